@@ -32,17 +32,3 @@ set(BUILD_DSA_C_GTESTS OFF CACHE BOOL "" FORCE)
 
 # Make available then include
 FetchContent_MakeAvailable(c_dsa)
-
-
-# Fetch the thread pool api
-FetchContent_Declare(
-        thpool
-        GIT_REPOSITORY https://github.com/majordoobie/thread_pool_c
-        GIT_TAG v0.0.2
-)
-
-# Disable building thpool gtests
-set(BUILD_THPOOL_GTEST OFF CACHE BOOL "" FORCE)
-# Make available then include
-FetchContent_MakeAvailable(thpool)
-
@@ -19,8 +19,12 @@ typedef enum
     MAX_FILE_SIZE       = 1016,
     DEFAULT_PORT        = 31337,
     CONNECTION_TIMEOUT  = 10,      // Socket timeout for a connected socket
+    ACCEPT_POLL_MS      = 250,     // Acceptors check for shutdown this often
     DEFAULT_TIMEOUT     = 60,      // Session timeout default
+    WORKERS_GROWTH      = 4,       // Default maximum of a pool, times its minimum
     MAX_TIMEOUT         = 300,     // Max timeout of 5 minutes
+    MAX_CACHE_MIB       = 1 << 20, // Max cache size of 1 TiB
+    MAX_MEMORY_MIB      = 1 << 20, // Max memory budget of 1 TiB
 } server_defaults_t;
 
 // header_sizes_t defines the amount of bytes that the field takes in the
@@ -62,6 +66,10 @@ typedef enum
     OP_USER_NO_EXIST       = 14,
     OP_FILE_EMPTY          = 15,
     OP_DIR_EMPTY           = 16,
+    OP_HASH_MISMATCH       = 17,
+    OP_CODEC_ERROR         = 18,
+    OP_HASH_UNKNOWN        = 19,
+    OP_SERVER_BUSY         = 20,
     OP_IO_ERROR            = 254,
     OP_FAILURE             = 255
 } ret_codes_t;
@@ -74,7 +82,10 @@ typedef enum
     ACT_GET_REMOTE_FILE         = 4,
     ACT_MAKE_REMOTE_DIRECTORY   = 5,
     ACT_PUT_REMOTE_FILE         = 6,
-    ACT_LOCAL_OPERATION         = 7
+    ACT_LOCAL_OPERATION         = 7,
+    ACT_PUT_BY_HASH             = 8, // PUT of a path and hash without the data
+    ACT_GET_SIGNATURE           = 9, // Block checksums of a file for a delta
+    ACT_PUT_DELTA               = 10 // Replace a file by a delta of its blocks
 } act_t;
 
 typedef enum
@@ -95,7 +106,8 @@ typedef struct
 {
     char *   p_username;
     perms_t  permission;
-    hash_t * p_hash;
+    hash_t   hash;
+    uint64_t rate;  // Bytes per second the user may transfer, 0 for the limit of its permission
 } user_account_t;
 
 #endif //BSLE_GALINDEZ_INCLUDE_SERVER_H_
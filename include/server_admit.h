@@ -0,0 +1,141 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_ADMIT_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_ADMIT_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_io.h>
+#include <server_sched.h>
+
+// Admission control of the requests. A request is admitted once its header
+// is read, before its payload is, as long as the server is within its
+// limits: the jobs waiting for the I/O workers of its lane, the requests
+// read and not answered yet and the payload bytes of those requests. A
+// request over a limit is turned away at once with OP_SERVER_BUSY instead of
+// waiting in a queue that only grows, so the requests admitted keep their
+// latency while the others are told when to come back.
+//
+// A request larger than the byte limit by itself is admitted while no other
+// payload is in flight, otherwise it could never be.
+//
+// Connections are admitted the same way when they are accepted. A
+// connection that would wait behind the queue limit for a network worker is
+// served by the workers of the turned away connections instead, which
+// answer its first request busy and close it. The answer goes out as soon
+// as the header of the request is read. At most ADMIT_SHED_DRAIN bytes of
+// the rest are read before the connection is closed, and connections past
+// ADMIT_SHED_QUEUE waiting for those workers are closed unanswered.
+//
+// The retry hint grows with how far the server is over the limit, from
+// ADMIT_RETRY_MS just over it up to ADMIT_RETRY_MAX_MS.
+#define ADMIT_RETRY_MS      100
+#define ADMIT_RETRY_MAX_MS  10000
+
+// Workers answering the connections turned away. They block reading the
+// requests so the pool grows to this many
+#define ADMIT_SHED_WORKERS  4
+
+// Connections waiting for the workers of the turned away connections
+#define ADMIT_SHED_QUEUE    64
+
+// Bytes read from a connection turned away after its answer, so the client
+// can read the answer before the connection is reset, and the seconds
+// spent reading them at most
+#define ADMIT_SHED_DRAIN    (64 * 1024)
+#define ADMIT_SHED_LINGER   1
+
+// v1 responses have no field for the hint, the reserved byte of a busy
+// response, which carries no data, holds it in this unit
+#define ADMIT_RETRY_UNIT_MS 100
+
+typedef struct admit admit_t;
+
+// Limits of the server, 0 for none
+typedef struct
+{
+    size_t      queued;     // Jobs waiting for a network worker or an I/O worker of the lane
+    size_t      requests;   // Requests read and not answered yet
+    uint64_t    bytes;      // Payload bytes of those requests
+} admit_limits_t;
+
+// Metrics of the admission control
+typedef struct
+{
+    size_t      requests;   // Requests in flight
+    uint64_t    bytes;      // Payload bytes in flight
+    uint64_t    admitted;   // Requests admitted since the start
+    uint64_t    shed;       // Requests and connections turned away since the start
+} admit_stats_t;
+
+/*!
+ * @brief Create the admission control of the server
+ *
+ * @param p_limits Pointer to the limits
+ * @param p_io Pointer to the I/O pool whose queues are limited. May be NULL
+ * @return admit_t object if successful otherwise NULL
+ */
+admit_t * admit_init(const admit_limits_t * p_limits, io_pool_t * p_io);
+
+/*!
+ * @brief Free the admission control
+ *
+ * @param pp_admit Double pointer to the admission control
+ */
+void admit_destroy(admit_t ** pp_admit);
+
+/*!
+ * @brief Admit a request whose header was read. An admitted request is
+ * counted in flight until admit_leave
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param lane Lane of the I/O workers answering the request
+ * @param payload_len Bytes of the payload of the request
+ * @param p_retry_ms Receives the milliseconds the client should wait before
+ * retrying if the request is turned away
+ * @retval OP_SUCCESS The request was admitted
+ * @retval OP_SERVER_BUSY The request is over a limit
+ */
+ret_codes_t admit_enter(admit_t * p_admit,
+                        io_lane_t lane,
+                        uint64_t payload_len,
+                        uint32_t * p_retry_ms);
+
+/*!
+ * @brief Admit a connection just accepted. Admitted connections are not
+ * counted, their requests are
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param p_workers Pointer to the network workers the connection goes to
+ * @param p_retry_ms Receives the milliseconds the client should wait before
+ * retrying if the connection is turned away
+ * @retval OP_SUCCESS The connection was admitted
+ * @retval OP_SERVER_BUSY The workers have too many connections waiting
+ */
+ret_codes_t admit_connection(admit_t * p_admit, sched_t * p_workers, uint32_t * p_retry_ms);
+
+/*!
+ * @brief Count an admitted request out once it is answered
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param payload_len Bytes of the payload the request was admitted with
+ */
+void admit_leave(admit_t * p_admit, uint64_t payload_len);
+
+/*!
+ * @brief Read the metrics of the admission control
+ *
+ * @param p_admit Pointer to the admission control
+ * @param p_stats Receives the metrics
+ */
+void admit_stats(admit_t * p_admit, admit_stats_t * p_stats);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_ADMIT_H_
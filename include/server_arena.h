@@ -0,0 +1,119 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_ARENA_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_ARENA_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server_mem.h>
+#include <server_file_api.h>
+
+// Every object of a request lives until the response has been written, so
+// the objects are carved out of blocks owned by the connection and released
+// all at once when the next request starts. Blocks are kept across resets,
+// which leaves the allocator out of the handling of most requests.
+//
+// Allocations larger than a block, such as the data of a PUT, get a block
+// of their own that is freed on reset. Those blocks are reserved against the
+// memory budget of the arena first, and arena_map backs the data the budget
+// has no room for with a temp file instead. Buffers allocated elsewhere can be
+// handed to the arena with arena_own to be freed on reset as well, and any
+// other resource with arena_defer. arena_reserve holds bytes of a budget
+// for such buffers until the reset.
+#define ARENA_BLOCK_SIZE    16384
+
+typedef struct arena arena_t;
+
+/*!
+ * @brief Create an arena
+ *
+ * @param block_size Number of bytes of each block. 0 uses ARENA_BLOCK_SIZE
+ * @param p_mem Memory budget the allocations larger than a block are
+ * reserved against. May be NULL
+ * @return arena_t object if successful otherwise NULL
+ */
+arena_t * arena_init(size_t block_size, mem_budget_t * p_mem);
+
+/*!
+ * @brief Allocate zeroed memory aligned for any type. The memory is valid
+ * until the arena is reset or destroyed. An allocation larger than a block
+ * waits up to MEM_WAIT_MS for room in the memory budget.
+ *
+ * @param p_arena Pointer to the arena
+ * @param size Number of bytes to allocate
+ * @return Pointer to the memory if successful otherwise NULL
+ */
+void * arena_alloc(arena_t * p_arena, size_t size);
+
+/*!
+ * @brief Allocate memory backed by an unnamed temp file in the directory
+ * instead of the heap, for data the memory budget has no room for. The
+ * pages are written back to the file and dropped under memory pressure.
+ * The memory is valid until the arena is reset or destroyed.
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_dir Pointer to the verified_path_t of the directory
+ * @param size Number of bytes to allocate, at least 1
+ * @return Pointer to the memory if successful otherwise NULL
+ */
+void * arena_map(arena_t * p_arena, verified_path_t * p_dir, size_t size);
+
+/*!
+ * @brief Free the heap memory with free when the arena is reset or
+ * destroyed
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_mem Pointer to memory allocated with malloc. May be NULL
+ * @return True if the arena owns the memory. The memory is not freed
+ * otherwise
+ */
+bool arena_own(arena_t * p_arena, void * p_mem);
+
+/*!
+ * @brief Call the function with its argument when the arena is reset or
+ * destroyed, before the memory of the arena is released
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_release Function releasing the resource
+ * @param p_arg Argument of the function
+ * @return True if the function will be called. It is not called otherwise
+ */
+bool arena_defer(arena_t * p_arena, void (* p_release)(void *), void * p_arg);
+
+/*!
+ * @brief Reserve bytes of a memory budget for a buffer that is not carved
+ * out of the arena but lives as long as its allocations. The bytes are
+ * given back when the arena is reset or destroyed
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes to reserve
+ * @param wait_ms Milliseconds to wait for the bytes to fit
+ * @return True if the bytes were reserved otherwise false
+ */
+bool arena_reserve(arena_t * p_arena, mem_budget_t * p_mem, size_t size, uint32_t wait_ms);
+
+/*!
+ * @brief Release every allocation of the arena. Blocks are kept for the
+ * allocations that follow
+ *
+ * @param p_arena Pointer to the arena
+ */
+void arena_reset(arena_t * p_arena);
+
+/*!
+ * @brief Release every allocation of the arena and free it
+ *
+ * @param pp_arena Double pointer to the arena
+ */
+void arena_destroy(arena_t ** pp_arena);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_ARENA_H_
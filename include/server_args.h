@@ -16,12 +16,42 @@ extern "C" {
 #include <utils.h>
 #include <server.h>
 #include <server_file_api.h>
+#include <server_cache.h>
+#include <server_sched.h>
+#include <server_shape.h>
+#include <server_admit.h>
+#include <server_mem.h>
+
+// Users -l may give a rate of their own to in one run
+#define MAX_USER_LIMITS 32
+
+typedef struct
+{
+    char        username[MAX_USERNAME_LEN + 1];
+    uint64_t    rate;       // Bytes per second, 0 to go back to the limit of the permission
+} user_limit_t;
 
 typedef struct
 {
     uint32_t            port;
     uint8_t             timeout;
     verified_path_t *   p_home_directory;
+    sync_mode_t         durability;
+    uint16_t            net_workers;
+    uint16_t            net_workers_max;    // Network workers the pool may grow to
+    uint16_t            io_workers;
+    uint16_t            io_workers_max;     // I/O workers the pool may grow to
+    uint16_t            bulk_workers;       // I/O workers of the bulk lane
+    uint16_t            bulk_workers_max;
+    uint16_t            acceptors;  // Threads accepting connections
+    bool                b_per_core; // One acceptor and its workers per CPU
+    size_t              cache_size;
+    bool                b_chunks;   // Store new files as chunks
+    shape_limits_t      limits;     // Bandwidth limits of the server, connections and permissions
+    size_t              user_limit_count;
+    user_limit_t        user_limits[MAX_USER_LIMITS]; // Saved to the accounts of the users
+    admit_limits_t      admission;  // Limits past which requests are turned away
+    uint64_t            memory;     // Bytes of the buffers of the requests, 0 for no limit
 } args_t;
 
 void args_destroy(args_t ** pp_args);
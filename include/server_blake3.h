@@ -0,0 +1,78 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_BLAKE3_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_BLAKE3_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BLAKE3_OUT_LEN      32
+#define BLAKE3_BLOCK_LEN    64
+#define BLAKE3_CHUNK_LEN    1024
+#define BLAKE3_MAX_DEPTH    54
+
+// State of the chunk currently being compressed. The last block of a chunk
+// is kept in the buffer until more input arrives because the final block of
+// the final chunk is compressed with different flags.
+typedef struct
+{
+    uint32_t    cv[8];
+    uint64_t    chunk_counter;
+    uint8_t     buf[BLAKE3_BLOCK_LEN];
+    uint8_t     buf_len;
+    uint8_t     blocks_compressed;
+} blake3_chunk_t;
+
+// Incremental BLAKE3 hasher in the default (unkeyed) mode. The chaining
+// values of completed subtrees are kept on a stack so the hasher never
+// allocates and can live on the stack of the caller.
+typedef struct
+{
+    blake3_chunk_t  chunk;
+    uint8_t         cv_stack_len;
+    uint32_t        cv_stack[BLAKE3_MAX_DEPTH][8];
+} blake3_hasher_t;
+
+/*!
+ * @brief Initialize the hasher
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t to initialize
+ */
+void blake3_init(blake3_hasher_t * p_hasher);
+
+/*!
+ * @brief Add the bytes to the running hash. Runs of whole chunks are hashed
+ * several at a time with AVX2 when the processor supports it.
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t object
+ * @param p_input Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ */
+void blake3_update(blake3_hasher_t * p_hasher, const uint8_t * p_input, size_t length);
+
+/*!
+ * @brief Write the 32 byte digest of everything added so far. The hasher is
+ * not modified so more input may be added afterwards.
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t object
+ * @param p_out Buffer of BLAKE3_OUT_LEN bytes receiving the digest
+ */
+void blake3_final(const blake3_hasher_t * p_hasher, uint8_t * p_out);
+
+/*!
+ * @brief Choose between the AVX2 and the portable implementation. Only used
+ * to compare both implementations; by default the AVX2 implementation is
+ * used whenever the processor supports it.
+ *
+ * @param b_enable false to force the portable implementation
+ * @return true if the AVX2 implementation is used after the call
+ */
+bool blake3_use_simd(bool b_enable);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_BLAKE3_H_
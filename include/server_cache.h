@@ -0,0 +1,109 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_CACHE_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_CACHE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_file_api.h>
+
+// Compressed representations of files are kept in CACHE_DIR under the home
+// directory. Every entry holds the frames of one file version compressed
+// with one codec and is named after the digest of the uncompressed file:
+//
+//      <hex digest>.<hash_alg>.<codec>
+//
+// Entries never change once they are written so a digest always names the
+// same bytes.
+#define CACHE_DIR           ".cape/cache"
+#define CACHE_DEFAULT_SIZE  ((size_t)256 << 20)
+
+// Fills waiting for the background worker. Further misses are not cached
+// until the queue drains
+#define CACHE_QUEUE_SIZE    16
+
+typedef struct cache cache_t;
+
+// Identifies a compressed representation
+typedef struct
+{
+    hash_t      hash;   // Digest of the uncompressed file
+    hash_alg_t  alg;    // Algorithm the digest was computed with
+    codec_t     codec;  // Codec of the representation
+} cache_key_t;
+
+/*!
+ * @brief Open the cache in the home directory, creating CACHE_DIR if needed.
+ * Entries left by a previous run are kept, oldest first in the eviction
+ * order, and a worker thread is started to fill the cache in the background.
+ *
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param capacity Maximum number of bytes of all entries together
+ * @return cache_t object if successful otherwise NULL
+ */
+cache_t * cache_init(verified_path_t * p_home_dir, size_t capacity);
+
+/*!
+ * @brief Stop the worker and free the cache. Fills still queued are dropped,
+ * a fill that is running is allowed to finish.
+ *
+ * @param pp_cache Double pointer to the cache object
+ */
+void cache_destroy(cache_t ** pp_cache);
+
+/*!
+ * @brief Open the representation if it is cached and mark it as the most
+ * recently used entry
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_key Pointer to the key of the representation
+ * @param p_size Pointer receiving the size of the representation
+ * @return f_stream_t of the frames or NULL on a miss
+ */
+f_stream_t * cache_open(cache_t * p_cache, const cache_key_t * p_key, size_t * p_size);
+
+/*!
+ * @brief Queue the compression of the source into the cache. The worker
+ * compresses the source into a temp file and links it into place once it
+ * is complete, evicting the least recently used entries to make room.
+ * Nothing is queued if the representation is already cached or queued or
+ * if the queue is full.
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_key Pointer to the key of the representation. The digest must
+ * be the digest of the source
+ * @param pp_source Double pointer to the source. The cache takes ownership
+ * of the stream and sets the pointer to NULL in every case
+ * @param length Number of bytes of the source
+ * @return true if the fill was queued otherwise false
+ */
+bool cache_fill(cache_t * p_cache,
+                const cache_key_t * p_key,
+                f_stream_t ** pp_source,
+                size_t length);
+
+/*!
+ * @brief Block until every queued fill has completed
+ *
+ * @param p_cache Pointer to the cache object
+ */
+void cache_wait(cache_t * p_cache);
+
+/*!
+ * @brief Get the number of bytes used by the cached entries
+ *
+ * @param p_cache Pointer to the cache object
+ * @return Bytes used
+ */
+size_t cache_usage(cache_t * p_cache);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_CACHE_H_
@@ -0,0 +1,173 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_CHUNKS_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_CHUNKS_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_file_api.h>
+
+// Files can be stored as the list of their chunks instead of their bytes.
+// Files are cut into chunks at boundaries picked by their content (FastCDC)
+// so an edit only changes the chunks around it, and every distinct chunk is
+// kept once in CHUNKS_DIR named after its BLAKE3 digest:
+//
+//      CHUNKS_DIR/<first byte of the digest in hex>/<hex digest>
+//
+// The file itself is replaced by a manifest listing its chunks:
+//
+//      MAGIC (8) | STORE_ID (16) | COUNT (8) | FILE_SIZE (8)
+//      { DIGEST (32) | LENGTH (4) } * COUNT
+//
+// All integers are big endian. The manifest is padded with a hole to
+// FILE_SIZE so listings and file identities see the size of the file.
+// Manifests only count as such when they carry the random id of the store,
+// so uploaded files do not pose as manifests by accident.
+//
+// Every manifest inode holds one reference on each of its chunks, as does
+// every open stream of a manifest. Chunks are removed when their last
+// reference is released. The references are counted in memory and rebuilt
+// from the manifests in the home directory when the store is opened.
+#define CHUNKS_DIR          ".cape/chunks"
+#define CHUNK_MIN_SIZE      2048
+#define CHUNK_AVG_SIZE      8192
+#define CHUNK_MAX_SIZE      65536
+
+#define CHUNK_MANIFEST_HEADER   40
+#define CHUNK_MANIFEST_ENTRY    (H_HASH_LEN + 4)
+
+// Chunks opened and advised ahead of a read of a manifest
+#define CHUNK_READAHEAD     32
+
+typedef struct chunks chunks_t;
+
+/*!
+ * @brief Open the chunk store in the home directory and count the
+ * references of its chunks. Chunks no manifest refers to, left by an
+ * interrupted write, are removed.
+ *
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param b_store Store new files as chunks. When false the store only
+ * serves the files already stored in it
+ * @return chunks_t object if successful otherwise NULL
+ */
+chunks_t * chunks_init(verified_path_t * p_home_dir, bool b_store);
+
+/*!
+ * @brief Free the chunk store. Every stream of a manifest must be closed
+ *
+ * @param pp_chunks Double pointer to the chunk store
+ */
+void chunks_destroy(chunks_t ** pp_chunks);
+
+/*!
+ * @brief Find the end of the first chunk of the bytes
+ *
+ * @param p_bytes Pointer to the bytes
+ * @param length Number of bytes
+ * @return Length of the chunk. Bytes are only cut short of CHUNK_MAX_SIZE
+ * at a content boundary or at the end of the bytes
+ */
+size_t chunks_cut(const uint8_t * p_bytes, size_t length);
+
+/*!
+ * @brief Create the file with the bytes. Without a store, or if the store
+ * does not take new files, the file is created with f_create_file.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t of the file to create
+ * @param p_bytes Pointer to the bytes of the file
+ * @param length Number of bytes
+ * @param p_sync Sync object deciding how the file is flushed. May be NULL
+ * @param p_id Pointer receiving the identity of the file or NULL
+ * @retval OP_SUCCESS The file was created
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected a write
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_create_file(chunks_t * p_chunks,
+                               verified_path_t * p_path,
+                               uint8_t * p_bytes,
+                               size_t length,
+                               sync_t * p_sync,
+                               f_file_id_t * p_id);
+
+/*!
+ * @brief Move the temp stream over the path. If the store takes new files
+ * the stream is stored as chunks and its manifest moved instead. The chunks
+ * of the file that was replaced are released.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_temp Pointer to a f_stream_t created with f_stream_temp_for
+ * @param length Number of bytes of the stream
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_sync Sync object deciding how the file is flushed. May be NULL
+ * @param p_id Pointer receiving the identity of the new file or NULL
+ * @retval OP_SUCCESS The file was replaced
+ * @retval OP_IO_ERROR The disk rejected a write or the rename
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_replace_file(chunks_t * p_chunks,
+                                f_stream_t * p_temp,
+                                size_t length,
+                                verified_path_t * p_path,
+                                sync_t * p_sync,
+                                f_file_id_t * p_id);
+
+/*!
+ * @brief Make the stream of a manifest read the file it describes. The
+ * stream holds the chunks until it is closed. Streams of other files are
+ * left as they are.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_source Pointer to a stream opened with f_stream_open
+ * @param size Size of the file of the stream
+ * @retval OP_SUCCESS The stream reads the file
+ * @retval OP_RESOLVE_ERROR The file was removed while it was opened
+ * @retval OP_IO_ERROR The manifest could not be read
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_stitch(chunks_t * p_chunks, f_stream_t * p_source, size_t size);
+
+/*!
+ * @brief Take the references of a file that was created as a copy of
+ * another, such as by dedup_link. Copies that share the inode of the
+ * original share its references.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t of the copy
+ * @retval OP_SUCCESS The copy holds its chunks
+ * @retval OP_RESOLVE_ERROR The chunks were released before the copy could
+ * take them. The copy must be removed
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_adopt(chunks_t * p_chunks, verified_path_t * p_path);
+
+/*!
+ * @brief Delete the file or directory with f_del_file. The chunks of a
+ * manifest are released when its last name is removed.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t to delete
+ * @return Result of f_del_file
+ */
+ret_codes_t chunks_del_file(chunks_t * p_chunks, verified_path_t * p_path);
+
+/*!
+ * @brief Get the number of chunks in the store
+ *
+ * @param p_chunks Pointer to the chunk store
+ * @return Number of chunks
+ */
+size_t chunks_count(chunks_t * p_chunks);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_CHUNKS_H_
@@ -0,0 +1,158 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_COMPRESS_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_COMPRESS_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <server.h>
+
+// Codec negotiated by the client in bits 4-7 of the request flags and
+// echoed in the high nibble of the response reserved byte
+typedef enum
+{
+    CODEC_NONE  = 0,    // Data is sent as is
+    CODEC_ZLIB  = 1,    // zlib streams. Only available when built with zlib
+    CODEC_LZ4   = 2     // LZ4 blocks. Always available
+} codec_t;
+
+#define CODEC_SHIFT         4
+#define CODEC_MASK          0x0F
+
+// Compressed data is a sequence of frames so it can be produced and
+// consumed one chunk at a time. Every frame holds at most
+// COMPRESS_FRAME_SIZE bytes of the original data and starts with a header
+// of two big endian 32 bit lengths:
+//
+//      [RAW_LEN][BODY_LEN][BODY]
+//
+// A frame whose BODY_LEN equals its RAW_LEN is stored uncompressed.
+#define COMPRESS_FRAME_SIZE     (1 << 20)
+#define COMPRESS_FRAME_HEADER   8
+
+/*!
+ * @brief Get the codec requested in the flags of a request
+ *
+ * @param flags Flags of the request in host byte order
+ * @return Codec requested by the client
+ */
+codec_t compress_codec(uint16_t flags);
+
+/*!
+ * @brief Check if the codec can be used by this build of the server
+ *
+ * @param codec Codec to check
+ * @return true if data can be compressed and decompressed with the codec
+ */
+bool compress_supported(codec_t codec);
+
+/*!
+ * @brief Compress the bytes into a single frame. The frame is stored
+ * uncompressed if compressing does not make it smaller.
+ *
+ * @param codec Codec to compress with
+ * @param p_raw Pointer to the bytes to compress. May be NULL if raw_len is 0
+ * @param raw_len Number of bytes to compress. At most COMPRESS_FRAME_SIZE
+ * @param p_frame Buffer of at least COMPRESS_FRAME_HEADER + raw_len bytes
+ * receiving the frame
+ * @param p_frame_len Pointer receiving the size of the frame
+ * @retval OP_SUCCESS The frame was written
+ * @retval OP_FAILURE The codec is not supported or the arguments are invalid
+ */
+ret_codes_t compress_frame(codec_t codec,
+                           const uint8_t * p_raw,
+                           size_t raw_len,
+                           uint8_t * p_frame,
+                           size_t * p_frame_len);
+
+/*!
+ * @brief Get the most bytes compress_buffer allocates for the bytes. Stored
+ * frames are the worst case so the frames never exceed the input plus one
+ * header per frame
+ *
+ * @param raw_len Number of bytes to compress
+ * @return Number of bytes of the buffer of the frames
+ */
+size_t compress_bound(size_t raw_len);
+
+/*!
+ * @brief Compress the bytes into a newly allocated sequence of frames
+ *
+ * @param codec Codec to compress with
+ * @param p_raw Pointer to the bytes to compress
+ * @param raw_len Number of bytes to compress
+ * @param pp_out Double pointer receiving the frames. Free with free
+ * @param p_out_len Pointer receiving the number of bytes in the frames
+ * @retval OP_SUCCESS The bytes were compressed
+ * @retval OP_FAILURE The codec is not supported or memory ran out
+ */
+ret_codes_t compress_buffer(codec_t codec,
+                            const uint8_t * p_raw,
+                            size_t raw_len,
+                            uint8_t ** pp_out,
+                            size_t * p_out_len);
+
+/*!
+ * @brief Validate a sequence of frames and get the number of bytes they
+ * decompress to, so the output can be reserved before it is allocated
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames. May be NULL if frames_len is 0
+ * @param frames_len Number of bytes in the frames
+ * @param p_out_len Pointer receiving the number of bytes of the data
+ * @retval OP_SUCCESS The frames are valid
+ * @retval OP_CODEC_ERROR The codec is not supported or the frames are corrupt
+ * @retval OP_FAILURE Invalid arguments
+ */
+ret_codes_t decompress_size(codec_t codec,
+                            const uint8_t * p_frames,
+                            size_t frames_len,
+                            size_t * p_out_len);
+
+/*!
+ * @brief Decompress a sequence of frames validated with decompress_size
+ * into the memory provided
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames
+ * @param frames_len Number of bytes in the frames
+ * @param p_out Pointer to the memory receiving the data, of the size given
+ * by decompress_size
+ * @retval OP_SUCCESS The frames were decompressed
+ * @retval OP_CODEC_ERROR The frames are corrupt
+ */
+ret_codes_t decompress_into(codec_t codec,
+                            const uint8_t * p_frames,
+                            size_t frames_len,
+                            uint8_t * p_out);
+
+/*!
+ * @brief Decompress a sequence of frames into a newly allocated buffer.
+ * Every frame is validated before anything is allocated and frames that
+ * claim more data than their codec can produce from their body are
+ * rejected, so the output is bounded by the size of the input.
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames. May be NULL if frames_len is 0
+ * @param frames_len Number of bytes in the frames
+ * @param pp_out Double pointer receiving the data. Set to NULL when the
+ * frames hold no data. Free with free
+ * @param p_out_len Pointer receiving the number of bytes decompressed
+ * @retval OP_SUCCESS The frames were decompressed
+ * @retval OP_CODEC_ERROR The codec is not supported or the frames are corrupt
+ * @retval OP_FAILURE Memory ran out
+ */
+ret_codes_t decompress_buffer(codec_t codec,
+                              const uint8_t * p_frames,
+                              size_t frames_len,
+                              uint8_t ** pp_out,
+                              size_t * p_out_len);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_COMPRESS_H_
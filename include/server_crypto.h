@@ -5,19 +5,54 @@ extern "C" {
 #endif //END __cplusplus
 // HEADER GUARD
 #include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <sys/stat.h>
 
 #include <utils.h>
+#include <server_blake3.h>
 
+// 32 byte digest of any hash_alg_t held inline so hashing never allocates
+// the result
 typedef struct
 {
-    size_t      size;
-    uint8_t *   array;
+    uint8_t     array[SHA256_DIGEST_LENGTH];
 } hash_t;
 
+// Hash algorithm negotiated by the client in the low nibble of the request
+// flags and echoed in the reserved byte of the response. The hash is only
+// used for transfer integrity so the faster algorithms are safe to offer.
+typedef enum
+{
+    HASH_ALG_SHA256 = 0,    // Single sha256 over the whole stream
+    HASH_ALG_TREE   = 1,    // sha256 Merkle root over HASH_TREE_LEAF_SIZE leaves
+    HASH_ALG_BLAKE3 = 2     // BLAKE3 with a 32 byte output
+} hash_alg_t;
+
+// Incremental hash context used to hash streams that are not held in
+// memory all at once. It lives wherever the caller puts it, usually the
+// stack, and must be finished with hash_stream_final. The sha256 context is
+// taken from a cache of the thread and given back when the stream finishes,
+// so once the cache is warm starting a stream does not allocate.
+typedef struct
+{
+    hash_alg_t          alg;
+    EVP_MD_CTX *        p_ctx;
+    blake3_hasher_t     blake3;
+    bool                b_open;
+} hash_stream_t;
+
+#define HASH_ALG_MASK       0x0F
+#define HASH_TREE_LEAF_SIZE (1 << 20)
+
+// Merkle tree over a stream split into fixed HASH_TREE_LEAF_SIZE leaves.
+// Leaves are hashed as sha256(0x00 || leaf) and nodes as
+// sha256(0x01 || left || right). A node without a sibling is promoted to the
+// next level unchanged. An empty stream is a single empty leaf.
+typedef struct hash_tree hash_tree_t;
+
 /*!
  * @brief Function takes a hash_t object and compares it against a hexadecimal
  * string that represents the p_hash to ensure they are the same.
@@ -27,33 +62,74 @@ typedef struct
  * @param length Length of the hexadecimal representation
  * @return True if hashes match else false
  */
-bool hash_pass_match(hash_t * p_hash, const char * p_input, size_t length);
+bool hash_pass_match(const hash_t * p_hash, const char * p_input, size_t length);
 
 /*!
- * @brief Hash the given byte array into a sha256 hash and return a hash_t
- * structure containing the byte array and its size
+ * @brief Hash the given byte array into a sha256 hash. The hash is computed
+ * with a sha256 context kept per thread so no memory is allocated after the
+ * first call on a thread.
  *
- * @param p_byte_array Pointer to the bytearray to hash
+ * @param p_byte_array Pointer to the bytearray to hash. May be NULL if the
+ * length is 0
  * @param length Length of the bytearray to hash
- * @return hash_t object if successful or a NULL
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
+ */
+bool hash_byte_array(const uint8_t * p_byte_array, size_t length, hash_t * p_hash);
+
+/*!
+ * @brief Hash the byte array with the algorithm negotiated by the client.
+ * HASH_ALG_TREE hashes the leaves with hash_tree_fill, on the calling thread
+ * and the workers of the leaf pool shared by the whole process.
+ *
+ * @param alg Algorithm to hash with
+ * @param p_bytes Pointer to the bytes to hash. May be NULL if the length is 0
+ * @param length Number of bytes to hash
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
+ */
+bool hash_alg_bytes(hash_alg_t alg, const uint8_t * p_bytes, size_t length, hash_t * p_hash);
+
+/*!
+ * @brief Start an incremental hash. Only algorithms computed over the stream
+ * in order can be streamed which excludes HASH_ALG_TREE.
+ *
+ * @param p_stream Pointer to the hash_stream_t to initialize
+ * @param alg Algorithm to hash with
+ * @return true if successful otherwise false
+ */
+bool hash_stream_init(hash_stream_t * p_stream, hash_alg_t alg);
+
+/*!
+ * @brief Add the bytes to the running hash
+ *
+ * @param p_stream Pointer to the hash_stream_t object
+ * @param p_bytes Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ * @return true if successful otherwise false
  */
-hash_t * hash_byte_array(uint8_t * p_byte_array, size_t length);
+bool hash_stream_update(hash_stream_t * p_stream, const uint8_t * p_bytes, size_t length);
 
 /*!
- * @brief Free a hash_t object
+ * @brief Finish the running hash and release the context. The context is
+ * released even if the function fails. Passing a NULL p_hash only releases
+ * the context.
  *
- * @param pp_hash Pointer to the pp_hash object to free
+ * @param p_stream Pointer to the hash_stream_t object
+ * @param p_hash Pointer to the hash_t receiving the digest. May be NULL
+ * @return true if the digest was written otherwise false
  */
-void hash_destroy(hash_t ** pp_hash);
+bool hash_stream_final(hash_stream_t * p_stream, hash_t * p_hash);
 
 /*!
- * @brief Compare if the hashes of two hash_t objects match
+ * @brief Compare if two hashes match. The comparison takes the same time
+ * wherever the first difference is.
  *
  * @param p_lhash Pointer to a p_hash object
  * @param p_rhash Pointer to a p_hash object
  * @return true if hashes match else false
  */
-bool hash_hash_t_match(hash_t * p_lhash, hash_t * p_rhash);
+bool hash_match(const hash_t * p_lhash, const hash_t * p_rhash);
 
 /*!
  * @brief Compare the hash of the hash_t to the array passed in
@@ -63,19 +139,175 @@ bool hash_hash_t_match(hash_t * p_lhash, hash_t * p_rhash);
  * @param array_size The size of the p_array
  * @return true if hashes match else false
  */
-bool hash_bytes_match(hash_t * p_hash, uint8_t * p_array, size_t array_size);
+bool hash_bytes_match(const hash_t * p_hash, const uint8_t * p_array, size_t array_size);
 
 /*!
- * @brief Translate a hexadecimal hash back into a byte array. Every two
- * characters of a hexadecimal array represents one byte. The function
- * reads two characters at a time and converts it to the byte representation.
- * The result is a byte array.
+ * @brief Translate a hexadecimal hash back into a hash_t. Every two
+ * characters of the hexadecimal string represent one byte.
  *
  * @param p_hash_str Pointer to the hexadecimal string
- * @param hash_size Size of the hexadecimal string
- * @return hash_t object if successful otherwise NULL
+ * @param hash_size Size of the hexadecimal string. Must be twice the digest
+ * length
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
+ */
+bool hash_from_hex(const char * p_hash_str, size_t hash_size, hash_t * p_hash);
+
+/*!
+ * @brief Write the digest as a NUL terminated lowercase hexadecimal string
+ *
+ * @param p_hash Pointer to the hash_t to encode
+ * @param p_hex Buffer of at least (2 * sizeof(p_hash->array)) + 1 characters
+ * @return true if successful otherwise false
+ */
+bool hash_to_hex(const hash_t * p_hash, char * p_hex);
+
+/*!
+ * @brief Encode the bytes as lowercase hexadecimal. Blocks of 32 and 16
+ * bytes are encoded with AVX2 and SSE4.1 when the processor supports them.
+ * The output is not NUL terminated.
+ *
+ * @param p_bytes Pointer to the bytes to encode. May be NULL if the length
+ * is 0
+ * @param length Number of bytes to encode
+ * @param p_hex Buffer of at least 2 * length characters
+ * @return Number of characters written
+ */
+size_t hex_encode(const uint8_t * p_bytes, size_t length, char * p_hex);
+
+/*!
+ * @brief Decode a hexadecimal string of either case. Blocks of 64 and 32
+ * characters are decoded with AVX2 and SSE4.1 when the processor supports
+ * them.
+ *
+ * @param p_hex Pointer to the hexadecimal characters. May be NULL if the
+ * length is 0
+ * @param length Number of characters. Must be even
+ * @param p_bytes Buffer of at least length / 2 bytes
+ * @return true if successful or false if the length is odd or a character is
+ * not hexadecimal. The output is undefined on failure
+ */
+bool hex_decode(const char * p_hex, size_t length, uint8_t * p_bytes);
+
+/*!
+ * @brief Choose between the SIMD and the scalar hex codec. Only used to
+ * compare both implementations; by default the SIMD codec is used whenever
+ * the processor supports it.
+ *
+ * @param b_enable false to force the scalar codec
+ * @return true if a SIMD codec is used after the call
+ */
+bool hex_use_simd(bool b_enable);
+
+/*!
+ * @brief Create a tree for a stream of the given length. The leaf hashes are
+ * set with hash_tree_set_leaf before the root is computed.
+ *
+ * @param length Number of bytes in the stream
+ * @return hash_tree_t object if successful or NULL
+ */
+hash_tree_t * hash_tree_init(size_t length);
+
+/*!
+ * @brief Free the tree
+ *
+ * @param pp_tree Double pointer to the hash_tree_t object
+ */
+void hash_tree_destroy(hash_tree_t ** pp_tree);
+
+/*!
+ * @brief Get the length of the stream the tree was created for
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @return Number of bytes in the stream
+ */
+size_t hash_tree_length(hash_tree_t * p_tree);
+
+/*!
+ * @brief Get the number of leaves of the tree
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @return Number of leaves
+ */
+size_t hash_tree_leaf_count(hash_tree_t * p_tree);
+
+/*!
+ * @brief Hash the bytes of a leaf into the tree. Leaves are independent of
+ * each other so different leaves may be set from different threads.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @param p_bytes Pointer to the bytes of the leaf
+ * @param length Number of bytes in the leaf. Must match the leaf size
+ * @return true if successful otherwise false
+ */
+bool hash_tree_set_leaf(hash_tree_t * p_tree,
+                        size_t index,
+                        const uint8_t * p_bytes,
+                        size_t length);
+
+/*!
+ * @brief Get the hash of a leaf. Used to verify a single range of the
+ * stream without reading the rest of it.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @return Pointer to the leaf hash owned by the tree or NULL if the index is
+ * out of range
+ */
+const hash_t * hash_tree_leaf(hash_tree_t * p_tree, size_t index);
+
+/*!
+ * @brief Combine the leaf hashes into the root of the tree
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param p_hash Pointer to the hash_t receiving the root
+ * @return true if successful otherwise false
+ */
+bool hash_tree_root(hash_tree_t * p_tree, hash_t * p_hash);
+
+// Hashes the leaf at the index into the tree. Called from the calling
+// thread of hash_tree_fill or a worker of the shared pool
+typedef bool (* hash_leaf_t)(hash_tree_t * p_tree, size_t index, void * p_ctx);
+
+/*!
+ * @brief Set every leaf of the tree with the callback. The calling thread
+ * hashes leaves together with up to threads - 1 workers of a pool of one
+ * thread per online processor shared by the whole process, so concurrent
+ * requests share a fixed number of threads instead of starting their own.
+ * Leaves are taken in order and the first failure stops the others.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @param leaf Callback hashing the leaf at the index into the tree
+ * @param p_ctx Context passed to the callback
+ * @return true if every leaf was set otherwise false
+ */
+bool hash_tree_fill(hash_tree_t * p_tree, uint8_t threads, hash_leaf_t leaf, void * p_ctx);
+
+/*!
+ * @brief Compute the tree root of the byte array. The leaves are hashed
+ * with hash_tree_fill.
+ *
+ * @param p_bytes Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @param p_hash Pointer to the hash_t receiving the root
+ * @return true if successful otherwise false
+ */
+bool hash_tree_bytes(const uint8_t * p_bytes,
+                     size_t length,
+                     uint8_t threads,
+                     hash_t * p_hash);
+
+/*!
+ * @brief Get the number of threads to use for tree hashing when the caller
+ * does not specify one
+ *
+ * @param leaves Number of leaves to hash
+ * @return Number of online processors capped by the number of leaves
  */
-hash_t * hex_char_to_byte_array(const char * p_hash_str, size_t hash_size);
+uint8_t hash_tree_threads(size_t leaves);
 
 // HEADER GUARD
 #ifdef __cplusplus
@@ -9,6 +9,9 @@ extern "C" {
 #include <time.h>
 
 #include <server_db.h>
+#include <server_xfer.h>
+#include <server_delta.h>
+#include <server_arena.h>
 
 
 typedef enum
@@ -44,9 +47,11 @@ typedef struct
 
 typedef struct
 {
+    uint8_t         version;        // Framing the request was read with
+    uint32_t        request_id;     // Echoed in the response of v2 requests
     act_t           opt_code;       // 1 byte
     usr_act_t       user_flag;      // 1 byte
-    uint16_t        _reserved;
+    uint16_t        flags;          // Low nibble selects the hash_alg_t
     uint16_t        username_len;
     uint16_t        passwd_len;
     uint32_t        session_id;
@@ -55,6 +60,9 @@ typedef struct
     uint64_t        payload_len;  // Size of everything but wire header
 
     payload_type_t type;
+    arena_t *      p_arena;     // Owns the members and the response if set
+    shape_bucket_t * p_bucket;  // Bucket of the user once authenticated if it has a limit
+    uint32_t       retry_ms;    // Wait the client is told to take if turned away
     union
     {
         std_payload_t *  p_std_payload;
@@ -63,10 +71,13 @@ typedef struct
 } wire_payload_t;
 
 /*!
- * @brief Destroy the payload and response objects
+ * @brief Destroy the payload and response objects. Members allocated from
+ * the arena of the payload are left to the arena, only the content of the
+ * response is destroyed.
  *
  * @param pp_payload Double pointer to the payload object
  * @param pp_res Double pointer to the response object
+ * @param free_wire_payload Free the payload object itself
  */
 void ctrl_destroy(wire_payload_t ** pp_payload,
                   act_resp_t ** pp_res,
@@ -85,7 +96,15 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
                                wire_payload_t * p_client_req,
                                time_t timeout);
 
-act_resp_t * ctrl_populate_resp(ret_codes_t code);
+/*!
+ * @brief Create a response holding only the code and its message
+ *
+ * @param p_arena Arena to allocate the response from. NULL allocates it
+ * with malloc
+ * @param code Result of the request
+ * @return Response object if successful otherwise NULL
+ */
+act_resp_t * ctrl_populate_resp(arena_t * p_arena, ret_codes_t code);
 
 // HEADER GUARD
 #ifdef __cplusplus
@@ -13,14 +13,32 @@ extern "C" {
 #include <server.h>
 #include <server_file_api.h>
 #include <server_crypto.h>
+#include <server_sync.h>
+#include <server_io.h>
+#include <server_cache.h>
+#include <server_dedup.h>
+#include <server_chunks.h>
+#include <server_session.h>
+#include <server_shape.h>
+#include <server_admit.h>
+#include <server_mem.h>
 #include <hashtable.h>
 
 //typedef struct
 typedef struct
 {
     htable_t *          users_htable;
-    htable_t *          sesh_htable;
+    sessions_t *        p_sessions;
     verified_path_t *   p_home_dir;
+    sync_t *            p_sync;   // Durability of every file written
+    io_pool_t *         p_io;     // File system operations run here if set
+    cache_t *           p_cache;  // Compressed GET data is cached here if set
+    dedup_t *           p_dedup;  // Files are indexed by digest here if set
+    chunks_t *          p_chunks; // Files are stored as chunks here if set
+    shaper_t *          p_shaper; // Bandwidth of the connections is shaped here if set
+    admit_t *           p_admit;  // Requests are admitted here if set
+    mem_budget_t *      p_mem;    // Buffers of the requests are reserved here if set
+    mem_budget_t *      p_spill;  // Data spilled to disk is reserved here if set
     bool                _debug;   // Used to assist in unit testing do not use
 } db_t;
 
@@ -38,9 +56,11 @@ typedef struct
  * the registered users along with their password hash and user permissions.
  *
  * @param p_home_dir Path to the home directory of the server
+ * @param durability Durability mode used for every file written through
+ * the database object
  * @return Hashtable object if successful or NULL if failure
  */
-db_t * db_init(verified_path_t * p_home_dir);
+db_t * db_init(verified_path_t * p_home_dir, sync_mode_t durability);
 
 /*!
  * @brief Update the database and hash file with the contents of the database
@@ -100,6 +120,19 @@ ret_codes_t db_create_user(db_t * p_db,
                            const char * passwd,
                            perms_t permission);
 
+/*!
+ * @brief Set the rate the user may transfer at. The rate is saved with the
+ * account
+ *
+ * @param p_db Pointer to the hashtable user database object
+ * @param username Pointer to the p_username
+ * @param rate Bytes per second, 0 for the limit of the permission of the user
+ * @retval OP_SUCCESS If the rate was set
+ * @retval OP_USER_NO_EXIST If the user does not exist
+ * @retval OP_FAILURE On server error
+ */
+ret_codes_t db_set_user_rate(db_t * p_db, const char * username, uint64_t rate);
+
 // HEADER GUARD
 #ifdef __cplusplus
 }
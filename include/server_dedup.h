@@ -0,0 +1,91 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_DEDUP_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_DEDUP_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_file_api.h>
+
+// Index of the files held by the server by the digest of their contents. A
+// PUT by hash whose digest is indexed is answered by linking the indexed
+// file to the new path instead of receiving the data again. Files are added
+// when they are uploaded or downloaded and checked against their identity
+// when they are used, so files deleted or replaced since then are a miss.
+//
+// Once the index holds DEDUP_MAX_ENTRIES digests new digests are not added
+#define DEDUP_MAX_ENTRIES   (1 << 18)
+
+typedef struct dedup dedup_t;
+
+/*!
+ * @brief Create an empty index
+ *
+ * @return dedup_t object if successful otherwise NULL
+ */
+dedup_t * dedup_init(void);
+
+/*!
+ * @brief Free the index
+ *
+ * @param pp_dedup Double pointer to the index
+ */
+void dedup_destroy(dedup_t ** pp_dedup);
+
+/*!
+ * @brief Index the file under its digest. A file already indexed under the
+ * digest is replaced by the newer one.
+ *
+ * @param p_dedup Pointer to the index
+ * @param alg Algorithm the digest was computed with
+ * @param p_hash Pointer to the digest of the contents of the file
+ * @param p_path Path of the file relative to the home directory
+ * @param p_id Pointer to the identity of the file that was hashed
+ */
+void dedup_add(dedup_t * p_dedup,
+               hash_alg_t alg,
+               const hash_t * p_hash,
+               const char * p_path,
+               const f_file_id_t * p_id);
+
+/*!
+ * @brief Create the destination as a link to the indexed file with the
+ * digest. Entries whose file is gone or has changed are dropped.
+ *
+ * @param p_dedup Pointer to the index
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param alg Algorithm the digest was computed with
+ * @param p_hash Pointer to the digest of the contents wanted
+ * @param p_dest Pointer to the verified_path_t of the file to create
+ * @param p_sync Sync object used to flush the new name. May be NULL
+ * @retval OP_SUCCESS The destination holds the contents of the digest
+ * @retval OP_HASH_UNKNOWN No file with the digest is held
+ * @retval OP_FILE_EXISTS A file already exists at the destination
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t dedup_link(dedup_t * p_dedup,
+                       verified_path_t * p_home_dir,
+                       hash_alg_t alg,
+                       const hash_t * p_hash,
+                       verified_path_t * p_dest,
+                       sync_t * p_sync);
+
+/*!
+ * @brief Get the number of digests in the index
+ *
+ * @param p_dedup Pointer to the index
+ * @return Number of digests
+ */
+size_t dedup_count(dedup_t * p_dedup);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_DEDUP_H_
@@ -0,0 +1,124 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_DELTA_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_DELTA_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_crypto.h>
+#include <server_file_api.h>
+
+// Files that already exist on the server are updated by sending only what
+// changed. The client asks for the signature of the file held by the
+// server, which is the weak and strong checksum of every block:
+//
+//      BLOCK_SIZE (4) | FILE_SIZE (8) | { WEAK (4) | STRONG (16) } * blocks
+//
+// The weak checksum is adler32 so the client can roll it over every offset
+// of its own file. The strong checksum is the first DELTA_STRONG_LEN bytes
+// of the block digest, sha256 unless BLAKE3 was requested. The last block
+// is short when the file size is not a multiple of the block size.
+//
+// The client answers with a delta that rebuilds its file from the blocks it
+// found and the bytes it did not find:
+//
+//      BLOCK_SIZE (4) | { OP (1) | ... } *
+//      DELTA_OP_COPY   INDEX (4) | COUNT (4)   Copy COUNT blocks from INDEX
+//      DELTA_OP_DATA   LENGTH (4) | BYTES      Literal bytes
+//
+// All integers are big endian.
+#define DELTA_MIN_BLOCK     2048
+#define DELTA_MAX_BLOCK     (1 << 17)
+#define DELTA_MAX_BLOCKS    (1 << 20)
+#define DELTA_STRONG_LEN    16
+#define DELTA_SIG_HEADER    12
+#define DELTA_SIG_ENTRY     (4 + DELTA_STRONG_LEN)
+
+// A delta may copy at most this many times the size of the file it is
+// applied to, which bounds the work a small delta can ask for
+#define DELTA_MAX_GROWTH    4
+
+typedef enum
+{
+    DELTA_OP_COPY = 0,
+    DELTA_OP_DATA = 1
+} delta_op_t;
+
+/*!
+ * @brief Get the block size of the signature of a file. The size grows with
+ * the square root of the file so that both the signature and the bytes
+ * resent around every change stay small.
+ *
+ * @param file_size Size of the file in bytes
+ * @return Block size in bytes
+ */
+size_t delta_block_size(size_t file_size);
+
+/*!
+ * @brief Get the length of the signature of a file
+ *
+ * @param file_size Size of the file in bytes
+ * @return Number of bytes of the signature
+ */
+size_t delta_signature_len(size_t file_size);
+
+/*!
+ * @brief Compute the adler32 weak checksum of the bytes
+ *
+ * @param p_bytes Pointer to the bytes
+ * @param length Number of bytes
+ * @return The checksum with the sum of sums in the high 16 bits
+ */
+uint32_t delta_weak(const uint8_t * p_bytes, size_t length);
+
+/*!
+ * @brief Compute the signature of the file
+ *
+ * @param p_base Pointer to the f_stream_t of the file
+ * @param base_size Number of bytes of the file
+ * @param alg Algorithm requested by the client. Picks the strong checksum
+ * @param pp_sig Double pointer receiving the allocated signature
+ * @param p_sig_len Pointer receiving the length of the signature
+ * @retval OP_SUCCESS The signature was computed
+ * @retval OP_IO_ERROR The file could not be read
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t delta_signature(f_stream_t * p_base,
+                            size_t base_size,
+                            hash_alg_t alg,
+                            uint8_t ** pp_sig,
+                            size_t * p_sig_len);
+
+/*!
+ * @brief Rebuild the file described by the delta into the output stream.
+ * The blocks are copied from the base file.
+ *
+ * @param p_base Pointer to the f_stream_t of the base file
+ * @param base_size Number of bytes of the base file
+ * @param p_delta Pointer to the delta
+ * @param delta_len Length of the delta
+ * @param p_out Pointer to the f_stream_t the file is written to
+ * @param p_hash Running hash updated with the bytes written or NULL
+ * @param p_out_len Pointer receiving the number of bytes written
+ * @retval OP_SUCCESS The file was rebuilt
+ * @retval OP_IO_ERROR The base could not be read or the output written
+ * @retval OP_FAILURE The delta is malformed or refers past the base
+ */
+ret_codes_t delta_apply(f_stream_t * p_base,
+                        size_t base_size,
+                        const uint8_t * p_delta,
+                        size_t delta_len,
+                        f_stream_t * p_out,
+                        hash_stream_t * p_hash,
+                        size_t * p_out_len);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_DELTA_H_
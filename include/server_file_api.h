@@ -20,17 +20,54 @@ extern "C" {
 #include <utils.h>
 #include <server_crypto.h>
 #include <server.h>
+#include <server_sync.h>
+#include <server_compress.h>
 
 typedef struct verified_path verified_path_t;
 
+// Identity of the inode behind a path. Uploaded files are never modified in
+// place, so a path whose identity still matches holds the same bytes it
+// held when the identity was taken.
+typedef struct
+{
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+    nlink_t         nlink;  // Names of the inode, not part of the version
+} f_file_id_t;
+
+// Open file whose bytes are read on demand instead of held in memory
+typedef struct f_stream f_stream_t;
+
+// Reads of a stream whose bytes are not the bytes of its file, such as a
+// file stored as a list of chunks. The file still identifies the stream.
+// The context is shared by the copies of the stream made by f_stream_dup
+typedef struct
+{
+    ssize_t (* read_at)(void * p_ctx, uint8_t * p_buffer, size_t length, size_t offset);
+    void *  (* dup)(void * p_ctx);      // Returns the context of the copy
+    void    (* release)(void * p_ctx);  // Called when a stream is closed
+} f_stream_ops_t;
+
 // Structure is used when reading contents. It holds the file byte stream
-// along with its hash, its path and the streams size.
+// along with its hash, its path and the streams size. Streamed files set
+// p_source instead of p_stream and fill in the hash once the file has been
+// read. hash_alg is the algorithm the hash was computed with. The bytes are
+// compressed frames when codec is not CODEC_NONE, the hash is always over
+// the uncompressed bytes. A non zero raw_size means p_source holds the
+// uncompressed file which is compressed into stream_size bytes of frames
+// while it is sent.
 typedef struct
 {
-    hash_t *    p_hash;
-    uint8_t *   p_stream;
-    size_t      stream_size;
-    char *      p_path;
+    hash_t          hash;
+    hash_alg_t      hash_alg;
+    codec_t         codec;
+    uint8_t *       p_stream;
+    size_t          stream_size;
+    size_t          raw_size;
+    char *          p_path;
+    f_stream_t *    p_source;
 } file_content_t;
 
 /*!
@@ -152,16 +189,254 @@ void f_destroy_content(file_content_t ** pp_content);
  */
 file_content_t * f_read_file(verified_path_t * p_path, ret_codes_t * p_code);
 
+/*!
+ * @brief Open the verified file path for streaming. Unlike f_read_file the
+ * contents are not loaded or hashed, the returned object has p_source set
+ * and its bytes are pulled with f_stream_read_at.
+ *
+ * @param p_path Pointer to a verified_path_t object
+ * @param p_code Pointer to save the result of the operation to
+ * @return file_content_t object if successful, otherwise NULL
+ */
+file_content_t * f_stream_file(verified_path_t * p_path, ret_codes_t * p_code);
+
+/*!
+ * @brief Open the regular file at the verified path for reading with
+ * f_stream_read_at
+ *
+ * @param p_path Pointer to a verified_path_t object
+ * @param p_size Pointer receiving the size of the file
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object if successful, otherwise NULL
+ */
+f_stream_t * f_stream_open(verified_path_t * p_path, size_t * p_size, ret_codes_t * p_code);
+
+/*!
+ * @brief Open a second descriptor of the stream. The copy reads the same
+ * file even if the path is replaced in the meantime, so work on the file
+ * can outlive the request that opened it.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @return f_stream_t object if successful, otherwise NULL
+ */
+f_stream_t * f_stream_dup(f_stream_t * p_source);
+
+/*!
+ * @brief Get the identity of the file the stream reads
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_id Pointer receiving the identity
+ * @return true if successful otherwise false
+ */
+bool f_stream_id(f_stream_t * p_source, f_file_id_t * p_id);
+
+/*!
+ * @brief Read up to length bytes at the offset of the streamed file. Short
+ * reads are only returned at the end of the file.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_buffer Buffer to read into
+ * @param length Number of bytes to read
+ * @param offset Offset into the file to read from
+ * @return Number of bytes read or -1 on failure
+ */
+ssize_t f_stream_read_at(f_stream_t * p_source,
+                         uint8_t * p_buffer,
+                         size_t length,
+                         size_t offset);
+
+/*!
+ * @brief Serve the reads of the stream through the ops instead of reading
+ * its file. Streams with ops cannot be written, linked or replaced.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_ops Pointer to the ops. Must outlive the stream
+ * @param p_ctx Context passed to the ops. Released with the stream
+ * @return true if successful otherwise false
+ */
+bool f_stream_set_ops(f_stream_t * p_source, const f_stream_ops_t * p_ops, void * p_ctx);
+
+/*!
+ * @brief Tell the kernel that the range of the stream is about to be read
+ * so it can start reading it in the background
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param offset Offset of the range
+ * @param length Number of bytes of the range
+ */
+void f_stream_advise(f_stream_t * p_source, size_t offset, size_t length);
+
+/*!
+ * @brief Give the stream length bytes of disk and map them into memory for
+ * reading and writing. The pages are backed by the file, so the kernel can
+ * write them back and drop them under memory pressure instead of the
+ * process holding them. The space is allocated first so a full disk fails
+ * here rather than on a write to the mapping
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param length Number of bytes to map, at least 1
+ * @return Pointer to the mapping if successful otherwise NULL
+ */
+uint8_t * f_stream_map(f_stream_t * p_source, size_t length);
+
+/*!
+ * @brief Unmap the bytes mapped with f_stream_map. The stream may be closed
+ * before or after
+ *
+ * @param p_map Pointer to the mapping. May be NULL
+ * @param length Number of bytes mapped
+ */
+void f_stream_unmap(uint8_t * p_map, size_t length);
+
+/*!
+ * @brief Create an unnamed temp file in the directory to spill data that is
+ * generated while handling a request. The file never appears in the
+ * directory and its space is released once the stream is closed.
+ *
+ * @param p_dir Pointer to the verified_path_t of the directory
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object opened for reading and writing or NULL
+ */
+f_stream_t * f_stream_temp(verified_path_t * p_dir, ret_codes_t * p_code);
+
+/*!
+ * @brief Create an unnamed temp file in the directory of the path. The
+ * file can then be written and moved over the path with f_stream_replace.
+ *
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object opened for reading and writing or NULL
+ */
+f_stream_t * f_stream_temp_for(verified_path_t * p_path, ret_codes_t * p_code);
+
+/*!
+ * @brief Append the bytes to the end of the stream
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_bytes Pointer to the bytes to write
+ * @param length Number of bytes to write
+ * @retval OP_SUCCESS All bytes were written
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_write(f_stream_t * p_source, const uint8_t * p_bytes, size_t length);
+
+/*!
+ * @brief Set the size of the stream. Growing the stream adds a hole that
+ * reads as zeros and takes no space on disk.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param length New size in bytes
+ * @retval OP_SUCCESS The size was set
+ * @retval OP_IO_ERROR The disk rejected the change
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_resize(f_stream_t * p_source, size_t length);
+
+/*!
+ * @brief Give the temp stream a name in the file system. The file must not
+ * already exist, the check is done by the kernel when the file is linked.
+ * The stream remains open.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param p_path Pointer to the verified_path_t to link the file to
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was linked
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_link(f_stream_t * p_source, verified_path_t * p_path, sync_t * p_sync);
+
+/*!
+ * @brief Move the temp stream over the path, replacing the file if it
+ * exists. The data is flushed before the rename so readers either see the
+ * old file or the complete new one. The stream remains open.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp_for
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was replaced
+ * @retval OP_IO_ERROR The disk rejected the write or the rename
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_replace(f_stream_t * p_source, verified_path_t * p_path, sync_t * p_sync);
 
 /*!
- * @brief Simple wrapper to write the data stream to the verified file path
+ * @brief Close the stream and free the f_stream_t object
+ *
+ * @param pp_source Double pointer to the f_stream_t object
+ */
+void f_stream_close(f_stream_t ** pp_source);
+
+/*!
+ * @brief Write the data stream to the verified file path replacing the file
+ * if it already exists. The stream is written into an unnamed temp file in
+ * the same directory and only linked into place once every byte is on disk.
+ * Readers either see the old file or the new file, never a partial write.
  *
  * @param p_path Pointer to a verified_file_t object
  * @param p_stream Pointer to a byte stream
  * @param stream_size Number of bytes in the byte stream
- * @return FILE_OP_SUCCESS if operation succeeded, otherwise FILE_OP_FAILURE
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was written
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_write_file(verified_path_t * p_path,
+                         uint8_t * p_stream,
+                         size_t stream_size,
+                         sync_t * p_sync);
+
+/*!
+ * @brief Same as f_write_file except that the file must not already exist.
+ * The existence check is performed by the kernel at the moment the file is
+ * linked into place, so two concurrent uploads to the same path cannot both
+ * succeed and a failed upload never leaves a truncated file behind.
+ *
+ * @param p_path Pointer to a verified_file_t object
+ * @param p_stream Pointer to a byte stream
+ * @param stream_size Number of bytes in the byte stream
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @param p_id Pointer receiving the identity of the created file. May be NULL
+ * @retval OP_SUCCESS The file was created
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_create_file(verified_path_t * p_path,
+                          uint8_t * p_stream,
+                          size_t stream_size,
+                          sync_t * p_sync,
+                          f_file_id_t * p_id);
+
+/*!
+ * @brief Give the file at the source path a second name at the destination
+ * path. The source is opened and checked against the identity first and the
+ * link is made through the open descriptor, so the destination is either
+ * the file the identity was taken from or nothing. If the file system
+ * refuses another hard link the file is reflinked instead.
+ *
+ * @param p_source Pointer to the verified_path_t of the existing file
+ * @param p_id Pointer to the identity the source must still have
+ * @param p_dest Pointer to the verified_path_t of the new name. The file
+ * must not already exist
+ * @param p_sync Sync object deciding how the new name is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The destination was created
+ * @retval OP_RESOLVE_ERROR The source is gone or no longer matches the identity
+ * @retval OP_FILE_EXISTS A file already exists at the destination
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
  */
-ret_codes_t f_write_file(verified_path_t * p_path, uint8_t * p_stream, size_t stream_size);
+ret_codes_t f_link_file(verified_path_t * p_source,
+                        const f_file_id_t * p_id,
+                        verified_path_t * p_dest,
+                        sync_t * p_sync);
 
 /*!
  * @brief Simple wrapper for creating a directory using the verified_path_t
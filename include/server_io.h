@@ -0,0 +1,101 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_IO_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_IO_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server_sched.h>
+
+// Pool of threads dedicated to blocking file system operations. It is kept
+// separate from the network workers so that a slow disk does not stall
+// socket handling and slow clients do not stall disk work.
+//
+// Requests are answered in one of two lanes, each with its own workers. File
+// transfers go to the bulk lane and everything else, listings, directories
+// and users, to the interactive lane, so a few large transfers cannot take
+// the workers the short operations need. Bulk workers also give the CPU up
+// between chunks while the interactive lane has jobs waiting.
+typedef struct io_pool io_pool_t;
+
+typedef enum
+{
+    IO_LANE_INTERACTIVE,
+    IO_LANE_BULK,
+    IO_LANE_COUNT
+} io_lane_t;
+
+// Size of the data of a PUT from which it is answered in the bulk lane
+#define IO_BULK_BYTES       (64 * 1024)
+
+/*!
+ * @brief Create the I/O pool. Each lane is resized between its bounds as
+ * the disk keeps its workers blocked
+ *
+ * @param min_workers Threads of the interactive lane at least
+ * @param max_workers Threads the interactive lane may grow to
+ * @param bulk_min Threads of the bulk lane at least
+ * @param bulk_max Threads the bulk lane may grow to
+ * @return io_pool_t object if successful otherwise NULL
+ */
+io_pool_t * io_pool_init(uint16_t min_workers,
+                         uint16_t max_workers,
+                         uint16_t bulk_min,
+                         uint16_t bulk_max);
+
+/*!
+ * @brief Wait for all queued operations to finish and free the pool
+ *
+ * @param pp_pool Double pointer to the I/O pool
+ */
+void io_pool_destroy(io_pool_t ** pp_pool);
+
+/*!
+ * @brief Read the metrics of the workers of a lane
+ *
+ * @param p_pool Pointer to the I/O pool
+ * @param lane Lane to read
+ * @param p_stats Receives the metrics
+ */
+void io_pool_stats(io_pool_t * p_pool, io_lane_t lane, sched_stats_t * p_stats);
+
+/*!
+ * @brief Estimate the jobs of a lane waiting for a worker, see sched_queued
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param lane Lane to read
+ * @return Number of jobs waiting
+ */
+size_t io_pool_queued(io_pool_t * p_pool, io_lane_t lane);
+
+/*!
+ * @brief Run the job on one of the interactive I/O workers and block the
+ * calling thread until the job completes. If p_pool is NULL, or the calling
+ * thread is an I/O worker, the job is run on the calling thread.
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param p_job Function performing the file system operation
+ * @param p_arg Argument passed to p_job
+ */
+void io_run(io_pool_t * p_pool, void (* p_job)(void *), void * p_arg);
+
+/*!
+ * @brief Queue the job on the workers of a lane without waiting for it. If
+ * p_pool is NULL the job is run on the calling thread. Jobs may call
+ * io_run, which runs the operation on the worker already running the job.
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param lane Lane of the job
+ * @param p_job Function to run
+ * @param p_arg Argument passed to p_job, owned by the job
+ */
+void io_submit(io_pool_t * p_pool, io_lane_t lane, void (* p_job)(void *), void * p_arg);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_IO_H_
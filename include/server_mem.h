@@ -0,0 +1,83 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_MEM_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_MEM_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+
+// Memory budget of the process for the buffers of the requests in flight.
+// Buffers whose size the client decides, such as the data of a PUT or what
+// it decompresses to, reserve their bytes before they are allocated
+// and give them back once they are freed, so the memory they hold together
+// never exceeds the budget whatever the mix of requests.
+//
+// A reservation that does not fit waits up to MEM_WAIT_MS for others to be
+// given back and otherwise fails. The caller then falls back to streaming
+// through a temp file where it can. A reservation larger than the whole
+// budget fails at once.
+#define MEM_WAIT_MS         250
+#define MEM_DEFAULT_MIB     1024
+
+typedef struct mem_budget mem_budget_t;
+
+// Metrics of the budget
+typedef struct
+{
+    uint64_t    limit;      // Bytes of the budget, 0 for none
+    uint64_t    used;       // Bytes reserved
+    uint64_t    high_water; // Most bytes reserved at once since the start
+    uint64_t    waited;     // Reservations that had to wait
+    uint64_t    refused;    // Reservations that failed
+} mem_stats_t;
+
+/*!
+ * @brief Create a memory budget
+ *
+ * @param limit Bytes of the budget. 0 only counts the bytes reserved
+ * @return mem_budget_t object if successful otherwise NULL
+ */
+mem_budget_t * mem_init(uint64_t limit);
+
+/*!
+ * @brief Free the memory budget. Every reservation must be given back
+ *
+ * @param pp_mem Double pointer to the memory budget
+ */
+void mem_destroy(mem_budget_t ** pp_mem);
+
+/*!
+ * @brief Reserve bytes of the budget before allocating them
+ *
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes to reserve
+ * @param wait_ms Milliseconds to wait for the bytes to fit
+ * @return true if the bytes were reserved otherwise false
+ */
+bool mem_reserve(mem_budget_t * p_mem, size_t size, uint32_t wait_ms);
+
+/*!
+ * @brief Give back bytes reserved once they are freed
+ *
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes reserved
+ */
+void mem_release(mem_budget_t * p_mem, size_t size);
+
+/*!
+ * @brief Read the metrics of the memory budget
+ *
+ * @param p_mem Pointer to the memory budget
+ * @param p_stats Receives the metrics
+ */
+void mem_stats(mem_budget_t * p_mem, mem_stats_t * p_stats);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_MEM_H_
@@ -0,0 +1,156 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_SCHED_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_SCHED_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+
+// Work-stealing scheduler running the network and I/O workers. Every worker
+// owns a deque (Chase-Lev) it pushes and pops jobs at the bottom of without
+// locking, idle workers steal from the top of the deques of the others.
+// Jobs queued from threads outside the scheduler go to a global injection
+// queue that producers push onto with a single CAS and workers empty in one
+// exchange, moving the jobs into their own deque. Workers with nothing to
+// run or steal park until a job is queued.
+//
+// Jobs queued by a job run on the same worker first, so a job that queues
+// its continuation keeps its data in the cache of that core unless another
+// worker is idle and steals it.
+//
+// A scheduler started with a maximum above its minimum number of workers is
+// resized by a controller thread. Every SCHED_ADAPT_MS it compares the jobs
+// finished, the time the jobs waited in the queues and the workers blocked
+// in system calls with the previous interval. Idle workers are given back
+// while nothing waits, workers are added when every worker is blocked and
+// none finished a job, and otherwise the controller climbs the throughput:
+// a change that raised it is repeated, a change that lowered it is undone.
+#define SCHED_MAX_WORKERS   1024
+
+// Jobs a deque holds. A worker whose deque is full queues on the injection
+// queue instead
+#define SCHED_DEQUE_SIZE    1024
+
+// Interval between two decisions of the controller
+#define SCHED_ADAPT_MS      250
+
+// Mean queue wait under which the controller leaves the pool as it is
+#define SCHED_WAIT_US       1000
+
+// Change of throughput the controller takes for a real one, in percent
+#define SCHED_ADAPT_GAIN    5
+
+typedef struct sched sched_t;
+
+// Metrics of a scheduler. The counters are summed from the workers without
+// stopping them so they are only consistent with each other approximately
+typedef struct
+{
+    uint16_t    workers;    // Workers taking jobs
+    uint16_t    blocked;    // Workers blocked in a system call
+    size_t      queued;     // Jobs waiting for a worker
+    uint64_t    completed;  // Jobs finished since the start
+    uint64_t    wait_us;    // Mean time a sample of the jobs started were queued
+} sched_stats_t;
+
+/*!
+ * @brief Start the scheduler. The controller resizes the pool between the
+ * bounds provided, a scheduler whose bounds are equal keeps its size
+ *
+ * @param min_workers Workers started and kept, 1 to max_workers
+ * @param max_workers Workers the pool may grow to, up to SCHED_MAX_WORKERS
+ * @return sched_t object if successful otherwise NULL
+ */
+sched_t * sched_init(uint16_t min_workers, uint16_t max_workers);
+
+/*!
+ * @brief Wait for the queued jobs to finish, stop the workers and free the
+ * scheduler
+ *
+ * @param pp_sched Double pointer to the scheduler
+ */
+void sched_destroy(sched_t ** pp_sched);
+
+/*!
+ * @brief Queue the job. Called from a worker of the scheduler the job goes
+ * to the deque of that worker, otherwise to the injection queue.
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_job Function to run
+ * @param p_arg Argument passed to p_job
+ * @return OP_SUCCESS if the job was queued otherwise OP_FAILURE
+ */
+ret_codes_t sched_submit(sched_t * p_sched, void (* p_job)(void *), void * p_arg);
+
+/*!
+ * @brief Block until every job queued, including the jobs queued by jobs,
+ * has finished
+ *
+ * @param p_sched Pointer to the scheduler
+ */
+void sched_wait(sched_t * p_sched);
+
+/*!
+ * @brief Get the number of workers of the scheduler taking jobs
+ *
+ * @param p_sched Pointer to the scheduler
+ * @return Number of workers
+ */
+uint16_t sched_workers(sched_t * p_sched);
+
+/*!
+ * @brief Estimate the jobs waiting for a worker as the jobs queued or running
+ * beyond the workers taking jobs. Unlike sched_stats it reads two counters
+ * only, so it is cheap enough to call for every request
+ *
+ * @param p_sched Pointer to the scheduler
+ * @return Number of jobs waiting
+ */
+size_t sched_queued(sched_t * p_sched);
+
+/*!
+ * @brief Read the metrics of the scheduler
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_stats Receives the metrics
+ */
+void sched_stats(sched_t * p_sched, sched_stats_t * p_stats);
+
+/*!
+ * @brief Make the workers of the scheduler give the CPU up in
+ * sched_cooperate while the favoured scheduler has more jobs than workers
+ *
+ * @param p_sched Pointer to the scheduler yielding
+ * @param p_favoured Pointer to the scheduler yielded to. May be NULL
+ */
+void sched_yield_to(sched_t * p_sched, sched_t * p_favoured);
+
+/*!
+ * @brief Let the jobs of the favoured scheduler run first. Long jobs call it
+ * between chunks of their work. Does nothing outside of the workers of a
+ * scheduler that yields to another or while that one keeps up
+ */
+void sched_cooperate(void);
+
+/*!
+ * @brief Mark the calling worker as blocked in a system call, such as a
+ * read from a socket or the disk, until sched_block_end. Calls nest and do
+ * nothing outside of the workers of a scheduler
+ */
+void sched_block_begin(void);
+
+/*!
+ * @brief End the blocking call started with sched_block_begin
+ */
+void sched_block_end(void);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_SCHED_H_
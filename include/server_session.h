@@ -0,0 +1,96 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_SESSION_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_SESSION_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <utils.h>
+#include <server.h>
+
+// Sessions are split into shards, each with its own lock and table, so
+// connections served on different cores do not contend for one table. A
+// session is created in the shard of the core the request is served on and
+// its ID is picked so that the ID alone names the shard:
+//
+//      shard = session_id % shard_count
+//
+// Requests of the session are looked up in that shard only, which is the
+// shard of the core serving the connection when connections stay on the
+// core that accepted them.
+#define SESSION_MAX_SHARDS  1024
+
+typedef struct sessions sessions_t;
+
+/*!
+ * @brief Create an empty session table
+ *
+ * @param shards Number of shards. 0 creates one shard per CPU
+ * @return sessions_t object if successful otherwise NULL
+ */
+sessions_t * sessions_init(uint32_t shards);
+
+/*!
+ * @brief Free the session table and every session in it
+ *
+ * @param pp_sessions Double pointer to the session table
+ */
+void sessions_destroy(sessions_t ** pp_sessions);
+
+/*!
+ * @brief Create a session in the shard of the CPU the caller runs on
+ *
+ * @param p_sessions Pointer to the session table
+ * @param p_session Pointer to save the ID of the new session to
+ * @return OP_SUCCESS if the session was created otherwise OP_FAILURE
+ */
+ret_codes_t sessions_create(sessions_t * p_sessions, uint32_t * p_session);
+
+/*!
+ * @brief Mark the session as used now if it has not been idle for longer
+ * than the timeout. A session that has is removed.
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ * @param timeout Seconds the session may stay idle
+ * @retval OP_SUCCESS The session is active
+ * @retval OP_SESSION_ERROR The session does not exist or has expired
+ */
+ret_codes_t sessions_renew(sessions_t * p_sessions,
+                           uint32_t session_id,
+                           time_t timeout);
+
+/*!
+ * @brief Remove the session if it exists
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ */
+void sessions_expire(sessions_t * p_sessions, uint32_t session_id);
+
+/*!
+ * @brief Get the shard a session ID belongs to
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ * @return Index of the shard
+ */
+uint32_t sessions_shard(sessions_t * p_sessions, uint32_t session_id);
+
+/*!
+ * @brief Get the number of shards of the session table
+ *
+ * @param p_sessions Pointer to the session table
+ * @return Number of shards
+ */
+uint32_t sessions_shard_count(sessions_t * p_sessions);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_SESSION_H_
@@ -0,0 +1,124 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_SHAPE_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_SHAPE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+
+// Bandwidth of the connections is shaped with token buckets nested in three
+// levels: the server, the user and the connection. Every byte sent or
+// received takes a token from the bucket of its connection, of the user the
+// connection last authenticated as and of the server. A transfer takes its
+// tokens before it starts and a bucket it overdraws goes into debt, the
+// transfer then waits until every bucket it took from has refilled its debt.
+// A connection is therefore held to the slowest of its three buckets and the
+// connections of a user or of the server share theirs. A bucket refills at
+// its rate and holds SHAPE_BURST_MS worth of bytes, so a connection left
+// idle may send that much without waiting.
+//
+// The limit of a user is the rate stored with its account, or the limit of
+// its permission when it has none. A connection is charged to a user from
+// the first of its requests that authenticates, the bytes read before only
+// count against the connection and the server.
+#define SHAPE_BURST_MS  250
+
+// Bytes sent or read at once by a shaped connection, so a large transfer
+// waits in small steps instead of once for the whole transfer
+#define SHAPE_SLICE     (64 * 1024)
+
+// Highest rate in bytes per second. The refill of a bucket is computed in
+// nanoseconds and would overflow above it
+#define SHAPE_MAX_RATE  (1ULL << 34)
+
+typedef struct shaper shaper_t;
+typedef struct shape_bucket shape_bucket_t;
+typedef struct shape_flow shape_flow_t;
+
+// Limits in bytes per second, 0 for none
+typedef struct
+{
+    uint64_t    server;             // Every connection together
+    uint64_t    connection;         // Each connection
+    uint64_t    levels[ADMIN + 1];  // Each user without a rate of its own, by perms_t
+} shape_limits_t;
+
+/*!
+ * @brief Create the shaper of the server
+ *
+ * @param p_limits Pointer to the limits
+ * @return shaper_t object if successful otherwise NULL
+ */
+shaper_t * shape_init(const shape_limits_t * p_limits);
+
+/*!
+ * @brief Free the shaper and the buckets of the users. The flows of the
+ * connections must be destroyed first
+ *
+ * @param pp_shaper Double pointer to the shaper
+ */
+void shape_destroy(shaper_t ** pp_shaper);
+
+/*!
+ * @brief Get the bucket of the user, created on first use. The bucket lives
+ * as long as the shaper and follows changes of the limit of the user
+ *
+ * @param p_shaper Pointer to the shaper. May be NULL
+ * @param p_user Pointer to the authenticated user
+ * @return Bucket of the user or NULL if the user has no limit
+ */
+shape_bucket_t * shape_user(shaper_t * p_shaper, const user_account_t * p_user);
+
+/*!
+ * @brief Create the flow of a connection, which holds its bucket
+ *
+ * @param p_shaper Pointer to the shaper
+ * @return shape_flow_t object if successful otherwise NULL
+ */
+shape_flow_t * shape_flow_init(shaper_t * p_shaper);
+
+/*!
+ * @brief Free the flow of a connection
+ *
+ * @param pp_flow Double pointer to the flow
+ */
+void shape_flow_destroy(shape_flow_t ** pp_flow);
+
+/*!
+ * @brief Charge the following bytes of the connection to a user
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @param p_bucket Bucket of the user from shape_user. NULL keeps the user
+ * the flow is charged to
+ */
+void shape_flow_user(shape_flow_t * p_flow, shape_bucket_t * p_bucket);
+
+/*!
+ * @brief Tell whether any bucket the flow takes from has a limit. Shaped
+ * connections transfer at most SHAPE_SLICE bytes at once
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @return true if the flow is shaped otherwise false
+ */
+bool shape_flow_limited(shape_flow_t * p_flow);
+
+/*!
+ * @brief Take the tokens of bytes about to be sent or just received and
+ * wait until no bucket of the flow is in debt. The wait counts as blocked
+ * for the scheduler running the caller so the pool may grow around it
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @param bytes Number of bytes transferred
+ */
+void shape_flow_take(shape_flow_t * p_flow, size_t bytes);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_SHAPE_H_
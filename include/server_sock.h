@@ -17,20 +17,39 @@ extern "C" {
 #include <time.h>
 #include <stdlib.h>
 
-#include <thread_pool.h>
 #include <utils.h>
 #include <server.h>
 #include <server_ctrl.h>
+#include <server_wire.h>
+#include <server_sched.h>
 
 
 /*!
- * @brief Start the main thread loop
+ * @brief Start the acceptors and wait for them to stop
  *
  * @param p_db Pointer to the database object
  * @param port_num Port number to bind to
  * @param timeout Timeout of each session with the client
+ * @param net_workers Number of threads serving client connections at least
+ * @param net_workers_max Number of threads the network workers may grow to
+ * @param acceptors Number of threads accepting connections. The network
+ * workers are split between them
+ * @param b_per_core Run one acceptor on each CPU the server may use with its
+ * workers pinned to the same CPU. acceptors is ignored
  */
-void start_server(db_t * p_db, uint32_t port_num, uint8_t timeout);
+void start_server(db_t * p_db,
+                  uint32_t port_num,
+                  uint8_t timeout,
+                  uint16_t net_workers,
+                  uint16_t net_workers_max,
+                  uint16_t acceptors,
+                  bool b_per_core);
+
+/*!
+ * @brief Make start_server return once the connections being served are
+ * closed, as the keyboard interrupt does
+ */
+void stop_server(void);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,88 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_SYNC_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_SYNC_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <utils.h>
+#include <server.h>
+
+// Durability mode of the file writes
+typedef enum
+{
+    SYNC_NONE   = 0, // Leave flushing to the kernel
+    SYNC_OP     = 1, // fdatasync every file and its directory per operation
+    SYNC_GROUP  = 2, // Batch the flushes of concurrent writers into one syncfs
+} sync_mode_t;
+
+typedef struct sync sync_t;
+
+/*!
+ * @brief Create the sync object used to flush file writes to stable storage.
+ * In SYNC_GROUP mode a commit thread is started which batches the flush
+ * requests of all writers that arrive within a short window into a single
+ * syncfs call on the file system holding p_dir.
+ *
+ * @param mode Durability mode
+ * @param p_dir Path to a directory on the file system that will be synced
+ * @return sync_t object if successful otherwise NULL
+ */
+sync_t * sync_init(sync_mode_t mode, const char * p_dir);
+
+/*!
+ * @brief Stop the commit thread if running and free the sync object
+ *
+ * @param pp_sync Double pointer to the sync object
+ */
+void sync_destroy(sync_t ** pp_sync);
+
+/*!
+ * @brief Get the durability mode of the sync object
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @return The sync_mode_t of the object
+ */
+sync_mode_t sync_get_mode(sync_t * p_sync);
+
+/*!
+ * @brief Get the number of group commits issued so far
+ *
+ * @param p_sync Pointer to the sync object. May be NULL
+ * @return Number of syncfs calls made, 0 outside of SYNC_GROUP mode
+ */
+uint64_t sync_commits(sync_t * p_sync);
+
+/*!
+ * @brief Make the data of the file descriptor durable. Returns immediately
+ * in SYNC_NONE mode and calls fdatasync in SYNC_OP mode. In SYNC_GROUP mode
+ * it returns immediately as well, since the syncfs that sync_dir waits for
+ * flushes the data together with the directory entry. Callers must follow
+ * it with sync_dir before reporting the write as durable.
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @param fd File descriptor of the file written
+ * @retval OP_SUCCESS The data is durable
+ * @retval OP_IO_ERROR The flush failed
+ */
+ret_codes_t sync_data(sync_t * p_sync, int fd);
+
+/*!
+ * @brief Make the entries of the directory durable. Returns immediately
+ * in SYNC_NONE mode, calls fsync on the directory in SYNC_OP mode and waits
+ * for the next group commit in SYNC_GROUP mode.
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @param p_dir Path of the directory that was modified
+ * @retval OP_SUCCESS The directory entries are durable
+ * @retval OP_IO_ERROR The flush failed
+ */
+ret_codes_t sync_dir(sync_t * p_sync, const char * p_dir);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_SYNC_H_
@@ -0,0 +1,187 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_WIRE_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_WIRE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_arena.h>
+#include <server_ctrl.h>
+
+// Requests are read from the socket in as few reads as the client allows
+// into the receive buffer of the connection and parsed where they land. The
+// hash and the data of a request point into the buffer, only the strings
+// handed to the database and the file API are copied to be terminated.
+// Fields that do not fit in the space left in the buffer are read into the
+// arena of the request instead. The data of a PUT the memory budget has no
+// room for is read into a temp file mapped by the arena, so it is held by
+// the page cache rather than the process. The data spilled by the requests
+// in flight is reserved against a budget of its own, WIRE_SPILL_MIB by
+// default, before the temp file is allocated. Data over it is refused so a
+// client cannot fill the disk by declaring a large payload.
+//
+// Every field a request points to stays in place until the next request is
+// read, bytes of the next request that were read early are moved to the
+// front of the buffer then.
+#define WIRE_RECV_SIZE      16384
+#define WIRE_SPILL_MIB      4096
+
+// The first byte of a v1 request is its opcode, which never has the high bit
+// set. Versioned requests start with the version with the high bit set
+#define WIRE_VERSION_1      1
+#define WIRE_VERSION_FLAG   0x80
+#define WIRE_VERSION_2      (WIRE_VERSION_FLAG | 2)
+
+// Size of the v2 request and response headers
+#define WIRE_V2_HEADER_LEN  32
+
+// The data of a v2 response follows its header in frames tagged with the
+// request ID, so the responses of the other requests of the connection are
+// written between the frames of a large one. A frame carries at most
+// WIRE_V2_FRAME_SIZE bytes of data
+#define WIRE_V2_DATA        (WIRE_VERSION_FLAG | 3)
+#define WIRE_V2_FRAME_SIZE  65536
+
+// Number of v2 requests of a connection that are read before their
+// responses are written
+#define WIRE_MAX_IN_FLIGHT  32
+
+// Fixed part of a request as it is laid out on the wire. Every field is
+// naturally aligned so the struct has no padding and is decoded with a
+// single copy
+typedef struct
+{
+    uint8_t     opt_code;
+    uint8_t     user_flag;
+    uint16_t    flags;
+    uint16_t    username_len;
+    uint16_t    passwd_len;
+    uint32_t    session_id;
+} wire_header_t;
+
+// Fixed header of a v2 request. The credentials and the payload of the
+// request follow it and are counted by payload_len
+typedef struct
+{
+    uint8_t     version;
+    uint8_t     opt_code;
+    uint16_t    flags;
+    uint32_t    request_id;
+    uint32_t    session_id;
+    uint8_t     user_flag;
+    uint8_t     reserved;
+    uint16_t    username_len;
+    uint16_t    passwd_len;
+    uint16_t    reserved_2;
+    uint32_t    reserved_3;
+    uint64_t    payload_len;
+} wire_v2_header_t;
+
+// Fixed header of a v2 response. The message and the data of the response
+// follow it and are counted by payload_len
+typedef struct
+{
+    uint8_t     version;
+    uint8_t     result;
+    uint8_t     content_flags;  // Hash algorithm and codec of the data
+    uint8_t     msg_len;
+    uint32_t    request_id;
+    uint32_t    session_id;
+    uint32_t    retry_ms;       // Wait before retrying an OP_SERVER_BUSY request
+    uint64_t    reserved;
+    uint64_t    payload_len;
+} wire_v2_response_t;
+
+// Header of a frame of the data of a v2 response. frame_len bytes of data
+// follow it
+typedef struct
+{
+    uint8_t     version;        // WIRE_V2_DATA
+    uint8_t     reserved[3];
+    uint32_t    request_id;
+    uint32_t    frame_len;
+} wire_v2_frame_t;
+
+typedef struct
+{
+    int             fd;
+    shape_flow_t *  p_flow;     // Charged with the bytes read. May be NULL
+    admit_t *       p_admit;    // Admits the requests read. May be NULL
+    uint32_t        busy_ms;    // Every request is turned away with this hint if set
+    verified_path_t * p_spill;  // Data without room in memory is spilled here. May be NULL
+    mem_budget_t *  p_spill_mem; // Bytes spilled are reserved here. May be NULL
+    size_t          start;      // First byte not parsed yet
+    size_t          end;        // End of the bytes read from fd
+    uint8_t         buffer[WIRE_RECV_SIZE];
+} wire_reader_t;
+
+/*!
+ * @brief Prepare the reader of a connection
+ *
+ * @param p_reader Pointer to the reader
+ * @param fd Socket of the connection
+ * @param p_flow Flow of the connection the bytes read are charged to. May be
+ * NULL
+ * @param p_admit Admission control of the server. May be NULL
+ */
+void wire_reader_init(wire_reader_t * p_reader,
+                      int fd,
+                      shape_flow_t * p_flow,
+                      admit_t * p_admit);
+
+/*!
+ * @brief Read the next request of the connection in either version of the
+ * protocol. The fields of the request are valid until the next request is
+ * read and the arena is reset.
+ *
+ * The request is admitted between its header and its payload. A request
+ * turned away has its payload read and dropped so the connection stays in
+ * step, only its header fields and the retry hint are set. A request read
+ * successfully stays admitted until it is answered.
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena the strings and large fields are allocated from
+ * @param p_wire Pointer to the zeroed wire_payload_t to populate
+ * @retval OP_SUCCESS The request was read
+ * @retval OP_SERVER_BUSY The request was turned away by the admission control
+ * @retval OP_SOCK_CLOSED The client closed the connection
+ * @retval OP_SESSION_ERROR The client did not send the request in time
+ * @retval OP_FAILURE The read failed or memory ran out
+ */
+ret_codes_t wire_read_request(wire_reader_t * p_reader,
+                              arena_t * p_arena,
+                              wire_payload_t * p_wire);
+
+/*!
+ * @brief Copy the fields of the request that point into the receive buffer
+ * to the arena so the request outlives the next read of the connection
+ *
+ * @param p_reader Pointer to the reader the request was read with
+ * @param p_arena Arena of the request
+ * @param p_wire Pointer to the request
+ * @return OP_SUCCESS if the fields were copied otherwise OP_FAILURE
+ */
+ret_codes_t wire_detach(wire_reader_t * p_reader,
+                        arena_t * p_arena,
+                        wire_payload_t * p_wire);
+
+/*!
+ * @brief Pick the lane the request is answered in from its opcode and the
+ * size of its payload. GETs and signatures read a whole file and large PUTs
+ * write one, the other requests only touch metadata
+ *
+ * @param p_wire Pointer to the request
+ * @return IO_LANE_BULK for file transfers otherwise IO_LANE_INTERACTIVE
+ */
+io_lane_t wire_lane(const wire_payload_t * p_wire);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_WIRE_H_
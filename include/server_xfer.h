@@ -0,0 +1,136 @@
+#ifndef BSLE_GALINDEZ_INCLUDE_SERVER_XFER_H_
+#define BSLE_GALINDEZ_INCLUDE_SERVER_XFER_H_
+#ifdef __cplusplus
+extern "C" {
+#endif //END __cplusplus
+// HEADER GUARD
+#include <stdint.h>
+#include <stddef.h>
+
+#include <utils.h>
+#include <server.h>
+#include <server_file_api.h>
+
+// Each transfer holds a single chunk of XFER_CHUNK_SIZE bytes. The kernel
+// reads the XFER_AHEAD chunks after it into the page cache while the chunk
+// is consumed, so the next read is served from memory. A compressed
+// transfer holds a frame of the same size as well. The chunks are not
+// reserved against the memory budget since their size does not depend on
+// the client, every transfer runs on a worker so at most two chunks per
+// network and I/O worker are held at once
+#define XFER_CHUNK_SIZE (1 << 20)
+#define XFER_AHEAD      2
+
+/*!
+ * @brief Consumer stage of the pipeline. Called in file order with each
+ * chunk read from the source.
+ *
+ * @param p_chunk Pointer to the bytes read
+ * @param chunk_len Number of bytes in the chunk
+ * @param p_ctx Context passed to xfer_pipeline
+ * @return OP_SUCCESS to continue otherwise the transfer is aborted and the
+ * code is returned by xfer_pipeline
+ */
+typedef ret_codes_t (* xfer_sink_t)(const uint8_t * p_chunk,
+                                    size_t chunk_len,
+                                    void * p_ctx);
+
+/*!
+ * @brief Stream the first length bytes of the source through the sink one
+ * chunk at a time. Before the sink runs the kernel is asked to read the
+ * next XFER_AHEAD chunks in the background, so disk reads overlap with
+ * hashing or sending without a thread of the transfer's own.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to transfer
+ * @param sink Consumer stage called with every chunk in order
+ * @param p_ctx Context passed to the sink
+ * @retval OP_SUCCESS All bytes were passed to the sink
+ * @retval OP_IO_ERROR The source could not be read or ended early
+ * @return Any code returned by the sink that aborted the transfer
+ */
+ret_codes_t xfer_pipeline(f_stream_t * p_source,
+                          size_t length,
+                          xfer_sink_t sink,
+                          void * p_ctx);
+
+/*!
+ * @brief Sink that adds every chunk to a running hash
+ *
+ * @param p_chunk Pointer to the bytes read
+ * @param chunk_len Number of bytes in the chunk
+ * @param p_ctx Pointer to a hash_stream_t object
+ * @return OP_SUCCESS or OP_FAILURE if the hash could not be updated
+ */
+ret_codes_t xfer_hash_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx);
+
+/*!
+ * @brief Compress the first length bytes of the source into frames passed
+ * to the sink in order. Every chunk read by the pipeline becomes one frame
+ * and is added to the running hash before it is compressed, so a file is
+ * hashed and compressed in a single pass. Without a sink the frames are only
+ * sized, which tells the length of the frames a later pass will produce
+ * since the codecs compress the same bytes the same way.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to compress
+ * @param codec Codec to compress with
+ * @param p_hash Running hash of the uncompressed bytes or NULL
+ * @param sink Consumer of the frames or NULL
+ * @param p_ctx Context passed to the sink
+ * @param p_frames_len Pointer receiving the number of bytes of the frames
+ * @retval OP_SUCCESS All bytes were compressed
+ * @retval OP_IO_ERROR The source could not be read
+ * @retval OP_FAILURE Allocation, hashing or compressing failed
+ * @return Any code returned by the sink that aborted the transfer
+ */
+ret_codes_t xfer_frames(f_stream_t * p_source,
+                        size_t length,
+                        codec_t codec,
+                        hash_stream_t * p_hash,
+                        xfer_sink_t sink,
+                        void * p_ctx,
+                        size_t * p_frames_len);
+
+/*!
+ * @brief Compress the first length bytes of the source into frames appended
+ * to the destination with xfer_frames.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to compress
+ * @param codec Codec to compress with
+ * @param p_hash Running hash of the uncompressed bytes or NULL
+ * @param p_dest Stream receiving the frames
+ * @param p_dest_len Pointer receiving the number of bytes written to p_dest
+ * @retval OP_SUCCESS All bytes were compressed
+ * @retval OP_IO_ERROR The source could not be read or p_dest written
+ * @retval OP_FAILURE Allocation, hashing or compressing failed
+ */
+ret_codes_t xfer_compress(f_stream_t * p_source,
+                          size_t length,
+                          codec_t codec,
+                          hash_stream_t * p_hash,
+                          f_stream_t * p_dest,
+                          size_t * p_dest_len);
+
+/*!
+ * @brief Hash the leaves of the tree from the source. The leaves are read
+ * with positional reads and hashed by hash_tree_fill, so hashing scales
+ * with the number of cores instead of being bound to a single running hash.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param p_tree Tree created for the length of the source
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @retval OP_SUCCESS Every leaf of the tree was set
+ * @retval OP_IO_ERROR The source could not be read or ended early
+ * @retval OP_FAILURE Allocation or hashing failed
+ */
+ret_codes_t xfer_tree_hash(f_stream_t * p_source,
+                           hash_tree_t * p_tree,
+                           uint8_t threads);
+
+// HEADER GUARD
+#ifdef __cplusplus
+}
+#endif // END __cplusplus
+#endif //BSLE_GALINDEZ_INCLUDE_SERVER_XFER_H_
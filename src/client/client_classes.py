@@ -1,13 +1,71 @@
 from __future__ import annotations
 
 import hashlib
+import os
 import struct
+import zlib
+from concurrent.futures import ThreadPoolExecutor
 from dataclasses import dataclass
 from enum import Enum, auto, unique
 from pathlib import Path
 from typing import Optional
 
+try:
+    import blake3
+except ImportError:
+    blake3 = None
+
 SUCCESS_RESPONSE = 1
+RESOLVE_ERROR_RESPONSE = 9
+HASH_UNKNOWN_RESPONSE = 19
+SERVER_BUSY_RESPONSE = 20
+FAILURE_RESPONSE = 255
+
+# Requests the server turns away as busy are sent again after the wait it
+# asks for, in tenths of a second in the response reserved byte. The wait
+# doubles on every attempt up to BUSY_MAX_WAIT seconds
+BUSY_RETRY_UNIT = 0.1
+BUSY_MIN_WAIT = 0.1
+BUSY_MAX_WAIT = 10.0
+BUSY_RETRIES = 5
+
+# Hash algorithms selected with the low nibble of the request reserved field
+HASH_ALG_MASK = 0x0F
+HASH_TREE_LEAF_SIZE = 1 << 20
+
+# Codecs selected with the high nibble of the request reserved field. The
+# server echoes the codec of the response data in the high nibble of the
+# response reserved byte
+CODEC_SHIFT = 4
+COMPRESS_FRAME_SIZE = 1 << 20
+COMPRESS_FRAME_HEADER = 8
+ZLIB_LEVEL = 1
+LZ4_MIN_MATCH = 4
+LZ4_LAST_LITERALS = 5
+LZ4_MFLIMIT = 12
+LZ4_MAX_OFFSET = 0xFFFF
+
+# Signatures and deltas of the sync requests. See make_delta
+DELTA_SIG_HEADER = 12
+DELTA_STRONG_LEN = 16
+DELTA_SIG_ENTRY = 4 + DELTA_STRONG_LEN
+DELTA_OP_COPY = 0
+DELTA_OP_DATA = 1
+ADLER_MOD = 65521
+
+
+@unique
+class HashAlg(Enum):
+    SHA256 = 0
+    TREE = 1
+    BLAKE3 = 2
+
+
+@unique
+class Codec(Enum):
+    NONE = 0
+    ZLIB = 1
+    LZ4 = 2
 
 
 class RespHeader(Enum):
@@ -31,6 +89,7 @@ class ActionType(Enum):
     MKDIR = 5
     PUT = 6
     LOCAL_OP = 7
+    PUT_BY_HASH = 8
 
     CREATE_USER = 10
     DELETE_USER = 20
@@ -39,6 +98,15 @@ class ActionType(Enum):
     L_LS = auto()
     L_DELETE = auto()
     L_MKDIR = auto()
+    SYNC = auto()
+
+
+@unique
+class SyncOp(Enum):
+    """Opcodes of the requests a sync is made of. A sync asks for the
+    signature of the file held by the server and answers with a delta"""
+    SIGNATURE = 9
+    PUT_DELTA = 10
 
 
 class DependencyAction(Enum):
@@ -61,6 +129,7 @@ class DependencyAction(Enum):
     DELETE = 2
     PUT = 3
     GET = 3
+    SYNC = 3
     CREATE_USER = 4
 
 
@@ -122,6 +191,14 @@ class ClientRequest:
         self._other_password: str = ""
 
         self._debug: bool = kwargs.get("debug", False)
+        self._hash_alg = _hash_alg(kwargs.get("hash_alg", HashAlg.SHA256))
+        self._codec = _codec(kwargs.get("compress", Codec.NONE))
+        self._dedup: bool = kwargs.get("dedup", True)
+        self._by_hash: bool = False
+        self._put_data: Optional[tuple[bytes, bytes]] = None
+        self._sync_op: Optional[SyncOp] = None
+        self._delta: Optional[bytes] = None
+        self._batch: Optional[Path] = None
         self._parse_kwargs(kwargs)
 
     def __str__(self) -> str:
@@ -155,11 +232,13 @@ class ClientRequest:
 
         action = None
         for key, value in kwargs.items():
-            if key == "debug":
+            if key in ("debug", "hash_alg", "compress", "dedup"):
                 continue
             if value:
                 if key in ("create_user", "delete_user"):
                     self._other_username = value
+                if "batch" == key:
+                    self._batch = value
                 if action is not None:
                     raise ValueError("[!] Only one command flag may be set")
                 action = key
@@ -229,6 +308,56 @@ class ClientRequest:
         """Hidden cli option "--debug" enables extra printing of information"""
         return self._debug
 
+    @property
+    def hash_alg(self) -> HashAlg:
+        """Hash algorithm requested for the data of PUT and GET"""
+        return self._hash_alg
+
+    @property
+    def codec(self) -> Codec:
+        """Codec the data of PUT, GET and LS is compressed with"""
+        return self._codec
+
+    @property
+    def offer_hash(self) -> bool:
+        """Uploads first offer the hash of the file so the server can skip
+        the data if it already holds it"""
+        return self._dedup and self._action in (ActionType.PUT, ActionType.SYNC)
+
+    @property
+    def by_hash(self) -> bool:
+        """The PUT request carries the hash of the file without its data"""
+        return self._by_hash
+
+    @by_hash.setter
+    def by_hash(self, value: bool) -> None:
+        self._by_hash = value
+
+    @property
+    def sync_op(self) -> Optional[SyncOp]:
+        """Request of the sync being sent. A sync without one is sent as a
+        regular PUT"""
+        return self._sync_op
+
+    @sync_op.setter
+    def sync_op(self, value: Optional[SyncOp]) -> None:
+        self._sync_op = value
+
+    def set_signature(self, signature: bytes) -> None:
+        """Compute the delta of the source file against the signature of the
+        file held by the server"""
+        payload, _ = self._read_put_data()
+        self._delta = make_delta(self._hash_alg, signature, payload)
+
+    @property
+    def delta_len(self) -> int:
+        return 0 if self._delta is None else len(self._delta)
+
+    @property
+    def batch(self) -> Optional[Path]:
+        """File of the commands to pipeline, "-" for stdin"""
+        return self._batch
+
     @property
     def shell_mode(self) -> bool:
         return ActionType.SHELL == self._action
@@ -305,6 +434,13 @@ class ClientRequest:
         self._src = src
         self._action = ActionType.PUT
 
+    def set_sync(self, dst: str, src: Path) -> None:
+        """Method is used for interactive mode"""
+        self._reset_state()
+        self._dst = dst
+        self._src = src
+        self._action = ActionType.SYNC
+
     def set_delete(self, dst: str) -> None:
         """Method is used for interactive mode"""
         self._reset_state()
@@ -329,6 +465,9 @@ class ClientRequest:
         self._user_flag = ActionType.NO_OP
         self._src = ""
         self._dst = ""
+        self._put_data = None
+        self._sync_op = None
+        self._delta = None
 
     @property
     def session(self) -> int:
@@ -346,7 +485,7 @@ class ClientRequest:
         0               1               2               3
         0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
         +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-        |     OPCODE    |   USER_FLAG   |           RESERVED            |
+        |     OPCODE    |   USER_FLAG   |  RESERVED (CODEC | HASH_ALG)   |
         +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
         |        USERNAME_LEN           |        PASSWORD_LEN           |
         +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
@@ -361,10 +500,19 @@ class ClientRequest:
         |                ~user_payload || std_payload~                  |
         +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
         """
+        if self._by_hash:
+            opcode = ActionType.PUT_BY_HASH
+        elif self._sync_op is not None:
+            opcode = self._sync_op
+        elif ActionType.SYNC == self._action:
+            opcode = ActionType.PUT
+        else:
+            opcode = self._action
         request_header = bytearray(struct.pack("!BBHHHL",
-                                               self._action.value,
+                                               opcode.value,
                                                self._user_flag.value,
-                                               0,
+                                               self._hash_alg.value
+                                               | (self._codec.value << CODEC_SHIFT),
                                                len(self._username),
                                                len(self.self_password),
                                                self._session_id,
@@ -410,22 +558,23 @@ class ClientRequest:
                |                     **FILE_DATA_STREAM**                      |
                +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
             """
-            if ActionType.PUT == self._action:
+            if self._action in (ActionType.PUT, ActionType.SYNC):
                 path = (Path(self._dst) / self._src.name).as_posix()
             else:
                 path = self._dst
             std_payload = struct.pack("!H", len(path))
             std_payload += path.encode(encoding="utf-8")
-            if ActionType.PUT == self._action:
-                try:
-                    with self._src.open("rb") as handle:
-                        _payload = handle.read()
-                    hash_digest = _hash(_payload)
-                    std_payload += hash_digest
-                    std_payload += _payload
-
-                except Exception:
-                    raise
+            if SyncOp.PUT_DELTA == self._sync_op:
+                # The hash is over the rebuilt file, not the delta
+                _, hash_digest = self._read_put_data()
+                std_payload += hash_digest
+                std_payload += compress(self._codec, self._delta)
+            elif (self._action in (ActionType.PUT, ActionType.SYNC)
+                  and self._sync_op is None):
+                _payload, hash_digest = self._read_put_data()
+                std_payload += hash_digest
+                if not self._by_hash:
+                    std_payload += compress(self._codec, _payload)
 
             request_header += struct.pack("!Q", len(std_payload))
             request_header += std_payload
@@ -434,6 +583,16 @@ class ClientRequest:
             print(' '.join('{:02x}'.format(x) for x in request_header))
         return request_header
 
+    def _read_put_data(self) -> tuple[bytes, bytes]:
+        """The file is read and hashed once even if the hash is offered or
+        a signature is requested before the data is sent"""
+        if self._put_data is None:
+            with self._src.open("rb") as handle:
+                _payload = handle.read()
+            # The hash is over the data before it is compressed
+            self._put_data = (_payload, _digest(self._hash_alg, _payload))
+        return self._put_data
+
     def save_file(self, payload: bytes) -> str:
         """
         Function is used during "GET" operations to save the byte stream
@@ -487,6 +646,17 @@ class ServerResponse:
     def successful(self) -> bool:
         return SUCCESS_RESPONSE == self.return_code
 
+    @property
+    def busy(self) -> bool:
+        return SERVER_BUSY_RESPONSE == self.return_code
+
+    @property
+    def retry_after(self) -> float:
+        """Seconds the server asked to wait before retrying a busy request"""
+        if not self.busy:
+            return 0.0
+        return self.reserved * BUSY_RETRY_UNIT
+
     @property
     def valid_hash(self) -> bool:
         """
@@ -498,7 +668,11 @@ class ServerResponse:
         if self.digest is None:
             return False
 
-        return self.digest == _hash(self.payload)
+        try:
+            alg = HashAlg(self.reserved & HASH_ALG_MASK)
+        except ValueError:
+            return False
+        return self.digest == _digest(alg, self.payload)
 
 
 def _chunker(payload: bytes, size: int) -> bytes:
@@ -513,3 +687,344 @@ def _hash(payload: bytes, size: int = 1024) -> bytes:
     for chunk in _chunker(payload, size):
         sha256_hash.update(chunk)
     return sha256_hash.digest()
+
+
+def _hash_alg(alg) -> HashAlg:
+    """
+    Resolve the hash algorithm requested by name or value. BLAKE3 requires
+    the optional blake3 package.
+
+    :param alg: HashAlg or the name of one
+    :return: The matching HashAlg
+    """
+    if not isinstance(alg, HashAlg):
+        try:
+            alg = HashAlg[str(alg).upper()]
+        except KeyError:
+            raise ValueError(f"[!] Unknown hash algorithm {alg}") from None
+    if HashAlg.BLAKE3 == alg and blake3 is None:
+        raise ValueError("[!] The blake3 package is required for BLAKE3 "
+                         "(pip install blake3)")
+    return alg
+
+
+def _codec(codec) -> Codec:
+    """
+    Resolve the codec requested by name or value. None disables compression.
+
+    :param codec: Codec, the name of one or None
+    :return: The matching Codec
+    """
+    if codec is None:
+        return Codec.NONE
+    if not isinstance(codec, Codec):
+        try:
+            codec = Codec[str(codec).upper()]
+        except KeyError:
+            raise ValueError(f"[!] Unknown compression codec {codec}") from None
+    return codec
+
+
+def compress(codec: Codec, payload: bytes) -> bytes:
+    """
+    Compress the bytes stream into frames of at most COMPRESS_FRAME_SIZE
+    bytes of data. Every frame starts with the big endian data length and
+    body length. Frames that do not shrink are stored as is.
+
+    :param codec: Codec to compress with. Codec.NONE returns the payload
+    :param payload: Bytes to compress
+    :return: The frames
+    """
+    if Codec.NONE == codec:
+        return payload
+
+    frames = bytearray()
+    for chunk in _chunker(payload, COMPRESS_FRAME_SIZE):
+        if Codec.ZLIB == codec:
+            body = zlib.compress(chunk, ZLIB_LEVEL)
+        else:
+            body = _lz4_compress(chunk)
+        if len(body) >= len(chunk):
+            body = chunk
+        frames += struct.pack("!II", len(chunk), len(body))
+        frames += body
+    return bytes(frames)
+
+
+def decompress(codec: Codec, frames: bytes) -> bytes:
+    """
+    Decompress the frames produced by compress or the server
+
+    :param codec: Codec the frames were compressed with
+    :param frames: The frames
+    :return: The original bytes stream
+    """
+    if Codec.NONE == codec:
+        return frames
+
+    payload = bytearray()
+    pos = 0
+    while pos < len(frames):
+        if len(frames) - pos < COMPRESS_FRAME_HEADER:
+            raise ValueError("[!] Compressed data is truncated")
+        raw_len, body_len = struct.unpack_from("!II", frames, pos)
+        pos += COMPRESS_FRAME_HEADER
+        body = frames[pos: pos + body_len]
+        pos += body_len
+        if (raw_len > COMPRESS_FRAME_SIZE or body_len > raw_len
+                or len(body) != body_len):
+            raise ValueError("[!] Compressed data is corrupt")
+
+        if body_len == raw_len:
+            data = body
+        elif Codec.ZLIB == codec:
+            data = zlib.decompress(body)
+        else:
+            data = _lz4_decompress(body, raw_len)
+        if len(data) != raw_len:
+            raise ValueError("[!] Compressed data is corrupt")
+        payload += data
+    return bytes(payload)
+
+
+def _lz4_compress(chunk: bytes) -> bytes:
+    """
+    Compress into the LZ4 block format with the same greedy matcher as the
+    server. Positions are remembered by their next four bytes.
+    """
+    out = bytearray()
+    table = {}
+    anchor = 0
+    pos = 0
+    match_limit = len(chunk) - LZ4_MFLIMIT
+    end_limit = len(chunk) - LZ4_LAST_LITERALS
+
+    def _length(value: int) -> None:
+        while value >= 255:
+            out.append(255)
+            value -= 255
+        out.append(value)
+
+    while pos < match_limit:
+        sequence = chunk[pos: pos + LZ4_MIN_MATCH]
+        candidate = table.get(sequence)
+        table[sequence] = pos
+        if candidate is None or pos - candidate > LZ4_MAX_OFFSET:
+            pos += 1
+            continue
+
+        match_len = LZ4_MIN_MATCH
+        while (pos + match_len < end_limit
+               and chunk[candidate + match_len] == chunk[pos + match_len]):
+            match_len += 1
+
+        literals = pos - anchor
+        match_code = match_len - LZ4_MIN_MATCH
+        out.append((min(literals, 15) << 4) | min(match_code, 15))
+        if literals >= 15:
+            _length(literals - 15)
+        out += chunk[anchor: pos]
+        out += struct.pack("<H", pos - candidate)
+        if match_code >= 15:
+            _length(match_code - 15)
+        pos += match_len
+        anchor = pos
+
+    literals = len(chunk) - anchor
+    out.append(min(literals, 15) << 4)
+    if literals >= 15:
+        _length(literals - 15)
+    out += chunk[anchor:]
+    return bytes(out)
+
+
+def _lz4_decompress(body: bytes, raw_len: int) -> bytes:
+    """Decompress an LZ4 block that must expand to exactly raw_len bytes"""
+    out = bytearray()
+    pos = 0
+
+    def _length(value: int) -> int:
+        nonlocal pos
+        if 15 == value:
+            extra = 255
+            while 255 == extra:
+                extra = body[pos]
+                pos += 1
+                value += extra
+        return value
+
+    try:
+        while pos < len(body):
+            token = body[pos]
+            pos += 1
+            literals = _length(token >> 4)
+            out += body[pos: pos + literals]
+            pos += literals
+            if pos >= len(body):
+                break
+
+            offset = body[pos] | (body[pos + 1] << 8)
+            pos += 2
+            match_len = _length(token & 0x0F) + LZ4_MIN_MATCH
+            if 0 == offset or offset > len(out) or len(out) + match_len > raw_len:
+                raise ValueError("[!] Compressed data is corrupt")
+            start = len(out) - offset
+            if offset >= match_len:
+                out += out[start: start + match_len]
+            else:
+                for i in range(match_len):
+                    out.append(out[start + i])
+    except IndexError:
+        raise ValueError("[!] Compressed data is corrupt") from None
+    return bytes(out)
+
+
+def make_delta(alg: HashAlg, signature: bytes, payload: bytes) -> bytes:
+    """
+    Compute the delta that rebuilds the payload from the file the signature
+    was taken of. The signature holds the block size and file size followed
+    by the adler32 and truncated digest of every block. The adler32 of the
+    window is rolled over every offset of the payload and a block is copied
+    wherever both checksums match, everything else is sent as literal bytes.
+
+    :param alg: Hash algorithm of the request. Picks the block digest
+    :param signature: Signature sent by the server
+    :param payload: Bytes of the new file
+    :return: The delta
+    """
+    if len(signature) < DELTA_SIG_HEADER:
+        raise ValueError("[!] Signature is truncated")
+    block_size, base_size = struct.unpack_from("!IQ", signature, 0)
+    if 0 == block_size:
+        raise ValueError("[!] Signature is corrupt")
+    blocks = -(-base_size // block_size)
+    if len(signature) != DELTA_SIG_HEADER + blocks * DELTA_SIG_ENTRY:
+        raise ValueError("[!] Signature is corrupt")
+
+    # Full blocks are found at any offset. The short last block can only be
+    # at the end of the payload
+    table: dict[int, dict[bytes, int]] = {}
+    tail = None
+    for index in range(blocks):
+        pos = DELTA_SIG_HEADER + index * DELTA_SIG_ENTRY
+        weak = struct.unpack_from("!I", signature, pos)[0]
+        strong = signature[pos + 4: pos + DELTA_SIG_ENTRY]
+        if index == blocks - 1 and base_size % block_size:
+            tail = (base_size % block_size, weak, strong, index)
+        else:
+            table.setdefault(weak, {}).setdefault(strong, index)
+
+    delta = bytearray(struct.pack("!I", block_size))
+    run = None  # Pending copy as [index, count]
+    literal = 0
+
+    def _flush(end: int) -> None:
+        nonlocal run
+        if run is not None:
+            delta.extend(struct.pack("!BII", DELTA_OP_COPY, *run))
+            run = None
+        for chunk in _chunker(view[literal: end], COMPRESS_FRAME_SIZE):
+            delta.extend(struct.pack("!BI", DELTA_OP_DATA, len(chunk)))
+            delta.extend(chunk)
+
+    def _copy(index: int, start: int) -> None:
+        nonlocal run, literal
+        if start > literal or run is None or run[0] + run[1] != index:
+            _flush(start)
+            run = [index, 0]
+        run[1] += 1
+
+    view = memoryview(payload)
+    size = len(payload)
+    pos = 0
+    sum_a = sum_b = 0
+    if size >= block_size and table:
+        checksum = zlib.adler32(view[0: block_size])
+        sum_a, sum_b = checksum & 0xFFFF, checksum >> 16
+    while table and pos + block_size <= size:
+        strongs = table.get((sum_b << 16) | sum_a)
+        if strongs is not None:
+            index = strongs.get(_strong(alg, view[pos: pos + block_size]))
+            if index is not None:
+                _copy(index, pos)
+                pos += block_size
+                literal = pos
+                if pos + block_size <= size:
+                    checksum = zlib.adler32(view[pos: pos + block_size])
+                    sum_a, sum_b = checksum & 0xFFFF, checksum >> 16
+                continue
+
+        # Roll the window one byte forward
+        if pos + block_size < size:
+            out_byte = payload[pos]
+            sum_a = (sum_a - out_byte + payload[pos + block_size]) % ADLER_MOD
+            sum_b = (sum_b - block_size * out_byte + sum_a - 1) % ADLER_MOD
+        pos += 1
+
+    end = size
+    if tail is not None:
+        tail_len, weak, strong, index = tail
+        start = size - tail_len
+        if (start >= literal and zlib.adler32(view[start:]) == weak
+                and _strong(alg, view[start:]) == strong):
+            _copy(index, start)
+            literal = size
+            end = size
+    _flush(end)
+    return bytes(delta)
+
+
+def _strong(alg: HashAlg, block: bytes) -> bytes:
+    """Digest of a block in a signature. Tree roots of a single block would
+    only add a level over sha256"""
+    if HashAlg.BLAKE3 == alg:
+        return blake3.blake3(block).digest()[:DELTA_STRONG_LEN]
+    return hashlib.sha256(block).digest()[:DELTA_STRONG_LEN]
+
+
+def _digest(alg: HashAlg, payload: bytes) -> bytes:
+    """Hash the bytes stream with the algorithm negotiated with the server"""
+    if HashAlg.TREE == alg:
+        return _tree_hash(payload)
+    if HashAlg.BLAKE3 == alg:
+        return _blake3_hash(payload)
+    return _hash(payload)
+
+
+def _blake3_hash(payload: bytes) -> bytes:
+    """BLAKE3 digest of the bytes stream"""
+    if blake3 is None:
+        raise ValueError("[!] The blake3 package is required for BLAKE3 "
+                         "(pip install blake3)")
+    return blake3.blake3(payload, max_threads=blake3.blake3.AUTO).digest()
+
+
+def _tree_hash(payload: bytes) -> bytes:
+    """
+    Merkle root of the bytes stream split into HASH_TREE_LEAF_SIZE leaves.
+    Leaves are sha256(0x00 || leaf) and nodes sha256(0x01 || left || right).
+    A node without a sibling is promoted unchanged. hashlib releases the GIL
+    on large buffers so the leaves are hashed on multiple threads.
+    """
+    view = memoryview(payload)
+    leaves = [view[pos: pos + HASH_TREE_LEAF_SIZE]
+              for pos in range(0, len(payload), HASH_TREE_LEAF_SIZE)] or [b""]
+
+    def _leaf(leaf: bytes) -> bytes:
+        leaf_hash = hashlib.sha256(b"\x00")
+        leaf_hash.update(leaf)
+        return leaf_hash.digest()
+
+    with ThreadPoolExecutor(max_workers=os.cpu_count()) as executor:
+        level = list(executor.map(_leaf, leaves))
+
+    while len(level) > 1:
+        parents = []
+        for pos in range(0, len(level), 2):
+            if pos + 1 == len(level):
+                parents.append(level[pos])
+            else:
+                parents.append(hashlib.sha256(
+                    b"\x01" + level[pos] + level[pos + 1]).digest())
+        level = parents
+    return level[0]
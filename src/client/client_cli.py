@@ -38,6 +38,27 @@ def get_args() -> ClientRequest:
         "--shell", dest="shell", action="store_true",
         help="Drop into interactive menu mode"
     )
+    parser.add_argument(
+        "--hash", dest="hash_alg", type=str, default="sha256",
+        choices=["sha256", "tree", "blake3"],
+        help="Hash used to verify file data: a single SHA256, a Merkle tree "
+             "of SHA256 computed in parallel or BLAKE3 which needs the "
+             "blake3 package. (Default: %(default)s)"
+    )
+    parser.add_argument(
+        "--compress", dest="compress", type=str, default=None,
+        choices=["zlib", "lz4"],
+        help="Compress file data and directory listings on the wire. The "
+             "hash is always computed over the uncompressed data. "
+             "(Default: no compression)"
+    )
+
+    parser.add_argument(
+        "--no-dedup", dest="dedup", action="store_false",
+        help="Always send the file data on --put. By default the hash of "
+             "the file is sent first and the data is skipped if the server "
+             "already holds a file with the same contents."
+    )
 
     # The --src and --dst are required arguments base on the action executed
     parser.add_argument(
@@ -83,10 +104,26 @@ def get_args() -> ClientRequest:
              "invoked by users with CREATE_RW permissions."
     )
 
+    remote_commands.add_argument(
+        "--sync", dest="sync", action="store_true",
+        help="Update a file at the server directory with the client file by "
+             "sending only the blocks that changed. Files the server does not "
+             "hold are copied as with --put. Can only be invoked by users "
+             "with CREATE_RW permissions."
+    )
+
     remote_commands.add_argument(
         "--get", dest="get", action="store_true",
         help="Copy file from server directory to client directory.")
 
+    remote_commands.add_argument(
+        "--batch", dest="batch", type=Path, metavar="[FILE]",
+        help="Run the remote commands listed in FILE, or in stdin if FILE is "
+             "-, one per line as in the shell (get, put, delete, ls, "
+             "mkdir). The commands are sent on one connection without "
+             "waiting for each response, which are printed in order."
+    )
+
     #
     # Local commands
     #
@@ -106,7 +106,7 @@ def parse_action(resp: ServerResponse) -> None:
         if resp.valid_hash:
             _parse_dir(resp.payload)
 
-    elif resp.action in [ActionType.MKDIR, ActionType.PUT,
+    elif resp.action in [ActionType.MKDIR, ActionType.PUT, ActionType.SYNC,
                          ActionType.DELETE, ActionType.USER_OP]:
         print(f"[+] {resp.msg}")
 
@@ -1,5 +1,6 @@
 from __future__ import annotations
 
+import copy
 import shlex
 import getpass
 from pathlib import Path
@@ -92,6 +93,20 @@ def _put(client: ClientRequest, args: list[str]) -> None:
     client_ctrl.parse_action(resp)
 
 
+def _sync(client: ClientRequest, args: list[str]) -> None:
+    try:
+        cmd_args = _parse_args(args)
+    except ValueError as error:
+        print(error)
+        return
+
+    dst = cmd_args.get("r_dst")
+    src = cmd_args.get("r_src")
+    client.set_sync(dst, Path(src))
+    resp = client_sock.make_connection(client)
+    client_ctrl.parse_action(resp)
+
+
 def _delete(client: ClientRequest, args: list[str]) -> None:
     try:
         cmd_args = _parse_args(args)
@@ -169,6 +184,62 @@ def _l_mkdir(client: ClientRequest, args: list[str]) -> None:
     return
 
 
+def _batch(client: ClientRequest, args: list[str]) -> None:
+    try:
+        cmd_args = _parse_args(args)
+    except ValueError as error:
+        print(error)
+        return
+
+    try:
+        lines = Path(cmd_args.get("r_src")).read_text().splitlines()
+    except OSError as error:
+        print(f"[!] {error}")
+        return
+    run_batch(client, lines)
+
+
+def run_batch(client: ClientRequest, lines: list[str]) -> None:
+    """
+    Run remote commands written like the shell commands, one per line, on a
+    single connection. Every request is sent without waiting for the
+    responses before it, which are printed in order once they arrive.
+
+    Uploads send the data right away instead of offering the hash first,
+    and sync cannot be batched, because both need the response of one
+    request before the next is sent.
+
+    :param client: Client object holding the connection configuration
+    :param lines: Commands to run. Empty lines and comments are skipped
+    """
+    requests = []
+    for line in lines:
+        cmd = shlex.split(line, comments=True)
+        if not cmd:
+            continue
+        cmd[0] = cmd[0].lower()
+        setter = BATCH_CMDS.get(cmd[0])
+        if setter is None:
+            print(f"[!] Command {cmd[0]} cannot be used in a batch")
+            continue
+        try:
+            setter(client, _parse_args(cmd))
+        except (ValueError, FileExistsError) as error:
+            print(error)
+            continue
+
+        # Each request keeps the paths it was set with until its response
+        # is handled
+        requests.append(copy.copy(client))
+
+    if not requests:
+        return
+    responses = client_sock.make_pipeline(requests)
+    client.session = requests[-1].session
+    for resp in responses:
+        client_ctrl.parse_action(resp)
+
+
 def _help(client: ClientRequest, args: list[str]) -> None:
     if len(args) > 2:
         print(f"[!] Too many arguments for command. Use help {args[0]} "
@@ -281,6 +352,15 @@ ARGS = {
     "dst": "Remote PATH to reference",
     "cmds": "Command name"
 }
+BATCH_CMDS = {
+    "get": lambda client, args: client.set_get(args.get("r_dst"),
+                                               Path(args.get("r_src"))),
+    "put": lambda client, args: client.set_put(args.get("r_dst"),
+                                               Path(args.get("r_src"))),
+    "delete": lambda client, args: client.set_delete(args.get("r_dst")),
+    "ls": lambda client, args: client.set_ls(args.get("dst") or "/"),
+    "mkdir": lambda client, args: client.set_mkdir(args.get("r_dst")),
+}
 CMDS = {
     "get": {
         "help": "Gets a file from server [dst] path and copies it into the "
@@ -295,6 +375,21 @@ CMDS = {
         "args": ["r_src", "r_dst"],
         "callback": _put,
     },
+    "sync": {
+        "help": "Updates the file in the server [dst] path with the client "
+                "[src] file by sending only what changed.\n\t  Example: sync "
+                "source_file.txt dest/folder",
+        "args": ["r_src", "r_dst"],
+        "callback": _sync,
+    },
+    "batch": {
+        "help": "Runs the get, put, delete, ls and mkdir commands listed in "
+                "the local [src] file, one per line, without waiting for "
+                "each response before sending the next command\n\t  "
+                "Example: batch commands.txt",
+        "args": ["r_src"],
+        "callback": _batch,
+    },
     "help": {
         "help": "Displays this help menu",
         "args": ["cmds"],
@@ -1,3 +1,5 @@
+import sys
+
 import client_cli
 import client_sock
 import client_ctrl
@@ -23,6 +25,14 @@ def main() -> None:
             args.other_password = cli.get_password(
                 f"[Enter password for {args.other_username}]\n> ")
 
+        if args.batch is not None:
+            if "-" == args.batch.as_posix():
+                lines = sys.stdin.read().splitlines()
+            else:
+                lines = args.batch.read_text().splitlines()
+            cli.run_batch(args, lines)
+            return
+
         resp = client_sock.make_connection(args)
         client_ctrl.parse_action(resp)
 
@@ -1,21 +1,148 @@
 import contextlib
+import random
 import socket
 import struct
-from typing import Union
+import threading
+import time
+from typing import Optional, Union
 
 from client_classes import ClientRequest, RespHeader, ServerResponse, \
-    SUCCESS_RESPONSE
+    SUCCESS_RESPONSE, RESOLVE_ERROR_RESPONSE, HASH_UNKNOWN_RESPONSE, \
+    FAILURE_RESPONSE, CODEC_SHIFT, BUSY_MIN_WAIT, BUSY_MAX_WAIT, \
+    BUSY_RETRIES, ActionType, Codec, SyncOp, decompress
 
 
 def make_connection(client: ClientRequest) -> ServerResponse:
     """Make a single connection and close the socket. This is used for
-    the CLI"""
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as conn:
-        conn.connect(client.socket)
-        resp = connect(client, conn)
+    the CLI. Uploads offer the hash of the file first and only send the data
+    if the server does not already hold it"""
+    if ActionType.SYNC == client.action:
+        resp = _sync(client)
+        if resp is not None:
+            return resp
+
+    if client.offer_hash:
+        client.by_hash = True
+        try:
+            resp = _make_connection(client)
+        finally:
+            client.by_hash = False
+
+        # Servers without PUT by hash answer with a plain failure
+        if resp.return_code not in (HASH_UNKNOWN_RESPONSE, FAILURE_RESPONSE):
+            return resp
+
+    return _make_connection(client)
+
+
+def _sync(client: ClientRequest) -> Optional[ServerResponse]:
+    """
+    Update the file held by the server by sending only the blocks that
+    changed. The signature of the remote file is requested first and a
+    delta of the local file against it is sent back.
+
+    :param client: ClientRequest of the sync
+    :return: Response of the sync or None if the server does not hold the
+    file and it has to be uploaded in full
+    """
+    try:
+        client.sync_op = SyncOp.SIGNATURE
+        resp = _make_connection(client)
+
+        # Servers without sync answer with a plain failure
+        if resp.return_code in (RESOLVE_ERROR_RESPONSE, FAILURE_RESPONSE):
+            return None
+        if not resp.successful:
+            return resp
+        if not resp.valid_hash:
+            resp.return_code = FAILURE_RESPONSE
+            resp.msg = "Signature hash from server does not match the local hash"
+            return resp
+
+        client.set_signature(resp.payload)
+        if client.debug:
+            print(f"[~] Sending a delta of {client.delta_len} bytes")
+        client.sync_op = SyncOp.PUT_DELTA
+        return _make_connection(client)
+    finally:
+        client.sync_op = None
+
+
+def _make_connection(client: ClientRequest) -> ServerResponse:
+    """Send the request on a connection of its own. A request the server
+    turns away as busy is sent again once the wait it asked for is over"""
+    for attempt in range(BUSY_RETRIES + 1):
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as conn:
+            conn.connect(client.socket)
+            resp = connect(client, conn)
+        if not resp.busy or BUSY_RETRIES == attempt:
+            return resp
+        time.sleep(backoff(resp.retry_after, attempt))
     return resp
 
 
+def backoff(retry_after: float, attempt: int) -> float:
+    """
+    Time to wait before retrying a busy request. The wait the server asked
+    for doubles on every attempt and a random part of it is taken off, so
+    the clients turned away together do not all come back together.
+
+    :param retry_after: Seconds the server asked to wait
+    :param attempt: Number of the attempt that was turned away, from 0
+    :return: Seconds to wait
+    """
+    wait = min(BUSY_MAX_WAIT, max(BUSY_MIN_WAIT, retry_after) * (2 ** attempt))
+    return random.uniform(wait / 2, wait)
+
+
+def make_pipeline(requests: list[ClientRequest]) -> list[ServerResponse]:
+    """
+    Send all requests on a single connection without waiting for the
+    response of one before sending the next. The server answers them in
+    order, so the batch pays for one round trip instead of one per request.
+    The requests are written by a second thread so large uploads cannot
+    fill the socket buffers while the responses go unread.
+
+    Requests the server turns away as busy are sent again in a pipeline of
+    their own once the longest wait it asked for is over.
+
+    :param requests: ClientRequest objects, one per request
+    :return: Responses in the order of the requests
+    """
+    responses = _pipeline(requests)
+    for attempt in range(BUSY_RETRIES):
+        busy = [idx for idx, resp in enumerate(responses) if resp.busy]
+        if not busy:
+            break
+        time.sleep(backoff(max(responses[idx].retry_after for idx in busy), attempt))
+        retried = _pipeline([requests[idx] for idx in busy])
+        for idx, resp in zip(busy, retried):
+            responses[idx] = resp
+    return responses
+
+
+def _pipeline(requests: list[ClientRequest]) -> list[ServerResponse]:
+    payloads = [request.client_request for request in requests]
+    responses = []
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as conn:
+        conn.connect(requests[0].socket)
+        sender = threading.Thread(target=_send_all, args=(conn, payloads),
+                                  daemon=True)
+        sender.start()
+        for request in requests:
+            responses.append(_read_response(request, conn))
+        sender.join()
+    return responses
+
+
+def _send_all(conn: socket, payloads: list[bytes]) -> None:
+    # A connection closed by the server shows up as a short read of the
+    # responses
+    with contextlib.suppress(OSError):
+        for payload in payloads:
+            conn.sendall(payload)
+
+
 def connect(client: ClientRequest, conn: socket) -> ServerResponse:
     """
     Use the connected socket to send a ClientRequest
@@ -24,8 +151,11 @@ def connect(client: ClientRequest, conn: socket) -> ServerResponse:
     :param conn: Connected socket
     :return: Response from server
     """
-    conn.send(client.client_request)
+    conn.sendall(client.client_request)
+    return _read_response(client, conn)
+
 
+def _read_response(client: ClientRequest, conn: socket) -> ServerResponse:
     return_code = _read_stream(conn, RespHeader.RETURN_CODE, client.debug)
     reserved = _read_stream(conn, RespHeader.RESERVED, client.debug)
     session_id = _read_stream(conn, RespHeader.SESSION_ID, client.debug)
@@ -56,6 +186,11 @@ def connect(client: ClientRequest, conn: socket) -> ServerResponse:
                                        client.debug)
             resp.payload = _read_stream(conn, stream_size, client.debug)
 
+            # The digest is over the data before it was compressed
+            codec = Codec(reserved >> CODEC_SHIFT)
+            if Codec.NONE != codec:
+                resp.payload = decompress(codec, resp.payload)
+
     # Needed to make a new line for the byte stream output
     if client.debug:
         print("\n")
@@ -69,7 +204,10 @@ def _read_stream(conn: socket, size: Union[int, RespHeader], debug: bool = False
     bytes_to_read = size if isinstance(size, int) else size.value
 
     while bytes_to_read != len(buffer):
-        buffer += conn.recv((bytes_to_read - len(buffer)))
+        chunk = conn.recv((bytes_to_read - len(buffer)))
+        if not chunk:
+            raise ConnectionError("Server closed the connection")
+        buffer += chunk
 
     if debug:
         print(' '.join('{:02x}'.format(x) for x in buffer), end=" ")
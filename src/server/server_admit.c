@@ -0,0 +1,233 @@
+#include <server_admit.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct admit
+{
+    admit_limits_t      limits;
+    io_pool_t *         p_io;
+    atomic_size_t       requests;
+    _Atomic uint64_t    bytes;
+    _Atomic uint64_t    admitted;
+    _Atomic uint64_t    shed;
+};
+
+static bool enter_bytes(admit_t * p_admit, uint64_t payload_len);
+static ret_codes_t shed(admit_t * p_admit, uint32_t retry, uint32_t * p_retry_ms);
+static uint32_t retry_ms(uint64_t observed, uint64_t limit);
+
+/*!
+ * @brief Create the admission control of the server
+ *
+ * @param p_limits Pointer to the limits
+ * @param p_io Pointer to the I/O pool whose queues are limited. May be NULL
+ * @return admit_t object if successful otherwise NULL
+ */
+admit_t * admit_init(const admit_limits_t * p_limits, io_pool_t * p_io)
+{
+    if (NULL == p_limits)
+    {
+        goto ret_null;
+    }
+
+    admit_t * p_admit = (admit_t *)malloc(sizeof(admit_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_admit))
+    {
+        goto ret_null;
+    }
+    p_admit->limits = *p_limits;
+    p_admit->p_io = p_io;
+    atomic_init(&p_admit->requests, 0);
+    atomic_init(&p_admit->bytes, 0);
+    atomic_init(&p_admit->admitted, 0);
+    atomic_init(&p_admit->shed, 0);
+    return p_admit;
+
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Free the admission control
+ *
+ * @param pp_admit Double pointer to the admission control
+ */
+void admit_destroy(admit_t ** pp_admit)
+{
+    if ((NULL == pp_admit) || (NULL == *pp_admit))
+    {
+        return;
+    }
+    free(*pp_admit);
+    *pp_admit = NULL;
+}
+
+/*!
+ * @brief Admit a request whose header was read. An admitted request is
+ * counted in flight until admit_leave
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param lane Lane of the I/O workers answering the request
+ * @param payload_len Bytes of the payload of the request
+ * @param p_retry_ms Receives the milliseconds the client should wait before
+ * retrying if the request is turned away
+ * @retval OP_SUCCESS The request was admitted
+ * @retval OP_SERVER_BUSY The request is over a limit
+ */
+ret_codes_t admit_enter(admit_t * p_admit,
+                        io_lane_t lane,
+                        uint64_t payload_len,
+                        uint32_t * p_retry_ms)
+{
+    if (NULL == p_admit)
+    {
+        return OP_SUCCESS;
+    }
+    const admit_limits_t * p_limits = &p_admit->limits;
+
+    // The queue is checked first, it is the limit an overloaded disk hits
+    if (0 != p_limits->queued)
+    {
+        size_t queued = io_pool_queued(p_admit->p_io, lane);
+        if (queued >= p_limits->queued)
+        {
+            return shed(p_admit, retry_ms(queued, p_limits->queued), p_retry_ms);
+        }
+    }
+
+    size_t requests = atomic_fetch_add(&p_admit->requests, 1) + 1;
+    if ((0 != p_limits->requests) && (requests > p_limits->requests))
+    {
+        atomic_fetch_sub(&p_admit->requests, 1);
+        return shed(p_admit, retry_ms(requests, p_limits->requests), p_retry_ms);
+    }
+    if (!enter_bytes(p_admit, payload_len))
+    {
+        atomic_fetch_sub(&p_admit->requests, 1);
+        uint64_t bytes = atomic_load(&p_admit->bytes);
+        uint64_t wanted = (payload_len > (UINT64_MAX - bytes)) ? UINT64_MAX
+                                                               : bytes + payload_len;
+        return shed(p_admit, retry_ms(wanted, p_limits->bytes), p_retry_ms);
+    }
+    atomic_fetch_add_explicit(&p_admit->admitted, 1, memory_order_relaxed);
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Admit a connection just accepted. Admitted connections are not
+ * counted, their requests are
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param p_workers Pointer to the network workers the connection goes to
+ * @param p_retry_ms Receives the milliseconds the client should wait before
+ * retrying if the connection is turned away
+ * @retval OP_SUCCESS The connection was admitted
+ * @retval OP_SERVER_BUSY The workers have too many connections waiting
+ */
+ret_codes_t admit_connection(admit_t * p_admit, sched_t * p_workers, uint32_t * p_retry_ms)
+{
+    if ((NULL == p_admit) || (0 == p_admit->limits.queued))
+    {
+        return OP_SUCCESS;
+    }
+    size_t queued = sched_queued(p_workers);
+    if (queued >= p_admit->limits.queued)
+    {
+        return shed(p_admit, retry_ms(queued, p_admit->limits.queued), p_retry_ms);
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Count an admitted request out once it is answered
+ *
+ * @param p_admit Pointer to the admission control. May be NULL
+ * @param payload_len Bytes of the payload the request was admitted with
+ */
+void admit_leave(admit_t * p_admit, uint64_t payload_len)
+{
+    if (NULL == p_admit)
+    {
+        return;
+    }
+    atomic_fetch_sub(&p_admit->bytes, payload_len);
+    atomic_fetch_sub(&p_admit->requests, 1);
+}
+
+/*!
+ * @brief Read the metrics of the admission control
+ *
+ * @param p_admit Pointer to the admission control
+ * @param p_stats Receives the metrics
+ */
+void admit_stats(admit_t * p_admit, admit_stats_t * p_stats)
+{
+    if ((NULL == p_admit) || (NULL == p_stats))
+    {
+        return;
+    }
+    *p_stats = (admit_stats_t){
+        .requests   = atomic_load(&p_admit->requests),
+        .bytes      = atomic_load(&p_admit->bytes),
+        .admitted   = atomic_load_explicit(&p_admit->admitted, memory_order_relaxed),
+        .shed       = atomic_load_explicit(&p_admit->shed, memory_order_relaxed)
+    };
+}
+
+/*!
+ * @brief Add the payload to the bytes in flight unless it takes them over
+ * the limit. A payload over the limit by itself only waits for the others
+ *
+ * @param p_admit Pointer to the admission control
+ * @param payload_len Bytes of the payload
+ * @return true if the bytes were added otherwise false
+ */
+static bool enter_bytes(admit_t * p_admit, uint64_t payload_len)
+{
+    uint64_t limit = p_admit->limits.bytes;
+    uint64_t bytes = atomic_load(&p_admit->bytes);
+    do
+    {
+        if ((0 != limit) && (0 != bytes)
+            && ((bytes >= limit) || (payload_len > (limit - bytes))))
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&p_admit->bytes, &bytes, bytes + payload_len));
+    return true;
+}
+
+/*!
+ * @brief Count a request or a connection turned away
+ *
+ * @param p_admit Pointer to the admission control
+ * @param retry Milliseconds the client should wait
+ * @param p_retry_ms Receives the wait. May be NULL
+ * @return OP_SERVER_BUSY
+ */
+static ret_codes_t shed(admit_t * p_admit, uint32_t retry, uint32_t * p_retry_ms)
+{
+    atomic_fetch_add_explicit(&p_admit->shed, 1, memory_order_relaxed);
+    if (NULL != p_retry_ms)
+    {
+        *p_retry_ms = retry;
+    }
+    return OP_SERVER_BUSY;
+}
+
+/*!
+ * @brief Scale the retry hint with how far the server is over the limit
+ *
+ * @param observed Value of the counter over the limit
+ * @param limit Limit of the counter
+ * @return Milliseconds the client should wait
+ */
+static uint32_t retry_ms(uint64_t observed, uint64_t limit)
+{
+    uint64_t ratio = observed / limit;
+    if (ratio >= (ADMIT_RETRY_MAX_MS / ADMIT_RETRY_MS))
+    {
+        return ADMIT_RETRY_MAX_MS;
+    }
+    return (uint32_t)((0 == ratio) ? ADMIT_RETRY_MS : ratio * ADMIT_RETRY_MS);
+}
@@ -0,0 +1,382 @@
+#include <server_arena.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN         (alignof(max_align_t))
+#define ARENA_ROUND(size)   (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+typedef struct arena_block
+{
+    struct arena_block *    p_next;
+    size_t                  size;   // Bytes after the header
+    size_t                  used;
+} arena_block_t;
+
+// Header rounded up so the bytes after it are aligned like malloc
+#define ARENA_HEADER        ARENA_ROUND(sizeof(arena_block_t))
+
+// Resource released on reset, heap memory is released with free
+typedef struct arena_owned
+{
+    struct arena_owned *    p_next;
+    void                    (* p_release)(void *);
+    void *                  p_arg;
+} arena_owned_t;
+
+struct arena
+{
+    arena_block_t *     p_blocks;   // Blocks of block_size kept across resets
+    arena_block_t *     p_current;  // Block allocations are carved from
+    arena_block_t *     p_large;    // Blocks of a single allocation
+    arena_owned_t *     p_owned;
+    size_t              block_size;
+    mem_budget_t *      p_mem;      // The large blocks are reserved here
+};
+
+// Memory backed by a temp file, released on reset
+typedef struct
+{
+    f_stream_t *    p_file;
+    uint8_t *       p_map;
+    size_t          size;
+} arena_map_t;
+
+// Bytes of a budget reserved until reset
+typedef struct
+{
+    mem_budget_t *  p_mem;
+    size_t          size;
+} arena_reserved_t;
+
+static arena_block_t * new_block(size_t size);
+static void release_map(void * p_arg);
+static void release_reserved(void * p_arg);
+static uint8_t * block_data(arena_block_t * p_block);
+static void release(arena_t * p_arena);
+
+/*!
+ * @brief Create an arena
+ *
+ * @param block_size Number of bytes of each block. 0 uses ARENA_BLOCK_SIZE
+ * @param p_mem Memory budget the allocations larger than a block are
+ * reserved against. May be NULL
+ * @return arena_t object if successful otherwise NULL
+ */
+arena_t * arena_init(size_t block_size, mem_budget_t * p_mem)
+{
+    if (0 == block_size)
+    {
+        block_size = ARENA_BLOCK_SIZE;
+    }
+
+    arena_t * p_arena = (arena_t *)malloc(sizeof(arena_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_arena))
+    {
+        return NULL;
+    }
+    *p_arena = (arena_t){
+        .p_blocks   = new_block(ARENA_ROUND(block_size)),
+        .p_current  = NULL,
+        .p_large    = NULL,
+        .p_owned    = NULL,
+        .block_size = ARENA_ROUND(block_size),
+        .p_mem      = p_mem
+    };
+    if (NULL == p_arena->p_blocks)
+    {
+        free(p_arena);
+        return NULL;
+    }
+    p_arena->p_current = p_arena->p_blocks;
+    return p_arena;
+}
+
+/*!
+ * @brief Allocate zeroed memory aligned for any type. The memory is valid
+ * until the arena is reset or destroyed. An allocation larger than a block
+ * waits up to MEM_WAIT_MS for room in the memory budget.
+ *
+ * @param p_arena Pointer to the arena
+ * @param size Number of bytes to allocate
+ * @return Pointer to the memory if successful otherwise NULL
+ */
+void * arena_alloc(arena_t * p_arena, size_t size)
+{
+    if ((NULL == p_arena) || (size > (SIZE_MAX - ARENA_HEADER - ARENA_ALIGN)))
+    {
+        return NULL;
+    }
+    size_t rounded = ARENA_ROUND((0 == size) ? 1 : size);
+
+    // calloc hands large allocations zeroed pages without touching them
+    if (rounded > p_arena->block_size)
+    {
+        if (!mem_reserve(p_arena->p_mem, ARENA_HEADER + rounded, MEM_WAIT_MS))
+        {
+            return NULL;
+        }
+        arena_block_t * p_block = (arena_block_t *)calloc(1, ARENA_HEADER + rounded);
+        if (UV_INVALID_ALLOC == verify_alloc(p_block))
+        {
+            mem_release(p_arena->p_mem, ARENA_HEADER + rounded);
+            return NULL;
+        }
+        p_block->p_next = p_arena->p_large;
+        p_block->size = rounded;
+        p_block->used = rounded;
+        p_arena->p_large = p_block;
+        return block_data(p_block);
+    }
+
+    // Move on to the next kept block, or add one, when the current is full
+    arena_block_t * p_block = p_arena->p_current;
+    while ((p_block->size - p_block->used) < rounded)
+    {
+        if (NULL == p_block->p_next)
+        {
+            p_block->p_next = new_block(p_arena->block_size);
+            if (NULL == p_block->p_next)
+            {
+                return NULL;
+            }
+        }
+        p_block = p_block->p_next;
+        p_arena->p_current = p_block;
+    }
+
+    uint8_t * p_mem = block_data(p_block) + p_block->used;
+    p_block->used += rounded;
+    memset(p_mem, 0, size);
+    return p_mem;
+}
+
+/*!
+ * @brief Allocate memory backed by an unnamed temp file in the directory
+ * instead of the heap, for data the memory budget has no room for. The
+ * pages are written back to the file and dropped under memory pressure.
+ * The memory is valid until the arena is reset or destroyed.
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_dir Pointer to the verified_path_t of the directory
+ * @param size Number of bytes to allocate, at least 1
+ * @return Pointer to the memory if successful otherwise NULL
+ */
+void * arena_map(arena_t * p_arena, verified_path_t * p_dir, size_t size)
+{
+    if ((NULL == p_dir) || (0 == size))
+    {
+        return NULL;
+    }
+    arena_map_t * p_map = (arena_map_t *)arena_alloc(p_arena, sizeof(arena_map_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_map))
+    {
+        return NULL;
+    }
+    ret_codes_t code = OP_FAILURE;
+    p_map->p_file = f_stream_temp(p_dir, &code);
+    if (NULL == p_map->p_file)
+    {
+        return NULL;
+    }
+    p_map->p_map = f_stream_map(p_map->p_file, size);
+    p_map->size = size;
+    if ((NULL == p_map->p_map) || (!arena_defer(p_arena, release_map, p_map)))
+    {
+        release_map(p_map);
+        return NULL;
+    }
+    return p_map->p_map;
+}
+
+/*!
+ * @brief Free the heap memory with free when the arena is reset or
+ * destroyed
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_mem Pointer to memory allocated with malloc. May be NULL
+ * @return True if the arena owns the memory. The memory is not freed
+ * otherwise
+ */
+bool arena_own(arena_t * p_arena, void * p_mem)
+{
+    if (NULL == p_mem)
+    {
+        return true;
+    }
+    return arena_defer(p_arena, free, p_mem);
+}
+
+/*!
+ * @brief Call the function with its argument when the arena is reset or
+ * destroyed, before the memory of the arena is released
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_release Function releasing the resource
+ * @param p_arg Argument of the function
+ * @return True if the function will be called. It is not called otherwise
+ */
+bool arena_defer(arena_t * p_arena, void (* p_release)(void *), void * p_arg)
+{
+    if (NULL == p_release)
+    {
+        return false;
+    }
+    arena_owned_t * p_owned = (arena_owned_t *)arena_alloc(p_arena, sizeof(arena_owned_t));
+    if (NULL == p_owned)
+    {
+        return false;
+    }
+    p_owned->p_release = p_release;
+    p_owned->p_arg = p_arg;
+    p_owned->p_next = p_arena->p_owned;
+    p_arena->p_owned = p_owned;
+    return true;
+}
+
+/*!
+ * @brief Reserve bytes of a memory budget for a buffer that is not carved
+ * out of the arena but lives as long as its allocations. The bytes are
+ * given back when the arena is reset or destroyed
+ *
+ * @param p_arena Pointer to the arena
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes to reserve
+ * @param wait_ms Milliseconds to wait for the bytes to fit
+ * @return True if the bytes were reserved otherwise false
+ */
+bool arena_reserve(arena_t * p_arena, mem_budget_t * p_mem, size_t size, uint32_t wait_ms)
+{
+    arena_reserved_t * p_reserved = (arena_reserved_t *)arena_alloc(p_arena,
+                                                                    sizeof(arena_reserved_t));
+    if ((NULL == p_reserved) || (!mem_reserve(p_mem, size, wait_ms)))
+    {
+        return false;
+    }
+    p_reserved->p_mem = p_mem;
+    p_reserved->size = size;
+    if (!arena_defer(p_arena, release_reserved, p_reserved))
+    {
+        release_reserved(p_reserved);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief Release every allocation of the arena. Blocks are kept for the
+ * allocations that follow
+ *
+ * @param p_arena Pointer to the arena
+ */
+void arena_reset(arena_t * p_arena)
+{
+    if (NULL == p_arena)
+    {
+        return;
+    }
+    release(p_arena);
+    for (arena_block_t * p_block = p_arena->p_blocks; NULL != p_block; p_block = p_block->p_next)
+    {
+        p_block->used = 0;
+    }
+    p_arena->p_current = p_arena->p_blocks;
+}
+
+/*!
+ * @brief Release every allocation of the arena and free it
+ *
+ * @param pp_arena Double pointer to the arena
+ */
+void arena_destroy(arena_t ** pp_arena)
+{
+    if ((NULL == pp_arena) || (NULL == *pp_arena))
+    {
+        return;
+    }
+    arena_t * p_arena = *pp_arena;
+    release(p_arena);
+    while (NULL != p_arena->p_blocks)
+    {
+        arena_block_t * p_next = p_arena->p_blocks->p_next;
+        free(p_arena->p_blocks);
+        p_arena->p_blocks = p_next;
+    }
+    free(p_arena);
+    *pp_arena = NULL;
+}
+
+/*!
+ * @brief Allocate an empty block
+ *
+ * @param size Number of bytes after the header
+ * @return Pointer to the block if successful otherwise NULL
+ */
+static arena_block_t * new_block(size_t size)
+{
+    arena_block_t * p_block = (arena_block_t *)malloc(ARENA_HEADER + size);
+    if (UV_INVALID_ALLOC == verify_alloc(p_block))
+    {
+        return NULL;
+    }
+    *p_block = (arena_block_t){
+        .p_next = NULL,
+        .size   = size,
+        .used   = 0
+    };
+    return p_block;
+}
+
+/*!
+ * @brief Unmap memory backed by a temp file and close the file, which
+ * releases its space on disk
+ *
+ * @param p_arg Pointer to the arena_map_t object
+ */
+static void release_map(void * p_arg)
+{
+    arena_map_t * p_map = (arena_map_t *)p_arg;
+    f_stream_unmap(p_map->p_map, p_map->size);
+    f_stream_close(&p_map->p_file);
+}
+
+/*!
+ * @brief Give back the bytes reserved by arena_reserve
+ */
+static void release_reserved(void * p_arg)
+{
+    arena_reserved_t * p_reserved = (arena_reserved_t *)p_arg;
+    mem_release(p_reserved->p_mem, p_reserved->size);
+}
+
+/*!
+ * @brief Get the first byte after the header of the block
+ */
+static uint8_t * block_data(arena_block_t * p_block)
+{
+    return (uint8_t *)p_block + ARENA_HEADER;
+}
+
+/*!
+ * @brief Release the owned resources and free the large blocks. Owned
+ * resources are recorded inside the blocks so they are released before the
+ * blocks are reused, and in the reverse order they were handed over
+ *
+ * @param p_arena Pointer to the arena
+ */
+static void release(arena_t * p_arena)
+{
+    for (arena_owned_t * p_owned = p_arena->p_owned; NULL != p_owned; p_owned = p_owned->p_next)
+    {
+        p_owned->p_release(p_owned->p_arg);
+    }
+    p_arena->p_owned = NULL;
+
+    while (NULL != p_arena->p_large)
+    {
+        arena_block_t * p_next = p_arena->p_large->p_next;
+        mem_release(p_arena->p_mem, ARENA_HEADER + p_arena->p_large->size);
+        free(p_arena->p_large);
+        p_arena->p_large = p_next;
+    }
+}
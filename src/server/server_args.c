@@ -2,6 +2,17 @@
 
 DEBUG_STATIC uint32_t get_port(char * port);
 DEBUG_STATIC uint8_t get_timeout(char * timeout);
+DEBUG_STATIC int get_durability(char * mode);
+DEBUG_STATIC uint16_t get_workers(char * workers);
+DEBUG_STATIC bool get_worker_bounds(char * bounds, uint16_t * p_min, uint16_t * p_max);
+DEBUG_STATIC int64_t get_cache_size(char * size);
+DEBUG_STATIC int64_t get_rate(char * rate);
+DEBUG_STATIC bool get_limits(char * limits, args_t * p_args);
+DEBUG_STATIC bool get_admission(char * admission, args_t * p_args);
+DEBUG_STATIC int64_t get_memory(char * size);
+static int64_t str_to_suffixed(char * str_num, uint64_t max);
+static uint16_t default_workers(void);
+static uint16_t default_max_workers(uint16_t min_workers);
 static uint8_t str_to_long(char * str_num, long int * int_val);
 verified_path_t * get_home_dir(char * home_dir);
 static void print_usage(void);
@@ -31,7 +42,22 @@ void args_destroy(args_t ** pp_args)
     *p_args = (args_t){
         .p_home_directory   = NULL,
         .timeout            = 0,
-        .port               = 0
+        .port               = 0,
+        .durability         = SYNC_NONE,
+        .net_workers        = 0,
+        .net_workers_max    = 0,
+        .io_workers         = 0,
+        .io_workers_max     = 0,
+        .bulk_workers       = 0,
+        .bulk_workers_max   = 0,
+        .acceptors          = 0,
+        .cache_size         = 0,
+        .b_chunks           = false,
+        .b_per_core         = false,
+        .limits             = { 0 },
+        .user_limit_count   = 0,
+        .admission          = { 0 },
+        .memory             = 0
     };
 
     free(p_args);
@@ -62,7 +88,19 @@ args_t * args_parse(int argc, char ** argv)
     *p_args = (args_t){
         .port           = DEFAULT_PORT,
         .timeout        = DEFAULT_TIMEOUT,
-        .p_home_directory = NULL
+        .p_home_directory = NULL,
+        .durability     = SYNC_NONE,
+        .net_workers    = default_workers(),
+        .io_workers     = default_workers(),
+        .bulk_workers   = default_workers(),
+        .acceptors      = 1,
+        .cache_size     = CACHE_DEFAULT_SIZE,
+        .b_chunks       = false,
+        .b_per_core     = false,
+        .limits         = { 0 },
+        .user_limit_count = 0,
+        .admission      = { 0 },
+        .memory         = (uint64_t)MEM_DEFAULT_MIB << 20
     };
 
 
@@ -73,8 +111,17 @@ args_t * args_parse(int argc, char ** argv)
     bool b_port = false;
     bool b_timeout = false;
     bool b_home_dir = false;
-
-    while ((c = getopt(argc, argv, "p:t:d:h")) != -1)
+    bool b_durability = false;
+    bool b_net_workers = false;
+    bool b_io_workers = false;
+    bool b_bulk_workers = false;
+    bool b_acceptors = false;
+    bool b_cache_size = false;
+    bool b_limits = false;
+    bool b_admission = false;
+    bool b_memory = false;
+
+    while ((c = getopt(argc, argv, "p:t:d:s:n:i:b:a:c:l:q:m:kxh")) != -1)
         switch (c)
         {
             case 'p':
@@ -113,11 +160,143 @@ args_t * args_parse(int argc, char ** argv)
                 }
                 b_home_dir = true;
                 break;
+            case 's':
+            {
+                if (b_durability)
+                {
+                    goto duplicate_args;
+                }
+                int mode = get_durability(optarg);
+                if (-1 == mode)
+                {
+                    goto cleanup;
+                }
+                p_args->durability = (sync_mode_t)mode;
+                b_durability = true;
+                break;
+            }
+            case 'n':
+                if (b_net_workers)
+                {
+                    goto duplicate_args;
+                }
+                if (!get_worker_bounds(optarg, &p_args->net_workers,
+                                       &p_args->net_workers_max))
+                {
+                    goto cleanup;
+                }
+                b_net_workers = true;
+                break;
+            case 'i':
+                if (b_io_workers)
+                {
+                    goto duplicate_args;
+                }
+                if (!get_worker_bounds(optarg, &p_args->io_workers,
+                                       &p_args->io_workers_max))
+                {
+                    goto cleanup;
+                }
+                b_io_workers = true;
+                break;
+            case 'b':
+                if (b_bulk_workers)
+                {
+                    goto duplicate_args;
+                }
+                if (!get_worker_bounds(optarg, &p_args->bulk_workers,
+                                       &p_args->bulk_workers_max))
+                {
+                    goto cleanup;
+                }
+                b_bulk_workers = true;
+                break;
+            case 'a':
+                if (b_acceptors)
+                {
+                    goto duplicate_args;
+                }
+                p_args->acceptors = get_workers(optarg);
+                if (0 == p_args->acceptors)
+                {
+                    goto cleanup;
+                }
+                b_acceptors = true;
+                break;
+            case 'c':
+            {
+                if (b_cache_size)
+                {
+                    goto duplicate_args;
+                }
+                int64_t cache_size = get_cache_size(optarg);
+                if (-1 == cache_size)
+                {
+                    goto cleanup;
+                }
+                p_args->cache_size = (size_t)cache_size;
+                b_cache_size = true;
+                break;
+            }
+            case 'l':
+                if (b_limits)
+                {
+                    goto duplicate_args;
+                }
+                if (!get_limits(optarg, p_args))
+                {
+                    goto cleanup;
+                }
+                b_limits = true;
+                break;
+            case 'q':
+                if (b_admission)
+                {
+                    goto duplicate_args;
+                }
+                if (!get_admission(optarg, p_args))
+                {
+                    goto cleanup;
+                }
+                b_admission = true;
+                break;
+            case 'm':
+            {
+                if (b_memory)
+                {
+                    goto duplicate_args;
+                }
+                int64_t memory = get_memory(optarg);
+                if (-1 == memory)
+                {
+                    goto cleanup;
+                }
+                p_args->memory = (uint64_t)memory;
+                b_memory = true;
+                break;
+            }
+            case 'k':
+                if (p_args->b_chunks)
+                {
+                    goto duplicate_args;
+                }
+                p_args->b_chunks = true;
+                break;
+            case 'x':
+                if (p_args->b_per_core)
+                {
+                    goto duplicate_args;
+                }
+                p_args->b_per_core = true;
+                break;
             case 'h':
                 print_usage();
                 goto cleanup;
             case '?':
-                if ((optopt == 'p') || (optopt == 'n'))
+                if ((optopt == 'p') || (optopt == 'n') || (optopt == 's')
+                    || (optopt == 'i') || (optopt == 'b') || (optopt == 'a')
+                    || (optopt == 'c') || (optopt == 'l') || (optopt == 'q')
+                    || (optopt == 'm'))
                 {
                     fprintf(stderr,
                             "Option -%c requires an argument.\n",
@@ -149,6 +328,20 @@ args_t * args_parse(int argc, char ** argv)
         fprintf(stderr, "[!] -d argument is mandatory\n");
         goto cleanup;
     }
+
+    // Pools whose size was not given grow up to a multiple of their minimum
+    if (!b_net_workers)
+    {
+        p_args->net_workers_max = default_max_workers(p_args->net_workers);
+    }
+    if (!b_io_workers)
+    {
+        p_args->io_workers_max = default_max_workers(p_args->io_workers);
+    }
+    if (!b_bulk_workers)
+    {
+        p_args->bulk_workers_max = default_max_workers(p_args->bulk_workers);
+    }
     return p_args;
 
 duplicate_args:
@@ -171,7 +364,42 @@ static void print_usage(void)
            "\t-t\tSession timeout in seconds (default: 10s)\n"
            "\t-p\tPort number to listen on (default: 31337)\n"
            "\t-d\tHome directory of the server. Path must have read and write "
-           "permissions.\n");
+           "permissions.\n"
+           "\t-s\tDurability of file writes (default: none)\n"
+           "\t\t  none  - leave flushing to the kernel\n"
+           "\t\t  op    - fsync every write before responding\n"
+           "\t\t  group - batch the fsyncs of concurrent writes before "
+           "responding\n"
+           "\t-n\tNumber of network workers serving clients, N or MIN:MAX "
+           "to let the pool grow from MIN to MAX as the workers block "
+           "(default: number of CPUs to 4 times that)\n"
+           "\t-i\tNumber of I/O workers performing file system operations, "
+           "N or MIN:MAX (default: number of CPUs to 4 times that)\n"
+           "\t-b\tNumber of I/O workers reserved for file transfers, N or "
+           "MIN:MAX (default: number of CPUs to 4 times that)\n"
+           "\t-a\tNumber of threads accepting connections, each on its own "
+           "socket and with its share of the network workers (default: 1)\n"
+           "\t-c\tSize in MiB of the cache of compressed files. 0 disables "
+           "the cache (default: 256)\n"
+           "\t-l\tBandwidth limits in bytes per second as SCOPE=RATE[,...], "
+           "SCOPE being server, connection, a permission (read, read_write "
+           "or admin) or user:NAME and RATE taking a K, M or G suffix. 0 is no "
+           "limit and the rate of a user is saved with its account "
+           "(default: none)\n"
+           "\t-q\tLimits past which requests are answered busy with a retry "
+           "hint as LIMIT=VALUE[,...], LIMIT being queue (connections "
+           "waiting for a network worker or jobs for the I/O workers of a "
+           "lane), requests (requests being answered) "
+           "or bytes (their payloads) and VALUE taking a K, M or G suffix. "
+           "0 is no limit (default: none)\n"
+           "\t-m\tMemory budget in MiB of the data of the requests in "
+           "flight. Data without room waits for it or is spilled to disk. "
+           "0 is no limit (default: 1024)\n"
+           "\t-k\tStore new files as deduplicated chunks. Files already "
+           "stored as chunks are always served\n"
+           "\t-x\tRun an acceptor on every CPU, pinned to it with its share "
+           "of the network workers and fed the connections the CPU "
+           "receives. Overrides -a\n");
 }
 
 /*!
@@ -248,6 +476,328 @@ DEBUG_STATIC uint8_t get_timeout(char * timeout)
     return (uint8_t)converted_timeout;
 }
 
+/*!
+ * @brief Convert the durability argument into a sync_mode_t
+ * @param mode Durability argument. One of "none", "op" or "group"
+ * @return -1 if failure or the sync_mode_t value
+ */
+DEBUG_STATIC int get_durability(char * mode)
+{
+    if (0 == strcmp(mode, "none"))
+    {
+        return SYNC_NONE;
+    }
+    else if (0 == strcmp(mode, "op"))
+    {
+        return SYNC_OP;
+    }
+    else if (0 == strcmp(mode, "group"))
+    {
+        return SYNC_GROUP;
+    }
+
+    fprintf(stderr, "[!] Durability must be one of none, op or group\n");
+    return -1;
+}
+
+/*!
+ * @brief Convert the worker count argument into an integer
+ * @param workers Number of workers to convert
+ * @return 0 if failure or the number of workers
+ */
+DEBUG_STATIC uint16_t get_workers(char * workers)
+{
+    long int converted_workers = 0;
+    int result = str_to_long(workers, &converted_workers);
+    if (0 == result)
+    {
+        return 0;
+    }
+
+    if ((converted_workers < 1) || (converted_workers > SCHED_MAX_WORKERS))
+    {
+        fprintf(stderr, "[!] Number of workers must be between 1 "
+                        "and %u\n", SCHED_MAX_WORKERS);
+        return 0;
+    }
+
+    return (uint16_t)converted_workers;
+}
+
+/*!
+ * @brief Convert the worker bounds argument, a count or MIN:MAX, into the
+ * bounds of a pool. A count sets both bounds
+ * @param bounds Bounds to convert
+ * @param p_min Receives the minimum number of workers
+ * @param p_max Receives the maximum number of workers
+ * @return true if the bounds are valid otherwise false
+ */
+DEBUG_STATIC bool get_worker_bounds(char * bounds, uint16_t * p_min, uint16_t * p_max)
+{
+    char min_str[16] = { 0 };
+    char * p_colon = strchr(bounds, ':');
+    if (NULL == p_colon)
+    {
+        *p_min = get_workers(bounds);
+        *p_max = *p_min;
+        return (0 != *p_min);
+    }
+
+    size_t min_len = (size_t)(p_colon - bounds);
+    if (min_len >= sizeof(min_str))
+    {
+        fprintf(stderr, "[!] Invalid worker bounds %s\n", bounds);
+        return false;
+    }
+    memcpy(min_str, bounds, min_len);
+    *p_min = get_workers(min_str);
+    *p_max = get_workers(p_colon + 1);
+    if ((0 == *p_min) || (0 == *p_max))
+    {
+        return false;
+    }
+    if (*p_min > *p_max)
+    {
+        fprintf(stderr, "[!] Minimum number of workers is above the maximum\n");
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief Convert the cache size argument in MiB into bytes
+ * @param size Size of the cache in MiB. 0 disables the cache
+ * @return -1 if failure or the size of the cache in bytes
+ */
+DEBUG_STATIC int64_t get_cache_size(char * size)
+{
+    long int converted_size = 0;
+    int result = str_to_long(size, &converted_size);
+    if (0 == result)
+    {
+        return -1;
+    }
+
+    if ((converted_size < 0) || (converted_size > MAX_CACHE_MIB))
+    {
+        fprintf(stderr, "[!] Cache size must be between 0 and %u MiB\n",
+                MAX_CACHE_MIB);
+        return -1;
+    }
+
+    return (int64_t)converted_size << 20;
+}
+
+/*!
+ * @brief Convert the memory budget argument in MiB into bytes
+ * @param size Size of the budget in MiB. 0 is no limit
+ * @return -1 if failure or the size of the budget in bytes
+ */
+DEBUG_STATIC int64_t get_memory(char * size)
+{
+    long int converted_size = 0;
+    int result = str_to_long(size, &converted_size);
+    if (0 == result)
+    {
+        return -1;
+    }
+
+    if ((converted_size < 0) || (converted_size > MAX_MEMORY_MIB))
+    {
+        fprintf(stderr, "[!] Memory budget must be between 0 and %u MiB\n",
+                MAX_MEMORY_MIB);
+        return -1;
+    }
+
+    return (int64_t)converted_size << 20;
+}
+
+/*!
+ * @brief Convert a rate argument into bytes per second. The rate takes an
+ * optional K, M or G suffix for KiB, MiB or GiB
+ * @param rate Rate to convert
+ * @return -1 if failure or the rate in bytes per second
+ */
+DEBUG_STATIC int64_t get_rate(char * rate)
+{
+    int64_t converted_rate = str_to_suffixed(rate, SHAPE_MAX_RATE);
+    if (-1 == converted_rate)
+    {
+        fprintf(stderr, "[!] Invalid rate %s, rates are bytes per second up to "
+                        "16G with an optional K, M or G suffix\n", rate);
+    }
+    return converted_rate;
+}
+
+/*!
+ * @brief Convert the bandwidth limits argument, a list of SCOPE=RATE
+ * separated by commas, into the limits of the args. The scope is server,
+ * connection, read, read_write, admin or user:NAME
+ * @param limits Limits to convert
+ * @param p_args Pointer to the args receiving the limits
+ * @return true if every limit is valid otherwise false
+ */
+DEBUG_STATIC bool get_limits(char * limits, args_t * p_args)
+{
+    char * p_copy = strdup(limits);
+    if (UV_INVALID_ALLOC == verify_alloc(p_copy))
+    {
+        return false;
+    }
+
+    bool b_valid = true;
+    char * p_save = NULL;
+    for (char * p_limit = strtok_r(p_copy, ",", &p_save);
+         (b_valid) && (NULL != p_limit);
+         p_limit = strtok_r(NULL, ",", &p_save))
+    {
+        char * p_equal = strchr(p_limit, '=');
+        if (NULL == p_equal)
+        {
+            fprintf(stderr, "[!] Limit %s is not SCOPE=RATE\n", p_limit);
+            b_valid = false;
+            break;
+        }
+        *p_equal = '\0';
+        int64_t rate = get_rate(p_equal + 1);
+        if (-1 == rate)
+        {
+            b_valid = false;
+            break;
+        }
+
+        const char * p_user = (0 == strncmp(p_limit, "user:", 5)) ? p_limit + 5 : NULL;
+        if (0 == strcmp(p_limit, "server"))
+        {
+            p_args->limits.server = (uint64_t)rate;
+        }
+        else if (0 == strcmp(p_limit, "connection"))
+        {
+            p_args->limits.connection = (uint64_t)rate;
+        }
+        else if (0 == strcmp(p_limit, "read"))
+        {
+            p_args->limits.levels[READ] = (uint64_t)rate;
+        }
+        else if (0 == strcmp(p_limit, "read_write"))
+        {
+            p_args->limits.levels[READ_WRITE] = (uint64_t)rate;
+        }
+        else if (0 == strcmp(p_limit, "admin"))
+        {
+            p_args->limits.levels[ADMIN] = (uint64_t)rate;
+        }
+        else if ((NULL != p_user)
+                 && (strlen(p_user) >= MIN_USERNAME_LEN)
+                 && (strlen(p_user) <= MAX_USERNAME_LEN)
+                 && (p_args->user_limit_count < MAX_USER_LIMITS))
+        {
+            user_limit_t * p_entry = &p_args->user_limits[p_args->user_limit_count];
+            strcpy(p_entry->username, p_user);
+            p_entry->rate = (uint64_t)rate;
+            p_args->user_limit_count++;
+        }
+        else
+        {
+            fprintf(stderr, "[!] Invalid limit scope %s, use server, connection, "
+                            "read, read_write, admin or user:NAME for up to %d "
+                            "users\n", p_limit, MAX_USER_LIMITS);
+            b_valid = false;
+        }
+    }
+    free(p_copy);
+    return b_valid;
+}
+
+/*!
+ * @brief Convert the admission control argument, a list of LIMIT=VALUE
+ * separated by commas, into the admission limits of the args. The limit is
+ * queue, requests or bytes
+ * @param admission Limits to convert
+ * @param p_args Pointer to the args receiving the limits
+ * @return true if every limit is valid otherwise false
+ */
+DEBUG_STATIC bool get_admission(char * admission, args_t * p_args)
+{
+    char * p_copy = strdup(admission);
+    if (UV_INVALID_ALLOC == verify_alloc(p_copy))
+    {
+        return false;
+    }
+
+    bool b_valid = true;
+    char * p_save = NULL;
+    for (char * p_limit = strtok_r(p_copy, ",", &p_save);
+         (b_valid) && (NULL != p_limit);
+         p_limit = strtok_r(NULL, ",", &p_save))
+    {
+        char * p_equal = strchr(p_limit, '=');
+        if (NULL == p_equal)
+        {
+            fprintf(stderr, "[!] Limit %s is not LIMIT=VALUE\n", p_limit);
+            b_valid = false;
+            break;
+        }
+        *p_equal = '\0';
+        int64_t value = str_to_suffixed(p_equal + 1, SIZE_MAX);
+        if (-1 == value)
+        {
+            fprintf(stderr, "[!] Invalid value %s, values are counts with an "
+                            "optional K, M or G suffix\n", p_equal + 1);
+            b_valid = false;
+            break;
+        }
+
+        if (0 == strcmp(p_limit, "queue"))
+        {
+            p_args->admission.queued = (size_t)value;
+        }
+        else if (0 == strcmp(p_limit, "requests"))
+        {
+            p_args->admission.requests = (size_t)value;
+        }
+        else if (0 == strcmp(p_limit, "bytes"))
+        {
+            p_args->admission.bytes = (uint64_t)value;
+        }
+        else
+        {
+            fprintf(stderr, "[!] Invalid limit %s, use queue, requests or "
+                            "bytes\n", p_limit);
+            b_valid = false;
+        }
+    }
+    free(p_copy);
+    return b_valid;
+}
+
+/*!
+ * @brief Get the default number of workers which is the number of online
+ * processors capped to what the thread pool supports
+ * @return Number of workers
+ */
+static uint16_t default_workers(void)
+{
+    long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (number_of_processors < 1)
+    {
+        return 1;
+    }
+    return (number_of_processors > SCHED_MAX_WORKERS) ? SCHED_MAX_WORKERS
+                                                      : (uint16_t)number_of_processors;
+}
+
+/*!
+ * @brief Get the default maximum of a pool of min_workers workers
+ * @param min_workers Minimum number of workers of the pool
+ * @return Number of workers
+ */
+static uint16_t default_max_workers(uint16_t min_workers)
+{
+    uint32_t max_workers = (uint32_t)min_workers * WORKERS_GROWTH;
+    return (max_workers > SCHED_MAX_WORKERS) ? SCHED_MAX_WORKERS : (uint16_t)max_workers;
+}
+
 /*!
  * @brief Convert the provided port argument into a valid port number this
  * includes ensuring that the port value is not less than the 1024 range
@@ -310,3 +860,50 @@ static uint8_t str_to_long(char * str_num, long int * int_val)
 
     return 1;
 }
+
+/*!
+ * @brief Convert a number with an optional K, M or G suffix multiplying it
+ * by 2^10, 2^20 or 2^30
+ *
+ * @param str_num String to convert
+ * @param max Largest value accepted
+ * @return -1 if failure or the value
+ */
+static int64_t str_to_suffixed(char * str_num, uint64_t max)
+{
+    errno = 0;
+    char * p_end = NULL;
+    long long converted = strtoll(str_num, &p_end, 10);
+    if ((0 != errno) || (p_end == str_num) || (converted < 0))
+    {
+        return -1;
+    }
+
+    int shift = 0;
+    switch (*p_end)
+    {
+        case 'K':
+            shift = 10;
+            p_end++;
+            break;
+        case 'M':
+            shift = 20;
+            p_end++;
+            break;
+        case 'G':
+            shift = 30;
+            p_end++;
+            break;
+        default:
+            break;
+    }
+    if (max > INT64_MAX)
+    {
+        max = INT64_MAX;
+    }
+    if (('\0' != *p_end) || ((uint64_t)converted > (max >> shift)))
+    {
+        return -1;
+    }
+    return (int64_t)converted << shift;
+}
@@ -0,0 +1,625 @@
+#include <server_blake3.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BLAKE3_AVX2
+#endif
+
+// Number of chunks hashed side by side by the AVX2 implementation
+#define BLAKE3_SIMD_DEGREE  8
+
+enum blake3_flags
+{
+    CHUNK_START = 1 << 0,
+    CHUNK_END   = 1 << 1,
+    PARENT      = 1 << 2,
+    ROOT        = 1 << 3
+};
+
+static const uint32_t g_iv[8] = {
+    0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+    0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+// Message word order of each of the seven rounds. Every row is the previous
+// row run through the BLAKE3 message permutation
+static const uint8_t g_schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+// Compression input kept until it is known whether it is the root
+typedef struct
+{
+    uint32_t    cv[8];
+    uint8_t     block[BLAKE3_BLOCK_LEN];
+    uint8_t     block_len;
+    uint64_t    counter;
+    uint8_t     flags;
+} blake3_output_t;
+
+static pthread_once_t g_detect_once = PTHREAD_ONCE_INIT;
+static bool gb_has_avx2 = false;
+static bool gb_use_simd = true;
+
+static void detect_simd(void);
+static bool simd_enabled(void);
+static uint32_t load32(const uint8_t * p_bytes);
+static void store32(uint8_t * p_bytes, uint32_t word);
+static uint32_t rotr32(uint32_t word, unsigned int count);
+static void g_mix(uint32_t * p_state, size_t a, size_t b, size_t c, size_t d,
+                  uint32_t x, uint32_t y);
+static void compress(const uint32_t cv[8],
+                     const uint8_t block[BLAKE3_BLOCK_LEN],
+                     uint8_t block_len,
+                     uint64_t counter,
+                     uint8_t flags,
+                     uint32_t out[8]);
+static void hash_chunk(const uint8_t * p_chunk, uint64_t counter, uint32_t out[8]);
+static void hash_chunks(const uint8_t * p_input,
+                        size_t chunks,
+                        uint64_t counter,
+                        uint32_t (* p_out)[8]);
+static void chunk_init(blake3_chunk_t * p_chunk, uint64_t counter);
+static size_t chunk_len(const blake3_chunk_t * p_chunk);
+static void chunk_update(blake3_chunk_t * p_chunk, const uint8_t * p_input, size_t length);
+static blake3_output_t chunk_output(const blake3_chunk_t * p_chunk);
+static blake3_output_t parent_output(const uint32_t left[8], const uint32_t right[8]);
+static void output_cv(const blake3_output_t * p_output, uint32_t out[8]);
+static void push_chunk_cv(blake3_hasher_t * p_hasher, uint32_t cv[8], uint64_t total_chunks);
+#ifdef BLAKE3_AVX2
+static void hash8_avx2(const uint8_t * p_input, uint64_t counter, uint32_t (* p_out)[8]);
+#endif
+
+/*!
+ * @brief Initialize the hasher
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t to initialize
+ */
+void blake3_init(blake3_hasher_t * p_hasher)
+{
+    chunk_init(&p_hasher->chunk, 0);
+    p_hasher->cv_stack_len = 0;
+}
+
+/*!
+ * @brief Add the bytes to the running hash. Runs of whole chunks are hashed
+ * several at a time with AVX2 when the processor supports it.
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t object
+ * @param p_input Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ */
+void blake3_update(blake3_hasher_t * p_hasher, const uint8_t * p_input, size_t length)
+{
+    // Finish the chunk in progress. A full chunk is only pushed once more
+    // input arrives because the last chunk is finalized differently
+    if (chunk_len(&p_hasher->chunk) > 0)
+    {
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&p_hasher->chunk);
+        if (take > length)
+        {
+            take = length;
+        }
+        chunk_update(&p_hasher->chunk, p_input, take);
+        p_input += take;
+        length -= take;
+        if (0 == length)
+        {
+            return;
+        }
+
+        uint32_t cv[8];
+        blake3_output_t output = chunk_output(&p_hasher->chunk);
+        output_cv(&output, cv);
+        uint64_t total_chunks = p_hasher->chunk.chunk_counter + 1;
+        push_chunk_cv(p_hasher, cv, total_chunks);
+        chunk_init(&p_hasher->chunk, total_chunks);
+    }
+
+    // Hash whole chunks directly from the input while keeping at least one
+    // byte for the chunk state
+    if (length > BLAKE3_CHUNK_LEN)
+    {
+        size_t chunks = (length - 1) / BLAKE3_CHUNK_LEN;
+        uint64_t counter = p_hasher->chunk.chunk_counter;
+        uint32_t cvs[BLAKE3_SIMD_DEGREE][8];
+
+        for (size_t done = 0; done < chunks; )
+        {
+            size_t batch = chunks - done;
+            if (batch > BLAKE3_SIMD_DEGREE)
+            {
+                batch = BLAKE3_SIMD_DEGREE;
+            }
+            hash_chunks(p_input, batch, counter, cvs);
+            for (size_t idx = 0; idx < batch; idx++)
+            {
+                counter++;
+                push_chunk_cv(p_hasher, cvs[idx], counter);
+            }
+            p_input += batch * BLAKE3_CHUNK_LEN;
+            length -= batch * BLAKE3_CHUNK_LEN;
+            done += batch;
+        }
+        chunk_init(&p_hasher->chunk, counter);
+    }
+
+    chunk_update(&p_hasher->chunk, p_input, length);
+}
+
+/*!
+ * @brief Write the 32 byte digest of everything added so far. The hasher is
+ * not modified so more input may be added afterwards.
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t object
+ * @param p_out Buffer of BLAKE3_OUT_LEN bytes receiving the digest
+ */
+void blake3_final(const blake3_hasher_t * p_hasher, uint8_t * p_out)
+{
+    blake3_output_t output = chunk_output(&p_hasher->chunk);
+
+    for (size_t idx = p_hasher->cv_stack_len; idx > 0; idx--)
+    {
+        uint32_t cv[8];
+        output_cv(&output, cv);
+        output = parent_output(p_hasher->cv_stack[idx - 1], cv);
+    }
+
+    uint32_t root[8];
+    compress(output.cv, output.block, output.block_len, output.counter,
+             (uint8_t)(output.flags | ROOT), root);
+    for (size_t idx = 0; idx < 8; idx++)
+    {
+        store32(p_out + (idx * 4), root[idx]);
+    }
+}
+
+/*!
+ * @brief Choose between the AVX2 and the portable implementation. Only used
+ * to compare both implementations; by default the AVX2 implementation is
+ * used whenever the processor supports it.
+ *
+ * @param b_enable false to force the portable implementation
+ * @return true if the AVX2 implementation is used after the call
+ */
+bool blake3_use_simd(bool b_enable)
+{
+    pthread_once(&g_detect_once, detect_simd);
+    gb_use_simd = b_enable;
+    return simd_enabled();
+}
+
+/*!
+ * @brief Check once whether the processor supports AVX2
+ */
+static void detect_simd(void)
+{
+#ifdef BLAKE3_AVX2
+    __builtin_cpu_init();
+    gb_has_avx2 = (0 != __builtin_cpu_supports("avx2"));
+#endif
+}
+
+/*!
+ * @brief Check whether whole chunks are hashed with AVX2
+ *
+ * @return true if the AVX2 implementation is used
+ */
+static bool simd_enabled(void)
+{
+    pthread_once(&g_detect_once, detect_simd);
+    return gb_has_avx2 && gb_use_simd;
+}
+
+static uint32_t load32(const uint8_t * p_bytes)
+{
+    return ((uint32_t)p_bytes[0]) | ((uint32_t)p_bytes[1] << 8)
+           | ((uint32_t)p_bytes[2] << 16) | ((uint32_t)p_bytes[3] << 24);
+}
+
+static void store32(uint8_t * p_bytes, uint32_t word)
+{
+    p_bytes[0] = (uint8_t)word;
+    p_bytes[1] = (uint8_t)(word >> 8);
+    p_bytes[2] = (uint8_t)(word >> 16);
+    p_bytes[3] = (uint8_t)(word >> 24);
+}
+
+static uint32_t rotr32(uint32_t word, unsigned int count)
+{
+    return (word >> count) | (word << (32 - count));
+}
+
+/*!
+ * @brief BLAKE3 quarter round mixing two message words into four state words
+ */
+static void g_mix(uint32_t * p_state, size_t a, size_t b, size_t c, size_t d,
+                  uint32_t x, uint32_t y)
+{
+    p_state[a] = p_state[a] + p_state[b] + x;
+    p_state[d] = rotr32(p_state[d] ^ p_state[a], 16);
+    p_state[c] = p_state[c] + p_state[d];
+    p_state[b] = rotr32(p_state[b] ^ p_state[c], 12);
+    p_state[a] = p_state[a] + p_state[b] + y;
+    p_state[d] = rotr32(p_state[d] ^ p_state[a], 8);
+    p_state[c] = p_state[c] + p_state[d];
+    p_state[b] = rotr32(p_state[b] ^ p_state[c], 7);
+}
+
+/*!
+ * @brief Compress one block into a new chaining value
+ *
+ * @param cv Input chaining value
+ * @param block Block of message bytes, zero padded past block_len
+ * @param block_len Number of message bytes in the block
+ * @param counter Chunk counter, 0 for parent nodes
+ * @param flags Domain separation flags of the block
+ * @param out Output chaining value. May alias cv
+ */
+static void compress(const uint32_t cv[8],
+                     const uint8_t block[BLAKE3_BLOCK_LEN],
+                     uint8_t block_len,
+                     uint64_t counter,
+                     uint8_t flags,
+                     uint32_t out[8])
+{
+    uint32_t words[16];
+    for (size_t idx = 0; idx < 16; idx++)
+    {
+        words[idx] = load32(block + (idx * 4));
+    }
+
+    uint32_t state[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        g_iv[0], g_iv[1], g_iv[2], g_iv[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags
+    };
+
+    for (size_t round = 0; round < 7; round++)
+    {
+        const uint8_t * p_sched = g_schedule[round];
+        g_mix(state, 0, 4, 8, 12, words[p_sched[0]], words[p_sched[1]]);
+        g_mix(state, 1, 5, 9, 13, words[p_sched[2]], words[p_sched[3]]);
+        g_mix(state, 2, 6, 10, 14, words[p_sched[4]], words[p_sched[5]]);
+        g_mix(state, 3, 7, 11, 15, words[p_sched[6]], words[p_sched[7]]);
+        g_mix(state, 0, 5, 10, 15, words[p_sched[8]], words[p_sched[9]]);
+        g_mix(state, 1, 6, 11, 12, words[p_sched[10]], words[p_sched[11]]);
+        g_mix(state, 2, 7, 8, 13, words[p_sched[12]], words[p_sched[13]]);
+        g_mix(state, 3, 4, 9, 14, words[p_sched[14]], words[p_sched[15]]);
+    }
+
+    for (size_t idx = 0; idx < 8; idx++)
+    {
+        out[idx] = state[idx] ^ state[idx + 8];
+    }
+}
+
+/*!
+ * @brief Hash a whole chunk that is known not to be the root
+ *
+ * @param p_chunk Pointer to BLAKE3_CHUNK_LEN bytes
+ * @param counter Index of the chunk in the stream
+ * @param out Chaining value of the chunk
+ */
+static void hash_chunk(const uint8_t * p_chunk, uint64_t counter, uint32_t out[8])
+{
+    const size_t blocks = BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN;
+
+    memcpy(out, g_iv, sizeof(g_iv));
+    for (size_t idx = 0; idx < blocks; idx++)
+    {
+        uint8_t flags = 0;
+        if (0 == idx)
+        {
+            flags |= CHUNK_START;
+        }
+        if ((blocks - 1) == idx)
+        {
+            flags |= CHUNK_END;
+        }
+        compress(out, p_chunk + (idx * BLAKE3_BLOCK_LEN), BLAKE3_BLOCK_LEN,
+                 counter, flags, out);
+    }
+}
+
+/*!
+ * @brief Hash up to BLAKE3_SIMD_DEGREE consecutive whole chunks
+ *
+ * @param p_input Pointer to the first chunk
+ * @param chunks Number of chunks to hash
+ * @param counter Index of the first chunk in the stream
+ * @param p_out Chaining value of every chunk
+ */
+static void hash_chunks(const uint8_t * p_input,
+                        size_t chunks,
+                        uint64_t counter,
+                        uint32_t (* p_out)[8])
+{
+#ifdef BLAKE3_AVX2
+    if ((BLAKE3_SIMD_DEGREE == chunks) && simd_enabled())
+    {
+        hash8_avx2(p_input, counter, p_out);
+        return;
+    }
+#endif
+    for (size_t idx = 0; idx < chunks; idx++)
+    {
+        hash_chunk(p_input + (idx * BLAKE3_CHUNK_LEN), counter + idx, p_out[idx]);
+    }
+}
+
+static void chunk_init(blake3_chunk_t * p_chunk, uint64_t counter)
+{
+    *p_chunk = (blake3_chunk_t){
+        .chunk_counter = counter
+    };
+    memcpy(p_chunk->cv, g_iv, sizeof(g_iv));
+}
+
+static size_t chunk_len(const blake3_chunk_t * p_chunk)
+{
+    return ((size_t)p_chunk->blocks_compressed * BLAKE3_BLOCK_LEN) + p_chunk->buf_len;
+}
+
+/*!
+ * @brief Add bytes to the chunk in progress. The caller never adds more than
+ * what is left of the chunk.
+ */
+static void chunk_update(blake3_chunk_t * p_chunk, const uint8_t * p_input, size_t length)
+{
+    while (length > 0)
+    {
+        // The buffered block is only compressed once it is known not to be
+        // the last block of the chunk
+        if (BLAKE3_BLOCK_LEN == p_chunk->buf_len)
+        {
+            uint8_t flags = (0 == p_chunk->blocks_compressed) ? CHUNK_START : 0;
+            compress(p_chunk->cv, p_chunk->buf, BLAKE3_BLOCK_LEN,
+                     p_chunk->chunk_counter, flags, p_chunk->cv);
+            p_chunk->blocks_compressed++;
+            p_chunk->buf_len = 0;
+            memset(p_chunk->buf, 0, sizeof(p_chunk->buf));
+        }
+
+        size_t take = BLAKE3_BLOCK_LEN - (size_t)p_chunk->buf_len;
+        if (take > length)
+        {
+            take = length;
+        }
+        memcpy(p_chunk->buf + p_chunk->buf_len, p_input, take);
+        p_chunk->buf_len = (uint8_t)(p_chunk->buf_len + take);
+        p_input += take;
+        length -= take;
+    }
+}
+
+static blake3_output_t chunk_output(const blake3_chunk_t * p_chunk)
+{
+    blake3_output_t output = {
+        .block_len  = p_chunk->buf_len,
+        .counter    = p_chunk->chunk_counter,
+        .flags      = (uint8_t)(CHUNK_END
+                                | ((0 == p_chunk->blocks_compressed) ? CHUNK_START : 0))
+    };
+    memcpy(output.cv, p_chunk->cv, sizeof(output.cv));
+    memcpy(output.block, p_chunk->buf, sizeof(output.block));
+    return output;
+}
+
+static blake3_output_t parent_output(const uint32_t left[8], const uint32_t right[8])
+{
+    blake3_output_t output = {
+        .block_len  = BLAKE3_BLOCK_LEN,
+        .counter    = 0,
+        .flags      = PARENT
+    };
+    memcpy(output.cv, g_iv, sizeof(g_iv));
+    for (size_t idx = 0; idx < 8; idx++)
+    {
+        store32(output.block + (idx * 4), left[idx]);
+        store32(output.block + 32 + (idx * 4), right[idx]);
+    }
+    return output;
+}
+
+static void output_cv(const blake3_output_t * p_output, uint32_t out[8])
+{
+    compress(p_output->cv, p_output->block, p_output->block_len,
+             p_output->counter, p_output->flags, out);
+}
+
+/*!
+ * @brief Push the chaining value of a completed chunk. Every trailing zero
+ * bit of the chunk count closes a subtree so the matching stack entries are
+ * merged into parents first.
+ *
+ * @param p_hasher Pointer to the blake3_hasher_t object
+ * @param cv Chaining value of the chunk. Overwritten with the merged value
+ * @param total_chunks Number of chunks completed including this one
+ */
+static void push_chunk_cv(blake3_hasher_t * p_hasher, uint32_t cv[8], uint64_t total_chunks)
+{
+    while (0 == (total_chunks & 1))
+    {
+        p_hasher->cv_stack_len--;
+        blake3_output_t output = parent_output(p_hasher->cv_stack[p_hasher->cv_stack_len], cv);
+        output_cv(&output, cv);
+        total_chunks >>= 1;
+    }
+    memcpy(p_hasher->cv_stack[p_hasher->cv_stack_len], cv, sizeof(p_hasher->cv_stack[0]));
+    p_hasher->cv_stack_len++;
+}
+
+#ifdef BLAKE3_AVX2
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN static inline __m256i rot16(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10,
+                                                  5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10,
+                                                  5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+AVX2_FN static inline __m256i rot12(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+}
+
+AVX2_FN static inline __m256i rot8(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9,
+                                                  4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9,
+                                                  4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+AVX2_FN static inline __m256i rot7(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+}
+
+AVX2_FN static inline void g_mix8(__m256i * p_v, size_t a, size_t b, size_t c, size_t d,
+                                  __m256i x, __m256i y)
+{
+    p_v[a] = _mm256_add_epi32(_mm256_add_epi32(p_v[a], p_v[b]), x);
+    p_v[d] = rot16(_mm256_xor_si256(p_v[d], p_v[a]));
+    p_v[c] = _mm256_add_epi32(p_v[c], p_v[d]);
+    p_v[b] = rot12(_mm256_xor_si256(p_v[b], p_v[c]));
+    p_v[a] = _mm256_add_epi32(_mm256_add_epi32(p_v[a], p_v[b]), y);
+    p_v[d] = rot8(_mm256_xor_si256(p_v[d], p_v[a]));
+    p_v[c] = _mm256_add_epi32(p_v[c], p_v[d]);
+    p_v[b] = rot7(_mm256_xor_si256(p_v[b], p_v[c]));
+}
+
+/*!
+ * @brief Transpose eight rows of eight words so that row N holds word N of
+ * every input row
+ */
+AVX2_FN static inline void transpose8(__m256i * p_rows)
+{
+    __m256i ab_lo = _mm256_unpacklo_epi32(p_rows[0], p_rows[1]);
+    __m256i ab_hi = _mm256_unpackhi_epi32(p_rows[0], p_rows[1]);
+    __m256i cd_lo = _mm256_unpacklo_epi32(p_rows[2], p_rows[3]);
+    __m256i cd_hi = _mm256_unpackhi_epi32(p_rows[2], p_rows[3]);
+    __m256i ef_lo = _mm256_unpacklo_epi32(p_rows[4], p_rows[5]);
+    __m256i ef_hi = _mm256_unpackhi_epi32(p_rows[4], p_rows[5]);
+    __m256i gh_lo = _mm256_unpacklo_epi32(p_rows[6], p_rows[7]);
+    __m256i gh_hi = _mm256_unpackhi_epi32(p_rows[6], p_rows[7]);
+
+    __m256i abcd_0 = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+    __m256i abcd_1 = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+    __m256i abcd_2 = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+    __m256i abcd_3 = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+    __m256i efgh_0 = _mm256_unpacklo_epi64(ef_lo, gh_lo);
+    __m256i efgh_1 = _mm256_unpackhi_epi64(ef_lo, gh_lo);
+    __m256i efgh_2 = _mm256_unpacklo_epi64(ef_hi, gh_hi);
+    __m256i efgh_3 = _mm256_unpackhi_epi64(ef_hi, gh_hi);
+
+    p_rows[0] = _mm256_permute2x128_si256(abcd_0, efgh_0, 0x20);
+    p_rows[1] = _mm256_permute2x128_si256(abcd_1, efgh_1, 0x20);
+    p_rows[2] = _mm256_permute2x128_si256(abcd_2, efgh_2, 0x20);
+    p_rows[3] = _mm256_permute2x128_si256(abcd_3, efgh_3, 0x20);
+    p_rows[4] = _mm256_permute2x128_si256(abcd_0, efgh_0, 0x31);
+    p_rows[5] = _mm256_permute2x128_si256(abcd_1, efgh_1, 0x31);
+    p_rows[6] = _mm256_permute2x128_si256(abcd_2, efgh_2, 0x31);
+    p_rows[7] = _mm256_permute2x128_si256(abcd_3, efgh_3, 0x31);
+}
+
+/*!
+ * @brief Hash eight consecutive whole chunks at once, one chunk per 32 bit
+ * lane
+ *
+ * @param p_input Pointer to the first of the eight chunks
+ * @param counter Index of the first chunk in the stream
+ * @param p_out Chaining value of every chunk
+ */
+AVX2_FN static void hash8_avx2(const uint8_t * p_input, uint64_t counter, uint32_t (* p_out)[8])
+{
+    const size_t blocks = BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN;
+    uint32_t counter_lo[BLAKE3_SIMD_DEGREE];
+    uint32_t counter_hi[BLAKE3_SIMD_DEGREE];
+    for (size_t lane = 0; lane < BLAKE3_SIMD_DEGREE; lane++)
+    {
+        counter_lo[lane] = (uint32_t)(counter + lane);
+        counter_hi[lane] = (uint32_t)((counter + lane) >> 32);
+    }
+
+    __m256i h[8];
+    for (size_t idx = 0; idx < 8; idx++)
+    {
+        h[idx] = _mm256_set1_epi32((int)g_iv[idx]);
+    }
+
+    for (size_t block = 0; block < blocks; block++)
+    {
+        // Load the block of every chunk and transpose so that m[N] holds
+        // message word N of every lane
+        __m256i m[16];
+        for (size_t half = 0; half < 2; half++)
+        {
+            for (size_t lane = 0; lane < BLAKE3_SIMD_DEGREE; lane++)
+            {
+                const uint8_t * p_src = p_input + (lane * BLAKE3_CHUNK_LEN)
+                                        + (block * BLAKE3_BLOCK_LEN) + (half * 32);
+                m[(half * 8) + lane] = _mm256_loadu_si256((const __m256i *)p_src);
+            }
+            transpose8(m + (half * 8));
+        }
+
+        uint32_t flags = 0;
+        if (0 == block)
+        {
+            flags |= CHUNK_START;
+        }
+        if ((blocks - 1) == block)
+        {
+            flags |= CHUNK_END;
+        }
+
+        __m256i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32((int)g_iv[0]), _mm256_set1_epi32((int)g_iv[1]),
+            _mm256_set1_epi32((int)g_iv[2]), _mm256_set1_epi32((int)g_iv[3]),
+            _mm256_loadu_si256((const __m256i *)counter_lo),
+            _mm256_loadu_si256((const __m256i *)counter_hi),
+            _mm256_set1_epi32(BLAKE3_BLOCK_LEN),
+            _mm256_set1_epi32((int)flags)
+        };
+
+        for (size_t round = 0; round < 7; round++)
+        {
+            const uint8_t * p_sched = g_schedule[round];
+            g_mix8(v, 0, 4, 8, 12, m[p_sched[0]], m[p_sched[1]]);
+            g_mix8(v, 1, 5, 9, 13, m[p_sched[2]], m[p_sched[3]]);
+            g_mix8(v, 2, 6, 10, 14, m[p_sched[4]], m[p_sched[5]]);
+            g_mix8(v, 3, 7, 11, 15, m[p_sched[6]], m[p_sched[7]]);
+            g_mix8(v, 0, 5, 10, 15, m[p_sched[8]], m[p_sched[9]]);
+            g_mix8(v, 1, 6, 11, 12, m[p_sched[10]], m[p_sched[11]]);
+            g_mix8(v, 2, 7, 8, 13, m[p_sched[12]], m[p_sched[13]]);
+            g_mix8(v, 3, 4, 9, 14, m[p_sched[14]], m[p_sched[15]]);
+        }
+
+        for (size_t idx = 0; idx < 8; idx++)
+        {
+            h[idx] = _mm256_xor_si256(v[idx], v[idx + 8]);
+        }
+    }
+
+    transpose8(h);
+    for (size_t lane = 0; lane < BLAKE3_SIMD_DEGREE; lane++)
+    {
+        _mm256_storeu_si256((__m256i *)p_out[lane], h[lane]);
+    }
+}
+
+#endif // BLAKE3_AVX2
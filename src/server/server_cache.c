@@ -0,0 +1,726 @@
+#define _GNU_SOURCE // fstatat and unlinkat
+#include <server_cache.h>
+#include <server_xfer.h>
+#include <hashtable.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hex digest, two separators and two numbers of at most three digits
+#define CACHE_NAME_LEN ((H_HASH_LEN * 2) + 9)
+
+// Entries are on the LRU list once their file is complete. Entries still
+// being filled are only in the table so the same fill is not queued twice
+typedef struct cache_entry
+{
+    char                    name[CACHE_NAME_LEN];
+    size_t                  size;
+    bool                    b_ready;
+    struct cache_entry *    p_prev;     // Towards the most recently used
+    struct cache_entry *    p_next;     // Towards the least recently used
+} cache_entry_t;
+
+typedef struct cache_job
+{
+    cache_key_t             key;
+    cache_entry_t *         p_entry;
+    f_stream_t *            p_source;
+    size_t                  length;
+    struct cache_job *      p_next;
+} cache_job_t;
+
+struct cache
+{
+    verified_path_t *   p_dir;
+    size_t              capacity;
+    size_t              used;
+    htable_t *          p_entries;      // name -> cache_entry_t
+    cache_entry_t *     p_head;         // Most recently used
+    cache_entry_t *     p_tail;         // Least recently used
+    cache_job_t *       p_jobs;
+    cache_job_t *       p_jobs_tail;
+    size_t              queued;
+    bool                b_busy;         // Worker is running a fill
+    bool                b_shutdown;
+    pthread_t           worker;
+    pthread_mutex_t     lock;
+    pthread_cond_t      work_cond;      // Signals the worker
+    pthread_cond_t      idle_cond;      // Signals cache_wait
+};
+
+// Entry found on disk when the cache is opened
+typedef struct
+{
+    cache_entry_t *     p_entry;
+    time_t              mtime;
+} cache_found_t;
+
+static void * fill_loop(void * p_arg);
+static void run_fill(cache_t * p_cache, cache_job_t * p_job);
+static void key_name(const cache_key_t * p_key, char name[CACHE_NAME_LEN]);
+static bool valid_name(const char * p_name);
+static bool load_entries(cache_t * p_cache);
+static int found_cmp(const void * p_left, const void * p_right);
+static void lru_push(cache_t * p_cache, cache_entry_t * p_entry);
+static void lru_unlink(cache_t * p_cache, cache_entry_t * p_entry);
+static cache_entry_t * evict(cache_t * p_cache, const cache_entry_t * p_keep);
+static void remove_files(cache_t * p_cache, cache_entry_t * p_evicted);
+static uint64_t cache_hash_callback(void * key);
+static htable_match_t cache_compare_callback(void * left_key, void * right_key);
+
+/*!
+ * @brief Open the cache in the home directory, creating CACHE_DIR if needed.
+ * Entries left by a previous run are kept, oldest first in the eviction
+ * order, and a worker thread is started to fill the cache in the background.
+ *
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param capacity Maximum number of bytes of all entries together
+ * @return cache_t object if successful otherwise NULL
+ */
+cache_t * cache_init(verified_path_t * p_home_dir, size_t capacity)
+{
+    if ((NULL == p_home_dir) || (0 == capacity))
+    {
+        goto ret_null;
+    }
+
+    verified_path_t * p_dir = f_ver_path_resolve(p_home_dir, CACHE_DIR);
+    if (NULL == p_dir)
+    {
+        p_dir = f_ver_valid_resolve(p_home_dir, CACHE_DIR);
+        if ((NULL == p_dir) || (OP_SUCCESS != f_create_dir(p_dir)))
+        {
+            fprintf(stderr, "[!] Unable to create the %s directory\n", CACHE_DIR);
+            goto cleanup_dir;
+        }
+    }
+
+    cache_t * p_cache = (cache_t *)calloc(1, sizeof(cache_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_cache))
+    {
+        goto cleanup_dir;
+    }
+    *p_cache = (cache_t){
+        .p_dir      = p_dir,
+        .capacity   = capacity,
+        .used       = 0,
+        .p_entries  = htable_create(cache_hash_callback, cache_compare_callback,
+                                    NULL, NULL),
+        .p_head     = NULL,
+        .p_tail     = NULL,
+        .p_jobs     = NULL,
+        .queued     = 0,
+        .b_busy     = false,
+        .b_shutdown = false
+    };
+    if (NULL == p_cache->p_entries)
+    {
+        goto cleanup_cache;
+    }
+
+    pthread_mutex_init(&p_cache->lock, NULL);
+    pthread_cond_init(&p_cache->work_cond, NULL);
+    pthread_cond_init(&p_cache->idle_cond, NULL);
+
+    if (!load_entries(p_cache))
+    {
+        goto cleanup_locks;
+    }
+
+    if (0 != pthread_create(&p_cache->worker, NULL, fill_loop, p_cache))
+    {
+        fprintf(stderr, "[!] Unable to start the cache worker\n");
+        goto cleanup_locks;
+    }
+    return p_cache;
+
+cleanup_locks:
+    pthread_cond_destroy(&p_cache->idle_cond);
+    pthread_cond_destroy(&p_cache->work_cond);
+    pthread_mutex_destroy(&p_cache->lock);
+    while (NULL != p_cache->p_head)
+    {
+        cache_entry_t * p_entry = p_cache->p_head;
+        p_cache->p_head = p_entry->p_next;
+        free(p_entry);
+    }
+    htable_destroy(p_cache->p_entries, HT_FREE_PTR_FALSE, HT_FREE_PTR_FALSE);
+cleanup_cache:
+    free(p_cache);
+cleanup_dir:
+    f_destroy_path(&p_dir);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Stop the worker and free the cache. Fills still queued are dropped,
+ * a fill that is running is allowed to finish.
+ *
+ * @param pp_cache Double pointer to the cache object
+ */
+void cache_destroy(cache_t ** pp_cache)
+{
+    if ((NULL == pp_cache) || (NULL == *pp_cache))
+    {
+        return;
+    }
+
+    cache_t * p_cache = *pp_cache;
+    pthread_mutex_lock(&p_cache->lock);
+    p_cache->b_shutdown = true;
+    pthread_cond_signal(&p_cache->work_cond);
+    pthread_mutex_unlock(&p_cache->lock);
+    pthread_join(p_cache->worker, NULL);
+
+    while (NULL != p_cache->p_jobs)
+    {
+        cache_job_t * p_job = p_cache->p_jobs;
+        p_cache->p_jobs = p_job->p_next;
+        f_stream_close(&p_job->p_source);
+        free(p_job->p_entry);
+        free(p_job);
+    }
+    while (NULL != p_cache->p_head)
+    {
+        cache_entry_t * p_entry = p_cache->p_head;
+        p_cache->p_head = p_entry->p_next;
+        free(p_entry);
+    }
+    htable_destroy(p_cache->p_entries, HT_FREE_PTR_FALSE, HT_FREE_PTR_FALSE);
+
+    pthread_cond_destroy(&p_cache->idle_cond);
+    pthread_cond_destroy(&p_cache->work_cond);
+    pthread_mutex_destroy(&p_cache->lock);
+    f_destroy_path(&p_cache->p_dir);
+
+    free(p_cache);
+    *pp_cache = NULL;
+}
+
+/*!
+ * @brief Open the representation if it is cached and mark it as the most
+ * recently used entry
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_key Pointer to the key of the representation
+ * @param p_size Pointer receiving the size of the representation
+ * @return f_stream_t of the frames or NULL on a miss
+ */
+f_stream_t * cache_open(cache_t * p_cache, const cache_key_t * p_key, size_t * p_size)
+{
+    if ((NULL == p_cache) || (NULL == p_key) || (NULL == p_size))
+    {
+        return NULL;
+    }
+
+    char name[CACHE_NAME_LEN] = {0};
+    key_name(p_key, name);
+
+    pthread_mutex_lock(&p_cache->lock);
+    cache_entry_t * p_entry = (cache_entry_t *)htable_get(p_cache->p_entries, name);
+    bool b_hit = ((NULL != p_entry) && (p_entry->b_ready));
+    if (b_hit)
+    {
+        lru_unlink(p_cache, p_entry);
+        lru_push(p_cache, p_entry);
+    }
+    pthread_mutex_unlock(&p_cache->lock);
+    if (!b_hit)
+    {
+        return NULL;
+    }
+
+    // An entry evicted after the lookup is still a miss. The descriptor of
+    // an entry evicted after the open stays readable until it is closed
+    ret_codes_t code = OP_SUCCESS;
+    f_stream_t * p_stream = NULL;
+    verified_path_t * p_path = f_ver_path_resolve(p_cache->p_dir, name);
+    if (NULL != p_path)
+    {
+        p_stream = f_stream_open(p_path, p_size, &code);
+        f_destroy_path(&p_path);
+    }
+    return p_stream;
+}
+
+/*!
+ * @brief Queue the compression of the source into the cache. The worker
+ * compresses the source into a temp file and links it into place once it
+ * is complete, evicting the least recently used entries to make room.
+ * Nothing is queued if the representation is already cached or queued or
+ * if the queue is full.
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_key Pointer to the key of the representation. The digest must
+ * be the digest of the source
+ * @param pp_source Double pointer to the source. The cache takes ownership
+ * of the stream and sets the pointer to NULL in every case
+ * @param length Number of bytes of the source
+ * @return true if the fill was queued otherwise false
+ */
+bool cache_fill(cache_t * p_cache,
+                const cache_key_t * p_key,
+                f_stream_t ** pp_source,
+                size_t length)
+{
+    if ((NULL == pp_source) || (NULL == *pp_source))
+    {
+        return false;
+    }
+    if ((NULL == p_cache) || (NULL == p_key))
+    {
+        goto cleanup_source;
+    }
+
+    cache_job_t * p_job = (cache_job_t *)malloc(sizeof(cache_job_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_job))
+    {
+        goto cleanup_source;
+    }
+    cache_entry_t * p_entry = (cache_entry_t *)calloc(1, sizeof(cache_entry_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_entry))
+    {
+        goto cleanup_job;
+    }
+    key_name(p_key, p_entry->name);
+
+    pthread_mutex_lock(&p_cache->lock);
+    if ((p_cache->b_shutdown) || (CACHE_QUEUE_SIZE <= p_cache->queued)
+        || (htable_key_exists(p_cache->p_entries, p_entry->name)))
+    {
+        pthread_mutex_unlock(&p_cache->lock);
+        goto cleanup_entry;
+    }
+
+    *p_job = (cache_job_t){
+        .key        = *p_key,
+        .p_entry    = p_entry,
+        .p_source   = *pp_source,
+        .length     = length,
+        .p_next     = NULL
+    };
+    *pp_source = NULL;
+    htable_set(p_cache->p_entries, p_entry->name, p_entry);
+    if (NULL == p_cache->p_jobs)
+    {
+        p_cache->p_jobs = p_job;
+    }
+    else
+    {
+        p_cache->p_jobs_tail->p_next = p_job;
+    }
+    p_cache->p_jobs_tail = p_job;
+    p_cache->queued++;
+    pthread_cond_signal(&p_cache->work_cond);
+    pthread_mutex_unlock(&p_cache->lock);
+    return true;
+
+cleanup_entry:
+    free(p_entry);
+cleanup_job:
+    free(p_job);
+cleanup_source:
+    f_stream_close(pp_source);
+    return false;
+}
+
+/*!
+ * @brief Block until every queued fill has completed
+ *
+ * @param p_cache Pointer to the cache object
+ */
+void cache_wait(cache_t * p_cache)
+{
+    if (NULL == p_cache)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&p_cache->lock);
+    while ((NULL != p_cache->p_jobs) || (p_cache->b_busy))
+    {
+        pthread_cond_wait(&p_cache->idle_cond, &p_cache->lock);
+    }
+    pthread_mutex_unlock(&p_cache->lock);
+}
+
+/*!
+ * @brief Get the number of bytes used by the cached entries
+ *
+ * @param p_cache Pointer to the cache object
+ * @return Bytes used
+ */
+size_t cache_usage(cache_t * p_cache)
+{
+    if (NULL == p_cache)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&p_cache->lock);
+    size_t used = p_cache->used;
+    pthread_mutex_unlock(&p_cache->lock);
+    return used;
+}
+
+/*!
+ * @brief Thread entry point of the worker. Runs the queued fills one at a
+ * time until the cache is destroyed.
+ *
+ * @param p_arg Pointer to the cache object
+ * @return NULL
+ */
+static void * fill_loop(void * p_arg)
+{
+    cache_t * p_cache = (cache_t *)p_arg;
+
+    pthread_mutex_lock(&p_cache->lock);
+    for (;;)
+    {
+        while ((!p_cache->b_shutdown) && (NULL == p_cache->p_jobs))
+        {
+            pthread_cond_wait(&p_cache->work_cond, &p_cache->lock);
+        }
+        if (p_cache->b_shutdown)
+        {
+            break;
+        }
+
+        cache_job_t * p_job = p_cache->p_jobs;
+        p_cache->p_jobs = p_job->p_next;
+        p_cache->queued--;
+        p_cache->b_busy = true;
+        pthread_mutex_unlock(&p_cache->lock);
+
+        run_fill(p_cache, p_job);
+
+        pthread_mutex_lock(&p_cache->lock);
+        p_cache->b_busy = false;
+        pthread_cond_broadcast(&p_cache->idle_cond);
+    }
+    pthread_cond_broadcast(&p_cache->idle_cond);
+    pthread_mutex_unlock(&p_cache->lock);
+    return NULL;
+}
+
+/*!
+ * @brief Compress the source of the job into a temp file in the cache
+ * directory and link it under the name of the entry. The entry becomes
+ * visible to cache_open only once the file is complete.
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_job Pointer to the job. Freed by the function
+ */
+static void run_fill(cache_t * p_cache, cache_job_t * p_job)
+{
+    cache_entry_t * p_entry = p_job->p_entry;
+    size_t size = 0;
+
+    ret_codes_t code = OP_FAILURE;
+    f_stream_t * p_temp = f_stream_temp(p_cache->p_dir, &code);
+    if (NULL != p_temp)
+    {
+        code = xfer_compress(p_job->p_source, p_job->length, p_job->key.codec,
+                             NULL, p_temp, &size);
+    }
+
+    // Representations that can never fit are not kept
+    if ((OP_SUCCESS == code) && (size > p_cache->capacity))
+    {
+        code = OP_FAILURE;
+    }
+    if (OP_SUCCESS == code)
+    {
+        verified_path_t * p_path = f_ver_valid_resolve(p_cache->p_dir, p_entry->name);
+        code = f_stream_link(p_temp, p_path, NULL);
+        f_destroy_path(&p_path);
+    }
+    f_stream_close(&p_temp);
+    f_stream_close(&p_job->p_source);
+
+    pthread_mutex_lock(&p_cache->lock);
+    cache_entry_t * p_evicted = NULL;
+    if (OP_SUCCESS == code)
+    {
+        p_entry->size = size;
+        p_entry->b_ready = true;
+        p_cache->used += size;
+        lru_push(p_cache, p_entry);
+        p_evicted = evict(p_cache, p_entry);
+    }
+    else
+    {
+        htable_del(p_cache->p_entries, p_entry->name, HT_FREE_PTR_FALSE);
+    }
+    pthread_mutex_unlock(&p_cache->lock);
+
+    if (OP_SUCCESS == code)
+    {
+        debug_print("[CACHE] Cached %ld as %ld bytes in %s\n",
+                    p_job->length, size, p_entry->name);
+    }
+    else
+    {
+        debug_print_err("[CACHE] Unable to cache %s\n", p_entry->name);
+        free(p_entry);
+    }
+    remove_files(p_cache, p_evicted);
+    free(p_job);
+}
+
+/*!
+ * @brief Write the file name of the key
+ *
+ * @param p_key Pointer to the key
+ * @param name Buffer of CACHE_NAME_LEN bytes receiving the name
+ */
+static void key_name(const cache_key_t * p_key, char name[CACHE_NAME_LEN])
+{
+    char hex[(H_HASH_LEN * 2) + 1] = {0};
+    hash_to_hex(&p_key->hash, hex);
+    snprintf(name, CACHE_NAME_LEN, "%s.%u.%u", hex,
+             (unsigned int)p_key->alg, (unsigned int)p_key->codec);
+}
+
+/*!
+ * @brief Check that the file name is the name of a key with a codec that
+ * this build of the server can serve
+ *
+ * @param p_name File name to check
+ * @return true if the name is valid otherwise false
+ */
+static bool valid_name(const char * p_name)
+{
+    size_t hex_len = H_HASH_LEN * 2;
+    if (strlen(p_name) < (hex_len + 4))
+    {
+        return false;
+    }
+
+    cache_key_t key = {0};
+    unsigned int alg = 0;
+    unsigned int codec = 0;
+    if ((!hex_decode(p_name, hex_len, key.hash.array))
+        || (2 != sscanf(p_name + hex_len, ".%3u.%3u", &alg, &codec))
+        || (!compress_supported((codec_t)codec)))
+    {
+        return false;
+    }
+    key.alg = (hash_alg_t)alg;
+    key.codec = (codec_t)codec;
+
+    // Only the canonical spelling is accepted so every key has one file
+    char name[CACHE_NAME_LEN] = {0};
+    key_name(&key, name);
+    return (0 == strcmp(name, p_name));
+}
+
+/*!
+ * @brief Add the entries left by a previous run to the cache, the most
+ * recently written first in the eviction order. Files that are not entries,
+ * such as the temp files of an interrupted fill, are removed.
+ *
+ * @param p_cache Pointer to the cache object
+ * @return true if the directory could be read otherwise false
+ */
+static bool load_entries(cache_t * p_cache)
+{
+    char dir_path[PATH_MAX] = {0};
+    f_path_repr(p_cache->p_dir, dir_path, PATH_MAX);
+
+    DIR * p_dir = opendir(dir_path);
+    if (NULL == p_dir)
+    {
+        fprintf(stderr, "[!] Unable to open %s: %s\n", dir_path, strerror(errno));
+        return false;
+    }
+    int dir_fd = dirfd(p_dir);
+
+    cache_found_t * p_found = NULL;
+    size_t found = 0;
+    size_t found_cap = 0;
+    bool b_result = true;
+
+    struct dirent * p_dirent = NULL;
+    while (NULL != (p_dirent = readdir(p_dir)))
+    {
+        if ((0 == strcmp(p_dirent->d_name, ".")) || (0 == strcmp(p_dirent->d_name, "..")))
+        {
+            continue;
+        }
+
+        struct stat stat_buff = {0};
+        if ((-1 == fstatat(dir_fd, p_dirent->d_name, &stat_buff, AT_SYMLINK_NOFOLLOW))
+            || (!S_ISREG(stat_buff.st_mode))
+            || (!valid_name(p_dirent->d_name)))
+        {
+            debug_print("[CACHE] Removing stale %s\n", p_dirent->d_name);
+            unlinkat(dir_fd, p_dirent->d_name,
+                     S_ISDIR(stat_buff.st_mode) ? AT_REMOVEDIR : 0);
+            continue;
+        }
+
+        if (found == found_cap)
+        {
+            found_cap = (0 == found_cap) ? 64 : found_cap * 2;
+            cache_found_t * p_grown = (cache_found_t *)realloc(p_found,
+                                                               found_cap * sizeof(cache_found_t));
+            if (UV_INVALID_ALLOC == verify_alloc(p_grown))
+            {
+                b_result = false;
+                break;
+            }
+            p_found = p_grown;
+        }
+
+        cache_entry_t * p_entry = (cache_entry_t *)calloc(1, sizeof(cache_entry_t));
+        if (UV_INVALID_ALLOC == verify_alloc(p_entry))
+        {
+            b_result = false;
+            break;
+        }
+        memcpy(p_entry->name, p_dirent->d_name, strlen(p_dirent->d_name) + 1);
+        p_entry->size = (size_t)stat_buff.st_size;
+        p_entry->b_ready = true;
+        p_found[found++] = (cache_found_t){
+            .p_entry    = p_entry,
+            .mtime      = stat_buff.st_mtime
+        };
+    }
+
+    // Oldest first so the newest entry ends up at the head of the list
+    if (found > 0)
+    {
+        qsort(p_found, found, sizeof(cache_found_t), found_cmp);
+    }
+    for (size_t i = 0; i < found; i++)
+    {
+        cache_entry_t * p_entry = p_found[i].p_entry;
+        htable_set(p_cache->p_entries, p_entry->name, p_entry);
+        p_cache->used += p_entry->size;
+        lru_push(p_cache, p_entry);
+    }
+    free(p_found);
+    closedir(p_dir);
+
+    // The capacity may have been lowered since the last run
+    remove_files(p_cache, evict(p_cache, NULL));
+    return b_result;
+}
+
+static int found_cmp(const void * p_left, const void * p_right)
+{
+    time_t left = ((const cache_found_t *)p_left)->mtime;
+    time_t right = ((const cache_found_t *)p_right)->mtime;
+    return (left > right) - (left < right);
+}
+
+/*!
+ * @brief Put the entry at the head of the LRU list
+ */
+static void lru_push(cache_t * p_cache, cache_entry_t * p_entry)
+{
+    p_entry->p_prev = NULL;
+    p_entry->p_next = p_cache->p_head;
+    if (NULL != p_cache->p_head)
+    {
+        p_cache->p_head->p_prev = p_entry;
+    }
+    p_cache->p_head = p_entry;
+    if (NULL == p_cache->p_tail)
+    {
+        p_cache->p_tail = p_entry;
+    }
+}
+
+/*!
+ * @brief Take the entry out of the LRU list
+ */
+static void lru_unlink(cache_t * p_cache, cache_entry_t * p_entry)
+{
+    if (NULL != p_entry->p_prev)
+    {
+        p_entry->p_prev->p_next = p_entry->p_next;
+    }
+    else
+    {
+        p_cache->p_head = p_entry->p_next;
+    }
+    if (NULL != p_entry->p_next)
+    {
+        p_entry->p_next->p_prev = p_entry->p_prev;
+    }
+    else
+    {
+        p_cache->p_tail = p_entry->p_prev;
+    }
+    p_entry->p_prev = NULL;
+    p_entry->p_next = NULL;
+}
+
+/*!
+ * @brief Remove the least recently used entries until the cache fits in its
+ * capacity. Must be called with the lock held. The files are removed by
+ * remove_files after the lock is released.
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_keep Entry that must not be evicted or NULL
+ * @return List of the evicted entries linked through p_next
+ */
+static cache_entry_t * evict(cache_t * p_cache, const cache_entry_t * p_keep)
+{
+    cache_entry_t * p_evicted = NULL;
+    while ((p_cache->used > p_cache->capacity) && (NULL != p_cache->p_tail)
+           && (p_keep != p_cache->p_tail))
+    {
+        cache_entry_t * p_entry = p_cache->p_tail;
+        lru_unlink(p_cache, p_entry);
+        htable_del(p_cache->p_entries, p_entry->name, HT_FREE_PTR_FALSE);
+        p_cache->used -= p_entry->size;
+        p_entry->p_next = p_evicted;
+        p_evicted = p_entry;
+    }
+    return p_evicted;
+}
+
+/*!
+ * @brief Remove the files of the evicted entries and free them
+ *
+ * @param p_cache Pointer to the cache object
+ * @param p_evicted List of entries returned by evict
+ */
+static void remove_files(cache_t * p_cache, cache_entry_t * p_evicted)
+{
+    while (NULL != p_evicted)
+    {
+        cache_entry_t * p_entry = p_evicted;
+        p_evicted = p_entry->p_next;
+
+        debug_print("[CACHE] Evicting %s\n", p_entry->name);
+        verified_path_t * p_path = f_ver_path_resolve(p_cache->p_dir, p_entry->name);
+        if (NULL != p_path)
+        {
+            f_del_file(p_path);
+            f_destroy_path(&p_path);
+        }
+        free(p_entry);
+    }
+}
+
+static uint64_t cache_hash_callback(void * key)
+{
+    char * p_name = (char *)key;
+    uint64_t hash = htable_get_init_hash();
+
+    htable_hash_key(&hash, p_name, strlen(p_name));
+    return hash;
+}
+
+static htable_match_t cache_compare_callback(void * left_key, void * right_key)
+{
+    return (0 == strcmp((char *)left_key, (char *)right_key)) ? HT_MATCH_TRUE
+                                                             : HT_MATCH_FALSE;
+}
@@ -0,0 +1,1573 @@
+#define _GNU_SOURCE // fstatat and unlinkat
+#include <server_chunks.h>
+#include <hashtable.h>
+#include <openssl/rand.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_SHARDS        256
+#define CHUNK_HEX_LEN       (H_HASH_LEN * 2)
+#define CHUNK_ID_LEN        16
+#define CHUNK_ID_FILE       "id"
+
+// FastCDC masks for an average of 8 KiB. Chunks shorter than the average
+// are cut with the stricter mask so chunk sizes cluster around the average
+#define CHUNK_MASK_S        0x0003590703530000ULL
+#define CHUNK_MASK_L        0x0000d90003530000ULL
+
+// Bytes of a stream gathered before they are cut into chunks. Must hold at
+// least CHUNK_MAX_SIZE bytes
+#define CHUNK_WINDOW        (1 << 20)
+
+// Files to ignore
+extern const char * DB_DIR;
+
+static const uint8_t MANIFEST_MAGIC[8] = {'C', 'A', 'P', 'E', 'C', 'H', 'K', '1'};
+
+typedef struct
+{
+    hash_t      digest;
+    uint64_t    refs;
+    bool        b_found;    // The file of the chunk was seen on open
+} chunk_ref_t;
+
+// Chunks are split by the first byte of their digest, which is also the
+// directory they are kept in
+typedef struct
+{
+    pthread_mutex_t     lock;
+    htable_t *          p_refs;     // hash_t -> chunk_ref_t
+    verified_path_t *   p_dir;
+    size_t              count;
+} chunk_shard_t;
+
+// Inode of a manifest that holds references on its chunks
+typedef struct
+{
+    dev_t   dev;
+    ino_t   ino;
+} chunk_owner_t;
+
+typedef struct
+{
+    hash_t      digest;
+    uint32_t    length;
+    uint64_t    offset;
+} chunk_entry_t;
+
+typedef struct
+{
+    chunk_entry_t * p_entries;
+    size_t          count;
+    size_t          capacity;
+    uint64_t        size;
+} manifest_t;
+
+// Context of the streams of one open manifest
+typedef struct
+{
+    chunks_t *      p_chunks;
+    manifest_t      manifest;
+    atomic_uint     users;
+} stitch_t;
+
+struct chunks
+{
+    verified_path_t *   p_home_dir;
+    verified_path_t *   p_dir;
+    chunk_shard_t       shards[CHUNK_SHARDS];
+    htable_t *          p_owners;   // chunk_owner_t -> chunk_owner_t
+    pthread_mutex_t     names_lock; // Held while manifests are linked or unlinked
+    uint8_t             id[CHUNK_ID_LEN];
+    bool                b_store;
+};
+
+static ssize_t stitch_read_at(void * p_ctx, uint8_t * p_buffer, size_t length, size_t offset);
+static void * stitch_dup(void * p_ctx);
+static void stitch_release(void * p_ctx);
+
+static const f_stream_ops_t STITCH_OPS = {
+    .read_at    = stitch_read_at,
+    .dup        = stitch_dup,
+    .release    = stitch_release
+};
+
+static bool open_dirs(chunks_t * p_chunks, verified_path_t * p_home_dir);
+static bool load_id(chunks_t * p_chunks);
+static bool scan_dir(chunks_t * p_chunks, const char * p_rel);
+static void scan_file(chunks_t * p_chunks, const char * p_rel);
+static void scan_chunks(chunks_t * p_chunks);
+static ret_codes_t add_chunks(chunks_t * p_chunks,
+                              manifest_t * p_manifest,
+                              const uint8_t * p_bytes,
+                              size_t length,
+                              bool b_last,
+                              sync_t * p_sync,
+                              size_t * p_used);
+static ret_codes_t chunk_stream(chunks_t * p_chunks,
+                                f_stream_t * p_source,
+                                size_t length,
+                                sync_t * p_sync,
+                                manifest_t * p_manifest);
+static ret_codes_t store_chunk(chunks_t * p_chunks,
+                               const uint8_t * p_bytes,
+                               size_t length,
+                               sync_t * p_sync,
+                               hash_t * p_digest);
+static f_stream_t * open_chunk(chunks_t * p_chunks, const hash_t * p_digest);
+static bool ref_take(chunks_t * p_chunks, const hash_t * p_digest);
+static void ref_drop(chunks_t * p_chunks, const hash_t * p_digest);
+static bool take_refs(chunks_t * p_chunks, const manifest_t * p_manifest);
+static void drop_refs(chunks_t * p_chunks, const manifest_t * p_manifest, size_t count);
+static bool owner_add(chunks_t * p_chunks, const f_file_id_t * p_id);
+static bool owner_remove(chunks_t * p_chunks, const f_file_id_t * p_id);
+static bool owner_has(chunks_t * p_chunks, const f_file_id_t * p_id);
+static f_stream_t * open_manifest(chunks_t * p_chunks,
+                                  verified_path_t * p_path,
+                                  manifest_t * p_manifest);
+static bool read_manifest(chunks_t * p_chunks,
+                          f_stream_t * p_source,
+                          size_t size,
+                          manifest_t * p_manifest,
+                          ret_codes_t * p_code);
+static ret_codes_t write_manifest(chunks_t * p_chunks,
+                                  const manifest_t * p_manifest,
+                                  f_stream_t * p_out);
+static bool manifest_push(manifest_t * p_manifest, const hash_t * p_digest, uint32_t length);
+static void manifest_free(manifest_t * p_manifest);
+static size_t find_entry(const manifest_t * p_manifest, size_t offset);
+static void gear_init(void);
+static void store_be32(uint8_t * p_bytes, uint32_t value);
+static uint32_t load_be32(const uint8_t * p_bytes);
+static void store_be64(uint8_t * p_bytes, uint64_t value);
+static uint64_t load_be64(const uint8_t * p_bytes);
+static uint64_t ref_hash_callback(void * key);
+static htable_match_t ref_compare_callback(void * left_key, void * right_key);
+static uint64_t owner_hash_callback(void * key);
+static htable_match_t owner_compare_callback(void * left_key, void * right_key);
+static void chunks_free_callback(void * value);
+
+// Random value of every byte used to roll the fingerprint of FastCDC
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/*!
+ * @brief Open the chunk store in the home directory and count the
+ * references of its chunks. Chunks no manifest refers to, left by an
+ * interrupted write, are removed.
+ *
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param b_store Store new files as chunks. When false the store only
+ * serves the files already stored in it
+ * @return chunks_t object if successful otherwise NULL
+ */
+chunks_t * chunks_init(verified_path_t * p_home_dir, bool b_store)
+{
+    if (NULL == p_home_dir)
+    {
+        return NULL;
+    }
+
+    chunks_t * p_chunks = (chunks_t *)calloc(1, sizeof(chunks_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_chunks))
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&p_chunks->names_lock, NULL);
+    for (size_t i = 0; i < CHUNK_SHARDS; i++)
+    {
+        pthread_mutex_init(&p_chunks->shards[i].lock, NULL);
+    }
+    p_chunks->p_home_dir = p_home_dir;
+    p_chunks->b_store = b_store;
+
+    p_chunks->p_owners = htable_create(owner_hash_callback, owner_compare_callback,
+                                       NULL, chunks_free_callback);
+    if ((NULL == p_chunks->p_owners) || (!open_dirs(p_chunks, p_home_dir))
+        || (!load_id(p_chunks)))
+    {
+        goto cleanup;
+    }
+
+    // Every manifest is counted before any chunk is removed
+    if (!scan_dir(p_chunks, ""))
+    {
+        goto cleanup;
+    }
+    scan_chunks(p_chunks);
+
+    debug_print("[CHUNKS] Opened the store with %ld chunks\n", chunks_count(p_chunks));
+    return p_chunks;
+
+cleanup:
+    chunks_destroy(&p_chunks);
+    return NULL;
+}
+
+/*!
+ * @brief Free the chunk store. Every stream of a manifest must be closed
+ *
+ * @param pp_chunks Double pointer to the chunk store
+ */
+void chunks_destroy(chunks_t ** pp_chunks)
+{
+    if ((NULL == pp_chunks) || (NULL == *pp_chunks))
+    {
+        return;
+    }
+
+    chunks_t * p_chunks = *pp_chunks;
+    for (size_t i = 0; i < CHUNK_SHARDS; i++)
+    {
+        chunk_shard_t * p_shard = &p_chunks->shards[i];
+        if (NULL != p_shard->p_refs)
+        {
+            htable_destroy(p_shard->p_refs, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+        }
+        f_destroy_path(&p_shard->p_dir);
+        pthread_mutex_destroy(&p_shard->lock);
+    }
+    if (NULL != p_chunks->p_owners)
+    {
+        htable_destroy(p_chunks->p_owners, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+    }
+    f_destroy_path(&p_chunks->p_dir);
+    pthread_mutex_destroy(&p_chunks->names_lock);
+
+    free(p_chunks);
+    *pp_chunks = NULL;
+}
+
+/*!
+ * @brief Find the end of the first chunk of the bytes
+ *
+ * @param p_bytes Pointer to the bytes
+ * @param length Number of bytes
+ * @return Length of the chunk. Bytes are only cut short of CHUNK_MAX_SIZE
+ * at a content boundary or at the end of the bytes
+ */
+size_t chunks_cut(const uint8_t * p_bytes, size_t length)
+{
+    if ((NULL == p_bytes) || (length <= CHUNK_MIN_SIZE))
+    {
+        return length;
+    }
+    pthread_once(&gear_once, gear_init);
+
+    if (length > CHUNK_MAX_SIZE)
+    {
+        length = CHUNK_MAX_SIZE;
+    }
+    size_t normal = (length < CHUNK_AVG_SIZE) ? length : CHUNK_AVG_SIZE;
+
+    // The bytes before the minimum size are never a boundary so they are
+    // not hashed
+    uint64_t fingerprint = 0;
+    size_t pos = CHUNK_MIN_SIZE;
+    for (; pos < normal; pos++)
+    {
+        fingerprint = (fingerprint << 1) + gear[p_bytes[pos]];
+        if (0 == (fingerprint & CHUNK_MASK_S))
+        {
+            return pos;
+        }
+    }
+    for (; pos < length; pos++)
+    {
+        fingerprint = (fingerprint << 1) + gear[p_bytes[pos]];
+        if (0 == (fingerprint & CHUNK_MASK_L))
+        {
+            return pos;
+        }
+    }
+    return length;
+}
+
+/*!
+ * @brief Create the file with the bytes. Without a store, or if the store
+ * does not take new files, the file is created with f_create_file.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t of the file to create
+ * @param p_bytes Pointer to the bytes of the file
+ * @param length Number of bytes
+ * @param p_sync Sync object deciding how the file is flushed. May be NULL
+ * @param p_id Pointer receiving the identity of the file or NULL
+ * @retval OP_SUCCESS The file was created
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected a write
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_create_file(chunks_t * p_chunks,
+                               verified_path_t * p_path,
+                               uint8_t * p_bytes,
+                               size_t length,
+                               sync_t * p_sync,
+                               f_file_id_t * p_id)
+{
+    // Files smaller than a chunk would only grow by a manifest
+    if ((NULL == p_chunks) || (!p_chunks->b_store) || (length < CHUNK_MIN_SIZE))
+    {
+        return f_create_file(p_path, p_bytes, length, p_sync, p_id);
+    }
+    if ((NULL == p_path) || (NULL == p_bytes))
+    {
+        return OP_FAILURE;
+    }
+
+    manifest_t manifest = {0};
+    f_stream_t * p_temp = NULL;
+    size_t used = 0;
+    ret_codes_t ret = add_chunks(p_chunks, &manifest, p_bytes, length, true, p_sync, &used);
+    if (OP_SUCCESS == ret)
+    {
+        p_temp = f_stream_temp_for(p_path, &ret);
+    }
+    if (NULL != p_temp)
+    {
+        ret = write_manifest(p_chunks, &manifest, p_temp);
+    }
+    if (OP_SUCCESS != ret)
+    {
+        drop_refs(p_chunks, &manifest, manifest.count);
+        goto cleanup;
+    }
+
+    // Once the manifest is linked its references are never dropped here,
+    // they are left for the next start if the owner cannot be recorded
+    f_file_id_t id = {0};
+    pthread_mutex_lock(&p_chunks->names_lock);
+    ret = f_stream_link(p_temp, p_path, p_sync);
+    if ((OP_SUCCESS == ret) && ((!f_stream_id(p_temp, &id)) || (!owner_add(p_chunks, &id))))
+    {
+        fprintf(stderr, "[!] Unable to record the owner of a manifest\n");
+    }
+    pthread_mutex_unlock(&p_chunks->names_lock);
+
+    if (OP_SUCCESS != ret)
+    {
+        drop_refs(p_chunks, &manifest, manifest.count);
+    }
+    else if (NULL != p_id)
+    {
+        *p_id = id;
+    }
+
+cleanup:
+    f_stream_close(&p_temp);
+    manifest_free(&manifest);
+    return ret;
+}
+
+/*!
+ * @brief Move the temp stream over the path. If the store takes new files
+ * the stream is stored as chunks and its manifest moved instead. The chunks
+ * of the file that was replaced are released.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_temp Pointer to a f_stream_t created with f_stream_temp_for
+ * @param length Number of bytes of the stream
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_sync Sync object deciding how the file is flushed. May be NULL
+ * @param p_id Pointer receiving the identity of the new file or NULL
+ * @retval OP_SUCCESS The file was replaced
+ * @retval OP_IO_ERROR The disk rejected a write or the rename
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_replace_file(chunks_t * p_chunks,
+                                f_stream_t * p_temp,
+                                size_t length,
+                                verified_path_t * p_path,
+                                sync_t * p_sync,
+                                f_file_id_t * p_id)
+{
+    f_file_id_t id = {0};
+    if (NULL == p_chunks)
+    {
+        ret_codes_t ret = f_stream_replace(p_temp, p_path, p_sync);
+        if ((OP_SUCCESS == ret) && (NULL != p_id) && (f_stream_id(p_temp, &id)))
+        {
+            *p_id = id;
+        }
+        return ret;
+    }
+
+    manifest_t built = {0};
+    manifest_t old = {0};
+    f_stream_t * p_manifest = NULL;
+    f_stream_t * p_old = NULL;
+    f_stream_t * p_new = p_temp;
+    ret_codes_t ret = OP_SUCCESS;
+    if ((p_chunks->b_store) && (length >= CHUNK_MIN_SIZE))
+    {
+        ret = chunk_stream(p_chunks, p_temp, length, p_sync, &built);
+        if (OP_SUCCESS == ret)
+        {
+            p_manifest = f_stream_temp_for(p_path, &ret);
+        }
+        if (NULL != p_manifest)
+        {
+            ret = write_manifest(p_chunks, &built, p_manifest);
+        }
+        if (OP_SUCCESS != ret)
+        {
+            drop_refs(p_chunks, &built, built.count);
+            goto cleanup;
+        }
+        p_new = p_manifest;
+    }
+
+    // The file replaced is opened under the lock so that two replacements
+    // of the same path cannot both release it
+    bool b_release = false;
+    pthread_mutex_lock(&p_chunks->names_lock);
+    p_old = open_manifest(p_chunks, p_path, &old);
+    ret = f_stream_replace(p_new, p_path, p_sync);
+    if (OP_SUCCESS == ret)
+    {
+        bool b_id = f_stream_id(p_new, &id);
+        if ((built.count > 0) && ((!b_id) || (!owner_add(p_chunks, &id))))
+        {
+            fprintf(stderr, "[!] Unable to record the owner of a manifest\n");
+        }
+
+        f_file_id_t old_id = {0};
+        if ((NULL != p_old) && (f_stream_id(p_old, &old_id)) && (0 == old_id.nlink))
+        {
+            b_release = owner_remove(p_chunks, &old_id);
+        }
+    }
+    pthread_mutex_unlock(&p_chunks->names_lock);
+
+    if (OP_SUCCESS != ret)
+    {
+        drop_refs(p_chunks, &built, built.count);
+        goto cleanup;
+    }
+    if (b_release)
+    {
+        drop_refs(p_chunks, &old, old.count);
+    }
+    if (NULL != p_id)
+    {
+        *p_id = id;
+    }
+
+cleanup:
+    f_stream_close(&p_old);
+    f_stream_close(&p_manifest);
+    manifest_free(&old);
+    manifest_free(&built);
+    return ret;
+}
+
+/*!
+ * @brief Make the stream of a manifest read the file it describes. The
+ * stream holds the chunks until it is closed. Streams of other files are
+ * left as they are.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_source Pointer to a stream opened with f_stream_open
+ * @param size Size of the file of the stream
+ * @retval OP_SUCCESS The stream reads the file
+ * @retval OP_RESOLVE_ERROR The file was removed while it was opened
+ * @retval OP_IO_ERROR The manifest could not be read
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_stitch(chunks_t * p_chunks, f_stream_t * p_source, size_t size)
+{
+    if ((NULL == p_chunks) || (NULL == p_source))
+    {
+        return OP_SUCCESS;
+    }
+
+    ret_codes_t code = OP_SUCCESS;
+    manifest_t manifest = {0};
+    if (!read_manifest(p_chunks, p_source, size, &manifest, &code))
+    {
+        return code;
+    }
+
+    // The last owner may have released the chunks after the file was opened
+    if (!take_refs(p_chunks, &manifest))
+    {
+        manifest_free(&manifest);
+        return OP_RESOLVE_ERROR;
+    }
+
+    stitch_t * p_stitch = (stitch_t *)calloc(1, sizeof(stitch_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_stitch))
+    {
+        goto cleanup;
+    }
+    p_stitch->p_chunks = p_chunks;
+    p_stitch->manifest = manifest;
+    atomic_init(&p_stitch->users, 1);
+    if (!f_stream_set_ops(p_source, &STITCH_OPS, p_stitch))
+    {
+        free(p_stitch);
+        goto cleanup;
+    }
+    return OP_SUCCESS;
+
+cleanup:
+    drop_refs(p_chunks, &manifest, manifest.count);
+    manifest_free(&manifest);
+    return OP_FAILURE;
+}
+
+/*!
+ * @brief Take the references of a file that was created as a copy of
+ * another, such as by dedup_link. Copies that share the inode of the
+ * original share its references.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t of the copy
+ * @retval OP_SUCCESS The copy holds its chunks
+ * @retval OP_RESOLVE_ERROR The chunks were released before the copy could
+ * take them. The copy must be removed
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t chunks_adopt(chunks_t * p_chunks, verified_path_t * p_path)
+{
+    if (NULL == p_chunks)
+    {
+        return OP_SUCCESS;
+    }
+
+    ret_codes_t ret = OP_SUCCESS;
+    manifest_t manifest = {0};
+    pthread_mutex_lock(&p_chunks->names_lock);
+    f_stream_t * p_copy = open_manifest(p_chunks, p_path, &manifest);
+    f_file_id_t id = {0};
+    if ((NULL != p_copy) && (f_stream_id(p_copy, &id)) && (!owner_has(p_chunks, &id)))
+    {
+        if (!take_refs(p_chunks, &manifest))
+        {
+            ret = OP_RESOLVE_ERROR;
+        }
+        else if (!owner_add(p_chunks, &id))
+        {
+            drop_refs(p_chunks, &manifest, manifest.count);
+            ret = OP_FAILURE;
+        }
+    }
+    pthread_mutex_unlock(&p_chunks->names_lock);
+
+    f_stream_close(&p_copy);
+    manifest_free(&manifest);
+    return ret;
+}
+
+/*!
+ * @brief Delete the file or directory with f_del_file. The chunks of a
+ * manifest are released when its last name is removed.
+ *
+ * @param p_chunks Pointer to the chunk store or NULL
+ * @param p_path Pointer to the verified_path_t to delete
+ * @return Result of f_del_file
+ */
+ret_codes_t chunks_del_file(chunks_t * p_chunks, verified_path_t * p_path)
+{
+    if (NULL == p_chunks)
+    {
+        return f_del_file(p_path);
+    }
+
+    // The link count is read from the open manifest once its name is gone.
+    // No name can be added to an inode without names, so only the removal
+    // of the last name sees zero
+    manifest_t manifest = {0};
+    bool b_release = false;
+    pthread_mutex_lock(&p_chunks->names_lock);
+    f_stream_t * p_manifest = open_manifest(p_chunks, p_path, &manifest);
+    ret_codes_t ret = f_del_file(p_path);
+    f_file_id_t id = {0};
+    if ((OP_SUCCESS == ret) && (NULL != p_manifest) && (f_stream_id(p_manifest, &id))
+        && (0 == id.nlink))
+    {
+        b_release = owner_remove(p_chunks, &id);
+    }
+    pthread_mutex_unlock(&p_chunks->names_lock);
+
+    if (b_release)
+    {
+        drop_refs(p_chunks, &manifest, manifest.count);
+    }
+    f_stream_close(&p_manifest);
+    manifest_free(&manifest);
+    return ret;
+}
+
+/*!
+ * @brief Get the number of chunks in the store
+ *
+ * @param p_chunks Pointer to the chunk store
+ * @return Number of chunks
+ */
+size_t chunks_count(chunks_t * p_chunks)
+{
+    if (NULL == p_chunks)
+    {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < CHUNK_SHARDS; i++)
+    {
+        chunk_shard_t * p_shard = &p_chunks->shards[i];
+        pthread_mutex_lock(&p_shard->lock);
+        count += p_shard->count;
+        pthread_mutex_unlock(&p_shard->lock);
+    }
+    return count;
+}
+
+/*!
+ * @brief Read the range of the file from its chunks. The chunks of the
+ * range are opened and advised CHUNK_READAHEAD at a time so the kernel
+ * reads them while the first ones are copied.
+ */
+static ssize_t stitch_read_at(void * p_ctx, uint8_t * p_buffer, size_t length, size_t offset)
+{
+    stitch_t * p_stitch = (stitch_t *)p_ctx;
+    const manifest_t * p_manifest = &p_stitch->manifest;
+    if (offset >= p_manifest->size)
+    {
+        return 0;
+    }
+    if (length > (p_manifest->size - offset))
+    {
+        length = (size_t)(p_manifest->size - offset);
+    }
+
+    size_t index = find_entry(p_manifest, offset);
+    size_t done = 0;
+    while (done < length)
+    {
+        f_stream_t * p_streams[CHUNK_READAHEAD] = {0};
+        size_t opened = 0;
+        bool b_failed = false;
+        while ((opened < CHUNK_READAHEAD) && ((index + opened) < p_manifest->count)
+               && (p_manifest->p_entries[index + opened].offset < (offset + length)))
+        {
+            const chunk_entry_t * p_entry = &p_manifest->p_entries[index + opened];
+            p_streams[opened] = open_chunk(p_stitch->p_chunks, &p_entry->digest);
+            if (NULL == p_streams[opened])
+            {
+                b_failed = true;
+                break;
+            }
+            f_stream_advise(p_streams[opened], 0, p_entry->length);
+            opened++;
+        }
+
+        for (size_t i = 0; (!b_failed) && (i < opened); i++)
+        {
+            const chunk_entry_t * p_entry = &p_manifest->p_entries[index + i];
+            size_t skip = (size_t)((offset + done) - p_entry->offset);
+            size_t want = p_entry->length - skip;
+            if (want > (length - done))
+            {
+                want = length - done;
+            }
+            ssize_t got = f_stream_read_at(p_streams[i], p_buffer + done, want, skip);
+            if ((got < 0) || ((size_t)got != want))
+            {
+                b_failed = true;
+                break;
+            }
+            done += want;
+        }
+
+        for (size_t i = 0; i < opened; i++)
+        {
+            f_stream_close(&p_streams[i]);
+        }
+        if (b_failed)
+        {
+            debug_print_err("[CHUNKS] Unable to read chunk %ld\n", index);
+            return -1;
+        }
+        index += opened;
+    }
+    return (ssize_t)done;
+}
+
+static void * stitch_dup(void * p_ctx)
+{
+    stitch_t * p_stitch = (stitch_t *)p_ctx;
+    atomic_fetch_add(&p_stitch->users, 1);
+    return p_stitch;
+}
+
+/*!
+ * @brief Release the chunks once the last stream of the manifest is closed
+ */
+static void stitch_release(void * p_ctx)
+{
+    stitch_t * p_stitch = (stitch_t *)p_ctx;
+    if (1 != atomic_fetch_sub(&p_stitch->users, 1))
+    {
+        return;
+    }
+    drop_refs(p_stitch->p_chunks, &p_stitch->manifest, p_stitch->manifest.count);
+    manifest_free(&p_stitch->manifest);
+    free(p_stitch);
+}
+
+/*!
+ * @brief Open CHUNKS_DIR and its shard directories, creating them if needed
+ *
+ * @return true if every directory is open otherwise false
+ */
+static bool open_dirs(chunks_t * p_chunks, verified_path_t * p_home_dir)
+{
+    p_chunks->p_dir = f_ver_path_resolve(p_home_dir, CHUNKS_DIR);
+    if (NULL == p_chunks->p_dir)
+    {
+        p_chunks->p_dir = f_ver_valid_resolve(p_home_dir, CHUNKS_DIR);
+        if ((NULL == p_chunks->p_dir) || (OP_SUCCESS != f_create_dir(p_chunks->p_dir)))
+        {
+            fprintf(stderr, "[!] Unable to create the %s directory\n", CHUNKS_DIR);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < CHUNK_SHARDS; i++)
+    {
+        chunk_shard_t * p_shard = &p_chunks->shards[i];
+        char name[3] = {0};
+        snprintf(name, sizeof(name), "%02x", (unsigned int)i);
+
+        p_shard->p_dir = f_ver_path_resolve(p_chunks->p_dir, name);
+        if (NULL == p_shard->p_dir)
+        {
+            p_shard->p_dir = f_ver_valid_resolve(p_chunks->p_dir, name);
+            if ((NULL == p_shard->p_dir) || (OP_SUCCESS != f_create_dir(p_shard->p_dir)))
+            {
+                fprintf(stderr, "[!] Unable to create the %s/%s directory\n", CHUNKS_DIR, name);
+                return false;
+            }
+        }
+
+        p_shard->p_refs = htable_create(ref_hash_callback, ref_compare_callback,
+                                        NULL, chunks_free_callback);
+        if (NULL == p_shard->p_refs)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief Read the id of the store, generating it when the store is new
+ *
+ * @return true if the id was read otherwise false
+ */
+static bool load_id(chunks_t * p_chunks)
+{
+    ret_codes_t code = OP_SUCCESS;
+    verified_path_t * p_path = f_ver_path_resolve(p_chunks->p_dir, CHUNK_ID_FILE);
+    if (NULL != p_path)
+    {
+        file_content_t * p_content = f_read_file(p_path, &code);
+        f_destroy_path(&p_path);
+        bool b_valid = ((NULL != p_content) && (CHUNK_ID_LEN == p_content->stream_size));
+        if (b_valid)
+        {
+            memcpy(p_chunks->id, p_content->p_stream, CHUNK_ID_LEN);
+        }
+        else
+        {
+            fprintf(stderr, "[!] The id of the chunk store is unreadable\n");
+        }
+        f_destroy_content(&p_content);
+        return b_valid;
+    }
+
+    if (1 != RAND_bytes(p_chunks->id, CHUNK_ID_LEN))
+    {
+        return false;
+    }
+    p_path = f_ver_valid_resolve(p_chunks->p_dir, CHUNK_ID_FILE);
+    code = f_create_file(p_path, p_chunks->id, CHUNK_ID_LEN, NULL, NULL);
+    f_destroy_path(&p_path);
+    return (OP_SUCCESS == code);
+}
+
+/*!
+ * @brief Count the references of the manifests under the directory
+ *
+ * @param p_rel Path of the directory relative to the home directory
+ * @return false if memory ran out otherwise true
+ */
+static bool scan_dir(chunks_t * p_chunks, const char * p_rel)
+{
+    char home[PATH_MAX] = {0};
+    char dir_path[PATH_MAX] = {0};
+    f_path_repr(p_chunks->p_home_dir, home, PATH_MAX);
+    if (snprintf(dir_path, PATH_MAX, "%s/%s", home, p_rel) >= PATH_MAX)
+    {
+        return true;
+    }
+
+    DIR * p_dir = opendir(dir_path);
+    if (NULL == p_dir)
+    {
+        fprintf(stderr, "[!] Unable to open %s: %s\n", dir_path, strerror(errno));
+        return true;
+    }
+    int dir_fd = dirfd(p_dir);
+
+    bool b_result = true;
+    struct dirent * p_dirent = NULL;
+    while ((b_result) && (NULL != (p_dirent = readdir(p_dir))))
+    {
+        if ((0 == strcmp(p_dirent->d_name, ".")) || (0 == strcmp(p_dirent->d_name, ".."))
+            || (('\0' == p_rel[0]) && (0 == strcmp(p_dirent->d_name, DB_DIR))))
+        {
+            continue;
+        }
+
+        char child[PATH_MAX] = {0};
+        int written = snprintf(child, PATH_MAX, "%s%s%s", p_rel,
+                               ('\0' == p_rel[0]) ? "" : "/", p_dirent->d_name);
+        struct stat stat_buff = {0};
+        if ((written >= PATH_MAX)
+            || (-1 == fstatat(dir_fd, p_dirent->d_name, &stat_buff, AT_SYMLINK_NOFOLLOW)))
+        {
+            continue;
+        }
+
+        if (S_ISDIR(stat_buff.st_mode))
+        {
+            b_result = scan_dir(p_chunks, child);
+        }
+        else if ((S_ISREG(stat_buff.st_mode)) && (stat_buff.st_size >= CHUNK_MANIFEST_HEADER))
+        {
+            scan_file(p_chunks, child);
+        }
+    }
+    closedir(p_dir);
+    return b_result;
+}
+
+/*!
+ * @brief Count the references of the file if it is a manifest. Names of the
+ * same inode are only counted once
+ *
+ * @param p_rel Path of the file relative to the home directory
+ */
+static void scan_file(chunks_t * p_chunks, const char * p_rel)
+{
+    verified_path_t * p_path = f_ver_path_resolve(p_chunks->p_home_dir, p_rel);
+    manifest_t manifest = {0};
+    f_stream_t * p_manifest = open_manifest(p_chunks, p_path, &manifest);
+    f_destroy_path(&p_path);
+
+    f_file_id_t id = {0};
+    if ((NULL == p_manifest) || (!f_stream_id(p_manifest, &id))
+        || (owner_has(p_chunks, &id)) || (!owner_add(p_chunks, &id)))
+    {
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < manifest.count; i++)
+    {
+        const hash_t * p_digest = &manifest.p_entries[i].digest;
+        if (ref_take(p_chunks, p_digest))
+        {
+            continue;
+        }
+
+        chunk_ref_t * p_ref = (chunk_ref_t *)calloc(1, sizeof(chunk_ref_t));
+        if (UV_INVALID_ALLOC == verify_alloc(p_ref))
+        {
+            break;
+        }
+        p_ref->digest = *p_digest;
+        p_ref->refs = 1;
+        chunk_shard_t * p_shard = &p_chunks->shards[p_digest->array[0]];
+        htable_set(p_shard->p_refs, &p_ref->digest, p_ref);
+        p_shard->count++;
+    }
+
+cleanup:
+    f_stream_close(&p_manifest);
+    manifest_free(&manifest);
+}
+
+/*!
+ * @brief Remove the files of the shard directories that are not referenced,
+ * and report the chunks that are referenced but missing
+ */
+static void scan_chunks(chunks_t * p_chunks)
+{
+    for (size_t i = 0; i < CHUNK_SHARDS; i++)
+    {
+        chunk_shard_t * p_shard = &p_chunks->shards[i];
+        char dir_path[PATH_MAX] = {0};
+        f_path_repr(p_shard->p_dir, dir_path, PATH_MAX);
+
+        DIR * p_dir = opendir(dir_path);
+        if (NULL == p_dir)
+        {
+            fprintf(stderr, "[!] Unable to open %s: %s\n", dir_path, strerror(errno));
+            continue;
+        }
+        int dir_fd = dirfd(p_dir);
+
+        struct dirent * p_dirent = NULL;
+        while (NULL != (p_dirent = readdir(p_dir)))
+        {
+            if ((0 == strcmp(p_dirent->d_name, ".")) || (0 == strcmp(p_dirent->d_name, "..")))
+            {
+                continue;
+            }
+
+            hash_t digest = {0};
+            chunk_ref_t * p_ref = NULL;
+            if ((CHUNK_HEX_LEN == strlen(p_dirent->d_name))
+                && (hex_decode(p_dirent->d_name, CHUNK_HEX_LEN, digest.array))
+                && (i == digest.array[0]))
+            {
+                p_ref = (chunk_ref_t *)htable_get(p_shard->p_refs, &digest);
+            }
+            if (NULL != p_ref)
+            {
+                p_ref->b_found = true;
+                continue;
+            }
+
+            debug_print("[CHUNKS] Removing unreferenced %s\n", p_dirent->d_name);
+            unlinkat(dir_fd, p_dirent->d_name, 0);
+        }
+        closedir(p_dir);
+
+        htable_iter_t * p_iter = htable_get_iter(p_shard->p_refs);
+        htable_entry_t * p_entry = htable_iter_get_entry(p_iter);
+        while (NULL != p_entry)
+        {
+            chunk_ref_t * p_ref = (chunk_ref_t *)p_entry->value;
+            if (!p_ref->b_found)
+            {
+                char hex[CHUNK_HEX_LEN + 1] = {0};
+                hash_to_hex(&p_ref->digest, hex);
+                fprintf(stderr, "[!] Chunk %s is missing from the store\n", hex);
+            }
+            p_entry = htable_iter_get_next(p_iter);
+        }
+        htable_destroy_iter(p_iter);
+    }
+}
+
+/*!
+ * @brief Store the chunks of the bytes and add them to the manifest. Unless
+ * the bytes are the last of the file, bytes shorter than CHUNK_MAX_SIZE are
+ * left for the next call since more bytes could move their boundary.
+ *
+ * @param p_used Pointer receiving the number of bytes stored
+ * @return OP_SUCCESS or the error of the chunk that could not be stored.
+ * The chunks added to the manifest hold a reference either way
+ */
+static ret_codes_t add_chunks(chunks_t * p_chunks,
+                              manifest_t * p_manifest,
+                              const uint8_t * p_bytes,
+                              size_t length,
+                              bool b_last,
+                              sync_t * p_sync,
+                              size_t * p_used)
+{
+    ret_codes_t ret = OP_SUCCESS;
+    size_t used = 0;
+    while (used < length)
+    {
+        size_t left = length - used;
+        if ((!b_last) && (left < CHUNK_MAX_SIZE))
+        {
+            break;
+        }
+
+        size_t cut = chunks_cut(p_bytes + used, left);
+        hash_t digest;
+        ret = store_chunk(p_chunks, p_bytes + used, cut, p_sync, &digest);
+        if (OP_SUCCESS != ret)
+        {
+            break;
+        }
+        if (!manifest_push(p_manifest, &digest, (uint32_t)cut))
+        {
+            ref_drop(p_chunks, &digest);
+            ret = OP_FAILURE;
+            break;
+        }
+        used += cut;
+    }
+    *p_used = used;
+    return ret;
+}
+
+/*!
+ * @brief Store the chunks of the stream into the manifest, reading
+ * CHUNK_WINDOW bytes at a time
+ *
+ * @return OP_SUCCESS or the error of the first read or chunk that failed.
+ * The chunks added to the manifest hold a reference either way
+ */
+static ret_codes_t chunk_stream(chunks_t * p_chunks,
+                                f_stream_t * p_source,
+                                size_t length,
+                                sync_t * p_sync,
+                                manifest_t * p_manifest)
+{
+    uint8_t * p_window = (uint8_t *)malloc(CHUNK_WINDOW);
+    if (UV_INVALID_ALLOC == verify_alloc(p_window))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t ret = OP_SUCCESS;
+    size_t have = 0;
+    size_t offset = 0;
+    for (;;)
+    {
+        size_t want = CHUNK_WINDOW - have;
+        if (want > (length - offset))
+        {
+            want = length - offset;
+        }
+        ssize_t got = f_stream_read_at(p_source, p_window + have, want, offset);
+        if ((got < 0) || ((size_t)got != want))
+        {
+            ret = OP_IO_ERROR;
+            break;
+        }
+        have += want;
+        offset += want;
+
+        bool b_last = (offset == length);
+        size_t used = 0;
+        ret = add_chunks(p_chunks, p_manifest, p_window, have, b_last, p_sync, &used);
+        if ((OP_SUCCESS != ret) || (b_last))
+        {
+            break;
+        }
+        memmove(p_window, p_window + used, have - used);
+        have -= used;
+    }
+    free(p_window);
+    return ret;
+}
+
+/*!
+ * @brief Take a reference on the chunk of the bytes, writing the chunk if
+ * the store does not hold it yet
+ *
+ * @param p_digest Pointer receiving the digest of the chunk
+ * @return OP_SUCCESS if the reference was taken otherwise the error code
+ */
+static ret_codes_t store_chunk(chunks_t * p_chunks,
+                               const uint8_t * p_bytes,
+                               size_t length,
+                               sync_t * p_sync,
+                               hash_t * p_digest)
+{
+    if (!hash_alg_bytes(HASH_ALG_BLAKE3, p_bytes, length, p_digest))
+    {
+        return OP_FAILURE;
+    }
+    if (ref_take(p_chunks, p_digest))
+    {
+        return OP_SUCCESS;
+    }
+
+    // The chunk is written outside the lock and only moved into place under
+    // it, after checking that no other request stored it in the meantime
+    chunk_shard_t * p_shard = &p_chunks->shards[p_digest->array[0]];
+    ret_codes_t ret = OP_FAILURE;
+    chunk_ref_t * p_ref = (chunk_ref_t *)calloc(1, sizeof(chunk_ref_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_ref))
+    {
+        return OP_FAILURE;
+    }
+    *p_ref = (chunk_ref_t){
+        .digest     = *p_digest,
+        .refs       = 1,
+        .b_found    = true
+    };
+
+    f_stream_t * p_temp = f_stream_temp(p_shard->p_dir, &ret);
+    if (NULL != p_temp)
+    {
+        ret = f_stream_write(p_temp, p_bytes, length);
+    }
+    if (OP_SUCCESS != ret)
+    {
+        goto cleanup;
+    }
+
+    char hex[CHUNK_HEX_LEN + 1] = {0};
+    hash_to_hex(p_digest, hex);
+    pthread_mutex_lock(&p_shard->lock);
+    chunk_ref_t * p_found = (chunk_ref_t *)htable_get(p_shard->p_refs, p_digest);
+    if (NULL != p_found)
+    {
+        p_found->refs++;
+    }
+    else
+    {
+        verified_path_t * p_path = f_ver_valid_resolve(p_shard->p_dir, hex);
+        ret = f_stream_replace(p_temp, p_path, p_sync);
+        f_destroy_path(&p_path);
+        if (OP_SUCCESS == ret)
+        {
+            htable_set(p_shard->p_refs, &p_ref->digest, p_ref);
+            p_shard->count++;
+            p_ref = NULL;
+        }
+    }
+    pthread_mutex_unlock(&p_shard->lock);
+
+cleanup:
+    f_stream_close(&p_temp);
+    free(p_ref);
+    return ret;
+}
+
+/*!
+ * @brief Open the file of the chunk
+ *
+ * @return f_stream_t of the chunk or NULL if it cannot be opened
+ */
+static f_stream_t * open_chunk(chunks_t * p_chunks, const hash_t * p_digest)
+{
+    char hex[CHUNK_HEX_LEN + 1] = {0};
+    hash_to_hex(p_digest, hex);
+    verified_path_t * p_path = f_ver_path_resolve(p_chunks->shards[p_digest->array[0]].p_dir,
+                                                  hex);
+    if (NULL == p_path)
+    {
+        return NULL;
+    }
+
+    ret_codes_t code = OP_SUCCESS;
+    size_t size = 0;
+    f_stream_t * p_chunk = f_stream_open(p_path, &size, &code);
+    f_destroy_path(&p_path);
+    return p_chunk;
+}
+
+/*!
+ * @brief Take a reference on a chunk the store holds
+ *
+ * @return true if the chunk is held otherwise false
+ */
+static bool ref_take(chunks_t * p_chunks, const hash_t * p_digest)
+{
+    chunk_shard_t * p_shard = &p_chunks->shards[p_digest->array[0]];
+    pthread_mutex_lock(&p_shard->lock);
+    chunk_ref_t * p_ref = (chunk_ref_t *)htable_get(p_shard->p_refs, (void *)p_digest);
+    if (NULL != p_ref)
+    {
+        p_ref->refs++;
+    }
+    pthread_mutex_unlock(&p_shard->lock);
+    return (NULL != p_ref);
+}
+
+/*!
+ * @brief Release a reference on the chunk, removing the chunk with its last
+ * reference. The file is removed under the lock so a request storing the
+ * same chunk again waits for it to be gone.
+ */
+static void ref_drop(chunks_t * p_chunks, const hash_t * p_digest)
+{
+    chunk_shard_t * p_shard = &p_chunks->shards[p_digest->array[0]];
+    pthread_mutex_lock(&p_shard->lock);
+    chunk_ref_t * p_ref = (chunk_ref_t *)htable_get(p_shard->p_refs, (void *)p_digest);
+    if ((NULL == p_ref) || (0 != --p_ref->refs))
+    {
+        pthread_mutex_unlock(&p_shard->lock);
+        return;
+    }
+
+    htable_del(p_shard->p_refs, (void *)p_digest, HT_FREE_PTR_FALSE);
+    p_shard->count--;
+
+    char hex[CHUNK_HEX_LEN + 1] = {0};
+    hash_to_hex(p_digest, hex);
+    verified_path_t * p_path = f_ver_path_resolve(p_shard->p_dir, hex);
+    if (NULL != p_path)
+    {
+        f_del_file(p_path);
+        f_destroy_path(&p_path);
+    }
+    pthread_mutex_unlock(&p_shard->lock);
+    free(p_ref);
+}
+
+/*!
+ * @brief Take a reference on every chunk of the manifest
+ *
+ * @return true if every chunk is held otherwise false and no reference is
+ * taken
+ */
+static bool take_refs(chunks_t * p_chunks, const manifest_t * p_manifest)
+{
+    for (size_t i = 0; i < p_manifest->count; i++)
+    {
+        if (!ref_take(p_chunks, &p_manifest->p_entries[i].digest))
+        {
+            drop_refs(p_chunks, p_manifest, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief Release the references of the first count chunks of the manifest
+ */
+static void drop_refs(chunks_t * p_chunks, const manifest_t * p_manifest, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        ref_drop(p_chunks, &p_manifest->p_entries[i].digest);
+    }
+}
+
+/*!
+ * @brief Record the inode as holding the references of its manifest. The
+ * names lock must be held
+ */
+static bool owner_add(chunks_t * p_chunks, const f_file_id_t * p_id)
+{
+    chunk_owner_t * p_owner = (chunk_owner_t *)malloc(sizeof(chunk_owner_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_owner))
+    {
+        return false;
+    }
+    *p_owner = (chunk_owner_t){
+        .dev    = p_id->dev,
+        .ino    = p_id->ino
+    };
+    htable_set(p_chunks->p_owners, p_owner, p_owner);
+    return true;
+}
+
+/*!
+ * @brief Forget the inode. The names lock must be held
+ *
+ * @return true if the inode held references otherwise false
+ */
+static bool owner_remove(chunks_t * p_chunks, const f_file_id_t * p_id)
+{
+    chunk_owner_t key = {
+        .dev    = p_id->dev,
+        .ino    = p_id->ino
+    };
+    chunk_owner_t * p_owner = (chunk_owner_t *)htable_del(p_chunks->p_owners, &key,
+                                                          HT_FREE_PTR_FALSE);
+    free(p_owner);
+    return (NULL != p_owner);
+}
+
+static bool owner_has(chunks_t * p_chunks, const f_file_id_t * p_id)
+{
+    chunk_owner_t key = {
+        .dev    = p_id->dev,
+        .ino    = p_id->ino
+    };
+    return (NULL != htable_get(p_chunks->p_owners, &key));
+}
+
+/*!
+ * @brief Open the file at the path if it is a manifest of the store
+ *
+ * @param p_manifest Pointer receiving the chunks of the manifest
+ * @return f_stream_t of the manifest, or NULL for other files, directories
+ * and paths that cannot be read
+ */
+static f_stream_t * open_manifest(chunks_t * p_chunks,
+                                  verified_path_t * p_path,
+                                  manifest_t * p_manifest)
+{
+    if (NULL == p_path)
+    {
+        return NULL;
+    }
+
+    // Directories and small files are common and never manifests
+    char repr[PATH_MAX] = {0};
+    f_path_repr(p_path, repr, PATH_MAX);
+    struct stat stat_buff = {0};
+    if ((-1 == lstat(repr, &stat_buff)) || (!S_ISREG(stat_buff.st_mode))
+        || (stat_buff.st_size < CHUNK_MANIFEST_HEADER))
+    {
+        return NULL;
+    }
+
+    ret_codes_t code = OP_SUCCESS;
+    size_t size = 0;
+    f_stream_t * p_source = f_stream_open(p_path, &size, &code);
+    if ((NULL != p_source) && (!read_manifest(p_chunks, p_source, size, p_manifest, &code)))
+    {
+        f_stream_close(&p_source);
+    }
+    return p_source;
+}
+
+/*!
+ * @brief Read the manifest of the stream
+ *
+ * @param size Size of the file of the stream
+ * @param p_manifest Pointer receiving the chunks of the manifest
+ * @param p_code Pointer receiving OP_SUCCESS if the file is not a manifest
+ * or the error that stopped it from being read
+ * @return true if the file is a manifest of the store otherwise false
+ */
+static bool read_manifest(chunks_t * p_chunks,
+                          f_stream_t * p_source,
+                          size_t size,
+                          manifest_t * p_manifest,
+                          ret_codes_t * p_code)
+{
+    *p_code = OP_SUCCESS;
+    if (size < CHUNK_MANIFEST_HEADER)
+    {
+        return false;
+    }
+
+    uint8_t header[CHUNK_MANIFEST_HEADER] = {0};
+    if (CHUNK_MANIFEST_HEADER != f_stream_read_at(p_source, header, CHUNK_MANIFEST_HEADER, 0))
+    {
+        *p_code = OP_IO_ERROR;
+        return false;
+    }
+    if ((0 != memcmp(header, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)))
+        || (0 != memcmp(header + sizeof(MANIFEST_MAGIC), p_chunks->id, CHUNK_ID_LEN)))
+    {
+        return false;
+    }
+
+    // The entries must fit before the hole that pads the manifest
+    uint64_t count = load_be64(header + 24);
+    uint64_t file_size = load_be64(header + 32);
+    if ((file_size != size) || (0 == count)
+        || (count > ((size - CHUNK_MANIFEST_HEADER) / CHUNK_MANIFEST_ENTRY)))
+    {
+        *p_code = OP_IO_ERROR;
+        goto corrupt;
+    }
+
+    size_t entries_len = (size_t)count * CHUNK_MANIFEST_ENTRY;
+    uint8_t * p_entries = (uint8_t *)malloc(entries_len);
+    if (UV_INVALID_ALLOC == verify_alloc(p_entries))
+    {
+        *p_code = OP_FAILURE;
+        return false;
+    }
+    if ((ssize_t)entries_len != f_stream_read_at(p_source, p_entries, entries_len,
+                                                 CHUNK_MANIFEST_HEADER))
+    {
+        free(p_entries);
+        *p_code = OP_IO_ERROR;
+        return false;
+    }
+
+    *p_manifest = (manifest_t){0};
+    bool b_valid = true;
+    for (size_t i = 0; (b_valid) && (i < count); i++)
+    {
+        const uint8_t * p_entry = p_entries + (i * CHUNK_MANIFEST_ENTRY);
+        hash_t digest;
+        memcpy(digest.array, p_entry, H_HASH_LEN);
+        uint32_t length = load_be32(p_entry + H_HASH_LEN);
+        b_valid = ((0 != length) && (length <= CHUNK_MAX_SIZE)
+                   && (manifest_push(p_manifest, &digest, length)));
+    }
+    free(p_entries);
+    if ((b_valid) && (p_manifest->size == file_size))
+    {
+        return true;
+    }
+    manifest_free(p_manifest);
+    *p_code = OP_IO_ERROR;
+
+corrupt:
+    fprintf(stderr, "[!] Found a corrupt manifest of %ld bytes\n", size);
+    return false;
+}
+
+/*!
+ * @brief Write the manifest to the stream and pad it to the size of the file
+ */
+static ret_codes_t write_manifest(chunks_t * p_chunks,
+                                  const manifest_t * p_manifest,
+                                  f_stream_t * p_out)
+{
+    size_t length = CHUNK_MANIFEST_HEADER + (p_manifest->count * CHUNK_MANIFEST_ENTRY);
+    uint8_t * p_bytes = (uint8_t *)malloc(length);
+    if (UV_INVALID_ALLOC == verify_alloc(p_bytes))
+    {
+        return OP_FAILURE;
+    }
+
+    memcpy(p_bytes, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    memcpy(p_bytes + sizeof(MANIFEST_MAGIC), p_chunks->id, CHUNK_ID_LEN);
+    store_be64(p_bytes + 24, (uint64_t)p_manifest->count);
+    store_be64(p_bytes + 32, p_manifest->size);
+    for (size_t i = 0; i < p_manifest->count; i++)
+    {
+        uint8_t * p_entry = p_bytes + CHUNK_MANIFEST_HEADER + (i * CHUNK_MANIFEST_ENTRY);
+        memcpy(p_entry, p_manifest->p_entries[i].digest.array, H_HASH_LEN);
+        store_be32(p_entry + H_HASH_LEN, p_manifest->p_entries[i].length);
+    }
+
+    ret_codes_t ret = f_stream_write(p_out, p_bytes, length);
+    if (OP_SUCCESS == ret)
+    {
+        ret = f_stream_resize(p_out, (size_t)p_manifest->size);
+    }
+    free(p_bytes);
+    return ret;
+}
+
+static bool manifest_push(manifest_t * p_manifest, const hash_t * p_digest, uint32_t length)
+{
+    if (p_manifest->count == p_manifest->capacity)
+    {
+        size_t capacity = (0 == p_manifest->capacity) ? 64 : p_manifest->capacity * 2;
+        chunk_entry_t * p_grown = (chunk_entry_t *)realloc(p_manifest->p_entries,
+                                                           capacity * sizeof(chunk_entry_t));
+        if (UV_INVALID_ALLOC == verify_alloc(p_grown))
+        {
+            return false;
+        }
+        p_manifest->p_entries = p_grown;
+        p_manifest->capacity = capacity;
+    }
+
+    p_manifest->p_entries[p_manifest->count++] = (chunk_entry_t){
+        .digest = *p_digest,
+        .length = length,
+        .offset = p_manifest->size
+    };
+    p_manifest->size += length;
+    return true;
+}
+
+static void manifest_free(manifest_t * p_manifest)
+{
+    free(p_manifest->p_entries);
+    *p_manifest = (manifest_t){0};
+}
+
+/*!
+ * @brief Find the chunk holding the offset, which must be within the file
+ */
+static size_t find_entry(const manifest_t * p_manifest, size_t offset)
+{
+    size_t low = 0;
+    size_t high = p_manifest->count - 1;
+    while (low < high)
+    {
+        size_t mid = low + ((high - low + 1) / 2);
+        if (p_manifest->p_entries[mid].offset <= offset)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    return low;
+}
+
+/*!
+ * @brief Fill the gear table from splitmix64 with a fixed seed so every
+ * server cuts the same bytes at the same offsets
+ */
+static void gear_init(void)
+{
+    uint64_t state = 0;
+    for (size_t i = 0; i < 256; i++)
+    {
+        state += 0x9e3779b97f4a7c15ULL;
+        uint64_t value = state;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = value ^ (value >> 31);
+    }
+}
+
+static void store_be32(uint8_t * p_bytes, uint32_t value)
+{
+    p_bytes[0] = (uint8_t)(value >> 24);
+    p_bytes[1] = (uint8_t)(value >> 16);
+    p_bytes[2] = (uint8_t)(value >> 8);
+    p_bytes[3] = (uint8_t)value;
+}
+
+static uint32_t load_be32(const uint8_t * p_bytes)
+{
+    return ((uint32_t)p_bytes[0] << 24) | ((uint32_t)p_bytes[1] << 16)
+           | ((uint32_t)p_bytes[2] << 8) | (uint32_t)p_bytes[3];
+}
+
+static void store_be64(uint8_t * p_bytes, uint64_t value)
+{
+    store_be32(p_bytes, (uint32_t)(value >> 32));
+    store_be32(p_bytes + 4, (uint32_t)value);
+}
+
+static uint64_t load_be64(const uint8_t * p_bytes)
+{
+    return ((uint64_t)load_be32(p_bytes) << 32) | (uint64_t)load_be32(p_bytes + 4);
+}
+
+static uint64_t ref_hash_callback(void * key)
+{
+    hash_t * p_digest = (hash_t *)key;
+    uint64_t hash = htable_get_init_hash();
+
+    htable_hash_key(&hash, p_digest->array, sizeof(p_digest->array));
+    return hash;
+}
+
+static htable_match_t ref_compare_callback(void * left_key, void * right_key)
+{
+    return (0 == memcmp(((hash_t *)left_key)->array, ((hash_t *)right_key)->array,
+                        sizeof(((hash_t *)left_key)->array))) ? HT_MATCH_TRUE
+                                                              : HT_MATCH_FALSE;
+}
+
+static uint64_t owner_hash_callback(void * key)
+{
+    chunk_owner_t * p_owner = (chunk_owner_t *)key;
+    uint64_t hash = htable_get_init_hash();
+
+    htable_hash_key(&hash, &p_owner->dev, sizeof(p_owner->dev));
+    htable_hash_key(&hash, &p_owner->ino, sizeof(p_owner->ino));
+    return hash;
+}
+
+static htable_match_t owner_compare_callback(void * left_key, void * right_key)
+{
+    chunk_owner_t * p_left = (chunk_owner_t *)left_key;
+    chunk_owner_t * p_right = (chunk_owner_t *)right_key;
+    return ((p_left->dev == p_right->dev) && (p_left->ino == p_right->ino)) ? HT_MATCH_TRUE
+                                                                            : HT_MATCH_FALSE;
+}
+
+static void chunks_free_callback(void * value)
+{
+    free(value);
+}
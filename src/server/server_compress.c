@@ -0,0 +1,649 @@
+#include <server_compress.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// zlib favors speed; text still shrinks several times at the lowest level
+#define ZLIB_LEVEL          1
+
+// Largest expansion each codec can produce from a single byte of its body.
+// Deflate is bounded by 1032:1 and an LZ4 sequence by 255:1
+#define ZLIB_MAX_RATIO      1032
+#define LZ4_MAX_RATIO       256
+
+// LZ4 block format constants. The last match has to start at least
+// LZ4_MFLIMIT bytes before the end and the last LZ4_LAST_LITERALS bytes are
+// always literals
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MFLIMIT         12
+#define LZ4_MAX_OFFSET      0xFFFF
+#define LZ4_HASH_LOG        12
+#define LZ4_SKIP_TRIGGER    6
+
+static void store_be32(uint8_t * p_bytes, uint32_t value);
+static uint32_t load_be32(const uint8_t * p_bytes);
+static uint32_t load_le32(const uint8_t * p_bytes);
+static size_t codec_compress(codec_t codec,
+                             const uint8_t * p_raw,
+                             size_t raw_len,
+                             uint8_t * p_out,
+                             size_t out_cap);
+static bool codec_decompress(codec_t codec,
+                             const uint8_t * p_body,
+                             size_t body_len,
+                             uint8_t * p_out,
+                             size_t raw_len);
+static bool body_can_expand(codec_t codec, size_t body_len, size_t raw_len);
+static uint8_t * lz4_put_length(uint8_t * p_out, size_t length);
+static size_t lz4_compress(const uint8_t * p_src,
+                           size_t src_len,
+                           uint8_t * p_dst,
+                           size_t dst_cap);
+static bool lz4_decompress(const uint8_t * p_src,
+                           size_t src_len,
+                           uint8_t * p_dst,
+                           size_t dst_len);
+
+/*!
+ * @brief Get the codec requested in the flags of a request
+ *
+ * @param flags Flags of the request in host byte order
+ * @return Codec requested by the client
+ */
+codec_t compress_codec(uint16_t flags)
+{
+    return (codec_t)((flags >> CODEC_SHIFT) & CODEC_MASK);
+}
+
+/*!
+ * @brief Check if the codec can be used by this build of the server
+ *
+ * @param codec Codec to check
+ * @return true if data can be compressed and decompressed with the codec
+ */
+bool compress_supported(codec_t codec)
+{
+    switch (codec)
+    {
+#ifdef HAVE_ZLIB
+        case CODEC_ZLIB:
+            return true;
+#endif
+        case CODEC_LZ4:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*!
+ * @brief Compress the bytes into a single frame. The frame is stored
+ * uncompressed if compressing does not make it smaller.
+ *
+ * @param codec Codec to compress with
+ * @param p_raw Pointer to the bytes to compress. May be NULL if raw_len is 0
+ * @param raw_len Number of bytes to compress. At most COMPRESS_FRAME_SIZE
+ * @param p_frame Buffer of at least COMPRESS_FRAME_HEADER + raw_len bytes
+ * receiving the frame
+ * @param p_frame_len Pointer receiving the size of the frame
+ * @retval OP_SUCCESS The frame was written
+ * @retval OP_FAILURE The codec is not supported or the arguments are invalid
+ */
+ret_codes_t compress_frame(codec_t codec,
+                           const uint8_t * p_raw,
+                           size_t raw_len,
+                           uint8_t * p_frame,
+                           size_t * p_frame_len)
+{
+    if (((NULL == p_raw) && (raw_len > 0)) || (NULL == p_frame)
+        || (NULL == p_frame_len) || (raw_len > COMPRESS_FRAME_SIZE)
+        || (!compress_supported(codec)))
+    {
+        return OP_FAILURE;
+    }
+
+    // Only keep the compressed body if it is strictly smaller, which is
+    // what tells the reader the frame is compressed
+    size_t body_len = 0;
+    if (raw_len > 1)
+    {
+        body_len = codec_compress(codec, p_raw, raw_len,
+                                  p_frame + COMPRESS_FRAME_HEADER, raw_len - 1);
+    }
+    if (0 == body_len)
+    {
+        if (raw_len > 0)
+        {
+            memcpy(p_frame + COMPRESS_FRAME_HEADER, p_raw, raw_len);
+        }
+        body_len = raw_len;
+    }
+
+    store_be32(p_frame, (uint32_t)raw_len);
+    store_be32(p_frame + 4, (uint32_t)body_len);
+    *p_frame_len = COMPRESS_FRAME_HEADER + body_len;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Get the most bytes compress_buffer allocates for the bytes. Stored
+ * frames are the worst case so the frames never exceed the input plus one
+ * header per frame
+ *
+ * @param raw_len Number of bytes to compress
+ * @return Number of bytes of the buffer of the frames
+ */
+size_t compress_bound(size_t raw_len)
+{
+    size_t frames = (raw_len + COMPRESS_FRAME_SIZE - 1) / COMPRESS_FRAME_SIZE;
+    return raw_len + (frames * COMPRESS_FRAME_HEADER) + 1;
+}
+
+/*!
+ * @brief Compress the bytes into a newly allocated sequence of frames
+ *
+ * @param codec Codec to compress with
+ * @param p_raw Pointer to the bytes to compress
+ * @param raw_len Number of bytes to compress
+ * @param pp_out Double pointer receiving the frames. Free with free
+ * @param p_out_len Pointer receiving the number of bytes in the frames
+ * @retval OP_SUCCESS The bytes were compressed
+ * @retval OP_FAILURE The codec is not supported or memory ran out
+ */
+ret_codes_t compress_buffer(codec_t codec,
+                            const uint8_t * p_raw,
+                            size_t raw_len,
+                            uint8_t ** pp_out,
+                            size_t * p_out_len)
+{
+    if (((NULL == p_raw) && (raw_len > 0)) || (NULL == pp_out)
+        || (NULL == p_out_len) || (!compress_supported(codec)))
+    {
+        return OP_FAILURE;
+    }
+
+    uint8_t * p_out = (uint8_t *)malloc(compress_bound(raw_len));
+    if (UV_INVALID_ALLOC == verify_alloc(p_out))
+    {
+        return OP_FAILURE;
+    }
+
+    size_t out_len = 0;
+    for (size_t offset = 0; offset < raw_len; offset += COMPRESS_FRAME_SIZE)
+    {
+        size_t chunk = raw_len - offset;
+        if (chunk > COMPRESS_FRAME_SIZE)
+        {
+            chunk = COMPRESS_FRAME_SIZE;
+        }
+
+        size_t frame_len = 0;
+        if (OP_SUCCESS != compress_frame(codec, p_raw + offset, chunk,
+                                         p_out + out_len, &frame_len))
+        {
+            free(p_out);
+            return OP_FAILURE;
+        }
+        out_len += frame_len;
+    }
+
+    *pp_out = p_out;
+    *p_out_len = out_len;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Decompress a sequence of frames into a newly allocated buffer.
+ * Every frame is validated before anything is allocated and frames that
+ * claim more data than their codec can produce from their body are
+ * rejected, so the output is bounded by the size of the input.
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames. May be NULL if frames_len is 0
+ * @param frames_len Number of bytes in the frames
+ * @param pp_out Double pointer receiving the data. Set to NULL when the
+ * frames hold no data. Free with free
+ * @param p_out_len Pointer receiving the number of bytes decompressed
+ * @retval OP_SUCCESS The frames were decompressed
+ * @retval OP_CODEC_ERROR The codec is not supported or the frames are corrupt
+ * @retval OP_FAILURE Memory ran out
+ */
+ret_codes_t decompress_buffer(codec_t codec,
+                              const uint8_t * p_frames,
+                              size_t frames_len,
+                              uint8_t ** pp_out,
+                              size_t * p_out_len)
+{
+    if (NULL == pp_out)
+    {
+        return OP_FAILURE;
+    }
+
+    // First pass validates the framing and sizes the output
+    size_t total = 0;
+    ret_codes_t result = decompress_size(codec, p_frames, frames_len, &total);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    *pp_out = NULL;
+    *p_out_len = 0;
+    if (0 == total)
+    {
+        return OP_SUCCESS;
+    }
+
+    uint8_t * p_out = (uint8_t *)malloc(total);
+    if (UV_INVALID_ALLOC == verify_alloc(p_out))
+    {
+        return OP_FAILURE;
+    }
+    result = decompress_into(codec, p_frames, frames_len, p_out);
+    if (OP_SUCCESS != result)
+    {
+        free(p_out);
+        return result;
+    }
+
+    *pp_out = p_out;
+    *p_out_len = total;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Validate a sequence of frames and get the number of bytes they
+ * decompress to, so the output can be reserved before it is allocated
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames. May be NULL if frames_len is 0
+ * @param frames_len Number of bytes in the frames
+ * @param p_out_len Pointer receiving the number of bytes of the data
+ * @retval OP_SUCCESS The frames are valid
+ * @retval OP_CODEC_ERROR The codec is not supported or the frames are corrupt
+ * @retval OP_FAILURE Invalid arguments
+ */
+ret_codes_t decompress_size(codec_t codec,
+                            const uint8_t * p_frames,
+                            size_t frames_len,
+                            size_t * p_out_len)
+{
+    if (((NULL == p_frames) && (frames_len > 0)) || (NULL == p_out_len))
+    {
+        return OP_FAILURE;
+    }
+    if (!compress_supported(codec))
+    {
+        return OP_CODEC_ERROR;
+    }
+
+    size_t total = 0;
+    size_t offset = 0;
+    while (offset < frames_len)
+    {
+        if ((frames_len - offset) < COMPRESS_FRAME_HEADER)
+        {
+            return OP_CODEC_ERROR;
+        }
+        size_t raw_len = load_be32(p_frames + offset);
+        size_t body_len = load_be32(p_frames + offset + 4);
+        offset += COMPRESS_FRAME_HEADER;
+
+        if ((raw_len > COMPRESS_FRAME_SIZE) || (body_len > raw_len)
+            || (body_len > (frames_len - offset))
+            || ((body_len < raw_len) && (!body_can_expand(codec, body_len, raw_len))))
+        {
+            return OP_CODEC_ERROR;
+        }
+        total += raw_len;
+        offset += body_len;
+    }
+    *p_out_len = total;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Decompress a sequence of frames validated with decompress_size
+ * into the memory provided
+ *
+ * @param codec Codec the frames were compressed with
+ * @param p_frames Pointer to the frames
+ * @param frames_len Number of bytes in the frames
+ * @param p_out Pointer to the memory receiving the data, of the size given
+ * by decompress_size
+ * @retval OP_SUCCESS The frames were decompressed
+ * @retval OP_CODEC_ERROR The frames are corrupt
+ */
+ret_codes_t decompress_into(codec_t codec,
+                            const uint8_t * p_frames,
+                            size_t frames_len,
+                            uint8_t * p_out)
+{
+    size_t out_len = 0;
+    size_t offset = 0;
+    while (offset < frames_len)
+    {
+        size_t raw_len = load_be32(p_frames + offset);
+        size_t body_len = load_be32(p_frames + offset + 4);
+        const uint8_t * p_body = p_frames + offset + COMPRESS_FRAME_HEADER;
+
+        if (body_len == raw_len)
+        {
+            memcpy(p_out + out_len, p_body, raw_len);
+        }
+        else if (!codec_decompress(codec, p_body, body_len, p_out + out_len, raw_len))
+        {
+            return OP_CODEC_ERROR;
+        }
+        out_len += raw_len;
+        offset += COMPRESS_FRAME_HEADER + body_len;
+    }
+    return OP_SUCCESS;
+}
+
+static void store_be32(uint8_t * p_bytes, uint32_t value)
+{
+    p_bytes[0] = (uint8_t)(value >> 24);
+    p_bytes[1] = (uint8_t)(value >> 16);
+    p_bytes[2] = (uint8_t)(value >> 8);
+    p_bytes[3] = (uint8_t)value;
+}
+
+static uint32_t load_be32(const uint8_t * p_bytes)
+{
+    return ((uint32_t)p_bytes[0] << 24) | ((uint32_t)p_bytes[1] << 16)
+           | ((uint32_t)p_bytes[2] << 8) | (uint32_t)p_bytes[3];
+}
+
+static uint32_t load_le32(const uint8_t * p_bytes)
+{
+    uint32_t value;
+    memcpy(&value, p_bytes, sizeof(value));
+    return value;
+}
+
+/*!
+ * @brief Compress with the codec into a buffer of out_cap bytes
+ *
+ * @return Size of the compressed body or 0 if it does not fit
+ */
+static size_t codec_compress(codec_t codec,
+                             const uint8_t * p_raw,
+                             size_t raw_len,
+                             uint8_t * p_out,
+                             size_t out_cap)
+{
+    switch (codec)
+    {
+#ifdef HAVE_ZLIB
+        case CODEC_ZLIB:
+        {
+            uLongf out_len = (uLongf)out_cap;
+            if (Z_OK != compress2(p_out, &out_len, p_raw, (uLong)raw_len, ZLIB_LEVEL))
+            {
+                return 0;
+            }
+            return (size_t)out_len;
+        }
+#endif
+        case CODEC_LZ4:
+            return lz4_compress(p_raw, raw_len, p_out, out_cap);
+        default:
+            return 0;
+    }
+}
+
+/*!
+ * @brief Decompress a body that must expand to exactly raw_len bytes
+ *
+ * @return true if the body was valid otherwise false
+ */
+static bool codec_decompress(codec_t codec,
+                             const uint8_t * p_body,
+                             size_t body_len,
+                             uint8_t * p_out,
+                             size_t raw_len)
+{
+    switch (codec)
+    {
+#ifdef HAVE_ZLIB
+        case CODEC_ZLIB:
+        {
+            uLongf out_len = (uLongf)raw_len;
+            return ((Z_OK == uncompress(p_out, &out_len, p_body, (uLong)body_len))
+                    && (raw_len == (size_t)out_len));
+        }
+#endif
+        case CODEC_LZ4:
+            return lz4_decompress(p_body, body_len, p_out, raw_len);
+        default:
+            return false;
+    }
+}
+
+/*!
+ * @brief Check that the codec is able to produce raw_len bytes out of a
+ * body of body_len bytes
+ */
+static bool body_can_expand(codec_t codec, size_t body_len, size_t raw_len)
+{
+    size_t ratio = (CODEC_ZLIB == codec) ? ZLIB_MAX_RATIO : LZ4_MAX_RATIO;
+    return (raw_len <= (body_len * ratio));
+}
+
+/*!
+ * @brief Write the continuation bytes of an LZ4 length that did not fit in
+ * its token nibble
+ */
+static uint8_t * lz4_put_length(uint8_t * p_out, size_t length)
+{
+    while (length >= 255)
+    {
+        *p_out++ = 255;
+        length -= 255;
+    }
+    *p_out++ = (uint8_t)length;
+    return p_out;
+}
+
+/*!
+ * @brief Compress into the LZ4 block format with a single pass greedy
+ * matcher. Positions are remembered in a small hash table of the next four
+ * bytes and the search skips ahead faster the longer it goes without a
+ * match, so incompressible data is passed over quickly.
+ *
+ * @return Size of the block or 0 if it does not fit in dst_cap bytes
+ */
+static size_t lz4_compress(const uint8_t * p_src,
+                           size_t src_len,
+                           uint8_t * p_dst,
+                           size_t dst_cap)
+{
+    uint32_t table[1 << LZ4_HASH_LOG];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t * p_dst_end = p_dst + dst_cap;
+    uint8_t * p_out = p_dst;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    if (src_len > LZ4_MFLIMIT)
+    {
+        size_t match_limit = src_len - LZ4_MFLIMIT;
+        size_t end_limit = src_len - LZ4_LAST_LITERALS;
+        size_t misses = 0;
+
+        while (pos < match_limit)
+        {
+            uint32_t sequence = load_le32(p_src + pos);
+            uint32_t hash = (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+            size_t candidate = table[hash];
+            table[hash] = (uint32_t)pos;
+
+            if ((candidate >= pos) || ((pos - candidate) > LZ4_MAX_OFFSET)
+                || (load_le32(p_src + candidate) != sequence))
+            {
+                misses++;
+                pos += 1 + (misses >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            size_t match_len = LZ4_MIN_MATCH;
+            while (((pos + match_len) < end_limit)
+                   && (p_src[candidate + match_len] == p_src[pos + match_len]))
+            {
+                match_len++;
+            }
+
+            // Token, both length extensions, literals and offset
+            size_t literals = pos - anchor;
+            size_t needed = 1 + ((literals / 255) + 1) + literals + 2
+                            + (((match_len - LZ4_MIN_MATCH) / 255) + 1);
+            if (needed > (size_t)(p_dst_end - p_out))
+            {
+                return 0;
+            }
+
+            uint8_t * p_token = p_out++;
+            size_t match_code = match_len - LZ4_MIN_MATCH;
+            *p_token = (uint8_t)(((literals < 15) ? literals : 15) << 4);
+            if (literals >= 15)
+            {
+                p_out = lz4_put_length(p_out, literals - 15);
+            }
+            memcpy(p_out, p_src + anchor, literals);
+            p_out += literals;
+
+            size_t offset = pos - candidate;
+            *p_out++ = (uint8_t)offset;
+            *p_out++ = (uint8_t)(offset >> 8);
+
+            *p_token = (uint8_t)(*p_token | ((match_code < 15) ? match_code : 15));
+            if (match_code >= 15)
+            {
+                p_out = lz4_put_length(p_out, match_code - 15);
+            }
+
+            pos += match_len;
+            anchor = pos;
+        }
+    }
+
+    // The block always ends with a sequence of literals only
+    size_t literals = src_len - anchor;
+    if ((1 + ((literals / 255) + 1) + literals) > (size_t)(p_dst_end - p_out))
+    {
+        return 0;
+    }
+    *p_out++ = (uint8_t)(((literals < 15) ? literals : 15) << 4);
+    if (literals >= 15)
+    {
+        p_out = lz4_put_length(p_out, literals - 15);
+    }
+    memcpy(p_out, p_src + anchor, literals);
+    p_out += literals;
+
+    return (size_t)(p_out - p_dst);
+}
+
+/*!
+ * @brief Decompress an LZ4 block that must expand to exactly dst_len bytes.
+ * Every length and offset is checked against both buffers.
+ *
+ * @return true if the block was valid otherwise false
+ */
+static bool lz4_decompress(const uint8_t * p_src,
+                           size_t src_len,
+                           uint8_t * p_dst,
+                           size_t dst_len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < src_len)
+    {
+        uint8_t token = p_src[in++];
+
+        size_t literals = (size_t)(token >> 4);
+        if (15 == literals)
+        {
+            uint8_t extra = 255;
+            while (255 == extra)
+            {
+                if (in >= src_len)
+                {
+                    return false;
+                }
+                extra = p_src[in++];
+                literals += extra;
+            }
+        }
+        if ((literals > (src_len - in)) || (literals > (dst_len - out)))
+        {
+            return false;
+        }
+        memcpy(p_dst + out, p_src + in, literals);
+        in += literals;
+        out += literals;
+
+        // The last sequence has no match
+        if (in == src_len)
+        {
+            break;
+        }
+
+        if ((src_len - in) < 2)
+        {
+            return false;
+        }
+        size_t offset = (size_t)p_src[in] | ((size_t)p_src[in + 1] << 8);
+        in += 2;
+        if ((0 == offset) || (offset > out))
+        {
+            return false;
+        }
+
+        size_t match_len = (size_t)(token & 0x0F);
+        if (15 == match_len)
+        {
+            uint8_t extra = 255;
+            while (255 == extra)
+            {
+                if (in >= src_len)
+                {
+                    return false;
+                }
+                extra = p_src[in++];
+                match_len += extra;
+            }
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (dst_len - out))
+        {
+            return false;
+        }
+
+        // Matches may overlap the bytes they produce so short offsets are
+        // copied one byte at a time
+        if (offset >= match_len)
+        {
+            memcpy(p_dst + out, p_dst + out - offset, match_len);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_len; i++)
+            {
+                p_dst[out + i] = p_dst[out - offset + i];
+            }
+        }
+        out += match_len;
+    }
+
+    return (out == dst_len);
+}
@@ -1,8 +1,99 @@
 #include <server_crypto.h>
+#include <server_sched.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <unistd.h>
 
-DEBUG_STATIC void print_b_array(hash_t * p_hash);
-DEBUG_STATIC hash_t * hex_char_to_byte_array(const char * p_hash_str, size_t hash_size);
-static bool hash_compare(uint8_t * l_array, uint8_t * r_array, size_t size);
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HEX_SIMD
+#endif
+
+// Domain separation prefixes so a leaf can never be passed off as a node
+#define TREE_LEAF_PREFIX 0x00
+#define TREE_NODE_PREFIX 0x01
+
+struct hash_tree
+{
+    size_t      length;
+    size_t      leaf_count;
+    hash_t *    p_leaves;
+};
+
+// Leaves of a tree shared out between the calling thread of hash_tree_fill
+// and the workers of the leaf pool. Workers that start after every leaf was
+// taken only drop their reference, the last reference frees the job
+typedef struct
+{
+    hash_tree_t *   p_tree;
+    hash_leaf_t     leaf;
+    void *          p_ctx;
+    size_t          leaves;     // Count of the tree, which may be gone
+    size_t          next;       // Next leaf to take
+    size_t          active;     // Leaves being hashed
+    uint32_t        refs;
+    bool            b_success;
+    pthread_mutex_t lock;
+    pthread_cond_t  idle;       // Signaled when no leaf is being hashed
+} tree_job_t;
+
+static const char g_hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+// Hex codec implementation picked once from the features of the processor
+static pthread_once_t g_hex_once = PTHREAD_ONCE_INIT;
+static bool gb_hex_sse41 = false;
+static bool gb_hex_avx2 = false;
+static bool gb_hex_simd = true;
+
+// Each thread reuses a single sha256 context for one shot hashes. The key
+// frees the context when the thread exits
+static pthread_key_t g_ctx_key;
+static pthread_once_t g_ctx_once = PTHREAD_ONCE_INIT;
+static _Thread_local EVP_MD_CTX * gp_thread_ctx = NULL;
+
+// Contexts of finished streams kept for the next streams started on the
+// thread. A thread may run several streams at once so they can not share the
+// one shot context. Freed with it when the thread exits
+#define STREAM_CTX_CACHE 4
+static _Thread_local EVP_MD_CTX * gp_stream_ctxs[STREAM_CTX_CACHE];
+static _Thread_local size_t g_stream_ctxs = 0;
+
+// Workers hashing the leaves of every tree of the process, started on the
+// first tree with more than one leaf and kept until the process exits
+static pthread_once_t g_leaf_once = PTHREAD_ONCE_INIT;
+static sched_t * gp_leaf_pool = NULL;
+
+DEBUG_STATIC void print_b_array(const hash_t * p_hash);
+static EVP_MD_CTX * get_thread_ctx(void);
+static void make_ctx_key(void);
+static void free_thread_ctx(void * p_ctx);
+static EVP_MD_CTX * take_stream_ctx(void);
+static void give_stream_ctx(EVP_MD_CTX * p_ctx);
+static bool hash_prefixed(uint8_t prefix,
+                          const uint8_t * p_first,
+                          size_t first_len,
+                          const uint8_t * p_second,
+                          size_t second_len,
+                          hash_t * p_hash);
+static void start_leaf_pool(void);
+static void take_leaves(tree_job_t * p_job);
+static void leaf_worker(void * p_arg);
+static void release_tree_job(tree_job_t * p_job);
+static bool bytes_leaf(hash_tree_t * p_tree, size_t index, void * p_ctx);
+static size_t leaf_length(hash_tree_t * p_tree, size_t index);
+static int hex_value(char hex);
+static void detect_hex_simd(void);
+static size_t hex_encode_scalar(const uint8_t * p_bytes, size_t length, char * p_hex);
+static bool hex_decode_scalar(const char * p_hex, size_t length, uint8_t * p_bytes);
+#ifdef HEX_SIMD
+static void hex_encode_16_sse41(const uint8_t * p_bytes, char * p_hex);
+static void hex_encode_32_avx2(const uint8_t * p_bytes, char * p_hex);
+static bool hex_decode_16_sse41(const char * p_hex, uint8_t * p_bytes);
+static bool hex_decode_32_avx2(const char * p_hex, uint8_t * p_bytes);
+#endif
 
 /*!
  * @brief Function takes a hash_t object and compares it against a hexadecimal
@@ -13,29 +104,19 @@ static bool hash_compare(uint8_t * l_array, uint8_t * r_array, size_t size);
  * @param length Length of the hexadecimal representation
  * @return True if hashes match else false
  */
-bool hash_pass_match(hash_t * p_hash, const char * p_input, size_t length)
+bool hash_pass_match(const hash_t * p_hash, const char * p_input, size_t length)
 {
     if ((NULL == p_hash) || (NULL == p_input))
     {
         return false;
     }
 
-    hash_t * p_pw_hash = hex_char_to_byte_array(p_input, length);
-    if (NULL == p_pw_hash)
+    hash_t pw_hash;
+    if (!hash_from_hex(p_input, length, &pw_hash))
     {
         return false;
     }
-
-    for (size_t i = 0; i < p_pw_hash->size; i++)
-    {
-        if (p_pw_hash->array[i] != p_hash->array[i])
-        {
-            hash_destroy(& p_pw_hash);
-            return false;
-        }
-    }
-    hash_destroy(&p_pw_hash);
-    return true;
+    return hash_match(p_hash, &pw_hash);
 }
 
 /*!
@@ -46,230 +127,1110 @@ bool hash_pass_match(hash_t * p_hash, const char * p_input, size_t length)
  * @param array_size The size of the p_array
  * @return true if hashes match else false
  */
-bool hash_bytes_match(hash_t * p_hash, uint8_t * p_array, size_t array_size)
+bool hash_bytes_match(const hash_t * p_hash, const uint8_t * p_array, size_t array_size)
 {
     if ((NULL == p_hash) || (NULL == p_array))
     {
         goto ret_null;
     }
 
-    if (p_hash->size != array_size)
+    if (sizeof(p_hash->array) != array_size)
     {
         goto ret_null;
     }
 
-    return hash_compare(p_hash->array, p_array, array_size);
+    return (0 == CRYPTO_memcmp(p_hash->array, p_array, array_size));
 
 ret_null:
     return false;
 }
 
 /*!
- * @brief Compare if the hashes of two hash_t objects match
+ * @brief Compare if two hashes match. The comparison takes the same time
+ * wherever the first difference is.
  *
  * @param p_lhash Pointer to a p_hash object
  * @param p_rhash Pointer to a p_hash object
  * @return true if hashes match else false
  */
-bool hash_hash_t_match(hash_t * p_lhash, hash_t * p_rhash)
+bool hash_match(const hash_t * p_lhash, const hash_t * p_rhash)
 {
     if ((NULL == p_lhash) || (NULL == p_rhash))
     {
-        goto ret_null;
+        return false;
     }
 
-    if (p_rhash->size != p_lhash->size)
+    return (0 == CRYPTO_memcmp(p_lhash->array, p_rhash->array, sizeof(p_lhash->array)));
+}
+
+/*!
+ * @brief Hash the given byte array into a sha256 hash. The hash is computed
+ * with a sha256 context kept per thread so no memory is allocated after the
+ * first call on a thread.
+ *
+ * @param p_byte_array Pointer to the bytearray to hash. May be NULL if the
+ * length is 0
+ * @param length Length of the bytearray to hash
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
+ */
+bool hash_byte_array(const uint8_t * p_byte_array, size_t length, hash_t * p_hash)
+{
+    if (((NULL == p_byte_array) && (length > 0)) || (NULL == p_hash))
     {
-        goto ret_null;
+        return false;
     }
 
-    return hash_compare(p_lhash->array, p_rhash->array, p_lhash->size);
-
+    EVP_MD_CTX * p_ctx = get_thread_ctx();
+    if (NULL == p_ctx)
+    {
+        return false;
+    }
 
-ret_null:
-    return false;
+    if ((1 != EVP_DigestInit_ex(p_ctx, EVP_sha256(), NULL))
+        || ((length > 0) && (1 != EVP_DigestUpdate(p_ctx, p_byte_array, length)))
+        || (1 != EVP_DigestFinal_ex(p_ctx, p_hash->array, NULL)))
+    {
+        fprintf(stderr, "[!] Unknown issue with SHA256\n");
+        return false;
+    }
+    return true;
 }
 
 /*!
- * @brief Compare if the two arrays match byte to byte
- * @param l_array Pointer to a byte array
- * @param r_array Pointer to a byte array
- * @param size Size of the byte arrays
- * @return true if arrays match else false
+ * @brief Hash the byte array with the algorithm negotiated by the client.
+ * HASH_ALG_TREE hashes the leaves with hash_tree_fill, on the calling thread
+ * and the workers of the leaf pool shared by the whole process.
+ *
+ * @param alg Algorithm to hash with
+ * @param p_bytes Pointer to the bytes to hash. May be NULL if the length is 0
+ * @param length Number of bytes to hash
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
  */
-static bool hash_compare(uint8_t * l_array, uint8_t * r_array, size_t size)
+bool hash_alg_bytes(hash_alg_t alg, const uint8_t * p_bytes, size_t length, hash_t * p_hash)
 {
-    for (size_t i = 0; i < size; i++)
+    if (((NULL == p_bytes) && (length > 0)) || (NULL == p_hash))
     {
-        if (l_array[i] != r_array[i])
+        return false;
+    }
+
+    switch (alg)
+    {
+        case HASH_ALG_SHA256:
+            return hash_byte_array(p_bytes, length, p_hash);
+        case HASH_ALG_TREE:
+            return hash_tree_bytes(p_bytes, length, 0, p_hash);
+        case HASH_ALG_BLAKE3:
         {
-            return false;
+            blake3_hasher_t hasher;
+            blake3_init(&hasher);
+            blake3_update(&hasher, p_bytes, length);
+            blake3_final(&hasher, p_hash->array);
+            return true;
         }
+        default:
+            return false;
+    }
+}
+
+/*!
+ * @brief Start an incremental hash. Only algorithms computed over the stream
+ * in order can be streamed which excludes HASH_ALG_TREE.
+ *
+ * @param p_stream Pointer to the hash_stream_t to initialize
+ * @param alg Algorithm to hash with
+ * @return true if successful otherwise false
+ */
+bool hash_stream_init(hash_stream_t * p_stream, hash_alg_t alg)
+{
+    if (NULL == p_stream)
+    {
+        return false;
+    }
+
+    *p_stream = (hash_stream_t){
+        .alg    = alg,
+        .p_ctx  = NULL,
+        .b_open = false
+    };
+
+    switch (alg)
+    {
+        case HASH_ALG_SHA256:
+            p_stream->p_ctx = take_stream_ctx();
+            if (NULL == p_stream->p_ctx)
+            {
+                return false;
+            }
+            if (1 != EVP_DigestInit_ex(p_stream->p_ctx, EVP_sha256(), NULL))
+            {
+                fprintf(stderr, "[!] Unable to initialize SHA256\n");
+                give_stream_ctx(p_stream->p_ctx);
+                p_stream->p_ctx = NULL;
+                return false;
+            }
+            break;
+        case HASH_ALG_BLAKE3:
+            blake3_init(&p_stream->blake3);
+            break;
+        default:
+            return false;
     }
+
+    p_stream->b_open = true;
     return true;
 }
 
 /*!
- * @brief Hash the given byte array into a sha256 hash and return a hash_t
- * structure containing the byte array and its size
+ * @brief Add the bytes to the running hash
  *
- * @param p_byte_array Pointer to the bytearray to hash
- * @param length Length of the bytearray to hash
- * @return hash_t object if successful or a NULL
+ * @param p_stream Pointer to the hash_stream_t object
+ * @param p_bytes Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ * @return true if successful otherwise false
  */
-hash_t * hash_byte_array(uint8_t * p_byte_array, size_t length)
+bool hash_stream_update(hash_stream_t * p_stream, const uint8_t * p_bytes, size_t length)
 {
-    if (NULL == p_byte_array)
+    if ((NULL == p_stream) || (!p_stream->b_open)
+        || ((NULL == p_bytes) && (length > 0)))
     {
-        return NULL;
+        return false;
     }
 
-    unsigned char md[SHA256_DIGEST_LENGTH];
-    uint8_t * hash_digest = (uint8_t *)SHA256((const unsigned char *)p_byte_array, length, (unsigned char *)&md);
-    if (NULL == hash_digest)
+    if (HASH_ALG_BLAKE3 == p_stream->alg)
     {
-        fprintf(stderr, "[!] Unknown issue with SHA256\n");
-        return NULL;
+        blake3_update(&p_stream->blake3, p_bytes, length);
+        return true;
     }
+    return (1 == EVP_DigestUpdate(p_stream->p_ctx, p_bytes, length));
+}
 
-    uint8_t * p_hash_digest = (uint8_t *)calloc(SHA256_DIGEST_LENGTH, sizeof(uint8_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_hash_digest))
+/*!
+ * @brief Finish the running hash and release the context. The context is
+ * released even if the function fails. Passing a NULL p_hash only releases
+ * the context.
+ *
+ * @param p_stream Pointer to the hash_stream_t object
+ * @param p_hash Pointer to the hash_t receiving the digest. May be NULL
+ * @return true if the digest was written otherwise false
+ */
+bool hash_stream_final(hash_stream_t * p_stream, hash_t * p_hash)
+{
+    if ((NULL == p_stream) || (!p_stream->b_open))
     {
-        return NULL;
+        return false;
+    }
+
+    bool b_success = false;
+    if (HASH_ALG_BLAKE3 == p_stream->alg)
+    {
+        if (NULL != p_hash)
+        {
+            blake3_final(&p_stream->blake3, p_hash->array);
+            b_success = true;
+        }
+    }
+    else if (NULL != p_hash)
+    {
+        b_success = (1 == EVP_DigestFinal_ex(p_stream->p_ctx, p_hash->array, NULL));
+        if (!b_success)
+        {
+            fprintf(stderr, "[!] Unable to finalize SHA256\n");
+        }
     }
 
-    // The SHA256 hash_digest is not a malloc pointer
-    memcpy(p_hash_digest, hash_digest, SHA256_DIGEST_LENGTH);
+    give_stream_ctx(p_stream->p_ctx);
+    p_stream->p_ctx = NULL;
+    p_stream->b_open = false;
+    return b_success;
+}
 
-    hash_t * p_hash = (hash_t *)malloc(sizeof(hash_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_hash))
+/*!
+ * @brief Create a tree for a stream of the given length. The leaf hashes are
+ * set with hash_tree_set_leaf before the root is computed.
+ *
+ * @param length Number of bytes in the stream
+ * @return hash_tree_t object if successful or NULL
+ */
+hash_tree_t * hash_tree_init(size_t length)
+{
+    hash_tree_t * p_tree = (hash_tree_t *)malloc(sizeof(hash_tree_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_tree))
     {
-        goto cleanup;
+        goto ret_null;
     }
-    *p_hash = (hash_t){
-        .array = p_hash_digest,
-        .size = SHA256_DIGEST_LENGTH
+
+    // An empty stream still has a single (empty) leaf
+    size_t leaf_count = (length + HASH_TREE_LEAF_SIZE - 1) / HASH_TREE_LEAF_SIZE;
+    leaf_count = (0 == leaf_count) ? 1 : leaf_count;
+
+    *p_tree = (hash_tree_t){
+        .length     = length,
+        .leaf_count = leaf_count,
+        .p_leaves   = (hash_t *)calloc(leaf_count, sizeof(hash_t))
     };
-    return p_hash;
+    if (UV_INVALID_ALLOC == verify_alloc(p_tree->p_leaves))
+    {
+        goto cleanup_tree;
+    }
+    return p_tree;
 
-cleanup:
-    free(p_hash_digest);
+cleanup_tree:
+    free(p_tree);
+ret_null:
     return NULL;
 }
 
 /*!
- * @brief Free a hash_t object
+ * @brief Free the tree
  *
- * @param pp_hash Pointer to the pp_hash object to free
+ * @param pp_tree Double pointer to the hash_tree_t object
  */
-void hash_destroy(hash_t ** pp_hash)
+void hash_tree_destroy(hash_tree_t ** pp_tree)
 {
-    if (NULL == pp_hash)
+    if ((NULL == pp_tree) || (NULL == *pp_tree))
     {
         return;
     }
-    hash_t * p_hash = *pp_hash;
-    if (NULL == p_hash)
+
+    free((*pp_tree)->p_leaves);
+    free(*pp_tree);
+    *pp_tree = NULL;
+}
+
+/*!
+ * @brief Get the length of the stream the tree was created for
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @return Number of bytes in the stream
+ */
+size_t hash_tree_length(hash_tree_t * p_tree)
+{
+    return (NULL == p_tree) ? 0 : p_tree->length;
+}
+
+/*!
+ * @brief Get the number of leaves of the tree
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @return Number of leaves
+ */
+size_t hash_tree_leaf_count(hash_tree_t * p_tree)
+{
+    return (NULL == p_tree) ? 0 : p_tree->leaf_count;
+}
+
+/*!
+ * @brief Hash the bytes of a leaf into the tree. Leaves are independent of
+ * each other so different leaves may be set from different threads.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @param p_bytes Pointer to the bytes of the leaf
+ * @param length Number of bytes in the leaf. Must match the leaf size
+ * @return true if successful otherwise false
+ */
+bool hash_tree_set_leaf(hash_tree_t * p_tree,
+                        size_t index,
+                        const uint8_t * p_bytes,
+                        size_t length)
+{
+    if ((NULL == p_tree) || (index >= p_tree->leaf_count)
+        || ((NULL == p_bytes) && (length > 0)))
     {
-        return;
+        return false;
+    }
+
+    if (length != leaf_length(p_tree, index))
+    {
+        return false;
+    }
+
+    return hash_prefixed(TREE_LEAF_PREFIX, p_bytes, length, NULL, 0,
+                         &p_tree->p_leaves[index]);
+}
+
+/*!
+ * @brief Get the hash of a leaf. Used to verify a single range of the
+ * stream without reading the rest of it.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @return Pointer to the leaf hash owned by the tree or NULL if the index is
+ * out of range
+ */
+const hash_t * hash_tree_leaf(hash_tree_t * p_tree, size_t index)
+{
+    if ((NULL == p_tree) || (index >= p_tree->leaf_count))
+    {
+        return NULL;
+    }
+    return &p_tree->p_leaves[index];
+}
+
+/*!
+ * @brief Combine the leaf hashes into the root of the tree
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param p_hash Pointer to the hash_t receiving the root
+ * @return true if successful otherwise false
+ */
+bool hash_tree_root(hash_tree_t * p_tree, hash_t * p_hash)
+{
+    if ((NULL == p_tree) || (NULL == p_hash))
+    {
+        return false;
+    }
+
+    // Each level is reduced in place in a copy of the leaves
+    hash_t * p_level = (hash_t *)malloc(p_tree->leaf_count * sizeof(hash_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_level))
+    {
+        return false;
+    }
+    memcpy(p_level, p_tree->p_leaves, p_tree->leaf_count * sizeof(hash_t));
+
+    bool b_success = true;
+    size_t nodes = p_tree->leaf_count;
+    while ((nodes > 1) && b_success)
+    {
+        size_t parents = 0;
+        for (size_t i = 0; i < nodes; i += 2)
+        {
+            if ((i + 1) == nodes)
+            {
+                // No sibling, promote the node as is
+                p_level[parents] = p_level[i];
+            }
+            else if (!hash_prefixed(TREE_NODE_PREFIX,
+                                    p_level[i].array, sizeof(hash_t),
+                                    p_level[i + 1].array, sizeof(hash_t),
+                                    &p_level[parents]))
+            {
+                b_success = false;
+                break;
+            }
+            parents++;
+        }
+        nodes = parents;
     }
 
-    if (NULL != p_hash->array)
+    if (b_success)
     {
-        free(p_hash->array);
+        *p_hash = p_level[0];
+    }
+    free(p_level);
+    return b_success;
+}
+
+/*!
+ * @brief Set every leaf of the tree with the callback. The calling thread
+ * hashes leaves together with up to threads - 1 workers of a pool of one
+ * thread per online processor shared by the whole process, so concurrent
+ * requests share a fixed number of threads instead of starting their own.
+ * Leaves are taken in order and the first failure stops the others.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @param leaf Callback hashing the leaf at the index into the tree
+ * @param p_ctx Context passed to the callback
+ * @return true if every leaf was set otherwise false
+ */
+bool hash_tree_fill(hash_tree_t * p_tree, uint8_t threads, hash_leaf_t leaf, void * p_ctx)
+{
+    if ((NULL == p_tree) || (NULL == leaf))
+    {
+        return false;
+    }
+
+    tree_job_t * p_job = (tree_job_t *)malloc(sizeof(tree_job_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_job))
+    {
+        return false;
     }
-    *p_hash = (hash_t){
-        .array = NULL,
-        .size = 0
+    *p_job = (tree_job_t){
+        .p_tree     = p_tree,
+        .leaf       = leaf,
+        .p_ctx      = p_ctx,
+        .leaves     = p_tree->leaf_count,
+        .next       = 0,
+        .active     = 0,
+        .refs       = 1,
+        .b_success  = true
     };
-    free(p_hash);
-    *pp_hash = NULL;
+    pthread_mutex_init(&p_job->lock, NULL);
+    pthread_cond_init(&p_job->idle, NULL);
+
+    size_t workers = (0 == threads) ? hash_tree_threads(p_job->leaves) : threads;
+    workers = (workers > p_job->leaves) ? p_job->leaves : workers;
+    if (workers > 1)
+    {
+        pthread_once(&g_leaf_once, start_leaf_pool);
+    }
+
+    // Helpers that can not be queued leave their leaves to the calling thread
+    for (size_t i = 1; (i < workers) && (NULL != gp_leaf_pool); i++)
+    {
+        pthread_mutex_lock(&p_job->lock);
+        p_job->refs++;
+        pthread_mutex_unlock(&p_job->lock);
+        if (OP_SUCCESS != sched_submit(gp_leaf_pool, leaf_worker, p_job))
+        {
+            release_tree_job(p_job);
+            break;
+        }
+    }
+    take_leaves(p_job);
+
+    // No leaf is left to take, wait for the ones the workers are hashing
+    pthread_mutex_lock(&p_job->lock);
+    while (p_job->active > 0)
+    {
+        pthread_cond_wait(&p_job->idle, &p_job->lock);
+    }
+    bool b_success = p_job->b_success;
+    pthread_mutex_unlock(&p_job->lock);
+    release_tree_job(p_job);
+    return b_success;
 }
 
 /*!
- * @brief Translate a hexadecimal hash back into a byte array. Every two
- * characters of a hexadecimal array represents one byte. The function
- * reads two characters at a time and converts it to the byte representation.
- * The result is a byte array.
+ * @brief Compute the tree root of the byte array. The leaves are hashed
+ * with hash_tree_fill.
+ *
+ * @param p_bytes Pointer to the bytes to hash
+ * @param length Number of bytes to hash
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @param p_hash Pointer to the hash_t receiving the root
+ * @return true if successful otherwise false
+ */
+bool hash_tree_bytes(const uint8_t * p_bytes,
+                     size_t length,
+                     uint8_t threads,
+                     hash_t * p_hash)
+{
+    if (((NULL == p_bytes) && (length > 0)) || (NULL == p_hash))
+    {
+        return false;
+    }
+
+    hash_tree_t * p_tree = hash_tree_init(length);
+    if (NULL == p_tree)
+    {
+        return false;
+    }
+
+    bool b_success = hash_tree_fill(p_tree, threads, bytes_leaf, (void *)p_bytes)
+                     && hash_tree_root(p_tree, p_hash);
+    hash_tree_destroy(&p_tree);
+    return b_success;
+}
+
+/*!
+ * @brief Get the number of threads to use for tree hashing when the caller
+ * does not specify one
+ *
+ * @param leaves Number of leaves to hash
+ * @return Number of online processors capped by the number of leaves
+ */
+uint8_t hash_tree_threads(size_t leaves)
+{
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = (nprocs < 1) ? 1 : (size_t)nprocs;
+    threads = (threads > UINT8_MAX) ? UINT8_MAX : threads;
+    threads = (threads > leaves) ? leaves : threads;
+    return (0 == threads) ? 1 : (uint8_t)threads;
+}
+
+/*!
+ * @brief Translate a hexadecimal hash back into a hash_t. Every two
+ * characters of the hexadecimal string represent one byte.
  *
  * @param p_hash_str Pointer to the hexadecimal string
- * @param hash_size Size of the hexadecimal string
- * @return hash_t object if successful otherwise NULL
+ * @param hash_size Size of the hexadecimal string. Must be twice the digest
+ * length
+ * @param p_hash Pointer to the hash_t receiving the digest
+ * @return true if successful otherwise false
  */
-hash_t * hex_char_to_byte_array(const char * p_hash_str, size_t hash_size)
+bool hash_from_hex(const char * p_hash_str, size_t hash_size, hash_t * p_hash)
 {
-    if ((NULL == p_hash_str) || (0 == hash_size))
+    if ((NULL == p_hash_str) || (NULL == p_hash))
     {
-        return NULL;
+        return false;
     }
 
-    // The hash string represents a byte using two characters, so the byte
-    // array must be half the size of the hash string
-    if (0 != (hash_size % 2))
+    // The hash string represents a byte using two characters
+    if ((sizeof(p_hash->array) * 2) != hash_size)
     {
-        fprintf(stderr, "[!] The hash string provided contains an "
-                        "odd number of hexadecimal characters.\n");
-        return NULL;
+        fprintf(stderr, "[!] The hash string provided is not %zu "
+                        "hexadecimal characters.\n", sizeof(p_hash->array) * 2);
+        return false;
     }
 
-    size_t array_size = (size_t)(hash_size / 2);
+    if (!hex_decode(p_hash_str, hash_size, p_hash->array))
+    {
+        fprintf(stderr, "[!] The hash string provided contains a "
+                        "non hexadecimal character.\n");
+        return false;
+    }
+    return true;
+}
 
-    uint8_t * p_byte_array = (uint8_t *)calloc(array_size, sizeof(uint8_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_byte_array))
+/*!
+ * @brief Write the digest as a NUL terminated lowercase hexadecimal string
+ *
+ * @param p_hash Pointer to the hash_t to encode
+ * @param p_hex Buffer of at least (2 * sizeof(p_hash->array)) + 1 characters
+ * @return true if successful otherwise false
+ */
+bool hash_to_hex(const hash_t * p_hash, char * p_hex)
+{
+    if ((NULL == p_hash) || (NULL == p_hex))
     {
-        return NULL;
+        return false;
     }
 
-    int result;
-    size_t str_idx  = 0;
-    size_t barr_idx = 0;
-    while (str_idx < hash_size)
+    size_t written = hex_encode(p_hash->array, sizeof(p_hash->array), p_hex);
+    p_hex[written] = '\0';
+    return true;
+}
+
+/*!
+ * @brief Encode the bytes as lowercase hexadecimal. Blocks of 32 and 16
+ * bytes are encoded with AVX2 and SSE4.1 when the processor supports them.
+ * The output is not NUL terminated.
+ *
+ * @param p_bytes Pointer to the bytes to encode. May be NULL if the length
+ * is 0
+ * @param length Number of bytes to encode
+ * @param p_hex Buffer of at least 2 * length characters
+ * @return Number of characters written
+ */
+size_t hex_encode(const uint8_t * p_bytes, size_t length, char * p_hex)
+{
+    if ((length > 0) && ((NULL == p_bytes) || (NULL == p_hex)))
     {
-        result = sscanf(&p_hash_str[str_idx], "%2hhx", &p_byte_array[barr_idx]);
+        return 0;
+    }
 
-        // The scan API returns the number of bytes read. To check if a valid
-        // read occurred a comparison of 1 byte is made.
-        if (1 == result)
+    pthread_once(&g_hex_once, detect_hex_simd);
+    size_t done = 0;
+#ifdef HEX_SIMD
+    if (gb_hex_simd)
+    {
+        for (; gb_hex_avx2 && ((length - done) >= 32); done += 32)
         {
-            str_idx  += 2;
-            barr_idx += 1;
+            hex_encode_32_avx2(p_bytes + done, p_hex + (done * 2));
         }
-            // EOF is returned when either the end of the string is reached or
-            // when an error occurred. Since we are reading with bounds, we should
-            // only get EOF when an error occurs
-        else if (EOF == result)
+        for (; gb_hex_sse41 && ((length - done) >= 16); done += 16)
         {
-            perror("sscanf");
-            goto cleanup;
+            hex_encode_16_sse41(p_bytes + done, p_hex + (done * 2));
         }
     }
+#endif
+    hex_encode_scalar(p_bytes + done, length - done, p_hex + (done * 2));
+    return length * 2;
+}
 
-    hash_t * p_hash = (hash_t *)malloc(sizeof(hash_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_hash))
+/*!
+ * @brief Decode a hexadecimal string of either case. Blocks of 64 and 32
+ * characters are decoded with AVX2 and SSE4.1 when the processor supports
+ * them.
+ *
+ * @param p_hex Pointer to the hexadecimal characters. May be NULL if the
+ * length is 0
+ * @param length Number of characters. Must be even
+ * @param p_bytes Buffer of at least length / 2 bytes
+ * @return true if successful or false if the length is odd or a character is
+ * not hexadecimal. The output is undefined on failure
+ */
+bool hex_decode(const char * p_hex, size_t length, uint8_t * p_bytes)
+{
+    if (((length > 0) && ((NULL == p_hex) || (NULL == p_bytes))) || (0 != (length % 2)))
     {
-        goto cleanup;
+        return false;
     }
-    *p_hash = (hash_t){
-        .array  = p_byte_array,
-        .size   = array_size
-    };
-    return p_hash;
 
-cleanup:
-    free(p_byte_array);
-    return NULL;
+    pthread_once(&g_hex_once, detect_hex_simd);
+    size_t bytes = length / 2;
+    size_t done = 0;
+#ifdef HEX_SIMD
+    if (gb_hex_simd)
+    {
+        for (; gb_hex_avx2 && ((bytes - done) >= 32); done += 32)
+        {
+            if (!hex_decode_32_avx2(p_hex + (done * 2), p_bytes + done))
+            {
+                return false;
+            }
+        }
+        for (; gb_hex_sse41 && ((bytes - done) >= 16); done += 16)
+        {
+            if (!hex_decode_16_sse41(p_hex + (done * 2), p_bytes + done))
+            {
+                return false;
+            }
+        }
+    }
+#endif
+    return hex_decode_scalar(p_hex + (done * 2), (bytes - done) * 2, p_bytes + done);
 }
 
-DEBUG_STATIC void print_b_array(hash_t * p_hash)
+/*!
+ * @brief Choose between the SIMD and the scalar hex codec. Only used to
+ * compare both implementations; by default the SIMD codec is used whenever
+ * the processor supports it.
+ *
+ * @param b_enable false to force the scalar codec
+ * @return true if a SIMD codec is used after the call
+ */
+bool hex_use_simd(bool b_enable)
+{
+    pthread_once(&g_hex_once, detect_hex_simd);
+    gb_hex_simd = b_enable;
+    return gb_hex_simd && (gb_hex_sse41 || gb_hex_avx2);
+}
+
+DEBUG_STATIC void print_b_array(const hash_t * p_hash)
 {
     if (NULL == p_hash)
     {
         return;
     }
-    for (size_t i = 0; i < p_hash->size; i++)
+    char hex[(sizeof(p_hash->array) * 2) + 1];
+    hash_to_hex(p_hash, hex);
+    printf("%s\n", hex);
+}
+
+/*!
+ * @brief Get the sha256 context of the calling thread. It is created on
+ * the first call and freed when the thread exits.
+ *
+ * @return EVP_MD_CTX of the thread or NULL if it could not be created
+ */
+static EVP_MD_CTX * get_thread_ctx(void)
+{
+    if (NULL != gp_thread_ctx)
+    {
+        return gp_thread_ctx;
+    }
+
+    pthread_once(&g_ctx_once, make_ctx_key);
+    EVP_MD_CTX * p_ctx = EVP_MD_CTX_new();
+    if (NULL == p_ctx)
+    {
+        return NULL;
+    }
+    if (0 != pthread_setspecific(g_ctx_key, p_ctx))
+    {
+        EVP_MD_CTX_free(p_ctx);
+        return NULL;
+    }
+    gp_thread_ctx = p_ctx;
+    return p_ctx;
+}
+
+/*!
+ * @brief Create the key that frees the per thread contexts
+ */
+static void make_ctx_key(void)
+{
+    if (0 != pthread_key_create(&g_ctx_key, free_thread_ctx))
+    {
+        fprintf(stderr, "[!] Unable to create the hash context key\n");
+    }
+}
+
+/*!
+ * @brief Destructor of the per thread context called at thread exit
+ *
+ * @param p_ctx Pointer to the EVP_MD_CTX of the exiting thread
+ */
+static void free_thread_ctx(void * p_ctx)
+{
+    EVP_MD_CTX_free((EVP_MD_CTX *)p_ctx);
+    gp_thread_ctx = NULL;
+    while (g_stream_ctxs > 0)
+    {
+        EVP_MD_CTX_free(gp_stream_ctxs[--g_stream_ctxs]);
+    }
+}
+
+/*!
+ * @brief Take a sha256 context for a stream from the cache of the thread
+ *
+ * @return EVP_MD_CTX for the stream or NULL if it could not be created
+ */
+static EVP_MD_CTX * take_stream_ctx(void)
+{
+    if (g_stream_ctxs > 0)
+    {
+        return gp_stream_ctxs[--g_stream_ctxs];
+    }
+    return EVP_MD_CTX_new();
+}
+
+/*!
+ * @brief Give the context of a finished stream back to the cache of the
+ * thread. The cache is only freed by the destructor of the one shot context,
+ * so a thread without one frees the context instead
+ *
+ * @param p_ctx Pointer to the EVP_MD_CTX of the stream. May be NULL
+ */
+static void give_stream_ctx(EVP_MD_CTX * p_ctx)
+{
+    if (NULL == p_ctx)
+    {
+        return;
+    }
+    if ((g_stream_ctxs < STREAM_CTX_CACHE) && (NULL != get_thread_ctx()))
+    {
+        gp_stream_ctxs[g_stream_ctxs++] = p_ctx;
+        return;
+    }
+    EVP_MD_CTX_free(p_ctx);
+}
+
+/*!
+ * @brief Start the pool of workers shared by every tree. Without the pool
+ * the calling threads hash every leaf themselves
+ */
+static void start_leaf_pool(void)
+{
+    uint16_t workers = hash_tree_threads(SIZE_MAX);
+    gp_leaf_pool = sched_init(workers, workers);
+    if (NULL == gp_leaf_pool)
+    {
+        fprintf(stderr, "[!] Unable to start the tree hash workers\n");
+    }
+}
+
+/*!
+ * @brief Hash leaves of the job until none is left or one failed
+ *
+ * @param p_job Pointer to the tree_job_t
+ */
+static void take_leaves(tree_job_t * p_job)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&p_job->lock);
+        if ((p_job->next >= p_job->leaves) || (!p_job->b_success))
+        {
+            pthread_mutex_unlock(&p_job->lock);
+            return;
+        }
+        size_t index = p_job->next++;
+        p_job->active++;
+        pthread_mutex_unlock(&p_job->lock);
+
+        bool b_success = p_job->leaf(p_job->p_tree, index, p_job->p_ctx);
+
+        pthread_mutex_lock(&p_job->lock);
+        p_job->b_success = p_job->b_success && b_success;
+        if (0 == --p_job->active)
+        {
+            pthread_cond_broadcast(&p_job->idle);
+        }
+        pthread_mutex_unlock(&p_job->lock);
+    }
+}
+
+/*!
+ * @brief Job of the leaf pool. Helps hashing the leaves of a tree
+ *
+ * @param p_arg Pointer to the tree_job_t
+ */
+static void leaf_worker(void * p_arg)
+{
+    tree_job_t * p_job = (tree_job_t *)p_arg;
+    take_leaves(p_job);
+    release_tree_job(p_job);
+}
+
+/*!
+ * @brief Drop a reference to the job and free it with the last one
+ *
+ * @param p_job Pointer to the tree_job_t
+ */
+static void release_tree_job(tree_job_t * p_job)
+{
+    pthread_mutex_lock(&p_job->lock);
+    bool b_last = (0 == --p_job->refs);
+    pthread_mutex_unlock(&p_job->lock);
+    if (b_last)
     {
-        printf("%02x", p_hash->array[i]);
+        pthread_cond_destroy(&p_job->idle);
+        pthread_mutex_destroy(&p_job->lock);
+        free(p_job);
     }
-    printf("\n");
 }
 
+/*!
+ * @brief Leaf callback of hash_tree_bytes. Hashes the leaf straight from
+ * the byte array
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @param p_ctx Pointer to the bytes of the tree
+ * @return true if successful otherwise false
+ */
+static bool bytes_leaf(hash_tree_t * p_tree, size_t index, void * p_ctx)
+{
+    const uint8_t * p_leaf = (const uint8_t *)p_ctx + (index * HASH_TREE_LEAF_SIZE);
+    return hash_tree_set_leaf(p_tree, index, p_leaf, leaf_length(p_tree, index));
+}
+
+/*!
+ * @brief Get the number of stream bytes covered by the leaf. Every leaf is
+ * HASH_TREE_LEAF_SIZE except the last one.
+ *
+ * @param p_tree Pointer to the hash_tree_t object
+ * @param index Index of the leaf
+ * @return Number of bytes of the leaf
+ */
+static size_t leaf_length(hash_tree_t * p_tree, size_t index)
+{
+    size_t offset = index * HASH_TREE_LEAF_SIZE;
+    size_t remaining = p_tree->length - offset;
+    return (remaining < HASH_TREE_LEAF_SIZE) ? remaining : HASH_TREE_LEAF_SIZE;
+}
+
+/*!
+ * @brief Compute sha256(prefix || first || second) with the context of the
+ * calling thread
+ *
+ * @param prefix Domain separation byte
+ * @param p_first Pointer to the first input. May be NULL if first_len is 0
+ * @param first_len Number of bytes of the first input
+ * @param p_second Pointer to the second input. May be NULL if second_len is 0
+ * @param second_len Number of bytes of the second input
+ * @param p_hash Pointer to the hash_t receiving the digest. May alias the
+ * inputs since it is only written once all input is consumed
+ * @return true if successful otherwise false
+ */
+static bool hash_prefixed(uint8_t prefix,
+                          const uint8_t * p_first,
+                          size_t first_len,
+                          const uint8_t * p_second,
+                          size_t second_len,
+                          hash_t * p_hash)
+{
+    EVP_MD_CTX * p_ctx = get_thread_ctx();
+    if (NULL == p_ctx)
+    {
+        return false;
+    }
+
+    bool b_success = (1 == EVP_DigestInit_ex(p_ctx, EVP_sha256(), NULL))
+                     && (1 == EVP_DigestUpdate(p_ctx, &prefix, sizeof(prefix)))
+                     && ((0 == first_len)
+                         || (1 == EVP_DigestUpdate(p_ctx, p_first, first_len)))
+                     && ((0 == second_len)
+                         || (1 == EVP_DigestUpdate(p_ctx, p_second, second_len)))
+                     && (1 == EVP_DigestFinal_ex(p_ctx, p_hash->array, NULL));
+    if (!b_success)
+    {
+        fprintf(stderr, "[!] Unable to compute tree hash\n");
+    }
+    return b_success;
+}
+
+/*!
+ * @brief Get the value of a hexadecimal character
+ *
+ * @param hex Character to convert
+ * @return Value between 0 and 15 or -1 if the character is not hexadecimal
+ */
+static int hex_value(char hex)
+{
+    if ((hex >= '0') && (hex <= '9'))
+    {
+        return hex - '0';
+    }
+    if ((hex >= 'a') && (hex <= 'f'))
+    {
+        return hex - 'a' + 10;
+    }
+    if ((hex >= 'A') && (hex <= 'F'))
+    {
+        return hex - 'A' + 10;
+    }
+    return -1;
+}
+
+/*!
+ * @brief Check once which SIMD extensions the processor supports
+ */
+static void detect_hex_simd(void)
+{
+#ifdef HEX_SIMD
+    __builtin_cpu_init();
+    gb_hex_sse41 = (0 != __builtin_cpu_supports("sse4.1"));
+    gb_hex_avx2 = (0 != __builtin_cpu_supports("avx2"));
+#endif
+}
+
+static size_t hex_encode_scalar(const uint8_t * p_bytes, size_t length, char * p_hex)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        p_hex[i * 2] = g_hex_digits[p_bytes[i] >> 4];
+        p_hex[(i * 2) + 1] = g_hex_digits[p_bytes[i] & 0x0F];
+    }
+    return length * 2;
+}
+
+static bool hex_decode_scalar(const char * p_hex, size_t length, uint8_t * p_bytes)
+{
+    for (size_t i = 0; i < (length / 2); i++)
+    {
+        int high = hex_value(p_hex[i * 2]);
+        int low  = hex_value(p_hex[(i * 2) + 1]);
+        if ((-1 == high) || (-1 == low))
+        {
+            return false;
+        }
+        p_bytes[i] = (uint8_t)((high << 4) | low);
+    }
+    return true;
+}
+
+#ifdef HEX_SIMD
+
+/*!
+ * @brief Encode 16 bytes into 32 characters. Each nibble indexes a table of
+ * the 16 digits with a byte shuffle and the high and low digits are then
+ * interleaved.
+ */
+__attribute__((target("sse4.1")))
+static void hex_encode_16_sse41(const uint8_t * p_bytes, char * p_hex)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i *)g_hex_digits);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    __m128i in = _mm_loadu_si128((const __m128i *)p_bytes);
+    __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+
+    _mm_storeu_si128((__m128i *)p_hex, _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *)(p_hex + 16), _mm_unpackhi_epi8(high, low));
+}
+
+/*!
+ * @brief Encode 32 bytes into 64 characters. The unpacks work within each
+ * 128 bit lane so the halves are put back in order before storing.
+ */
+__attribute__((target("avx2")))
+static void hex_encode_32_avx2(const uint8_t * p_bytes, char * p_hex)
+{
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)g_hex_digits));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i in = _mm256_loadu_si256((const __m256i *)p_bytes);
+    __m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, nibble));
+
+    __m256i first = _mm256_unpacklo_epi8(high, low);
+    __m256i second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256((__m256i *)p_hex, _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)(p_hex + 32), _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+/*!
+ * @brief Convert 16 characters into their nibble values
+ *
+ * @param chars Characters to convert
+ * @param p_valid Set to false if a character is not hexadecimal
+ * @return Nibble value of every character
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i hex_nibbles_sse41(__m128i chars, bool * p_valid)
+{
+    // Digits and letters are found with unsigned range checks: after
+    // subtracting the start of the range, values past the end compare
+    // greater than the width of the range
+    __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+    if (0xFFFF != _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)))
+    {
+        *p_valid = false;
+    }
+    return _mm_blendv_epi8(_mm_add_epi8(alpha, _mm_set1_epi8(10)), digit, is_digit);
+}
+
+/*!
+ * @brief Decode 32 characters into 16 bytes. Pairs of nibbles are combined
+ * as high * 16 + low with a multiply add and packed back to bytes.
+ */
+__attribute__((target("sse4.1")))
+static bool hex_decode_16_sse41(const char * p_hex, uint8_t * p_bytes)
+{
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    bool b_valid = true;
+
+    __m128i first = hex_nibbles_sse41(_mm_loadu_si128((const __m128i *)p_hex), &b_valid);
+    __m128i second = hex_nibbles_sse41(_mm_loadu_si128((const __m128i *)(p_hex + 16)), &b_valid);
+    if (!b_valid)
+    {
+        return false;
+    }
+
+    __m128i packed = _mm_packus_epi16(_mm_maddubs_epi16(first, weights),
+                                      _mm_maddubs_epi16(second, weights));
+    _mm_storeu_si128((__m128i *)p_bytes, packed);
+    return true;
+}
+
+/*!
+ * @brief Convert 32 characters into their nibble values
+ *
+ * @param chars Characters to convert
+ * @param p_valid Set to false if a character is not hexadecimal
+ * @return Nibble value of every character
+ */
+__attribute__((target("avx2")))
+static inline __m256i hex_nibbles_avx2(__m256i chars, bool * p_valid)
+{
+    __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+    __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)),
+                                    _mm256_set1_epi8('a'));
+    __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+
+    if (-1 != _mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)))
+    {
+        *p_valid = false;
+    }
+    return _mm256_blendv_epi8(_mm256_add_epi8(alpha, _mm256_set1_epi8(10)), digit, is_digit);
+}
+
+/*!
+ * @brief Decode 64 characters into 32 bytes. The pack works within each 128
+ * bit lane so the quarters are put back in order before storing.
+ */
+__attribute__((target("avx2")))
+static bool hex_decode_32_avx2(const char * p_hex, uint8_t * p_bytes)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    bool b_valid = true;
+
+    __m256i first = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)p_hex), &b_valid);
+    __m256i second = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(p_hex + 32)), &b_valid);
+    if (!b_valid)
+    {
+        return false;
+    }
+
+    __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(first, weights),
+                                         _mm256_maddubs_epi16(second, weights));
+    _mm256_storeu_si256((__m256i *)p_bytes, _mm256_permute4x64_epi64(packed, 0xD8));
+    return true;
+}
+
+#endif // HEX_SIMD
@@ -16,30 +16,66 @@ static const char * OP_13 = "Network socket is closed, cannot read or send anymo
 static const char * OP_14 = "User could not be removed because they do not exist";
 static const char * OP_15 = "File requested exists but it is empty";
 static const char * OP_16 = "Directory requested exists but it is empty";
+static const char * OP_17 = "Hash of the data received does not match the hash provided";
+static const char * OP_18 = "Compressed data is corrupt or the compression codec is not supported";
+static const char * OP_19 = "Server does not hold data with the provided hash, the file data must be sent";
+static const char * OP_20 = "Server is busy, retry the request later";
 static const char * OP_254 = "I/O error occurred during the action. This could be due to permissions, file not existing, or error while writing and reading.";
 static const char * OP_255 = "Server action failed";
 
 
 static const char * get_err_msg(ret_codes_t res);
-static time_t * get_time(void);
-static ret_codes_t generate_session_id(htable_t * htable, uint32_t * p_session);
 static void set_resp(act_resp_t ** pp_resp, ret_codes_t code);
 static ret_codes_t user_action(db_t * p_db, wire_payload_t * p_ld);
 static ret_codes_t do_del_file(db_t * p_db, wire_payload_t * p_ld);
 static ret_codes_t do_make_dir(db_t * p_db, wire_payload_t * p_ld);
 static ret_codes_t do_put_file(db_t * p_db, wire_payload_t * p_ld);
+static ret_codes_t do_put_hash(db_t * p_db, wire_payload_t * p_ld);
+static ret_codes_t do_put_delta(db_t * p_db, wire_payload_t * p_ld);
+static ret_codes_t hash_delta_output(f_stream_t * p_out, size_t out_len, hash_t * p_hash);
+static ret_codes_t verify_put_hash(wire_payload_t * p_ld);
+static ret_codes_t hash_stream_file(file_content_t * p_content, hash_alg_t alg);
+static ret_codes_t compress_file(file_content_t * p_content,
+                                 codec_t codec,
+                                 hash_stream_t * p_hash);
+static ret_codes_t compress_content(db_t * p_db,
+                                    file_content_t * p_content,
+                                    codec_t codec);
+static ret_codes_t decompress_put(db_t * p_db, wire_payload_t * p_ld);
+static ret_codes_t hash_tree_file(file_content_t * p_content);
 static void do_get_file(db_t * p_db, wire_payload_t * p_ld, act_resp_t ** pp_resp);
+static void do_get_signature(db_t * p_db, wire_payload_t * p_ld, act_resp_t ** pp_resp);
 static void do_list_dir(db_t * p_db,
                         wire_payload_t * p_ld,
                         act_resp_t ** pp_resp);
 
 
-static act_resp_t * get_resp(void);
+static act_resp_t * get_resp(arena_t * p_arena);
+
+// Operation handed to the I/O pool. The network worker blocks until the
+// I/O worker has filled in the response
+typedef struct
+{
+    db_t *              p_db;
+    wire_payload_t *    p_req;
+    act_resp_t *        p_resp;
+} file_op_t;
+
+static void run_file_op(db_t * p_db, wire_payload_t * p_req, act_resp_t * p_resp);
+static void file_op_job(void * p_arg);
 
 
-act_resp_t * ctrl_populate_resp(ret_codes_t code)
+/*!
+ * @brief Create a response holding only the code and its message
+ *
+ * @param p_arena Arena to allocate the response from. NULL allocates it
+ * with malloc
+ * @param code Result of the request
+ * @return Response object if successful otherwise NULL
+ */
+act_resp_t * ctrl_populate_resp(arena_t * p_arena, ret_codes_t code)
 {
-    act_resp_t * p_resp = get_resp();
+    act_resp_t * p_resp = get_resp(p_arena);
     if (NULL == p_resp)
     {
         return NULL;
@@ -72,7 +108,7 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
     }
 
 
-    act_resp_t * p_resp = get_resp();
+    act_resp_t * p_resp = get_resp(p_client_req->p_arena);
     if (NULL == p_resp)
     {
         goto ret_null;
@@ -90,45 +126,20 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
         goto set_resp;
     }
 
+    // The connection is charged to the user for what it sends from now on
+    p_client_req->p_bucket = shape_user(p_db->p_shaper, p_user);
+
     // The session is brand new, attempt to authenticate and generate session
     if (0 == p_client_req->session_id)
     {
-        res = generate_session_id(p_db->sesh_htable, &p_client_req->session_id);
+        res = sessions_create(p_db->p_sessions, &p_client_req->session_id);
         debug_print("[WORKER - CTRL] Generating new session ID for client: %u\n", p_client_req->session_id);
     }
     else
     {
-        // Check if the session used by client is a valid session ID
-        if (!htable_key_exists(p_db->sesh_htable, &p_client_req->session_id))
-        {
-            debug_print("[WORKER - CTRL] Client session [%u] is no longer active\n", p_client_req->session_id);
-            res = OP_SESSION_ERROR;
-        }
-        else
-        {
-            time_t * session_time = (time_t *)htable_get(p_db->sesh_htable, &p_client_req->session_id);
-            time_t * current_time = get_time();
-            if (NULL == current_time)
-            {
-                res = OP_FAILURE;
-                goto set_resp;
-            }
-
-            // If the elapsed time is greater than the timeout, expire the session
-            if ((*current_time - *session_time) > timeout)
-            {
-                debug_print("[WORKER - CTRL] Session [%u] has expired\n", p_client_req->session_id);
-                res = OP_SESSION_ERROR;
-                free(htable_del(p_db->sesh_htable, &p_client_req->session_id, HT_FREE_PTR_TRUE));
-            }
-            else
-            {
-                // Update the session time for the session ID
-                debug_print("[WORKER - CTRL] Updated [%u] session\n", p_client_req->session_id);
-                *session_time = *current_time;
-            }
-            free(current_time);
-        }
+        // Check if the session used by client is a valid session ID and
+        // update its time, expired sessions are removed
+        res = sessions_renew(p_db->p_sessions, p_client_req->session_id, timeout);
     }
 
     // If the user authentication failed, return the error code for it
@@ -158,7 +169,7 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
                         set_resp(&p_resp, OP_PERMISSION_ERROR);
                         goto ret_resp;
                     }
-                    set_resp(&p_resp, user_action(p_db, p_client_req));
+                    run_file_op(p_db, p_client_req, p_resp);
                     goto ret_resp;
                 }
                 case USR_ACT_DELETE_USER:
@@ -169,7 +180,7 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
                         set_resp(&p_resp, OP_PERMISSION_ERROR);
                         goto ret_resp;
                     }
-                    set_resp(&p_resp, user_action(p_db, p_client_req));
+                    run_file_op(p_db, p_client_req, p_resp);
                     goto ret_resp;
                 }
                 default:
@@ -187,7 +198,7 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
                 set_resp(&p_resp, OP_PERMISSION_ERROR);
                 goto ret_resp;
             }
-            set_resp(&p_resp, do_del_file(p_db, p_client_req));
+            run_file_op(p_db, p_client_req, p_resp);
             goto ret_resp;
         }
         case ACT_MAKE_REMOTE_DIRECTORY:
@@ -197,28 +208,31 @@ act_resp_t * ctrl_parse_action(db_t * p_db,
                 set_resp(&p_resp, OP_PERMISSION_ERROR);
                 goto ret_resp;
             }
-            set_resp(&p_resp, do_make_dir(p_db, p_client_req));
+            run_file_op(p_db, p_client_req, p_resp);
             goto ret_resp;
         }
 
         case ACT_PUT_REMOTE_FILE:
+        case ACT_PUT_BY_HASH:
+        case ACT_PUT_DELTA:
         {
             if (p_user->permission < READ_WRITE)
             {
                 set_resp(&p_resp, OP_PERMISSION_ERROR);
                 goto ret_resp;
             }
-            set_resp(&p_resp, do_put_file(p_db, p_client_req));
+            run_file_op(p_db, p_client_req, p_resp);
             goto ret_resp;
         }
 
         case ACT_LIST_REMOTE_DIRECTORY:
         {
-            do_list_dir(p_db, p_client_req, &p_resp);
+            run_file_op(p_db, p_client_req, p_resp);
             goto ret_resp;
         }
         case ACT_GET_REMOTE_FILE:
-            do_get_file(p_db, p_client_req, &p_resp);
+        case ACT_GET_SIGNATURE:
+            run_file_op(p_db, p_client_req, p_resp);
             goto ret_resp;
         default:
         {
@@ -238,6 +252,69 @@ ret_null:
     return NULL;
 }
 
+/*!
+ * @brief Perform the file system portion of the request on the I/O pool
+ * and wait for it to complete. Runs on the calling thread if the database
+ * has no I/O pool.
+ *
+ * @param p_db Pointer to the user_db object
+ * @param p_req Pointer to the wire_payload object
+ * @param p_resp Pointer to the response object to populate
+ */
+static void run_file_op(db_t * p_db, wire_payload_t * p_req, act_resp_t * p_resp)
+{
+    file_op_t op = {
+        .p_db   = p_db,
+        .p_req  = p_req,
+        .p_resp = p_resp
+    };
+    io_run(p_db->p_io, file_op_job, &op);
+}
+
+/*!
+ * @brief I/O pool job that dispatches the request to the action handler.
+ * Permissions are checked by the caller before the job is queued.
+ *
+ * @param p_arg Pointer to a file_op_t object
+ */
+static void file_op_job(void * p_arg)
+{
+    file_op_t * p_op = (file_op_t *)p_arg;
+    switch (p_op->p_req->opt_code)
+    {
+        case ACT_USER_OPERATION:
+            set_resp(&p_op->p_resp, user_action(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_DELETE_REMOTE_FILE:
+            set_resp(&p_op->p_resp, do_del_file(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_MAKE_REMOTE_DIRECTORY:
+            set_resp(&p_op->p_resp, do_make_dir(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_PUT_REMOTE_FILE:
+            set_resp(&p_op->p_resp, do_put_file(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_PUT_BY_HASH:
+            set_resp(&p_op->p_resp, do_put_hash(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_PUT_DELTA:
+            set_resp(&p_op->p_resp, do_put_delta(p_op->p_db, p_op->p_req));
+            break;
+        case ACT_LIST_REMOTE_DIRECTORY:
+            do_list_dir(p_op->p_db, p_op->p_req, &p_op->p_resp);
+            break;
+        case ACT_GET_REMOTE_FILE:
+            do_get_file(p_op->p_db, p_op->p_req, &p_op->p_resp);
+            break;
+        case ACT_GET_SIGNATURE:
+            do_get_signature(p_op->p_db, p_op->p_req, &p_op->p_resp);
+            break;
+        default:
+            set_resp(&p_op->p_resp, OP_FAILURE);
+            break;
+    }
+}
+
 /*!
  * @brief Function reads the file on disk if found and saves the contents
  * to the response object
@@ -257,8 +334,12 @@ static void do_get_file(db_t * p_db, wire_payload_t * p_ld, act_resp_t ** pp_res
         return;
     }
 
+    // The file is not loaded into memory. It is read once here to compute
+    // the hash that prefixes the data and read again by the response writer
+    // while sending. Files are only ever replaced through a new inode so
+    // both passes over the open descriptor see the same bytes.
     ret_codes_t code = OP_SUCCESS;
-    file_content_t * p_content = f_read_file(p_path, &code);
+    file_content_t * p_content = f_stream_file(p_path, &code);
     f_destroy_path(&p_path);
     if (NULL == p_content)
     {
@@ -266,19 +347,311 @@ static void do_get_file(db_t * p_db, wire_payload_t * p_ld, act_resp_t ** pp_res
         return;
     }
 
+    // Files stored as chunks are read from their chunks
+    code = chunks_stitch(p_db->p_chunks, p_content->p_source, p_content->stream_size);
+    if (OP_SUCCESS != code)
+    {
+        f_destroy_content(&p_content);
+        set_resp(pp_resp, code);
+        return;
+    }
+
+    // Taken before compressing replaces the source with the frames
+    f_file_id_t id = {0};
+    bool b_indexable = f_stream_id(p_content->p_source, &id);
+
     if (0 == p_content->stream_size)
     {
         f_destroy_content(&p_content);
         set_resp(pp_resp, OP_FILE_EMPTY);
+        return;
+    }
+
+    // Unknown algorithms fall back to sha256 and unsupported codecs to
+    // sending the file as is. The response tells the client which ones were
+    // used
+    hash_alg_t alg = (hash_alg_t)(p_ld->flags & HASH_ALG_MASK);
+    if ((HASH_ALG_TREE != alg) && (HASH_ALG_BLAKE3 != alg))
+    {
+        alg = HASH_ALG_SHA256;
+    }
+    codec_t codec = compress_codec(p_ld->flags);
+    if (!compress_supported(codec))
+    {
+        codec = CODEC_NONE;
+    }
+
+    if (HASH_ALG_TREE == alg)
+    {
+        code = hash_tree_file(p_content);
+    }
+    else if ((CODEC_NONE != codec) && (NULL == p_db->p_cache))
+    {
+        // Without a cache the file is hashed and its frames sized in one pass
+        hash_stream_t stream;
+        code = hash_stream_init(&stream, alg) ? OP_SUCCESS : OP_FAILURE;
+        if (OP_SUCCESS == code)
+        {
+            code = compress_file(p_content, codec, &stream);
+            if (!hash_stream_final(&stream, &p_content->hash) && (OP_SUCCESS == code))
+            {
+                code = OP_FAILURE;
+            }
+            p_content->hash_alg = alg;
+        }
     }
     else
     {
-        debug_print("[WORKER - CTRL] Read %ld from %s\n", p_content->stream_size, p_content->p_path);
-        set_resp(pp_resp, OP_SUCCESS);
-        (*pp_resp)->p_content = p_content;
+        code = hash_stream_file(p_content, alg);
     }
 
-    return;
+    // Files that were downloaded can be uploaded again by hash
+    if ((OP_SUCCESS == code) && (b_indexable))
+    {
+        dedup_add(p_db->p_dedup, alg, &p_content->hash, p_std->p_path, &id);
+    }
+
+    // Tree leaves are hashed in parallel and cache lookups need the digest,
+    // so in both cases the file is compressed after it has been hashed
+    if ((OP_SUCCESS == code) && (CODEC_NONE != codec) && (CODEC_NONE == p_content->codec))
+    {
+        code = compress_content(p_db, p_content, codec);
+    }
+    if (OP_SUCCESS != code)
+    {
+        f_destroy_content(&p_content);
+        set_resp(pp_resp, (OP_SUCCESS != code) ? code : OP_FAILURE);
+        return;
+    }
+
+    debug_print("[WORKER - CTRL] Hashed %ld from %s\n", p_content->stream_size, p_content->p_path);
+    set_resp(pp_resp, OP_SUCCESS);
+    (*pp_resp)->p_content = p_content;
+}
+
+/*!
+ * @brief Compute the hash of the streamed file with the read ahead
+ * pipeline and save it to the content
+ *
+ * @param p_content Pointer to the streamed file content
+ * @param alg Streaming algorithm to hash with
+ * @return OP_SUCCESS if the hash was computed otherwise the error code
+ */
+static ret_codes_t hash_stream_file(file_content_t * p_content, hash_alg_t alg)
+{
+    hash_stream_t stream;
+    if (!hash_stream_init(&stream, alg))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t code = xfer_pipeline(p_content->p_source, p_content->stream_size,
+                                     xfer_hash_sink, &stream);
+    if (!hash_stream_final(&stream, &p_content->hash) && (OP_SUCCESS == code))
+    {
+        code = OP_FAILURE;
+    }
+    p_content->hash_alg = alg;
+    return code;
+}
+
+/*!
+ * @brief Replace the hashed file with its compressed representation. A
+ * cached representation is sent as is. On a miss the cache is filled in the
+ * background and the file is only compressed for this request if it fits
+ * in a single frame, larger files are sent uncompressed rather than holding
+ * the response until the whole file is compressed. Without a cache the file
+ * is always compressed for the request.
+ *
+ * @param p_db Pointer to the user_db object
+ * @param p_content Pointer to the streamed file content with its hash set
+ * @param codec Codec to compress with
+ * @return OP_SUCCESS if the content can be sent otherwise the error code
+ */
+static ret_codes_t compress_content(db_t * p_db,
+                                    file_content_t * p_content,
+                                    codec_t codec)
+{
+    if (NULL == p_db->p_cache)
+    {
+        return compress_file(p_content, codec, NULL);
+    }
+
+    cache_key_t key = {
+        .hash   = p_content->hash,
+        .alg    = p_content->hash_alg,
+        .codec  = codec
+    };
+    size_t cached_len = 0;
+    f_stream_t * p_cached = cache_open(p_db->p_cache, &key, &cached_len);
+    if (NULL != p_cached)
+    {
+        debug_print("[WORKER - CTRL] Sending %ld cached bytes for %s\n",
+                    cached_len, p_content->p_path);
+        f_stream_close(&p_content->p_source);
+        p_content->p_source    = p_cached;
+        p_content->stream_size = cached_len;
+        p_content->codec       = codec;
+        return OP_SUCCESS;
+    }
+
+    // The copy reads the inode that was hashed even if the path is replaced
+    // before the fill runs, so the entry always matches its digest
+    f_stream_t * p_copy = f_stream_dup(p_content->p_source);
+    cache_fill(p_db->p_cache, &key, &p_copy, p_content->stream_size);
+
+    if (p_content->stream_size <= XFER_CHUNK_SIZE)
+    {
+        return compress_file(p_content, codec, NULL);
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Size the frames of the streamed file so the response can announce
+ * their length. Nothing is stored, the frames are compressed again one at a
+ * time while the response is sent so the first byte leaves without waiting
+ * for the whole file to be compressed.
+ *
+ * @param p_content Pointer to the streamed file content
+ * @param codec Codec to compress with
+ * @param p_hash Running hash updated with the uncompressed bytes or NULL
+ * @return OP_SUCCESS if the file was compressed otherwise the error code
+ */
+static ret_codes_t compress_file(file_content_t * p_content,
+                                 codec_t codec,
+                                 hash_stream_t * p_hash)
+{
+    size_t frames_len = 0;
+    ret_codes_t code = xfer_frames(p_content->p_source, p_content->stream_size,
+                                   codec, p_hash, NULL, NULL, &frames_len);
+    if (OP_SUCCESS != code)
+    {
+        return code;
+    }
+
+    debug_print("[WORKER - CTRL] Compressing %ld to %ld from %s\n",
+                p_content->stream_size, frames_len, p_content->p_path);
+    p_content->raw_size    = p_content->stream_size;
+    p_content->stream_size = frames_len;
+    p_content->codec       = codec;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Compute the tree root of the streamed file with the leaves hashed
+ * in parallel and save it to the content
+ *
+ * @param p_content Pointer to the streamed file content
+ * @return OP_SUCCESS if the hash was computed otherwise the error code
+ */
+static ret_codes_t hash_tree_file(file_content_t * p_content)
+{
+    hash_tree_t * p_tree = hash_tree_init(p_content->stream_size);
+    if (NULL == p_tree)
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t code = xfer_tree_hash(p_content->p_source, p_tree, 0);
+    if ((OP_SUCCESS == code) && (!hash_tree_root(p_tree, &p_content->hash)))
+    {
+        code = OP_FAILURE;
+    }
+    p_content->hash_alg = HASH_ALG_TREE;
+    hash_tree_destroy(&p_tree);
+    return code;
+}
+
+/*!
+ * @brief Compute the signature of the file so the client can send a delta
+ * of it. The signature is sent in place of the file data, hashed with the
+ * algorithm of the request.
+ *
+ * @param p_user_db Pointer to the user_db object
+ * @param p_ld Pointer to the wire_payload object
+ * @param pp_resp Double pointer to the response object. The status code,
+ * status message and the signature will be saved to this object
+ */
+static void do_get_signature(db_t * p_db, wire_payload_t * p_ld, act_resp_t ** pp_resp)
+{
+    std_payload_t * p_std = p_ld->p_std_payload;
+    verified_path_t * p_path = f_ver_path_resolve(p_db->p_home_dir, p_std->p_path);
+    if (NULL == p_path)
+    {
+        set_resp(pp_resp, OP_RESOLVE_ERROR);
+        return;
+    }
+
+    ret_codes_t code = OP_SUCCESS;
+    size_t base_size = 0;
+    f_stream_t * p_base = f_stream_open(p_path, &base_size, &code);
+    f_destroy_path(&p_path);
+    if (NULL != p_base)
+    {
+        code = chunks_stitch(p_db->p_chunks, p_base, base_size);
+    }
+    if (OP_SUCCESS != code)
+    {
+        f_stream_close(&p_base);
+        set_resp(pp_resp, code);
+        return;
+    }
+
+    hash_alg_t alg = (hash_alg_t)(p_ld->flags & HASH_ALG_MASK);
+    if ((HASH_ALG_TREE != alg) && (HASH_ALG_BLAKE3 != alg))
+    {
+        alg = HASH_ALG_SHA256;
+    }
+
+    // The signature is held until the response is sent, so it is reserved
+    // against the memory budget until the request is released
+    if ((NULL != p_ld->p_arena)
+        && (!arena_reserve(p_ld->p_arena, p_db->p_mem, delta_signature_len(base_size),
+                           MEM_WAIT_MS)))
+    {
+        f_stream_close(&p_base);
+        set_resp(pp_resp, OP_SERVER_BUSY);
+        return;
+    }
+
+    uint8_t * p_sig = NULL;
+    size_t sig_len = 0;
+    code = delta_signature(p_base, base_size, alg, &p_sig, &sig_len);
+    f_stream_close(&p_base);
+    if (OP_SUCCESS != code)
+    {
+        set_resp(pp_resp, code);
+        return;
+    }
+
+    file_content_t * p_content = (file_content_t *)calloc(1, sizeof(file_content_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_content))
+    {
+        free(p_sig);
+        set_resp(pp_resp, OP_FAILURE);
+        return;
+    }
+    *p_content = (file_content_t){
+        .hash_alg       = alg,
+        .codec          = CODEC_NONE,
+        .p_stream       = p_sig,
+        .stream_size    = sig_len,
+        .p_path         = strdup(p_std->p_path),
+        .p_source       = NULL
+    };
+    if ((NULL == p_content->p_path)
+        || (!hash_alg_bytes(alg, p_sig, sig_len, &p_content->hash)))
+    {
+        f_destroy_content(&p_content);
+        set_resp(pp_resp, OP_FAILURE);
+        return;
+    }
+
+    debug_print("[WORKER - CTRL] Signature of %ld for %ld from %s\n",
+                sig_len, base_size, p_std->p_path);
+    set_resp(pp_resp, OP_SUCCESS);
+    (*pp_resp)->p_content = p_content;
 }
 
 /*!
@@ -319,6 +692,32 @@ static void do_list_dir(db_t * p_db,
     {
         debug_print("[WORKER - CTRL] Read dir listing of %ld from %s\n",
                     p_content->stream_size, p_content->p_path);
+
+        // The listing is only sent compressed when that makes it smaller and
+        // the memory budget has room for the frames
+        codec_t codec = compress_codec(p_ld->flags);
+        uint8_t * p_frames = NULL;
+        size_t frames_len = 0;
+        if ((compress_supported(codec))
+            && ((NULL == p_ld->p_arena)
+                || (arena_reserve(p_ld->p_arena, p_db->p_mem,
+                                  compress_bound(p_content->stream_size), 0)))
+            && (OP_SUCCESS == compress_buffer(codec, p_content->p_stream,
+                                              p_content->stream_size,
+                                              &p_frames, &frames_len)))
+        {
+            if (frames_len < p_content->stream_size)
+            {
+                free(p_content->p_stream);
+                p_content->p_stream    = p_frames;
+                p_content->stream_size = frames_len;
+                p_content->codec       = codec;
+            }
+            else
+            {
+                free(p_frames);
+            }
+        }
         set_resp(pp_resp, OP_SUCCESS);
         (*pp_resp)->p_content = p_content;
     }
@@ -348,15 +747,336 @@ static ret_codes_t do_put_file(db_t * p_db, wire_payload_t * p_ld)
     {
         return OP_RESOLVE_ERROR;
     }
-    ret_codes_t ret = f_write_file(p_path,
-                                   p_std->p_byte_stream,
-                                   p_std->byte_stream_len);
 
-    debug_print("[WORKER - CTRL] Wrote %ld to %s\n", p_std->byte_stream_len, p_std->p_path);
+    ret_codes_t ret = decompress_put(p_db, p_ld);
+    if (OP_SUCCESS == ret)
+    {
+        ret = verify_put_hash(p_ld);
+    }
+    if (OP_SUCCESS != ret)
+    {
+        f_destroy_path(&p_path);
+        return ret;
+    }
+
+    // The check above is only a fast path. Creating the file fails with
+    // OP_FILE_EXISTS if another client created the file in the meantime
+    f_file_id_t id = {0};
+    ret = chunks_create_file(p_db->p_chunks,
+                             p_path,
+                             p_std->p_byte_stream,
+                             p_std->byte_stream_len,
+                             p_db->p_sync,
+                             &id);
+    if (OP_SUCCESS == ret)
+    {
+        debug_print("[WORKER - CTRL] Wrote %ld to %s\n",
+                    p_std->byte_stream_len, p_std->p_path);
+
+        // Only verified hashes are indexed
+        if (NULL != p_std->p_hash_stream)
+        {
+            hash_t hash;
+            memcpy(hash.array, p_std->p_hash_stream, H_HASH_LEN);
+            dedup_add(p_db->p_dedup, (hash_alg_t)(p_ld->flags & HASH_ALG_MASK),
+                      &hash, p_std->p_path, &id);
+        }
+    }
+
+    f_destroy_path(&p_path);
+    return ret;
+
+}
+
+/*!
+ * @brief Create the file from data the server already holds under the hash
+ * sent by the client instead of receiving the data again. The client sends
+ * the data with a regular PUT when the hash is unknown.
+ *
+ * @param p_user_db Pointer to the user_db object
+ * @param p_ld Pointer to the wire_payload object
+ * @retval OP_SUCCESS The file was linked to the data with the hash
+ * @retval OP_HASH_UNKNOWN No data with the hash is held
+ * @return Any other error of the PUT
+ */
+static ret_codes_t do_put_hash(db_t * p_db, wire_payload_t * p_ld)
+{
+    std_payload_t * p_std = p_ld->p_std_payload;
+    if ((NULL == p_std->p_hash_stream) || (0 != p_std->byte_stream_len))
+    {
+        return OP_FAILURE;
+    }
+
+    verified_path_t * p_path = f_ver_path_resolve(p_db->p_home_dir, p_std->p_path);
+    if (NULL != p_path)
+    {
+        f_destroy_path(&p_path);
+        return OP_FILE_EXISTS;
+    }
+    p_path = f_ver_valid_resolve(p_db->p_home_dir, p_std->p_path);
+    if (NULL == p_path)
+    {
+        return OP_RESOLVE_ERROR;
+    }
+
+    hash_t hash;
+    memcpy(hash.array, p_std->p_hash_stream, H_HASH_LEN);
+    ret_codes_t ret = dedup_link(p_db->p_dedup,
+                                 p_db->p_home_dir,
+                                 (hash_alg_t)(p_ld->flags & HASH_ALG_MASK),
+                                 &hash,
+                                 p_path,
+                                 p_db->p_sync);
+
+    // A copy of a file stored as chunks needs the chunks to still be held.
+    // If they were released in the meantime the data has to be sent
+    if ((OP_SUCCESS == ret) && (OP_SUCCESS != chunks_adopt(p_db->p_chunks, p_path)))
+    {
+        chunks_del_file(p_db->p_chunks, p_path);
+        ret = OP_HASH_UNKNOWN;
+    }
+    if (OP_SUCCESS == ret)
+    {
+        debug_print("[WORKER - CTRL] Linked %s by hash\n", p_std->p_path);
+    }
 
     f_destroy_path(&p_path);
     return ret;
+}
+
+/*!
+ * @brief Replace an existing file with the file rebuilt from the delta sent
+ * by the client. The file is rebuilt into a temp file next to it and only
+ * moved over the original once its hash matches the hash sent by the
+ * client, so a delta against a file that changed since its signature was
+ * taken is rejected. Concurrent updates of the same file are last writer
+ * wins.
+ *
+ * @param p_user_db Pointer to the user_db object
+ * @param p_ld Pointer to the wire_payload object
+ * @retval OP_SUCCESS The file was replaced
+ * @retval OP_HASH_MISMATCH The rebuilt file does not match the hash
+ * @return Any other error of the PUT
+ */
+static ret_codes_t do_put_delta(db_t * p_db, wire_payload_t * p_ld)
+{
+    std_payload_t * p_std = p_ld->p_std_payload;
+    if ((NULL == p_std->p_hash_stream) || (NULL == p_std->p_byte_stream))
+    {
+        return OP_FAILURE;
+    }
+
+    verified_path_t * p_path = f_ver_path_resolve(p_db->p_home_dir, p_std->p_path);
+    if (NULL == p_path)
+    {
+        return OP_RESOLVE_ERROR;
+    }
+
+    f_stream_t * p_base = NULL;
+    f_stream_t * p_out = NULL;
+    ret_codes_t ret = decompress_put(p_db, p_ld);
+    if (OP_SUCCESS != ret)
+    {
+        goto cleanup;
+    }
+
+    size_t base_size = 0;
+    p_base = f_stream_open(p_path, &base_size, &ret);
+    if (NULL == p_base)
+    {
+        goto cleanup;
+    }
+    ret = chunks_stitch(p_db->p_chunks, p_base, base_size);
+    if (OP_SUCCESS != ret)
+    {
+        goto cleanup;
+    }
+    p_out = f_stream_temp_for(p_path, &ret);
+    if (NULL == p_out)
+    {
+        goto cleanup;
+    }
+
+    // Streaming algorithms hash the file as it is rebuilt. Tree roots are
+    // computed from the rebuilt file afterwards
+    hash_alg_t alg = (hash_alg_t)(p_ld->flags & HASH_ALG_MASK);
+    hash_stream_t stream;
+    bool b_streamed = (HASH_ALG_TREE != alg);
+    if ((b_streamed) && (!hash_stream_init(&stream, alg)))
+    {
+        ret = OP_FAILURE;
+        goto cleanup;
+    }
+
+    size_t out_len = 0;
+    ret = delta_apply(p_base, base_size, p_std->p_byte_stream, p_std->byte_stream_len,
+                      p_out, (b_streamed) ? &stream : NULL, &out_len);
+    hash_t hash;
+    if (b_streamed)
+    {
+        if (!hash_stream_final(&stream, &hash) && (OP_SUCCESS == ret))
+        {
+            ret = OP_FAILURE;
+        }
+    }
+    else if (OP_SUCCESS == ret)
+    {
+        ret = hash_delta_output(p_out, out_len, &hash);
+    }
+    if (OP_SUCCESS != ret)
+    {
+        goto cleanup;
+    }
+    if (!hash_bytes_match(&hash, p_std->p_hash_stream, H_HASH_LEN))
+    {
+        ret = OP_HASH_MISMATCH;
+        goto cleanup;
+    }
+
+    f_file_id_t id = {0};
+    ret = chunks_replace_file(p_db->p_chunks, p_out, out_len, p_path, p_db->p_sync, &id);
+    if (OP_SUCCESS == ret)
+    {
+        debug_print("[WORKER - CTRL] Rebuilt %ld of %s from a delta of %ld\n",
+                    out_len, p_std->p_path, p_std->byte_stream_len);
+        dedup_add(p_db->p_dedup, alg, &hash, p_std->p_path, &id);
+    }
+
+cleanup:
+    f_stream_close(&p_out);
+    f_stream_close(&p_base);
+    f_destroy_path(&p_path);
+    return ret;
+}
+
+/*!
+ * @brief Compute the tree root of the file rebuilt from a delta
+ *
+ * @param p_out Pointer to the f_stream_t of the rebuilt file
+ * @param out_len Number of bytes of the rebuilt file
+ * @param p_hash Pointer receiving the root
+ * @return OP_SUCCESS if the hash was computed otherwise the error code
+ */
+static ret_codes_t hash_delta_output(f_stream_t * p_out, size_t out_len, hash_t * p_hash)
+{
+    hash_tree_t * p_tree = hash_tree_init(out_len);
+    if (NULL == p_tree)
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t code = xfer_tree_hash(p_out, p_tree, 0);
+    if ((OP_SUCCESS == code) && (!hash_tree_root(p_tree, p_hash)))
+    {
+        code = OP_FAILURE;
+    }
+    hash_tree_destroy(&p_tree);
+    return code;
+}
+
+/*!
+ * @brief Replace the compressed byte stream of a PUT with the data it
+ * decompresses to. The hash sent by the client is over the decompressed
+ * data. Requests without a codec are left untouched.
+ *
+ * @param p_db Pointer to the database object
+ * @param p_ld Pointer to the wire_payload object
+ * @retval OP_SUCCESS The byte stream holds the uncompressed data
+ * @retval OP_CODEC_ERROR The codec is not supported or the data is corrupt
+ * @retval OP_SERVER_BUSY The memory budget has no room for the data
+ * @retval OP_FAILURE Memory ran out
+ */
+static ret_codes_t decompress_put(db_t * p_db, wire_payload_t * p_ld)
+{
+    codec_t codec = compress_codec(p_ld->flags);
+    if (CODEC_NONE == codec)
+    {
+        return OP_SUCCESS;
+    }
+
+    std_payload_t * p_std = p_ld->p_std_payload;
+    uint8_t * p_data = NULL;
+    size_t data_len = 0;
+    ret_codes_t ret = OP_SUCCESS;
+    if (NULL == p_ld->p_arena)
+    {
+        ret = decompress_buffer(codec, p_std->p_byte_stream, p_std->byte_stream_len,
+                                &p_data, &data_len);
+    }
+    else
+    {
+        ret = decompress_size(codec, p_std->p_byte_stream, p_std->byte_stream_len,
+                              &data_len);
+    }
+    if (OP_SUCCESS != ret)
+    {
+        debug_print_err("[WORKER - CTRL] Unable to decompress %s with codec %u\n",
+                        p_std->p_path, (unsigned int)codec);
+        return ret;
+    }
 
+    // The data is allocated from the arena and released with it, which
+    // charges it to the memory budget. Data the budget has no room for goes
+    // to a temp file, and without a home directory the client tries later
+    if (NULL == p_ld->p_arena)
+    {
+        free(p_std->p_byte_stream);
+    }
+    else if (data_len > 0)
+    {
+        p_data = (uint8_t *)arena_alloc(p_ld->p_arena, data_len);
+        if ((NULL == p_data) && (NULL != p_db->p_mem))
+        {
+            p_data = (uint8_t *)arena_map(p_ld->p_arena, p_db->p_home_dir, data_len);
+        }
+        if (NULL == p_data)
+        {
+            p_ld->retry_ms = ADMIT_RETRY_MS;
+            return OP_SERVER_BUSY;
+        }
+        ret = decompress_into(codec, p_std->p_byte_stream, p_std->byte_stream_len, p_data);
+        if (OP_SUCCESS != ret)
+        {
+            return ret;
+        }
+    }
+    p_std->p_byte_stream   = p_data;
+    p_std->byte_stream_len = data_len;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Verify the data of a PUT against the hash sent by the client using
+ * the algorithm selected in the request flags. Requests without a hash are
+ * not verified.
+ *
+ * @param p_ld Pointer to the wire_payload object
+ * @retval OP_SUCCESS The hashes match or no hash was provided
+ * @retval OP_HASH_MISMATCH The data does not match the hash
+ * @retval OP_FAILURE The algorithm is unknown or hashing failed
+ */
+static ret_codes_t verify_put_hash(wire_payload_t * p_ld)
+{
+    std_payload_t * p_std = p_ld->p_std_payload;
+    if (NULL == p_std->p_hash_stream)
+    {
+        return OP_SUCCESS;
+    }
+
+    // Empty files carry a hash but no byte stream
+    uint8_t empty = 0;
+    uint8_t * p_bytes = (NULL == p_std->p_byte_stream) ? &empty : p_std->p_byte_stream;
+
+    hash_alg_t alg = (hash_alg_t)(p_ld->flags & HASH_ALG_MASK);
+    hash_t hash;
+    if (!hash_alg_bytes(alg, p_bytes, p_std->byte_stream_len, &hash))
+    {
+        debug_print_err("[WORKER - CTRL] Unable to hash with algorithm %u\n", (unsigned int)alg);
+        return OP_FAILURE;
+    }
+
+    return hash_bytes_match(&hash, p_std->p_hash_stream, H_HASH_LEN)
+           ? OP_SUCCESS : OP_HASH_MISMATCH;
 }
 
 /*!
@@ -400,7 +1120,7 @@ static ret_codes_t do_del_file(db_t * p_db, wire_payload_t * p_ld)
     {
         return OP_RESOLVE_ERROR;
     }
-    ret_codes_t ret = f_del_file(p_path);
+    ret_codes_t ret = chunks_del_file(p_db->p_chunks, p_path);
     if (OP_SUCCESS == ret)
     {
         char repr[PATH_MAX] = {0};
@@ -443,16 +1163,33 @@ static ret_codes_t user_action(db_t * p_db, wire_payload_t * p_ld)
 }
 
 /*!
- * @brief Destroy the payload and response objects
+ * @brief Destroy the payload and response objects. Members allocated from
+ * the arena of the payload are left to the arena, only the content of the
+ * response is destroyed.
  *
  * @param pp_payload Double pointer to the payload object
  * @param pp_res Double pointer to the response object
+ * @param free_wire_payload Free the payload object itself
  */
 void ctrl_destroy(wire_payload_t ** pp_payload,
                   act_resp_t ** pp_res,
                   bool free_wire_payload)
 {
-    if (NULL != pp_res)
+    arena_t * p_arena = NULL;
+    if ((NULL != pp_payload) && (NULL != *pp_payload))
+    {
+        p_arena = (*pp_payload)->p_arena;
+    }
+
+    if ((NULL != pp_res) && (NULL != p_arena))
+    {
+        if (NULL != *pp_res)
+        {
+            f_destroy_content(&(*pp_res)->p_content);
+        }
+        *pp_res = NULL;
+    }
+    else if (NULL != pp_res)
     {
         destroy_resp(pp_res);
     }
@@ -464,22 +1201,27 @@ void ctrl_destroy(wire_payload_t ** pp_payload,
 
     // Destroy the wire_payload_t
     wire_payload_t * p_payload = *pp_payload;
+    if (NULL != p_arena)
+    {
+        *p_payload = (wire_payload_t){
+            .type       = NO_PAYLOAD,
+            .p_arena    = NULL
+        };
+        *pp_payload = NULL;
+        return;
+    }
 
     // Destroy the union struct
     if (STD_PAYLOAD == p_payload->type)
     {
         std_payload_t * p_ld = p_payload->p_std_payload;
-        if (NULL != p_ld->p_path)
-        {
-            free(p_ld->p_path);
-        }
-        if (NULL != p_ld->p_byte_stream)
-        {
-            free(p_ld->p_byte_stream);
-        }
+        free(p_ld->p_path);
+        free(p_ld->p_byte_stream);
+        free(p_ld->p_hash_stream);
         *p_ld = (std_payload_t){
             .byte_stream_len = 0,
             .p_byte_stream   = NULL,
+            .p_hash_stream   = NULL,
             .p_path          = NULL,
             .path_len        = 0,
         };
@@ -579,6 +1321,14 @@ static const char * get_err_msg(ret_codes_t res)
             return OP_15;
         case OP_DIR_EMPTY:
             return OP_16;
+        case OP_HASH_MISMATCH:
+            return OP_17;
+        case OP_CODEC_ERROR:
+            return OP_18;
+        case OP_HASH_UNKNOWN:
+            return OP_19;
+        case OP_SERVER_BUSY:
+            return OP_20;
         case OP_IO_ERROR:
             return OP_254;
         default:
@@ -586,9 +1336,17 @@ static const char * get_err_msg(ret_codes_t res)
     }
 }
 
-static act_resp_t * get_resp(void)
+static act_resp_t * get_resp(arena_t * p_arena)
 {
-    act_resp_t * p_resp = (act_resp_t *)malloc(sizeof(act_resp_t));
+    act_resp_t * p_resp = NULL;
+    if (NULL == p_arena)
+    {
+        p_resp = (act_resp_t *)malloc(sizeof(act_resp_t));
+    }
+    else
+    {
+        p_resp = (act_resp_t *)arena_alloc(p_arena, sizeof(act_resp_t));
+    }
     if (UV_INVALID_ALLOC == verify_alloc(p_resp))
     {
         return NULL;
@@ -600,44 +1358,3 @@ static act_resp_t * get_resp(void)
     };
     return p_resp;
 }
-
-static uint32_t gen_session(void)
-{
-    uint32_t sesh = rand() & 0xff;
-    sesh |= ((uint32_t)(rand() & 0xff) << 8);
-    sesh |= ((uint32_t)(rand() & 0xff) << 16);
-    sesh |= ((uint32_t)(rand() & 0xff) << 24);
-    return sesh;
-}
-
-static time_t * get_time(void)
-{
-    time_t * p_time = (time_t *)calloc(1, sizeof(time_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_time))
-    {
-        return NULL;
-    }
-    time(p_time);
-    return p_time;
-
-}
-
-static ret_codes_t generate_session_id(htable_t * htable, uint32_t * p_session)
-{
-    uint32_t sesh = gen_session();
-    while(htable_key_exists(htable, &sesh))
-    {
-        sesh = gen_session();
-    }
-
-    uint32_t * p_key = (uint32_t *)malloc(sizeof(uint32_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_key))
-    {
-        return OP_FAILURE;
-    }
-    *p_key = sesh;
-    htable_set(htable, p_key, get_time());
-
-    *p_session = *p_key;
-    return OP_SUCCESS;
-}
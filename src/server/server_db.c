@@ -1,4 +1,5 @@
 #include <server_db.h>
+#include <inttypes.h>
 
 // Macro is used to make dynamic string literal limits for the
 // scanf widths
@@ -15,8 +16,10 @@ static const char * DB_FMT          = "%s:%hhd:%s\n";
 static const uint32_t MAGIC_BYTES   = 0xFFAAFABA;
 
 static verified_path_t * init_db_dir(verified_path_t * p_home_dir);
-static verified_path_t * init_db_file(verified_path_t * p_home_dir);
-static verified_path_t * update_db_hash(verified_path_t * p_home_dir, verified_path_t * p_db_file);
+static verified_path_t * init_db_file(verified_path_t * p_home_dir, sync_t * p_sync);
+static verified_path_t * update_db_hash(verified_path_t * p_home_dir,
+                                        verified_path_t * p_db_file,
+                                        sync_t * p_sync);
 static bool verify_magic(file_content_t * p_content);
 static bool get_stored_hash(file_content_t * p_content);
 static bool get_stored_data(file_content_t * p_content);
@@ -31,10 +34,6 @@ void db_free_value_callback(void * payload);
 static uint64_t db_hash_callback(void * key);
 static htable_match_t db_compare_callback(void * left_key, void * right_key);
 
-static htable_match_t sesh_compare_callback(void * left_key, void * right_key);
-static uint64_t sesh_hash_callback(void * key);
-void sesh_free_callback(void * payload);
-
 
 /*!
  * @brief This beefy function aggregates several internal API calls into one
@@ -43,10 +42,22 @@ void sesh_free_callback(void * payload);
  * the registered users along with their password hash and user permissions.
  *
  * @param p_home_dir Path to the home directory of the server
+ * @param durability Durability mode used for every file written through
+ * the database object
  * @return Hashtable object if successful or NULL if failure
  */
-db_t * db_init(verified_path_t * p_home_dir)
+db_t * db_init(verified_path_t * p_home_dir, sync_mode_t durability)
 {
+    // Create the sync object first since the default database files may
+    // have to be written
+    char home_dir_repr[PATH_MAX] = {0};
+    f_path_repr(p_home_dir, home_dir_repr, PATH_MAX);
+    sync_t * p_sync = sync_init(durability, home_dir_repr);
+    if (NULL == p_sync)
+    {
+        goto ret_null;
+    }
+
     // Check if the ${HOME_DIR}/.cape directory exists; If not, create it
     verified_path_t * p_db_dir = f_ver_path_resolve(p_home_dir, DB_DIR);
     if (NULL == p_db_dir)
@@ -74,12 +85,12 @@ db_t * db_init(verified_path_t * p_home_dir)
         debug_print("%s\n", "[!] The database files do not exist, attempting to "
                     "create the defaults");
         // Attempt to init the db_file
-        p_db_file = init_db_file(p_home_dir);
+        p_db_file = init_db_file(p_home_dir, p_sync);
         if (NULL == p_db_file)
         {
             goto ret_null;
         }
-        p_hash_file = update_db_hash(p_home_dir, p_db_file);
+        p_hash_file = update_db_hash(p_home_dir, p_db_file, p_sync);
         if (NULL == p_hash_file)
         {
             goto cleanup_db;
@@ -127,7 +138,7 @@ db_t * db_init(verified_path_t * p_home_dir)
 
     // Check that the hash of the .cape.db matches the hash stored in .cape.hash
     // if it does not then return failure
-    if (!hash_bytes_match(p_db_contents->p_hash,
+    if (!hash_bytes_match(&p_db_contents->hash,
                          p_hash_contents->p_stream,
                          p_hash_contents->stream_size))
     {
@@ -165,24 +176,19 @@ db_t * db_init(verified_path_t * p_home_dir)
     }
     f_destroy_content(&p_db_contents);
 
-    // Create the hashtable object that is going to store the users
-    htable_t * sesh_htable = htable_create(
-        sesh_hash_callback,
-        sesh_compare_callback,
-        sesh_free_callback,
-        sesh_free_callback);
-
-    if (NULL == sesh_htable)
+    // Sessions are sharded by CPU so the workers of each core mostly use
+    // their own shard
+    sessions_t * p_sessions = sessions_init(0);
+    if (NULL == p_sessions)
     {
-        fprintf(stderr, "[!] Failed to create the hashtable"
-                        "for session db\n");
-        goto cleanup_sesh;
+        fprintf(stderr, "[!] Failed to create the session table\n");
+        goto cleanup_htable;
     }
 
     db_t * p_db = (db_t *)malloc(sizeof(db_t));
     if (UV_INVALID_ALLOC == verify_alloc(p_db))
     {
-        goto cleanup_htable;
+        goto cleanup_sesh;
     }
 
 
@@ -190,12 +196,21 @@ db_t * db_init(verified_path_t * p_home_dir)
     *p_db = (db_t){
         .p_home_dir     = p_home_dir,
         .users_htable    = htable,
-        .sesh_htable    = sesh_htable,
+        .p_sessions     = p_sessions,
+        .p_sync         = p_sync,
+        .p_io           = NULL,
+        .p_cache        = NULL,
+        .p_dedup        = NULL,
+        .p_chunks       = NULL,
+        .p_shaper       = NULL,
+        .p_admit        = NULL,
+        .p_mem          = NULL,
+        .p_spill        = NULL,
     };
     return p_db;
 
 cleanup_sesh:
-    htable_destroy(sesh_htable, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+    sessions_destroy(&p_sessions);
 cleanup_htable:
     htable_destroy(htable, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
 cleanup_hash_content:
@@ -207,6 +222,7 @@ cleanup_hash:
 cleanup_db:
     f_destroy_path(&p_db_file);
 ret_null:
+    sync_destroy(&p_sync);
     return NULL;
 }
 
@@ -233,10 +249,8 @@ ret_codes_t db_remove_user(db_t * p_db, const char * username)
     }
 
     free(p_user->p_username);
-    hash_destroy(&p_user->p_hash);
     *p_user = (user_account_t){
         .p_username = NULL,
-        .p_hash     = NULL,
         .permission = 0
     };
     free(p_user);
@@ -297,32 +311,31 @@ ret_codes_t db_create_user(db_t * p_db,
         goto ret_null;
     }
 
-    // Hash the users password
-    hash_t * p_hash = hash_byte_array((uint8_t *)passwd, strlen(passwd));
-    if (NULL == p_hash)
-    {
-        goto cleanup_username;
-    }
-
     user_account_t * p_acct = (user_account_t *)malloc(sizeof(user_account_t));
     if (UV_INVALID_ALLOC == verify_alloc(p_acct))
     {
-        goto cleanup_hash;
+        goto cleanup_username;
     }
     *p_acct = (user_account_t){
         .p_username = p_username,
         .permission = permission,
-        .p_hash     = p_hash
+        .rate       = 0
     };
 
+    // Hash the users password
+    if (!hash_byte_array((const uint8_t *)passwd, strlen(passwd), &p_acct->hash))
+    {
+        goto cleanup_acct;
+    }
+
     // Add the account to the database
     htable_set(p_db->users_htable, p_username, p_acct);
     debug_print("[+] Added new user %s\n", p_username);
     db_update_db(p_db);
     return OP_SUCCESS;
 
-cleanup_hash:
-    hash_destroy(&p_hash);
+cleanup_acct:
+    free(p_acct);
 cleanup_username:
     free(p_username);
     p_username = NULL;
@@ -334,6 +347,34 @@ cred_failure:
     return OP_CRED_RULE_ERROR;
 }
 
+/*!
+ * @brief Set the rate the user may transfer at. The rate is saved with the
+ * account
+ *
+ * @param p_db Pointer to the hashtable user database object
+ * @param username Pointer to the p_username
+ * @param rate Bytes per second, 0 for the limit of the permission of the user
+ * @retval OP_SUCCESS If the rate was set
+ * @retval OP_USER_NO_EXIST If the user does not exist
+ * @retval OP_FAILURE On server error
+ */
+ret_codes_t db_set_user_rate(db_t * p_db, const char * username, uint64_t rate)
+{
+    if ((NULL == p_db) || (NULL == username))
+    {
+        return OP_FAILURE;
+    }
+
+    user_account_t * p_user = (user_account_t *)htable_get(p_db->users_htable, (void *)username);
+    if (NULL == p_user)
+    {
+        return OP_USER_NO_EXIST;
+    }
+    p_user->rate = rate;
+    db_update_db(p_db);
+    return OP_SUCCESS;
+}
+
 void destroy_resp(act_resp_t ** pp_resp)
 {
     if ((NULL == pp_resp) || (NULL == *pp_resp))
@@ -375,12 +416,22 @@ void db_shutdown(db_t ** pp_db)
 
     // Destroy the db object
     htable_destroy(p_db->users_htable, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
-    htable_destroy(p_db->sesh_htable, HT_FREE_PTR_TRUE, HT_FREE_PTR_TRUE);
+    sessions_destroy(&p_db->p_sessions);
     f_destroy_path(&p_db->p_home_dir);
+    sync_destroy(&p_db->p_sync);
     *p_db = (db_t){
         .users_htable   = NULL,
         .p_home_dir     = NULL,
-        .sesh_htable    = NULL,
+        .p_sessions     = NULL,
+        .p_sync         = NULL,
+        .p_io           = NULL,
+        .p_cache        = NULL,
+        .p_dedup        = NULL,
+        .p_chunks       = NULL,
+        .p_shaper       = NULL,
+        .p_admit        = NULL,
+        .p_mem          = NULL,
+        .p_spill        = NULL,
     };
 
     free(p_db);
@@ -423,16 +474,14 @@ ret_codes_t db_authenticate_user(db_t * p_db,
         return OP_USER_AUTH;
     }
 
-    hash_t * p_pw_hash = hash_byte_array((uint8_t *)passwd, strlen(passwd));
-    if (NULL == p_pw_hash)
+    hash_t pw_hash;
+    if (!hash_byte_array((const uint8_t *)passwd, strlen(passwd), &pw_hash))
     {
         return OP_FAILURE;
     }
 
     // If passwords match, return success
-    bool auth = hash_hash_t_match((*pp_user)->p_hash, p_pw_hash);
-    hash_destroy(&p_pw_hash);
-    if (auth)
+    if (hash_match(&(*pp_user)->hash, &pw_hash))
     {
         debug_print("[+] User %s successfully authenticated\n", username);
         return OP_SUCCESS;
@@ -464,8 +513,14 @@ static void db_update_db(db_t * p_db)
     {
         p_acct = (user_account_t *)entry->value;
         char_count += strlen(p_acct->p_username);
-        char_count += p_acct->p_hash->size * 2; // hash stored in hex so times 2
+        char_count += sizeof(p_acct->hash.array) * 2; // hash stored in hex so times 2
         char_count += 5; // ":" + ":" + "\n" + perm + fprintf('\0')
+
+        // Accounts with a rate of their own end with ":rate"
+        if (0 != p_acct->rate)
+        {
+            char_count += (size_t)snprintf(NULL, 0, ":%" PRIu64, p_acct->rate);
+        }
         entry = htable_iter_get_next(iter);
     }
     htable_destroy_iter(iter);
@@ -488,16 +543,20 @@ static void db_update_db(db_t * p_db)
     entry = htable_iter_get_entry(iter);
     while (NULL != entry)
     {
-        memset(pw_hash, 0, sizeof(pw_hash));
         p_acct = (user_account_t *)entry->value;
+        hash_to_hex(&p_acct->hash, pw_hash);
 
-        int hash_offset = 0;
-        for (size_t i = 0; i < p_acct->p_hash->size; i++)
+        int writes = 0;
+        if (0 != p_acct->rate)
         {
-            hash_offset += sprintf((pw_hash + hash_offset), "%02x", p_acct->p_hash->array[i]);
+            writes = sprintf((char *)(p_buffer + offset), "%s:%hhu:%s:%" PRIu64 "\n",
+                             p_acct->p_username, p_acct->permission, pw_hash, p_acct->rate);
+        }
+        else
+        {
+            writes = sprintf((char *)(p_buffer + offset), "%s:%hhu:%s\n",
+                             p_acct->p_username, p_acct->permission, pw_hash);
         }
-
-        int writes = sprintf((char *)(p_buffer + offset), "%s:%hhu:%s\n", p_acct->p_username, p_acct->permission, pw_hash);
         offset += writes;
         accounts++;
         entry = htable_iter_get_next(iter);
@@ -519,14 +578,14 @@ static void db_update_db(db_t * p_db)
     }
 
     //*NOTE* That char_count - acc is written this is to omit the \0 from fprintf
-    ret_codes_t status = f_write_file(p_db_path, p_buffer, (char_count - accounts));
-    if (OP_FAILURE == status)
+    ret_codes_t status = f_write_file(p_db_path, p_buffer, (char_count - accounts), p_db->p_sync);
+    if (OP_SUCCESS != status)
     {
         goto cleanup_file;
     }
     debug_print("%s\n", "[+] Successfully updated the .cape.db file");
 
-    verified_path_t * p_hash_file = update_db_hash(p_db->p_home_dir, p_db_path);
+    verified_path_t * p_hash_file = update_db_hash(p_db->p_home_dir, p_db_path, p_db->p_sync);
     if (NULL == p_hash_file)
     {
         fprintf(stderr, "[!] Failed to update the .cape.hash file\n");
@@ -550,7 +609,7 @@ ret_null:
 /*!
  * @brief Function iterates over the user account segments represented by the
  *
- *      `user_name:user_perm:passwd_hash\n`
+ *      `user_name:user_perm:passwd_hash[:rate]\n`
  *
  * and populates the user hashtable. The Hashtable is used as a in memory
  * database of users to verify their passwords and ensure that their
@@ -568,9 +627,11 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
     }
 
     uint8_t perm;
+    uint64_t rate;
+    int consumed;
     char username[MAX_USERNAME_LEN + 1];
     char pw_hash[(SHA256_DIGEST_LEN) + 1];
-    hash_t * p_hash;
+    hash_t hash;
     char * p_username;
 
     int res = 0;
@@ -580,17 +641,18 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
     {
         // Reset the copy variables for the next segment
         perm = 0;
+        rate = 0;
+        consumed = 0;
         memset(username, 0, sizeof(username));
         memset(pw_hash, 0, sizeof(pw_hash));
-        p_hash = NULL;
         p_username = NULL;
 
         // Find the p_username:perm:pw_hash from the segment and
         // populate the variables
         res = sscanf(segment,
                      "%" stringify(MAX_USERNAME_LEN) "[^:]:%hhu:%"
-                     stringify(SHA256_DIGEST_LEN) "[^\n]",
-                     username, & perm, pw_hash);
+                     stringify(SHA256_DIGEST_LEN) "[^:\n]%n",
+                     username, & perm, pw_hash, &consumed);
 
         // Verify that the tokens were parsed properly
         if (EOF == res)
@@ -607,13 +669,25 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
         total_read += strlen(username);
         total_read += strlen(pw_hash);
 
+        // The rate of the user follows the hash when it has one
+        if (':' == segment[consumed])
+        {
+            char * p_end = NULL;
+            errno = 0;
+            rate = strtoull(segment + consumed + 1, &p_end, 10);
+            if ((0 != errno) || ('\n' != *p_end))
+            {
+                fprintf(stderr, "[!] Invalid rate for %s\n", username);
+                goto ret_null;
+            }
+            total_read += (size_t)(p_end - (segment + consumed));
+        }
+
 
         // Convert the string hash to a hash_t object
-        p_hash = hex_char_to_byte_array(pw_hash, strlen(pw_hash));
-        if (NULL == p_hash)
+        if (!hash_from_hex(pw_hash, strlen(pw_hash), &hash))
         {
-            fprintf(stderr, "[!] Unable to create memory for "
-                            "pw_hash\n");
+            fprintf(stderr, "[!] Invalid pw_hash for %s\n", username);
             goto ret_null;
         }
 
@@ -621,7 +695,7 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
         p_username = strdup(username);
         if (UV_INVALID_ALLOC == verify_alloc(p_username))
         {
-            goto cleanup_hash;
+            goto ret_null;
         }
 
         // Create the account object that will be saved into the hash table
@@ -632,8 +706,9 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
         }
         *p_user = (user_account_t){
             .p_username = p_username,
-            .p_hash     = p_hash,
-            .permission = perm
+            .hash       = hash,
+            .permission = perm,
+            .rate       = rate
         };
 
         htable_set(p_htable, p_username, p_user);
@@ -646,8 +721,6 @@ static int8_t populate_htable(htable_t * p_htable, file_content_t * p_contents)
 
 cleanup_uname:
     free(p_username);
-cleanup_hash:
-    hash_destroy(&p_hash);
 ret_null:
     return -1;
 }
@@ -760,9 +833,12 @@ ret_null:
  *
  * @param p_home_dir Pointer to the servers home directory
  * @param p_db_file verified_path_t object to the .cape.db file
+ * @param p_sync Sync object used to flush the hash file
  * @return verified_path_t object representing the .cape.hash or NULL if error
  */
-static verified_path_t * update_db_hash(verified_path_t * p_home_dir, verified_path_t * p_db_file)
+static verified_path_t * update_db_hash(verified_path_t * p_home_dir,
+                                        verified_path_t * p_db_file,
+                                        sync_t * p_sync)
 {
     FILE * h_db_file = NULL;
     ret_codes_t result = f_open_file(p_db_file, "r", &h_db_file);
@@ -774,39 +850,38 @@ static verified_path_t * update_db_hash(verified_path_t * p_home_dir, verified_p
         goto ret_null;
     }
 
-    // Get the files size to allocate a byte array
-    fseek(h_db_file, 0L, SEEK_END);
-    long int file_size = ftell(h_db_file);
-    if (-1 == file_size)
+    // Hash the file in fixed size blocks so it never has to be held in
+    // memory as a whole
+    hash_stream_t stream;
+    if (!hash_stream_init(&stream, HASH_ALG_SHA256))
     {
-        perror("ftell");
+        fprintf(stderr, "[!] Could not hash the file\n");
         goto cleanup_file;
     }
-    fseek(h_db_file, 0L, SEEK_SET);
 
-    // Create the memory to read the files contents
-    uint8_t * p_byte_array = (uint8_t *)calloc((unsigned long)file_size, sizeof(uint8_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_byte_array))
+    uint8_t block[BUFSIZ];
+    size_t bytes_read = 0;
+    while (0 != (bytes_read = fread(block, sizeof(uint8_t), sizeof(block), h_db_file)))
     {
-        goto cleanup_file;
+        if (!hash_stream_update(&stream, block, bytes_read))
+        {
+            fprintf(stderr, "[!] Could not hash the file\n");
+            goto cleanup_stream;
+        }
     }
-
-    // Read the contents of the file so that we can hash it
-    size_t bytes_read = fread(p_byte_array, sizeof(uint8_t),(unsigned long)file_size, h_db_file);
-    fclose(h_db_file);
-    if (bytes_read != (unsigned long)file_size)
+    if (ferror(h_db_file))
     {
         fprintf(stderr, "[!] Could not properly read the file\n");
-        goto cleanup_array;
+        goto cleanup_stream;
     }
+    fclose(h_db_file);
+    h_db_file = NULL;
 
-    // Call the hashing function to get a hash structure to save the hash
-    // string to the hash file
-    hash_t * p_hash = hash_byte_array(p_byte_array, bytes_read);
-    if (NULL == p_hash)
+    hash_t hash;
+    if (!hash_stream_final(&stream, &hash))
     {
         fprintf(stderr, "[!] Could not hash the file\n");
-        goto cleanup_array;
+        goto ret_null;
     }
 
     // Get a verified path for the hash file to write the hash data to
@@ -816,34 +891,29 @@ static verified_path_t * update_db_hash(verified_path_t * p_home_dir, verified_p
         fprintf(stderr, "[!] Could not create the database file "
                         "in %s/%s you may have to create it yourself\n",
                 DB_DIR, DB_NAME);
-        goto cleanup_hash;
+        goto ret_null;
     }
 
-    // Open a handle the hash file to write the contents to
-    FILE * h_hash_file = NULL;
-    result = f_open_file(p_hash_file, "w", &h_hash_file);
-    if (OP_SUCCESS != result) // Message printed already
+    // Build the magic bytes followed by the digest and replace the hash
+    // file in one atomic write so a crash never leaves a torn hash file
+    uint8_t hash_buffer[sizeof(uint32_t) + sizeof(hash.array)] = {0};
+    memcpy(hash_buffer, &MAGIC_BYTES, sizeof(uint32_t));
+    memcpy(hash_buffer + sizeof(uint32_t), hash.array, sizeof(hash.array));
+    result = f_write_file(p_hash_file, hash_buffer, sizeof(hash_buffer), p_sync);
+    if (OP_SUCCESS != result)
     {
+        fprintf(stderr, "[!] Could not write the .cape.hash file\n");
         goto cleanup_hash_file;
     }
 
-    fwrite(&MAGIC_BYTES, sizeof(uint32_t), 1, h_hash_file);
-    fwrite(p_hash->array, sizeof(uint8_t), p_hash->size, h_hash_file);
-
-    // clean up
-    fclose(h_hash_file);
-    free(p_byte_array);
-    hash_destroy(&p_hash);
     debug_print("%s\n", "[+] .cape.hash file updated with new .cape.db hash");
-
     return p_hash_file;
 
 cleanup_hash_file:
     f_destroy_path(&p_hash_file);
-cleanup_hash:
-    hash_destroy(&p_hash);
-cleanup_array:
-    free(p_byte_array);
+    goto ret_null;
+cleanup_stream:
+    hash_stream_final(&stream, NULL);
 cleanup_file:
     fclose(h_db_file);
 ret_null:
@@ -854,9 +924,10 @@ ret_null:
  * @brief Initialized the db file with the default admin user
  *
  * @param p_home_dir Pointer to the home directory of the server
+ * @param p_sync Sync object used to flush the db file
  * @return If successful, a verified_path_t object is returned otherwise NULL
  */
-static verified_path_t * init_db_file(verified_path_t * p_home_dir)
+static verified_path_t * init_db_file(verified_path_t * p_home_dir, sync_t * p_sync)
 {
     // Attempt to resolve the path to the db file; This should never fail at
     // this point, but you can never be too sure
@@ -892,8 +963,8 @@ static verified_path_t * init_db_file(verified_path_t * p_home_dir)
     }
 
     //*NOTE* That array_size - 1 is written this is to omit the \0 from fprintf
-    ret_codes_t status = f_write_file(p_db, p_buffer, array_size - 1);
-    if (OP_FAILURE == status)
+    ret_codes_t status = f_write_file(p_db, p_buffer, array_size - 1, p_sync);
+    if (OP_SUCCESS != status)
     {
         goto cleanup_array;
     }
@@ -961,23 +1032,6 @@ static uint64_t db_hash_callback(void * key)
     return hash;
 }
 
-/*!
- * @brief Callback is used for the session_htable
- *
- * @param key Pointer to the key object to be hashed. In this case, it is
- * the session ID
- *
- * @return Hash value of the key
- */
-static uint64_t sesh_hash_callback(void * key)
-{
-    uint32_t * session = (uint32_t *)key;
-    uint64_t hash = htable_get_init_hash();
-
-    htable_hash_key(&hash, session, sizeof(uint32_t));
-    return hash;
-}
-
 /*!
  * @brief Callback is used for the users_htable
  * @param left_key Left key to compare
@@ -999,41 +1053,6 @@ static htable_match_t db_compare_callback(void * left_key, void * right_key)
     return HT_MATCH_FALSE;
 }
 
-/*!
- * @brief Callback is used for the session_htable
- * @param left_key Left key to compare
- * @param right_key Right key to compare
- *
- * @return If the two keys match. In this case, if the two sessions match
- */
-static htable_match_t sesh_compare_callback(void * left_key, void * right_key)
-{
-    uint32_t left = *(uint32_t *)left_key;
-    uint32_t right = *(uint32_t *)right_key;
-
-    // This test function only tests the payload strings. But you would compare
-    // all items of the struct
-    if (left == right)
-    {
-        return HT_MATCH_TRUE;
-    }
-    return HT_MATCH_FALSE;
-}
-/*!
- * @brief Callback is used for the session_htable
- *
- * @param payload Pointer to the value object stored in the hash table
- */
-void sesh_free_callback(void * payload)
-{
-    if (NULL == payload)
-    {
-        return;
-    }
-    free(payload);
-    payload = NULL;
-}
-
 /*!
  * @brief Callback is used for the user_htable
  *
@@ -1050,14 +1069,9 @@ void db_free_value_callback(void * payload)
     {
         free(s->p_username);
     }
-    if (NULL != s->p_hash)
-    {
-        hash_destroy(&s->p_hash);
-    }
 
     *s = (user_account_t){
         .p_username = NULL,
-        .p_hash     = NULL,
         .permission = 0,
     };
 
@@ -0,0 +1,280 @@
+#include <server_dedup.h>
+#include <hashtable.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    hash_t      hash;
+    hash_alg_t  alg;
+} dedup_key_t;
+
+typedef struct
+{
+    dedup_key_t     key;
+    f_file_id_t     id;
+    char            path[];
+} dedup_entry_t;
+
+struct dedup
+{
+    htable_t *          p_entries;  // dedup_key_t -> dedup_entry_t
+    size_t              count;
+    pthread_mutex_t     lock;
+};
+
+static dedup_entry_t * new_entry(const dedup_key_t * p_key,
+                                 const char * p_path,
+                                 const f_file_id_t * p_id);
+static bool same_id(const f_file_id_t * p_left, const f_file_id_t * p_right);
+static uint64_t dedup_hash_callback(void * key);
+static htable_match_t dedup_compare_callback(void * left_key, void * right_key);
+static void dedup_free_callback(void * value);
+
+/*!
+ * @brief Create an empty index
+ *
+ * @return dedup_t object if successful otherwise NULL
+ */
+dedup_t * dedup_init(void)
+{
+    dedup_t * p_dedup = (dedup_t *)calloc(1, sizeof(dedup_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_dedup))
+    {
+        return NULL;
+    }
+
+    *p_dedup = (dedup_t){
+        .p_entries  = htable_create(dedup_hash_callback, dedup_compare_callback,
+                                    NULL, dedup_free_callback),
+        .count      = 0
+    };
+    if (NULL == p_dedup->p_entries)
+    {
+        free(p_dedup);
+        return NULL;
+    }
+    pthread_mutex_init(&p_dedup->lock, NULL);
+    return p_dedup;
+}
+
+/*!
+ * @brief Free the index
+ *
+ * @param pp_dedup Double pointer to the index
+ */
+void dedup_destroy(dedup_t ** pp_dedup)
+{
+    if ((NULL == pp_dedup) || (NULL == *pp_dedup))
+    {
+        return;
+    }
+
+    dedup_t * p_dedup = *pp_dedup;
+    htable_destroy(p_dedup->p_entries, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+    pthread_mutex_destroy(&p_dedup->lock);
+    free(p_dedup);
+    *pp_dedup = NULL;
+}
+
+/*!
+ * @brief Index the file under its digest. A file already indexed under the
+ * digest is replaced by the newer one.
+ *
+ * @param p_dedup Pointer to the index
+ * @param alg Algorithm the digest was computed with
+ * @param p_hash Pointer to the digest of the contents of the file
+ * @param p_path Path of the file relative to the home directory
+ * @param p_id Pointer to the identity of the file that was hashed
+ */
+void dedup_add(dedup_t * p_dedup,
+               hash_alg_t alg,
+               const hash_t * p_hash,
+               const char * p_path,
+               const f_file_id_t * p_id)
+{
+    if ((NULL == p_dedup) || (NULL == p_hash) || (NULL == p_path) || (NULL == p_id))
+    {
+        return;
+    }
+
+    dedup_key_t key = {
+        .hash   = *p_hash,
+        .alg    = alg
+    };
+    dedup_entry_t * p_entry = new_entry(&key, p_path, p_id);
+    if (NULL == p_entry)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&p_dedup->lock);
+    dedup_entry_t * p_old = (dedup_entry_t *)htable_del(p_dedup->p_entries,
+                                                        &key,
+                                                        HT_FREE_PTR_FALSE);
+    if ((NULL == p_old) && (DEDUP_MAX_ENTRIES <= p_dedup->count))
+    {
+        pthread_mutex_unlock(&p_dedup->lock);
+        free(p_entry);
+        return;
+    }
+    htable_set(p_dedup->p_entries, &p_entry->key, p_entry);
+    if (NULL == p_old)
+    {
+        p_dedup->count++;
+    }
+    pthread_mutex_unlock(&p_dedup->lock);
+    free(p_old);
+}
+
+/*!
+ * @brief Create the destination as a link to the indexed file with the
+ * digest. Entries whose file is gone or has changed are dropped.
+ *
+ * @param p_dedup Pointer to the index
+ * @param p_home_dir Pointer to the verified_path_t of the home directory
+ * @param alg Algorithm the digest was computed with
+ * @param p_hash Pointer to the digest of the contents wanted
+ * @param p_dest Pointer to the verified_path_t of the file to create
+ * @param p_sync Sync object used to flush the new name. May be NULL
+ * @retval OP_SUCCESS The destination holds the contents of the digest
+ * @retval OP_HASH_UNKNOWN No file with the digest is held
+ * @retval OP_FILE_EXISTS A file already exists at the destination
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t dedup_link(dedup_t * p_dedup,
+                       verified_path_t * p_home_dir,
+                       hash_alg_t alg,
+                       const hash_t * p_hash,
+                       verified_path_t * p_dest,
+                       sync_t * p_sync)
+{
+    if ((NULL == p_dedup) || (NULL == p_hash))
+    {
+        return OP_HASH_UNKNOWN;
+    }
+
+    dedup_key_t key = {
+        .hash   = *p_hash,
+        .alg    = alg
+    };
+
+    // The entry is copied so the link is made without holding the lock
+    pthread_mutex_lock(&p_dedup->lock);
+    dedup_entry_t * p_found = (dedup_entry_t *)htable_get(p_dedup->p_entries, &key);
+    dedup_entry_t * p_entry = (NULL == p_found) ? NULL
+                                                : new_entry(&key, p_found->path, &p_found->id);
+    pthread_mutex_unlock(&p_dedup->lock);
+    if (NULL == p_entry)
+    {
+        return OP_HASH_UNKNOWN;
+    }
+
+    ret_codes_t result = OP_RESOLVE_ERROR;
+    verified_path_t * p_source = f_ver_path_resolve(p_home_dir, p_entry->path);
+    if (NULL != p_source)
+    {
+        result = f_link_file(p_source, &p_entry->id, p_dest, p_sync);
+        f_destroy_path(&p_source);
+    }
+
+    if (OP_RESOLVE_ERROR == result)
+    {
+        debug_print("[DEDUP] Dropping stale entry for %s\n", p_entry->path);
+
+        // Another request may have indexed a newer file in the meantime
+        pthread_mutex_lock(&p_dedup->lock);
+        p_found = (dedup_entry_t *)htable_get(p_dedup->p_entries, &key);
+        if ((NULL != p_found) && (same_id(&p_found->id, &p_entry->id)))
+        {
+            htable_del(p_dedup->p_entries, &key, HT_FREE_PTR_FALSE);
+            p_dedup->count--;
+            free(p_found);
+        }
+        pthread_mutex_unlock(&p_dedup->lock);
+        result = OP_HASH_UNKNOWN;
+    }
+    else if (OP_SUCCESS == result)
+    {
+        debug_print("[DEDUP] Linked %s to the new file\n", p_entry->path);
+    }
+
+    free(p_entry);
+    return result;
+}
+
+/*!
+ * @brief Get the number of digests in the index
+ *
+ * @param p_dedup Pointer to the index
+ * @return Number of digests
+ */
+size_t dedup_count(dedup_t * p_dedup)
+{
+    if (NULL == p_dedup)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&p_dedup->lock);
+    size_t count = p_dedup->count;
+    pthread_mutex_unlock(&p_dedup->lock);
+    return count;
+}
+
+/*!
+ * @brief Allocate an entry holding a copy of the path
+ *
+ * @return dedup_entry_t object or NULL if memory ran out
+ */
+static dedup_entry_t * new_entry(const dedup_key_t * p_key,
+                                 const char * p_path,
+                                 const f_file_id_t * p_id)
+{
+    size_t path_len = strlen(p_path) + 1;
+    dedup_entry_t * p_entry = (dedup_entry_t *)malloc(sizeof(dedup_entry_t) + path_len);
+    if (UV_INVALID_ALLOC == verify_alloc(p_entry))
+    {
+        return NULL;
+    }
+    p_entry->key = *p_key;
+    p_entry->id = *p_id;
+    memcpy(p_entry->path, p_path, path_len);
+    return p_entry;
+}
+
+static bool same_id(const f_file_id_t * p_left, const f_file_id_t * p_right)
+{
+    return ((p_left->dev == p_right->dev)
+            && (p_left->ino == p_right->ino)
+            && (p_left->size == p_right->size)
+            && (p_left->mtime.tv_sec == p_right->mtime.tv_sec)
+            && (p_left->mtime.tv_nsec == p_right->mtime.tv_nsec));
+}
+
+static uint64_t dedup_hash_callback(void * key)
+{
+    dedup_key_t * p_key = (dedup_key_t *)key;
+    uint64_t hash = htable_get_init_hash();
+
+    htable_hash_key(&hash, p_key->hash.array, sizeof(p_key->hash.array));
+    htable_hash_key(&hash, &p_key->alg, sizeof(p_key->alg));
+    return hash;
+}
+
+static htable_match_t dedup_compare_callback(void * left_key, void * right_key)
+{
+    dedup_key_t * p_left = (dedup_key_t *)left_key;
+    dedup_key_t * p_right = (dedup_key_t *)right_key;
+    return ((p_left->alg == p_right->alg)
+            && (0 == memcmp(p_left->hash.array, p_right->hash.array,
+                            sizeof(p_left->hash.array)))) ? HT_MATCH_TRUE
+                                                          : HT_MATCH_FALSE;
+}
+
+static void dedup_free_callback(void * value)
+{
+    free(value);
+}
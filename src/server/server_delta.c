@@ -0,0 +1,413 @@
+#include <server_delta.h>
+#include <server_xfer.h>
+#include <stdlib.h>
+#include <string.h>
+
+// adler32 modulus and the most bytes that can be summed before the sums
+// have to be reduced to stay within 32 bits
+#define ADLER_MOD           65521
+#define ADLER_NMAX          5552
+
+// Output is gathered into chunks of XFER_CHUNK_SIZE before it is written
+typedef struct
+{
+    f_stream_t *    p_out;
+    hash_stream_t * p_hash;
+    uint8_t *       p_buffer;
+    size_t          used;
+    size_t          total;
+} delta_out_t;
+
+static ret_codes_t out_flush(delta_out_t * p_out);
+static ret_codes_t out_copy(delta_out_t * p_out,
+                            f_stream_t * p_base,
+                            size_t offset,
+                            size_t length);
+static ret_codes_t out_data(delta_out_t * p_out, const uint8_t * p_bytes, size_t length);
+static void store_be32(uint8_t * p_bytes, uint32_t value);
+static uint32_t load_be32(const uint8_t * p_bytes);
+
+/*!
+ * @brief Get the block size of the signature of a file. The size grows with
+ * the square root of the file so that both the signature and the bytes
+ * resent around every change stay small.
+ *
+ * @param file_size Size of the file in bytes
+ * @return Block size in bytes
+ */
+size_t delta_block_size(size_t file_size)
+{
+    size_t block_size = DELTA_MIN_BLOCK;
+    while ((block_size < DELTA_MAX_BLOCK) && ((block_size * block_size) < file_size))
+    {
+        block_size <<= 1;
+    }
+
+    // Very large files use larger blocks to bound the signature
+    while ((file_size / block_size) >= DELTA_MAX_BLOCKS)
+    {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+/*!
+ * @brief Get the length of the signature of a file
+ *
+ * @param file_size Size of the file in bytes
+ * @return Number of bytes of the signature
+ */
+size_t delta_signature_len(size_t file_size)
+{
+    size_t block_size = delta_block_size(file_size);
+    size_t blocks = (file_size + block_size - 1) / block_size;
+    return DELTA_SIG_HEADER + (blocks * DELTA_SIG_ENTRY);
+}
+
+/*!
+ * @brief Compute the adler32 weak checksum of the bytes
+ *
+ * @param p_bytes Pointer to the bytes
+ * @param length Number of bytes
+ * @return The checksum with the sum of sums in the high 16 bits
+ */
+uint32_t delta_weak(const uint8_t * p_bytes, size_t length)
+{
+    uint32_t sum_a = 1;
+    uint32_t sum_b = 0;
+    while (length > 0)
+    {
+        size_t run = (length < ADLER_NMAX) ? length : ADLER_NMAX;
+        length -= run;
+        while (run-- > 0)
+        {
+            sum_a += *p_bytes++;
+            sum_b += sum_a;
+        }
+        sum_a %= ADLER_MOD;
+        sum_b %= ADLER_MOD;
+    }
+    return (sum_b << 16) | sum_a;
+}
+
+/*!
+ * @brief Compute the signature of the file
+ *
+ * @param p_base Pointer to the f_stream_t of the file
+ * @param base_size Number of bytes of the file
+ * @param alg Algorithm requested by the client. Picks the strong checksum
+ * @param pp_sig Double pointer receiving the allocated signature
+ * @param p_sig_len Pointer receiving the length of the signature
+ * @retval OP_SUCCESS The signature was computed
+ * @retval OP_IO_ERROR The file could not be read
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t delta_signature(f_stream_t * p_base,
+                            size_t base_size,
+                            hash_alg_t alg,
+                            uint8_t ** pp_sig,
+                            size_t * p_sig_len)
+{
+    if ((NULL == p_base) || (NULL == pp_sig) || (NULL == p_sig_len))
+    {
+        return OP_FAILURE;
+    }
+
+    // Tree roots of single blocks would only add a level over sha256
+    hash_alg_t strong_alg = (HASH_ALG_BLAKE3 == alg) ? HASH_ALG_BLAKE3 : HASH_ALG_SHA256;
+    size_t block_size = delta_block_size(base_size);
+    size_t blocks = (base_size + block_size - 1) / block_size;
+    size_t sig_len = delta_signature_len(base_size);
+
+    uint8_t * p_sig = (uint8_t *)malloc(sig_len);
+    if (UV_INVALID_ALLOC == verify_alloc(p_sig))
+    {
+        return OP_FAILURE;
+    }
+
+    // Read whole blocks at a time, as many as fit in a transfer chunk
+    size_t buffer_len = (block_size < XFER_CHUNK_SIZE)
+                        ? (XFER_CHUNK_SIZE / block_size) * block_size
+                        : block_size;
+    if (buffer_len > base_size)
+    {
+        buffer_len = blocks * block_size;
+    }
+    uint8_t * p_buffer = (uint8_t *)malloc((0 == buffer_len) ? 1 : buffer_len);
+    if (UV_INVALID_ALLOC == verify_alloc(p_buffer))
+    {
+        free(p_sig);
+        return OP_FAILURE;
+    }
+
+    store_be32(p_sig, (uint32_t)block_size);
+    uint64_t size_be = htonll((uint64_t)base_size);
+    memcpy(p_sig + 4, &size_be, sizeof(size_be));
+
+    ret_codes_t result = OP_SUCCESS;
+    uint8_t * p_entry = p_sig + DELTA_SIG_HEADER;
+    size_t offset = 0;
+    while (offset < base_size)
+    {
+        size_t want = base_size - offset;
+        if (want > buffer_len)
+        {
+            want = buffer_len;
+        }
+        ssize_t got = f_stream_read_at(p_base, p_buffer, want, offset);
+        if ((got < 0) || ((size_t)got != want))
+        {
+            result = OP_IO_ERROR;
+            goto cleanup;
+        }
+
+        for (size_t pos = 0; pos < want; pos += block_size)
+        {
+            size_t length = ((want - pos) < block_size) ? (want - pos) : block_size;
+            hash_t strong;
+            if (!hash_alg_bytes(strong_alg, p_buffer + pos, length, &strong))
+            {
+                result = OP_FAILURE;
+                goto cleanup;
+            }
+            store_be32(p_entry, delta_weak(p_buffer + pos, length));
+            memcpy(p_entry + 4, strong.array, DELTA_STRONG_LEN);
+            p_entry += DELTA_SIG_ENTRY;
+        }
+        offset += want;
+    }
+
+    *pp_sig = p_sig;
+    *p_sig_len = sig_len;
+    p_sig = NULL;
+cleanup:
+    free(p_buffer);
+    free(p_sig);
+    return result;
+}
+
+/*!
+ * @brief Rebuild the file described by the delta into the output stream.
+ * The blocks are copied from the base file.
+ *
+ * @param p_base Pointer to the f_stream_t of the base file
+ * @param base_size Number of bytes of the base file
+ * @param p_delta Pointer to the delta
+ * @param delta_len Length of the delta
+ * @param p_out Pointer to the f_stream_t the file is written to
+ * @param p_hash Running hash updated with the bytes written or NULL
+ * @param p_out_len Pointer receiving the number of bytes written
+ * @retval OP_SUCCESS The file was rebuilt
+ * @retval OP_IO_ERROR The base could not be read or the output written
+ * @retval OP_FAILURE The delta is malformed or refers past the base
+ */
+ret_codes_t delta_apply(f_stream_t * p_base,
+                        size_t base_size,
+                        const uint8_t * p_delta,
+                        size_t delta_len,
+                        f_stream_t * p_out,
+                        hash_stream_t * p_hash,
+                        size_t * p_out_len)
+{
+    if ((NULL == p_base) || (NULL == p_delta) || (NULL == p_out)
+        || (NULL == p_out_len) || (delta_len < 4))
+    {
+        return OP_FAILURE;
+    }
+
+    size_t block_size = load_be32(p_delta);
+    if (0 == block_size)
+    {
+        return OP_FAILURE;
+    }
+
+    delta_out_t out = {
+        .p_out      = p_out,
+        .p_hash     = p_hash,
+        .p_buffer   = (uint8_t *)malloc(XFER_CHUNK_SIZE),
+        .used       = 0,
+        .total      = 0
+    };
+    if (UV_INVALID_ALLOC == verify_alloc(out.p_buffer))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t result = OP_SUCCESS;
+    uint64_t copied = 0;
+    size_t pos = 4;
+    while ((OP_SUCCESS == result) && (pos < delta_len))
+    {
+        uint8_t op = p_delta[pos++];
+        if (DELTA_OP_COPY == op)
+        {
+            if ((delta_len - pos) < 8)
+            {
+                result = OP_FAILURE;
+                break;
+            }
+
+            // Both fields are 32 bits so the product cannot overflow
+            uint64_t start = (uint64_t)load_be32(p_delta + pos) * block_size;
+            uint64_t length = (uint64_t)load_be32(p_delta + pos + 4) * block_size;
+            pos += 8;
+
+            // Only the last block may be short
+            if ((start >= base_size) || (0 == length))
+            {
+                result = OP_FAILURE;
+                break;
+            }
+            if (length > (base_size - start))
+            {
+                length = base_size - start;
+            }
+
+            copied += length;
+            if (copied > ((uint64_t)base_size * DELTA_MAX_GROWTH))
+            {
+                result = OP_FAILURE;
+                break;
+            }
+            result = out_copy(&out, p_base, (size_t)start, (size_t)length);
+        }
+        else if (DELTA_OP_DATA == op)
+        {
+            if ((delta_len - pos) < 4)
+            {
+                result = OP_FAILURE;
+                break;
+            }
+            size_t length = load_be32(p_delta + pos);
+            pos += 4;
+            if ((delta_len - pos) < length)
+            {
+                result = OP_FAILURE;
+                break;
+            }
+            result = out_data(&out, p_delta + pos, length);
+            pos += length;
+        }
+        else
+        {
+            result = OP_FAILURE;
+        }
+    }
+
+    if (OP_SUCCESS == result)
+    {
+        result = out_flush(&out);
+    }
+    if (OP_SUCCESS == result)
+    {
+        *p_out_len = out.total;
+    }
+    else
+    {
+        debug_print_err("[DELTA] Unable to apply the delta at offset %ld\n", pos);
+    }
+    free(out.p_buffer);
+    return result;
+}
+
+/*!
+ * @brief Hash and write the gathered output
+ */
+static ret_codes_t out_flush(delta_out_t * p_out)
+{
+    if (0 == p_out->used)
+    {
+        return OP_SUCCESS;
+    }
+    if ((NULL != p_out->p_hash)
+        && (!hash_stream_update(p_out->p_hash, p_out->p_buffer, p_out->used)))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t result = f_stream_write(p_out->p_out, p_out->p_buffer, p_out->used);
+    p_out->total += p_out->used;
+    p_out->used = 0;
+    return result;
+}
+
+/*!
+ * @brief Read the range of the base file straight into the output
+ */
+static ret_codes_t out_copy(delta_out_t * p_out,
+                            f_stream_t * p_base,
+                            size_t offset,
+                            size_t length)
+{
+    while (length > 0)
+    {
+        if (XFER_CHUNK_SIZE == p_out->used)
+        {
+            ret_codes_t result = out_flush(p_out);
+            if (OP_SUCCESS != result)
+            {
+                return result;
+            }
+        }
+
+        size_t want = XFER_CHUNK_SIZE - p_out->used;
+        if (want > length)
+        {
+            want = length;
+        }
+
+        // A short read means the base shrank while the delta was applied
+        ssize_t got = f_stream_read_at(p_base, p_out->p_buffer + p_out->used, want, offset);
+        if ((got < 0) || ((size_t)got != want))
+        {
+            return OP_IO_ERROR;
+        }
+        p_out->used += want;
+        offset += want;
+        length -= want;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Append the literal bytes to the output
+ */
+static ret_codes_t out_data(delta_out_t * p_out, const uint8_t * p_bytes, size_t length)
+{
+    while (length > 0)
+    {
+        if (XFER_CHUNK_SIZE == p_out->used)
+        {
+            ret_codes_t result = out_flush(p_out);
+            if (OP_SUCCESS != result)
+            {
+                return result;
+            }
+        }
+
+        size_t want = XFER_CHUNK_SIZE - p_out->used;
+        if (want > length)
+        {
+            want = length;
+        }
+        memcpy(p_out->p_buffer + p_out->used, p_bytes, want);
+        p_out->used += want;
+        p_bytes += want;
+        length -= want;
+    }
+    return OP_SUCCESS;
+}
+
+static void store_be32(uint8_t * p_bytes, uint32_t value)
+{
+    p_bytes[0] = (uint8_t)(value >> 24);
+    p_bytes[1] = (uint8_t)(value >> 16);
+    p_bytes[2] = (uint8_t)(value >> 8);
+    p_bytes[3] = (uint8_t)value;
+}
+
+static uint32_t load_be32(const uint8_t * p_bytes)
+{
+    return ((uint32_t)p_bytes[0] << 24) | ((uint32_t)p_bytes[1] << 16)
+           | ((uint32_t)p_bytes[2] << 8) | (uint32_t)p_bytes[3];
+}
@@ -1,8 +1,20 @@
+#define _GNU_SOURCE // O_TMPFILE, linkat AT_EMPTY_PATH and fallocate
 #include <server_file_api.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h> // FICLONE
+#include <stdatomic.h> // c++ does not play nice with stdatomic.h so header is added here
+
+#include <server_sched.h>
 
 // Bytes needed to account for the "/" and a "\0"
 #define SLASH_PLUS_NULL 2
 
+// Size of each write(2) issued when flushing a stream to disk. The writes
+// start at offset 0 so every chunk but the last is page aligned
+#define WRITE_CHUNK_SIZE (1 << 20)
+
 // Files to ignore
 extern const char * DB_DIR;
 extern const char * DB_NAME;
@@ -19,6 +31,32 @@ DEBUG_STATIC char * join_and_resolve_paths(const char * p_root,
                                            size_t child_length);
 static char * join_paths(const char * p_root, size_t root_length,
                          const char * p_child, size_t child_length);
+static ret_codes_t write_atomic(verified_path_t * p_path,
+                                uint8_t * p_stream,
+                                size_t stream_size,
+                                sync_t * p_sync,
+                                bool b_replace,
+                                f_file_id_t * p_id);
+static ret_codes_t clone_file(int source_fd,
+                              const char * p_dir,
+                              const char * p_final,
+                              sync_t * p_sync);
+static void stat_to_id(const struct stat * p_stat, f_file_id_t * p_id);
+static bool id_match(const f_file_id_t * p_id, const struct stat * p_stat);
+static int open_tmp_file(const char * p_dir, char * p_tmp_name);
+static ret_codes_t write_all(int fd, const uint8_t * p_stream, size_t stream_size);
+static ret_codes_t link_tmp_file(int fd,
+                                 const char * p_dir,
+                                 const char * p_tmp_name,
+                                 const char * p_final,
+                                 bool b_replace);
+static ret_codes_t errno_to_code(int err);
+static f_stream_t * new_stream(int fd, const char * p_tmp_name);
+static bool split_dir(const char * p_path, char dir[PATH_MAX]);
+static f_stream_t * temp_stream(const char * p_dir, ret_codes_t * p_code);
+
+// Counter used to generate unique names for the temp links within a process
+static atomic_uint tmp_counter;
 
 
 // Simple structure is to ensure path paths passed to the API have already
@@ -28,6 +66,18 @@ struct verified_path
     char * p_path;
 };
 
+// Descriptor of a file that is read on demand with pread so that multiple
+// passes over the file do not share a file offset. Temp files created where
+// O_TMPFILE is not supported keep their hidden name until they are linked
+// or closed. Streams with ops are read through the ops instead
+struct f_stream
+{
+    int                     fd;
+    char *                  p_tmp_name;
+    const f_stream_ops_t *  p_ops;
+    void *                  p_ctx;
+};
+
 
 /*!
  * @brief Access to the members of verified_path_t is private. But the need
@@ -483,44 +533,115 @@ ret_null:
 }
 
 /*!
- * @brief Simple wrapper to write the data stream to the verified file path
+ * @brief Write the data stream to the verified file path replacing the file
+ * if it already exists. The stream is written into an unnamed temp file in
+ * the same directory and only linked into place once every byte is on disk.
+ * Readers either see the old file or the new file, never a partial write.
  *
  * @param p_path Pointer to a verified_file_t object
  * @param p_stream Pointer to a byte stream
  * @param stream_size Number of bytes in the byte stream
- * @return FILE_OP_SUCCESS if operation succeeded, otherwise FILE_OP_FAILURE
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was written
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
  */
 ret_codes_t f_write_file(verified_path_t * p_path,
                          uint8_t * p_stream,
-                         size_t stream_size)
+                         size_t stream_size,
+                         sync_t * p_sync)
+{
+    return write_atomic(p_path, p_stream, stream_size, p_sync, true, NULL);
+}
+
+/*!
+ * @brief Same as f_write_file except that the file must not already exist.
+ * The existence check is performed by the kernel at the moment the file is
+ * linked into place, so two concurrent uploads to the same path cannot both
+ * succeed and a failed upload never leaves a truncated file behind.
+ *
+ * @param p_path Pointer to a verified_file_t object
+ * @param p_stream Pointer to a byte stream
+ * @param stream_size Number of bytes in the byte stream
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @param p_id Pointer receiving the identity of the created file. May be NULL
+ * @retval OP_SUCCESS The file was created
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_create_file(verified_path_t * p_path,
+                          uint8_t * p_stream,
+                          size_t stream_size,
+                          sync_t * p_sync,
+                          f_file_id_t * p_id)
 {
-    if ((NULL == p_path) || (NULL == p_stream))
+    return write_atomic(p_path, p_stream, stream_size, p_sync, false, p_id);
+}
+
+/*!
+ * @brief Give the file at the source path a second name at the destination
+ * path. The source is opened and checked against the identity first and the
+ * link is made through the open descriptor, so the destination is either
+ * the file the identity was taken from or nothing. If the file system
+ * refuses another hard link the file is reflinked instead.
+ *
+ * @param p_source Pointer to the verified_path_t of the existing file
+ * @param p_id Pointer to the identity the source must still have
+ * @param p_dest Pointer to the verified_path_t of the new name. The file
+ * must not already exist
+ * @param p_sync Sync object deciding how the new name is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The destination was created
+ * @retval OP_RESOLVE_ERROR The source is gone or no longer matches the identity
+ * @retval OP_FILE_EXISTS A file already exists at the destination
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_link_file(verified_path_t * p_source,
+                        const f_file_id_t * p_id,
+                        verified_path_t * p_dest,
+                        sync_t * p_sync)
+{
+    char dir[PATH_MAX] = {0};
+    if ((NULL == p_source) || (NULL == p_id) || (NULL == p_dest)
+        || (!split_dir(p_dest->p_path, dir)))
     {
-        goto ret_null;
+        return OP_FAILURE;
     }
-    ret_codes_t result = OP_FAILURE;
 
-    FILE * h_path = NULL;
-    result = f_open_file(p_path, "w", &h_path);
-    if (OP_SUCCESS != result) // Message printed already
+    int fd = open(p_source->p_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (-1 == fd)
     {
-        return result;
+        return OP_RESOLVE_ERROR;
     }
 
-    size_t write = fwrite(p_stream, sizeof(uint8_t), stream_size, h_path);
-    if (write != stream_size)
+    ret_codes_t result = OP_RESOLVE_ERROR;
+    struct stat stat_buff = {0};
+    if ((-1 == fstat(fd, &stat_buff)) || (!S_ISREG(stat_buff.st_mode))
+        || (!id_match(p_id, &stat_buff)))
     {
-        fprintf(stderr, "[!] Unable to write all bytes to %s\n",
-                p_path->p_path);
-        goto cleanup;
+        goto cleanup_fd;
     }
-    fclose(h_path);
-    return OP_SUCCESS;
 
-cleanup:
-    fclose(h_path);
-ret_null:
-    return OP_FAILURE;
+    // Linking the descriptor rather than the source path means the inode
+    // that was checked is the one that gets the new name
+    result = link_tmp_file(fd, dir, "", p_dest->p_path, false);
+    if (OP_FAILURE == result)
+    {
+        // EMLINK or a file system without hard links
+        result = clone_file(fd, dir, p_dest->p_path, p_sync);
+    }
+    else if (OP_SUCCESS == result)
+    {
+        result = sync_dir(p_sync, dir);
+    }
+
+cleanup_fd:
+    close(fd);
+    return result;
 }
 
 /*!
@@ -598,17 +719,18 @@ file_content_t * f_read_file(verified_path_t * p_path, ret_codes_t * p_code)
 
     // Read the contents into the p_byte_array created
     size_t bytes_read = fread(p_byte_array, sizeof(uint8_t), (unsigned long)file_size, h_path);
-    fclose(h_path);
     if (bytes_read != (unsigned long)file_size)
     {
         fprintf(stderr, "[!] Unable to read all the bytes from the "
                         "file %s\n", p_path->p_path);
         goto cleanup_array;
     }
+    fclose(h_path);
+    h_path = NULL;
 
     // Hash the data stream
-    hash_t * p_hash = hash_byte_array(p_byte_array, bytes_read);
-    if (NULL == p_hash)
+    hash_t hash;
+    if (!hash_byte_array(p_byte_array, bytes_read, &hash))
     {
         fprintf(stderr, "[!] Unable to hash the contents of "
                         "%s", p_path->p_path);
@@ -622,7 +744,7 @@ file_content_t * f_read_file(verified_path_t * p_path, ret_codes_t * p_code)
     if (UV_INVALID_ALLOC == verify_alloc(p_content))
     {
         *p_code = OP_FAILURE;
-        goto cleanup_hash;
+        goto cleanup_array;
     }
 
     // Duplicate the file path, the verified path is not needed inside the
@@ -637,7 +759,8 @@ file_content_t * f_read_file(verified_path_t * p_path, ret_codes_t * p_code)
     // Save data into the content structure to return
     * p_content = (file_content_t){
         .p_stream       = p_byte_array,
-        .p_hash         = p_hash,
+        .hash           = hash,
+        .hash_alg       = HASH_ALG_SHA256,
         .stream_size    = bytes_read,
         .p_path         = p_file_path
     };
@@ -647,16 +770,521 @@ file_content_t * f_read_file(verified_path_t * p_path, ret_codes_t * p_code)
 
 cleanup_content:
     free(p_content); // Content is not populated here so no destroy is called
-cleanup_hash:
-    hash_destroy(& p_hash);
 cleanup_array:
     free(p_byte_array);
 cleanup_close:
-    fclose(h_path);
+    if (NULL != h_path)
+    {
+        fclose(h_path);
+    }
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Open the verified file path for streaming. Unlike f_read_file the
+ * contents are not loaded or hashed, the returned object has p_source set
+ * and its bytes are pulled with f_stream_read_at.
+ *
+ * @param p_path Pointer to a verified_path_t object
+ * @param p_code Pointer to save the result of the operation to
+ * @return file_content_t object if successful, otherwise NULL
+ */
+file_content_t * f_stream_file(verified_path_t * p_path, ret_codes_t * p_code)
+{
+    size_t stream_size = 0;
+    f_stream_t * p_source = f_stream_open(p_path, &stream_size, p_code);
+    if (NULL == p_source)
+    {
+        goto ret_null;
+    }
+
+    *p_code = OP_FAILURE;
+    file_content_t * p_content = (file_content_t *)malloc(sizeof(file_content_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_content))
+    {
+        goto cleanup_source;
+    }
+
+    char * p_file_path = strdup(p_path->p_path);
+    if (UV_INVALID_ALLOC == verify_alloc(p_file_path))
+    {
+        goto cleanup_content;
+    }
+
+    *p_content = (file_content_t){
+        .p_stream       = NULL,
+        .hash_alg       = HASH_ALG_SHA256,
+        .stream_size    = stream_size,
+        .p_path         = p_file_path,
+        .p_source       = p_source
+    };
+
+    *p_code = OP_SUCCESS;
+    return p_content;
+
+cleanup_content:
+    free(p_content);
+cleanup_source:
+    f_stream_close(&p_source);
 ret_null:
     return NULL;
 }
 
+/*!
+ * @brief Open the regular file at the verified path for reading with
+ * f_stream_read_at
+ *
+ * @param p_path Pointer to a verified_path_t object
+ * @param p_size Pointer receiving the size of the file
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object if successful, otherwise NULL
+ */
+f_stream_t * f_stream_open(verified_path_t * p_path, size_t * p_size, ret_codes_t * p_code)
+{
+    *p_code = OP_IO_ERROR;
+    if ((NULL == p_path) || (NULL == p_size))
+    {
+        goto ret_null;
+    }
+
+    int fd = open(p_path->p_path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd)
+    {
+        debug_print_err("[!] Unable to open %s\n:Error: %s\n",
+                        p_path->p_path, strerror(errno));
+        goto ret_null;
+    }
+
+    // Stat the descriptor rather than the path so the size matches the
+    // file that will actually be read
+    struct stat stat_buff = {0};
+    if (-1 == fstat(fd, &stat_buff))
+    {
+        debug_print_err("[!] Unable to get stats for %s\n:Error: %s\n",
+                        p_path->p_path, strerror(errno));
+        goto cleanup_fd;
+    }
+    if (!S_ISREG(stat_buff.st_mode))
+    {
+        fprintf(stderr, "[!] Path %s given is not a regular file\n",
+                p_path->p_path);
+        *p_code = OP_PATH_NOT_FILE;
+        goto cleanup_fd;
+    }
+
+    // Hint that the file is read front to back so readahead is maximized
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    *p_code = OP_FAILURE;
+    f_stream_t * p_source = new_stream(fd, NULL);
+    if (NULL == p_source)
+    {
+        goto cleanup_fd;
+    }
+
+    *p_size = (size_t)stat_buff.st_size;
+    *p_code = OP_SUCCESS;
+    return p_source;
+
+cleanup_fd:
+    close(fd);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Open a second descriptor of the stream. The copy reads the same
+ * file even if the path is replaced in the meantime, so work on the file
+ * can outlive the request that opened it.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @return f_stream_t object if successful, otherwise NULL
+ */
+f_stream_t * f_stream_dup(f_stream_t * p_source)
+{
+    if (NULL == p_source)
+    {
+        return NULL;
+    }
+
+    int fd = fcntl(p_source->fd, F_DUPFD_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+        debug_print_err("[!] Unable to duplicate stream: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    f_stream_t * p_copy = new_stream(fd, NULL);
+    if (NULL == p_copy)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if (NULL != p_source->p_ops)
+    {
+        void * p_ctx = p_source->p_ops->dup(p_source->p_ctx);
+        if (NULL == p_ctx)
+        {
+            f_stream_close(&p_copy);
+            return NULL;
+        }
+        p_copy->p_ops = p_source->p_ops;
+        p_copy->p_ctx = p_ctx;
+    }
+    return p_copy;
+}
+
+/*!
+ * @brief Get the identity of the file the stream reads
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_id Pointer receiving the identity
+ * @return true if successful otherwise false
+ */
+bool f_stream_id(f_stream_t * p_source, f_file_id_t * p_id)
+{
+    struct stat stat_buff = {0};
+    if ((NULL == p_source) || (NULL == p_id) || (-1 == fstat(p_source->fd, &stat_buff)))
+    {
+        return false;
+    }
+    stat_to_id(&stat_buff, p_id);
+    return true;
+}
+
+/*!
+ * @brief Read up to length bytes at the offset of the streamed file. Short
+ * reads are only returned at the end of the file.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_buffer Buffer to read into
+ * @param length Number of bytes to read
+ * @param offset Offset into the file to read from
+ * @return Number of bytes read or -1 on failure
+ */
+ssize_t f_stream_read_at(f_stream_t * p_source,
+                         uint8_t * p_buffer,
+                         size_t length,
+                         size_t offset)
+{
+    if ((NULL == p_source) || (NULL == p_buffer))
+    {
+        return -1;
+    }
+    if (NULL != p_source->p_ops)
+    {
+        return p_source->p_ops->read_at(p_source->p_ctx, p_buffer, length, offset);
+    }
+
+    size_t total = 0;
+    while (total < length)
+    {
+        ssize_t bytes = pread(p_source->fd, p_buffer + total,
+                              length - total, (off_t)(offset + total));
+        if (-1 == bytes)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            debug_print_err("[!] Unable to read stream: %s\n", strerror(errno));
+            return -1;
+        }
+        if (0 == bytes)
+        {
+            break;
+        }
+        total += (size_t)bytes;
+    }
+    return (ssize_t)total;
+}
+
+/*!
+ * @brief Serve the reads of the stream through the ops instead of reading
+ * its file. Streams with ops cannot be written, linked or replaced.
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_ops Pointer to the ops. Must outlive the stream
+ * @param p_ctx Context passed to the ops. Released with the stream
+ * @return true if successful otherwise false
+ */
+bool f_stream_set_ops(f_stream_t * p_source, const f_stream_ops_t * p_ops, void * p_ctx)
+{
+    if ((NULL == p_source) || (NULL == p_ops) || (NULL != p_source->p_ops)
+        || (NULL != p_source->p_tmp_name))
+    {
+        return false;
+    }
+    p_source->p_ops = p_ops;
+    p_source->p_ctx = p_ctx;
+    return true;
+}
+
+/*!
+ * @brief Tell the kernel that the range of the stream is about to be read
+ * so it can start reading it in the background
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param offset Offset of the range
+ * @param length Number of bytes of the range
+ */
+void f_stream_advise(f_stream_t * p_source, size_t offset, size_t length)
+{
+    // The ops do their own read ahead
+    if ((NULL == p_source) || (NULL != p_source->p_ops))
+    {
+        return;
+    }
+    posix_fadvise(p_source->fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+}
+
+/*!
+ * @brief Give the stream length bytes of disk and map them into memory for
+ * reading and writing. The pages are backed by the file, so the kernel can
+ * write them back and drop them under memory pressure instead of the
+ * process holding them. The space is allocated first so a full disk fails
+ * here rather than on a write to the mapping
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param length Number of bytes to map, at least 1
+ * @return Pointer to the mapping if successful otherwise NULL
+ */
+uint8_t * f_stream_map(f_stream_t * p_source, size_t length)
+{
+    // Streams read through ops have no file behind them
+    if ((NULL == p_source) || (NULL != p_source->p_ops) || (0 == length))
+    {
+        return NULL;
+    }
+    int result = posix_fallocate(p_source->fd, 0, (off_t)length);
+    if (0 != result)
+    {
+        debug_print_err("[FILE_API] Unable to allocate %zu bytes: %s\n", length, strerror(result));
+        return NULL;
+    }
+    void * p_map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, p_source->fd, 0);
+    if (MAP_FAILED == p_map)
+    {
+        debug_print_err("[FILE_API] Unable to map %zu bytes: %s\n", length, strerror(errno));
+        return NULL;
+    }
+    return (uint8_t *)p_map;
+}
+
+/*!
+ * @brief Unmap the bytes mapped with f_stream_map. The stream may be closed
+ * before or after
+ *
+ * @param p_map Pointer to the mapping. May be NULL
+ * @param length Number of bytes mapped
+ */
+void f_stream_unmap(uint8_t * p_map, size_t length)
+{
+    if (NULL == p_map)
+    {
+        return;
+    }
+    munmap(p_map, length);
+}
+
+/*!
+ * @brief Create an unnamed temp file in the directory to spill data that is
+ * generated while handling a request. The file never appears in the
+ * directory and its space is released once the stream is closed.
+ *
+ * @param p_dir Pointer to the verified_path_t of the directory
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object opened for reading and writing or NULL
+ */
+f_stream_t * f_stream_temp(verified_path_t * p_dir, ret_codes_t * p_code)
+{
+    *p_code = OP_FAILURE;
+    if (NULL == p_dir)
+    {
+        return NULL;
+    }
+    return temp_stream(p_dir->p_path, p_code);
+}
+
+/*!
+ * @brief Create an unnamed temp file in the directory of the path. The
+ * file can then be written and moved over the path with f_stream_replace.
+ *
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object opened for reading and writing or NULL
+ */
+f_stream_t * f_stream_temp_for(verified_path_t * p_path, ret_codes_t * p_code)
+{
+    *p_code = OP_FAILURE;
+    char dir[PATH_MAX] = {0};
+    if ((NULL == p_path) || (!split_dir(p_path->p_path, dir)))
+    {
+        return NULL;
+    }
+    return temp_stream(dir, p_code);
+}
+
+/*!
+ * @brief Append the bytes to the end of the stream
+ *
+ * @param p_source Pointer to the f_stream_t object
+ * @param p_bytes Pointer to the bytes to write
+ * @param length Number of bytes to write
+ * @retval OP_SUCCESS All bytes were written
+ * @retval OP_IO_ERROR The disk rejected the write (ENOSPC, EIO, etc.)
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_write(f_stream_t * p_source, const uint8_t * p_bytes, size_t length)
+{
+    if ((NULL == p_source) || (NULL != p_source->p_ops)
+        || ((NULL == p_bytes) && (length > 0)))
+    {
+        return OP_FAILURE;
+    }
+    return write_all(p_source->fd, p_bytes, length);
+}
+
+/*!
+ * @brief Set the size of the stream. Growing the stream adds a hole that
+ * reads as zeros and takes no space on disk.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param length New size in bytes
+ * @retval OP_SUCCESS The size was set
+ * @retval OP_IO_ERROR The disk rejected the change
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_resize(f_stream_t * p_source, size_t length)
+{
+    if ((NULL == p_source) || (NULL != p_source->p_ops))
+    {
+        return OP_FAILURE;
+    }
+    if (-1 == ftruncate(p_source->fd, (off_t)length))
+    {
+        debug_print_err("[!] Unable to resize stream: %s\n", strerror(errno));
+        return errno_to_code(errno);
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Give the temp stream a name in the file system. The file must not
+ * already exist, the check is done by the kernel when the file is linked.
+ * The stream remains open.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp
+ * @param p_path Pointer to the verified_path_t to link the file to
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was linked
+ * @retval OP_FILE_EXISTS A file already exists at the path
+ * @retval OP_IO_ERROR The disk rejected the link
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_link(f_stream_t * p_source, verified_path_t * p_path, sync_t * p_sync)
+{
+    char dir[PATH_MAX] = {0};
+    if ((NULL == p_source) || (NULL != p_source->p_ops) || (NULL == p_path)
+        || (!split_dir(p_path->p_path, dir)))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t result = sync_data(p_sync, p_source->fd);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    const char * p_tmp_name = (NULL == p_source->p_tmp_name) ? "" : p_source->p_tmp_name;
+    result = link_tmp_file(p_source->fd, dir, p_tmp_name, p_path->p_path, false);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    if (NULL != p_source->p_tmp_name)
+    {
+        // The hidden name was removed by the link
+        free(p_source->p_tmp_name);
+        p_source->p_tmp_name = NULL;
+    }
+    return sync_dir(p_sync, dir);
+}
+
+/*!
+ * @brief Move the temp stream over the path, replacing the file if it
+ * exists. The data is flushed before the rename so readers either see the
+ * old file or the complete new one. The stream remains open.
+ *
+ * @param p_source Pointer to a f_stream_t created with f_stream_temp_for
+ * @param p_path Pointer to the verified_path_t of the file to replace
+ * @param p_sync Sync object deciding how the file is flushed to stable
+ * storage before returning. NULL leaves flushing to the kernel
+ * @retval OP_SUCCESS The file was replaced
+ * @retval OP_IO_ERROR The disk rejected the write or the rename
+ * @retval OP_FAILURE Any other failure
+ */
+ret_codes_t f_stream_replace(f_stream_t * p_source, verified_path_t * p_path, sync_t * p_sync)
+{
+    char dir[PATH_MAX] = {0};
+    if ((NULL == p_source) || (NULL != p_source->p_ops) || (NULL == p_path)
+        || (!split_dir(p_path->p_path, dir)))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t result = sync_data(p_sync, p_source->fd);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    const char * p_tmp_name = (NULL == p_source->p_tmp_name) ? "" : p_source->p_tmp_name;
+    result = link_tmp_file(p_source->fd, dir, p_tmp_name, p_path->p_path, true);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    if (NULL != p_source->p_tmp_name)
+    {
+        // The hidden name was renamed over the path
+        free(p_source->p_tmp_name);
+        p_source->p_tmp_name = NULL;
+    }
+    return sync_dir(p_sync, dir);
+}
+
+/*!
+ * @brief Close the stream and free the f_stream_t object
+ *
+ * @param pp_source Double pointer to the f_stream_t object
+ */
+void f_stream_close(f_stream_t ** pp_source)
+{
+    if ((NULL == pp_source) || (NULL == *pp_source))
+    {
+        return;
+    }
+
+    f_stream_t * p_source = *pp_source;
+    if (NULL != p_source->p_ops)
+    {
+        p_source->p_ops->release(p_source->p_ctx);
+    }
+    close(p_source->fd);
+    if (NULL != p_source->p_tmp_name)
+    {
+        unlink(p_source->p_tmp_name);
+        free(p_source->p_tmp_name);
+    }
+    free(p_source);
+    *pp_source = NULL;
+}
+
 /*!
  * @brief Iterate over all the files in the dir path provided and create
  * a byte array with the file type [F] for file or [D] for dir along with
@@ -778,8 +1406,8 @@ file_content_t * f_list_dir(verified_path_t * p_path, ret_codes_t * p_code)
     memcpy(p_buff, p_buffer, str_len);
 
     // Hash the data stream
-    hash_t * p_hash = hash_byte_array(p_buff, str_len);
-    if (NULL == p_hash)
+    hash_t hash;
+    if (!hash_byte_array(p_buff, str_len, &hash))
     {
         fprintf(stderr, "[!] Unable to hash the contents of "
                         "%s", p_path->p_path);
@@ -792,7 +1420,7 @@ file_content_t * f_list_dir(verified_path_t * p_path, ret_codes_t * p_code)
     if (UV_INVALID_ALLOC == verify_alloc(p_content))
     {
         *p_code = OP_FAILURE;
-        goto cleanup_hash;
+        goto cleanup_buff2;
     }
 
     // Duplicate the file path, the verified path is not needed inside the
@@ -807,7 +1435,8 @@ file_content_t * f_list_dir(verified_path_t * p_path, ret_codes_t * p_code)
     // Save data into the content structure to return
     *p_content = (file_content_t){
         .p_stream       = p_buff,
-        .p_hash         = p_hash,
+        .hash           = hash,
+        .hash_alg       = HASH_ALG_SHA256,
         .stream_size    = str_len,
         .p_path         = p_file_path
     };
@@ -817,9 +1446,7 @@ file_content_t * f_list_dir(verified_path_t * p_path, ret_codes_t * p_code)
     return p_content;
 
 cleanup_content:
-    f_destroy_content(&p_content);
-cleanup_hash:
-    hash_destroy(&p_hash);
+    free(p_content); // Content is not populated here so no destroy is called
 cleanup_buff2:
     free(p_buff);
     p_buff = NULL;
@@ -848,19 +1475,394 @@ void f_destroy_content(file_content_t ** pp_content)
         return;
     }
 
-    hash_destroy(& p_content->p_hash);
     free(p_content->p_stream);
     free(p_content->p_path);
+    f_stream_close(&p_content->p_source);
     * p_content = (file_content_t){
         .p_stream    = NULL,
         .p_path      = NULL,
-        .p_hash      = NULL,
-        .stream_size = 0
+        .stream_size = 0,
+        .p_source    = NULL
     };
     free(p_content);
     * pp_content = NULL;
 }
 
+/*!
+ * @brief Create the file in four steps:
+ *  1. Open an unnamed file in the target directory (O_TMPFILE)
+ *  2. Reserve the full size up front with fallocate so that parallel uploads
+ *     get contiguous extents instead of growing the file extent by extent
+ *  3. Write the stream with large sequential writes and flush them as p_sync dictates
+ *  4. Link the finished file into the namespace
+ *
+ * File systems without O_TMPFILE support fall back to a hidden named temp
+ * file that is removed if anything fails.
+ *
+ * @param p_path Pointer to the verified path of the final file
+ * @param p_stream Pointer to the byte stream to write
+ * @param stream_size Number of bytes in the byte stream
+ * @param p_sync Sync object used to flush the file. May be NULL
+ * @param b_replace Replace the file if it exists instead of failing
+ * @param p_id Pointer receiving the identity of the written file. May be NULL
+ * @return ret_codes_t of the operation
+ */
+static ret_codes_t write_atomic(verified_path_t * p_path,
+                                uint8_t * p_stream,
+                                size_t stream_size,
+                                sync_t * p_sync,
+                                bool b_replace,
+                                f_file_id_t * p_id)
+{
+    if ((NULL == p_path) || (NULL == p_path->p_path)
+        || ((NULL == p_stream) && (stream_size > 0)))
+    {
+        goto ret_null;
+    }
+
+    char dir[PATH_MAX] = {0};
+    if (!split_dir(p_path->p_path, dir))
+    {
+        goto ret_null;
+    }
+
+    char tmp_name[PATH_MAX] = {0};
+    int fd = open_tmp_file(dir, tmp_name);
+    if (-1 == fd)
+    {
+        return errno_to_code(errno);
+    }
+
+    ret_codes_t result = OP_SUCCESS;
+    if (stream_size > 0)
+    {
+        // Not every file system supports fallocate. It is only an
+        // optimization so only a full disk is treated as an error
+        if ((-1 == fallocate(fd, 0, 0, (off_t)stream_size)) && (ENOSPC == errno))
+        {
+            result = OP_IO_ERROR;
+            goto cleanup_fd;
+        }
+
+        result = write_all(fd, p_stream, stream_size);
+        if (OP_SUCCESS != result)
+        {
+            fprintf(stderr, "[!] Unable to write all bytes to %s\n",
+                    p_path->p_path);
+            goto cleanup_fd;
+        }
+    }
+
+    // The data has to be durable before the link, otherwise a crash could
+    // expose a named file with unwritten extents. Group commits flush the
+    // data and the link in the one syncfs waited for after the link
+    result = sync_data(p_sync, fd);
+    if (OP_SUCCESS != result)
+    {
+        goto cleanup_fd;
+    }
+
+    // Taken from the descriptor so it describes this file even if the path
+    // is replaced right after the link
+    struct stat stat_buff = {0};
+    if (NULL != p_id)
+    {
+        if (-1 == fstat(fd, &stat_buff))
+        {
+            result = errno_to_code(errno);
+            goto cleanup_fd;
+        }
+        stat_to_id(&stat_buff, p_id);
+    }
+
+    result = link_tmp_file(fd, dir, tmp_name, p_path->p_path, b_replace);
+    if (OP_SUCCESS != result)
+    {
+        goto cleanup_fd;
+    }
+    close(fd);
+
+    // The new directory entry is only durable once the directory is synced
+    return sync_dir(p_sync, dir);
+
+cleanup_fd:
+    close(fd);
+    if ('\0' != tmp_name[0])
+    {
+        unlink(tmp_name);
+    }
+    return result;
+ret_null:
+    return OP_FAILURE;
+}
+
+/*!
+ * @brief Reflink the source into a new file at the final path. The new file
+ * shares the extents of the source until either is written to.
+ *
+ * @param source_fd File descriptor of the file to clone
+ * @param p_dir Directory of the final file
+ * @param p_final Final path of the file. Must not exist
+ * @param p_sync Sync object used to flush the file. May be NULL
+ * @return OP_SUCCESS if the clone was linked otherwise an error code
+ */
+static ret_codes_t clone_file(int source_fd,
+                              const char * p_dir,
+                              const char * p_final,
+                              sync_t * p_sync)
+{
+    char tmp_name[PATH_MAX] = {0};
+    int fd = open_tmp_file(p_dir, tmp_name);
+    if (-1 == fd)
+    {
+        return errno_to_code(errno);
+    }
+
+    ret_codes_t result = OP_FAILURE;
+    if (-1 == ioctl(fd, FICLONE, source_fd))
+    {
+        debug_print_err("[!] Unable to clone into %s\n:Error: %s\n",
+                        p_final, strerror(errno));
+        goto cleanup_fd;
+    }
+
+    result = sync_data(p_sync, fd);
+    if (OP_SUCCESS == result)
+    {
+        result = link_tmp_file(fd, p_dir, tmp_name, p_final, false);
+    }
+    if (OP_SUCCESS == result)
+    {
+        close(fd);
+        return sync_dir(p_sync, p_dir);
+    }
+
+cleanup_fd:
+    close(fd);
+    if ('\0' != tmp_name[0])
+    {
+        unlink(tmp_name);
+    }
+    return result;
+}
+
+/*!
+ * @brief Copy the fields of the stat buffer that identify a file version
+ */
+static void stat_to_id(const struct stat * p_stat, f_file_id_t * p_id)
+{
+    *p_id = (f_file_id_t){
+        .dev    = p_stat->st_dev,
+        .ino    = p_stat->st_ino,
+        .size   = p_stat->st_size,
+        .mtime  = p_stat->st_mtim,
+        .nlink  = p_stat->st_nlink
+    };
+}
+
+/*!
+ * @brief Check if the stat buffer describes the file version of the identity
+ */
+static bool id_match(const f_file_id_t * p_id, const struct stat * p_stat)
+{
+    return ((p_id->dev == p_stat->st_dev)
+            && (p_id->ino == p_stat->st_ino)
+            && (p_id->size == p_stat->st_size)
+            && (p_id->mtime.tv_sec == p_stat->st_mtim.tv_sec)
+            && (p_id->mtime.tv_nsec == p_stat->st_mtim.tv_nsec));
+}
+
+/*!
+ * @brief Open an unnamed temp file in the directory. If the file system does
+ * not support O_TMPFILE a hidden named temp file is created instead and its
+ * name is written to p_tmp_name.
+ *
+ * @param p_dir Directory to create the file in
+ * @param p_tmp_name Buffer of PATH_MAX bytes. Left empty for unnamed files
+ * @return File descriptor or -1 on failure
+ */
+static int open_tmp_file(const char * p_dir, char * p_tmp_name)
+{
+    int fd = open(p_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0666);
+    if (-1 != fd)
+    {
+        return fd;
+    }
+
+    // Only fall back when O_TMPFILE itself is the problem
+    if ((EOPNOTSUPP != errno) && (EISDIR != errno) && (EINVAL != errno))
+    {
+        debug_print_err("[!] Unable to create temp file in %s\n:Error: %s\n",
+                        p_dir, strerror(errno));
+        return -1;
+    }
+
+    int writes = snprintf(p_tmp_name, PATH_MAX, "%s/.cape_tmp.XXXXXX", p_dir);
+    if ((writes < 0) || (writes >= PATH_MAX))
+    {
+        p_tmp_name[0] = '\0';
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = mkostemp(p_tmp_name, O_CLOEXEC);
+    if (-1 == fd)
+    {
+        debug_print_err("[!] Unable to create temp file in %s\n:Error: %s\n",
+                        p_dir, strerror(errno));
+        p_tmp_name[0] = '\0';
+    }
+    return fd;
+}
+
+/*!
+ * @brief Write the whole stream to the file descriptor in WRITE_CHUNK_SIZE
+ * chunks while handling short writes and signal interruptions.
+ *
+ * @param fd File descriptor to write to
+ * @param p_stream Byte stream to write
+ * @param stream_size Number of bytes to write
+ * @return OP_SUCCESS if all bytes were written otherwise an error code
+ */
+static ret_codes_t write_all(int fd, const uint8_t * p_stream, size_t stream_size)
+{
+    size_t offset = 0;
+    while (offset < stream_size)
+    {
+        size_t to_write = stream_size - offset;
+        to_write = (to_write < WRITE_CHUNK_SIZE) ? to_write : WRITE_CHUNK_SIZE;
+
+        // Large writes run on the bulk workers, which let the interactive
+        // ones have the CPU between chunks
+        sched_cooperate();
+        ssize_t written = write(fd, p_stream + offset, to_write);
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return errno_to_code(errno);
+        }
+        offset += (size_t)written;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Give the finished temp file its final name. Exclusive links use
+ * linkat/link which fail with EEXIST if the name is taken. Replacements link
+ * the file under a unique temporary name first and rename it over the final
+ * path since rename is the only atomic replace operation.
+ *
+ * @param fd File descriptor of the temp file
+ * @param p_dir Directory of the final file
+ * @param p_tmp_name Name of the temp file or empty if the file is unnamed
+ * @param p_final Final path of the file
+ * @param b_replace Replace the final path if it exists
+ * @return OP_SUCCESS if linked otherwise an error code
+ */
+static ret_codes_t link_tmp_file(int fd,
+                                 const char * p_dir,
+                                 const char * p_tmp_name,
+                                 const char * p_final,
+                                 bool b_replace)
+{
+    char link_name[PATH_MAX] = {0};
+    const char * p_target = p_final;
+
+    if (b_replace)
+    {
+        // Named temp files can be renamed over the target directly
+        if ('\0' != p_tmp_name[0])
+        {
+            goto do_rename;
+        }
+        int writes = snprintf(link_name, PATH_MAX, "%s/.cape_tmp.%d.%u",
+                              p_dir, getpid(),
+                              atomic_fetch_add(&tmp_counter, 1));
+        if ((writes < 0) || (writes >= PATH_MAX))
+        {
+            return OP_FAILURE;
+        }
+        p_target = link_name;
+    }
+
+    int result = 0;
+    if ('\0' != p_tmp_name[0])
+    {
+        result = link(p_tmp_name, p_target);
+        if (0 == result)
+        {
+            unlink(p_tmp_name);
+        }
+    }
+    else
+    {
+        // AT_EMPTY_PATH requires CAP_DAC_READ_SEARCH so fall back to the
+        // /proc symlink of the descriptor which any process may use
+        result = linkat(fd, "", AT_FDCWD, p_target, AT_EMPTY_PATH);
+        if ((-1 == result) && (ENOENT == errno))
+        {
+            char proc_path[64] = {0};
+            snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+            result = linkat(AT_FDCWD, proc_path, AT_FDCWD, p_target,
+                            AT_SYMLINK_FOLLOW);
+        }
+    }
+
+    // Printing the error may change errno
+    int link_errno = errno;
+    if (-1 == result)
+    {
+        if (EEXIST != link_errno)
+        {
+            debug_print_err("[!] Unable to link %s\n:Error: %s\n",
+                            p_target, strerror(link_errno));
+        }
+        return errno_to_code(link_errno);
+    }
+
+    if (!b_replace)
+    {
+        return OP_SUCCESS;
+    }
+    p_tmp_name = link_name;
+
+do_rename:
+    if (-1 == rename(p_tmp_name, p_final))
+    {
+        ret_codes_t code = errno_to_code(errno);
+        debug_print_err("[!] Unable to rename %s to %s\n:Error: %s\n",
+                        p_tmp_name, p_final, strerror(errno));
+        unlink(p_tmp_name);
+        return code;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Translate the errno of a failed file operation into a ret_codes_t
+ */
+static ret_codes_t errno_to_code(int err)
+{
+    switch (err)
+    {
+        case EEXIST:
+            return OP_FILE_EXISTS;
+        case ENOTDIR:
+            return OP_PATH_NOT_FILE;
+        case ENOSPC:
+        case EDQUOT:
+        case EIO:
+        case EROFS:
+        case EFBIG:
+            return OP_IO_ERROR;
+        default:
+            return OP_FAILURE;
+    }
+}
+
 /*!
  * @brief Attempt to join and resolve the two paths provided. The function will
  * handle the "/" regardless if both or neither paths to join have the "/".
@@ -1019,3 +2021,92 @@ static size_t get_file_size(verified_path_t * p_path,
 
     return (size_t)stat_buff.st_size;
 }
+
+/*!
+ * @brief Allocate the f_stream_t for the descriptor
+ *
+ * @param fd Open file descriptor. Owned by the stream on success
+ * @param p_tmp_name Hidden name of a temp file to remove on close. NULL or
+ * empty for files that are not temp files
+ * @return f_stream_t object or NULL if memory ran out
+ */
+static f_stream_t * new_stream(int fd, const char * p_tmp_name)
+{
+    f_stream_t * p_source = (f_stream_t *)malloc(sizeof(f_stream_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_source))
+    {
+        return NULL;
+    }
+    *p_source = (f_stream_t){
+        .fd         = fd,
+        .p_tmp_name = NULL,
+        .p_ops      = NULL,
+        .p_ctx      = NULL
+    };
+
+    if ((NULL != p_tmp_name) && ('\0' != p_tmp_name[0]))
+    {
+        p_source->p_tmp_name = strdup(p_tmp_name);
+        if (UV_INVALID_ALLOC == verify_alloc(p_source->p_tmp_name))
+        {
+            free(p_source);
+            return NULL;
+        }
+    }
+    return p_source;
+}
+
+/*!
+ * @brief Copy the directory part of the path into dir. Verified paths are
+ * always absolute so the last "/" splits the directory from the file name.
+ *
+ * @param p_path Absolute path of a file
+ * @param dir Buffer of PATH_MAX bytes receiving the directory
+ * @return true if the path has a directory otherwise false
+ */
+static bool split_dir(const char * p_path, char dir[PATH_MAX])
+{
+    const char * p_slash = strrchr(p_path, '/');
+    if (NULL == p_slash)
+    {
+        return false;
+    }
+    size_t dir_len = (p_slash == p_path) ? 1 : (size_t)(p_slash - p_path);
+    memcpy(dir, p_path, dir_len);
+    dir[dir_len] = '\0';
+    return true;
+}
+
+/*!
+ * @brief Open a temp file in the directory and wrap it in a stream
+ *
+ * @param p_dir Absolute path of the directory
+ * @param p_code Pointer to save the result of the operation to
+ * @return f_stream_t object or NULL
+ */
+static f_stream_t * temp_stream(const char * p_dir, ret_codes_t * p_code)
+{
+    char tmp_name[PATH_MAX] = {0};
+    int fd = open_tmp_file(p_dir, tmp_name);
+    if (-1 == fd)
+    {
+        *p_code = errno_to_code(errno);
+        return NULL;
+    }
+
+    // Named fallback files are removed when the stream is closed so they
+    // behave like O_TMPFILE files
+    f_stream_t * p_source = new_stream(fd, tmp_name);
+    if (NULL == p_source)
+    {
+        close(fd);
+        if ('\0' != tmp_name[0])
+        {
+            unlink(tmp_name);
+        }
+        return NULL;
+    }
+
+    *p_code = OP_SUCCESS;
+    return p_source;
+}
@@ -0,0 +1,250 @@
+#include <server_io.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <server_sched.h>
+
+struct io_pool
+{
+    sched_t *   p_lanes[IO_LANE_COUNT];
+};
+
+// Completion handed to the I/O worker. It lives on the stack of the thread
+// waiting in io_run which is blocked until b_done is set
+typedef struct
+{
+    void (* p_job)(void *);
+    void *              p_arg;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    bool                b_done;
+} io_task_t;
+
+// Set on the I/O workers. A worker waiting in io_run for another worker
+// could leave every worker waiting, so it runs the operation itself
+static _Thread_local bool b_io_worker = false;
+
+static void io_worker(void * p_arg);
+static void io_submitted(void * p_arg);
+
+/*!
+ * @brief Create the I/O pool. Each lane is resized between its bounds as
+ * the disk keeps its workers blocked
+ *
+ * @param min_workers Threads of the interactive lane at least
+ * @param max_workers Threads the interactive lane may grow to
+ * @param bulk_min Threads of the bulk lane at least
+ * @param bulk_max Threads the bulk lane may grow to
+ * @return io_pool_t object if successful otherwise NULL
+ */
+io_pool_t * io_pool_init(uint16_t min_workers,
+                         uint16_t max_workers,
+                         uint16_t bulk_min,
+                         uint16_t bulk_max)
+{
+    if ((0 == min_workers) || (0 == bulk_min))
+    {
+        goto ret_null;
+    }
+
+    io_pool_t * p_pool = (io_pool_t *)malloc(sizeof(io_pool_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_pool))
+    {
+        goto ret_null;
+    }
+
+    *p_pool = (io_pool_t){
+        .p_lanes = {
+            [IO_LANE_INTERACTIVE]   = sched_init(min_workers, max_workers),
+            [IO_LANE_BULK]          = sched_init(bulk_min, bulk_max)
+        }
+    };
+    if ((NULL == p_pool->p_lanes[IO_LANE_INTERACTIVE])
+        || (NULL == p_pool->p_lanes[IO_LANE_BULK]))
+    {
+        fprintf(stderr, "[!] Unable to start the I/O workers\n");
+        goto cleanup_lanes;
+    }
+    sched_yield_to(p_pool->p_lanes[IO_LANE_BULK], p_pool->p_lanes[IO_LANE_INTERACTIVE]);
+    return p_pool;
+
+cleanup_lanes:
+    sched_destroy(&p_pool->p_lanes[IO_LANE_BULK]);
+    sched_destroy(&p_pool->p_lanes[IO_LANE_INTERACTIVE]);
+    free(p_pool);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Wait for all queued operations to finish and free the pool
+ *
+ * @param pp_pool Double pointer to the I/O pool
+ */
+void io_pool_destroy(io_pool_t ** pp_pool)
+{
+    if ((NULL == pp_pool) || (NULL == *pp_pool))
+    {
+        return;
+    }
+
+    io_pool_t * p_pool = *pp_pool;
+
+    // The connections wait for their requests before closing, so by now no
+    // lane queues jobs on the other
+    sched_destroy(&p_pool->p_lanes[IO_LANE_BULK]);
+    sched_destroy(&p_pool->p_lanes[IO_LANE_INTERACTIVE]);
+
+    free(p_pool);
+    *pp_pool = NULL;
+}
+
+/*!
+ * @brief Read the metrics of the workers of a lane
+ *
+ * @param p_pool Pointer to the I/O pool
+ * @param lane Lane to read
+ * @param p_stats Receives the metrics
+ */
+void io_pool_stats(io_pool_t * p_pool, io_lane_t lane, sched_stats_t * p_stats)
+{
+    if ((NULL == p_pool) || (lane >= IO_LANE_COUNT))
+    {
+        return;
+    }
+    sched_stats(p_pool->p_lanes[lane], p_stats);
+}
+
+/*!
+ * @brief Estimate the jobs of a lane waiting for a worker, see sched_queued
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param lane Lane to read
+ * @return Number of jobs waiting
+ */
+size_t io_pool_queued(io_pool_t * p_pool, io_lane_t lane)
+{
+    if ((NULL == p_pool) || (lane >= IO_LANE_COUNT))
+    {
+        return 0;
+    }
+    return sched_queued(p_pool->p_lanes[lane]);
+}
+
+/*!
+ * @brief Run the job on one of the interactive I/O workers and block the
+ * calling thread until the job completes. If p_pool is NULL, or the calling
+ * thread is an I/O worker, the job is run on the calling thread.
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param p_job Function performing the file system operation
+ * @param p_arg Argument passed to p_job
+ */
+void io_run(io_pool_t * p_pool, void (* p_job)(void *), void * p_arg)
+{
+    if ((NULL == p_pool) || b_io_worker)
+    {
+        p_job(p_arg);
+        return;
+    }
+
+    io_task_t task = {
+        .p_job  = p_job,
+        .p_arg  = p_arg,
+        .b_done = false
+    };
+    pthread_mutex_init(&task.lock, NULL);
+    pthread_cond_init(&task.cond, NULL);
+
+    if (OP_SUCCESS != sched_submit(p_pool->p_lanes[IO_LANE_INTERACTIVE], io_worker, &task))
+    {
+        p_job(p_arg);
+        task.b_done = true;
+    }
+
+    // A network worker waiting here is blocked as much as in a read
+    sched_block_begin();
+    pthread_mutex_lock(&task.lock);
+    while (!task.b_done)
+    {
+        pthread_cond_wait(&task.cond, &task.lock);
+    }
+    pthread_mutex_unlock(&task.lock);
+    sched_block_end();
+
+    pthread_cond_destroy(&task.cond);
+    pthread_mutex_destroy(&task.lock);
+}
+
+/*!
+ * @brief Queue the job on the workers of a lane without waiting for it. If
+ * p_pool is NULL the job is run on the calling thread. Jobs may call
+ * io_run, which runs the operation on the worker already running the job.
+ *
+ * @param p_pool Pointer to the I/O pool. May be NULL
+ * @param lane Lane of the job
+ * @param p_job Function to run
+ * @param p_arg Argument passed to p_job, owned by the job
+ */
+void io_submit(io_pool_t * p_pool, io_lane_t lane, void (* p_job)(void *), void * p_arg)
+{
+    if ((NULL == p_pool) || (lane >= IO_LANE_COUNT))
+    {
+        p_job(p_arg);
+        return;
+    }
+
+    io_task_t * p_task = (io_task_t *)malloc(sizeof(io_task_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_task))
+    {
+        p_job(p_arg);
+        return;
+    }
+    *p_task = (io_task_t){
+        .p_job  = p_job,
+        .p_arg  = p_arg,
+        .b_done = false
+    };
+    if (OP_SUCCESS != sched_submit(p_pool->p_lanes[lane], io_submitted, p_task))
+    {
+        free(p_task);
+        p_job(p_arg);
+    }
+}
+
+/*!
+ * @brief Thread pool entry point. Runs the job then signals the waiting
+ * thread. The signal is sent while holding the lock because the task goes
+ * out of scope as soon as the waiter observes b_done.
+ *
+ * @param p_arg Pointer to the io_task_t
+ */
+static void io_worker(void * p_arg)
+{
+    io_task_t * p_task = (io_task_t *)p_arg;
+    b_io_worker = true;
+    sched_block_begin();
+    p_task->p_job(p_task->p_arg);
+    sched_block_end();
+
+    pthread_mutex_lock(&p_task->lock);
+    p_task->b_done = true;
+    pthread_cond_signal(&p_task->cond);
+    pthread_mutex_unlock(&p_task->lock);
+}
+
+/*!
+ * @brief Thread pool entry point of the jobs nobody waits for. The task is
+ * freed once the job returns
+ *
+ * @param p_arg Pointer to the io_task_t allocated by io_submit
+ */
+static void io_submitted(void * p_arg)
+{
+    io_task_t * p_task = (io_task_t *)p_arg;
+    b_io_worker = true;
+    sched_block_begin();
+    p_task->p_job(p_task->p_arg);
+    sched_block_end();
+    free(p_task);
+}
@@ -8,19 +8,115 @@ int main(int argc, char ** argv)
         goto ret_null;
     }
 
-    db_t * p_db = db_init(p_args->p_home_directory);
+    db_t * p_db = db_init(p_args->p_home_directory, p_args->durability);
     if (NULL == p_db)
     {
         goto cleanup_args;
     }
     p_args->p_home_directory = NULL; // p_db consumes the pointer
 
-    start_server(p_db, p_args->port, p_args->timeout);
+    // Rates given to users are saved with their accounts and stay in
+    // effect for the next runs
+    for (size_t idx = 0; idx < p_args->user_limit_count; idx++)
+    {
+        const user_limit_t * p_limit = &p_args->user_limits[idx];
+        if (OP_SUCCESS != db_set_user_rate(p_db, p_limit->username, p_limit->rate))
+        {
+            fprintf(stderr, "[!] Unable to limit the unknown user %s\n",
+                    p_limit->username);
+            goto cleanup_db;
+        }
+    }
+    p_db->p_shaper = shape_init(&p_args->limits);
+    if (NULL == p_db->p_shaper)
+    {
+        goto cleanup_db;
+    }
+
+    // File system operations run on their own pool so that they can be
+    // sized independently of the network workers
+    p_db->p_io = io_pool_init(p_args->io_workers, p_args->io_workers_max,
+                              p_args->bulk_workers, p_args->bulk_workers_max);
+    if (NULL == p_db->p_io)
+    {
+        goto cleanup_db;
+    }
+
+    // Requests past the limits are answered busy before they queue
+    p_db->p_admit = admit_init(&p_args->admission, p_db->p_io);
+    if (NULL == p_db->p_admit)
+    {
+        goto cleanup_modules;
+    }
+
+    // Buffers sized by the clients wait for room in the budget or are
+    // spilled to disk instead of growing the process without bound
+    p_db->p_mem = mem_init(p_args->memory);
+    p_db->p_spill = mem_init((uint64_t)WIRE_SPILL_MIB << 20);
+    if ((NULL == p_db->p_mem) || (NULL == p_db->p_spill))
+    {
+        goto cleanup_modules;
+    }
+
+    // The cache only saves work so the server runs without it if it cannot
+    // be opened
+    if (p_args->cache_size > 0)
+    {
+        p_db->p_cache = cache_init(p_db->p_home_dir, p_args->cache_size);
+        if (NULL == p_db->p_cache)
+        {
+            fprintf(stderr, "[!] Running without the compression cache\n");
+        }
+    }
+
+    // Once files are stored as chunks the store is needed to read them, so
+    // it is opened whenever it exists and the server stops if it cannot be
+    verified_path_t * p_chunks_dir = f_ver_path_resolve(p_db->p_home_dir, CHUNKS_DIR);
+    bool b_chunks = ((p_args->b_chunks) || (NULL != p_chunks_dir));
+    f_destroy_path(&p_chunks_dir);
+    if (b_chunks)
+    {
+        p_db->p_chunks = chunks_init(p_db->p_home_dir, p_args->b_chunks);
+        if (NULL == p_db->p_chunks)
+        {
+            fprintf(stderr, "[!] Unable to open the chunk store\n");
+            goto cleanup_modules;
+        }
+    }
+
+    // Without the index every PUT by hash is answered as unknown and the
+    // clients send the data
+    p_db->p_dedup = dedup_init();
+    if (NULL == p_db->p_dedup)
+    {
+        fprintf(stderr, "[!] Running without the upload index\n");
+    }
+
+    start_server(p_db, p_args->port, p_args->timeout, p_args->net_workers,
+                 p_args->net_workers_max, p_args->acceptors, p_args->b_per_core);
 
+    // Shutdown writes the database on the calling thread
+    dedup_destroy(&p_db->p_dedup);
+    cache_destroy(&p_db->p_cache);
+    chunks_destroy(&p_db->p_chunks);
+    mem_destroy(&p_db->p_spill);
+    mem_destroy(&p_db->p_mem);
+    admit_destroy(&p_db->p_admit);
+    io_pool_destroy(&p_db->p_io);
+    shape_destroy(&p_db->p_shaper);
     db_shutdown(&p_db);
     args_destroy(&p_args);
     return 0;
 
+cleanup_modules:
+    cache_destroy(&p_db->p_cache);
+    mem_destroy(&p_db->p_spill);
+    mem_destroy(&p_db->p_mem);
+    admit_destroy(&p_db->p_admit);
+    io_pool_destroy(&p_db->p_io);
+cleanup_db:
+    shape_destroy(&p_db->p_shaper);
+    db_shutdown(&p_db);
 cleanup_args:
     args_destroy(&p_args);
 ret_null:
@@ -0,0 +1,193 @@
+#include <server_mem.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Reservations are only made for buffers too large for the arena blocks,
+// so a lock around the counters is cheap next to the allocations
+struct mem_budget
+{
+    uint64_t        limit;
+    uint64_t        used;
+    uint64_t        high_water;
+    uint64_t        waited;
+    uint64_t        refused;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // Signaled when bytes are given back
+};
+
+static bool fits(mem_budget_t * p_mem, size_t size);
+static void take(mem_budget_t * p_mem, size_t size);
+
+/*!
+ * @brief Create a memory budget
+ *
+ * @param limit Bytes of the budget. 0 only counts the bytes reserved
+ * @return mem_budget_t object if successful otherwise NULL
+ */
+mem_budget_t * mem_init(uint64_t limit)
+{
+    mem_budget_t * p_mem = (mem_budget_t *)malloc(sizeof(mem_budget_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_mem))
+    {
+        return NULL;
+    }
+    *p_mem = (mem_budget_t){
+        .limit      = limit,
+        .used       = 0,
+        .high_water = 0,
+        .waited     = 0,
+        .refused    = 0
+    };
+    pthread_mutex_init(&p_mem->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p_mem->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    return p_mem;
+}
+
+/*!
+ * @brief Free the memory budget. Every reservation must be given back
+ *
+ * @param pp_mem Double pointer to the memory budget
+ */
+void mem_destroy(mem_budget_t ** pp_mem)
+{
+    if ((NULL == pp_mem) || (NULL == *pp_mem))
+    {
+        return;
+    }
+    mem_budget_t * p_mem = *pp_mem;
+    pthread_cond_destroy(&p_mem->cond);
+    pthread_mutex_destroy(&p_mem->lock);
+    free(p_mem);
+    *pp_mem = NULL;
+}
+
+/*!
+ * @brief Reserve bytes of the budget before allocating them
+ *
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes to reserve
+ * @param wait_ms Milliseconds to wait for the bytes to fit
+ * @return true if the bytes were reserved otherwise false
+ */
+bool mem_reserve(mem_budget_t * p_mem, size_t size, uint32_t wait_ms)
+{
+    if (NULL == p_mem)
+    {
+        return true;
+    }
+
+    pthread_mutex_lock(&p_mem->lock);
+
+    // Waiting cannot make room for more than the whole budget
+    if ((0 != p_mem->limit) && (size > p_mem->limit))
+    {
+        p_mem->refused++;
+        pthread_mutex_unlock(&p_mem->lock);
+        return false;
+    }
+
+    if ((!fits(p_mem, size)) && (wait_ms > 0))
+    {
+        p_mem->waited++;
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+        deadline.tv_sec += (time_t)(wait_ms / 1000) + (deadline.tv_nsec / 1000000000L);
+        deadline.tv_nsec %= 1000000000L;
+
+        int result = 0;
+        while ((!fits(p_mem, size)) && (ETIMEDOUT != result))
+        {
+            result = pthread_cond_timedwait(&p_mem->cond, &p_mem->lock, &deadline);
+        }
+    }
+
+    bool b_reserved = fits(p_mem, size);
+    if (b_reserved)
+    {
+        take(p_mem, size);
+    }
+    else
+    {
+        p_mem->refused++;
+    }
+    pthread_mutex_unlock(&p_mem->lock);
+    return b_reserved;
+}
+
+/*!
+ * @brief Give back bytes reserved once they are freed
+ *
+ * @param p_mem Pointer to the memory budget. May be NULL
+ * @param size Number of bytes reserved
+ */
+void mem_release(mem_budget_t * p_mem, size_t size)
+{
+    if ((NULL == p_mem) || (0 == size))
+    {
+        return;
+    }
+    pthread_mutex_lock(&p_mem->lock);
+    p_mem->used -= size;
+    pthread_cond_broadcast(&p_mem->cond);
+    pthread_mutex_unlock(&p_mem->lock);
+}
+
+/*!
+ * @brief Read the metrics of the memory budget
+ *
+ * @param p_mem Pointer to the memory budget
+ * @param p_stats Receives the metrics
+ */
+void mem_stats(mem_budget_t * p_mem, mem_stats_t * p_stats)
+{
+    if ((NULL == p_mem) || (NULL == p_stats))
+    {
+        return;
+    }
+    pthread_mutex_lock(&p_mem->lock);
+    *p_stats = (mem_stats_t){
+        .limit      = p_mem->limit,
+        .used       = p_mem->used,
+        .high_water = p_mem->high_water,
+        .waited     = p_mem->waited,
+        .refused    = p_mem->refused
+    };
+    pthread_mutex_unlock(&p_mem->lock);
+}
+
+/*!
+ * @brief Check if the bytes fit in what is left of the budget. The caller
+ * holds the lock
+ *
+ * @param p_mem Pointer to the memory budget
+ * @param size Number of bytes
+ * @return true if the bytes fit otherwise false
+ */
+static bool fits(mem_budget_t * p_mem, size_t size)
+{
+    return (0 == p_mem->limit)
+           || ((p_mem->used <= p_mem->limit) && (size <= (p_mem->limit - p_mem->used)));
+}
+
+/*!
+ * @brief Count the bytes reserved and raise the high water mark. The caller
+ * holds the lock
+ *
+ * @param p_mem Pointer to the memory budget
+ * @param size Number of bytes
+ */
+static void take(mem_budget_t * p_mem, size_t size)
+{
+    p_mem->used += size;
+    if (p_mem->used > p_mem->high_water)
+    {
+        p_mem->high_water = p_mem->used;
+    }
+}
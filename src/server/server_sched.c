@@ -0,0 +1,1090 @@
+#include <server_sched.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The indices of a deque and the shared counters each get their own cache
+// line so the owner and the thieves do not invalidate each other's lines
+#define SCHED_ALIGN         64
+
+// Passes over the other deques a worker makes before it parks
+#define SCHED_STEAL_ROUNDS  2
+
+// One job in this many queued by a thread is timed for the queue wait,
+// reading the clock costs as much as queueing an empty job
+#define SCHED_WAIT_SAMPLE   16
+
+_Static_assert(0 == (SCHED_DEQUE_SIZE & (SCHED_DEQUE_SIZE - 1)),
+               "SCHED_DEQUE_SIZE must be a power of two");
+
+typedef struct sched_job
+{
+    void (* p_job)(void *);
+    void *              p_arg;
+    uint64_t            queued_ns;  // Time the job was queued, 0 if not timed
+    _Atomic(struct sched_job *) p_next; // Link in the injection queue
+} sched_job_t;
+
+// Chase-Lev deque with a fixed ring. Only the owner moves bottom, thieves
+// and the owner race on top with a CAS for the last job
+typedef struct
+{
+    _Alignas(SCHED_ALIGN) _Atomic int64_t   top;
+    _Alignas(SCHED_ALIGN) _Atomic int64_t   bottom;
+    _Atomic(sched_job_t *)                  jobs[SCHED_DEQUE_SIZE];
+} sched_deque_t;
+
+typedef struct
+{
+    sched_deque_t   deque;
+    sched_t *       p_sched;
+    uint32_t        seed;       // Picks the first victim to steal from
+    uint16_t        index;
+    pthread_t       thread;
+    // Metrics written by the worker alone and summed by the readers
+    _Alignas(SCHED_ALIGN) atomic_uint_fast64_t  taken;      // Jobs started
+    atomic_uint_fast64_t                        completed;  // Jobs finished
+    atomic_uint_fast64_t                        timed;      // Timed jobs started
+    atomic_uint_fast64_t                        wait_ns;    // Queue wait of the timed jobs
+    atomic_uint                                 blocked;    // Nested blocking calls
+} sched_worker_t;
+
+// Totals of the metrics of the workers
+typedef struct
+{
+    uint64_t    taken;
+    uint64_t    completed;
+    uint64_t    timed;
+    uint64_t    wait_ns;
+    uint16_t    blocked;
+} sched_totals_t;
+
+// State the controller carries from one interval to the next
+typedef struct
+{
+    sched_totals_t  totals;     // Totals at the end of the last interval
+    uint64_t        time_ns;
+    double          throughput; // Jobs finished per second in the last interval
+    int             move;       // Workers added, or removed if negative, last
+} sched_climb_t;
+
+struct sched
+{
+    uint16_t                                    min_workers;
+    uint16_t                                    max_workers;    // Workers allocated
+    _Atomic uint16_t                            started;        // Threads running, never shrinks
+    atomic_uint                                 active;         // Workers taking jobs
+    sched_worker_t *                            p_workers;
+    // Injection queue (Vyukov MPSC). Producers append with one exchange on
+    // the head, a single worker at a time takes from the tail
+    _Alignas(SCHED_ALIGN) _Atomic(sched_job_t *) p_inject_head;
+    atomic_size_t                               injected;   // Jobs in the queue
+    _Alignas(SCHED_ALIGN) sched_job_t *         p_inject_tail;
+    atomic_bool                                 b_taking;   // Owns the tail
+    sched_job_t                                 stub;
+    _Alignas(SCHED_ALIGN) atomic_size_t         pending;    // Queued or running
+    _Alignas(SCHED_ALIGN) atomic_uint           searching;  // Workers looking for jobs
+    atomic_uint                                 sleepers;   // Workers parked
+    atomic_bool                                 b_stop;
+    pthread_mutex_t                             park_lock;
+    pthread_cond_t                              park_cond;
+    pthread_cond_t                              idle_cond;  // pending dropped to 0
+    pthread_cond_t                              retire_cond;    // Workers above active
+    _Atomic(sched_t *)                          p_favoured;     // Yielded to in sched_cooperate
+    // Controller resizing the pool, only started if the bounds differ
+    bool                                        b_adaptive;
+    bool                                        b_ctl_stop;
+    pthread_t                                   controller;
+    pthread_mutex_t                             ctl_lock;
+    pthread_cond_t                              ctl_cond;
+};
+
+// Worker the current thread runs, NULL outside of the schedulers
+static _Thread_local sched_worker_t * p_self = NULL;
+
+// Jobs queued by the current thread, picks the jobs that are timed
+static _Thread_local uint32_t submitted = 0;
+
+static void * worker_loop(void * p_arg);
+static bool retire(sched_worker_t * p_worker);
+static void stop_workers(sched_t * p_sched, uint16_t started);
+static void * control_loop(void * p_arg);
+static void adapt(sched_t * p_sched, sched_climb_t * p_climb);
+static void resize(sched_t * p_sched, uint16_t workers);
+static void sum_workers(sched_t * p_sched, sched_totals_t * p_totals);
+static void add_relaxed(atomic_uint_fast64_t * p_counter, uint64_t value);
+static uint64_t now_ns(void);
+static sched_job_t * find_job(sched_worker_t * p_worker);
+static void run_job(sched_t * p_sched, sched_job_t * p_job);
+static void park(sched_t * p_sched);
+static void wake(sched_t * p_sched);
+static void wake_parked(sched_t * p_sched);
+static bool has_work(sched_t * p_sched);
+static void inject(sched_t * p_sched, sched_job_t * p_job);
+static sched_job_t * take_injected(sched_worker_t * p_worker);
+static sched_job_t * inject_pop(sched_t * p_sched);
+static bool deque_push(sched_deque_t * p_deque, sched_job_t * p_job);
+static sched_job_t * deque_pop(sched_deque_t * p_deque);
+static sched_job_t * deque_steal(sched_deque_t * p_deque);
+static uint32_t next_random(sched_worker_t * p_worker);
+
+/*!
+ * @brief Start the scheduler. The controller resizes the pool between the
+ * bounds provided, a scheduler whose bounds are equal keeps its size
+ *
+ * @param min_workers Workers started and kept, 1 to max_workers
+ * @param max_workers Workers the pool may grow to, up to SCHED_MAX_WORKERS
+ * @return sched_t object if successful otherwise NULL
+ */
+sched_t * sched_init(uint16_t min_workers, uint16_t max_workers)
+{
+    if ((0 == min_workers) || (min_workers > max_workers)
+        || (max_workers > SCHED_MAX_WORKERS))
+    {
+        goto ret_null;
+    }
+
+    sched_t * p_sched = (sched_t *)aligned_alloc(SCHED_ALIGN, sizeof(sched_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_sched))
+    {
+        goto ret_null;
+    }
+    // Every worker the pool may grow to is allocated upfront so thieves can
+    // read the deques without a lock while the pool is resized
+    sched_worker_t * p_workers = (sched_worker_t *)aligned_alloc(
+        SCHED_ALIGN, max_workers * sizeof(sched_worker_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_workers))
+    {
+        goto cleanup_sched;
+    }
+
+    p_sched->min_workers = min_workers;
+    p_sched->max_workers = max_workers;
+    atomic_init(&p_sched->started, 0);
+    atomic_init(&p_sched->active, min_workers);
+    p_sched->p_workers = p_workers;
+    atomic_init(&p_sched->stub.p_next, NULL);
+    atomic_init(&p_sched->p_inject_head, &p_sched->stub);
+    atomic_init(&p_sched->injected, 0);
+    atomic_init(&p_sched->b_taking, false);
+    p_sched->p_inject_tail = &p_sched->stub;
+    atomic_init(&p_sched->pending, 0);
+    atomic_init(&p_sched->searching, 0);
+    atomic_init(&p_sched->sleepers, 0);
+    atomic_init(&p_sched->b_stop, false);
+    pthread_mutex_init(&p_sched->park_lock, NULL);
+    pthread_cond_init(&p_sched->park_cond, NULL);
+    pthread_cond_init(&p_sched->idle_cond, NULL);
+    pthread_cond_init(&p_sched->retire_cond, NULL);
+    atomic_init(&p_sched->p_favoured, NULL);
+    p_sched->b_adaptive = (min_workers < max_workers);
+    p_sched->b_ctl_stop = false;
+    pthread_mutex_init(&p_sched->ctl_lock, NULL);
+    pthread_condattr_t ctl_attr;
+    pthread_condattr_init(&ctl_attr);
+    pthread_condattr_setclock(&ctl_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p_sched->ctl_cond, &ctl_attr);
+    pthread_condattr_destroy(&ctl_attr);
+
+    // Every deque is ready before the first worker may steal from it
+    for (uint16_t idx = 0; idx < max_workers; idx++)
+    {
+        sched_worker_t * p_worker = &p_workers[idx];
+        atomic_init(&p_worker->deque.top, 0);
+        atomic_init(&p_worker->deque.bottom, 0);
+        p_worker->p_sched = p_sched;
+        p_worker->seed = (uint32_t)idx * 2654435761u + 1;
+        p_worker->index = idx;
+        atomic_init(&p_worker->taken, 0);
+        atomic_init(&p_worker->completed, 0);
+        atomic_init(&p_worker->timed, 0);
+        atomic_init(&p_worker->wait_ns, 0);
+        atomic_init(&p_worker->blocked, 0);
+    }
+    // A worker is counted as started before its thread runs so that it is
+    // among the workers it steals from
+    for (uint16_t idx = 0; idx < min_workers; idx++)
+    {
+        atomic_store(&p_sched->started, (uint16_t)(idx + 1));
+        if (0 != pthread_create(&p_workers[idx].thread, NULL, worker_loop, &p_workers[idx]))
+        {
+            fprintf(stderr, "[!] Unable to start the scheduler workers\n");
+            stop_workers(p_sched, idx);
+            goto cleanup_workers;
+        }
+    }
+    if (p_sched->b_adaptive
+        && (0 != pthread_create(&p_sched->controller, NULL, control_loop, p_sched)))
+    {
+        fprintf(stderr, "[!] Unable to start the scheduler controller\n");
+        stop_workers(p_sched, min_workers);
+        goto cleanup_workers;
+    }
+    return p_sched;
+
+cleanup_workers:
+    pthread_cond_destroy(&p_sched->ctl_cond);
+    pthread_mutex_destroy(&p_sched->ctl_lock);
+    pthread_cond_destroy(&p_sched->retire_cond);
+    pthread_cond_destroy(&p_sched->idle_cond);
+    pthread_cond_destroy(&p_sched->park_cond);
+    pthread_mutex_destroy(&p_sched->park_lock);
+    free(p_workers);
+cleanup_sched:
+    free(p_sched);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Wait for the queued jobs to finish, stop the workers and free the
+ * scheduler
+ *
+ * @param pp_sched Double pointer to the scheduler
+ */
+void sched_destroy(sched_t ** pp_sched)
+{
+    if ((NULL == pp_sched) || (NULL == *pp_sched))
+    {
+        return;
+    }
+
+    sched_t * p_sched = *pp_sched;
+    sched_wait(p_sched);
+
+    // The controller is stopped first so the pool no longer changes size
+    if (p_sched->b_adaptive)
+    {
+        pthread_mutex_lock(&p_sched->ctl_lock);
+        p_sched->b_ctl_stop = true;
+        pthread_cond_signal(&p_sched->ctl_cond);
+        pthread_mutex_unlock(&p_sched->ctl_lock);
+        pthread_join(p_sched->controller, NULL);
+    }
+    stop_workers(p_sched, atomic_load(&p_sched->started));
+
+    pthread_cond_destroy(&p_sched->ctl_cond);
+    pthread_mutex_destroy(&p_sched->ctl_lock);
+    pthread_cond_destroy(&p_sched->retire_cond);
+    pthread_cond_destroy(&p_sched->idle_cond);
+    pthread_cond_destroy(&p_sched->park_cond);
+    pthread_mutex_destroy(&p_sched->park_lock);
+    free(p_sched->p_workers);
+    free(p_sched);
+    *pp_sched = NULL;
+}
+
+/*!
+ * @brief Queue the job. Called from a worker of the scheduler the job goes
+ * to the deque of that worker, otherwise to the injection queue.
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_job Function to run
+ * @param p_arg Argument passed to p_job
+ * @return OP_SUCCESS if the job was queued otherwise OP_FAILURE
+ */
+ret_codes_t sched_submit(sched_t * p_sched, void (* p_job)(void *), void * p_arg)
+{
+    if ((NULL == p_sched) || (NULL == p_job))
+    {
+        return OP_FAILURE;
+    }
+
+    sched_job_t * p_entry = (sched_job_t *)malloc(sizeof(sched_job_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_entry))
+    {
+        return OP_FAILURE;
+    }
+    *p_entry = (sched_job_t){
+        .p_job      = p_job,
+        .p_arg      = p_arg,
+        .queued_ns  = (0 == (submitted++ % SCHED_WAIT_SAMPLE)) ? now_ns() : 0
+    };
+    atomic_init(&p_entry->p_next, NULL);
+
+    atomic_fetch_add(&p_sched->pending, 1);
+    sched_worker_t * p_worker = p_self;
+    if ((NULL == p_worker) || (p_worker->p_sched != p_sched)
+        || (!deque_push(&p_worker->deque, p_entry)))
+    {
+        inject(p_sched, p_entry);
+    }
+    wake(p_sched);
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Block until every job queued, including the jobs queued by jobs,
+ * has finished
+ *
+ * @param p_sched Pointer to the scheduler
+ */
+void sched_wait(sched_t * p_sched)
+{
+    if (NULL == p_sched)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&p_sched->park_lock);
+    while (0 != atomic_load(&p_sched->pending))
+    {
+        pthread_cond_wait(&p_sched->idle_cond, &p_sched->park_lock);
+    }
+    pthread_mutex_unlock(&p_sched->park_lock);
+}
+
+/*!
+ * @brief Get the number of workers of the scheduler taking jobs
+ *
+ * @param p_sched Pointer to the scheduler
+ * @return Number of workers
+ */
+uint16_t sched_workers(sched_t * p_sched)
+{
+    return (NULL == p_sched) ? 0 : (uint16_t)atomic_load(&p_sched->active);
+}
+
+/*!
+ * @brief Estimate the jobs waiting for a worker as the jobs queued or running
+ * beyond the workers taking jobs. Unlike sched_stats it reads two counters
+ * only, so it is cheap enough to call for every request
+ *
+ * @param p_sched Pointer to the scheduler
+ * @return Number of jobs waiting
+ */
+size_t sched_queued(sched_t * p_sched)
+{
+    if (NULL == p_sched)
+    {
+        return 0;
+    }
+    size_t pending = atomic_load(&p_sched->pending);
+    size_t active = atomic_load(&p_sched->active);
+    return (pending > active) ? pending - active : 0;
+}
+
+/*!
+ * @brief Read the metrics of the scheduler
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_stats Receives the metrics
+ */
+void sched_stats(sched_t * p_sched, sched_stats_t * p_stats)
+{
+    if ((NULL == p_sched) || (NULL == p_stats))
+    {
+        return;
+    }
+
+    // pending counts the running jobs as well
+    sched_totals_t totals;
+    sum_workers(p_sched, &totals);
+    size_t pending = atomic_load(&p_sched->pending);
+    uint64_t running = totals.taken - totals.completed;
+    *p_stats = (sched_stats_t){
+        .workers    = sched_workers(p_sched),
+        .blocked    = totals.blocked,
+        .queued     = (pending > running) ? (size_t)(pending - running) : 0,
+        .completed  = totals.completed,
+        .wait_us    = (0 == totals.timed) ? 0 : (totals.wait_ns / totals.timed) / 1000
+    };
+}
+
+/*!
+ * @brief Make the workers of the scheduler give the CPU up in
+ * sched_cooperate while the favoured scheduler has more jobs than workers
+ *
+ * @param p_sched Pointer to the scheduler yielding
+ * @param p_favoured Pointer to the scheduler yielded to. May be NULL
+ */
+void sched_yield_to(sched_t * p_sched, sched_t * p_favoured)
+{
+    if (NULL != p_sched)
+    {
+        atomic_store(&p_sched->p_favoured, p_favoured);
+    }
+}
+
+/*!
+ * @brief Let the jobs of the favoured scheduler run first. Long jobs call it
+ * between chunks of their work. Does nothing outside of the workers of a
+ * scheduler that yields to another or while that one keeps up
+ */
+void sched_cooperate(void)
+{
+    if (NULL == p_self)
+    {
+        return;
+    }
+    sched_t * p_favoured = atomic_load_explicit(&p_self->p_sched->p_favoured,
+                                                memory_order_relaxed);
+    if ((NULL != p_favoured)
+        && (atomic_load(&p_favoured->pending) > atomic_load(&p_favoured->active)))
+    {
+        sched_yield();
+    }
+}
+
+/*!
+ * @brief Mark the calling worker as blocked in a system call, such as a
+ * read from a socket or the disk, until sched_block_end. Calls nest and do
+ * nothing outside of the workers of a scheduler
+ */
+void sched_block_begin(void)
+{
+    if (NULL != p_self)
+    {
+        atomic_fetch_add_explicit(&p_self->blocked, 1, memory_order_relaxed);
+    }
+}
+
+/*!
+ * @brief End the blocking call started with sched_block_begin
+ */
+void sched_block_end(void)
+{
+    if (NULL != p_self)
+    {
+        atomic_fetch_sub_explicit(&p_self->blocked, 1, memory_order_relaxed);
+    }
+}
+
+/*!
+ * @brief Thread of a worker. Runs jobs until the scheduler stops
+ *
+ * @param p_arg Pointer to the sched_worker_t
+ * @return NULL
+ */
+static void * worker_loop(void * p_arg)
+{
+    sched_worker_t * p_worker = (sched_worker_t *)p_arg;
+    sched_t * p_sched = p_worker->p_sched;
+    p_self = p_worker;
+
+    for (;;)
+    {
+        // Workers above the size the controller set stop taking jobs
+        if (p_worker->index >= atomic_load(&p_sched->active))
+        {
+            if (!retire(p_worker))
+            {
+                break;
+            }
+            continue;
+        }
+
+        sched_job_t * p_job = find_job(p_worker);
+        if (NULL != p_job)
+        {
+            run_job(p_sched, p_job);
+            continue;
+        }
+        if (atomic_load(&p_sched->b_stop))
+        {
+            break;
+        }
+        park(p_sched);
+    }
+
+    p_self = NULL;
+    return NULL;
+}
+
+/*!
+ * @brief Hand the jobs of a worker the pool shrank below back to the others
+ * and wait until the pool grows again or the scheduler stops
+ *
+ * @param p_worker Pointer to the worker
+ * @return true if the worker takes jobs again, false if the scheduler stops
+ */
+static bool retire(sched_worker_t * p_worker)
+{
+    sched_t * p_sched = p_worker->p_sched;
+    sched_job_t * p_job = NULL;
+    while (NULL != (p_job = deque_pop(&p_worker->deque)))
+    {
+        inject(p_sched, p_job);
+    }
+
+    // The worker may have been woken for a job it will not run
+    wake_parked(p_sched);
+
+    pthread_mutex_lock(&p_sched->park_lock);
+    while ((p_worker->index >= atomic_load(&p_sched->active))
+           && (!atomic_load(&p_sched->b_stop)))
+    {
+        pthread_cond_wait(&p_sched->retire_cond, &p_sched->park_lock);
+    }
+    bool b_run = !atomic_load(&p_sched->b_stop);
+    pthread_mutex_unlock(&p_sched->park_lock);
+    return b_run;
+}
+
+/*!
+ * @brief Stop the workers and wait for their threads to exit
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param started Number of workers whose thread was started
+ */
+static void stop_workers(sched_t * p_sched, uint16_t started)
+{
+    pthread_mutex_lock(&p_sched->park_lock);
+    atomic_store(&p_sched->b_stop, true);
+    pthread_cond_broadcast(&p_sched->park_cond);
+    pthread_cond_broadcast(&p_sched->retire_cond);
+    pthread_mutex_unlock(&p_sched->park_lock);
+    for (uint16_t idx = 0; idx < started; idx++)
+    {
+        pthread_join(p_sched->p_workers[idx].thread, NULL);
+    }
+}
+
+/*!
+ * @brief Thread of the controller. Adapts the size of the pool every
+ * SCHED_ADAPT_MS until the scheduler is destroyed
+ *
+ * @param p_arg Pointer to the scheduler
+ * @return NULL
+ */
+static void * control_loop(void * p_arg)
+{
+    sched_t * p_sched = (sched_t *)p_arg;
+    sched_climb_t climb = {
+        .time_ns    = now_ns(),
+        .throughput = 0.0,
+        .move       = 0
+    };
+    sum_workers(p_sched, &climb.totals);
+
+    pthread_mutex_lock(&p_sched->ctl_lock);
+    while (!p_sched->b_ctl_stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (SCHED_ADAPT_MS % 1000) * 1000000L;
+        deadline.tv_sec += (SCHED_ADAPT_MS / 1000) + (deadline.tv_nsec / 1000000000L);
+        deadline.tv_nsec %= 1000000000L;
+
+        int result = 0;
+        while ((!p_sched->b_ctl_stop) && (ETIMEDOUT != result))
+        {
+            result = pthread_cond_timedwait(&p_sched->ctl_cond, &p_sched->ctl_lock, &deadline);
+        }
+        if (p_sched->b_ctl_stop)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&p_sched->ctl_lock);
+        adapt(p_sched, &climb);
+        pthread_mutex_lock(&p_sched->ctl_lock);
+    }
+    pthread_mutex_unlock(&p_sched->ctl_lock);
+    return NULL;
+}
+
+/*!
+ * @brief Decide the size of the pool for the next interval from the metrics
+ * of the last one
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_climb State of the controller, updated for the next interval
+ */
+static void adapt(sched_t * p_sched, sched_climb_t * p_climb)
+{
+    sched_totals_t totals;
+    sum_workers(p_sched, &totals);
+    uint64_t time_ns = now_ns();
+    uint64_t elapsed_ns = time_ns - p_climb->time_ns;
+    uint64_t finished = totals.completed - p_climb->totals.completed;
+    uint64_t taken = totals.taken - p_climb->totals.taken;
+    uint64_t timed = totals.timed - p_climb->totals.timed;
+    double throughput = ((double)finished * 1e9) / (double)((0 == elapsed_ns) ? 1 : elapsed_ns);
+    uint64_t wait_us = (0 == timed) ? 0
+                                    : ((totals.wait_ns - p_climb->totals.wait_ns) / timed) / 1000;
+
+    size_t pending = atomic_load(&p_sched->pending);
+    uint64_t running = totals.taken - totals.completed;
+    size_t queued = (pending > running) ? (size_t)(pending - running) : 0;
+    uint16_t workers = sched_workers(p_sched);
+    double gain = SCHED_ADAPT_GAIN / 100.0;
+    int direction = (p_climb->move > 0) ? 1 : ((p_climb->move < 0) ? -1 : 0);
+
+    int move = 0;
+    if (0 == queued)
+    {
+        // Nothing waits, the workers parked for want of jobs are given back
+        move = (0 != atomic_load(&p_sched->sleepers)) ? -1 : 0;
+    }
+    else if ((0 == finished) && (totals.blocked >= workers))
+    {
+        // Every worker is stuck in a system call while jobs queue up. The
+        // pool grows by a quarter so a burst of slow clients is absorbed in
+        // a few intervals
+        move = (workers / 4) + 1;
+    }
+    else if ((0 == taken) || (wait_us >= SCHED_WAIT_US))
+    {
+        // Hill climbing: a change that raised the throughput is repeated
+        // and one that lowered it is undone. While the throughput holds
+        // another worker can only help if some are blocked
+        if ((0 != direction) && (throughput > (p_climb->throughput * (1.0 + gain))))
+        {
+            move = direction;
+        }
+        else if ((0 != direction) && (throughput < (p_climb->throughput * (1.0 - gain))))
+        {
+            move = -direction;
+        }
+        else
+        {
+            move = (0 != totals.blocked) ? 1 : 0;
+        }
+    }
+
+    int target = (int)workers + move;
+    if (target < (int)p_sched->min_workers)
+    {
+        target = p_sched->min_workers;
+    }
+    if (target > (int)p_sched->max_workers)
+    {
+        target = p_sched->max_workers;
+    }
+    if (target != (int)workers)
+    {
+        resize(p_sched, (uint16_t)target);
+        debug_print("[SCHED] %u -> %u workers (%zu queued, %u blocked, %.0f jobs/s)\n",
+                    workers, sched_workers(p_sched), queued, totals.blocked, throughput);
+    }
+
+    *p_climb = (sched_climb_t){
+        .totals     = totals,
+        .time_ns    = time_ns,
+        .throughput = throughput,
+        .move       = (int)sched_workers(p_sched) - (int)workers
+    };
+}
+
+/*!
+ * @brief Set the number of workers taking jobs. Threads are started the
+ * first time the pool reaches their index and wait once retired, so a pool
+ * that shrinks and grows again reuses them
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param workers Number of workers, min_workers to max_workers
+ */
+static void resize(sched_t * p_sched, uint16_t workers)
+{
+    uint16_t started = atomic_load(&p_sched->started);
+    for (; started < workers; started++)
+    {
+        sched_worker_t * p_worker = &p_sched->p_workers[started];
+        atomic_store(&p_sched->started, (uint16_t)(started + 1));
+        if (0 != pthread_create(&p_worker->thread, NULL, worker_loop, p_worker))
+        {
+            fprintf(stderr, "[!] Unable to add a scheduler worker\n");
+            atomic_store(&p_sched->started, started);
+            workers = started;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&p_sched->park_lock);
+    atomic_store(&p_sched->active, workers);
+    pthread_cond_broadcast(&p_sched->retire_cond);
+    pthread_mutex_unlock(&p_sched->park_lock);
+}
+
+/*!
+ * @brief Sum the metrics of the workers whose thread was started
+ *
+ * @param p_sched Pointer to the scheduler
+ * @param p_totals Receives the sums
+ */
+static void sum_workers(sched_t * p_sched, sched_totals_t * p_totals)
+{
+    *p_totals = (sched_totals_t){ 0 };
+    uint16_t started = atomic_load(&p_sched->started);
+    for (uint16_t idx = 0; idx < started; idx++)
+    {
+        sched_worker_t * p_worker = &p_sched->p_workers[idx];
+        p_totals->taken += atomic_load_explicit(&p_worker->taken, memory_order_relaxed);
+        p_totals->completed += atomic_load_explicit(&p_worker->completed, memory_order_relaxed);
+        p_totals->timed += atomic_load_explicit(&p_worker->timed, memory_order_relaxed);
+        p_totals->wait_ns += atomic_load_explicit(&p_worker->wait_ns, memory_order_relaxed);
+        if (0 != atomic_load_explicit(&p_worker->blocked, memory_order_relaxed))
+        {
+            p_totals->blocked++;
+        }
+    }
+}
+
+/*!
+ * @brief Find the next job of the worker: its own deque first, then the
+ * injection queue, then the deques of the other workers
+ *
+ * @param p_worker Pointer to the worker
+ * @return Job to run or NULL if none was found
+ */
+static sched_job_t * find_job(sched_worker_t * p_worker)
+{
+    sched_job_t * p_job = deque_pop(&p_worker->deque);
+    if (NULL != p_job)
+    {
+        return p_job;
+    }
+
+    // Producers skip waking a parked worker while one is searching
+    sched_t * p_sched = p_worker->p_sched;
+    atomic_fetch_add(&p_sched->searching, 1);
+    p_job = take_injected(p_worker);
+
+    // Thieves start at a random victim so they do not all hit the same deque.
+    // Retired workers are passed over quickly, their deques are empty
+    uint16_t count = atomic_load_explicit(&p_sched->started, memory_order_acquire);
+    for (uint32_t round = 0; (NULL == p_job) && (round < SCHED_STEAL_ROUNDS); round++)
+    {
+        uint32_t start = next_random(p_worker) % count;
+        for (uint32_t idx = 0; (NULL == p_job) && (idx < count); idx++)
+        {
+            sched_worker_t * p_victim = &p_sched->p_workers[(start + idx) % count];
+            if (p_victim != p_worker)
+            {
+                p_job = deque_steal(&p_victim->deque);
+            }
+        }
+    }
+    // Producers may have skipped waking a worker for jobs queued while this
+    // one searched. The last searcher to find a job hands the search over
+    unsigned int searching = atomic_fetch_sub(&p_sched->searching, 1);
+    if ((NULL != p_job) && (1 == searching))
+    {
+        wake_parked(p_sched);
+    }
+    return p_job;
+}
+
+/*!
+ * @brief Run the job and free it. The last job to finish wakes the threads
+ * waiting in sched_wait
+ */
+static void run_job(sched_t * p_sched, sched_job_t * p_job)
+{
+    sched_worker_t * p_worker = p_self;
+    if (0 != p_job->queued_ns)
+    {
+        uint64_t started_ns = now_ns();
+        add_relaxed(&p_worker->wait_ns,
+                    (started_ns > p_job->queued_ns) ? started_ns - p_job->queued_ns : 0);
+        add_relaxed(&p_worker->timed, 1);
+    }
+    add_relaxed(&p_worker->taken, 1);
+
+    p_job->p_job(p_job->p_arg);
+    free(p_job);
+    add_relaxed(&p_worker->completed, 1);
+
+    if (1 == atomic_fetch_sub(&p_sched->pending, 1))
+    {
+        pthread_mutex_lock(&p_sched->park_lock);
+        pthread_cond_broadcast(&p_sched->idle_cond);
+        pthread_mutex_unlock(&p_sched->park_lock);
+    }
+}
+
+/*!
+ * @brief Sleep until a job is queued. The worker counts itself as parked
+ * before looking for jobs one last time, and producers look at the count
+ * after queueing, so either the worker sees the job or the producer sees
+ * the worker.
+ */
+static void park(sched_t * p_sched)
+{
+    pthread_mutex_lock(&p_sched->park_lock);
+    atomic_fetch_add(&p_sched->sleepers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if ((!has_work(p_sched)) && (!atomic_load(&p_sched->b_stop)))
+    {
+        pthread_cond_wait(&p_sched->park_cond, &p_sched->park_lock);
+    }
+    atomic_fetch_sub(&p_sched->sleepers, 1);
+    pthread_mutex_unlock(&p_sched->park_lock);
+}
+
+/*!
+ * @brief Wake a parked worker for a job that was just queued, unless a
+ * worker that is searching will find it
+ */
+static void wake(sched_t * p_sched)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 != atomic_load(&p_sched->searching))
+    {
+        return;
+    }
+    wake_parked(p_sched);
+}
+
+/*!
+ * @brief Wake a parked worker if there is one
+ */
+static void wake_parked(sched_t * p_sched)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 == atomic_load(&p_sched->sleepers))
+    {
+        return;
+    }
+    pthread_mutex_lock(&p_sched->park_lock);
+    pthread_cond_signal(&p_sched->park_cond);
+    pthread_mutex_unlock(&p_sched->park_lock);
+}
+
+/*!
+ * @brief Check whether any job is queued anywhere
+ */
+static bool has_work(sched_t * p_sched)
+{
+    if (0 != atomic_load(&p_sched->injected))
+    {
+        return true;
+    }
+    uint16_t started = atomic_load(&p_sched->started);
+    for (uint16_t idx = 0; idx < started; idx++)
+    {
+        sched_deque_t * p_deque = &p_sched->p_workers[idx].deque;
+        if (atomic_load(&p_deque->top) < atomic_load(&p_deque->bottom))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief Append the job to the injection queue
+ */
+static void inject(sched_t * p_sched, sched_job_t * p_job)
+{
+    atomic_store_explicit(&p_job->p_next, NULL, memory_order_relaxed);
+    atomic_fetch_add(&p_sched->injected, 1);
+    sched_job_t * p_prev = atomic_exchange_explicit(&p_sched->p_inject_head,
+                                                    p_job,
+                                                    memory_order_acq_rel);
+    atomic_store_explicit(&p_prev->p_next, p_job, memory_order_release);
+}
+
+/*!
+ * @brief Take the worker's share of the injection queue. The oldest job is
+ * returned and the others are moved to the deque of the worker where idle
+ * workers can steal them. Only one worker takes at a time, the others look
+ * elsewhere meanwhile. The worker is searching so a parked worker is woken
+ * once it found its job
+ *
+ * @param p_worker Pointer to the worker taking the jobs
+ * @return Oldest job or NULL if none was taken
+ */
+static sched_job_t * take_injected(sched_worker_t * p_worker)
+{
+    sched_t * p_sched = p_worker->p_sched;
+    size_t injected = atomic_load_explicit(&p_sched->injected, memory_order_relaxed);
+    if ((0 == injected)
+        || atomic_exchange_explicit(&p_sched->b_taking, true, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    // An even share leaves jobs for the other workers and at most half of the
+    // deque is filled so pushing cannot fail
+    size_t share = (injected / atomic_load_explicit(&p_sched->active,
+                                                    memory_order_relaxed)) + 1;
+    if (share > (SCHED_DEQUE_SIZE / 2))
+    {
+        share = SCHED_DEQUE_SIZE / 2;
+    }
+
+    sched_job_t * p_first = inject_pop(p_sched);
+    for (size_t taken = 1; (NULL != p_first) && (taken < share); taken++)
+    {
+        sched_job_t * p_job = inject_pop(p_sched);
+        if (NULL == p_job)
+        {
+            break;
+        }
+        if (!deque_push(&p_worker->deque, p_job))
+        {
+            inject(p_sched, p_job);
+            break;
+        }
+    }
+    atomic_store_explicit(&p_sched->b_taking, false, memory_order_release);
+    return p_first;
+}
+
+/*!
+ * @brief Take the oldest job of the injection queue. Called by the worker
+ * holding b_taking
+ *
+ * @return Job or NULL if the queue is empty or a producer has not finished
+ * linking its job yet
+ */
+static sched_job_t * inject_pop(sched_t * p_sched)
+{
+    sched_job_t * p_tail = p_sched->p_inject_tail;
+    sched_job_t * p_next = atomic_load_explicit(&p_tail->p_next, memory_order_acquire);
+
+    // The stub only marks the queue as empty, skip over it
+    if (&p_sched->stub == p_tail)
+    {
+        if (NULL == p_next)
+        {
+            return NULL;
+        }
+        p_sched->p_inject_tail = p_next;
+        p_tail = p_next;
+        p_next = atomic_load_explicit(&p_tail->p_next, memory_order_acquire);
+    }
+
+    if (NULL == p_next)
+    {
+        // The tail is the last job. It is only taken once the stub is
+        // queued behind it so the head never points to a job that ran
+        if (p_tail != atomic_load_explicit(&p_sched->p_inject_head, memory_order_acquire))
+        {
+            return NULL;
+        }
+        inject(p_sched, &p_sched->stub);
+        atomic_fetch_sub(&p_sched->injected, 1);
+        p_next = atomic_load_explicit(&p_tail->p_next, memory_order_acquire);
+        if (NULL == p_next)
+        {
+            return NULL;
+        }
+    }
+
+    p_sched->p_inject_tail = p_next;
+    atomic_fetch_sub(&p_sched->injected, 1);
+    return p_tail;
+}
+
+/*!
+ * @brief Push the job at the bottom of the deque. Only the owner pushes
+ *
+ * @return false if the deque is full otherwise true
+ */
+static bool deque_push(sched_deque_t * p_deque, sched_job_t * p_job)
+{
+    int64_t bottom = atomic_load_explicit(&p_deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&p_deque->top, memory_order_acquire);
+    if ((bottom - top) >= SCHED_DEQUE_SIZE)
+    {
+        return false;
+    }
+    atomic_store_explicit(&p_deque->jobs[bottom & (SCHED_DEQUE_SIZE - 1)],
+                          p_job,
+                          memory_order_relaxed);
+    atomic_store_explicit(&p_deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+/*!
+ * @brief Pop the job at the bottom of the deque. Only the owner pops, it
+ * races the thieves with a CAS on top when a single job is left
+ *
+ * @return Job or NULL if the deque is empty
+ */
+static sched_job_t * deque_pop(sched_deque_t * p_deque)
+{
+    int64_t bottom = atomic_load_explicit(&p_deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&p_deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&p_deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&p_deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    sched_job_t * p_job = atomic_load_explicit(&p_deque->jobs[bottom & (SCHED_DEQUE_SIZE - 1)],
+                                               memory_order_relaxed);
+    if (top == bottom)
+    {
+        if (!atomic_compare_exchange_strong_explicit(&p_deque->top,
+                                                     &top,
+                                                     top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+        {
+            p_job = NULL;
+        }
+        atomic_store_explicit(&p_deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return p_job;
+}
+
+/*!
+ * @brief Steal the job at the top of the deque
+ *
+ * @return Job or NULL if the deque is empty or another thief won the job
+ */
+static sched_job_t * deque_steal(sched_deque_t * p_deque)
+{
+    int64_t top = atomic_load_explicit(&p_deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&p_deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    sched_job_t * p_job = atomic_load_explicit(&p_deque->jobs[top & (SCHED_DEQUE_SIZE - 1)],
+                                               memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&p_deque->top,
+                                                 &top,
+                                                 top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return p_job;
+}
+
+/*!
+ * @brief xorshift32 step of the seed of the worker
+ */
+static uint32_t next_random(sched_worker_t * p_worker)
+{
+    uint32_t value = p_worker->seed;
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    p_worker->seed = value;
+    return value;
+}
+
+/*!
+ * @brief Add to a counter only the calling worker writes. A load and a
+ * store are enough and cheaper than a locked add
+ */
+static void add_relaxed(atomic_uint_fast64_t * p_counter, uint64_t value)
+{
+    atomic_store_explicit(p_counter,
+                          atomic_load_explicit(p_counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+/*!
+ * @brief Monotonic time in nanoseconds
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE // sched_getcpu
+#include <server_session.h>
+#include <hashtable.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Shards are cache line aligned so that the lock of one shard never shares
+// a line with its neighbours
+#define SHARD_ALIGN 64
+
+typedef struct
+{
+    uint32_t    session_id;
+    time_t      last_used;
+} session_t;
+
+typedef struct
+{
+    _Alignas(SHARD_ALIGN) pthread_mutex_t lock;
+    htable_t *          p_table;    // session_id -> session_t
+} session_shard_t;
+
+struct sessions
+{
+    uint32_t            shard_count;
+    session_shard_t *   p_shards;
+};
+
+static uint32_t local_shard(sessions_t * p_sessions);
+static bool random_id(sessions_t * p_sessions, uint32_t shard, uint32_t * p_id);
+static uint64_t session_hash_callback(void * key);
+static htable_match_t session_compare_callback(void * left_key, void * right_key);
+static void session_free_callback(void * value);
+
+/*!
+ * @brief Create an empty session table
+ *
+ * @param shards Number of shards. 0 creates one shard per CPU
+ * @return sessions_t object if successful otherwise NULL
+ */
+sessions_t * sessions_init(uint32_t shards)
+{
+    if (0 == shards)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        shards = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+    if (shards > SESSION_MAX_SHARDS)
+    {
+        shards = SESSION_MAX_SHARDS;
+    }
+
+    sessions_t * p_sessions = (sessions_t *)calloc(1, sizeof(sessions_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_sessions))
+    {
+        goto ret_null;
+    }
+    session_shard_t * p_shards = (session_shard_t *)aligned_alloc(
+        SHARD_ALIGN, shards * sizeof(session_shard_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_shards))
+    {
+        goto cleanup_sessions;
+    }
+    *p_sessions = (sessions_t){
+        .shard_count    = shards,
+        .p_shards       = p_shards
+    };
+
+    for (uint32_t idx = 0; idx < shards; idx++)
+    {
+        p_shards[idx].p_table = htable_create(session_hash_callback,
+                                              session_compare_callback,
+                                              NULL,
+                                              session_free_callback);
+        if (NULL == p_shards[idx].p_table)
+        {
+            p_sessions->shard_count = idx;
+            sessions_destroy(&p_sessions);
+            goto ret_null;
+        }
+        pthread_mutex_init(&p_shards[idx].lock, NULL);
+    }
+    return p_sessions;
+
+cleanup_sessions:
+    free(p_sessions);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Free the session table and every session in it
+ *
+ * @param pp_sessions Double pointer to the session table
+ */
+void sessions_destroy(sessions_t ** pp_sessions)
+{
+    if ((NULL == pp_sessions) || (NULL == *pp_sessions))
+    {
+        return;
+    }
+
+    sessions_t * p_sessions = *pp_sessions;
+    for (uint32_t idx = 0; idx < p_sessions->shard_count; idx++)
+    {
+        session_shard_t * p_shard = &p_sessions->p_shards[idx];
+        htable_destroy(p_shard->p_table, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+        pthread_mutex_destroy(&p_shard->lock);
+    }
+    free(p_sessions->p_shards);
+    free(p_sessions);
+    *pp_sessions = NULL;
+}
+
+/*!
+ * @brief Create a session in the shard of the CPU the caller runs on
+ *
+ * @param p_sessions Pointer to the session table
+ * @param p_session Pointer to save the ID of the new session to
+ * @return OP_SUCCESS if the session was created otherwise OP_FAILURE
+ */
+ret_codes_t sessions_create(sessions_t * p_sessions, uint32_t * p_session)
+{
+    if ((NULL == p_sessions) || (NULL == p_session))
+    {
+        return OP_FAILURE;
+    }
+
+    session_t * p_entry = (session_t *)malloc(sizeof(session_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_entry))
+    {
+        return OP_FAILURE;
+    }
+    *p_entry = (session_t){
+        .session_id = 0,
+        .last_used  = time(NULL)
+    };
+
+    uint32_t shard = local_shard(p_sessions);
+    session_shard_t * p_shard = &p_sessions->p_shards[shard];
+    pthread_mutex_lock(&p_shard->lock);
+    do
+    {
+        if (!random_id(p_sessions, shard, &p_entry->session_id))
+        {
+            pthread_mutex_unlock(&p_shard->lock);
+            free(p_entry);
+            return OP_FAILURE;
+        }
+    } while (htable_key_exists(p_shard->p_table, &p_entry->session_id));
+    htable_set(p_shard->p_table, &p_entry->session_id, p_entry);
+    pthread_mutex_unlock(&p_shard->lock);
+
+    *p_session = p_entry->session_id;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Mark the session as used now if it has not been idle for longer
+ * than the timeout. A session that has is removed.
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ * @param timeout Seconds the session may stay idle
+ * @retval OP_SUCCESS The session is active
+ * @retval OP_SESSION_ERROR The session does not exist or has expired
+ */
+ret_codes_t sessions_renew(sessions_t * p_sessions,
+                           uint32_t session_id,
+                           time_t timeout)
+{
+    if (NULL == p_sessions)
+    {
+        return OP_SESSION_ERROR;
+    }
+
+    session_shard_t * p_shard = &p_sessions->p_shards[sessions_shard(p_sessions, session_id)];
+    ret_codes_t res = OP_SUCCESS;
+    time_t current_time = time(NULL);
+
+    pthread_mutex_lock(&p_shard->lock);
+    session_t * p_entry = (session_t *)htable_get(p_shard->p_table, &session_id);
+    if (NULL == p_entry)
+    {
+        debug_print("[SESSION] Session [%u] is no longer active\n", session_id);
+        res = OP_SESSION_ERROR;
+    }
+    // If the elapsed time is greater than the timeout, expire the session
+    else if ((current_time - p_entry->last_used) > timeout)
+    {
+        debug_print("[SESSION] Session [%u] has expired\n", session_id);
+        free(htable_del(p_shard->p_table, &session_id, HT_FREE_PTR_FALSE));
+        res = OP_SESSION_ERROR;
+    }
+    else
+    {
+        p_entry->last_used = current_time;
+    }
+    pthread_mutex_unlock(&p_shard->lock);
+    return res;
+}
+
+/*!
+ * @brief Remove the session if it exists
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ */
+void sessions_expire(sessions_t * p_sessions, uint32_t session_id)
+{
+    if ((NULL == p_sessions) || (0 == session_id))
+    {
+        return;
+    }
+
+    session_shard_t * p_shard = &p_sessions->p_shards[sessions_shard(p_sessions, session_id)];
+    pthread_mutex_lock(&p_shard->lock);
+    free(htable_del(p_shard->p_table, &session_id, HT_FREE_PTR_FALSE));
+    pthread_mutex_unlock(&p_shard->lock);
+}
+
+/*!
+ * @brief Get the shard a session ID belongs to
+ *
+ * @param p_sessions Pointer to the session table
+ * @param session_id ID of the session
+ * @return Index of the shard
+ */
+uint32_t sessions_shard(sessions_t * p_sessions, uint32_t session_id)
+{
+    return session_id % p_sessions->shard_count;
+}
+
+/*!
+ * @brief Get the number of shards of the session table
+ *
+ * @param p_sessions Pointer to the session table
+ * @return Number of shards
+ */
+uint32_t sessions_shard_count(sessions_t * p_sessions)
+{
+    return (NULL == p_sessions) ? 0 : p_sessions->shard_count;
+}
+
+/*!
+ * @brief Get the shard of the CPU the caller runs on
+ */
+static uint32_t local_shard(sessions_t * p_sessions)
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+    {
+        return 0;
+    }
+    return (uint32_t)cpu % p_sessions->shard_count;
+}
+
+/*!
+ * @brief Pick a random nonzero session ID that belongs to the shard
+ *
+ * @return false if no random bytes were available otherwise true
+ */
+static bool random_id(sessions_t * p_sessions, uint32_t shard, uint32_t * p_id)
+{
+    for (;;)
+    {
+        uint32_t random = 0;
+        if (1 != RAND_bytes((unsigned char *)&random, sizeof(random)))
+        {
+            return false;
+        }
+
+        // Move the ID to the shard, IDs that would wrap are drawn again
+        uint64_t id = (uint64_t)random - (random % p_sessions->shard_count) + shard;
+        if ((0 != id) && (id <= UINT32_MAX))
+        {
+            *p_id = (uint32_t)id;
+            return true;
+        }
+    }
+}
+
+/*!
+ * @brief Callback is used for the session tables
+ */
+static uint64_t session_hash_callback(void * key)
+{
+    uint64_t hash = htable_get_init_hash();
+    htable_hash_key(&hash, key, sizeof(uint32_t));
+    return hash;
+}
+
+/*!
+ * @brief Callback is used for the session tables
+ *
+ * @return If the two session IDs match
+ */
+static htable_match_t session_compare_callback(void * left_key, void * right_key)
+{
+    if (*(uint32_t *)left_key == *(uint32_t *)right_key)
+    {
+        return HT_MATCH_TRUE;
+    }
+    return HT_MATCH_FALSE;
+}
+
+/*!
+ * @brief Callback is used for the session tables. The key is part of the
+ * session so only the session is freed
+ */
+static void session_free_callback(void * value)
+{
+    free(value);
+}
@@ -0,0 +1,453 @@
+#include <server_shape.h>
+#include <server_sched.h>
+#include <hashtable.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_SEC  1000000000ULL
+
+struct shape_bucket
+{
+    pthread_mutex_t     lock;
+    _Atomic uint64_t    rate;           // Bytes per second, 0 for no limit
+    int64_t             tokens;         // Below 0 while the bucket is in debt
+    uint64_t            refilled_ns;    // Time the tokens were last added
+    char *              p_username;     // User owning the bucket, NULL for the others
+};
+
+struct shaper
+{
+    shape_limits_t      limits;
+    shape_bucket_t      server;
+    pthread_mutex_t     users_lock;
+    htable_t *          p_users;        // username -> shape_bucket_t
+};
+
+struct shape_flow
+{
+    shaper_t *                  p_shaper;
+    shape_bucket_t              connection;
+    _Atomic(shape_bucket_t *)   p_user; // NULL until a request authenticates
+};
+
+static void bucket_init(shape_bucket_t * p_bucket, uint64_t rate);
+static void bucket_destroy(shape_bucket_t * p_bucket);
+static void bucket_set_rate(shape_bucket_t * p_bucket, uint64_t rate);
+static bool bucket_limited(shape_bucket_t * p_bucket);
+static uint64_t bucket_take(shape_bucket_t * p_bucket, size_t bytes, uint64_t now_ns);
+static int64_t bucket_burst(uint64_t rate);
+static uint64_t clock_ns(void);
+static void sleep_ns(uint64_t wait_ns);
+static uint64_t shape_hash_callback(void * key);
+static htable_match_t shape_compare_callback(void * left_key, void * right_key);
+static void shape_free_callback(void * value);
+
+/*!
+ * @brief Create the shaper of the server
+ *
+ * @param p_limits Pointer to the limits
+ * @return shaper_t object if successful otherwise NULL
+ */
+shaper_t * shape_init(const shape_limits_t * p_limits)
+{
+    if (NULL == p_limits)
+    {
+        goto ret_null;
+    }
+
+    shaper_t * p_shaper = (shaper_t *)calloc(1, sizeof(shaper_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_shaper))
+    {
+        goto ret_null;
+    }
+    p_shaper->p_users = htable_create(shape_hash_callback,
+                                      shape_compare_callback,
+                                      NULL,
+                                      shape_free_callback);
+    if (NULL == p_shaper->p_users)
+    {
+        goto cleanup_shaper;
+    }
+    p_shaper->limits = *p_limits;
+    bucket_init(&p_shaper->server, p_limits->server);
+    pthread_mutex_init(&p_shaper->users_lock, NULL);
+    return p_shaper;
+
+cleanup_shaper:
+    free(p_shaper);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Free the shaper and the buckets of the users. The flows of the
+ * connections must be destroyed first
+ *
+ * @param pp_shaper Double pointer to the shaper
+ */
+void shape_destroy(shaper_t ** pp_shaper)
+{
+    if ((NULL == pp_shaper) || (NULL == *pp_shaper))
+    {
+        return;
+    }
+
+    shaper_t * p_shaper = *pp_shaper;
+    htable_destroy(p_shaper->p_users, HT_FREE_PTR_FALSE, HT_FREE_PTR_TRUE);
+    pthread_mutex_destroy(&p_shaper->users_lock);
+    bucket_destroy(&p_shaper->server);
+    free(p_shaper);
+    *pp_shaper = NULL;
+}
+
+/*!
+ * @brief Get the bucket of the user, created on first use. The bucket lives
+ * as long as the shaper and follows changes of the limit of the user
+ *
+ * @param p_shaper Pointer to the shaper. May be NULL
+ * @param p_user Pointer to the authenticated user
+ * @return Bucket of the user or NULL if the user has no limit
+ */
+shape_bucket_t * shape_user(shaper_t * p_shaper, const user_account_t * p_user)
+{
+    if ((NULL == p_shaper) || (NULL == p_user) || (NULL == p_user->p_username))
+    {
+        return NULL;
+    }
+
+    uint64_t rate = p_user->rate;
+    if ((0 == rate) && (p_user->permission <= ADMIN))
+    {
+        rate = p_shaper->limits.levels[p_user->permission];
+    }
+
+    pthread_mutex_lock(&p_shaper->users_lock);
+    shape_bucket_t * p_bucket = (shape_bucket_t *)htable_get(p_shaper->p_users,
+                                                             p_user->p_username);
+    if (NULL != p_bucket)
+    {
+        bucket_set_rate(p_bucket, rate);
+    }
+
+    // Users without a limit get a bucket once they are given one
+    else if (0 != rate)
+    {
+        p_bucket = (shape_bucket_t *)malloc(sizeof(shape_bucket_t));
+        if (UV_INVALID_ALLOC == verify_alloc(p_bucket))
+        {
+            goto unlock;
+        }
+        bucket_init(p_bucket, rate);
+        p_bucket->p_username = strdup(p_user->p_username);
+        if (UV_INVALID_ALLOC == verify_alloc(p_bucket->p_username))
+        {
+            shape_free_callback(p_bucket);
+            p_bucket = NULL;
+            goto unlock;
+        }
+        htable_set(p_shaper->p_users, p_bucket->p_username, p_bucket);
+    }
+unlock:
+    pthread_mutex_unlock(&p_shaper->users_lock);
+    return (0 != rate) ? p_bucket : NULL;
+}
+
+/*!
+ * @brief Create the flow of a connection, which holds its bucket
+ *
+ * @param p_shaper Pointer to the shaper
+ * @return shape_flow_t object if successful otherwise NULL
+ */
+shape_flow_t * shape_flow_init(shaper_t * p_shaper)
+{
+    if (NULL == p_shaper)
+    {
+        return NULL;
+    }
+
+    shape_flow_t * p_flow = (shape_flow_t *)malloc(sizeof(shape_flow_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_flow))
+    {
+        return NULL;
+    }
+    p_flow->p_shaper = p_shaper;
+    bucket_init(&p_flow->connection, p_shaper->limits.connection);
+    atomic_init(&p_flow->p_user, NULL);
+    return p_flow;
+}
+
+/*!
+ * @brief Free the flow of a connection
+ *
+ * @param pp_flow Double pointer to the flow
+ */
+void shape_flow_destroy(shape_flow_t ** pp_flow)
+{
+    if ((NULL == pp_flow) || (NULL == *pp_flow))
+    {
+        return;
+    }
+
+    shape_flow_t * p_flow = *pp_flow;
+    bucket_destroy(&p_flow->connection);
+    free(p_flow);
+    *pp_flow = NULL;
+}
+
+/*!
+ * @brief Charge the following bytes of the connection to a user
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @param p_bucket Bucket of the user from shape_user. NULL keeps the user
+ * the flow is charged to
+ */
+void shape_flow_user(shape_flow_t * p_flow, shape_bucket_t * p_bucket)
+{
+    if ((NULL == p_flow) || (NULL == p_bucket))
+    {
+        return;
+    }
+    atomic_store_explicit(&p_flow->p_user, p_bucket, memory_order_release);
+}
+
+/*!
+ * @brief Tell whether any bucket the flow takes from has a limit. Shaped
+ * connections transfer at most SHAPE_SLICE bytes at once
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @return true if the flow is shaped otherwise false
+ */
+bool shape_flow_limited(shape_flow_t * p_flow)
+{
+    if (NULL == p_flow)
+    {
+        return false;
+    }
+    shape_bucket_t * p_user = atomic_load_explicit(&p_flow->p_user, memory_order_acquire);
+    return (bucket_limited(&p_flow->connection)
+            || ((NULL != p_user) && bucket_limited(p_user))
+            || bucket_limited(&p_flow->p_shaper->server));
+}
+
+/*!
+ * @brief Take the tokens of bytes about to be sent or just received and
+ * wait until no bucket of the flow is in debt. The wait counts as blocked
+ * for the scheduler running the caller so the pool may grow around it
+ *
+ * @param p_flow Pointer to the flow. May be NULL
+ * @param bytes Number of bytes transferred
+ */
+void shape_flow_take(shape_flow_t * p_flow, size_t bytes)
+{
+    if ((0 == bytes) || (!shape_flow_limited(p_flow)))
+    {
+        return;
+    }
+
+    // Every bucket is charged even if another one already makes the
+    // transfer wait, the bytes go through all of them
+    uint64_t now_ns = clock_ns();
+    uint64_t wait_ns = bucket_take(&p_flow->connection, bytes, now_ns);
+    shape_bucket_t * p_user = atomic_load_explicit(&p_flow->p_user, memory_order_acquire);
+    if (NULL != p_user)
+    {
+        uint64_t user_ns = bucket_take(p_user, bytes, now_ns);
+        wait_ns = (user_ns > wait_ns) ? user_ns : wait_ns;
+    }
+    uint64_t server_ns = bucket_take(&p_flow->p_shaper->server, bytes, now_ns);
+    wait_ns = (server_ns > wait_ns) ? server_ns : wait_ns;
+
+    if (wait_ns > 0)
+    {
+        sched_block_begin();
+        sleep_ns(wait_ns);
+        sched_block_end();
+    }
+}
+
+/*!
+ * @brief Start a full bucket. Rates above SHAPE_MAX_RATE are lowered to it
+ *
+ * @param p_bucket Pointer to the bucket
+ * @param rate Bytes per second, 0 for no limit
+ */
+static void bucket_init(shape_bucket_t * p_bucket, uint64_t rate)
+{
+    rate = (rate > SHAPE_MAX_RATE) ? SHAPE_MAX_RATE : rate;
+    pthread_mutex_init(&p_bucket->lock, NULL);
+    atomic_init(&p_bucket->rate, rate);
+    p_bucket->tokens        = bucket_burst(rate);
+    p_bucket->refilled_ns   = clock_ns();
+    p_bucket->p_username    = NULL;
+}
+
+/*!
+ * @brief Release the lock of the bucket
+ *
+ * @param p_bucket Pointer to the bucket
+ */
+static void bucket_destroy(shape_bucket_t * p_bucket)
+{
+    pthread_mutex_destroy(&p_bucket->lock);
+}
+
+/*!
+ * @brief Change the rate of the bucket. Its debt is kept
+ *
+ * @param p_bucket Pointer to the bucket
+ * @param rate Bytes per second, 0 for no limit
+ */
+static void bucket_set_rate(shape_bucket_t * p_bucket, uint64_t rate)
+{
+    rate = (rate > SHAPE_MAX_RATE) ? SHAPE_MAX_RATE : rate;
+    if (rate == atomic_load_explicit(&p_bucket->rate, memory_order_relaxed))
+    {
+        return;
+    }
+    pthread_mutex_lock(&p_bucket->lock);
+    atomic_store_explicit(&p_bucket->rate, rate, memory_order_relaxed);
+    int64_t burst = bucket_burst(rate);
+    if (p_bucket->tokens > burst)
+    {
+        p_bucket->tokens = burst;
+    }
+    pthread_mutex_unlock(&p_bucket->lock);
+}
+
+/*!
+ * @brief Tell whether the bucket has a limit
+ */
+static bool bucket_limited(shape_bucket_t * p_bucket)
+{
+    return (0 != atomic_load_explicit(&p_bucket->rate, memory_order_relaxed));
+}
+
+/*!
+ * @brief Refill the bucket for the time elapsed and take the tokens of the
+ * bytes from it
+ *
+ * @param p_bucket Pointer to the bucket
+ * @param bytes Number of bytes transferred
+ * @param now_ns Current time of CLOCK_MONOTONIC in nanoseconds
+ * @return Nanoseconds until the bucket is out of debt, 0 if it is not in debt
+ */
+static uint64_t bucket_take(shape_bucket_t * p_bucket, size_t bytes, uint64_t now_ns)
+{
+    uint64_t wait_ns = 0;
+    pthread_mutex_lock(&p_bucket->lock);
+    uint64_t rate = atomic_load_explicit(&p_bucket->rate, memory_order_relaxed);
+    if (0 == rate)
+    {
+        goto unlock;
+    }
+
+    // Another thread may have refilled the bucket with a later time
+    int64_t burst = bucket_burst(rate);
+    if (now_ns > p_bucket->refilled_ns)
+    {
+        uint64_t elapsed_ns = now_ns - p_bucket->refilled_ns;
+        uint64_t seconds = elapsed_ns / NS_PER_SEC;
+        uint64_t missing = (uint64_t)(burst - p_bucket->tokens);
+        if ((seconds >= (missing / rate) + 1))
+        {
+            p_bucket->tokens = burst;
+        }
+        else
+        {
+            uint64_t added = (seconds * rate)
+                             + (((elapsed_ns % NS_PER_SEC) * rate) / NS_PER_SEC);
+            p_bucket->tokens = (added >= missing) ? burst
+                                                  : p_bucket->tokens + (int64_t)added;
+        }
+        p_bucket->refilled_ns = now_ns;
+    }
+
+    p_bucket->tokens -= (int64_t)bytes;
+    if (p_bucket->tokens < 0)
+    {
+        uint64_t debt = (uint64_t)(-p_bucket->tokens);
+        wait_ns = ((debt / rate) * NS_PER_SEC) + (((debt % rate) * NS_PER_SEC) / rate);
+    }
+unlock:
+    pthread_mutex_unlock(&p_bucket->lock);
+    return wait_ns;
+}
+
+/*!
+ * @brief Get the number of tokens a full bucket holds. A bucket always
+ * holds a slice so a shaped transfer never waits on an idle bucket
+ *
+ * @param rate Bytes per second
+ * @return Number of tokens
+ */
+static int64_t bucket_burst(uint64_t rate)
+{
+    uint64_t burst = (rate * SHAPE_BURST_MS) / 1000;
+    return (int64_t)((burst > SHAPE_SLICE) ? burst : SHAPE_SLICE);
+}
+
+/*!
+ * @brief Get the time of CLOCK_MONOTONIC in nanoseconds
+ */
+static uint64_t clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * NS_PER_SEC) + (uint64_t)now.tv_nsec;
+}
+
+/*!
+ * @brief Sleep for the time given, resuming after signals
+ *
+ * @param wait_ns Nanoseconds to sleep
+ */
+static void sleep_ns(uint64_t wait_ns)
+{
+    struct timespec wait = {
+        .tv_sec     = (time_t)(wait_ns / NS_PER_SEC),
+        .tv_nsec    = (long)(wait_ns % NS_PER_SEC)
+    };
+    while ((-1 == nanosleep(&wait, &wait)) && (EINTR == errno))
+    {
+        continue;
+    }
+}
+
+/*!
+ * @brief Callback hashing the username keys of the user buckets
+ */
+static uint64_t shape_hash_callback(void * key)
+{
+    char * p_username = (char *)key;
+    uint64_t hash = htable_get_init_hash();
+    htable_hash_key(&hash, p_username, strlen(p_username));
+    return hash;
+}
+
+/*!
+ * @brief Callback comparing the username keys of the user buckets
+ */
+static htable_match_t shape_compare_callback(void * left_key, void * right_key)
+{
+    return (0 == strcmp((char *)left_key, (char *)right_key)) ? HT_MATCH_TRUE
+                                                              : HT_MATCH_FALSE;
+}
+
+/*!
+ * @brief Callback freeing a user bucket and the username it is keyed by
+ */
+static void shape_free_callback(void * value)
+{
+    shape_bucket_t * p_bucket = (shape_bucket_t *)value;
+    if (NULL == p_bucket)
+    {
+        return;
+    }
+    bucket_destroy(p_bucket);
+    free(p_bucket->p_username);
+    free(p_bucket);
+}
@@ -1,64 +1,166 @@
+#define _GNU_SOURCE // accept4, SO_INCOMING_CPU and the affinity calls
 #include <server_sock.h>
 #include <stdatomic.h> // c++ does not play nice with stdatomic.h so header is added here
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+
+// Keeps the acceptors running. It is set to false upon keyboard interrupt
+// or by stop_server
+static atomic_bool b_server_run;
+
+// Set by SIGUSR1, the metrics of the worker pools are printed once
+static atomic_bool b_print_stats;
+
+// Each acceptor owns a listening socket bound to the port with SO_REUSEPORT,
+// so the kernel spreads new connections across the acceptors, and the pool
+// of workers serving the connections it accepts. In the per-core mode the
+// acceptor and its workers run on one CPU and the socket receives the
+// connections whose packets that CPU handles
+typedef struct
+{
+    int         server_socket;
+    sched_t *   p_workers;
+    sched_t *   p_shed;     // Serves the connections turned away, shared. May be NULL
+    db_t *      p_db;
+    uint8_t     timeout;
+    int         cpu;        // CPU the acceptor is pinned to, -1 if not pinned
+    pthread_t   thread;
+} acceptor_t;
+
+// CPU the current thread was pinned to, -1 if it was not
+static _Thread_local int pinned_cpu = -1;
 
-// Atomic flag is used to keep the main loop running. It is triggered
-// to false upon keyboard interrupt
-static volatile atomic_flag server_run;
+struct request;
 
-// Each session created is handled by a single thread. The thread receives
-// a worker_payload_t to maintain its information
+// Each connection is read by a single thread. The thread receives a
+// worker_payload_t to maintain its information. v2 requests, and v1 requests
+// the client sent without waiting for the previous response, are answered
+// by the I/O workers while the thread reads the next ones
 typedef struct
 {
-    int         fd;
-    db_t *      p_db;
-    uint32_t    session_id;
-    time_t      timeout;
+    int             fd;
+    db_t *          p_db;
+    time_t          timeout;
+    int             cpu;            // CPU serving the connection, -1 if any
+    size_t          requests;       // Requests read from the connection
+    shape_flow_t *  p_flow;         // Bandwidth of the connection, NULL if not shaped
+    wire_reader_t   reader;         // Requests are parsed in place in its buffer
+    pthread_mutex_t write_lock;     // Keeps the writes of the responses from interleaving
+    pthread_mutex_t lock;           // Guards the members below
+    pthread_cond_t  cond;
+    size_t          in_flight;      // Requests read and not answered yet
+    size_t          idle_count;
+    arena_t *       p_idle[WIRE_MAX_IN_FLIGHT]; // Arenas of answered requests
+    bool            b_ordered_busy; // A v1 request is answered by an I/O worker
+    struct request * p_ordered_head; // v1 requests waiting for it, in order
+    struct request * p_ordered_tail;
 } worker_payload_t;
 
-static int server_listen(uint32_t serv_port, socklen_t * record_len);
+// Request handed to the thread answering it. It is allocated from the arena
+// of the request
+typedef struct request
+{
+    worker_payload_t *  p_worker;
+    wire_payload_t *    p_wire;
+    bool                b_ordered;  // Starts the next v1 request when answered
+    bool                b_shed;     // Turned away by the admission control
+    io_lane_t           lane;       // Lane of the I/O workers answering it
+    struct request *    p_next;
+} request_t;
+
+// Context of send_frames. The data of a v2 response is written in frames
+// tagged with the ID of its request
+typedef struct
+{
+    worker_payload_t *  p_worker;
+    uint32_t            request_id;
+} frame_sink_t;
+
+static int server_listen(uint32_t serv_port, socklen_t * record_len, int cpu);
+static void * accept_loop(void * p_arg);
+static int nth_cpu(const cpu_set_t * p_cpus, uint32_t index);
+static void pin_thread(int cpu);
 static void serve_client(void * sock_void);
 static void signal_handler(int signal);
+static void print_stats(acceptor_t * p_acceptors, uint16_t count, db_t * p_db);
 static int get_ip_port(struct sockaddr * addr, socklen_t addr_size, char * host, char * port);
 static void destroy_worker_pld(worker_payload_t ** pp_ld);
-static ret_codes_t read_client_req(worker_payload_t * p_ld, wire_payload_t ** pp_wire);
-static ret_codes_t read_stream(int fd, void * payload, size_t bytes_to_read);
-static void write_response(worker_payload_t * p_worker, act_resp_t * p_resp);
+static ret_codes_t read_client_req(worker_payload_t * p_ld, wire_payload_t * p_wire);
+static void answer_request(void * p_arg);
+static void queue_ordered(worker_payload_t * p_worker, request_t * p_req);
+static request_t * next_ordered(worker_payload_t * p_worker);
+static arena_t * acquire_arena(worker_payload_t * p_worker);
+static void release_arena(worker_payload_t * p_worker, arena_t * p_arena);
+static bool answers_pending(worker_payload_t * p_worker);
+static void drain_client(worker_payload_t * p_worker);
+static void write_response(worker_payload_t * p_worker,
+                           wire_payload_t * p_wire,
+                           act_resp_t * p_resp);
+static ret_codes_t send_chunk(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx);
+static ret_codes_t send_frames(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx);
+static ret_codes_t send_data(file_content_t * p_content, xfer_sink_t sink, void * p_ctx);
+static ret_codes_t write_all(int fd, const uint8_t * p_buf, size_t len, int flags);
 
 // Readability functions
-static bool std_payload_has_file(uint64_t payload_len, uint16_t path_len);
-static bool user_payload_has_password(uint64_t payload_len, uint16_t username_len);
 static int get_ip_port(struct sockaddr * addr, socklen_t addr_size, char * host, char * port);
-static uint64_t get_file_stream_size(uint64_t payload_len, uint16_t path_len);
 static size_t get_base_resp_size(void);
-static ret_codes_t make_byte_array(worker_payload_t * p_ld, uint8_t ** pp_byte_array, uint64_t array_len, bool make_string);
-static ret_codes_t read_client_user_payload(worker_payload_t * p_ld, wire_payload_t * p_wire);
-static ret_codes_t read_client_std_payload(worker_payload_t * p_ld, wire_payload_t * p_wire);
-static const char * action_to_string(act_t code);
 
 
 /*!
- * @brief Start the main thread loop
+ * @brief Start the acceptors and wait for them to stop
  *
  * @param p_db Pointer to the database object
  * @param port_num Port number to bind to
  * @param timeout Timeout of each session with the client
+ * @param net_workers Number of threads serving client connections at least
+ * @param net_workers_max Number of threads the network workers may grow to
+ * @param acceptors Number of threads accepting connections. The network
+ * workers are split between them
+ * @param b_per_core Run one acceptor on each CPU the server may use with its
+ * workers pinned to the same CPU. acceptors is ignored
  */
-void start_server(db_t * p_db, uint32_t port_num, uint8_t timeout)
+void start_server(db_t * p_db,
+                  uint32_t port_num,
+                  uint8_t timeout,
+                  uint16_t net_workers,
+                  uint16_t net_workers_max,
+                  uint16_t acceptors,
+                  bool b_per_core)
 {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (b_per_core)
+    {
+        int cpu_count = 0;
+        if (0 == sched_getaffinity(0, sizeof(cpus), &cpus))
+        {
+            cpu_count = CPU_COUNT(&cpus);
+        }
+        if (0 == cpu_count)
+        {
+            fprintf(stderr, "[!] Unable to read the CPUs, running a single acceptor\n");
+            b_per_core = false;
+            cpu_count = 1;
+        }
+        acceptors = (uint16_t)((cpu_count > SCHED_MAX_WORKERS) ? SCHED_MAX_WORKERS : cpu_count);
+    }
 
-    // Make the server start listening
-    int server_socket = server_listen(port_num, 0);
-    if (-1 == server_socket)
+    // Every acceptor needs at least one worker
+    if ((0 == acceptors) || (acceptors > net_workers))
     {
-        goto ret_null;
+        acceptors = (0 == net_workers) ? 1 : net_workers;
+    }
+    if (net_workers_max < net_workers)
+    {
+        net_workers_max = net_workers;
     }
 
-    // Initialize the thread pool for the connections of clients
-    long number_of_processors = sysconf(_SC_NPROCESSORS_ONLN);
-    thpool_t * thpool = thpool_init((uint8_t)number_of_processors);
-    if (NULL == thpool)
+    acceptor_t * p_acceptors = (acceptor_t *)calloc(acceptors, sizeof(acceptor_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_acceptors))
     {
-        goto cleanup_sock;
+        goto ret_null;
     }
 
     // Set up SIGINT signal handling
@@ -71,72 +173,425 @@ void start_server(db_t * p_db, uint32_t port_num, uint8_t timeout)
     if (-1 == (sigaction(SIGINT, &signal_action, NULL)))
     {
         debug_print_err("%s\n", "Unable to set up signal handler");
-        goto cleanup_thpool;
+        goto cleanup_acceptors;
     }
     if (-1 == (sigaction(SIGPIPE, &signal_action, NULL)))
     {
         fprintf(stderr , "Unable to set up signal handler\n");
-        goto cleanup_thpool;
+        goto cleanup_acceptors;
+    }
+    if (-1 == (sigaction(SIGUSR1, &signal_action, NULL)))
+    {
+        fprintf(stderr , "Unable to set up signal handler\n");
+        goto cleanup_acceptors;
+    }
+
+    // Connections turned away are answered by workers of their own so they
+    // do not wait behind the ones admitted
+    sched_t * p_shed = NULL;
+    if (NULL != p_db->p_admit)
+    {
+        p_shed = sched_init(1, ADMIT_SHED_WORKERS);
+        if (NULL == p_shed)
+        {
+            fprintf(stderr, "[!] Unable to start the workers of the connections turned away\n");
+            goto cleanup_acceptors;
+        }
+    }
+
+    // Each acceptor gets its own listening socket and its share of the
+    // network workers. File system operations are handed off to the I/O
+    // pool held by p_db
+    atomic_store(&b_server_run, true);
+    uint16_t started = 0;
+    for (; started < acceptors; started++)
+    {
+        acceptor_t * p_acceptor = &p_acceptors[started];
+        uint16_t workers = (uint16_t)((net_workers / acceptors)
+                                      + ((started < (net_workers % acceptors)) ? 1 : 0));
+        uint16_t workers_max = (uint16_t)((net_workers_max / acceptors)
+                                          + ((started < (net_workers_max % acceptors)) ? 1 : 0));
+        int cpu = b_per_core ? nth_cpu(&cpus, started) : -1;
+        *p_acceptor = (acceptor_t){
+            .server_socket  = server_listen(port_num, 0, cpu),
+            .p_workers      = NULL,
+            .p_shed         = p_shed,
+            .p_db           = p_db,
+            .timeout        = timeout,
+            .cpu            = cpu
+        };
+        if (-1 == p_acceptor->server_socket)
+        {
+            break;
+        }
+        p_acceptor->p_workers = sched_init(workers, workers_max);
+        if (NULL == p_acceptor->p_workers)
+        {
+            close(p_acceptor->server_socket);
+            break;
+        }
+        if (0 != pthread_create(&p_acceptor->thread, NULL, accept_loop, p_acceptor))
+        {
+            fprintf(stderr, "[!] Unable to start the acceptor\n");
+            sched_destroy(&p_acceptor->p_workers);
+            close(p_acceptor->server_socket);
+            break;
+        }
+    }
+
+    // Acceptors that did start are stopped if the others could not be
+    if (started < acceptors)
+    {
+        atomic_store(&b_server_run, false);
+    }
+
+    // The metrics are printed from this thread, the signal handler only
+    // raises the flag
+    while (atomic_load(&b_server_run))
+    {
+        poll(NULL, 0, ACCEPT_POLL_MS);
+        if (atomic_exchange(&b_print_stats, false))
+        {
+            print_stats(p_acceptors, started, p_db);
+        }
+    }
+
+    for (uint16_t idx = 0; idx < started; idx++)
+    {
+        acceptor_t * p_acceptor = &p_acceptors[idx];
+        pthread_join(p_acceptor->thread, NULL);
+
+        // Wait for all the jobs to finish
+        sched_destroy(&p_acceptor->p_workers);
+        close(p_acceptor->server_socket);
     }
+    sched_destroy(&p_shed);
+
+cleanup_acceptors:
+    free(p_acceptors);
+ret_null:
+    return;
+}
+
+/*!
+ * @brief Make start_server return once the connections being served are
+ * closed, as the keyboard interrupt does
+ */
+void stop_server(void)
+{
+    atomic_store(&b_server_run, false);
+}
 
+/*!
+ * @brief Thread accepting the connections of one listening socket until the
+ * server shuts down. The socket is polled with a timeout so the acceptor
+ * notices the shutdown without a connection to wake it up.
+ *
+ * @param p_arg Pointer to the acceptor_t
+ * @return NULL
+ */
+static void * accept_loop(void * p_arg)
+{
+    acceptor_t * p_acceptor = (acceptor_t *)p_arg;
+    pin_thread(p_acceptor->cpu);
+    struct pollfd listener = {
+        .fd     = p_acceptor->server_socket,
+        .events = POLLIN
+    };
     struct sockaddr_storage client_addr;
-    socklen_t addr_size = sizeof(struct sockaddr_storage);
 
-    atomic_flag_test_and_set(&server_run);
-    while (atomic_flag_test_and_set(&server_run))
+    while (atomic_load(&b_server_run))
     {
-        // Clear the client_addr before the next connection
+        if (poll(&listener, 1, ACCEPT_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        // Clear the client_addr before the next connection. Connections are
+        // accepted close-on-exec and stay blocking because the workers read
+        // with the socket timeout
+        socklen_t addr_size = sizeof(client_addr);
         memset(&client_addr, 0, addr_size);
-        int client_fd = accept(server_socket, (struct sockaddr *)&client_addr, &addr_size);
+        int client_fd = accept4(p_acceptor->server_socket,
+                                (struct sockaddr *)&client_addr,
+                                &addr_size,
+                                SOCK_CLOEXEC);
         if (-1 == client_fd)
         {
-            debug_print_err("Failed to accept: %s\n", strerror(errno));
+            // The connection may be gone before it is accepted
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+            {
+                debug_print_err("Failed to accept: %s\n", strerror(errno));
+            }
+            continue;
+        }
+
+        char host[NI_MAXHOST];
+        char service[NI_MAXSERV];
+        if (0 == get_ip_port((struct sockaddr *)&client_addr, addr_size, host, service))
+        {
+            debug_print("[SERVER] Received connection from %s:%s\n", host, service);
         }
         else
         {
-            char host[NI_MAXHOST];
-            char service[NI_MAXSERV];
-            if (0 == get_ip_port((struct sockaddr *)&client_addr, addr_size, host, service))
-            {
-                debug_print("[SERVER] Received connection from %s:%s\n", host, service);
-            }
-            else
-            {
-                printf("[SERVER] Received connection from unknown peer\n");
-            }
-            worker_payload_t * w_pld = (worker_payload_t *)malloc(sizeof(worker_payload_t));
-            if (UV_INVALID_ALLOC == verify_alloc(w_pld))
-            {
-                debug_print_err("[SERVER] Unable to allocate memory for fd "
-                                "for connection %s:%s\n", host, service);
-                close(client_fd);
-            }
-            else
+            printf("[SERVER] Received connection from unknown peer\n");
+        }
+        worker_payload_t * w_pld = (worker_payload_t *)malloc(sizeof(worker_payload_t));
+        if (UV_INVALID_ALLOC == verify_alloc(w_pld))
+        {
+            debug_print_err("[SERVER] Unable to allocate memory for fd "
+                            "for connection %s:%s\n", host, service);
+            close(client_fd);
+            continue;
+        }
+        *w_pld = (worker_payload_t){
+            .timeout        = p_acceptor->timeout,
+            .fd             = client_fd,
+            .p_db           = p_acceptor->p_db,
+            .cpu            = p_acceptor->cpu,
+            .requests       = 0,
+            .p_flow         = shape_flow_init(p_acceptor->p_db->p_shaper),
+            .in_flight      = 0,
+            .idle_count     = 0,
+            .b_ordered_busy = false,
+            .p_ordered_head = NULL,
+            .p_ordered_tail = NULL
+        };
+        wire_reader_init(&w_pld->reader, client_fd, w_pld->p_flow,
+                         p_acceptor->p_db->p_admit);
+
+        // Data the memory budget has no room for goes to the home directory,
+        // it is on the disk the data is bound for
+        if (NULL != p_acceptor->p_db->p_mem)
+        {
+            w_pld->reader.p_spill = p_acceptor->p_db->p_home_dir;
+            w_pld->reader.p_spill_mem = p_acceptor->p_db->p_spill;
+        }
+        pthread_mutex_init(&w_pld->write_lock, NULL);
+        pthread_mutex_init(&w_pld->lock, NULL);
+        pthread_cond_init(&w_pld->cond, NULL);
+
+        // A connection the shaper cannot follow is not served at all
+        if ((NULL != p_acceptor->p_db->p_shaper) && (NULL == w_pld->p_flow))
+        {
+            destroy_worker_pld(&w_pld);
+            continue;
+        }
+
+        // A connection that would wait too long for a network worker is
+        // answered busy by the workers of the connections turned away
+        sched_t * p_workers = p_acceptor->p_workers;
+        if (OP_SUCCESS != admit_connection(p_acceptor->p_db->p_admit, p_workers,
+                                           &w_pld->reader.busy_ms))
+        {
+            // Past its queue limit even the answer is not worth waiting for
+            if (sched_queued(p_acceptor->p_shed) >= ADMIT_SHED_QUEUE)
             {
-                *w_pld = (worker_payload_t){
-                    .timeout    = timeout,
-                    .fd         = client_fd,
-                    .p_db       = p_db,
-                };
-                thpool_enqueue_job(thpool, serve_client, w_pld);
+                destroy_worker_pld(&w_pld);
+                continue;
             }
+            w_pld->cpu = -1;
+            p_workers = p_acceptor->p_shed;
+        }
+        if (OP_SUCCESS != sched_submit(p_workers, serve_client, w_pld))
+        {
+            destroy_worker_pld(&w_pld);
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief Find the CPU at the index among the CPUs of the set, wrapping
+ * around when the index is past the last one
+ *
+ * @param p_cpus Pointer to the set of CPUs
+ * @param index Index of the CPU wanted
+ * @return Number of the CPU or -1 if the set is empty
+ */
+static int nth_cpu(const cpu_set_t * p_cpus, uint32_t index)
+{
+    int count = CPU_COUNT(p_cpus);
+    if (0 == count)
+    {
+        return -1;
+    }
+    index %= (uint32_t)count;
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, p_cpus) && (0 == index--))
+        {
+            return (int)cpu;
         }
     }
+    return -1;
+}
 
-    // Wait for all the jobs to finish
-    thpool_wait(thpool);
+/*!
+ * @brief Pin the calling thread to the CPU. The threads of a pool serve a
+ * single acceptor so each one is only pinned the first time
+ *
+ * @param cpu CPU to run on. Nothing is done for -1
+ */
+static void pin_thread(int cpu)
+{
+    if ((-1 == cpu) || (pinned_cpu == cpu))
+    {
+        return;
+    }
 
-    // Close the server
-    close(server_socket);
-    thpool_destroy(&thpool);
-    return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((size_t)cpu, &cpus);
+    if (0 != pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+    {
+        debug_print_err("[SERVER] Unable to pin the thread to CPU %d\n", cpu);
+        return;
+    }
+    pinned_cpu = cpu;
+}
 
-cleanup_thpool:
-    thpool_destroy(&thpool);
-cleanup_sock:
-    close(server_socket);
-ret_null:
-    return;
+/*!
+ * @brief Pipeline sink that writes the whole chunk to the client socket.
+ * Shaped connections write it a slice at a time
+ *
+ * @param p_chunk Pointer to the bytes to send
+ * @param chunk_len Number of bytes to send
+ * @param p_ctx Pointer to the worker_payload_t of the connection
+ * @return OP_SUCCESS if all bytes were written otherwise OP_SOCK_CLOSED
+ */
+static ret_codes_t send_chunk(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx)
+{
+    worker_payload_t * p_worker = (worker_payload_t *)p_ctx;
+    sched_cooperate();
+    size_t slice = shape_flow_limited(p_worker->p_flow) ? SHAPE_SLICE : chunk_len;
+    size_t total_sent = 0;
+    while (total_sent < chunk_len)
+    {
+        size_t left = chunk_len - total_sent;
+        size_t len  = (left < slice) ? left : slice;
+        shape_flow_take(p_worker->p_flow, len);
+        if (OP_SUCCESS != write_all(p_worker->fd, p_chunk + total_sent, len, 0))
+        {
+            return OP_SOCK_CLOSED;
+        }
+        total_sent += len;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Pipeline sink that writes the chunk to the client socket in frames
+ * of at most WIRE_V2_FRAME_SIZE bytes tagged with the request ID. The write
+ * lock is taken for each frame, so the responses of the other requests of
+ * the connection are written between the frames, and the shaper is charged
+ * before the lock is taken so a shaped response does not hold it while it
+ * waits
+ *
+ * @param p_chunk Pointer to the bytes to send
+ * @param chunk_len Number of bytes to send
+ * @param p_ctx Pointer to the frame_sink_t of the response
+ * @return OP_SUCCESS if all bytes were written otherwise OP_SOCK_CLOSED
+ */
+static ret_codes_t send_frames(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx)
+{
+    frame_sink_t * p_sink = (frame_sink_t *)p_ctx;
+    worker_payload_t * p_worker = p_sink->p_worker;
+    size_t total_sent = 0;
+    while (total_sent < chunk_len)
+    {
+        sched_cooperate();
+        size_t left      = chunk_len - total_sent;
+        size_t frame_len = (left < WIRE_V2_FRAME_SIZE) ? left : WIRE_V2_FRAME_SIZE;
+        wire_v2_frame_t header = {
+            .version    = WIRE_V2_DATA,
+            .request_id = htonl(p_sink->request_id),
+            .frame_len  = htonl((uint32_t)frame_len)
+        };
+        shape_flow_take(p_worker->p_flow, sizeof(header) + frame_len);
+
+        pthread_mutex_lock(&p_worker->write_lock);
+        ret_codes_t result = write_all(p_worker->fd, (const uint8_t *)&header,
+                                       sizeof(header), MSG_MORE);
+        if (OP_SUCCESS == result)
+        {
+            result = write_all(p_worker->fd, p_chunk + total_sent, frame_len, 0);
+        }
+        pthread_mutex_unlock(&p_worker->write_lock);
+        if (OP_SUCCESS != result)
+        {
+            return result;
+        }
+        total_sent += frame_len;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Send the data of a response to the sink, from the memory holding
+ * it or streamed from the file. Streamed files are read ahead from disk
+ * while the previous chunk is being written to the socket
+ *
+ * @param p_content Pointer to the content of the response
+ * @param sink Sink writing the data to the socket
+ * @param p_ctx Context passed to the sink
+ * @return OP_SUCCESS if all the data was sent otherwise the error code
+ */
+static ret_codes_t send_data(file_content_t * p_content, xfer_sink_t sink, void * p_ctx)
+{
+    if ((NULL == p_content) || (0 == p_content->stream_size))
+    {
+        return OP_SUCCESS;
+    }
+    if (NULL == p_content->p_source)
+    {
+        return sink(p_content->p_stream, p_content->stream_size, p_ctx);
+    }
+    if (0 == p_content->raw_size)
+    {
+        return xfer_pipeline(p_content->p_source, p_content->stream_size, sink, p_ctx);
+    }
+
+    // The frames are compressed as they are sent and have to add up to the
+    // length announced in the header
+    size_t frames_len = 0;
+    ret_codes_t result = xfer_frames(p_content->p_source, p_content->raw_size,
+                                     p_content->codec, NULL, sink, p_ctx,
+                                     &frames_len);
+    if ((OP_SUCCESS == result) && (frames_len != p_content->stream_size))
+    {
+        result = OP_FAILURE;
+    }
+    return result;
+}
+
+/*!
+ * @brief Write the whole buffer to the client socket
+ *
+ * @param fd Socket of the connection
+ * @param p_buf Pointer to the bytes to write
+ * @param len Number of bytes to write
+ * @param flags Flags of send, MSG_MORE when more bytes follow right away
+ * @return OP_SUCCESS if all bytes were written otherwise OP_SOCK_CLOSED
+ */
+static ret_codes_t write_all(int fd, const uint8_t * p_buf, size_t len, int flags)
+{
+    size_t total_sent = 0;
+    while (total_sent < len)
+    {
+        ssize_t sent_bytes = send(fd, p_buf + total_sent, len - total_sent, flags);
+        if (-1 == sent_bytes)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            debug_print_err("%s\n", strerror(errno));
+            return OP_SOCK_CLOSED;
+        }
+        total_sent += (size_t)sent_bytes;
+    }
+    return OP_SUCCESS;
 }
 
 /*!
@@ -148,9 +603,67 @@ static void signal_handler(int signal)
     {
         return;
     }
+    if (SIGUSR1 == signal)
+    {
+        atomic_store(&b_print_stats, true);
+        return;
+    }
 
     debug_print("%s\n", "[SERVER] Gracefully shutting down...");
-    atomic_flag_clear(&server_run);
+    atomic_store(&b_server_run, false);
+}
+
+/*!
+ * @brief Print the size, the blocked workers and the queue depth of the
+ * worker pools of the acceptors and of the lanes of the I/O pool, and the
+ * requests the admission control let in and turned away
+ *
+ * @param p_acceptors Array of the acceptors
+ * @param count Number of acceptors that were started
+ * @param p_db Pointer to the database object holding the I/O pool
+ */
+static void print_stats(acceptor_t * p_acceptors, uint16_t count, db_t * p_db)
+{
+    io_pool_t * p_io = p_db->p_io;
+    sched_stats_t stats;
+    for (uint16_t idx = 0; idx < count; idx++)
+    {
+        sched_stats(p_acceptors[idx].p_workers, &stats);
+        printf("[SERVER] net %u: %u workers, %u blocked, %zu queued, %" PRIu64
+               " done, %" PRIu64 " us mean wait\n",
+               idx, stats.workers, stats.blocked, stats.queued, stats.completed,
+               stats.wait_us);
+    }
+    const char * lane_names[IO_LANE_COUNT] = {
+        [IO_LANE_INTERACTIVE]   = "interactive",
+        [IO_LANE_BULK]          = "bulk"
+    };
+    for (int lane = 0; (NULL != p_io) && (lane < IO_LANE_COUNT); lane++)
+    {
+        io_pool_stats(p_io, (io_lane_t)lane, &stats);
+        printf("[SERVER] io %s: %u workers, %u blocked, %zu queued, %" PRIu64
+               " done, %" PRIu64 " us mean wait\n",
+               lane_names[lane], stats.workers, stats.blocked, stats.queued,
+               stats.completed, stats.wait_us);
+    }
+    if (NULL != p_db->p_admit)
+    {
+        admit_stats_t admitted;
+        admit_stats(p_db->p_admit, &admitted);
+        printf("[SERVER] admission: %zu requests, %" PRIu64 " bytes in flight, %"
+               PRIu64 " admitted, %" PRIu64 " turned away\n",
+               admitted.requests, admitted.bytes, admitted.admitted, admitted.shed);
+    }
+    if (NULL != p_db->p_mem)
+    {
+        mem_stats_t memory;
+        mem_stats(p_db->p_mem, &memory);
+        printf("[SERVER] memory: %" PRIu64 " of %" PRIu64 " bytes reserved, %" PRIu64
+               " high water, %" PRIu64 " waited, %" PRIu64 " refused\n",
+               memory.used, memory.limit, memory.high_water, memory.waited,
+               memory.refused);
+    }
+    fflush(stdout);
 }
 
 /*!
@@ -160,9 +673,10 @@ static void signal_handler(int signal)
  * @param serv_port Port number to listen on
  * @param record_len Populated with the size of the sockaddr. This value is
  * dependant on the structure used. IPv6 structures are larger.
+ * @param cpu CPU whose connections the socket prefers, -1 for any
  * @return Either -1 for failure or 0 for success
  */
-static int server_listen(uint32_t serv_port, socklen_t * record_len)
+static int server_listen(uint32_t serv_port, socklen_t * record_len, int cpu)
 {
     // Convert the serv_port number into a string. The serv_port number is already
     // verified, so we do not need to double-check it here
@@ -202,8 +716,9 @@ static int server_listen(uint32_t serv_port, socklen_t * record_len)
 
         // Using the current network record, attempt to create a socket fd
         // out of it. If it fails, grab the next one
+        // The acceptor polls the socket so accepting never blocks
         sock_fd = socket(network_record->ai_family,
-                         network_record->ai_socktype,
+                         network_record->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
                          network_record->ai_protocol);
         if (-1 == sock_fd)
         {
@@ -211,13 +726,24 @@ static int server_listen(uint32_t serv_port, socklen_t * record_len)
         }
 
         // Attempt to modify the socket to be used for listening
-        if (-1 == setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &enable_setsockopt, sizeof(enable_setsockopt)))
+        // Every acceptor binds its own socket to the port
+        if ((-1 == setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &enable_setsockopt, sizeof(enable_setsockopt)))
+            || (-1 == setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &enable_setsockopt, sizeof(enable_setsockopt))))
         {
             close(sock_fd);
             freeaddrinfo(network_record_root);
             return -1;
         }
 
+        // Among the sockets of the port the kernel prefers the one of the
+        // CPU that received the connection. It is only a preference so the
+        // socket still works if the hint is refused
+        if ((-1 != cpu)
+            && (-1 == setsockopt(sock_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu))))
+        {
+            debug_print_err("[SERVER] Unable to steer CPU %d: %s\n", cpu, strerror(errno));
+        }
+
         if (0 == bind(sock_fd, network_record->ai_addr, network_record->ai_addrlen))
         {
             break; // If successful bind, break we are done
@@ -286,6 +812,7 @@ static int server_listen(uint32_t serv_port, socklen_t * record_len)
 static void serve_client(void * sock_void)
 {
     worker_payload_t * p_worker = (worker_payload_t *)sock_void;
+    pin_thread(p_worker->cpu);
     struct timeval tv;
     tv.tv_usec = 0;
     tv.tv_sec = CONNECTION_TIMEOUT;
@@ -303,34 +830,118 @@ static void serve_client(void * sock_void)
         goto ret_null;
     }
 
-    // If we get a null then we know that some kind of error occurred and
-    // has been handled
-    wire_payload_t * p_client_req = (wire_payload_t *)calloc(1, sizeof(wire_payload_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_client_req))
+    // Requests are read until the client closes the connection or leaves
+    // it idle
+    for (;;)
     {
-        goto ret_null;
+        // Everything a request and its response allocate comes from the
+        // arena of the request and is released at once after the response
+        // is written
+        arena_t * p_arena = acquire_arena(p_worker);
+        if (NULL == p_arena)
+        {
+            break;
+        }
+        request_t * p_req = (request_t *)arena_alloc(p_arena, sizeof(request_t));
+        wire_payload_t * p_client_req = (wire_payload_t *)arena_alloc(p_arena,
+                                                                      sizeof(wire_payload_t));
+        if ((UV_INVALID_ALLOC == verify_alloc(p_req))
+            || (UV_INVALID_ALLOC == verify_alloc(p_client_req)))
+        {
+            release_arena(p_worker, p_arena);
+            break;
+        }
+        p_client_req->p_arena = p_arena;
+        *p_req = (request_t){
+            .p_worker   = p_worker,
+            .p_wire     = p_client_req,
+            .b_ordered  = false,
+            .b_shed     = false,
+            .lane       = IO_LANE_INTERACTIVE,
+            .p_next     = NULL
+        };
+
+        // p_client_req->session_id will receive the session_id from the
+        // client connection. On initial connection, the session is set
+        // to zero from the client.
+        ret_codes_t result = read_client_req(p_worker, p_client_req);
+        if (OP_SERVER_BUSY == result)
+        {
+            p_req->b_shed = true;
+        }
+        else if (OP_SUCCESS != result)
+        {
+            // If error returned (OP_SESSION_ERROR/SOCKET_CLOSED) then
+            // expire the session ID from the database
+            sessions_expire(p_worker->p_db->p_sessions, p_client_req->session_id);
+            release_arena(p_worker, p_arena);
+            break;
+        }
+        p_worker->requests++;
+        p_req->lane = p_req->b_shed ? IO_LANE_INTERACTIVE : wire_lane(p_client_req);
+
+        // v1 responses go out in the order of the requests. A short request
+        // that came alone is answered here. Once the client sent the next
+        // one before the response, the requests are answered one after the
+        // other by the I/O workers while the next ones are read. Transfers
+        // always go to the bulk lane so they are bounded by its workers.
+        // Requests turned away are answered here unless a v1 response is
+        // owed before theirs
+        bool b_ordered = (WIRE_VERSION_2 != p_client_req->version);
+        if (p_req->b_shed && (0 != p_worker->reader.busy_ms))
+        {
+            answer_request(p_req);
+            drain_client(p_worker);
+            break;
+        }
+        if (p_req->b_shed && !b_ordered)
+        {
+            answer_request(p_req);
+            continue;
+        }
+        if (b_ordered && (IO_LANE_INTERACTIVE == p_req->lane))
+        {
+            pthread_mutex_lock(&p_worker->lock);
+            bool b_idle = !p_worker->b_ordered_busy;
+            pthread_mutex_unlock(&p_worker->lock);
+            if (b_idle && (p_req->b_shed
+                           || (p_worker->reader.end == p_worker->reader.start)))
+            {
+                answer_request(p_req);
+                continue;
+            }
+        }
+
+        // The request is answered by an I/O worker while the next one is
+        // read into the receive buffer, so it takes its fields out of it
+        if (OP_SUCCESS != wire_detach(&p_worker->reader, p_arena, p_client_req))
+        {
+            if (!p_req->b_shed)
+            {
+                admit_leave(p_worker->p_db->p_admit, p_client_req->payload_len);
+            }
+            release_arena(p_worker, p_arena);
+            break;
+        }
+        if (b_ordered)
+        {
+            queue_ordered(p_worker, p_req);
+        }
+        else
+        {
+            io_submit(p_worker->p_db->p_io, p_req->lane, answer_request, p_req);
+        }
     }
 
-    // p_client_req->session_id will receive the session_id from the
-    // client connection. On initial connection, the session is set
-    // to zero from the client and p_worker->session_id will also be 0.
-    ret_codes_t result = read_client_req(p_worker, &p_client_req);
-    if (OP_SUCCESS != result)
+    // The requests still being answered write to the socket
+    sched_block_begin();
+    pthread_mutex_lock(&p_worker->lock);
+    while (p_worker->in_flight > 0)
     {
-        // If error returned (OP_SESSION_ERROR/SOCKET_CLOSED) then
-        // expire the session ID from the database
-        free(htable_del(p_worker->p_db->sesh_htable,
-                   &p_client_req->session_id, HT_FREE_PTR_TRUE));
-        goto ret_null;
+        pthread_cond_wait(&p_worker->cond, &p_worker->lock);
     }
-    act_resp_t * resp = ctrl_parse_action(p_worker->p_db,
-                                          p_client_req,
-                                          p_worker->timeout);
-    p_worker->session_id = p_client_req->session_id;
-
-    write_response(p_worker, resp);
-    ctrl_destroy(&p_client_req, &resp, true);
-
+    pthread_mutex_unlock(&p_worker->lock);
+    sched_block_end();
 
 ret_null:
     destroy_worker_pld(&p_worker);
@@ -350,11 +961,20 @@ static void destroy_worker_pld(worker_payload_t ** pp_ld)
     }
     worker_payload_t * p_ld = *pp_ld;
     close(p_ld->fd);
+    shape_flow_destroy(&p_ld->p_flow);
+    for (size_t idx = 0; idx < p_ld->idle_count; idx++)
+    {
+        arena_destroy(&p_ld->p_idle[idx]);
+    }
+    pthread_cond_destroy(&p_ld->cond);
+    pthread_mutex_destroy(&p_ld->lock);
+    pthread_mutex_destroy(&p_ld->write_lock);
 
     *p_ld = (worker_payload_t){
         .fd         = 0,
         .p_db       = NULL,
-        .timeout    = 0
+        .timeout    = 0,
+        .idle_count = 0
     };
     free(p_ld);
     *pp_ld = NULL;
@@ -364,312 +984,279 @@ static void destroy_worker_pld(worker_payload_t ** pp_ld)
 
 /*!
  * @brief Function performs the "reading" portion of the client communications.
- * It parses out the headers to return a wire_payload_t. The wire_payload_t
- * contains a union that holds the type of payload sent which is either
- * the std_payload_t (file stuffs) or user_payload_t (user creations)
+ * The request is parsed into the wire_payload_t by wire_read_request. The
+ * wire_payload_t contains a union that holds the type of payload sent which
+ * is either the std_payload_t (file stuffs) or user_payload_t (user
+ * creations). The client is answered here if the request could not be read,
+ * requests turned away by the admission control are answered by the caller
  *
  * @param p_ld Pointer to the worker_payload object
- * @return wire_payload_t object
+ * @param p_wire Pointer to the zeroed wire_payload_t to populate
+ * @return OP_SUCCESS if the request was read otherwise the error
  */
 static ret_codes_t read_client_req(worker_payload_t * p_ld,
-                                   wire_payload_t ** pp_wire)
+                                   wire_payload_t * p_wire)
 {
-    /*
-     *
-     * 0               1               2               3
-     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |     OPCODE    |   USER_FLAG   |           RESERVED            |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |        USERNAME_LEN           |        PASSWORD_LEN           |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                          SESSION_ID                           |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                    **USERNAME + PASSWORD**                    |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                          PAYLOAD_LEN ->                       |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                       <- PAYLOAD_LEN                          |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                ~user_payload || std_payload~                  |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     */
-    if ((NULL == p_ld) || (NULL == pp_wire) || (NULL == *pp_wire))
+    if ((NULL == p_ld) || (NULL == p_wire))
     {
         goto ret_null;
     }
-    wire_payload_t * p_wire = *pp_wire;
-    act_resp_t * resp = NULL;
 
-    ret_codes_t result = read_stream(p_ld->fd, &p_wire->opt_code, H_OPCODE);
-    if (OP_SUCCESS != result)
+    // The connection is only idle once every request read before this one
+    // is answered. Until then a read that timed out before the next request
+    // started is armed again, nothing of the request was consumed yet
+    sched_block_begin();
+    ret_codes_t result = wire_read_request(&p_ld->reader, p_wire->p_arena, p_wire);
+    while ((OP_SESSION_ERROR == result) && (0 == p_wire->version) && answers_pending(p_ld))
     {
-        goto failure_response;
+        result = wire_read_request(&p_ld->reader, p_wire->p_arena, p_wire);
     }
-
-    result = read_stream(p_ld->fd, &p_wire->user_flag, H_USER_FLAG);
-    if (OP_SUCCESS != result)
+    sched_block_end();
+    if ((OP_SUCCESS == result) || (OP_SERVER_BUSY == result))
     {
-        goto failure_response;
+        return result;
     }
 
-    result = read_stream(p_ld->fd, &p_wire->_reserved, H_REQ_RESERVED);
-    if (OP_SUCCESS != result)
+    // A connection left idle after its requests is closed without an answer
+    if ((OP_SOCK_CLOSED == result) || ((0 == p_wire->version) && (p_ld->requests > 0)))
     {
-        goto failure_response;
+        return result;
     }
-
-    result = read_stream(p_ld->fd, &p_wire->username_len, H_USERNAME_LEN);
-    if (OP_SUCCESS != result)
+    act_resp_t * resp = ctrl_populate_resp(p_wire->p_arena, result);
+    if (NULL == resp)
     {
-        goto failure_response;
+        debug_print("%s\n", "[WORKER - READ_CLIENT] Failed to read from client,"
+                            " sending a response packet");
+        goto ret_null;
     }
-    p_wire->username_len = ntohs(p_wire->username_len);
+    write_response(p_ld, p_wire, resp);
+    return result;
+ret_null:
+    return OP_FAILURE;
+}
 
-    result = read_stream(p_ld->fd, &p_wire->passwd_len, H_PASSWORD_LEN);
-    if (OP_SUCCESS != result)
-    {
-        goto failure_response;
-    }
-    p_wire->passwd_len = ntohs(p_wire->passwd_len);
+/*!
+ * @brief Answer a request and release its arena. Requests read ahead of the
+ * responses are answered on the I/O workers, the others on the thread
+ * reading the connection. Requests turned away by the admission control
+ * are answered busy without running
+ *
+ * @param p_arg Pointer to the request_t
+ */
+static void answer_request(void * p_arg)
+{
+    request_t * p_req = (request_t *)p_arg;
+    worker_payload_t * p_worker = p_req->p_worker;
+    wire_payload_t * p_wire = p_req->p_wire;
+    arena_t * p_arena = p_wire->p_arena;
 
-    result = read_stream(p_ld->fd, &p_wire->session_id, H_SESSION_ID);
-    if (OP_SUCCESS != result)
+    if (p_req->b_shed)
     {
-        goto failure_response;
+        act_resp_t * resp = ctrl_populate_resp(p_arena, OP_SERVER_BUSY);
+        write_response(p_worker, p_wire, resp);
     }
-    p_wire->session_id = ntohl(p_wire->session_id);
-
-    result = make_byte_array(p_ld,
-                             (uint8_t **)& p_wire->p_username,
-                             p_wire->username_len,
-                             true);
-
-    if (OP_SUCCESS != result)
+    else
     {
-        goto failure_response;
+        uint64_t payload_len = p_wire->payload_len;
+        act_resp_t * resp = ctrl_parse_action(p_worker->p_db,
+                                              p_wire,
+                                              p_worker->timeout);
+        shape_flow_user(p_worker->p_flow, p_wire->p_bucket);
+        write_response(p_worker, p_wire, resp);
+        ctrl_destroy(&p_wire, &resp, true);
+        admit_leave(p_worker->p_db->p_admit, payload_len);
     }
-    result = make_byte_array(p_ld,
-                             (uint8_t **)&p_wire->p_passwd,
-                             p_wire->passwd_len,
-                             true);
 
-    if (OP_SUCCESS != result)
+    // The next request is in flight so the worker outlives the release
+    request_t * p_next = NULL;
+    if (p_req->b_ordered)
     {
-        goto failure_response;
+        p_next = next_ordered(p_worker);
     }
-
-    result = read_stream(p_ld->fd, &p_wire->payload_len, H_PAYLOAD_LEN);
-    if (OP_SUCCESS != result)
+    release_arena(p_worker, p_arena);
+    if (NULL != p_next)
     {
-        goto failure_response;
+        io_submit(p_worker->p_db->p_io, p_next->lane, answer_request, p_next);
     }
-    p_wire->payload_len = ntohll(p_wire->payload_len);
+}
 
-    if (ACT_USER_OPERATION == p_wire->opt_code)
+/*!
+ * @brief Answer the v1 request after the ones queued before it. The request
+ * is started right away if no other v1 request is being answered
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ * @param p_req Pointer to the request
+ */
+static void queue_ordered(worker_payload_t * p_worker, request_t * p_req)
+{
+    p_req->b_ordered = true;
+    bool b_start = false;
+    pthread_mutex_lock(&p_worker->lock);
+    if (!p_worker->b_ordered_busy)
     {
-        debug_print("%s\n", "[WORKER - READ_CLIENT] Parsing user_payload "
-                            "in client request");
-        result = read_client_user_payload(p_ld, p_wire);
-        if (OP_SUCCESS != result)
-        {
-            goto failure_response;
-        }
+        p_worker->b_ordered_busy = true;
+        b_start = true;
     }
-    else if (ACT_LOCAL_OPERATION != p_wire->opt_code)
+    else if (NULL == p_worker->p_ordered_tail)
     {
-        debug_print("%s\n", "[WORKER - READ_CLIENT] Parsing std_payload "
-                            "in client request");
-        result = read_client_std_payload(p_ld, p_wire);
-        if (OP_SUCCESS != result)
-        {
-            goto failure_response;
-        }
+        p_worker->p_ordered_head = p_req;
+        p_worker->p_ordered_tail = p_req;
     }
-    return OP_SUCCESS;
-
-failure_response:
-    resp = ctrl_populate_resp(result);
-    if (NULL == resp)
+    else
     {
-        debug_print("%s\n", "[WORKER - READ_CLIENT] Failed to read from client,"
-                            " sending a response packet");
-        goto ret_null;
+        p_worker->p_ordered_tail->p_next = p_req;
+        p_worker->p_ordered_tail = p_req;
     }
-    if (OP_SOCK_CLOSED != result)
+    pthread_mutex_unlock(&p_worker->lock);
+
+    if (b_start)
     {
-        write_response(p_ld, resp);
+        io_submit(p_worker->p_db->p_io, p_req->lane, answer_request, p_req);
     }
-    return result;
-ret_null:
-    return OP_FAILURE;
 }
 
-static ret_codes_t read_client_std_payload(worker_payload_t * p_ld,
-                                           wire_payload_t * p_wire)
+/*!
+ * @brief Take the v1 request to answer after the one just answered
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ * @return Pointer to the next request or NULL if none is queued
+ */
+static request_t * next_ordered(worker_payload_t * p_worker)
 {
-    ret_codes_t result = OP_FAILURE;
-    p_wire->p_std_payload = (std_payload_t *)calloc(1, sizeof(std_payload_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_wire->p_std_payload))
-    {
-        goto ret_null;
-    }
-    std_payload_t * p_load =  p_wire->p_std_payload;
-
-    /*
-     * 0               1               2               3
-     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |          PATH_LEN             |         **PATH_NAME**         |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |                     **FILE_DATA_STREAM**                      |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     */
-
-    result = read_stream(p_ld->fd, &p_load->path_len, H_PATH_LEN);
-    if (OP_SUCCESS != result)
-    {
-        goto ret_null;
-    }
-    p_load->path_len = htons(p_load->path_len);
-
-    result = make_byte_array(p_ld,
-                             (uint8_t **)&p_load->p_path,
-                             p_load->path_len,
-                             true);
-
-    if (OP_SUCCESS != result)
+    pthread_mutex_lock(&p_worker->lock);
+    request_t * p_next = p_worker->p_ordered_head;
+    if (NULL != p_next)
     {
-        goto ret_null;
-    }
-
-    if (std_payload_has_file(p_wire->payload_len, p_load->path_len))
-    {
-        result = make_byte_array(p_ld,
-                                 &p_load->p_hash_stream,
-                                 H_HASH_LEN,
-                                 false);
-        if (OP_SUCCESS != result)
+        p_worker->p_ordered_head = p_next->p_next;
+        if (NULL == p_worker->p_ordered_head)
         {
-            goto ret_null;
-        }
-
-        p_load->byte_stream_len = get_file_stream_size(p_wire->payload_len,
-                                                       p_load->path_len);
-
-        result = make_byte_array(p_ld,
-                                 &p_load->p_byte_stream,
-                                 p_load->byte_stream_len,
-                                 false);
-        if (OP_SUCCESS != result)
-        {
-            goto ret_null;
+            p_worker->p_ordered_tail = NULL;
         }
     }
-
-    debug_print("[~] Parsed std payload:\n"
-                "    [~]    Session ID: %u\n"
-                "    [~]    Command:   %s\n"
-                "    [~]    PATH_LEN:  %d\n"
-                "    [~]    PATH_NAME: %s\n"
-                "    [~]    PATH_LEN:  %d\n"
-                "    [~]    FileLen:   %ld\n",
-                p_wire->session_id,
-                action_to_string(p_wire->opt_code),
-                p_load->path_len,
-                p_load->p_path,
-                p_load->path_len,
-                p_load->byte_stream_len
-                );
-
-    return OP_SUCCESS;
-
-ret_null:
-    return result;
+    else
+    {
+        p_worker->b_ordered_busy = false;
+    }
+    pthread_mutex_unlock(&p_worker->lock);
+    return p_next;
 }
 
-static ret_codes_t read_client_user_payload(worker_payload_t * p_ld,
-                                            wire_payload_t * p_wire)
+/*!
+ * @brief Take an arena for the next request of the connection. The caller
+ * waits while WIRE_MAX_IN_FLIGHT requests are being answered
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ * @return Arena to allocate the request from if successful otherwise NULL
+ */
+static arena_t * acquire_arena(worker_payload_t * p_worker)
 {
-    ret_codes_t result = OP_FAILURE;
-    p_wire->type = USER_PAYLOAD;
-
-    // Create the payload portion that goes inside the wire_payload_t
-    p_wire->p_user_payload = (user_payload_t *)calloc(1, sizeof(user_payload_t));
-    if (UV_INVALID_ALLOC == verify_alloc(p_wire->p_user_payload))
+    arena_t * p_arena = NULL;
+    pthread_mutex_lock(&p_worker->lock);
+    while (p_worker->in_flight >= WIRE_MAX_IN_FLIGHT)
     {
-        goto ret_null;
+        pthread_cond_wait(&p_worker->cond, &p_worker->lock);
     }
-    user_payload_t * p_load =  p_wire->p_user_payload;
-
-    /*
-     * 0               1               2               3
-     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * |  USR_ACT_FLAG |   PERMISSION  |          USERNAME_LEN         |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     * | **USERNAME**  |         PASSWORD_LEN          | **PASSWORD**  |
-     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-     */
-    result = read_stream(p_ld->fd, &p_load->user_flag, H_USR_ACT_FLAG);
-    if (OP_SUCCESS != result)
+    p_worker->in_flight++;
+    if (p_worker->idle_count > 0)
     {
-        goto ret_null;
+        p_worker->idle_count--;
+        p_arena = p_worker->p_idle[p_worker->idle_count];
     }
+    pthread_mutex_unlock(&p_worker->lock);
 
-    result = read_stream(p_ld->fd, &p_load->user_perm, H_USR_PERMISSION);
-    if (OP_SUCCESS != result)
+    if (NULL == p_arena)
     {
-        goto ret_null;
+        p_arena = arena_init(ARENA_BLOCK_SIZE, p_worker->p_db->p_mem);
+        if (NULL == p_arena)
+        {
+            release_arena(p_worker, NULL);
+        }
     }
+    return p_arena;
+}
 
-    result = read_stream(p_ld->fd, &p_load->username_len, H_USERNAME_LEN);
-    if (OP_SUCCESS != result)
+/*!
+ * @brief Reset the arena of an answered request and keep it for the next
+ * one. Every arena of the connection belongs to a request in flight or is
+ * idle, so there is always room for it
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ * @param p_arena Arena of the request. May be NULL
+ */
+static void release_arena(worker_payload_t * p_worker, arena_t * p_arena)
+{
+    arena_reset(p_arena);
+    pthread_mutex_lock(&p_worker->lock);
+    if (NULL != p_arena)
     {
-        goto ret_null;
+        p_worker->p_idle[p_worker->idle_count] = p_arena;
+        p_worker->idle_count++;
     }
-    p_load->username_len = ntohs(p_load->username_len);
+    p_worker->in_flight--;
 
-    result = make_byte_array(p_ld,
-                             (uint8_t **)&p_load->p_username,
-                             p_load->username_len,
-                             true);
-    if (OP_SUCCESS != result)
-    {
-        goto ret_null;
-    }
+    // The worker may be destroyed as soon as the lock is released
+    pthread_cond_broadcast(&p_worker->cond);
+    pthread_mutex_unlock(&p_worker->lock);
+}
 
-    // Only "Create user" commands have the password field filled
-    if (user_payload_has_password(p_wire->payload_len, p_load->username_len))
+/*!
+ * @brief Close the sending side of a connection turned away once it is
+ * answered and read what the client still sends for a short while, so the
+ * answer is not lost to a reset when the connection is closed with unread
+ * bytes. The reading is bounded in bytes and in time
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ */
+static void drain_client(worker_payload_t * p_worker)
+{
+    shutdown(p_worker->fd, SHUT_WR);
+    struct timeval tv = {
+        .tv_sec     = ADMIT_SHED_LINGER,
+        .tv_usec    = 0
+    };
+    setsockopt(p_worker->fd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof(tv));
+
+    // The request is answered so the receive buffer is free to read into
+    uint8_t * p_buffer = p_worker->reader.buffer;
+    size_t drained = 0;
+    time_t deadline = time(NULL) + ADMIT_SHED_LINGER;
+    sched_block_begin();
+    while ((drained < ADMIT_SHED_DRAIN) && (time(NULL) <= deadline))
     {
-        result = read_stream(p_ld->fd, &p_load->passwd_len, H_PASSWORD_LEN);
-        if (OP_SUCCESS != result)
+        size_t want = ADMIT_SHED_DRAIN - drained;
+        ssize_t read_bytes = read(p_worker->fd, p_buffer,
+                                  (want < sizeof(p_worker->reader.buffer))
+                                  ? want : sizeof(p_worker->reader.buffer));
+        if (read_bytes > 0)
         {
-            goto ret_null;
+            drained += (size_t)read_bytes;
+            continue;
         }
-        p_load->passwd_len = htons(p_load->passwd_len);
-
-        result = make_byte_array(p_ld,
-                                 (uint8_t **)&p_load->p_passwd,
-                                 p_load->passwd_len,
-                                 true);
-    }
-    debug_print("[~] Parsed user payload:\n"
-                "    [~]    Session ID: %u\n"
-                "    [~]    USER_OP: %s\n"
-                "    [~]    O_PERM:  %d\n"
-                "    [~]    O_User:  %s\n"
-                "    [~]    O_Pass:  %s\n",
-           p_wire->session_id,
-           (USR_ACT_CREATE_USER == p_load->user_flag) ? "CREATE" : "DELETE",
-           p_load->user_perm,
-           p_load->p_username,
-           (NULL != p_load->p_passwd) ? p_load->p_passwd : "None");
+        if ((-1 == read_bytes) && (EINTR == errno))
+        {
+            continue;
+        }
+        break;
+    }
+    sched_block_end();
+    shutdown(p_worker->fd, SHUT_RD);
+}
 
-    return result;
+/*!
+ * @brief Tell if requests read before the one being read are still being
+ * answered
+ *
+ * @param p_worker Pointer to the worker_payload_t of the connection
+ * @return true if a response is still owed otherwise false
+ */
+static bool answers_pending(worker_payload_t * p_worker)
+{
+    pthread_mutex_lock(&p_worker->lock);
 
-ret_null:
-    return result;
+    // The request being read is in flight as well
+    bool b_pending = (p_worker->in_flight > 1);
+    pthread_mutex_unlock(&p_worker->lock);
+    return b_pending;
 }
 
 /*!
@@ -682,12 +1269,20 @@ ret_null:
  * LS command and GET command holding that data stream to return in the
  * format for (BYTE_STREAM_HASH)(BYTE_STREAM).
  *
+ * v2 requests are answered with the v2 header tagged with their request
+ * ID, and the data stream follows it in frames tagged with the same ID. The
+ * frames of the responses of a connection are written between each other
+ * as the requests complete. v1 responses are written whole, one at a time.
+ *
  * @param p_worker Pointer to the worker_payload_t object
+ * @param p_wire Pointer to the request answered
  * @param p_resp act_resp_t contains the data that has been created
  * by the user after it processed the user request. It will contain all
  * the information that was requested even if it's just an error message.
  */
-static void write_response(worker_payload_t * p_worker, act_resp_t * p_resp)
+static void write_response(worker_payload_t * p_worker,
+                           wire_payload_t * p_wire,
+                           act_resp_t * p_resp)
 {
     /*
      *   0               1               2               3
@@ -705,234 +1300,185 @@ static void write_response(worker_payload_t * p_worker, act_resp_t * p_resp)
      *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
      */
 
+    /*
+     *   v2
+     *   0               1               2               3
+     *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |    VERSION    |  RETURN_CODE  |    RESERVED   |    MSG_LEN    |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                          REQUEST_ID                           |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                          SESSION_ID                           |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                           RESERVED                            |
+     *  |                                                               |
+     *  |                                                               |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                          PAYLOAD_LEN ->                       |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                       <- PAYLOAD_LEN                          |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                **MSG** + **BYTE_STREAM_HASH**                 |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *
+     *   v2 data frame, repeated until the data stream is sent
+     *   0               1               2               3
+     *   0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |    VERSION    |                   RESERVED                    |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                          REQUEST_ID                           |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                           FRAME_LEN                           |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *  |                   **FILE DATA STREAM** part                   |
+     *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     */
+    if (NULL == p_resp)
+    {
+        goto ret_null;
+    }
+    bool b_v2 = (WIRE_VERSION_2 == p_wire->version);
+
     // Complete size of the whole response packet limited to 2048 bytes
-    size_t pkt_msg_size = get_base_resp_size();
+    size_t pkt_msg_size = b_v2 ? WIRE_V2_HEADER_LEN : get_base_resp_size();
 
     // msg is guaranteed to be null terminated
     size_t msg_len = strlen(p_resp->msg);
     pkt_msg_size += msg_len;
 
-    // Payload: MSG_LEN + strlen(msg) + len(stream)
-    size_t payload_len = msg_len + H_MSG_LEN;
+    // Payload: MSG_LEN + strlen(msg) + len(stream). The length of the
+    // message is part of the fixed header in v2
+    size_t payload_len = msg_len + (b_v2 ? 0 : H_MSG_LEN);
 
-    // Size of the data stream which is limited to 1016 bytes per packet
-    size_t data_stream_size = 0;
+    // The data is not copied into the packet, it is sent after the hash from
+    // the memory holding it or streamed from the file
     if (NULL != p_resp->p_content)
     {
-        pkt_msg_size    += p_resp->p_content->stream_size;
-        pkt_msg_size    += p_resp->p_content->p_hash->size;
+        pkt_msg_size    += sizeof(p_resp->p_content->hash.array);
 
         payload_len      += p_resp->p_content->stream_size;
-        payload_len      += p_resp->p_content->p_hash->size;
-
-        data_stream_size += p_resp->p_content->stream_size;
-        data_stream_size += p_resp->p_content->p_hash->size;
+        payload_len      += sizeof(p_resp->p_content->hash.array);
     }
 
-    uint8_t * p_stream = (uint8_t *)calloc(pkt_msg_size, sizeof(uint8_t));
+    uint8_t * p_stream = (uint8_t *)arena_alloc(p_wire->p_arena, pkt_msg_size);
     if (UV_INVALID_ALLOC == verify_alloc(p_stream))
     {
         goto ret_null;
     }
 
-    size_t offset = 0;
-    memcpy(p_stream, &p_resp->result, H_RETURN_CODE);
-    offset += H_RETURN_CODE;
-
+    // Tell the client which algorithm the hash in front of the data uses and
+    // which codec the data is compressed with
     uint8_t reserved = 0;
-    memcpy((p_stream + offset), &reserved, H_RESP_RESERVED);
-    offset += H_RESP_RESERVED;
-
-    uint32_t session_id = htonl(p_worker->session_id);
-    memcpy((p_stream + offset), &session_id, H_SESSION_ID);
-    offset += H_SESSION_ID;
-
-    uint64_t pld_size = htonll(payload_len);
-    memcpy((p_stream + offset), &pld_size, H_PAYLOAD_LEN);
-    offset += H_PAYLOAD_LEN;
-
-    memcpy((p_stream + offset), &msg_len, H_MSG_LEN);
-    offset += H_MSG_LEN;
-
-    memcpy((p_stream + offset), p_resp->msg, msg_len);
-    offset += msg_len;
-
     if (NULL != p_resp->p_content)
     {
-        memcpy((p_stream + offset), p_resp->p_content->p_hash->array, p_resp->p_content->p_hash->size);
-        offset += p_resp->p_content->p_hash->size;
-
-        memcpy((p_stream + offset), p_resp->p_content->p_stream, p_resp->p_content->stream_size);
+        reserved = (uint8_t)(p_resp->p_content->hash_alg
+                             | (p_resp->p_content->codec << CODEC_SHIFT));
     }
 
-    // Data is going to be sent two segments to facilitate the packet size
-    // limit for the message response packet of 2048 and the file data stream
-    // for 1016 bytes per packet. So the first everything but the file data
-    // stream
-    offset                  = 0;
-    ssize_t sent_bytes      = 0; // Number of bytes to send per packet
-    ssize_t total_sent      = 0; // Total number of bytes sent so far
-    size_t total_send_size  = pkt_msg_size - data_stream_size; // total to send
-
-    // If total bytes to send is less than the MAX size to send, then
-    // set to send value to the total_send_size. Otherwise, set it to
-    // the MAX_MSG_SIZE of 2048
-    size_t send_size = (total_send_size < MAX_MSG_SIZE) ? total_send_size
-                                                        : MAX_MSG_SIZE;
-    for (;;)
+    // Busy responses tell the client when to retry, v1 ones in the reserved
+    // byte they have no other use for
+    uint32_t retry_ms = (OP_SERVER_BUSY == p_resp->result) ? p_wire->retry_ms : 0;
+    if (!b_v2 && (retry_ms > 0))
     {
-        sent_bytes = write(p_worker->fd, (p_stream + offset), send_size);
-        if (-1 == sent_bytes)
-        {
-            debug_print_err("%s\n", strerror(errno));
-            goto cleanup;
-        }
-        offset += (size_t)sent_bytes;
-
-        total_sent += sent_bytes;
-        if (total_sent == total_send_size)
-        {
-            debug_print("[WORKER - RESP] Responded with %ld bytes\n", total_sent);
-            break;
-        }
-
-        send_size = total_send_size - (size_t)total_sent;
-        send_size = (send_size < MAX_MSG_SIZE) ? send_size : MAX_MSG_SIZE;
+        uint32_t units = (retry_ms + ADMIT_RETRY_UNIT_MS - 1) / ADMIT_RETRY_UNIT_MS;
+        reserved = (uint8_t)((units > UINT8_MAX) ? UINT8_MAX : units);
     }
 
-    // If there is a file stream send it while taking into account
-    // the file size limit of 1016 bytes
-    if (data_stream_size > 0)
+    size_t offset = 0;
+    if (b_v2)
     {
-        total_send_size = data_stream_size;
-        total_sent      = 0;
-        send_size = (total_send_size < MAX_FILE_SIZE) ? total_send_size
-                                                      : MAX_FILE_SIZE;
-        for (;;)
-        {
-            sent_bytes = write(p_worker->fd, (p_stream + offset), send_size);
-            if (-1 == sent_bytes)
-            {
-                debug_print_err("%s\n", strerror(errno));
-                goto cleanup;
-            }
-            offset += (size_t)sent_bytes;
-            total_sent += sent_bytes;
-
-            if (total_sent == total_send_size)
-            {
-                debug_print("[WORKER - RESP] Responded with %ld bytes\n", total_sent);
-                break;
-            }
-
-            send_size = total_send_size - (size_t)total_sent;
-            send_size = (send_size < MAX_FILE_SIZE) ? send_size : MAX_FILE_SIZE;
-        }
+        wire_v2_response_t header = {
+            .version        = WIRE_VERSION_2,
+            .result         = (uint8_t)p_resp->result,
+            .content_flags  = reserved,
+            .msg_len        = (uint8_t)msg_len,
+            .request_id     = htonl(p_wire->request_id),
+            .session_id     = htonl(p_wire->session_id),
+            .retry_ms       = htonl(retry_ms),
+            .payload_len    = htonll(payload_len)
+        };
+        memcpy(p_stream, &header, sizeof(header));
+        offset += sizeof(header);
     }
-    free(p_stream);
-    return;
+    else
+    {
+        memcpy(p_stream, &p_resp->result, H_RETURN_CODE);
+        offset += H_RETURN_CODE;
 
-cleanup:
-    free(p_stream);
-ret_null:
-    return;
-}
+        memcpy((p_stream + offset), &reserved, H_RESP_RESERVED);
+        offset += H_RESP_RESERVED;
 
-/*!
- * @brief Function handles reading from the file descriptor and populates the
- * void pointer supplied with using the bytes_to_read parameter
- *
- * @param fd
- * @param payload
- * @param bytes_to_read
- * @return
- */
-static ret_codes_t read_stream(int fd, void * payload, size_t bytes_to_read)
-{
-    ssize_t read_bytes;
-    ssize_t total_bytes_read = 0;
-    ret_codes_t res = OP_FAILURE;
+        uint32_t session_id = htonl(p_wire->session_id);
+        memcpy((p_stream + offset), &session_id, H_SESSION_ID);
+        offset += H_SESSION_ID;
 
-    if (0 == bytes_to_read)
-    {
-        res = OP_SUCCESS;
-        goto ret_null;
-    }
+        uint64_t pld_size = htonll(payload_len);
+        memcpy((p_stream + offset), &pld_size, H_PAYLOAD_LEN);
+        offset += H_PAYLOAD_LEN;
 
-    if (NULL == payload)
-    {
-        goto ret_null;
+        memcpy((p_stream + offset), &msg_len, H_MSG_LEN);
+        offset += H_MSG_LEN;
     }
 
-    // Buffer will be used to read from the file descriptor
-    uint8_t * read_buffer = (uint8_t *)calloc(1, bytes_to_read + 1);
-    if (UV_INVALID_ALLOC == verify_alloc(read_buffer))
-    {
-        debug_print_err("%s\n", "Unable to allocate memory for read_buffer");
-        goto ret_null;
-    }
+    memcpy((p_stream + offset), p_resp->msg, msg_len);
+    offset += msg_len;
 
-    uint8_t * payload_buffer = (uint8_t *)calloc(1, bytes_to_read + 1);
-    if (UV_INVALID_ALLOC == verify_alloc(payload_buffer))
+    if (NULL != p_resp->p_content)
     {
-        debug_print_err("%s\n", "Unable to allocate memory for read_buffer");
-        goto clean_read_buff;
+        memcpy((p_stream + offset), p_resp->p_content->hash.array, sizeof(p_resp->p_content->hash.array));
     }
 
-    bool keep_reading = true;
-    while (keep_reading)
+    ret_codes_t result = OP_SUCCESS;
+    if (b_v2)
     {
-        read_bytes = read(fd, read_buffer, 1);
-        if (-1 == read_bytes)
+        // The header is written whole and the data in frames after it. The
+        // write lock is only held while a piece is written, so a large or
+        // shaped response does not hold back the others of the connection
+        shape_flow_take(p_worker->p_flow, pkt_msg_size);
+        pthread_mutex_lock(&p_worker->write_lock);
+        result = write_all(p_worker->fd, p_stream, pkt_msg_size, 0);
+        pthread_mutex_unlock(&p_worker->write_lock);
+        if (OP_SUCCESS == result)
         {
-            // If timed out, display message indicating that it timed out
-            if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
-            {
-                debug_print("%s\n", "[STREAM READ] Read timed out");
-                res = OP_SESSION_ERROR;
-            }
-            else
-            {
-                debug_print_err("[WORKER - READ] Unable to read from fd: %s\n", strerror(errno));
-            }
-            goto clean_buffers;
-        }
-        else if (0 == read_bytes)
-        {
-            debug_print_err("%s\n", "[WORKER - READ] Read zero bytes. Client likely closed connection.");
-            res = OP_SOCK_CLOSED;
-            goto clean_buffers;
+            frame_sink_t sink = {
+                .p_worker   = p_worker,
+                .request_id = p_wire->request_id
+            };
+            result = send_data(p_resp->p_content, send_frames, &sink);
         }
-
-        // Use string operations to concatenate the final payload buffer
-        memcpy(payload_buffer + total_bytes_read, read_buffer, (unsigned long)read_bytes);
-        total_bytes_read = total_bytes_read + read_bytes;
-
-        if (total_bytes_read == bytes_to_read)
+    }
+    else
+    {
+        // v1 responses are written whole, one at a time. The header and the
+        // data both go through send_chunk, so shaped connections are charged
+        // a slice at a time rather than the whole body up front
+        pthread_mutex_lock(&p_worker->write_lock);
+        result = send_chunk(p_stream, pkt_msg_size, p_worker);
+        if (OP_SUCCESS == result)
         {
-            keep_reading = false;
+            result = send_data(p_resp->p_content, send_chunk, p_worker);
         }
+        pthread_mutex_unlock(&p_worker->write_lock);
     }
 
-    // Copy the data read into the callers buffer
-    memcpy(payload, payload_buffer, bytes_to_read);
-
-    // Free the working buffers
-    free(read_buffer);
-    free(payload_buffer);
-    return OP_SUCCESS;
+    if (OP_SUCCESS != result)
+    {
+        // The client cannot tell where a response cut short ends, so the
+        // connection is closed rather than left out of step
+        debug_print_err("[WORKER - RESP] Failed to respond to request %u\n",
+                        p_wire->request_id);
+        shutdown(p_worker->fd, SHUT_RDWR);
+        goto ret_null;
+    }
+    debug_print("[WORKER - RESP] Responded with %zu bytes\n",
+                pkt_msg_size + ((NULL == p_resp->p_content) ? 0 : p_resp->p_content->stream_size));
 
-clean_buffers:
-    free(payload_buffer);
-clean_read_buff:
-    free(read_buffer);
 ret_null:
-    return res;
+    return;
 }
 
-
-
-
 /*
  *
  * Expressive functions used to increase readability
@@ -940,125 +1486,16 @@ ret_null:
  */
 
 /*!
- * @brief Function is just used for readability sakes
- */
-static bool user_payload_has_password(uint64_t payload_len,
-                                      uint16_t username_len)
-{
-    uint32_t r_operand = H_USR_ACT_FLAG + H_USR_PERMISSION + H_USERNAME_LEN + username_len;
-    if (payload_len <= r_operand)
-    {
-        return false;
-    }
-    return true;
-}
-
-/*!
- * @brief Function is just used for readability sakes
- */
-static bool std_payload_has_file(uint64_t payload_len, uint16_t path_len)
-{
-    return ((payload_len - path_len) >= H_HASH_LEN);
-}
-
-
-/*!
- * @brief Safely calculate the amount of bytes left in the payload
- */
-static uint64_t get_file_stream_size(uint64_t payload_len, uint16_t path_len)
-{
-    uint32_t r_operand = path_len + H_HASH_LEN + H_PATH_LEN;
-    if (payload_len < r_operand)
-    {
-        return 0;
-    }
-    return payload_len - r_operand;
-}
-
-/*!
- * @brief Function is used to create the strings provided in the payload.
- *
- * @param p_ld Thread worker structure object
- * @param pp_byte_array Double pointer to where the string will be set to
- * @param array_len Length of the string
- * @return Server ret code
- */
-static ret_codes_t make_byte_array(worker_payload_t * p_ld,
-                                   uint8_t ** pp_byte_array,
-                                   uint64_t array_len,
-                                   bool make_string)
-{
-    if ((0 == array_len) && (false == make_string))
-    {
-        return OP_SUCCESS;
-    }
-
-    uint8_t * p_array = NULL;
-    ret_codes_t result = OP_FAILURE;
-    if (make_string)
-    {
-        p_array = (uint8_t *)calloc(array_len, sizeof(uint8_t) + 1);
-    }
-    else
-    {
-        p_array = (uint8_t *)calloc(array_len, sizeof(uint8_t));
-    }
-
-    if (UV_INVALID_ALLOC == verify_alloc(p_array))
-    {
-        goto ret_null;
-    }
-
-    result = read_stream(p_ld->fd, p_array, array_len);
-    if (OP_SUCCESS != result)
-    {
-        goto ret_null;
-    }
-
-    if (make_string)
-    {
-        p_array[array_len] = '\0';
-    }
-
-    *pp_byte_array = p_array;
-    return OP_SUCCESS;
-
-ret_null:
-    return result;
-}
-
-/*!
- * @brief Return the port used from the connection
+ * @brief Return the numeric address and port used from the connection. Host
+ * names are not looked up so accepting never waits on DNS
  */
 static int get_ip_port(struct sockaddr * addr, socklen_t addr_size, char * host, char * port)
 {
-    return getnameinfo(addr, addr_size, host, NI_MAXHOST, port, NI_MAXSERV, NI_NUMERICSERV);
+    return getnameinfo(addr, addr_size, host, NI_MAXHOST, port, NI_MAXSERV,
+                       NI_NUMERICHOST | NI_NUMERICSERV);
 
 }
 
-static const char * action_to_string(act_t code)
-{
-    switch (code)
-    {
-        case ACT_USER_OPERATION:
-            return "USER_OPERATION";
-        case ACT_DELETE_REMOTE_FILE:
-            return "DELETE_REMOTE_FILE";
-        case ACT_LIST_REMOTE_DIRECTORY:
-            return "LIST_REMOTE_DIR";
-        case ACT_GET_REMOTE_FILE:
-            return "GET_REMOTE_FILE";
-        case ACT_MAKE_REMOTE_DIRECTORY:
-            return "MAKE_REMOTE_DIR";
-        case ACT_PUT_REMOTE_FILE:
-            return "PUT_REMOTE_FILE";
-        case ACT_LOCAL_OPERATION:
-            return "LOCAL_OP";
-        default:
-            return "UNKNOWN";
-    }
-}
-
 static size_t get_base_resp_size(void)
 {
     return H_RETURN_CODE + H_RESP_RESERVED + H_SESSION_ID + H_PAYLOAD_LEN + H_MSG_LEN;
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE // syncfs
+#include <server_sync.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Time the commit thread waits for more writers to join a batch before
+// issuing the syncfs. Short enough to stay below a network round trip
+#define GROUP_COMMIT_WINDOW_NS (2 * 1000 * 1000)
+
+struct sync
+{
+    sync_mode_t         mode;
+    int                 fs_fd;          // Any fd on the file system to syncfs
+    pthread_t           commit_thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      request_cond;   // Signals the commit thread
+    pthread_cond_t      done_cond;      // Signals the waiting writers
+    uint64_t            open_batch;     // Batch that new writers join
+    uint64_t            done_batch;     // Last batch that landed
+    uint64_t            failed_batch;   // Last batch whose syncfs failed
+    uint32_t            waiters;        // Writers waiting on open_batch
+    bool                b_shutdown;
+};
+
+static void * commit_loop(void * p_arg);
+static ret_codes_t group_wait(sync_t * p_sync);
+
+/*!
+ * @brief Create the sync object used to flush file writes to stable storage.
+ * In SYNC_GROUP mode a commit thread is started which batches the flush
+ * requests of all writers that arrive within a short window into a single
+ * syncfs call on the file system holding p_dir.
+ *
+ * @param mode Durability mode
+ * @param p_dir Path to a directory on the file system that will be synced
+ * @return sync_t object if successful otherwise NULL
+ */
+sync_t * sync_init(sync_mode_t mode, const char * p_dir)
+{
+    if ((NULL == p_dir) || (mode > SYNC_GROUP))
+    {
+        goto ret_null;
+    }
+
+    sync_t * p_sync = (sync_t *)calloc(1, sizeof(sync_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_sync))
+    {
+        goto ret_null;
+    }
+    *p_sync = (sync_t){
+        .mode           = mode,
+        .fs_fd          = -1,
+        .open_batch     = 1,
+        .done_batch     = 0,
+        .failed_batch   = 0,
+        .waiters        = 0,
+        .b_shutdown     = false
+    };
+
+    if (SYNC_GROUP != mode)
+    {
+        return p_sync;
+    }
+
+    p_sync->fs_fd = open(p_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == p_sync->fs_fd)
+    {
+        fprintf(stderr, "[!] Unable to open %s for group commits: %s\n",
+                p_dir, strerror(errno));
+        goto cleanup_sync;
+    }
+
+    pthread_mutex_init(&p_sync->lock, NULL);
+    pthread_cond_init(&p_sync->request_cond, NULL);
+    pthread_cond_init(&p_sync->done_cond, NULL);
+    if (0 != pthread_create(&p_sync->commit_thread, NULL, commit_loop, p_sync))
+    {
+        fprintf(stderr, "[!] Unable to start the group commit thread\n");
+        goto cleanup_locks;
+    }
+    return p_sync;
+
+cleanup_locks:
+    pthread_cond_destroy(&p_sync->done_cond);
+    pthread_cond_destroy(&p_sync->request_cond);
+    pthread_mutex_destroy(&p_sync->lock);
+    close(p_sync->fs_fd);
+cleanup_sync:
+    free(p_sync);
+ret_null:
+    return NULL;
+}
+
+/*!
+ * @brief Stop the commit thread if running and free the sync object
+ *
+ * @param pp_sync Double pointer to the sync object
+ */
+void sync_destroy(sync_t ** pp_sync)
+{
+    if ((NULL == pp_sync) || (NULL == *pp_sync))
+    {
+        return;
+    }
+
+    sync_t * p_sync = *pp_sync;
+    if (SYNC_GROUP == p_sync->mode)
+    {
+        // The commit thread drains any pending batch before exiting
+        pthread_mutex_lock(&p_sync->lock);
+        p_sync->b_shutdown = true;
+        pthread_cond_signal(&p_sync->request_cond);
+        pthread_mutex_unlock(&p_sync->lock);
+        pthread_join(p_sync->commit_thread, NULL);
+
+        pthread_cond_destroy(&p_sync->done_cond);
+        pthread_cond_destroy(&p_sync->request_cond);
+        pthread_mutex_destroy(&p_sync->lock);
+        close(p_sync->fs_fd);
+    }
+
+    free(p_sync);
+    *pp_sync = NULL;
+}
+
+/*!
+ * @brief Get the durability mode of the sync object
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @return The sync_mode_t of the object
+ */
+sync_mode_t sync_get_mode(sync_t * p_sync)
+{
+    return (NULL == p_sync) ? SYNC_NONE : p_sync->mode;
+}
+
+/*!
+ * @brief Get the number of group commits issued so far
+ *
+ * @param p_sync Pointer to the sync object. May be NULL
+ * @return Number of syncfs calls made, 0 outside of SYNC_GROUP mode
+ */
+uint64_t sync_commits(sync_t * p_sync)
+{
+    if (SYNC_GROUP != sync_get_mode(p_sync))
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&p_sync->lock);
+    uint64_t commits = p_sync->done_batch;
+    pthread_mutex_unlock(&p_sync->lock);
+    return commits;
+}
+
+/*!
+ * @brief Make the data of the file descriptor durable. Returns immediately
+ * in SYNC_NONE mode and calls fdatasync in SYNC_OP mode. In SYNC_GROUP mode
+ * it returns immediately as well, since the syncfs that sync_dir waits for
+ * flushes the data together with the directory entry. Callers must follow
+ * it with sync_dir before reporting the write as durable.
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @param fd File descriptor of the file written
+ * @retval OP_SUCCESS The data is durable
+ * @retval OP_IO_ERROR The flush failed
+ */
+ret_codes_t sync_data(sync_t * p_sync, int fd)
+{
+    switch (sync_get_mode(p_sync))
+    {
+        case SYNC_OP:
+            if (-1 == fdatasync(fd))
+            {
+                debug_print_err("[!] fdatasync failed: %s\n", strerror(errno));
+                return OP_IO_ERROR;
+            }
+            return OP_SUCCESS;
+        default:
+            return OP_SUCCESS;
+    }
+}
+
+/*!
+ * @brief Make the entries of the directory durable. Returns immediately
+ * in SYNC_NONE mode, calls fsync on the directory in SYNC_OP mode and waits
+ * for the next group commit in SYNC_GROUP mode.
+ *
+ * @param p_sync Pointer to the sync object. NULL is treated as SYNC_NONE
+ * @param p_dir Path of the directory that was modified
+ * @retval OP_SUCCESS The directory entries are durable
+ * @retval OP_IO_ERROR The flush failed
+ */
+ret_codes_t sync_dir(sync_t * p_sync, const char * p_dir)
+{
+    switch (sync_get_mode(p_sync))
+    {
+        case SYNC_OP:
+        {
+            int dir_fd = open(p_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if ((-1 == dir_fd) || (-1 == fsync(dir_fd)))
+            {
+                debug_print_err("[!] Unable to sync directory %s\n:Error: %s\n",
+                                p_dir, strerror(errno));
+                if (-1 != dir_fd)
+                {
+                    close(dir_fd);
+                }
+                return OP_IO_ERROR;
+            }
+            close(dir_fd);
+            return OP_SUCCESS;
+        }
+        case SYNC_GROUP:
+            return group_wait(p_sync);
+        default:
+            return OP_SUCCESS;
+    }
+}
+
+/*!
+ * @brief Join the currently open batch and block until the commit thread
+ * reports that the batch landed.
+ *
+ * @param p_sync Pointer to the sync object
+ * @return OP_SUCCESS if the batch was synced otherwise OP_IO_ERROR
+ */
+static ret_codes_t group_wait(sync_t * p_sync)
+{
+    pthread_mutex_lock(&p_sync->lock);
+    uint64_t batch = p_sync->open_batch;
+    p_sync->waiters++;
+    pthread_cond_signal(&p_sync->request_cond);
+
+    while (p_sync->done_batch < batch)
+    {
+        pthread_cond_wait(&p_sync->done_cond, &p_sync->lock);
+    }
+
+    // syncfs reports errors for the file system as a whole so a failure in
+    // a later batch is reported as well. Being pessimistic is the safe choice
+    ret_codes_t result = (p_sync->failed_batch >= batch) ? OP_IO_ERROR : OP_SUCCESS;
+    pthread_mutex_unlock(&p_sync->lock);
+    return result;
+}
+
+/*!
+ * @brief Commit thread. Sleeps until a writer requests a sync, lingers for
+ * GROUP_COMMIT_WINDOW_NS to let concurrent writers join the batch, then
+ * closes the batch and issues a single syncfs for all of them.
+ *
+ * @param p_arg Pointer to the sync object
+ * @return NULL
+ */
+static void * commit_loop(void * p_arg)
+{
+    sync_t * p_sync = (sync_t *)p_arg;
+    const struct timespec window = {
+        .tv_sec     = 0,
+        .tv_nsec    = GROUP_COMMIT_WINDOW_NS
+    };
+
+    pthread_mutex_lock(&p_sync->lock);
+    for (;;)
+    {
+        while ((0 == p_sync->waiters) && (!p_sync->b_shutdown))
+        {
+            pthread_cond_wait(&p_sync->request_cond, &p_sync->lock);
+        }
+        if ((0 == p_sync->waiters) && p_sync->b_shutdown)
+        {
+            break;
+        }
+
+        // Let other writers pile into the open batch
+        pthread_mutex_unlock(&p_sync->lock);
+        nanosleep(&window, NULL);
+        pthread_mutex_lock(&p_sync->lock);
+
+        // Close the batch. Writers arriving from here on join the next one
+        uint64_t batch = p_sync->open_batch++;
+        uint32_t writers = p_sync->waiters;
+        p_sync->waiters = 0;
+        pthread_mutex_unlock(&p_sync->lock);
+
+        int result = syncfs(p_sync->fs_fd);
+        if (-1 == result)
+        {
+            fprintf(stderr, "[!] Group commit failed: %s\n", strerror(errno));
+        }
+
+        pthread_mutex_lock(&p_sync->lock);
+        if (-1 == result)
+        {
+            p_sync->failed_batch = batch;
+        }
+        p_sync->done_batch = batch;
+        pthread_cond_broadcast(&p_sync->done_cond);
+        debug_print("[SYNC] Committed batch %lu for %u writers\n", batch, writers);
+    }
+    pthread_mutex_unlock(&p_sync->lock);
+    return NULL;
+}
@@ -0,0 +1,944 @@
+#include <server_wire.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(wire_header_t) == (H_OPCODE + H_USER_FLAG + H_REQ_RESERVED
+                                         + H_USERNAME_LEN + H_PASSWORD_LEN
+                                         + H_SESSION_ID),
+               "wire_header_t must match the request header");
+_Static_assert(sizeof(wire_v2_header_t) == WIRE_V2_HEADER_LEN,
+               "wire_v2_header_t must match the v2 request header");
+_Static_assert(sizeof(wire_v2_response_t) == WIRE_V2_HEADER_LEN,
+               "wire_v2_response_t must match the v2 response header");
+
+static ret_codes_t read_v1_header(wire_reader_t * p_reader,
+                                  arena_t * p_arena,
+                                  wire_payload_t * p_wire);
+static ret_codes_t read_v2_header(wire_reader_t * p_reader,
+                                  arena_t * p_arena,
+                                  wire_payload_t * p_wire);
+
+static ret_codes_t read_view(wire_reader_t * p_reader,
+                             arena_t * p_arena,
+                             size_t length,
+                             uint8_t ** pp_view);
+static ret_codes_t read_data(wire_reader_t * p_reader,
+                             arena_t * p_arena,
+                             size_t length,
+                             uint8_t ** pp_data);
+static uint8_t * spill_data(wire_reader_t * p_reader, arena_t * p_arena, size_t length);
+static ret_codes_t read_into(wire_reader_t * p_reader, uint8_t * p_bytes, size_t length);
+static ret_codes_t read_string(wire_reader_t * p_reader,
+                               arena_t * p_arena,
+                               size_t length,
+                               char ** pp_string);
+static ret_codes_t read_u16(wire_reader_t * p_reader, arena_t * p_arena, uint16_t * p_value);
+static ret_codes_t fill(wire_reader_t * p_reader);
+static ret_codes_t read_exact(wire_reader_t * p_reader, uint8_t * p_buffer, size_t length);
+static ret_codes_t skip(wire_reader_t * p_reader, uint64_t length);
+static ret_codes_t detach_view(wire_reader_t * p_reader,
+                               arena_t * p_arena,
+                               size_t length,
+                               uint8_t ** pp_view);
+static ret_codes_t read_std_payload(wire_reader_t * p_reader,
+                                    arena_t * p_arena,
+                                    wire_payload_t * p_wire);
+static ret_codes_t read_user_payload(wire_reader_t * p_reader,
+                                     arena_t * p_arena,
+                                     wire_payload_t * p_wire);
+
+// Readability functions
+static bool take_field(uint64_t * p_left, uint64_t length);
+static ret_codes_t skip_rest(wire_reader_t * p_reader, uint64_t left);
+static const char * action_to_string(act_t code);
+
+/*!
+ * @brief Prepare the reader of a connection
+ *
+ * @param p_reader Pointer to the reader
+ * @param fd Socket of the connection
+ * @param p_flow Flow of the connection the bytes read are charged to. May be
+ * NULL
+ * @param p_admit Admission control of the server. May be NULL
+ */
+void wire_reader_init(wire_reader_t * p_reader,
+                      int fd,
+                      shape_flow_t * p_flow,
+                      admit_t * p_admit)
+{
+    if (NULL == p_reader)
+    {
+        return;
+    }
+    p_reader->fd = fd;
+    p_reader->p_flow = p_flow;
+    p_reader->p_admit = p_admit;
+    p_reader->busy_ms = 0;
+    p_reader->p_spill = NULL;
+    p_reader->p_spill_mem = NULL;
+    p_reader->start = 0;
+    p_reader->end = 0;
+}
+
+/*!
+ * @brief Read the next request of the connection in either version of the
+ * protocol. The fields of the request are valid until the next request is
+ * read and the arena is reset.
+ *
+ * The request is admitted between its header and its payload. A request
+ * turned away has its payload read and dropped so the connection stays in
+ * step, only its header fields and the retry hint are set. The payload of a
+ * connection turned away as a whole is left unread since the connection is
+ * closed after the answer. A request read successfully stays admitted until
+ * it is answered.
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena the strings and large fields are allocated from
+ * @param p_wire Pointer to the zeroed wire_payload_t to populate
+ * @retval OP_SUCCESS The request was read
+ * @retval OP_SERVER_BUSY The request was turned away by the admission control
+ * @retval OP_SOCK_CLOSED The client closed the connection
+ * @retval OP_SESSION_ERROR The client did not send the request in time
+ * @retval OP_FAILURE The read failed or memory ran out
+ */
+ret_codes_t wire_read_request(wire_reader_t * p_reader,
+                              arena_t * p_arena,
+                              wire_payload_t * p_wire)
+{
+    if ((NULL == p_reader) || (NULL == p_arena) || (NULL == p_wire))
+    {
+        return OP_FAILURE;
+    }
+
+    // Bytes of this request that were read with the last one are moved to
+    // the front so the request has the whole buffer
+    if (p_reader->start > 0)
+    {
+        memmove(p_reader->buffer, p_reader->buffer + p_reader->start,
+                p_reader->end - p_reader->start);
+        p_reader->end -= p_reader->start;
+        p_reader->start = 0;
+    }
+
+    // The first byte tells the version of the request
+    ret_codes_t result = OP_SUCCESS;
+    while (p_reader->end == p_reader->start)
+    {
+        result = fill(p_reader);
+        if (OP_SUCCESS != result)
+        {
+            return result;
+        }
+    }
+    if (0 != (p_reader->buffer[p_reader->start] & WIRE_VERSION_FLAG))
+    {
+        result = read_v2_header(p_reader, p_arena, p_wire);
+    }
+    else
+    {
+        result = read_v1_header(p_reader, p_arena, p_wire);
+    }
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    // Nothing of the payload is kept for a request turned away
+    if (0 != p_reader->busy_ms)
+    {
+        p_wire->retry_ms = p_reader->busy_ms;
+        return OP_SERVER_BUSY;
+    }
+    result = admit_enter(p_reader->p_admit, wire_lane(p_wire), p_wire->payload_len,
+                         &p_wire->retry_ms);
+    if (OP_SUCCESS != result)
+    {
+        ret_codes_t skipped = skip(p_reader, p_wire->payload_len);
+        return (OP_SUCCESS == skipped) ? result : skipped;
+    }
+
+    if (ACT_USER_OPERATION == p_wire->opt_code)
+    {
+        debug_print("%s\n", "[WORKER - READ_CLIENT] Parsing user_payload "
+                            "in client request");
+        result = read_user_payload(p_reader, p_arena, p_wire);
+    }
+    else if (ACT_LOCAL_OPERATION != p_wire->opt_code)
+    {
+        debug_print("%s\n", "[WORKER - READ_CLIENT] Parsing std_payload "
+                            "in client request");
+        result = read_std_payload(p_reader, p_arena, p_wire);
+    }
+    else
+    {
+        result = skip_rest(p_reader, p_wire->payload_len);
+    }
+    if (OP_SUCCESS != result)
+    {
+        admit_leave(p_reader->p_admit, p_wire->payload_len);
+    }
+    return result;
+}
+
+/*!
+ * @brief Copy the fields of the request that point into the receive buffer
+ * to the arena so the request outlives the next read of the connection
+ *
+ * @param p_reader Pointer to the reader the request was read with
+ * @param p_arena Arena of the request
+ * @param p_wire Pointer to the request
+ * @return OP_SUCCESS if the fields were copied otherwise OP_FAILURE
+ */
+ret_codes_t wire_detach(wire_reader_t * p_reader,
+                        arena_t * p_arena,
+                        wire_payload_t * p_wire)
+{
+    if ((NULL == p_reader) || (NULL == p_arena) || (NULL == p_wire))
+    {
+        return OP_FAILURE;
+    }
+
+    // The strings are copied by the read already
+    if (STD_PAYLOAD != p_wire->type)
+    {
+        return OP_SUCCESS;
+    }
+    std_payload_t * p_load = p_wire->p_std_payload;
+    ret_codes_t result = detach_view(p_reader, p_arena, H_HASH_LEN, &p_load->p_hash_stream);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    return detach_view(p_reader, p_arena, (size_t)p_load->byte_stream_len,
+                       &p_load->p_byte_stream);
+}
+
+/*!
+ * @brief Pick the lane the request is answered in from its opcode and the
+ * size of its payload. GETs and signatures read a whole file and large PUTs
+ * write one, the other requests only touch metadata
+ *
+ * @param p_wire Pointer to the request
+ * @return IO_LANE_BULK for file transfers otherwise IO_LANE_INTERACTIVE
+ */
+io_lane_t wire_lane(const wire_payload_t * p_wire)
+{
+    if (NULL == p_wire)
+    {
+        return IO_LANE_INTERACTIVE;
+    }
+
+    switch (p_wire->opt_code)
+    {
+        case ACT_GET_REMOTE_FILE:
+        case ACT_GET_SIGNATURE:
+            return IO_LANE_BULK;
+        case ACT_PUT_REMOTE_FILE:
+        case ACT_PUT_DELTA:
+            return (p_wire->payload_len >= IO_BULK_BYTES) ? IO_LANE_BULK
+                                                          : IO_LANE_INTERACTIVE;
+        default:
+            return IO_LANE_INTERACTIVE;
+    }
+}
+
+static ret_codes_t read_v1_header(wire_reader_t * p_reader,
+                                  arena_t * p_arena,
+                                  wire_payload_t * p_wire)
+{
+    /*
+     *
+     * 0               1               2               3
+     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |     OPCODE    |   USER_FLAG   |           RESERVED            |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |        USERNAME_LEN           |        PASSWORD_LEN           |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                          SESSION_ID                           |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                    **USERNAME + PASSWORD**                    |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                          PAYLOAD_LEN ->                       |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                       <- PAYLOAD_LEN                          |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                ~user_payload || std_payload~                  |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     */
+    uint8_t * p_bytes = NULL;
+    ret_codes_t result = read_view(p_reader, p_arena, sizeof(wire_header_t), &p_bytes);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    wire_header_t header;
+    memcpy(&header, p_bytes, sizeof(header));
+    p_wire->version      = WIRE_VERSION_1;
+    p_wire->opt_code     = (act_t)header.opt_code;
+    p_wire->user_flag    = (usr_act_t)header.user_flag;
+    p_wire->flags        = ntohs(header.flags);
+    p_wire->username_len = ntohs(header.username_len);
+    p_wire->passwd_len   = ntohs(header.passwd_len);
+    p_wire->session_id   = ntohl(header.session_id);
+
+    // The database looks users up by their name as a string
+    result = read_string(p_reader, p_arena, p_wire->username_len, &p_wire->p_username);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    result = read_string(p_reader, p_arena, p_wire->passwd_len, &p_wire->p_passwd);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    result = read_view(p_reader, p_arena, H_PAYLOAD_LEN, &p_bytes);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    memcpy(&p_wire->payload_len, p_bytes, H_PAYLOAD_LEN);
+    p_wire->payload_len = ntohll(p_wire->payload_len);
+    return OP_SUCCESS;
+}
+
+static ret_codes_t read_v2_header(wire_reader_t * p_reader,
+                                  arena_t * p_arena,
+                                  wire_payload_t * p_wire)
+{
+    /*
+     *
+     * 0               1               2               3
+     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |    VERSION    |     OPCODE    |            FLAGS              |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                          REQUEST_ID                           |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                          SESSION_ID                           |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |   USER_FLAG   |   RESERVED    |         USERNAME_LEN          |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |         PASSWORD_LEN          |           RESERVED            |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                           RESERVED                            |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                          PAYLOAD_LEN ->                       |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                       <- PAYLOAD_LEN                          |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                    **USERNAME + PASSWORD**                    |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                ~user_payload || std_payload~                  |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     */
+    uint8_t * p_bytes = NULL;
+    ret_codes_t result = read_view(p_reader, p_arena, sizeof(wire_v2_header_t), &p_bytes);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    wire_v2_header_t header;
+    memcpy(&header, p_bytes, sizeof(header));
+    if (WIRE_VERSION_2 != header.version)
+    {
+        debug_print_err("[WORKER - READ_CLIENT] Unsupported version 0x%x\n", header.version);
+        return OP_FAILURE;
+    }
+    p_wire->version      = header.version;
+    p_wire->request_id   = ntohl(header.request_id);
+    p_wire->opt_code     = (act_t)header.opt_code;
+    p_wire->user_flag    = (usr_act_t)header.user_flag;
+    p_wire->flags        = ntohs(header.flags);
+    p_wire->username_len = ntohs(header.username_len);
+    p_wire->passwd_len   = ntohs(header.passwd_len);
+    p_wire->session_id   = ntohl(header.session_id);
+
+    // PAYLOAD_LEN counts the credentials as well, the payload parsers only
+    // see what follows them
+    uint64_t payload_len = ntohll(header.payload_len);
+    uint64_t credentials_len = (uint64_t)p_wire->username_len + p_wire->passwd_len;
+    if (payload_len < credentials_len)
+    {
+        return OP_FAILURE;
+    }
+    p_wire->payload_len = payload_len - credentials_len;
+
+    result = read_string(p_reader, p_arena, p_wire->username_len, &p_wire->p_username);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    return read_string(p_reader, p_arena, p_wire->passwd_len, &p_wire->p_passwd);
+}
+
+static ret_codes_t read_std_payload(wire_reader_t * p_reader,
+                                    arena_t * p_arena,
+                                    wire_payload_t * p_wire)
+{
+    p_wire->type = STD_PAYLOAD;
+    p_wire->p_std_payload = (std_payload_t *)arena_alloc(p_arena, sizeof(std_payload_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_wire->p_std_payload))
+    {
+        return OP_FAILURE;
+    }
+    std_payload_t * p_load = p_wire->p_std_payload;
+
+    /*
+     * 0               1               2               3
+     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |          PATH_LEN             |         **PATH_NAME**         |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |                     **FILE_DATA_STREAM**                      |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     */
+    // Every field is taken from the bytes the payload declares so a field
+    // can never run into the next request
+    uint64_t left = p_wire->payload_len;
+    if (!take_field(&left, H_PATH_LEN))
+    {
+        return OP_FAILURE;
+    }
+    ret_codes_t result = read_u16(p_reader, p_arena, &p_load->path_len);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    // Paths are resolved as strings by the file API
+    if (!take_field(&left, p_load->path_len))
+    {
+        return OP_FAILURE;
+    }
+    result = read_string(p_reader, p_arena, p_load->path_len, &p_load->p_path);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    // The data is whatever follows the hash
+    if (take_field(&left, H_HASH_LEN))
+    {
+        result = read_view(p_reader, p_arena, H_HASH_LEN, &p_load->p_hash_stream);
+        if (OP_SUCCESS != result)
+        {
+            return result;
+        }
+
+        p_load->byte_stream_len = left;
+        left = 0;
+        if (p_load->byte_stream_len > SIZE_MAX)
+        {
+            return OP_FAILURE;
+        }
+        if (p_load->byte_stream_len > 0)
+        {
+            result = read_data(p_reader, p_arena, (size_t)p_load->byte_stream_len,
+                               &p_load->p_byte_stream);
+            if (OP_SUCCESS != result)
+            {
+                return result;
+            }
+        }
+    }
+    result = skip_rest(p_reader, left);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    debug_print("[~] Parsed std payload:\n"
+                "    [~]    Session ID: %u\n"
+                "    [~]    Command:   %s\n"
+                "    [~]    PATH_LEN:  %d\n"
+                "    [~]    PATH_NAME: %s\n"
+                "    [~]    FileLen:   %ld\n",
+                p_wire->session_id,
+                action_to_string(p_wire->opt_code),
+                p_load->path_len,
+                p_load->p_path,
+                p_load->byte_stream_len
+                );
+    return OP_SUCCESS;
+}
+
+static ret_codes_t read_user_payload(wire_reader_t * p_reader,
+                                     arena_t * p_arena,
+                                     wire_payload_t * p_wire)
+{
+    p_wire->type = USER_PAYLOAD;
+    p_wire->p_user_payload = (user_payload_t *)arena_alloc(p_arena, sizeof(user_payload_t));
+    if (UV_INVALID_ALLOC == verify_alloc(p_wire->p_user_payload))
+    {
+        return OP_FAILURE;
+    }
+    user_payload_t * p_load = p_wire->p_user_payload;
+
+    /*
+     * 0               1               2               3
+     * 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * |  USR_ACT_FLAG |   PERMISSION  |          USERNAME_LEN         |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     * | **USERNAME**  |         PASSWORD_LEN          | **PASSWORD**  |
+     * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     */
+    uint64_t left = p_wire->payload_len;
+    if (!take_field(&left, H_USR_ACT_FLAG + H_USR_PERMISSION + H_USERNAME_LEN))
+    {
+        return OP_FAILURE;
+    }
+    uint8_t * p_bytes = NULL;
+    ret_codes_t result = read_view(p_reader, p_arena,
+                                   H_USR_ACT_FLAG + H_USR_PERMISSION, &p_bytes);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    p_load->user_flag = (usr_act_t)p_bytes[0];
+    p_load->user_perm = (perms_t)p_bytes[H_USR_ACT_FLAG];
+
+    result = read_u16(p_reader, p_arena, &p_load->username_len);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    if (!take_field(&left, p_load->username_len))
+    {
+        return OP_FAILURE;
+    }
+    result = read_string(p_reader, p_arena, p_load->username_len, &p_load->p_username);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+
+    // Only "Create user" commands have the password field filled
+    if (left > 0)
+    {
+        if (!take_field(&left, H_PASSWORD_LEN))
+        {
+            return OP_FAILURE;
+        }
+        result = read_u16(p_reader, p_arena, &p_load->passwd_len);
+        if (OP_SUCCESS != result)
+        {
+            return result;
+        }
+        if (!take_field(&left, p_load->passwd_len))
+        {
+            return OP_FAILURE;
+        }
+        result = read_string(p_reader, p_arena, p_load->passwd_len, &p_load->p_passwd);
+        if (OP_SUCCESS != result)
+        {
+            return result;
+        }
+    }
+    result = skip_rest(p_reader, left);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    debug_print("[~] Parsed user payload:\n"
+                "    [~]    Session ID: %u\n"
+                "    [~]    USER_OP: %s\n"
+                "    [~]    O_PERM:  %d\n"
+                "    [~]    O_User:  %s\n"
+                "    [~]    O_Pass:  %s\n",
+           p_wire->session_id,
+           (USR_ACT_CREATE_USER == p_load->user_flag) ? "CREATE" : "DELETE",
+           p_load->user_perm,
+           p_load->p_username,
+           (NULL != p_load->p_passwd) ? p_load->p_passwd : "None");
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Get the next bytes of the connection where they were read. Bytes
+ * that do not fit in the buffer are read into memory from the arena.
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena used when the bytes do not fit in the buffer
+ * @param length Number of bytes to get
+ * @param pp_view Double pointer receiving the bytes
+ * @return OP_SUCCESS if the bytes were read otherwise the error of the read
+ */
+static ret_codes_t read_view(wire_reader_t * p_reader,
+                             arena_t * p_arena,
+                             size_t length,
+                             uint8_t ** pp_view)
+{
+    if (length <= (sizeof(p_reader->buffer) - p_reader->start))
+    {
+        while ((p_reader->end - p_reader->start) < length)
+        {
+            ret_codes_t result = fill(p_reader);
+            if (OP_SUCCESS != result)
+            {
+                return result;
+            }
+        }
+        *pp_view = p_reader->buffer + p_reader->start;
+        p_reader->start += length;
+        return OP_SUCCESS;
+    }
+
+    uint8_t * p_bytes = (uint8_t *)arena_alloc(p_arena, length);
+    if (UV_INVALID_ALLOC == verify_alloc(p_bytes))
+    {
+        return OP_FAILURE;
+    }
+    ret_codes_t result = read_into(p_reader, p_bytes, length);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    *pp_view = p_bytes;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Read the data of a PUT. Data that does not fit in the buffer is
+ * read into the arena if the memory budget has room for it and otherwise
+ * into memory backed by a temp file
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena of the request
+ * @param length Number of bytes of the data
+ * @param pp_data Double pointer receiving the data
+ * @return OP_SUCCESS if the data was read otherwise the error of the read
+ */
+static ret_codes_t read_data(wire_reader_t * p_reader,
+                             arena_t * p_arena,
+                             size_t length,
+                             uint8_t ** pp_data)
+{
+    if ((length <= (sizeof(p_reader->buffer) - p_reader->start))
+        || (NULL == p_reader->p_spill))
+    {
+        return read_view(p_reader, p_arena, length, pp_data);
+    }
+
+    // The arena gives up once the memory budget stays full
+    uint8_t * p_bytes = (uint8_t *)arena_alloc(p_arena, length);
+    if (NULL == p_bytes)
+    {
+        p_bytes = spill_data(p_reader, p_arena, length);
+    }
+    if (NULL == p_bytes)
+    {
+        return OP_FAILURE;
+    }
+    ret_codes_t result = read_into(p_reader, p_bytes, length);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    *pp_data = p_bytes;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Map memory backed by a temp file for data the memory budget has no
+ * room for. The bytes are reserved against the spill budget before the
+ * file is allocated and given back when the arena is reset
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena of the request
+ * @param length Number of bytes of the data
+ * @return Pointer to the mapped memory or NULL if the data is refused
+ */
+static uint8_t * spill_data(wire_reader_t * p_reader, arena_t * p_arena, size_t length)
+{
+    if (!arena_reserve(p_arena, p_reader->p_spill_mem, length, MEM_WAIT_MS))
+    {
+        debug_print_err("[WORKER - READ] No room to spill %zu bytes\n", length);
+        return NULL;
+    }
+    debug_print("[WORKER - READ] Spilling %zu bytes to disk\n", length);
+    return (uint8_t *)arena_map(p_arena, p_reader->p_spill, length);
+}
+
+/*!
+ * @brief Read bytes that do not fit in the buffer. The bytes already read
+ * are taken from the buffer and the rest is read straight into the memory.
+ * Earlier fields still point into the buffer so it is not moved
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_bytes Pointer to the memory receiving the bytes
+ * @param length Number of bytes to read, more than the buffer holds
+ * @return OP_SUCCESS if the bytes were read otherwise the error of the read
+ */
+static ret_codes_t read_into(wire_reader_t * p_reader, uint8_t * p_bytes, size_t length)
+{
+    size_t buffered = p_reader->end - p_reader->start;
+    memcpy(p_bytes, p_reader->buffer + p_reader->start, buffered);
+    p_reader->start = p_reader->end;
+    return read_exact(p_reader, p_bytes + buffered, length - buffered);
+}
+
+/*!
+ * @brief Read a string of the request and terminate it
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena the string is copied to
+ * @param length Number of bytes of the string
+ * @param pp_string Double pointer receiving the string
+ * @return OP_SUCCESS if the string was read otherwise the error of the read
+ */
+static ret_codes_t read_string(wire_reader_t * p_reader,
+                               arena_t * p_arena,
+                               size_t length,
+                               char ** pp_string)
+{
+    uint8_t * p_bytes = NULL;
+    ret_codes_t result = read_view(p_reader, p_arena, length, &p_bytes);
+    if (OP_SUCCESS != result)
+    {
+        return result;
+    }
+    char * p_string = (char *)arena_alloc(p_arena, length + 1);
+    if (UV_INVALID_ALLOC == verify_alloc(p_string))
+    {
+        return OP_FAILURE;
+    }
+    memcpy(p_string, p_bytes, length);
+    *pp_string = p_string;
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Read a big endian 16 bit field of the request
+ */
+static ret_codes_t read_u16(wire_reader_t * p_reader, arena_t * p_arena, uint16_t * p_value)
+{
+    uint8_t * p_bytes = NULL;
+    ret_codes_t result = read_view(p_reader, p_arena, sizeof(uint16_t), &p_bytes);
+    if (OP_SUCCESS == result)
+    {
+        memcpy(p_value, p_bytes, sizeof(uint16_t));
+        *p_value = ntohs(*p_value);
+    }
+    return result;
+}
+
+/*!
+ * @brief Read whatever the socket holds into the free end of the buffer
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @return OP_SUCCESS if at least one byte was read otherwise the error
+ */
+static ret_codes_t fill(wire_reader_t * p_reader)
+{
+    for (;;)
+    {
+        ssize_t read_bytes = read(p_reader->fd, p_reader->buffer + p_reader->end,
+                                  sizeof(p_reader->buffer) - p_reader->end);
+        if (read_bytes > 0)
+        {
+            p_reader->end += (size_t)read_bytes;
+            shape_flow_take(p_reader->p_flow, (size_t)read_bytes);
+            return OP_SUCCESS;
+        }
+        if (0 == read_bytes)
+        {
+            debug_print_err("%s\n", "[WORKER - READ] Read zero bytes. Client likely closed connection.");
+            return OP_SOCK_CLOSED;
+        }
+        if (EINTR == errno)
+        {
+            continue;
+        }
+
+        // If timed out, display message indicating that it timed out
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+        {
+            debug_print("%s\n", "[STREAM READ] Read timed out");
+            return OP_SESSION_ERROR;
+        }
+        debug_print_err("[WORKER - READ] Unable to read from fd: %s\n", strerror(errno));
+        return OP_FAILURE;
+    }
+}
+
+/*!
+ * @brief Read exactly length bytes from the socket into the buffer. Shaped
+ * connections are read SHAPE_SLICE bytes at a time
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_buffer Pointer to the buffer
+ * @param length Number of bytes to read
+ * @return OP_SUCCESS if all bytes were read otherwise the error
+ */
+static ret_codes_t read_exact(wire_reader_t * p_reader, uint8_t * p_buffer, size_t length)
+{
+    size_t slice = shape_flow_limited(p_reader->p_flow) ? SHAPE_SLICE : length;
+    size_t total_read = 0;
+    while (total_read < length)
+    {
+        size_t want = length - total_read;
+        ssize_t read_bytes = read(p_reader->fd, p_buffer + total_read,
+                                  (want < slice) ? want : slice);
+        if (read_bytes > 0)
+        {
+            total_read += (size_t)read_bytes;
+            shape_flow_take(p_reader->p_flow, (size_t)read_bytes);
+            continue;
+        }
+        if (0 == read_bytes)
+        {
+            debug_print_err("%s\n", "[WORKER - READ] Read zero bytes. Client likely closed connection.");
+            return OP_SOCK_CLOSED;
+        }
+        if (EINTR == errno)
+        {
+            continue;
+        }
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+        {
+            debug_print("%s\n", "[STREAM READ] Read timed out");
+            return OP_SESSION_ERROR;
+        }
+        debug_print_err("[WORKER - READ] Unable to read from fd: %s\n", strerror(errno));
+        return OP_FAILURE;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Read and drop the next bytes of the connection. The fields of the
+ * request read so far are copied out of the buffer already, so the buffer
+ * is reused from its start for the bytes dropped
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param length Number of bytes to drop
+ * @return OP_SUCCESS if all bytes were read otherwise the error
+ */
+static ret_codes_t skip(wire_reader_t * p_reader, uint64_t length)
+{
+    while (length > 0)
+    {
+        size_t buffered = p_reader->end - p_reader->start;
+        if (0 == buffered)
+        {
+            p_reader->start = 0;
+            p_reader->end = 0;
+            ret_codes_t result = fill(p_reader);
+            if (OP_SUCCESS != result)
+            {
+                return result;
+            }
+            continue;
+        }
+        size_t dropped = (buffered < length) ? buffered : (size_t)length;
+        p_reader->start += dropped;
+        length -= dropped;
+    }
+    return OP_SUCCESS;
+}
+
+/*!
+ * @brief Copy a field to the arena if it points into the receive buffer
+ *
+ * @param p_reader Pointer to the reader of the connection
+ * @param p_arena Arena the field is copied to
+ * @param length Number of bytes of the field
+ * @param pp_view Double pointer to the field, updated to the copy
+ * @return OP_SUCCESS if the field was copied or is not in the buffer
+ */
+static ret_codes_t detach_view(wire_reader_t * p_reader,
+                               arena_t * p_arena,
+                               size_t length,
+                               uint8_t ** pp_view)
+{
+    uint8_t * p_view = *pp_view;
+    if ((NULL == p_view) || (p_view < p_reader->buffer)
+        || (p_view >= (p_reader->buffer + sizeof(p_reader->buffer))))
+    {
+        return OP_SUCCESS;
+    }
+    uint8_t * p_copy = (uint8_t *)arena_alloc(p_arena, length);
+    if (UV_INVALID_ALLOC == verify_alloc(p_copy))
+    {
+        return OP_FAILURE;
+    }
+    memcpy(p_copy, p_view, length);
+    *pp_view = p_copy;
+    return OP_SUCCESS;
+}
+
+
+/*
+ *
+ * Expressive functions used to increase readability
+ *
+ */
+
+/*!
+ * @brief Take a field of length bytes from the bytes left in the payload
+ *
+ * @param p_left Pointer to the number of bytes left in the payload
+ * @param length Number of bytes of the field
+ * @return true if the payload holds the field otherwise false
+ */
+static bool take_field(uint64_t * p_left, uint64_t length)
+{
+    if (length > *p_left)
+    {
+        debug_print_err("[WORKER - READ_CLIENT] Field of %" PRIu64 " bytes overruns "
+                        "the %" PRIu64 " bytes left in the payload\n", length, *p_left);
+        return false;
+    }
+    *p_left -= length;
+    return true;
+}
+
+/*!
+ * @brief Drop the bytes of the payload that follow its last field so the
+ * next request starts where it should. Every field before them is copied
+ * out of the buffer or there are no such bytes
+ */
+static ret_codes_t skip_rest(wire_reader_t * p_reader, uint64_t left)
+{
+    if (left > 0)
+    {
+        debug_print("[WORKER - READ_CLIENT] Dropping %" PRIu64 " trailing bytes\n", left);
+    }
+    return skip(p_reader, left);
+}
+
+static const char * action_to_string(act_t code)
+{
+    switch (code)
+    {
+        case ACT_USER_OPERATION:
+            return "USER_OPERATION";
+        case ACT_DELETE_REMOTE_FILE:
+            return "DELETE_REMOTE_FILE";
+        case ACT_LIST_REMOTE_DIRECTORY:
+            return "LIST_REMOTE_DIR";
+        case ACT_GET_REMOTE_FILE:
+            return "GET_REMOTE_FILE";
+        case ACT_MAKE_REMOTE_DIRECTORY:
+            return "MAKE_REMOTE_DIR";
+        case ACT_PUT_REMOTE_FILE:
+            return "PUT_REMOTE_FILE";
+        case ACT_LOCAL_OPERATION:
+            return "LOCAL_OP";
+        case ACT_PUT_BY_HASH:
+            return "PUT_BY_HASH";
+        case ACT_GET_SIGNATURE:
+            return "GET_SIGNATURE";
+        case ACT_PUT_DELTA:
+            return "PUT_DELTA";
+        default:
+            return "UNKNOWN";
+    }
+}
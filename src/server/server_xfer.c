@@ -0,0 +1,304 @@
+#include <server_xfer.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Source of the leaves of xfer_tree_hash. The leaves are read by several
+// threads, any of which may find the source ended early
+typedef struct
+{
+    f_stream_t *        p_source;
+    atomic_bool         b_read_error;
+} xfer_tree_t;
+
+// Every chunk of the pipeline has to fit in a single frame
+_Static_assert(XFER_CHUNK_SIZE <= COMPRESS_FRAME_SIZE, "chunk exceeds frame");
+
+// State of the sink used by xfer_frames
+typedef struct
+{
+    codec_t             codec;
+    hash_stream_t *     p_hash;
+    xfer_sink_t         sink;
+    void *              p_ctx;
+    uint8_t *           p_frame;
+    size_t              written;
+} xfer_compress_t;
+
+static bool read_leaf(hash_tree_t * p_tree, size_t index, void * p_ctx);
+static ret_codes_t compress_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx);
+static ret_codes_t write_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx);
+
+/*!
+ * @brief Stream the first length bytes of the source through the sink one
+ * chunk at a time. Before the sink runs the kernel is asked to read the
+ * next XFER_AHEAD chunks in the background, so disk reads overlap with
+ * hashing or sending without a thread of the transfer's own.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to transfer
+ * @param sink Consumer stage called with every chunk in order
+ * @param p_ctx Context passed to the sink
+ * @retval OP_SUCCESS All bytes were passed to the sink
+ * @retval OP_IO_ERROR The source could not be read or ended early
+ * @return Any code returned by the sink that aborted the transfer
+ */
+ret_codes_t xfer_pipeline(f_stream_t * p_source,
+                          size_t length,
+                          xfer_sink_t sink,
+                          void * p_ctx)
+{
+    if ((NULL == p_source) || (NULL == sink))
+    {
+        return OP_FAILURE;
+    }
+    if (0 == length)
+    {
+        return OP_SUCCESS;
+    }
+
+    size_t buffer_size = (length < XFER_CHUNK_SIZE) ? length : XFER_CHUNK_SIZE;
+    uint8_t * p_buffer = (uint8_t *)malloc(buffer_size);
+    if (UV_INVALID_ALLOC == verify_alloc(p_buffer))
+    {
+        return OP_FAILURE;
+    }
+
+    ret_codes_t result = OP_SUCCESS;
+    size_t offset = 0;
+    while ((offset < length) && (OP_SUCCESS == result))
+    {
+        size_t to_read = length - offset;
+        to_read = (to_read < buffer_size) ? to_read : buffer_size;
+
+        ssize_t bytes = f_stream_read_at(p_source, p_buffer, to_read, offset);
+        if ((-1 == bytes) || ((size_t)bytes != to_read))
+        {
+            // A short read means the file shrank after it was sized
+            result = OP_IO_ERROR;
+            break;
+        }
+        offset += to_read;
+
+        // Read the next chunks while this one is consumed
+        size_t ahead = length - offset;
+        ahead = (ahead < (XFER_AHEAD * buffer_size)) ? ahead : (XFER_AHEAD * buffer_size);
+        if (ahead > 0)
+        {
+            f_stream_advise(p_source, offset, ahead);
+        }
+        result = sink(p_buffer, to_read, p_ctx);
+    }
+
+    free(p_buffer);
+    return result;
+}
+
+/*!
+ * @brief Sink that adds every chunk to a running hash
+ *
+ * @param p_chunk Pointer to the bytes read
+ * @param chunk_len Number of bytes in the chunk
+ * @param p_ctx Pointer to a hash_stream_t object
+ * @return OP_SUCCESS or OP_FAILURE if the hash could not be updated
+ */
+ret_codes_t xfer_hash_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx)
+{
+    hash_stream_t * p_hash = (hash_stream_t *)p_ctx;
+    return hash_stream_update(p_hash, p_chunk, chunk_len) ? OP_SUCCESS : OP_FAILURE;
+}
+
+/*!
+ * @brief Compress the first length bytes of the source into frames passed
+ * to the sink in order. Every chunk read by the pipeline becomes one frame
+ * and is added to the running hash before it is compressed, so a file is
+ * hashed and compressed in a single pass. Without a sink the frames are only
+ * sized, which tells the length of the frames a later pass will produce
+ * since the codecs compress the same bytes the same way.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to compress
+ * @param codec Codec to compress with
+ * @param p_hash Running hash of the uncompressed bytes or NULL
+ * @param sink Consumer of the frames or NULL
+ * @param p_ctx Context passed to the sink
+ * @param p_frames_len Pointer receiving the number of bytes of the frames
+ * @retval OP_SUCCESS All bytes were compressed
+ * @retval OP_IO_ERROR The source could not be read
+ * @retval OP_FAILURE Allocation, hashing or compressing failed
+ * @return Any code returned by the sink that aborted the transfer
+ */
+ret_codes_t xfer_frames(f_stream_t * p_source,
+                        size_t length,
+                        codec_t codec,
+                        hash_stream_t * p_hash,
+                        xfer_sink_t sink,
+                        void * p_ctx,
+                        size_t * p_frames_len)
+{
+    if ((NULL == p_source) || (NULL == p_frames_len))
+    {
+        return OP_FAILURE;
+    }
+
+    uint8_t * p_frame = (uint8_t *)malloc(COMPRESS_FRAME_HEADER + XFER_CHUNK_SIZE);
+    if (UV_INVALID_ALLOC == verify_alloc(p_frame))
+    {
+        return OP_FAILURE;
+    }
+
+    xfer_compress_t ctx = {
+        .codec      = codec,
+        .p_hash     = p_hash,
+        .sink       = sink,
+        .p_ctx      = p_ctx,
+        .p_frame    = p_frame,
+        .written    = 0
+    };
+    ret_codes_t code = xfer_pipeline(p_source, length, compress_sink, &ctx);
+    *p_frames_len = ctx.written;
+    free(p_frame);
+    return code;
+}
+
+/*!
+ * @brief Compress the first length bytes of the source into frames appended
+ * to the destination with xfer_frames.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param length Number of bytes to compress
+ * @param codec Codec to compress with
+ * @param p_hash Running hash of the uncompressed bytes or NULL
+ * @param p_dest Stream receiving the frames
+ * @param p_dest_len Pointer receiving the number of bytes written to p_dest
+ * @retval OP_SUCCESS All bytes were compressed
+ * @retval OP_IO_ERROR The source could not be read or p_dest written
+ * @retval OP_FAILURE Allocation, hashing or compressing failed
+ */
+ret_codes_t xfer_compress(f_stream_t * p_source,
+                          size_t length,
+                          codec_t codec,
+                          hash_stream_t * p_hash,
+                          f_stream_t * p_dest,
+                          size_t * p_dest_len)
+{
+    if (NULL == p_dest)
+    {
+        return OP_FAILURE;
+    }
+    return xfer_frames(p_source, length, codec, p_hash, write_sink, p_dest, p_dest_len);
+}
+
+/*!
+ * @brief Hash the leaves of the tree from the source. The leaves are read
+ * with positional reads and hashed by hash_tree_fill, so hashing scales
+ * with the number of cores instead of being bound to a single running hash.
+ *
+ * @param p_source Pointer to the streamed file
+ * @param p_tree Tree created for the length of the source
+ * @param threads Number of threads to use. 0 uses one per online processor
+ * @retval OP_SUCCESS Every leaf of the tree was set
+ * @retval OP_IO_ERROR The source could not be read or ended early
+ * @retval OP_FAILURE Allocation or hashing failed
+ */
+ret_codes_t xfer_tree_hash(f_stream_t * p_source,
+                           hash_tree_t * p_tree,
+                           uint8_t threads)
+{
+    if ((NULL == p_source) || (NULL == p_tree))
+    {
+        return OP_FAILURE;
+    }
+
+    xfer_tree_t tree = {
+        .p_source       = p_source,
+        .b_read_error   = false
+    };
+    if (hash_tree_fill(p_tree, threads, read_leaf, &tree))
+    {
+        return OP_SUCCESS;
+    }
+    return atomic_load(&tree.b_read_error) ? OP_IO_ERROR : OP_FAILURE;
+}
+
+/*!
+ * @brief Pipeline sink of xfer_frames. Hashes the chunk, compresses it
+ * into a frame and passes the frame on.
+ *
+ * @param p_chunk Pointer to the bytes read
+ * @param chunk_len Number of bytes in the chunk
+ * @param p_ctx Pointer to a xfer_compress_t object
+ * @return OP_SUCCESS or the code of the step that failed
+ */
+static ret_codes_t compress_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx)
+{
+    xfer_compress_t * p_compress = (xfer_compress_t *)p_ctx;
+    if ((NULL != p_compress->p_hash)
+        && (!hash_stream_update(p_compress->p_hash, p_chunk, chunk_len)))
+    {
+        return OP_FAILURE;
+    }
+
+    size_t frame_len = 0;
+    ret_codes_t code = compress_frame(p_compress->codec, p_chunk, chunk_len,
+                                      p_compress->p_frame, &frame_len);
+    if ((OP_SUCCESS == code) && (NULL != p_compress->sink))
+    {
+        code = p_compress->sink(p_compress->p_frame, frame_len, p_compress->p_ctx);
+    }
+    if (OP_SUCCESS == code)
+    {
+        p_compress->written += frame_len;
+    }
+    return code;
+}
+
+/*!
+ * @brief Sink of xfer_compress appending the frames to a stream
+ *
+ * @param p_chunk Pointer to the frame
+ * @param chunk_len Number of bytes of the frame
+ * @param p_ctx Pointer to the f_stream_t receiving the frames
+ * @return OP_SUCCESS or the error of the write
+ */
+static ret_codes_t write_sink(const uint8_t * p_chunk, size_t chunk_len, void * p_ctx)
+{
+    return f_stream_write((f_stream_t *)p_ctx, p_chunk, chunk_len);
+}
+
+/*!
+ * @brief Leaf callback of xfer_tree_hash. Reads the leaf into a buffer of
+ * its own and hashes it into the tree.
+ *
+ * @param p_tree Tree created for the length of the source
+ * @param index Index of the leaf
+ * @param p_ctx Pointer to the xfer_tree_t
+ * @return true if successful otherwise false
+ */
+static bool read_leaf(hash_tree_t * p_tree, size_t index, void * p_ctx)
+{
+    xfer_tree_t * p_xfer = (xfer_tree_t *)p_ctx;
+    size_t offset = index * HASH_TREE_LEAF_SIZE;
+    size_t to_read = hash_tree_length(p_tree) - offset;
+    to_read = (to_read < HASH_TREE_LEAF_SIZE) ? to_read : HASH_TREE_LEAF_SIZE;
+
+    uint8_t * p_buffer = (uint8_t *)malloc((0 == to_read) ? 1 : to_read);
+    if (UV_INVALID_ALLOC == verify_alloc(p_buffer))
+    {
+        return false;
+    }
+
+    bool b_success = false;
+    ssize_t bytes = f_stream_read_at(p_xfer->p_source, p_buffer, to_read, offset);
+    if ((-1 == bytes) || ((size_t)bytes != to_read))
+    {
+        atomic_store(&p_xfer->b_read_error, true);
+    }
+    else
+    {
+        b_success = hash_tree_set_leaf(p_tree, index, p_buffer, to_read);
+    }
+    free(p_buffer);
+    return b_success;
+}
@@ -94,6 +94,16 @@ class TestArgParser(unittest.TestCase):
         self.args["put"] = True
         self._test_valid()
 
+    def test_batch(self):
+        """Test the batch file which is a command of its own"""
+        self.args["batch"] = Path(__file__)
+        obj = client_classes.ClientRequest(**self.args)
+        self.assertEqual(Path(__file__), obj.batch)
+
+        self.args["put"] = True
+        with self.assertRaises(ValueError):
+            client_classes.ClientRequest(**self.args)
+
     def test_create_user(self):
         """Test dependency of creating user which only requires the --perm"""
         self.args["create_user"] = True
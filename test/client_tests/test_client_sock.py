@@ -0,0 +1,112 @@
+import socket
+import struct
+import sys
+import threading
+import unittest
+from pathlib import Path
+from unittest import mock
+
+# client_sock imports its siblings by their bare names like the client does
+sys.path.insert(0, str(Path(__file__).resolve().parents[2] / "src" / "client"))
+
+import client_classes  # noqa: E402
+import client_sock  # noqa: E402
+
+
+def _response(return_code: int, reserved: int, msg: bytes) -> bytes:
+    """v1 response without data"""
+    return struct.pack("!BBIQB", return_code, reserved, 0, len(msg) + 1,
+                       len(msg)) + msg
+
+
+class TestServerBusy(unittest.TestCase):
+    def setUp(self) -> None:
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen()
+        self.request = client_classes.ClientRequest(
+            host="127.0.0.1",
+            port=self.listener.getsockname()[1],
+            username="Scooby",
+            src=None,
+            dst=".",
+            perm=None,
+            shell=False,
+            ls=True,
+            mkdir=False,
+            delete=False,
+            put=False,
+            l_ls=False,
+            l_mkdir=False,
+            create_user=False,
+            delete_user=False)
+        self.request.self_password = "password"
+
+    def tearDown(self) -> None:
+        self.listener.close()
+
+    def _serve(self, responses: list[bytes]) -> threading.Thread:
+        """Answer one connection with each response in turn"""
+        length = len(self.request.client_request)
+
+        def serve():
+            for response in responses:
+                conn, _ = self.listener.accept()
+                with conn:
+                    received = b""
+                    while len(received) < length:
+                        received += conn.recv(length - len(received))
+                    conn.sendall(response)
+
+        server = threading.Thread(target=serve, daemon=True)
+        server.start()
+        return server
+
+    def test_retry_after(self):
+        """The hint of a busy response is in tenths of a second"""
+        busy = client_classes.ServerResponse(
+            self.request, client_classes.SERVER_BUSY_RESPONSE, 5, 0, 0, 0, "")
+        self.assertTrue(busy.busy)
+        self.assertAlmostEqual(0.5, busy.retry_after)
+
+        done = client_classes.ServerResponse(
+            self.request, client_classes.SUCCESS_RESPONSE, 5, 0, 0, 0, "")
+        self.assertFalse(done.busy)
+        self.assertEqual(0.0, done.retry_after)
+
+    def test_backoff(self):
+        """The wait doubles on every attempt up to its maximum"""
+        for attempt in range(4):
+            wait = client_sock.backoff(0.2, attempt)
+            self.assertGreaterEqual(wait, 0.1 * (2 ** attempt))
+            self.assertLessEqual(wait, 0.2 * (2 ** attempt))
+        self.assertLessEqual(client_sock.backoff(0.0, 0), client_classes.BUSY_MIN_WAIT)
+        self.assertLessEqual(client_sock.backoff(60.0, 10), client_classes.BUSY_MAX_WAIT)
+
+    def test_busy_retried(self):
+        """A request turned away is sent again after the wait"""
+        server = self._serve([
+            _response(client_classes.SERVER_BUSY_RESPONSE, 3, b"busy"),
+            _response(client_classes.SUCCESS_RESPONSE, 0, b"done"),
+        ])
+        with mock.patch.object(client_sock.time, "sleep") as sleep:
+            resp = client_sock.make_connection(self.request)
+        server.join()
+        self.assertTrue(resp.successful)
+        self.assertEqual("done", resp.msg)
+        sleep.assert_called_once()
+        self.assertGreaterEqual(sleep.call_args[0][0], 0.15)
+
+    def test_busy_gives_up(self):
+        """The busy response is returned once the retries run out"""
+        busy = _response(client_classes.SERVER_BUSY_RESPONSE, 1, b"busy")
+        server = self._serve([busy] * (client_classes.BUSY_RETRIES + 1))
+        with mock.patch.object(client_sock.time, "sleep") as sleep:
+            resp = client_sock.make_connection(self.request)
+        server.join()
+        self.assertTrue(resp.busy)
+        self.assertEqual(client_classes.BUSY_RETRIES, sleep.call_count)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <server_crypto.h>
+
+// Number of digests converted per run. Roughly a large user database
+#define BENCH_DIGESTS   200000
+#define BENCH_HEX_LEN   (SHA256_DIGEST_LENGTH * 2)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/*!
+ * @brief Encoder used by the db before the hex codec: one sprintf per byte
+ */
+static void encode_sprintf(const uint8_t * p_bytes, char * p_hex)
+{
+    int offset = 0;
+    for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        offset += sprintf(p_hex + offset, "%02x", p_bytes[i]);
+    }
+}
+
+static int nibble(char hex)
+{
+    if ((hex >= '0') && (hex <= '9'))
+    {
+        return hex - '0';
+    }
+    if ((hex >= 'a') && (hex <= 'f'))
+    {
+        return hex - 'a' + 10;
+    }
+    if ((hex >= 'A') && (hex <= 'F'))
+    {
+        return hex - 'A' + 10;
+    }
+    return -1;
+}
+
+/*!
+ * @brief Decoder used before the hex codec: two characters per iteration
+ */
+static bool decode_pairs(const char * p_hex, uint8_t * p_bytes)
+{
+    for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++)
+    {
+        int high = nibble(p_hex[i * 2]);
+        int low  = nibble(p_hex[(i * 2) + 1]);
+        if ((-1 == high) || (-1 == low))
+        {
+            return false;
+        }
+        p_bytes[i] = (uint8_t)((high << 4) | low);
+    }
+    return true;
+}
+
+static void report(const char * p_name, double seconds)
+{
+    printf("%-24s %8.1f ns/digest\n", p_name, (seconds * 1e9) / BENCH_DIGESTS);
+}
+
+int main(void)
+{
+    uint8_t * p_digests = (uint8_t *)malloc((size_t)BENCH_DIGESTS * SHA256_DIGEST_LENGTH);
+    char * p_hex = (char *)malloc(((size_t)BENCH_DIGESTS * BENCH_HEX_LEN) + 1);
+    uint8_t * p_decoded = (uint8_t *)malloc((size_t)BENCH_DIGESTS * SHA256_DIGEST_LENGTH);
+    if ((NULL == p_digests) || (NULL == p_hex) || (NULL == p_decoded))
+    {
+        fprintf(stderr, "[!] Unable to allocate the benchmark buffers\n");
+        free(p_digests);
+        free(p_hex);
+        free(p_decoded);
+        return 1;
+    }
+
+    srand(1);
+    for (size_t i = 0; i < (size_t)BENCH_DIGESTS * SHA256_DIGEST_LENGTH; i++)
+    {
+        p_digests[i] = (uint8_t)rand();
+    }
+
+    bool b_ok = true;
+    double start = now();
+    for (size_t i = 0; i < BENCH_DIGESTS; i++)
+    {
+        encode_sprintf(p_digests + (i * SHA256_DIGEST_LENGTH), p_hex + (i * BENCH_HEX_LEN));
+    }
+    report("encode sprintf", now() - start);
+
+    start = now();
+    for (size_t i = 0; i < BENCH_DIGESTS; i++)
+    {
+        b_ok &= decode_pairs(p_hex + (i * BENCH_HEX_LEN), p_decoded + (i * SHA256_DIGEST_LENGTH));
+    }
+    report("decode pairs", now() - start);
+
+    for (int simd = 0; simd < 2; simd++)
+    {
+        bool b_simd = hex_use_simd(1 == simd);
+        if ((1 == simd) && (!b_simd))
+        {
+            printf("SIMD hex codec not supported by this processor\n");
+            break;
+        }
+
+        start = now();
+        for (size_t i = 0; i < BENCH_DIGESTS; i++)
+        {
+            hex_encode(p_digests + (i * SHA256_DIGEST_LENGTH), SHA256_DIGEST_LENGTH,
+                       p_hex + (i * BENCH_HEX_LEN));
+        }
+        report(b_simd ? "hex_encode simd" : "hex_encode scalar", now() - start);
+
+        start = now();
+        for (size_t i = 0; i < BENCH_DIGESTS; i++)
+        {
+            b_ok &= hex_decode(p_hex + (i * BENCH_HEX_LEN), BENCH_HEX_LEN,
+                               p_decoded + (i * SHA256_DIGEST_LENGTH));
+        }
+        report(b_simd ? "hex_decode simd" : "hex_decode scalar", now() - start);
+    }
+    hex_use_simd(true);
+
+    b_ok &= (0 == memcmp(p_digests, p_decoded, (size_t)BENCH_DIGESTS * SHA256_DIGEST_LENGTH));
+    if (!b_ok)
+    {
+        fprintf(stderr, "[!] Decoded digests do not match\n");
+    }
+
+    free(p_digests);
+    free(p_hex);
+    free(p_decoded);
+    return b_ok ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <server_sched.h>
+
+// Number of jobs per run. Each job does next to nothing so the numbers are
+// the cost of queueing and dequeuing
+#define BENCH_JOBS      400000
+#define BENCH_FANOUT    64
+
+static atomic_size_t g_ran;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+static void empty_job(void * p_arg)
+{
+    (void)p_arg;
+    atomic_fetch_add_explicit(&g_ran, 1, memory_order_relaxed);
+}
+
+// Pool used by the server before the scheduler: every worker takes its jobs
+// from one queue behind one lock
+typedef struct shared_job
+{
+    void (* p_job)(void *);
+    void *              p_arg;
+    struct shared_job * p_next;
+} shared_job_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  idle;
+    shared_job_t *  p_head;
+    shared_job_t *  p_tail;
+    size_t          pending;
+    bool            b_stop;
+    size_t          count;
+    pthread_t *     p_threads;
+} shared_pool_t;
+
+static void * shared_worker(void * p_arg)
+{
+    shared_pool_t * p_pool = (shared_pool_t *)p_arg;
+    pthread_mutex_lock(&p_pool->lock);
+    for (;;)
+    {
+        while ((NULL == p_pool->p_head) && (!p_pool->b_stop))
+        {
+            pthread_cond_wait(&p_pool->cond, &p_pool->lock);
+        }
+        if (NULL == p_pool->p_head)
+        {
+            break;
+        }
+        shared_job_t * p_job = p_pool->p_head;
+        p_pool->p_head = p_job->p_next;
+        if (NULL == p_pool->p_head)
+        {
+            p_pool->p_tail = NULL;
+        }
+        pthread_mutex_unlock(&p_pool->lock);
+
+        p_job->p_job(p_job->p_arg);
+        free(p_job);
+
+        pthread_mutex_lock(&p_pool->lock);
+        if (0 == --p_pool->pending)
+        {
+            pthread_cond_broadcast(&p_pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+    return NULL;
+}
+
+static shared_pool_t * shared_init(size_t count)
+{
+    shared_pool_t * p_pool = (shared_pool_t *)calloc(1, sizeof(shared_pool_t));
+    p_pool->p_threads = (pthread_t *)calloc(count, sizeof(pthread_t));
+    pthread_mutex_init(&p_pool->lock, NULL);
+    pthread_cond_init(&p_pool->cond, NULL);
+    pthread_cond_init(&p_pool->idle, NULL);
+    p_pool->count = count;
+    for (size_t idx = 0; idx < count; idx++)
+    {
+        pthread_create(&p_pool->p_threads[idx], NULL, shared_worker, p_pool);
+    }
+    return p_pool;
+}
+
+static void shared_submit(shared_pool_t * p_pool, void (* p_job)(void *), void * p_arg)
+{
+    shared_job_t * p_entry = (shared_job_t *)malloc(sizeof(shared_job_t));
+    *p_entry = (shared_job_t){
+        .p_job  = p_job,
+        .p_arg  = p_arg,
+        .p_next = NULL
+    };
+    pthread_mutex_lock(&p_pool->lock);
+    if (NULL == p_pool->p_tail)
+    {
+        p_pool->p_head = p_entry;
+    }
+    else
+    {
+        p_pool->p_tail->p_next = p_entry;
+    }
+    p_pool->p_tail = p_entry;
+    p_pool->pending++;
+    pthread_cond_signal(&p_pool->cond);
+    pthread_mutex_unlock(&p_pool->lock);
+}
+
+static void shared_wait(shared_pool_t * p_pool)
+{
+    pthread_mutex_lock(&p_pool->lock);
+    while (0 != p_pool->pending)
+    {
+        pthread_cond_wait(&p_pool->idle, &p_pool->lock);
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+}
+
+static void shared_destroy(shared_pool_t * p_pool)
+{
+    pthread_mutex_lock(&p_pool->lock);
+    p_pool->b_stop = true;
+    pthread_cond_broadcast(&p_pool->cond);
+    pthread_mutex_unlock(&p_pool->lock);
+    for (size_t idx = 0; idx < p_pool->count; idx++)
+    {
+        pthread_join(p_pool->p_threads[idx], NULL);
+    }
+    pthread_cond_destroy(&p_pool->idle);
+    pthread_cond_destroy(&p_pool->cond);
+    pthread_mutex_destroy(&p_pool->lock);
+    free(p_pool->p_threads);
+    free(p_pool);
+}
+
+// Jobs that queue BENCH_FANOUT empty jobs each, the way answered requests
+// queue the next one
+static shared_pool_t * gp_shared;
+static sched_t * gp_sched;
+
+static void shared_fanout(void * p_arg)
+{
+    (void)p_arg;
+    for (size_t idx = 0; idx < BENCH_FANOUT; idx++)
+    {
+        shared_submit(gp_shared, empty_job, NULL);
+    }
+}
+
+static void sched_fanout(void * p_arg)
+{
+    (void)p_arg;
+    for (size_t idx = 0; idx < BENCH_FANOUT; idx++)
+    {
+        sched_submit(gp_sched, empty_job, NULL);
+    }
+}
+
+static void report(const char * p_name, double seconds)
+{
+    printf("%-28s %8.1f ns/job\n", p_name, (seconds * 1e9) / BENCH_JOBS);
+}
+
+int main(int argc, char ** argv)
+{
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+    {
+        workers = strtol(argv[1], NULL, 10);
+    }
+    if ((workers < 1) || (workers > SCHED_MAX_WORKERS))
+    {
+        fprintf(stderr, "[!] Number of workers must be between 1 and %d\n", SCHED_MAX_WORKERS);
+        return 1;
+    }
+    printf("%ld workers, %d jobs\n", workers, BENCH_JOBS);
+
+    bool b_ok = true;
+    gp_shared = shared_init((size_t)workers);
+    gp_sched = sched_init((uint16_t)workers, (uint16_t)workers);
+    if (NULL == gp_sched)
+    {
+        fprintf(stderr, "[!] Unable to start the scheduler\n");
+        shared_destroy(gp_shared);
+        return 1;
+    }
+
+    // Many short requests handed over from one thread, the acceptor
+    atomic_store(&g_ran, 0);
+    double start = now();
+    for (size_t idx = 0; idx < BENCH_JOBS; idx++)
+    {
+        shared_submit(gp_shared, empty_job, NULL);
+    }
+    shared_wait(gp_shared);
+    report("injected shared queue", now() - start);
+    b_ok &= (BENCH_JOBS == atomic_load(&g_ran));
+
+    atomic_store(&g_ran, 0);
+    start = now();
+    for (size_t idx = 0; idx < BENCH_JOBS; idx++)
+    {
+        sched_submit(gp_sched, empty_job, NULL);
+    }
+    sched_wait(gp_sched);
+    report("injected work stealing", now() - start);
+    b_ok &= (BENCH_JOBS == atomic_load(&g_ran));
+
+    // Jobs queued by the workers themselves
+    atomic_store(&g_ran, 0);
+    start = now();
+    for (size_t idx = 0; idx < (BENCH_JOBS / BENCH_FANOUT); idx++)
+    {
+        shared_submit(gp_shared, shared_fanout, NULL);
+    }
+    shared_wait(gp_shared);
+    report("fan-out shared queue", now() - start);
+    b_ok &= ((BENCH_JOBS / BENCH_FANOUT) * BENCH_FANOUT == atomic_load(&g_ran));
+
+    atomic_store(&g_ran, 0);
+    start = now();
+    for (size_t idx = 0; idx < (BENCH_JOBS / BENCH_FANOUT); idx++)
+    {
+        sched_submit(gp_sched, sched_fanout, NULL);
+    }
+    sched_wait(gp_sched);
+    report("fan-out work stealing", now() - start);
+    b_ok &= ((BENCH_JOBS / BENCH_FANOUT) * BENCH_FANOUT == atomic_load(&g_ran));
+
+    shared_destroy(gp_shared);
+    sched_destroy(&gp_sched);
+    if (!b_ok)
+    {
+        fprintf(stderr, "[!] Not every job ran\n");
+    }
+    return b_ok ? 0 : 1;
+}
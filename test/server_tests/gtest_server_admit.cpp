@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <server_admit.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Holds its worker until the flag is raised
+static void held_job(void * p_arg)
+{
+    std::atomic<bool> * p_release = (std::atomic<bool> *)p_arg;
+    while (!p_release->load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+TEST(ServerAdmitTest, TestUnlimited)
+{
+    admit_limits_t limits = {};
+    admit_t * p_admit = admit_init(&limits, NULL);
+    ASSERT_NE(nullptr, p_admit);
+
+    uint32_t retry_ms = 0;
+    for (int idx = 0; idx < 100; idx++)
+    {
+        EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_BULK, (uint64_t)1 << 40, &retry_ms));
+    }
+    admit_stats_t stats = {};
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)100, stats.requests);
+    EXPECT_EQ((uint64_t)100, stats.admitted);
+    EXPECT_EQ((uint64_t)0, stats.shed);
+    for (int idx = 0; idx < 100; idx++)
+    {
+        admit_leave(p_admit, (uint64_t)1 << 40);
+    }
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)0, stats.requests);
+    EXPECT_EQ((uint64_t)0, stats.bytes);
+
+    // Servers without admission control admit everything
+    EXPECT_EQ(OP_SUCCESS, admit_enter(NULL, IO_LANE_BULK, 1, &retry_ms));
+    admit_leave(NULL, 1);
+
+    admit_destroy(&p_admit);
+    EXPECT_EQ(nullptr, p_admit);
+    EXPECT_EQ(nullptr, admit_init(NULL, NULL));
+}
+
+TEST(ServerAdmitTest, TestRequests)
+{
+    admit_limits_t limits = {};
+    limits.requests = 2;
+    admit_t * p_admit = admit_init(&limits, NULL);
+    ASSERT_NE(nullptr, p_admit);
+
+    uint32_t retry_ms = 0;
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_INTERACTIVE, 0, &retry_ms));
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_INTERACTIVE, 0, &retry_ms));
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_INTERACTIVE, 0, &retry_ms));
+    EXPECT_EQ((uint32_t)ADMIT_RETRY_MS, retry_ms);
+
+    // A request answered makes room for the next
+    admit_leave(p_admit, 0);
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_INTERACTIVE, 0, &retry_ms));
+
+    admit_stats_t stats = {};
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)2, stats.requests);
+    EXPECT_EQ((uint64_t)3, stats.admitted);
+    EXPECT_EQ((uint64_t)1, stats.shed);
+    admit_destroy(&p_admit);
+}
+
+TEST(ServerAdmitTest, TestBytes)
+{
+    admit_limits_t limits = {};
+    limits.bytes = 1000;
+    admit_t * p_admit = admit_init(&limits, NULL);
+    ASSERT_NE(nullptr, p_admit);
+
+    uint32_t retry_ms = 0;
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_BULK, 600, &retry_ms));
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_BULK, 400, &retry_ms));
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_BULK, 1, &retry_ms));
+
+    // The hint grows with how far the payload is over the limit
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_BULK, 4000, &retry_ms));
+    EXPECT_EQ((uint32_t)(5 * ADMIT_RETRY_MS), retry_ms);
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_BULK, UINT64_MAX, &retry_ms));
+    EXPECT_EQ((uint32_t)ADMIT_RETRY_MAX_MS, retry_ms);
+
+    // Requests turned away are not counted in flight
+    admit_stats_t stats = {};
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)2, stats.requests);
+    EXPECT_EQ((uint64_t)1000, stats.bytes);
+
+    // A payload over the limit by itself waits for the others only
+    admit_leave(p_admit, 600);
+    admit_leave(p_admit, 400);
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_BULK, 4000, &retry_ms));
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_BULK, 1, &retry_ms));
+    admit_leave(p_admit, 4000);
+    admit_destroy(&p_admit);
+}
+
+TEST(ServerAdmitTest, TestQueue)
+{
+    io_pool_t * p_io = io_pool_init(1, 1, 1, 1);
+    ASSERT_NE(nullptr, p_io);
+    admit_limits_t limits = {};
+    limits.queued = 2;
+    admit_t * p_admit = admit_init(&limits, p_io);
+    ASSERT_NE(nullptr, p_admit);
+
+    // The bulk worker is held and two jobs wait behind it
+    std::atomic<bool> release{false};
+    for (int idx = 0; idx < 3; idx++)
+    {
+        io_submit(p_io, IO_LANE_BULK, held_job, &release);
+    }
+    EXPECT_EQ((size_t)2, io_pool_queued(p_io, IO_LANE_BULK));
+
+    // Only the lane of the request is limited
+    uint32_t retry_ms = 0;
+    EXPECT_EQ(OP_SERVER_BUSY, admit_enter(p_admit, IO_LANE_BULK, 0, &retry_ms));
+    EXPECT_EQ((uint32_t)ADMIT_RETRY_MS, retry_ms);
+    EXPECT_EQ(OP_SUCCESS, admit_enter(p_admit, IO_LANE_INTERACTIVE, 0, &retry_ms));
+    admit_leave(p_admit, 0);
+
+    release = true;
+    io_pool_destroy(&p_io);
+    admit_destroy(&p_admit);
+}
+
+TEST(ServerAdmitTest, TestConnection)
+{
+    sched_t * p_workers = sched_init(1, 1);
+    ASSERT_NE(nullptr, p_workers);
+    admit_limits_t limits = {};
+    limits.queued = 2;
+    admit_t * p_admit = admit_init(&limits, NULL);
+    ASSERT_NE(nullptr, p_admit);
+
+    // The worker is held, connections are admitted until two wait behind it
+    std::atomic<bool> release{false};
+    uint32_t retry_ms = 0;
+    ASSERT_EQ(OP_SUCCESS, sched_submit(p_workers, held_job, &release));
+    while (0 != sched_queued(p_workers))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    for (int idx = 0; idx < 2; idx++)
+    {
+        EXPECT_EQ(OP_SUCCESS, admit_connection(p_admit, p_workers, &retry_ms));
+        ASSERT_EQ(OP_SUCCESS, sched_submit(p_workers, held_job, &release));
+    }
+    EXPECT_EQ(OP_SERVER_BUSY, admit_connection(p_admit, p_workers, &retry_ms));
+    EXPECT_EQ((uint32_t)ADMIT_RETRY_MS, retry_ms);
+
+    // Connections are not counted in flight, only turned away
+    admit_stats_t stats = {};
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)0, stats.requests);
+    EXPECT_EQ((uint64_t)1, stats.shed);
+    EXPECT_EQ(OP_SUCCESS, admit_connection(NULL, p_workers, &retry_ms));
+
+    release = true;
+    sched_destroy(&p_workers);
+    admit_destroy(&p_admit);
+}
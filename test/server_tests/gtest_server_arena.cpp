@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <server_arena.h>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+TEST(ServerArenaTest, TestAlloc)
+{
+    arena_t * p_arena = arena_init(256, NULL);
+    ASSERT_NE(nullptr, p_arena);
+
+    // Allocations are zeroed, aligned and do not overlap
+    std::set<uintptr_t> seen;
+    for (size_t size = 0; size < 100; size++)
+    {
+        uint8_t * p_mem = (uint8_t *)arena_alloc(p_arena, size);
+        ASSERT_NE(nullptr, p_mem);
+        EXPECT_EQ((uintptr_t)0, (uintptr_t)p_mem % alignof(max_align_t));
+        for (size_t i = 0; i < size; i++)
+        {
+            EXPECT_EQ(0, p_mem[i]);
+        }
+        memset(p_mem, 0xff, size);
+        EXPECT_TRUE(seen.insert((uintptr_t)p_mem).second);
+    }
+
+    // Allocations larger than a block get their own
+    uint8_t * p_large = (uint8_t *)arena_alloc(p_arena, 100000);
+    ASSERT_NE(nullptr, p_large);
+    EXPECT_EQ(0, p_large[99999]);
+
+    EXPECT_EQ(nullptr, arena_alloc(NULL, 1));
+    EXPECT_EQ(nullptr, arena_alloc(p_arena, SIZE_MAX));
+    arena_destroy(&p_arena);
+    EXPECT_EQ(nullptr, p_arena);
+}
+
+TEST(ServerArenaTest, TestReset)
+{
+    arena_t * p_arena = arena_init(256, NULL);
+    ASSERT_NE(nullptr, p_arena);
+
+    // The blocks are reused by the allocations after a reset
+    uint8_t * p_first = (uint8_t *)arena_alloc(p_arena, 16);
+    uint8_t * p_last = NULL;
+    for (int i = 0; i < 64; i++)
+    {
+        p_last = (uint8_t *)arena_alloc(p_arena, 48);
+        memset(p_last, 0xff, 48);
+    }
+    arena_reset(p_arena);
+    EXPECT_EQ(p_first, arena_alloc(p_arena, 16));
+    for (int i = 0; i < 64; i++)
+    {
+        uint8_t * p_mem = (uint8_t *)arena_alloc(p_arena, 48);
+        EXPECT_EQ(0, p_mem[47]);
+        if (63 == i)
+        {
+            EXPECT_EQ(p_last, p_mem);
+        }
+    }
+
+    // Owned memory is freed on reset and on destroy
+    EXPECT_TRUE(arena_own(p_arena, malloc(64)));
+    EXPECT_TRUE(arena_own(p_arena, NULL));
+    arena_reset(p_arena);
+    EXPECT_TRUE(arena_own(p_arena, malloc(64)));
+    arena_destroy(&p_arena);
+}
+
+static void count_release(void * p_arg)
+{
+    (*(int *)p_arg)++;
+}
+
+TEST(ServerArenaTest, TestBudget)
+{
+    mem_budget_t * p_mem = mem_init(200000);
+    ASSERT_NE(nullptr, p_mem);
+    arena_t * p_arena = arena_init(256, p_mem);
+    ASSERT_NE(nullptr, p_arena);
+
+    // Only the allocations larger than a block are reserved
+    ASSERT_NE(nullptr, arena_alloc(p_arena, 128));
+    ASSERT_NE(nullptr, arena_alloc(p_arena, 100000));
+    mem_stats_t stats = {};
+    mem_stats(p_mem, &stats);
+    EXPECT_LE((uint64_t)100000, stats.used);
+    EXPECT_GT((uint64_t)101000, stats.used);
+
+    // An allocation without room in the budget fails
+    EXPECT_EQ(nullptr, arena_alloc(p_arena, 150000));
+    // and needs a directory to be backed by a temp file instead
+    EXPECT_EQ(nullptr, arena_map(p_arena, NULL, 150000));
+
+    // Buffers allocated elsewhere reserve their bytes until the reset
+    EXPECT_TRUE(arena_reserve(p_arena, p_mem, 50000, 0));
+    EXPECT_FALSE(arena_reserve(p_arena, p_mem, 60000, 0));
+    mem_stats(p_mem, &stats);
+    EXPECT_LE((uint64_t)150000, stats.used);
+
+    // Resources handed over are released with the arena, which gives the
+    // reservations back
+    int released = 0;
+    EXPECT_TRUE(arena_defer(p_arena, count_release, &released));
+    EXPECT_FALSE(arena_defer(p_arena, NULL, &released));
+    arena_reset(p_arena);
+    EXPECT_EQ(1, released);
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)0, stats.used);
+    EXPECT_NE(nullptr, arena_alloc(p_arena, 150000));
+
+    arena_destroy(&p_arena);
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)0, stats.used);
+    mem_destroy(&p_mem);
+}
@@ -8,6 +8,9 @@ extern "C"
 {
     uint32_t get_port(char * port);
     uint8_t get_timeout(char * timeout);
+    int64_t get_rate(char * rate);
+    bool get_limits(char * limits, args_t * p_args);
+    bool get_admission(char * admission, args_t * p_args);
 }
 
 class ServerTestValidPorts : public ::testing::TestWithParam<std::tuple<std::string, bool>>{};
@@ -129,6 +132,108 @@ INSTANTIATE_TEST_SUITE_P(
         std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "extra_arg"}, true),
         std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-w"}, true),
         std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-w", "10", "-p", "10"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s", "none"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s", "op"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s", "group"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s", "always"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s", "op", "-s", "group"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-s"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "4", "-i", "16"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "0"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-i", "256"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-i", "1025"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "2:8", "-i", "4:4"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "8:2"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "2:"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-i", ":4"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-i", "1:1025"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-b", "2:16"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-b", "0"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-b", "2", "-b", "4"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-i", "2", "-i", "4"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-n", "8", "-a", "4"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-a", "0"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-a", "2", "-a", "2"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-c", "0"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-c", "1024"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-c", "-1"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-c", "1048577"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-c", "8", "-c", "16"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-k"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-x", "-n", "64"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-x", "-x"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-k", "-k"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-k", "1"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l", "server=100M,connection=10M"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l", "read=512K,user:alice=0"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l", "guest=1M"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l", "server"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l", "server=1M", "-l", "admin=1M"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-l"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-q", "queue=64,requests=1K,bytes=256M"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-q", "queue=0"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-q", "connections=8"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-q", "queue=8", "-q", "bytes=1M"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-q"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-m", "0"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-m", "512"}, false),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-m", "-1"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-m", "1048577"}, true),
+        std::make_tuple(std::vector<std::string>{__FILE__, "-d", "/tmp", "-m", "8", "-m", "16"}, true),
         std::make_tuple(std::vector<std::string>{__FILE__}, true)
     ));
 
+
+TEST(ServerTestLimits, TestRates)
+{
+    EXPECT_EQ(0, get_rate((char *)"0"));
+    EXPECT_EQ(1000, get_rate((char *)"1000"));
+    EXPECT_EQ(512 << 10, get_rate((char *)"512K"));
+    EXPECT_EQ(10 << 20, get_rate((char *)"10M"));
+    EXPECT_EQ((int64_t)16 << 30, get_rate((char *)"16G"));
+    EXPECT_EQ(-1, get_rate((char *)"17G"));
+    EXPECT_EQ(-1, get_rate((char *)"-1"));
+    EXPECT_EQ(-1, get_rate((char *)"1T"));
+    EXPECT_EQ(-1, get_rate((char *)"1MB"));
+    EXPECT_EQ(-1, get_rate((char *)""));
+}
+
+TEST(ServerTestLimits, TestScopes)
+{
+    args_t args = {};
+    char limits[] = "server=1G,connection=2M,read=1K,read_write=2K,admin=3K,user:alice=4K";
+    ASSERT_TRUE(get_limits(limits, &args));
+    EXPECT_EQ((uint64_t)1 << 30, args.limits.server);
+    EXPECT_EQ((uint64_t)2 << 20, args.limits.connection);
+    EXPECT_EQ((uint64_t)1 << 10, args.limits.levels[READ]);
+    EXPECT_EQ((uint64_t)2 << 10, args.limits.levels[READ_WRITE]);
+    EXPECT_EQ((uint64_t)3 << 10, args.limits.levels[ADMIN]);
+    ASSERT_EQ((size_t)1, args.user_limit_count);
+    EXPECT_STREQ("alice", args.user_limits[0].username);
+    EXPECT_EQ((uint64_t)4 << 10, args.user_limits[0].rate);
+
+    // The argument itself is left as it was
+    EXPECT_STREQ("server=1G,connection=2M,read=1K,read_write=2K,admin=3K,user:alice=4K", limits);
+
+    char bad_user[] = "user:al=1K";
+    EXPECT_FALSE(get_limits(bad_user, &args));
+    char bad_rate[] = "server=fast";
+    EXPECT_FALSE(get_limits(bad_rate, &args));
+}
+
+TEST(ServerTestLimits, TestAdmission)
+{
+    args_t args = {};
+    char admission[] = "queue=64,requests=2K,bytes=1G";
+    ASSERT_TRUE(get_admission(admission, &args));
+    EXPECT_EQ((size_t)64, args.admission.queued);
+    EXPECT_EQ((size_t)2 << 10, args.admission.requests);
+    EXPECT_EQ((uint64_t)1 << 30, args.admission.bytes);
+
+    char bad_limit[] = "queue";
+    EXPECT_FALSE(get_admission(bad_limit, &args));
+    char bad_value[] = "requests=-1";
+    EXPECT_FALSE(get_admission(bad_value, &args));
+    char bad_suffix[] = "bytes=1T";
+    EXPECT_FALSE(get_admission(bad_suffix, &args));
+}
@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+#include <server_cache.h>
+#include <server_compress.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+static const std::filesystem::path test_dir{"/tmp/cache_test"};
+
+/*!
+ * Noise does not compress so every entry is about as large as its file
+ */
+static std::vector<uint8_t> make_noise(size_t length, uint32_t seed)
+{
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        seed = (seed * 1103515245) + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+    return data;
+}
+
+/*!
+ * Write the file into the test directory and queue its LZ4 representation
+ */
+static bool fill(cache_t * p_cache, const char * p_name,
+                 const std::vector<uint8_t> & data, cache_key_t * p_key)
+{
+    {
+        std::ofstream out{test_dir/p_name, std::ios::binary};
+        out.write((const char *)data.data(), (std::streamsize)data.size());
+    }
+    cache_key_t key = {};
+    key.alg = HASH_ALG_BLAKE3;
+    key.codec = CODEC_LZ4;
+    *p_key = key;
+    EXPECT_TRUE(hash_alg_bytes(HASH_ALG_BLAKE3, data.data(), data.size(), &p_key->hash));
+
+    ret_codes_t code;
+    verified_path_t * p_path = f_path_resolve(test_dir.c_str(), p_name);
+    EXPECT_NE(nullptr, p_path);
+    file_content_t * p_content = f_stream_file(p_path, &code);
+    EXPECT_NE(nullptr, p_content);
+    f_stream_t * p_source = f_stream_dup(p_content->p_source);
+    bool b_queued = cache_fill(p_cache, p_key, &p_source, data.size());
+    EXPECT_EQ(nullptr, p_source);
+
+    f_destroy_content(&p_content);
+    f_destroy_path(&p_path);
+    return b_queued;
+}
+
+/*!
+ * Read the cached representation back and decompress it. Empty on a miss
+ */
+static std::vector<uint8_t> open_cached(cache_t * p_cache, const cache_key_t * p_key)
+{
+    size_t size = 0;
+    f_stream_t * p_stream = cache_open(p_cache, p_key, &size);
+    if (NULL == p_stream)
+    {
+        return {};
+    }
+
+    std::vector<uint8_t> frames(size);
+    EXPECT_EQ((ssize_t)size, f_stream_read_at(p_stream, frames.data(), size, 0));
+    f_stream_close(&p_stream);
+
+    uint8_t * p_out = NULL;
+    size_t out_len = 0;
+    EXPECT_EQ(OP_SUCCESS, decompress_buffer(p_key->codec, frames.data(), frames.size(),
+                                            &p_out, &out_len));
+    std::vector<uint8_t> out(p_out, p_out + out_len);
+    free(p_out);
+    return out;
+}
+
+class ServerCacheTest : public ::testing::Test
+{
+protected:
+    verified_path_t * p_home = NULL;
+
+    void SetUp() override
+    {
+        std::filesystem::remove_all(test_dir);
+        std::filesystem::create_directories(test_dir/".cape");
+        p_home = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+        ASSERT_NE(nullptr, p_home);
+    }
+
+    void TearDown() override
+    {
+        f_destroy_path(&p_home);
+        std::filesystem::remove_all(test_dir);
+    }
+};
+
+TEST_F(ServerCacheTest, TestFillAndOpen)
+{
+    cache_t * p_cache = cache_init(p_home, CACHE_DEFAULT_SIZE);
+    ASSERT_NE(nullptr, p_cache);
+    EXPECT_TRUE(std::filesystem::is_directory(test_dir/CACHE_DIR));
+
+    std::vector<uint8_t> data(COMPRESS_FRAME_SIZE + 1234, 'c');
+    cache_key_t key;
+    EXPECT_TRUE(fill(p_cache, "text.txt", data, &key));
+    cache_wait(p_cache);
+
+    EXPECT_EQ(data, open_cached(p_cache, &key));
+    EXPECT_GT(cache_usage(p_cache), (size_t)0);
+    EXPECT_LT(cache_usage(p_cache), data.size() / 50);
+
+    // A cached representation is never filled again
+    EXPECT_FALSE(fill(p_cache, "text.txt", data, &key));
+
+    // The same file is another entry under another codec or algorithm
+    cache_key_t other = key;
+    other.codec = CODEC_NONE;
+    EXPECT_TRUE(open_cached(p_cache, &other).empty());
+    other = key;
+    other.alg = HASH_ALG_SHA256;
+    EXPECT_TRUE(open_cached(p_cache, &other).empty());
+
+    cache_destroy(&p_cache);
+    EXPECT_EQ(nullptr, p_cache);
+}
+
+TEST_F(ServerCacheTest, TestEviction)
+{
+    const size_t length = 1000;
+    cache_t * p_cache = cache_init(p_home, (length * 2) + 100);
+    ASSERT_NE(nullptr, p_cache);
+
+    cache_key_t first;
+    cache_key_t second;
+    cache_key_t third;
+    EXPECT_TRUE(fill(p_cache, "first", make_noise(length, 1), &first));
+    EXPECT_TRUE(fill(p_cache, "second", make_noise(length, 2), &second));
+    cache_wait(p_cache);
+
+    // Opening the first entry makes the second the least recently used
+    EXPECT_FALSE(open_cached(p_cache, &first).empty());
+    EXPECT_TRUE(fill(p_cache, "third", make_noise(length, 3), &third));
+    cache_wait(p_cache);
+
+    EXPECT_FALSE(open_cached(p_cache, &first).empty());
+    EXPECT_TRUE(open_cached(p_cache, &second).empty());
+    EXPECT_EQ(make_noise(length, 3), open_cached(p_cache, &third));
+    EXPECT_LE(cache_usage(p_cache), (length * 2) + 100);
+    EXPECT_EQ(2, std::distance(std::filesystem::directory_iterator(test_dir/CACHE_DIR),
+                               std::filesystem::directory_iterator{}));
+
+    // Representations larger than the whole cache are not kept
+    cache_key_t large;
+    EXPECT_TRUE(fill(p_cache, "large", make_noise(length * 3, 4), &large));
+    cache_wait(p_cache);
+    EXPECT_TRUE(open_cached(p_cache, &large).empty());
+    EXPECT_FALSE(open_cached(p_cache, &first).empty());
+
+    cache_destroy(&p_cache);
+}
+
+TEST_F(ServerCacheTest, TestReload)
+{
+    cache_t * p_cache = cache_init(p_home, CACHE_DEFAULT_SIZE);
+    ASSERT_NE(nullptr, p_cache);
+
+    std::vector<uint8_t> data = make_noise(5000, 5);
+    cache_key_t key;
+    EXPECT_TRUE(fill(p_cache, "file", data, &key));
+    cache_wait(p_cache);
+    size_t used = cache_usage(p_cache);
+    cache_destroy(&p_cache);
+
+    // Leftovers that are not entries are removed when the cache is opened
+    std::ofstream{test_dir/CACHE_DIR/"partial.tmp"};
+    std::ofstream{test_dir/CACHE_DIR/"AB.2.2"};
+    std::filesystem::create_directory(test_dir/CACHE_DIR/"dir");
+    std::filesystem::create_directory(test_dir/CACHE_DIR/(std::string(H_HASH_LEN * 2, '0') + ".0.2"));
+
+    p_cache = cache_init(p_home, CACHE_DEFAULT_SIZE);
+    ASSERT_NE(nullptr, p_cache);
+    EXPECT_EQ(used, cache_usage(p_cache));
+    EXPECT_EQ(data, open_cached(p_cache, &key));
+    EXPECT_EQ(1, std::distance(std::filesystem::directory_iterator(test_dir/CACHE_DIR),
+                               std::filesystem::directory_iterator{}));
+    cache_destroy(&p_cache);
+
+    // A lower capacity evicts entries that no longer fit
+    p_cache = cache_init(p_home, used - 1);
+    ASSERT_NE(nullptr, p_cache);
+    EXPECT_EQ((size_t)0, cache_usage(p_cache));
+    EXPECT_TRUE(open_cached(p_cache, &key).empty());
+    cache_destroy(&p_cache);
+}
@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+#include <server_chunks.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+static const std::filesystem::path test_dir{"/tmp/chunks_test"};
+
+static std::string read_all(const std::filesystem::path & path)
+{
+    std::ifstream in{path, std::ios::binary};
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static std::vector<size_t> cut_all(const std::string & data)
+{
+    std::vector<size_t> ends;
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        pos += chunks_cut((const uint8_t *)data.data() + pos, data.size() - pos);
+        ends.push_back(pos);
+    }
+    return ends;
+}
+
+static size_t chunk_files()
+{
+    size_t count = 0;
+    for (auto & entry : std::filesystem::recursive_directory_iterator(test_dir/CHUNKS_DIR))
+    {
+        if (entry.is_regular_file() && (entry.path().filename() != "id"))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+class ServerChunksTest : public ::testing::Test
+{
+protected:
+    verified_path_t * p_home = NULL;
+    chunks_t * p_chunks = NULL;
+    std::string data;
+
+    void SetUp() override
+    {
+        std::filesystem::remove_all(test_dir);
+        std::filesystem::create_directories(test_dir/".cape");
+        p_home = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+        ASSERT_NE(nullptr, p_home);
+        p_chunks = chunks_init(p_home, true);
+        ASSERT_NE(nullptr, p_chunks);
+
+        std::mt19937 gen(7);
+        data.resize(300000);
+        for (auto & byte : data)
+        {
+            byte = (char)gen();
+        }
+    }
+
+    void TearDown() override
+    {
+        chunks_destroy(&p_chunks);
+        f_destroy_path(&p_home);
+        std::filesystem::remove_all(test_dir);
+    }
+
+    ret_codes_t create(const char * p_name, const std::string & bytes)
+    {
+        verified_path_t * p_path = f_ver_valid_resolve(p_home, p_name);
+        EXPECT_NE(nullptr, p_path);
+        ret_codes_t code = chunks_create_file(p_chunks, p_path, (uint8_t *)bytes.data(),
+                                              bytes.size(), NULL, NULL);
+        f_destroy_path(&p_path);
+        return code;
+    }
+
+    // Open the file through the store, NULL if it cannot be read
+    f_stream_t * open(const char * p_name, size_t * p_size)
+    {
+        ret_codes_t code = OP_FAILURE;
+        verified_path_t * p_path = f_ver_path_resolve(p_home, p_name);
+        f_stream_t * p_source = f_stream_open(p_path, p_size, &code);
+        f_destroy_path(&p_path);
+        if ((NULL != p_source) && (OP_SUCCESS != chunks_stitch(p_chunks, p_source, *p_size)))
+        {
+            f_stream_close(&p_source);
+        }
+        return p_source;
+    }
+
+    std::string read(const char * p_name)
+    {
+        size_t size = 0;
+        f_stream_t * p_source = open(p_name, &size);
+        std::string out(size, '\0');
+        EXPECT_EQ((ssize_t)size, f_stream_read_at(p_source, (uint8_t *)out.data(), size, 0));
+        f_stream_close(&p_source);
+        return out;
+    }
+
+    ret_codes_t remove(const char * p_name)
+    {
+        verified_path_t * p_path = f_ver_path_resolve(p_home, p_name);
+        ret_codes_t code = chunks_del_file(p_chunks, p_path);
+        f_destroy_path(&p_path);
+        return code;
+    }
+};
+
+TEST_F(ServerChunksTest, TestCut)
+{
+    std::vector<size_t> ends = cut_all(data);
+    size_t start = 0;
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+        size_t length = ends[i] - start;
+        EXPECT_LE(length, (size_t)CHUNK_MAX_SIZE);
+        if (i + 1 < ends.size())
+        {
+            EXPECT_GE(length, (size_t)CHUNK_MIN_SIZE);
+        }
+        start = ends[i];
+    }
+    EXPECT_EQ((size_t)3, chunks_cut((const uint8_t *)"abc", 3));
+
+    // Boundaries after an insert are the same boundaries shifted
+    std::string edited = data.substr(0, 1000) + "inserted" + data.substr(1000);
+    std::vector<size_t> edited_ends = cut_all(edited);
+    size_t shared = 0;
+    for (size_t end : edited_ends)
+    {
+        if ((end > 1008) && (std::find(ends.begin(), ends.end(), end - 8) != ends.end()))
+        {
+            shared++;
+        }
+    }
+    EXPECT_GE(shared + 2, ends.size());
+}
+
+TEST_F(ServerChunksTest, TestRoundTrip)
+{
+    ASSERT_EQ(OP_SUCCESS, create("one.bin", data));
+    size_t count = chunks_count(p_chunks);
+    EXPECT_GT(count, (size_t)1);
+    EXPECT_EQ(count, chunk_files());
+
+    // The file on disk is a manifest with the size of the data
+    EXPECT_EQ(data.size(), std::filesystem::file_size(test_dir/"one.bin"));
+    EXPECT_NE(data, read_all(test_dir/"one.bin"));
+    EXPECT_EQ(data, read("one.bin"));
+
+    // Reads across chunk boundaries and past the end
+    size_t size = 0;
+    f_stream_t * p_source = open("one.bin", &size);
+    ASSERT_NE(nullptr, p_source);
+    std::string part(100000, '\0');
+    EXPECT_EQ((ssize_t)part.size(), f_stream_read_at(p_source, (uint8_t *)part.data(),
+                                                     part.size(), 12345));
+    EXPECT_EQ(data.substr(12345, part.size()), part);
+    EXPECT_EQ((ssize_t)45, f_stream_read_at(p_source, (uint8_t *)part.data(),
+                                            part.size(), data.size() - 45));
+    EXPECT_EQ(0, f_stream_read_at(p_source, (uint8_t *)part.data(), 1, data.size()));
+    f_stream_close(&p_source);
+
+    // The same data is stored once
+    ASSERT_EQ(OP_SUCCESS, create("two.bin", data));
+    EXPECT_EQ(count, chunks_count(p_chunks));
+    EXPECT_EQ(OP_FILE_EXISTS, create("two.bin", data));
+
+    // Small files are stored as they are
+    ASSERT_EQ(OP_SUCCESS, create("small.txt", "small"));
+    EXPECT_EQ("small", read_all(test_dir/"small.txt"));
+    EXPECT_EQ("small", read("small.txt"));
+}
+
+TEST_F(ServerChunksTest, TestDelete)
+{
+    ASSERT_EQ(OP_SUCCESS, create("one.bin", data));
+    ASSERT_EQ(OP_SUCCESS, create("two.bin", data));
+    size_t count = chunks_count(p_chunks);
+
+    EXPECT_EQ(OP_SUCCESS, remove("one.bin"));
+    EXPECT_EQ(count, chunks_count(p_chunks));
+
+    // An open stream holds the chunks of a deleted file
+    size_t size = 0;
+    f_stream_t * p_source = open("two.bin", &size);
+    ASSERT_NE(nullptr, p_source);
+    f_stream_t * p_copy = f_stream_dup(p_source);
+    f_stream_close(&p_source);
+    EXPECT_EQ(OP_SUCCESS, remove("two.bin"));
+    EXPECT_EQ(count, chunks_count(p_chunks));
+
+    std::string out(size, '\0');
+    EXPECT_EQ((ssize_t)size, f_stream_read_at(p_copy, (uint8_t *)out.data(), size, 0));
+    EXPECT_EQ(data, out);
+    f_stream_close(&p_copy);
+    EXPECT_EQ((size_t)0, chunks_count(p_chunks));
+    EXPECT_EQ((size_t)0, chunk_files());
+}
+
+TEST_F(ServerChunksTest, TestReplace)
+{
+    ASSERT_EQ(OP_SUCCESS, create("one.bin", data));
+    size_t count = chunks_count(p_chunks);
+
+    std::string edited = data.substr(0, 150000) + "inserted" + data.substr(150000);
+    verified_path_t * p_path = f_ver_path_resolve(p_home, "one.bin");
+    ret_codes_t code = OP_FAILURE;
+    f_stream_t * p_temp = f_stream_temp_for(p_path, &code);
+    ASSERT_NE(nullptr, p_temp);
+    ASSERT_EQ(OP_SUCCESS, f_stream_write(p_temp, (uint8_t *)edited.data(), edited.size()));
+    f_file_id_t id = {};
+    EXPECT_EQ(OP_SUCCESS, chunks_replace_file(p_chunks, p_temp, edited.size(), p_path, NULL, &id));
+    f_stream_close(&p_temp);
+    f_destroy_path(&p_path);
+
+    // Only the chunks around the edit changed
+    EXPECT_EQ(edited, read("one.bin"));
+    EXPECT_EQ((off_t)edited.size(), id.size);
+    EXPECT_LE(chunks_count(p_chunks), count + 2);
+    EXPECT_EQ(chunks_count(p_chunks), chunk_files());
+
+    EXPECT_EQ(OP_SUCCESS, remove("one.bin"));
+    EXPECT_EQ((size_t)0, chunks_count(p_chunks));
+}
+
+TEST_F(ServerChunksTest, TestAdopt)
+{
+    ASSERT_EQ(OP_SUCCESS, create("one.bin", data));
+    size_t count = chunks_count(p_chunks);
+
+    // Links share the references of the inode, copies take their own
+    std::filesystem::create_hard_link(test_dir/"one.bin", test_dir/"link.bin");
+    std::filesystem::copy_file(test_dir/"one.bin", test_dir/"copy.bin");
+    for (const char * p_name : {"link.bin", "copy.bin"})
+    {
+        verified_path_t * p_path = f_ver_path_resolve(p_home, p_name);
+        EXPECT_EQ(OP_SUCCESS, chunks_adopt(p_chunks, p_path));
+        f_destroy_path(&p_path);
+    }
+
+    EXPECT_EQ(OP_SUCCESS, remove("one.bin"));
+    EXPECT_EQ(OP_SUCCESS, remove("link.bin"));
+    EXPECT_EQ(count, chunks_count(p_chunks));
+    EXPECT_EQ(data, read("copy.bin"));
+    EXPECT_EQ(OP_SUCCESS, remove("copy.bin"));
+    EXPECT_EQ((size_t)0, chunks_count(p_chunks));
+}
+
+TEST_F(ServerChunksTest, TestReload)
+{
+    std::filesystem::create_directory(test_dir/"dir");
+    ASSERT_EQ(OP_SUCCESS, create("dir/one.bin", data));
+    std::filesystem::create_hard_link(test_dir/"dir/one.bin", test_dir/"link.bin");
+    size_t count = chunks_count(p_chunks);
+
+    // A stray chunk is removed and the references are counted again
+    std::ofstream(test_dir/CHUNKS_DIR/"00"/"stray") << "stray";
+    chunks_destroy(&p_chunks);
+    p_chunks = chunks_init(p_home, false);
+    ASSERT_NE(nullptr, p_chunks);
+    EXPECT_EQ(count, chunks_count(p_chunks));
+    EXPECT_EQ(count, chunk_files());
+    EXPECT_EQ(data, read("link.bin"));
+
+    // A store that does not take new files still releases the old ones
+    ASSERT_EQ(OP_SUCCESS, create("plain.bin", data));
+    EXPECT_EQ(data, read_all(test_dir/"plain.bin"));
+    EXPECT_EQ(OP_SUCCESS, remove("dir/one.bin"));
+    EXPECT_EQ(OP_SUCCESS, remove("link.bin"));
+    EXPECT_EQ((size_t)0, chunks_count(p_chunks));
+
+    // Manifests of another store are plain files
+    std::string id = read_all(test_dir/CHUNKS_DIR/"id");
+    ASSERT_EQ((size_t)16, id.size());
+    ASSERT_EQ(OP_SUCCESS, remove("plain.bin"));
+    chunks_destroy(&p_chunks);
+    p_chunks = chunks_init(p_home, true);
+    ASSERT_EQ(OP_SUCCESS, create("one.bin", data));
+    std::filesystem::remove_all(test_dir/CHUNKS_DIR);
+    std::filesystem::create_directories(test_dir/".cape");
+    chunks_destroy(&p_chunks);
+    p_chunks = chunks_init(p_home, true);
+    ASSERT_NE(nullptr, p_chunks);
+    EXPECT_NE(id, read_all(test_dir/CHUNKS_DIR/"id"));
+    EXPECT_EQ((size_t)0, chunks_count(p_chunks));
+    EXPECT_EQ(read_all(test_dir/"one.bin"), read("one.bin"));
+}
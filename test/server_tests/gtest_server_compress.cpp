@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+#include <server_compress.h>
+#include <string.h>
+#include <vector>
+
+/*!
+ * Data with long repeats, short repeats and noise so every kind of LZ4
+ * sequence is produced
+ */
+static std::vector<uint8_t> make_data(size_t length)
+{
+    std::vector<uint8_t> data(length);
+    uint32_t state = 0x12345678;
+    for (size_t i = 0; i < length; i++)
+    {
+        state = (state * 1103515245) + 12345;
+        switch ((i / 4096) % 3)
+        {
+            case 0:
+                data[i] = (uint8_t)"cape file server "[i % 17];
+                break;
+            case 1:
+                data[i] = (uint8_t)(i % 3);
+                break;
+            default:
+                data[i] = (uint8_t)(state >> 16);
+                break;
+        }
+    }
+    return data;
+}
+
+static std::vector<uint8_t> round_trip(codec_t codec, const std::vector<uint8_t> & data)
+{
+    uint8_t * p_frames = NULL;
+    size_t frames_len = 0;
+    EXPECT_EQ(OP_SUCCESS, compress_buffer(codec, data.data(), data.size(),
+                                          &p_frames, &frames_len));
+
+    uint8_t * p_out = NULL;
+    size_t out_len = 0;
+    EXPECT_EQ(OP_SUCCESS, decompress_buffer(codec, p_frames, frames_len,
+                                            &p_out, &out_len));
+    std::vector<uint8_t> out(p_out, p_out + out_len);
+
+    // Sizing first decompresses to the same data in memory of the caller
+    size_t sized_len = 0;
+    EXPECT_EQ(OP_SUCCESS, decompress_size(codec, p_frames, frames_len, &sized_len));
+    EXPECT_EQ(out_len, sized_len);
+    std::vector<uint8_t> into(sized_len);
+    EXPECT_EQ(OP_SUCCESS, decompress_into(codec, p_frames, frames_len, into.data()));
+    EXPECT_EQ(out, into);
+
+    free(p_frames);
+    free(p_out);
+    return out;
+}
+
+class ServerCompressTest : public ::testing::TestWithParam<codec_t>{};
+
+TEST_P(ServerCompressTest, TestRoundTrip)
+{
+    codec_t codec = GetParam();
+    if (!compress_supported(codec))
+    {
+        GTEST_SKIP() << "Codec not built in";
+    }
+
+    for (size_t length : {(size_t)1, (size_t)12, (size_t)13, (size_t)4096,
+                          (size_t)100000, (size_t)(COMPRESS_FRAME_SIZE * 2) + 17})
+    {
+        std::vector<uint8_t> data = make_data(length);
+        EXPECT_EQ(data, round_trip(codec, data)) << length;
+    }
+
+    // Repetitive data shrinks
+    std::vector<uint8_t> text(100000, 'a');
+    uint8_t * p_frames = NULL;
+    size_t frames_len = 0;
+    ASSERT_EQ(OP_SUCCESS, compress_buffer(codec, text.data(), text.size(),
+                                          &p_frames, &frames_len));
+    EXPECT_LT(frames_len, text.size() / 50);
+    free(p_frames);
+}
+
+TEST_P(ServerCompressTest, TestStoredFrame)
+{
+    codec_t codec = GetParam();
+    if (!compress_supported(codec))
+    {
+        GTEST_SKIP() << "Codec not built in";
+    }
+
+    // Noise does not compress so the frame is stored as is
+    std::vector<uint8_t> noise(5000);
+    uint32_t state = 1;
+    for (auto & byte : noise)
+    {
+        state = (state * 1103515245) + 12345;
+        byte = (uint8_t)(state >> 16);
+    }
+    std::vector<uint8_t> frame(COMPRESS_FRAME_HEADER + noise.size());
+    size_t frame_len = 0;
+    ASSERT_EQ(OP_SUCCESS, compress_frame(codec, noise.data(), noise.size(),
+                                         frame.data(), &frame_len));
+    EXPECT_EQ(frame.size(), frame_len);
+    EXPECT_EQ(0, memcmp(noise.data(), frame.data() + COMPRESS_FRAME_HEADER, noise.size()));
+    EXPECT_EQ(noise, round_trip(codec, noise));
+
+    // No frames decompress to nothing
+    uint8_t * p_out = (uint8_t *)&frame_len;
+    size_t out_len = 1;
+    EXPECT_EQ(OP_SUCCESS, decompress_buffer(codec, NULL, 0, &p_out, &out_len));
+    EXPECT_EQ(nullptr, p_out);
+    EXPECT_EQ(0, out_len);
+}
+
+TEST_P(ServerCompressTest, TestCorrupt)
+{
+    codec_t codec = GetParam();
+    if (!compress_supported(codec))
+    {
+        GTEST_SKIP() << "Codec not built in";
+    }
+
+    std::vector<uint8_t> data = make_data(50000);
+    uint8_t * p_frames = NULL;
+    size_t frames_len = 0;
+    ASSERT_EQ(OP_SUCCESS, compress_buffer(codec, data.data(), data.size(),
+                                          &p_frames, &frames_len));
+    std::vector<uint8_t> frames(p_frames, p_frames + frames_len);
+    free(p_frames);
+
+    uint8_t * p_out = NULL;
+    size_t out_len = 0;
+
+    // Truncated frames
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, frames.data(), frames.size() - 1,
+                                                &p_out, &out_len));
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, frames.data(), 5, &p_out, &out_len));
+
+    // Raw length that does not match what the body produces
+    std::vector<uint8_t> bad = frames;
+    bad[3] ^= 1;
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, bad.data(), bad.size(),
+                                                &p_out, &out_len));
+
+    // Garbage body
+    bad = frames;
+    memset(bad.data() + COMPRESS_FRAME_HEADER, 0xFF, 64);
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, bad.data(), bad.size(),
+                                                &p_out, &out_len));
+
+    // A tiny body claiming a full frame is rejected before allocating
+    uint8_t bomb[COMPRESS_FRAME_HEADER + 4] = {0x00, 0x10, 0x00, 0x00, 0, 0, 0, 4};
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, bomb, sizeof(bomb),
+                                                &p_out, &out_len));
+
+    // Frames larger than COMPRESS_FRAME_SIZE are never produced
+    uint8_t big[COMPRESS_FRAME_HEADER] = {0x00, 0x10, 0x00, 0x01, 0x00, 0x10, 0x00, 0x01};
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(codec, big, sizeof(big),
+                                                &p_out, &out_len));
+    EXPECT_EQ(nullptr, p_out);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    CompressTests,
+    ServerCompressTest,
+    ::testing::Values(CODEC_ZLIB, CODEC_LZ4)
+);
+
+TEST(TestCompress, TestCodecFlags)
+{
+    EXPECT_EQ(CODEC_NONE, compress_codec(0x0001));
+    EXPECT_EQ(CODEC_ZLIB, compress_codec(0x0012));
+    EXPECT_EQ(CODEC_LZ4, compress_codec(0x0020));
+    EXPECT_FALSE(compress_supported(CODEC_NONE));
+    EXPECT_TRUE(compress_supported(CODEC_LZ4));
+
+    // Codecs this build does not know come in through the request flags
+    codec_t unknown = compress_codec(0xF << CODEC_SHIFT);
+    EXPECT_FALSE(compress_supported(unknown));
+
+    uint8_t frame[COMPRESS_FRAME_HEADER + 1];
+    size_t frame_len = 0;
+    EXPECT_EQ(OP_FAILURE, compress_frame(CODEC_NONE, frame, 1, frame, &frame_len));
+    uint8_t * p_out = NULL;
+    size_t out_len = 0;
+    EXPECT_EQ(OP_CODEC_ERROR, decompress_buffer(unknown, frame, 0, &p_out, &out_len));
+}
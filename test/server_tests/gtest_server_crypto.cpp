@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 #include <server_crypto.h>
+#include <atomic>
+#include <initializer_list>
+#include <thread>
+#include <vector>
 
 extern "C"
 {
-    hash_t * hex_char_to_byte_array(const char *p_hash_str, size_t hash_size);
-    void print_b_array(hash_t * p_hash);
+    void print_b_array(const hash_t * p_hash);
 }
 
 
@@ -22,23 +25,30 @@ TEST_P(ServerCryptoHashTest, TestValidPorts)
     auto [string_to_hash, sha256_sum_hash] = GetParam();
 
 
-    hash_t * pw_hash =
-        hash_byte_array((uint8_t *)string_to_hash.c_str(),
-                        string_to_hash.size());
-    EXPECT_NE(nullptr, pw_hash);
+    hash_t pw_hash;
+    EXPECT_TRUE(hash_byte_array((uint8_t *)string_to_hash.c_str(),
+                                string_to_hash.size(), &pw_hash));
 
-    hash_t * exp_hash = hex_char_to_byte_array(sha256_sum_hash.c_str(), sha256_sum_hash.size());
-    EXPECT_NE(nullptr, exp_hash);
+    hash_t exp_hash;
+    EXPECT_TRUE(hash_from_hex(sha256_sum_hash.c_str(), sha256_sum_hash.size(), &exp_hash));
 
-    EXPECT_EQ(pw_hash->size, exp_hash->size);
-
-    for (size_t i = 0; i < pw_hash->size; i++)
+    for (size_t i = 0; i < sizeof(pw_hash.array); i++)
     {
-        EXPECT_EQ(pw_hash->array[i], exp_hash->array[i]);
+        EXPECT_EQ(pw_hash.array[i], exp_hash.array[i]);
     }
+    EXPECT_TRUE(hash_match(&pw_hash, &exp_hash));
 
-    hash_destroy(& pw_hash);
-    hash_destroy(& exp_hash);
+    // Hashing the same bytes in pieces gives the same digest
+    hash_stream_t stream;
+    ASSERT_TRUE(hash_stream_init(&stream, HASH_ALG_SHA256));
+    size_t half = string_to_hash.size() / 2;
+    EXPECT_TRUE(hash_stream_update(&stream, (uint8_t *)string_to_hash.c_str(), half));
+    EXPECT_TRUE(hash_stream_update(&stream, (uint8_t *)string_to_hash.c_str() + half,
+                                   string_to_hash.size() - half));
+    hash_t stream_hash;
+    EXPECT_TRUE(hash_stream_final(&stream, &stream_hash));
+    EXPECT_EQ(nullptr, stream.p_ctx);
+    EXPECT_TRUE(hash_match(&stream_hash, &exp_hash));
 }
 
 INSTANTIATE_TEST_SUITE_P(
@@ -95,7 +105,325 @@ INSTANTIATE_TEST_SUITE_P(
 TEST(TestMatchingFunc, TestMatch)
 {
     const char * hash_str = "5e884898da28047151d0e56f8dc6292773603d0d6aabbdd62a11ef721d1542d8";
-    hash_t * hash = hash_byte_array((uint8_t *)"password", 8);
-    EXPECT_TRUE(hash_pass_match(hash, hash_str, strlen(hash_str)));
-    hash_destroy(& hash);
+    hash_t hash;
+    EXPECT_TRUE(hash_byte_array((uint8_t *)"password", 8, &hash));
+    EXPECT_TRUE(hash_pass_match(&hash, hash_str, strlen(hash_str)));
+
+    // Wrong length, non hex characters and a single changed byte
+    EXPECT_FALSE(hash_pass_match(&hash, hash_str, strlen(hash_str) - 2));
+    std::string bad{hash_str};
+    bad[10] = 'g';
+    EXPECT_FALSE(hash_pass_match(&hash, bad.c_str(), bad.size()));
+    bad[10] = '0';
+    EXPECT_FALSE(hash_pass_match(&hash, bad.c_str(), bad.size()));
+}
+
+/*
+ * Expected roots were computed with the python client's tree hash so both
+ * sides of the protocol agree on the leaf and node encoding
+ */
+class ServerCryptoTreeTest : public ::testing::TestWithParam<std::tuple<size_t, std::string>>{};
+
+TEST_P(ServerCryptoTreeTest, TestTreeRoot)
+{
+    auto [length, root_hex] = GetParam();
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = (uint8_t)(i % 251);
+    }
+
+    hash_t exp_hash;
+    ASSERT_TRUE(hash_from_hex(root_hex.c_str(), root_hex.size(), &exp_hash));
+
+    // The root does not depend on the number of threads hashing the leaves
+    for (uint8_t threads : std::initializer_list<uint8_t>{1, 2, 3, 0})
+    {
+        hash_t root;
+        ASSERT_TRUE(hash_tree_bytes(data.data(), data.size(), threads, &root));
+        EXPECT_TRUE(hash_match(&exp_hash, &root));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    TreeHashTests,
+    ServerCryptoTreeTest,
+    ::testing::Values(
+        std::make_tuple(0, "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d"),
+        std::make_tuple((3 * HASH_TREE_LEAF_SIZE) + 5,
+                        "19cc3f2db5bad6ffe7c2538ca892fbee5afa64cce958b830b60bea68a155d4a4")
+    ));
+
+TEST(TestTreeHash, TestLeaves)
+{
+    std::vector<uint8_t> data((2 * HASH_TREE_LEAF_SIZE) + 7, 0xAB);
+    hash_tree_t * tree = hash_tree_init(data.size());
+    ASSERT_NE(nullptr, tree);
+    EXPECT_EQ(3, hash_tree_leaf_count(tree));
+
+    // The last leaf is short and must be given with its exact size
+    EXPECT_FALSE(hash_tree_set_leaf(tree, 2, data.data(), HASH_TREE_LEAF_SIZE));
+    EXPECT_FALSE(hash_tree_set_leaf(tree, 3, data.data(), 7));
+    EXPECT_EQ(nullptr, hash_tree_leaf(tree, 3));
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        size_t offset = i * HASH_TREE_LEAF_SIZE;
+        size_t length = std::min((size_t)HASH_TREE_LEAF_SIZE, data.size() - offset);
+        EXPECT_TRUE(hash_tree_set_leaf(tree, i, data.data() + offset, length));
+    }
+
+    // Each leaf can be checked on its own against sha256(0x00 || leaf)
+    std::vector<uint8_t> leaf{0x00};
+    leaf.insert(leaf.end(), data.begin() + (2 * HASH_TREE_LEAF_SIZE), data.end());
+    hash_t leaf_hash;
+    EXPECT_TRUE(hash_byte_array(leaf.data(), leaf.size(), &leaf_hash));
+    EXPECT_TRUE(hash_match(&leaf_hash, hash_tree_leaf(tree, 2)));
+
+    // Root of three leaves is node(node(l0, l1), l2)
+    auto append = [](std::vector<uint8_t> & out, const hash_t * hash) {
+        out.insert(out.end(), hash->array, hash->array + sizeof(hash->array));
+    };
+    std::vector<uint8_t> node{0x01};
+    append(node, hash_tree_leaf(tree, 0));
+    append(node, hash_tree_leaf(tree, 1));
+    hash_t left;
+    EXPECT_TRUE(hash_byte_array(node.data(), node.size(), &left));
+    node.resize(1);
+    append(node, &left);
+    append(node, hash_tree_leaf(tree, 2));
+    hash_t expected;
+    EXPECT_TRUE(hash_byte_array(node.data(), node.size(), &expected));
+
+    hash_t root;
+    EXPECT_TRUE(hash_tree_root(tree, &root));
+    EXPECT_TRUE(hash_match(&expected, &root));
+
+    hash_tree_destroy(& tree);
+    EXPECT_EQ(nullptr, tree);
+}
+
+// Trees hashed at the same time share the workers of one pool and a leaf
+// that fails stops the tree
+TEST(TestTreeHash, TestFill)
+{
+    std::vector<uint8_t> data((5 * HASH_TREE_LEAF_SIZE) + 3, 0x5A);
+    hash_t expected;
+    ASSERT_TRUE(hash_tree_bytes(data.data(), data.size(), 1, &expected));
+
+    std::atomic_uint matches = 0;
+    std::vector<std::thread> hashers;
+    for (int i = 0; i < 6; i++)
+    {
+        hashers.emplace_back([&]() {
+            hash_t root;
+            if (hash_tree_bytes(data.data(), data.size(), 0, &root)
+                && hash_match(&expected, &root))
+            {
+                matches++;
+            }
+        });
+    }
+    for (auto & hasher : hashers)
+    {
+        hasher.join();
+    }
+    EXPECT_EQ(6, matches);
+
+    hash_tree_t * tree = hash_tree_init(data.size());
+    ASSERT_NE(nullptr, tree);
+    auto fail_third = [](hash_tree_t *, size_t index, void * p_ctx) {
+        ((std::atomic_uint *)p_ctx)->fetch_add(1);
+        return 2 != index;
+    };
+    std::atomic_uint calls = 0;
+    EXPECT_FALSE(hash_tree_fill(tree, 3, fail_third, &calls));
+    EXPECT_LE(3, calls);
+    EXPECT_FALSE(hash_tree_fill(NULL, 3, fail_third, &calls));
+    hash_tree_destroy(&tree);
+}
+
+/*
+ * Expected digests are from the BLAKE3 reference implementation over the
+ * bytes i % 251. The lengths sit on either side of the chunk and subtree
+ * boundaries where the chaining values are merged
+ */
+class ServerCryptoBlake3Test : public ::testing::TestWithParam<std::tuple<size_t, std::string>>{};
+
+TEST_P(ServerCryptoBlake3Test, TestDigest)
+{
+    auto [length, digest_hex] = GetParam();
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = (uint8_t)(i % 251);
+    }
+
+    hash_t exp_hash;
+    ASSERT_TRUE(hash_from_hex(digest_hex.c_str(), digest_hex.size(), &exp_hash));
+
+    // Both implementations agree and the result does not depend on how the
+    // stream is split
+    for (bool b_simd : {false, true})
+    {
+        blake3_use_simd(b_simd);
+
+        hash_t hash;
+        ASSERT_TRUE(hash_alg_bytes(HASH_ALG_BLAKE3, data.data(), data.size(), &hash));
+        EXPECT_TRUE(hash_match(&exp_hash, &hash));
+
+        hash_stream_t stream;
+        ASSERT_TRUE(hash_stream_init(&stream, HASH_ALG_BLAKE3));
+        size_t offset = 0;
+        for (size_t piece = 1; offset < length; piece = (piece * 3) + 7)
+        {
+            size_t take = std::min(piece, length - offset);
+            EXPECT_TRUE(hash_stream_update(&stream, data.data() + offset, take));
+            offset += take;
+        }
+        hash_t stream_hash;
+        EXPECT_TRUE(hash_stream_final(&stream, &stream_hash));
+        EXPECT_TRUE(hash_match(&exp_hash, &stream_hash));
+    }
+    blake3_use_simd(true);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Blake3Tests,
+    ServerCryptoBlake3Test,
+    ::testing::Values(
+        std::make_tuple(0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"),
+        std::make_tuple(1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"),
+        std::make_tuple(1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"),
+        std::make_tuple(1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"),
+        std::make_tuple(1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"),
+        std::make_tuple(2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"),
+        std::make_tuple(3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"),
+        std::make_tuple(8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"),
+        std::make_tuple(8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"),
+        std::make_tuple(31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"),
+        std::make_tuple(102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085")
+    ));
+
+TEST(TestHashAlg, TestAlgorithms)
+{
+    const uint8_t data[] = {'a', 'b', 'c'};
+    hash_t hash;
+    hash_t expected;
+
+    EXPECT_TRUE(hash_alg_bytes(HASH_ALG_SHA256, data, sizeof(data), &hash));
+    EXPECT_TRUE(hash_byte_array(data, sizeof(data), &expected));
+    EXPECT_TRUE(hash_match(&expected, &hash));
+
+    EXPECT_TRUE(hash_alg_bytes(HASH_ALG_TREE, data, sizeof(data), &hash));
+    EXPECT_TRUE(hash_tree_bytes(data, sizeof(data), 1, &expected));
+    EXPECT_TRUE(hash_match(&expected, &hash));
+
+    const char * blake3_abc = "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85";
+    EXPECT_TRUE(hash_alg_bytes(HASH_ALG_BLAKE3, data, sizeof(data), &hash));
+    EXPECT_TRUE(hash_pass_match(&hash, blake3_abc, strlen(blake3_abc)));
+
+    // Streams running at the same time on one thread have contexts of their
+    // own, which are reused by the streams started after them
+    hash_stream_t first;
+    hash_stream_t second;
+    for (int round = 0; round < 2; round++)
+    {
+        ASSERT_TRUE(hash_stream_init(&first, HASH_ALG_SHA256));
+        ASSERT_TRUE(hash_stream_init(&second, HASH_ALG_SHA256));
+        EXPECT_TRUE(hash_stream_update(&first, data, 1));
+        EXPECT_TRUE(hash_stream_update(&second, data + 1, 2));
+        EXPECT_TRUE(hash_stream_update(&first, data + 1, 2));
+        EXPECT_TRUE(hash_stream_final(&second, &hash));
+        EXPECT_TRUE(hash_byte_array(data + 1, 2, &expected));
+        EXPECT_TRUE(hash_match(&expected, &hash));
+        EXPECT_TRUE(hash_stream_final(&first, &hash));
+        EXPECT_TRUE(hash_byte_array(data, sizeof(data), &expected));
+        EXPECT_TRUE(hash_match(&expected, &hash));
+    }
+
+    // Tree hashes can not be streamed and unknown algorithms are rejected
+    hash_stream_t stream;
+    EXPECT_FALSE(hash_stream_init(&stream, HASH_ALG_TREE));
+    uint16_t flags = 7;
+    hash_alg_t unknown = (hash_alg_t)(flags & HASH_ALG_MASK);
+    EXPECT_FALSE(hash_stream_init(&stream, unknown));
+    EXPECT_FALSE(hash_alg_bytes(unknown, data, sizeof(data), &hash));
+}
+
+TEST(TestHexCodec, TestEncodeDecode)
+{
+    // Lengths around the 16 and 32 byte SIMD blocks so every path and tail
+    // is used
+    std::vector<uint8_t> data(100);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)((i * 37) + 11);
+    }
+
+    for (bool b_simd : {false, true})
+    {
+        hex_use_simd(b_simd);
+        for (size_t length : {0, 1, 15, 16, 17, 31, 32, 33, 48, 64, 100})
+        {
+            std::string expected;
+            char digits[3];
+            for (size_t i = 0; i < length; i++)
+            {
+                snprintf(digits, sizeof(digits), "%02x", data[i]);
+                expected += digits;
+            }
+
+            std::string hex(length * 2, '\0');
+            EXPECT_EQ(length * 2, hex_encode(data.data(), length, hex.data()));
+            EXPECT_EQ(expected, hex);
+
+            std::vector<uint8_t> decoded(length);
+            EXPECT_TRUE(hex_decode(hex.data(), hex.size(), decoded.data()));
+            EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), data.begin()));
+
+            // Upper case decodes to the same bytes
+            for (char & c : hex)
+            {
+                c = (char)toupper(c);
+            }
+            std::fill(decoded.begin(), decoded.end(), 0);
+            EXPECT_TRUE(hex_decode(hex.data(), hex.size(), decoded.data()));
+            EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), data.begin()));
+        }
+    }
+    hex_use_simd(true);
+}
+
+TEST(TestHexCodec, TestInvalid)
+{
+    std::vector<uint8_t> data(64, 0xab);
+    std::string hex(data.size() * 2, '\0');
+    hex_encode(data.data(), data.size(), hex.data());
+    std::vector<uint8_t> decoded(data.size());
+
+    EXPECT_FALSE(hex_decode(hex.data(), hex.size() - 1, decoded.data()));
+
+    // Characters just outside the digit and letter ranges are rejected
+    // wherever they are
+    for (bool b_simd : {false, true})
+    {
+        hex_use_simd(b_simd);
+        for (size_t pos = 0; pos < hex.size(); pos += 7)
+        {
+            for (char bad : {'/', ':', '@', 'G', '`', 'g', ' ', '\x80'})
+            {
+                std::string copy = hex;
+                copy[pos] = bad;
+                EXPECT_FALSE(hex_decode(copy.data(), copy.size(), decoded.data()));
+            }
+        }
+    }
+    hex_use_simd(true);
+
+    hash_t hash;
+    char hash_hex[(sizeof(hash.array) * 2) + 1];
+    EXPECT_TRUE(hash_byte_array((uint8_t *)"password", 8, &hash));
+    EXPECT_TRUE(hash_to_hex(&hash, hash_hex));
+    EXPECT_STREQ("5e884898da28047151d0e56f8dc6292773603d0d6aabbdd62a11ef721d1542d8", hash_hex);
 }
@@ -48,7 +48,7 @@ class DBUserActions : public ::testing::Test
         // server_args api will already create the verified_path_t in order
         // to verify that the path is valid
         p_home_dir = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
-        this->user_db = db_init(this->p_home_dir);
+        this->user_db = db_init(this->p_home_dir, SYNC_NONE);
         if (NULL == this->user_db)
         {
             f_destroy_path(&p_home_dir);
@@ -531,7 +531,7 @@ TEST(TestDBParsing, ParseDB)
      * Test the successful creation of the ./cape dir and the .cape/.cape.db and
      * .cape/.cape.hash
      */
-    db_t * htable = db_init(p_home_dir);
+    db_t * htable = db_init(p_home_dir, SYNC_NONE);
     EXPECT_NE(htable, nullptr); // Creates both
     db_shutdown(&htable);
     std::filesystem::remove_all(home);
@@ -540,7 +540,7 @@ TEST(TestDBParsing, ParseDB)
 db_t * reset_test(const char * path)
 {
     verified_path_t * p_home_dir = f_set_home_dir(path, strlen(path));
-    db_t * db = db_init(p_home_dir);
+    db_t * db = db_init(p_home_dir, SYNC_NONE);
     if (NULL == db)
     {
         f_destroy_path(&p_home_dir);
@@ -572,7 +572,7 @@ TEST(TestDBInit, SingleThreadTests)
      * Test the successful creation of the ./cape dir and the .cape/.cape.db and
      * .cape/.cape.hash
      */
-    p_db = db_init(p_home_dir);
+    p_db = db_init(p_home_dir, SYNC_NONE);
     EXPECT_NE(p_db, nullptr);
     db_shutdown(&p_db);
     std::filesystem::remove_all(home_cape);
@@ -624,3 +624,33 @@ TEST(TestDBInit, SingleThreadTests)
     db_shutdown(&p_db);
     std::filesystem::remove_all(home);
 }
+
+/*!
+ * Rates given to users are saved with their accounts and read back
+ */
+TEST(TestDBInit, UserRate)
+{
+    const char * home = "/tmp/test_user_rate";
+    std::filesystem::remove_all(home);
+    std::filesystem::create_directory(home);
+
+    db_t * p_db = reset_test(home);
+    ASSERT_NE(p_db, nullptr);
+    EXPECT_EQ(OP_SUCCESS, db_create_user(p_db, "limited", "password", READ));
+    EXPECT_EQ(OP_SUCCESS, db_create_user(p_db, "unlimited", "password", READ));
+    EXPECT_EQ(OP_SUCCESS, db_set_user_rate(p_db, "limited", 1 << 20));
+    EXPECT_EQ(OP_USER_NO_EXIST, db_set_user_rate(p_db, "nobody", 1 << 20));
+    db_shutdown(&p_db);
+
+    p_db = reset_test(home);
+    ASSERT_NE(p_db, nullptr);
+    user_account_t * p_user = NULL;
+    ASSERT_EQ(OP_SUCCESS, db_authenticate_user(p_db, &p_user, "limited", "password"));
+    EXPECT_EQ((uint64_t)1 << 20, p_user->rate);
+    ASSERT_EQ(OP_SUCCESS, db_authenticate_user(p_db, &p_user, "unlimited", "password"));
+    EXPECT_EQ((uint64_t)0, p_user->rate);
+    ASSERT_EQ(OP_SUCCESS, db_authenticate_user(p_db, &p_user, "admin", "password"));
+    EXPECT_EQ((uint64_t)0, p_user->rate);
+    db_shutdown(&p_db);
+    std::filesystem::remove_all(home);
+}
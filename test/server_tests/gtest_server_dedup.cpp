@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <server_dedup.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+
+static const std::filesystem::path test_dir{"/tmp/dedup_test"};
+
+static std::string read_all(const std::filesystem::path & path)
+{
+    std::ifstream in{path, std::ios::binary};
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+class ServerDedupTest : public ::testing::Test
+{
+protected:
+    verified_path_t * p_home = NULL;
+    dedup_t * p_dedup = NULL;
+
+    void SetUp() override
+    {
+        std::filesystem::remove_all(test_dir);
+        std::filesystem::create_directory(test_dir);
+        p_home = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+        ASSERT_NE(nullptr, p_home);
+        p_dedup = dedup_init();
+        ASSERT_NE(nullptr, p_dedup);
+    }
+
+    void TearDown() override
+    {
+        dedup_destroy(&p_dedup);
+        EXPECT_EQ(nullptr, p_dedup);
+        f_destroy_path(&p_home);
+        std::filesystem::remove_all(test_dir);
+    }
+
+    /*!
+     * Upload the data to the path and index it the way a PUT does
+     */
+    void put(const char * p_name, const std::string & data, hash_t * p_hash)
+    {
+        verified_path_t * p_path = f_ver_valid_resolve(p_home, p_name);
+        ASSERT_NE(nullptr, p_path);
+        f_file_id_t id;
+        ASSERT_EQ(OP_SUCCESS, f_create_file(p_path, (uint8_t *)data.data(),
+                                            data.size(), NULL, &id));
+        ASSERT_TRUE(hash_alg_bytes(HASH_ALG_SHA256, (const uint8_t *)data.data(),
+                                   data.size(), p_hash));
+        dedup_add(p_dedup, HASH_ALG_SHA256, p_hash, p_name, &id);
+        f_destroy_path(&p_path);
+    }
+
+    ret_codes_t link(const char * p_name, hash_alg_t alg, const hash_t * p_hash)
+    {
+        verified_path_t * p_path = f_ver_valid_resolve(p_home, p_name);
+        EXPECT_NE(nullptr, p_path);
+        ret_codes_t code = dedup_link(p_dedup, p_home, alg, p_hash, p_path, NULL);
+        f_destroy_path(&p_path);
+        return code;
+    }
+};
+
+TEST_F(ServerDedupTest, TestLinkIndexedFile)
+{
+    hash_t hash;
+    put("artifact.bin", "release artifact", &hash);
+    EXPECT_EQ((size_t)1, dedup_count(p_dedup));
+
+    ASSERT_EQ(OP_SUCCESS, link("copy.bin", HASH_ALG_SHA256, &hash));
+    EXPECT_EQ("release artifact", read_all(test_dir/"copy.bin"));
+    EXPECT_TRUE(std::filesystem::equivalent(test_dir/"artifact.bin", test_dir/"copy.bin"));
+
+    // Existing files are never replaced
+    EXPECT_EQ(OP_FILE_EXISTS, link("copy.bin", HASH_ALG_SHA256, &hash));
+
+    // The digest only names the contents under its own algorithm
+    EXPECT_EQ(OP_HASH_UNKNOWN, link("other.bin", HASH_ALG_BLAKE3, &hash));
+    hash_t unknown = {};
+    EXPECT_EQ(OP_HASH_UNKNOWN, link("other.bin", HASH_ALG_SHA256, &unknown));
+    EXPECT_FALSE(std::filesystem::exists(test_dir/"other.bin"));
+}
+
+TEST_F(ServerDedupTest, TestStaleEntries)
+{
+    hash_t hash;
+    put("artifact.bin", "first version", &hash);
+
+    // A new file at the same path does not hold the indexed contents
+    std::filesystem::remove(test_dir/"artifact.bin");
+    hash_t other;
+    verified_path_t * p_path = f_ver_valid_resolve(p_home, "artifact.bin");
+    ASSERT_NE(nullptr, p_path);
+    ASSERT_EQ(OP_SUCCESS, f_create_file(p_path, (uint8_t *)"second version",
+                                        14, NULL, NULL));
+    f_destroy_path(&p_path);
+
+    EXPECT_EQ(OP_HASH_UNKNOWN, link("copy.bin", HASH_ALG_SHA256, &hash));
+    EXPECT_FALSE(std::filesystem::exists(test_dir/"copy.bin"));
+    EXPECT_EQ((size_t)0, dedup_count(p_dedup));
+
+    // Indexing the same contents again replaces the entry
+    put("again.bin", "first version", &other);
+    put("twice.bin", "first version", &other);
+    EXPECT_EQ((size_t)1, dedup_count(p_dedup));
+    std::filesystem::remove(test_dir/"again.bin");
+    EXPECT_EQ(OP_SUCCESS, link("copy.bin", HASH_ALG_SHA256, &other));
+    EXPECT_EQ("first version", read_all(test_dir/"copy.bin"));
+}
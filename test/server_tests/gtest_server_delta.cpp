@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include <server_delta.h>
+#include <arpa/inet.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static const std::filesystem::path test_dir{"/tmp/delta_test"};
+
+static std::string read_all(const std::filesystem::path & path)
+{
+    std::ifstream in{path, std::ios::binary};
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void put_be32(std::vector<uint8_t> & delta, uint32_t value)
+{
+    value = htonl(value);
+    const uint8_t * p_bytes = (const uint8_t *)&value;
+    delta.insert(delta.end(), p_bytes, p_bytes + sizeof(value));
+}
+
+static void put_copy(std::vector<uint8_t> & delta, uint32_t index, uint32_t count)
+{
+    delta.push_back(DELTA_OP_COPY);
+    put_be32(delta, index);
+    put_be32(delta, count);
+}
+
+static void put_data(std::vector<uint8_t> & delta, const std::string & bytes)
+{
+    delta.push_back(DELTA_OP_DATA);
+    put_be32(delta, (uint32_t)bytes.size());
+    delta.insert(delta.end(), bytes.begin(), bytes.end());
+}
+
+class ServerDeltaTest : public ::testing::Test
+{
+protected:
+    verified_path_t * p_home = NULL;
+    verified_path_t * p_path = NULL;
+    f_stream_t * p_base = NULL;
+    size_t base_size = 0;
+    std::string base;
+
+    void SetUp() override
+    {
+        std::filesystem::remove_all(test_dir);
+        std::filesystem::create_directory(test_dir);
+        p_home = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+        ASSERT_NE(nullptr, p_home);
+
+        // Three full blocks and a short one of distinct bytes
+        for (size_t i = 0; i < (3 * DELTA_MIN_BLOCK) + 100; i++)
+        {
+            base.push_back((char)((i * 7) + (i / DELTA_MIN_BLOCK)));
+        }
+        p_path = f_ver_valid_resolve(p_home, "data.bin");
+        ASSERT_NE(nullptr, p_path);
+        ASSERT_EQ(OP_SUCCESS, f_create_file(p_path, (uint8_t *)base.data(),
+                                            base.size(), NULL, NULL));
+        ret_codes_t code = OP_FAILURE;
+        p_base = f_stream_open(p_path, &base_size, &code);
+        ASSERT_NE(nullptr, p_base);
+    }
+
+    void TearDown() override
+    {
+        f_stream_close(&p_base);
+        f_destroy_path(&p_path);
+        f_destroy_path(&p_home);
+        std::filesystem::remove_all(test_dir);
+    }
+
+    ret_codes_t apply(const std::vector<uint8_t> & delta, std::string & out)
+    {
+        ret_codes_t code = OP_FAILURE;
+        f_stream_t * p_out = f_stream_temp_for(p_path, &code);
+        EXPECT_NE(nullptr, p_out);
+        size_t out_len = 0;
+        code = delta_apply(p_base, base_size, delta.data(), delta.size(),
+                           p_out, NULL, &out_len);
+        if (OP_SUCCESS == code)
+        {
+            out.resize(out_len);
+            EXPECT_EQ((ssize_t)out_len, f_stream_read_at(p_out, (uint8_t *)out.data(), out_len, 0));
+            code = f_stream_replace(p_out, p_path, NULL);
+        }
+        f_stream_close(&p_out);
+        return code;
+    }
+};
+
+TEST_F(ServerDeltaTest, TestSignature)
+{
+    EXPECT_EQ((size_t)DELTA_MIN_BLOCK, delta_block_size(0));
+    EXPECT_EQ((size_t)4096, delta_block_size(10 << 20));
+    EXPECT_EQ((size_t)DELTA_MAX_BLOCK, delta_block_size((size_t)64 << 30));
+
+    // The weak checksum is adler32 so clients can roll it with zlib
+    EXPECT_EQ((uint32_t)0x11E60398, delta_weak((const uint8_t *)"Wikipedia", 9));
+
+    uint8_t * p_sig = NULL;
+    size_t sig_len = 0;
+    ASSERT_EQ(OP_SUCCESS, delta_signature(p_base, base_size, HASH_ALG_SHA256, &p_sig, &sig_len));
+    ASSERT_EQ((size_t)(DELTA_SIG_HEADER + (4 * DELTA_SIG_ENTRY)), sig_len);
+    EXPECT_EQ((uint32_t)DELTA_MIN_BLOCK, ntohl(*(uint32_t *)p_sig));
+
+    // The short last block is summed over its own bytes
+    const uint8_t * p_last = p_sig + DELTA_SIG_HEADER + (3 * DELTA_SIG_ENTRY);
+    const uint8_t * p_tail = (const uint8_t *)base.data() + (3 * DELTA_MIN_BLOCK);
+    EXPECT_EQ(delta_weak(p_tail, 100), ntohl(*(uint32_t *)p_last));
+    hash_t strong;
+    ASSERT_TRUE(hash_alg_bytes(HASH_ALG_SHA256, p_tail, 100, &strong));
+    EXPECT_EQ(0, memcmp(strong.array, p_last + 4, DELTA_STRONG_LEN));
+    free(p_sig);
+}
+
+TEST_F(ServerDeltaTest, TestApply)
+{
+    // Insert bytes after the first block, drop the second and keep the rest
+    std::vector<uint8_t> delta;
+    put_be32(delta, DELTA_MIN_BLOCK);
+    put_copy(delta, 0, 1);
+    put_data(delta, "inserted");
+    put_copy(delta, 2, 2);
+
+    std::string expected = base.substr(0, DELTA_MIN_BLOCK) + "inserted"
+                           + base.substr(2 * DELTA_MIN_BLOCK);
+    std::string out;
+    ASSERT_EQ(OP_SUCCESS, apply(delta, out));
+    EXPECT_EQ(expected, out);
+    EXPECT_EQ(expected, read_all(test_dir/"data.bin"));
+
+    // The original stays readable through the open stream
+    std::string old(base_size, '\0');
+    EXPECT_EQ((ssize_t)base_size, f_stream_read_at(p_base, (uint8_t *)old.data(), base_size, 0));
+    EXPECT_EQ(base, old);
+}
+
+TEST_F(ServerDeltaTest, TestMalformedDelta)
+{
+    std::string out;
+    std::vector<uint8_t> delta;
+    put_be32(delta, DELTA_MIN_BLOCK);
+    put_copy(delta, 4, 1);
+    EXPECT_EQ(OP_FAILURE, apply(delta, out));
+
+    delta.resize(4);
+    put_data(delta, "truncated");
+    delta.pop_back();
+    EXPECT_EQ(OP_FAILURE, apply(delta, out));
+
+    delta.resize(4);
+    delta.push_back(7);
+    EXPECT_EQ(OP_FAILURE, apply(delta, out));
+
+    // Copies are bounded by the size of the base
+    delta.resize(4);
+    for (size_t i = 0; i <= DELTA_MAX_GROWTH; i++)
+    {
+        put_copy(delta, 0, 4);
+    }
+    EXPECT_EQ(OP_FAILURE, apply(delta, out));
+
+    // Nothing replaced the original
+    EXPECT_EQ(base, read_all(test_dir/"data.bin"));
+}
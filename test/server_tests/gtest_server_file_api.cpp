@@ -1,10 +1,14 @@
 #include <gtest/gtest.h>
 #include <server_file_api.h>
+#include <server_io.h>
+#include <server_xfer.h>
 #include <stdio.h>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <atomic>
+#include <thread>
+#include <vector>
 
 extern "C"
 {
@@ -204,4 +208,336 @@ TEST(TestFileApi, InSequence)
     f_destroy_path(&p_test_file);
     f_destroy_path(&p_db_dir2);
     std::filesystem::remove_all(test_dir);
-}
\ No newline at end of file
+}
+
+// Writes go through a temp file that is linked into place. Verify the
+// exclusive and replace semantics and that no temp files are left behind
+TEST(TestFileApi, AtomicWrite)
+{
+    const std::filesystem::path test_dir{"/tmp/atomic_write"};
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directory(test_dir);
+
+    uint8_t first[] = "first contents";
+    uint8_t second[] = "second";
+
+    verified_path_t * p_file = f_valid_resolve(test_dir.c_str(), "file.bin");
+    ASSERT_NE(nullptr, p_file);
+
+    // Exclusive create succeeds once and then reports the file exists
+    EXPECT_EQ(OP_SUCCESS, f_create_file(p_file, first, sizeof(first), NULL, NULL));
+    EXPECT_EQ(OP_FILE_EXISTS, f_create_file(p_file, second, sizeof(second), NULL, NULL));
+    EXPECT_EQ(sizeof(first), std::filesystem::file_size(test_dir/"file.bin"));
+
+    // Replacing swaps the whole file
+    EXPECT_EQ(OP_SUCCESS, f_write_file(p_file, second, sizeof(second), NULL));
+    EXPECT_EQ(sizeof(second), std::filesystem::file_size(test_dir/"file.bin"));
+
+    // Empty files are valid
+    verified_path_t * p_empty = f_valid_resolve(test_dir.c_str(), "empty.bin");
+    ASSERT_NE(nullptr, p_empty);
+    EXPECT_EQ(OP_SUCCESS, f_create_file(p_empty, NULL, 0, NULL, NULL));
+    EXPECT_EQ(0, std::filesystem::file_size(test_dir/"empty.bin"));
+
+    size_t entries = 0;
+    for (auto const & entry : std::filesystem::directory_iterator{test_dir})
+    {
+        (void)entry;
+        entries++;
+    }
+    EXPECT_EQ(2, entries);
+
+    f_destroy_path(&p_file);
+    f_destroy_path(&p_empty);
+    std::filesystem::remove_all(test_dir);
+}
+
+// Concurrent writers in group mode share commits and all get acknowledged
+TEST(TestFileApi, GroupCommitWrite)
+{
+    const std::filesystem::path test_dir{"/tmp/group_commit"};
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directory(test_dir);
+
+    sync_t * p_sync = sync_init(SYNC_GROUP, test_dir.c_str());
+    ASSERT_NE(nullptr, p_sync);
+    EXPECT_EQ(SYNC_GROUP, sync_get_mode(p_sync));
+
+    // A write waits for a single syncfs covering its data and its link
+    uint8_t data[64] = {0};
+    verified_path_t * p_first = f_valid_resolve(test_dir.c_str(), "first");
+    ASSERT_NE(nullptr, p_first);
+    EXPECT_EQ(OP_SUCCESS, f_create_file(p_first, data, sizeof(data), p_sync, NULL));
+    f_destroy_path(&p_first);
+    EXPECT_EQ((uint64_t)1, sync_commits(p_sync));
+
+    // and concurrent writers share the flushes
+    std::atomic_uint successes = 0;
+    std::atomic_uint ready = 0;
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 8; i++)
+    {
+        writers.emplace_back([&, i]() {
+            std::string name = "file_" + std::to_string(i);
+            verified_path_t * p_path = f_valid_resolve(test_dir.c_str(), name.c_str());
+            ready++;
+            while (ready < 8)
+            {
+                std::this_thread::yield();
+            }
+            if ((NULL != p_path)
+                && (OP_SUCCESS == f_create_file(p_path, data, sizeof(data), p_sync, NULL)))
+            {
+                successes++;
+            }
+            f_destroy_path(&p_path);
+        });
+    }
+    for (auto & writer : writers)
+    {
+        writer.join();
+    }
+    EXPECT_EQ(8, successes);
+
+    // Writers released together land in one batch, or two if one of them
+    // arrives after the batch closed
+    EXPECT_GE((uint64_t)2, sync_commits(p_sync) - 1);
+
+    sync_destroy(&p_sync);
+    EXPECT_EQ(nullptr, p_sync);
+    std::filesystem::remove_all(test_dir);
+}
+
+// Jobs handed to the I/O pool run off the calling thread and io_run only
+// returns once the job has completed
+TEST(TestFileApi, IoPoolRun)
+{
+    io_pool_t * p_pool = io_pool_init(2, 2, 1, 1);
+    ASSERT_NE(nullptr, p_pool);
+
+    struct job_state
+    {
+        std::thread::id caller;
+        std::thread::id runner;
+        std::atomic_uint runs;
+    } state;
+    state.caller = std::this_thread::get_id();
+    state.runs = 0;
+
+    auto job = [](void * p_arg) {
+        auto * p_state = (job_state *)p_arg;
+        p_state->runner = std::this_thread::get_id();
+        p_state->runs++;
+    };
+
+    std::vector<std::thread> callers;
+    for (int i = 0; i < 4; i++)
+    {
+        callers.emplace_back([&]() { io_run(p_pool, job, &state); });
+    }
+    for (auto & caller : callers)
+    {
+        caller.join();
+    }
+    EXPECT_EQ(4, state.runs);
+
+    io_run(p_pool, job, &state);
+    EXPECT_EQ(5, state.runs);
+    EXPECT_NE(state.caller, state.runner);
+
+    // Without a pool the job runs inline
+    io_run(NULL, job, &state);
+    EXPECT_EQ(6, state.runs);
+    EXPECT_EQ(state.caller, state.runner);
+
+    io_pool_destroy(&p_pool);
+    EXPECT_EQ(nullptr, p_pool);
+}
+
+// Transfers holding every bulk worker leave the interactive lane free
+TEST(TestFileApi, IoPoolLanes)
+{
+    io_pool_t * p_pool = io_pool_init(1, 1, 1, 1);
+    ASSERT_NE(nullptr, p_pool);
+
+    static std::atomic_bool release;
+    static std::atomic_uint runs;
+    release = false;
+    runs = 0;
+    auto bulk_job = [](void * p_arg) {
+        (void)p_arg;
+        while (!release)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        runs++;
+    };
+    auto short_job = [](void * p_arg) {
+        (void)p_arg;
+        runs++;
+    };
+
+    io_submit(p_pool, IO_LANE_BULK, bulk_job, NULL);
+    io_submit(p_pool, IO_LANE_BULK, bulk_job, NULL);
+    io_run(p_pool, short_job, NULL);
+    io_submit(p_pool, IO_LANE_INTERACTIVE, short_job, NULL);
+    while (runs < 2)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    sched_stats_t stats;
+    io_pool_stats(p_pool, IO_LANE_BULK, &stats);
+    EXPECT_EQ((uint64_t)0, stats.completed);
+
+    release = true;
+    io_pool_destroy(&p_pool);
+    EXPECT_EQ(4, runs);
+}
+
+// Stream a multi chunk file through the read ahead pipeline and ensure the
+// sink sees every byte in order and that aborting the sink stops the reader
+TEST(TestFileApi, PipelinedStream)
+{
+    const std::filesystem::path test_dir{"/tmp/xfer_stream"};
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directory(test_dir);
+
+    std::vector<uint8_t> data((XFER_CHUNK_SIZE * 4) + 123);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)(i * 31);
+    }
+    {
+        std::ofstream out{test_dir/"big.bin", std::ios::binary};
+        out.write((const char *)data.data(), (std::streamsize)data.size());
+    }
+
+    verified_path_t * p_path = f_path_resolve(test_dir.c_str(), "big.bin");
+    ASSERT_NE(nullptr, p_path);
+    ret_codes_t code;
+    file_content_t * p_content = f_stream_file(p_path, &code);
+    ASSERT_NE(nullptr, p_content);
+    EXPECT_EQ(data.size(), p_content->stream_size);
+    EXPECT_EQ(nullptr, p_content->p_stream);
+
+    auto collect = [](const uint8_t * p_chunk, size_t len, void * p_ctx) {
+        auto * p_out = (std::vector<uint8_t> *)p_ctx;
+        p_out->insert(p_out->end(), p_chunk, p_chunk + len);
+        return OP_SUCCESS;
+    };
+    std::vector<uint8_t> received;
+    EXPECT_EQ(OP_SUCCESS, xfer_pipeline(p_content->p_source,
+                                        p_content->stream_size,
+                                        collect, &received));
+    EXPECT_EQ(data, received);
+
+    // Streamed hash matches the one shot hash
+    hash_stream_t stream_hash;
+    ASSERT_TRUE(hash_stream_init(&stream_hash, HASH_ALG_SHA256));
+    EXPECT_EQ(OP_SUCCESS, xfer_pipeline(p_content->p_source,
+                                        p_content->stream_size,
+                                        xfer_hash_sink, &stream_hash));
+    hash_t hash;
+    hash_t expected;
+    EXPECT_TRUE(hash_stream_final(&stream_hash, &hash));
+    EXPECT_TRUE(hash_byte_array(data.data(), data.size(), &expected));
+    EXPECT_TRUE(hash_match(&expected, &hash));
+
+    auto abort_sink = [](const uint8_t *, size_t, void * p_ctx) {
+        auto * p_calls = (int *)p_ctx;
+        (*p_calls)++;
+        return OP_SOCK_CLOSED;
+    };
+    int calls = 0;
+    EXPECT_EQ(OP_SOCK_CLOSED, xfer_pipeline(p_content->p_source,
+                                            p_content->stream_size,
+                                            abort_sink, &calls));
+    EXPECT_EQ(1, calls);
+
+    // Asking for more bytes than the file holds is an I/O error
+    received.clear();
+    EXPECT_EQ(OP_IO_ERROR, xfer_pipeline(p_content->p_source,
+                                         p_content->stream_size + 1,
+                                         collect, &received));
+
+    // Tree hash read from the file matches the one computed in memory
+    hash_tree_t * p_tree = hash_tree_init(p_content->stream_size);
+    ASSERT_NE(nullptr, p_tree);
+    EXPECT_EQ(OP_SUCCESS, xfer_tree_hash(p_content->p_source, p_tree, 3));
+    EXPECT_TRUE(hash_tree_root(p_tree, &hash));
+    EXPECT_TRUE(hash_tree_bytes(data.data(), data.size(), 1, &expected));
+    EXPECT_TRUE(hash_match(&expected, &hash));
+    hash_tree_destroy(&p_tree);
+
+    f_destroy_content(&p_content);
+    f_destroy_path(&p_path);
+    std::filesystem::remove_all(test_dir);
+}
+
+TEST(TestFileApi, CompressedStream)
+{
+    const std::filesystem::path test_dir{"/tmp/xfer_compress"};
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directory(test_dir);
+
+    std::vector<uint8_t> data((XFER_CHUNK_SIZE * 2) + 99);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)((i / 7) % 13);
+    }
+    {
+        std::ofstream out{test_dir/"big.bin", std::ios::binary};
+        out.write((const char *)data.data(), (std::streamsize)data.size());
+    }
+
+    verified_path_t * p_dir = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+    ASSERT_NE(nullptr, p_dir);
+    verified_path_t * p_path = f_path_resolve(test_dir.c_str(), "big.bin");
+    ASSERT_NE(nullptr, p_path);
+    ret_codes_t code;
+    file_content_t * p_content = f_stream_file(p_path, &code);
+    ASSERT_NE(nullptr, p_content);
+
+    // The temp file never shows up in the directory
+    f_stream_t * p_frames = f_stream_temp(p_dir, &code);
+    ASSERT_NE(nullptr, p_frames);
+    EXPECT_EQ(1, std::distance(std::filesystem::directory_iterator(test_dir),
+                               std::filesystem::directory_iterator{}));
+
+    hash_stream_t stream_hash;
+    ASSERT_TRUE(hash_stream_init(&stream_hash, HASH_ALG_BLAKE3));
+    size_t frames_len = 0;
+    EXPECT_EQ(OP_SUCCESS, xfer_compress(p_content->p_source, p_content->stream_size,
+                                        CODEC_LZ4, &stream_hash, p_frames, &frames_len));
+    EXPECT_LT(frames_len, data.size() / 4);
+
+    // Hash is over the uncompressed bytes
+    hash_t hash;
+    hash_t expected;
+    EXPECT_TRUE(hash_stream_final(&stream_hash, &hash));
+    EXPECT_TRUE(hash_alg_bytes(HASH_ALG_BLAKE3, data.data(), data.size(), &expected));
+    EXPECT_TRUE(hash_match(&expected, &hash));
+
+    std::vector<uint8_t> frames(frames_len);
+    EXPECT_EQ((ssize_t)frames_len, f_stream_read_at(p_frames, frames.data(), frames_len, 0));
+    uint8_t * p_out = NULL;
+    size_t out_len = 0;
+    ASSERT_EQ(OP_SUCCESS, decompress_buffer(CODEC_LZ4, frames.data(), frames.size(),
+                                            &p_out, &out_len));
+    EXPECT_EQ(data, std::vector<uint8_t>(p_out, p_out + out_len));
+    free(p_out);
+
+    // Sizing the frames without a sink gives the length they are sent with
+    size_t sized_len = 0;
+    EXPECT_EQ(OP_SUCCESS, xfer_frames(p_content->p_source, p_content->stream_size,
+                                      CODEC_LZ4, NULL, NULL, NULL, &sized_len));
+    EXPECT_EQ(frames_len, sized_len);
+
+    f_stream_close(&p_frames);
+    EXPECT_EQ(nullptr, p_frames);
+    f_destroy_content(&p_content);
+    f_destroy_path(&p_path);
+    f_destroy_path(&p_dir);
+    std::filesystem::remove_all(test_dir);
+}
@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <server_mem.h>
+#include <chrono>
+#include <thread>
+
+TEST(ServerMemTest, TestUnlimited)
+{
+    mem_budget_t * p_mem = mem_init(0);
+    ASSERT_NE(nullptr, p_mem);
+
+    // Without a limit the bytes are only counted
+    EXPECT_TRUE(mem_reserve(p_mem, (size_t)1 << 40, 0));
+    EXPECT_TRUE(mem_reserve(p_mem, 100, 0));
+    mem_release(p_mem, (size_t)1 << 40);
+    mem_stats_t stats = {};
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)0, stats.limit);
+    EXPECT_EQ((uint64_t)100, stats.used);
+    EXPECT_EQ(((uint64_t)1 << 40) + 100, stats.high_water);
+    EXPECT_EQ((uint64_t)0, stats.refused);
+    mem_release(p_mem, 100);
+
+    // Buffers without a budget are never held back
+    EXPECT_TRUE(mem_reserve(NULL, SIZE_MAX, 0));
+    mem_release(NULL, SIZE_MAX);
+
+    mem_destroy(&p_mem);
+    EXPECT_EQ(nullptr, p_mem);
+}
+
+TEST(ServerMemTest, TestLimit)
+{
+    mem_budget_t * p_mem = mem_init(1000);
+    ASSERT_NE(nullptr, p_mem);
+
+    EXPECT_TRUE(mem_reserve(p_mem, 600, 0));
+    EXPECT_TRUE(mem_reserve(p_mem, 400, 0));
+    EXPECT_FALSE(mem_reserve(p_mem, 1, 0));
+
+    // More than the whole budget fails without waiting
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(mem_reserve(p_mem, 1001, 1000));
+    EXPECT_GT(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+
+    // A reservation that does not fit gives up after the wait
+    start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(mem_reserve(p_mem, 100, 50));
+    EXPECT_LE(std::chrono::milliseconds(50), std::chrono::steady_clock::now() - start);
+
+    mem_stats_t stats = {};
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)1000, stats.used);
+    EXPECT_EQ((uint64_t)1000, stats.high_water);
+    EXPECT_EQ((uint64_t)1, stats.waited);
+    EXPECT_EQ((uint64_t)3, stats.refused);
+
+    mem_release(p_mem, 600);
+    mem_release(p_mem, 400);
+    mem_destroy(&p_mem);
+}
+
+TEST(ServerMemTest, TestWait)
+{
+    mem_budget_t * p_mem = mem_init(1000);
+    ASSERT_NE(nullptr, p_mem);
+    ASSERT_TRUE(mem_reserve(p_mem, 800, 0));
+
+    // Bytes given back wake the reservation waiting for them
+    std::thread releaser([p_mem]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mem_release(p_mem, 800);
+    });
+    EXPECT_TRUE(mem_reserve(p_mem, 500, 5000));
+    releaser.join();
+
+    mem_stats_t stats = {};
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)500, stats.used);
+    EXPECT_EQ((uint64_t)800, stats.high_water);
+    EXPECT_EQ((uint64_t)1, stats.waited);
+    EXPECT_EQ((uint64_t)0, stats.refused);
+
+    mem_release(p_mem, 500);
+    mem_destroy(&p_mem);
+}
@@ -0,0 +1,217 @@
+#include <gtest/gtest.h>
+#include <server_sched.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+static std::atomic<size_t> g_ran{0};
+
+static void count_job(void * p_arg)
+{
+    (void)p_arg;
+    g_ran++;
+}
+
+// Queues two children until the depth runs out, 2^depth - 1 jobs in total
+typedef struct
+{
+    sched_t *   p_sched;
+    int         depth;
+} tree_job_t;
+
+static void tree_job(void * p_arg)
+{
+    tree_job_t * p_job = (tree_job_t *)p_arg;
+    g_ran++;
+    if (p_job->depth > 1)
+    {
+        for (int child = 0; child < 2; child++)
+        {
+            tree_job_t * p_child = new tree_job_t{p_job->p_sched, p_job->depth - 1};
+            ASSERT_EQ(OP_SUCCESS, sched_submit(p_job->p_sched, tree_job, p_child));
+        }
+    }
+    delete p_job;
+}
+
+static std::mutex g_threads_lock;
+static std::set<std::thread::id> g_threads;
+
+static void slow_job(void * p_arg)
+{
+    (void)p_arg;
+    {
+        std::lock_guard<std::mutex> guard(g_threads_lock);
+        g_threads.insert(std::this_thread::get_id());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    g_ran++;
+}
+
+// Waits in a system call until the flag is raised
+static void blocked_job(void * p_arg)
+{
+    std::atomic<bool> * p_release = (std::atomic<bool> *)p_arg;
+    sched_block_begin();
+    while (!p_release->load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    sched_block_end();
+    g_ran++;
+}
+
+// Queues the slow jobs from a worker so they start in its own deque
+static void spawn_job(void * p_arg)
+{
+    for (int idx = 0; idx < 64; idx++)
+    {
+        ASSERT_EQ(OP_SUCCESS, sched_submit((sched_t *)p_arg, slow_job, NULL));
+    }
+}
+
+class ServerSchedTest : public ::testing::Test
+{
+protected:
+    sched_t * p_sched = NULL;
+
+    void SetUp() override
+    {
+        g_ran = 0;
+        p_sched = sched_init(4, 4);
+        ASSERT_NE(nullptr, p_sched);
+        EXPECT_EQ(4, sched_workers(p_sched));
+    }
+
+    void TearDown() override
+    {
+        sched_destroy(&p_sched);
+        EXPECT_EQ(nullptr, p_sched);
+    }
+};
+
+TEST_F(ServerSchedTest, TestWorkers)
+{
+    EXPECT_EQ(nullptr, sched_init(0, 4));
+    EXPECT_EQ(nullptr, sched_init(4, 2));
+    EXPECT_EQ(nullptr, sched_init(1, SCHED_MAX_WORKERS + 1));
+    EXPECT_EQ(OP_FAILURE, sched_submit(NULL, count_job, NULL));
+    EXPECT_EQ(OP_FAILURE, sched_submit(p_sched, NULL, NULL));
+}
+
+TEST_F(ServerSchedTest, TestInjected)
+{
+    // Jobs queued from several threads outside the scheduler all run
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < 4; producer++)
+    {
+        producers.emplace_back([this]() {
+            for (int idx = 0; idx < 5000; idx++)
+            {
+                ASSERT_EQ(OP_SUCCESS, sched_submit(p_sched, count_job, NULL));
+            }
+        });
+    }
+    for (std::thread & producer : producers)
+    {
+        producer.join();
+    }
+    sched_wait(p_sched);
+    EXPECT_EQ((size_t)20000, g_ran.load());
+
+    // The scheduler is reused once idle
+    ASSERT_EQ(OP_SUCCESS, sched_submit(p_sched, count_job, NULL));
+    sched_wait(p_sched);
+    EXPECT_EQ((size_t)20001, g_ran.load());
+}
+
+TEST_F(ServerSchedTest, TestNested)
+{
+    // Waiting covers the jobs queued by jobs, including deques that overflow
+    // into the injection queue
+    ASSERT_EQ(OP_SUCCESS, sched_submit(p_sched, tree_job, new tree_job_t{p_sched, 14}));
+    sched_wait(p_sched);
+    EXPECT_EQ((size_t)(1 << 14) - 1, g_ran.load());
+}
+
+TEST_F(ServerSchedTest, TestSteal)
+{
+    // Jobs queued on one worker are stolen by the idle ones
+    g_threads.clear();
+    ASSERT_EQ(OP_SUCCESS, sched_submit(p_sched, spawn_job, p_sched));
+    sched_wait(p_sched);
+    EXPECT_EQ((size_t)64, g_ran.load());
+    EXPECT_LT((size_t)1, g_threads.size());
+}
+
+TEST_F(ServerSchedTest, TestStats)
+{
+    for (int idx = 0; idx < 100; idx++)
+    {
+        ASSERT_EQ(OP_SUCCESS, sched_submit(p_sched, count_job, NULL));
+    }
+    sched_wait(p_sched);
+
+    sched_stats_t stats;
+    sched_stats(p_sched, &stats);
+    EXPECT_EQ(4, stats.workers);
+    EXPECT_EQ(0, stats.blocked);
+    EXPECT_EQ((size_t)0, stats.queued);
+    EXPECT_EQ((uint64_t)100, stats.completed);
+}
+
+// Waits up to 10s for the scheduler to reach a size
+static bool wait_for_workers(sched_t * p_sched, bool (* p_done)(uint16_t))
+{
+    for (int tries = 0; tries < 1000; tries++)
+    {
+        if (p_done(sched_workers(p_sched)))
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+TEST(ServerSchedAdaptiveTest, TestGrowShrink)
+{
+    g_ran = 0;
+    sched_t * p_adaptive = sched_init(1, 8);
+    ASSERT_NE(nullptr, p_adaptive);
+    EXPECT_EQ(1, sched_workers(p_adaptive));
+
+    // Jobs queue up behind a worker blocked in a system call, the pool
+    // grows to run them
+    std::atomic<bool> release{false};
+    for (int idx = 0; idx < 8; idx++)
+    {
+        ASSERT_EQ(OP_SUCCESS, sched_submit(p_adaptive, blocked_job, &release));
+    }
+    EXPECT_TRUE(wait_for_workers(p_adaptive, [](uint16_t workers) { return workers > 1; }));
+
+    sched_stats_t stats;
+    sched_stats(p_adaptive, &stats);
+    EXPECT_LE(1, stats.blocked);
+    EXPECT_GE((size_t)8, stats.queued);
+
+    // Once idle the pool goes back to its minimum
+    release = true;
+    sched_wait(p_adaptive);
+    EXPECT_EQ((size_t)8, g_ran.load());
+    EXPECT_TRUE(wait_for_workers(p_adaptive, [](uint16_t workers) { return 1 == workers; }));
+
+    // The workers retired are taken back when the jobs block again
+    release = false;
+    for (int idx = 0; idx < 8; idx++)
+    {
+        ASSERT_EQ(OP_SUCCESS, sched_submit(p_adaptive, blocked_job, &release));
+    }
+    EXPECT_TRUE(wait_for_workers(p_adaptive, [](uint16_t workers) { return workers > 1; }));
+    release = true;
+    sched_wait(p_adaptive);
+    EXPECT_EQ((size_t)16, g_ran.load());
+    sched_destroy(&p_adaptive);
+}
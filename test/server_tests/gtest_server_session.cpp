@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <server_session.h>
+#include <pthread.h>
+#include <sched.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+class ServerSessionTest : public ::testing::Test
+{
+protected:
+    sessions_t * p_sessions = NULL;
+
+    void SetUp() override
+    {
+        p_sessions = sessions_init(4);
+        ASSERT_NE(nullptr, p_sessions);
+    }
+
+    void TearDown() override
+    {
+        sessions_destroy(&p_sessions);
+        EXPECT_EQ(nullptr, p_sessions);
+    }
+};
+
+TEST_F(ServerSessionTest, TestLifetime)
+{
+    uint32_t session = 0;
+    ASSERT_EQ(OP_SUCCESS, sessions_create(p_sessions, &session));
+    EXPECT_NE((uint32_t)0, session);
+    EXPECT_EQ(OP_SUCCESS, sessions_renew(p_sessions, session, 10));
+
+    // Unknown sessions and expired sessions are refused, an expired
+    // session is removed
+    EXPECT_EQ(OP_SESSION_ERROR, sessions_renew(p_sessions, session + 1, 10));
+    EXPECT_EQ(OP_SESSION_ERROR, sessions_renew(p_sessions, session, -1));
+    EXPECT_EQ(OP_SESSION_ERROR, sessions_renew(p_sessions, session, 10));
+
+    ASSERT_EQ(OP_SUCCESS, sessions_create(p_sessions, &session));
+    sessions_expire(p_sessions, session);
+    EXPECT_EQ(OP_SESSION_ERROR, sessions_renew(p_sessions, session, 10));
+}
+
+TEST_F(ServerSessionTest, TestShards)
+{
+    // Sessions are created in the shard of the CPU the thread runs on
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpus), &cpus));
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &cpus))
+        {
+            continue;
+        }
+        std::thread pinned([this, cpu]() {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            ASSERT_EQ(0, pthread_setaffinity_np(pthread_self(), sizeof(one), &one));
+            for (int idx = 0; idx < 16; idx++)
+            {
+                uint32_t session = 0;
+                ASSERT_EQ(OP_SUCCESS, sessions_create(p_sessions, &session));
+                EXPECT_EQ((uint32_t)cpu % 4, sessions_shard(p_sessions, session));
+            }
+        });
+        pinned.join();
+    }
+
+    // 0 asks for a shard per CPU
+    sessions_t * p_per_cpu = sessions_init(0);
+    ASSERT_NE(nullptr, p_per_cpu);
+    EXPECT_LE((uint32_t)CPU_COUNT(&cpus), sessions_shard_count(p_per_cpu));
+    sessions_destroy(&p_per_cpu);
+}
+
+TEST_F(ServerSessionTest, TestConcurrent)
+{
+    // Threads creating and renewing sessions at once all get distinct IDs
+    std::vector<std::vector<uint32_t>> created(8);
+    std::vector<std::thread> threads;
+    for (size_t thread = 0; thread < created.size(); thread++)
+    {
+        threads.emplace_back([this, &created, thread]() {
+            for (int idx = 0; idx < 256; idx++)
+            {
+                uint32_t session = 0;
+                ASSERT_EQ(OP_SUCCESS, sessions_create(p_sessions, &session));
+                ASSERT_EQ(OP_SUCCESS, sessions_renew(p_sessions, session, 10));
+                created[thread].push_back(session);
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+    {
+        thread.join();
+    }
+
+    std::set<uint32_t> unique;
+    for (const std::vector<uint32_t> & sessions : created)
+    {
+        unique.insert(sessions.begin(), sessions.end());
+    }
+    EXPECT_EQ((size_t)8 * 256, unique.size());
+}
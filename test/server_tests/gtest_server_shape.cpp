@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <server_shape.h>
+#include <chrono>
+
+// Milliseconds the flow waits to take the bytes
+static long long take_ms(shape_flow_t * p_flow, size_t bytes)
+{
+    auto start = std::chrono::steady_clock::now();
+    shape_flow_take(p_flow, bytes);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+static user_account_t make_user(const char * p_username, perms_t permission, uint64_t rate)
+{
+    user_account_t user = {};
+    user.p_username = (char *)p_username;
+    user.permission = permission;
+    user.rate       = rate;
+    return user;
+}
+
+TEST(ServerShapeTest, TestUnlimited)
+{
+    shape_limits_t limits = {};
+    shaper_t * p_shaper = shape_init(&limits);
+    ASSERT_NE(nullptr, p_shaper);
+    shape_flow_t * p_flow = shape_flow_init(p_shaper);
+    ASSERT_NE(nullptr, p_flow);
+
+    // Users without a rate of their own or of their permission have no bucket
+    user_account_t user = make_user("unlimited", READ, 0);
+    EXPECT_EQ(nullptr, shape_user(p_shaper, &user));
+    EXPECT_FALSE(shape_flow_limited(p_flow));
+    EXPECT_GT(50, take_ms(p_flow, (size_t)1 << 30));
+
+    // NULL flows are never shaped
+    EXPECT_FALSE(shape_flow_limited(NULL));
+    shape_flow_take(NULL, 1024);
+
+    shape_flow_destroy(&p_flow);
+    EXPECT_EQ(nullptr, p_flow);
+    shape_destroy(&p_shaper);
+    EXPECT_EQ(nullptr, p_shaper);
+    EXPECT_EQ(nullptr, shape_init(NULL));
+}
+
+TEST(ServerShapeTest, TestConnection)
+{
+    // A full bucket lets SHAPE_BURST_MS worth of bytes through, the next
+    // bytes wait for the bucket to refill
+    shape_limits_t limits = {};
+    limits.connection = 1 << 20;
+    shaper_t * p_shaper = shape_init(&limits);
+    ASSERT_NE(nullptr, p_shaper);
+    shape_flow_t * p_flow = shape_flow_init(p_shaper);
+    ASSERT_NE(nullptr, p_flow);
+    EXPECT_TRUE(shape_flow_limited(p_flow));
+
+    EXPECT_GT(100, take_ms(p_flow, 256 << 10));
+    long long waited = take_ms(p_flow, 256 << 10);
+    EXPECT_LE(200, waited);
+    EXPECT_GT(1000, waited);
+
+    // Connections do not share their bucket
+    shape_flow_t * p_other = shape_flow_init(p_shaper);
+    ASSERT_NE(nullptr, p_other);
+    EXPECT_GT(100, take_ms(p_other, 256 << 10));
+
+    shape_flow_destroy(&p_other);
+    shape_flow_destroy(&p_flow);
+    shape_destroy(&p_shaper);
+}
+
+TEST(ServerShapeTest, TestUsers)
+{
+    shape_limits_t limits = {};
+    limits.levels[READ] = 1 << 20;
+    shaper_t * p_shaper = shape_init(&limits);
+    ASSERT_NE(nullptr, p_shaper);
+
+    // A user gets the limit of its permission unless it has a rate of its own
+    user_account_t reader = make_user("reader", READ, 0);
+    user_account_t writer = make_user("writer", READ_WRITE, 0);
+    user_account_t fast = make_user("fast", READ, (uint64_t)64 << 20);
+    shape_bucket_t * p_reader = shape_user(p_shaper, &reader);
+    ASSERT_NE(nullptr, p_reader);
+    EXPECT_EQ(p_reader, shape_user(p_shaper, &reader));
+    EXPECT_EQ(nullptr, shape_user(p_shaper, &writer));
+    EXPECT_NE(nullptr, shape_user(p_shaper, &fast));
+
+    // The connections of a user share its bucket
+    shape_flow_t * p_first = shape_flow_init(p_shaper);
+    shape_flow_t * p_second = shape_flow_init(p_shaper);
+    ASSERT_NE(nullptr, p_first);
+    ASSERT_NE(nullptr, p_second);
+    EXPECT_FALSE(shape_flow_limited(p_first));
+    shape_flow_user(p_first, p_reader);
+    shape_flow_user(p_second, shape_user(p_shaper, &reader));
+    EXPECT_TRUE(shape_flow_limited(p_first));
+
+    EXPECT_GT(100, take_ms(p_first, 256 << 10));
+    EXPECT_LE(200, take_ms(p_second, 256 << 10));
+
+    // Lifting the limit of the user frees its connections at once
+    reader.rate = SHAPE_MAX_RATE;
+    EXPECT_EQ(p_reader, shape_user(p_shaper, &reader));
+    EXPECT_GT(100, take_ms(p_first, 1 << 20));
+
+    shape_flow_destroy(&p_second);
+    shape_flow_destroy(&p_first);
+    shape_destroy(&p_shaper);
+}
+
+TEST(ServerShapeTest, TestServer)
+{
+    // The server bucket holds every connection back once it is in debt
+    shape_limits_t limits = {};
+    limits.server = 1 << 20;
+    limits.connection = 64 << 20;
+    shaper_t * p_shaper = shape_init(&limits);
+    ASSERT_NE(nullptr, p_shaper);
+    shape_flow_t * p_first = shape_flow_init(p_shaper);
+    shape_flow_t * p_second = shape_flow_init(p_shaper);
+    ASSERT_NE(nullptr, p_first);
+    ASSERT_NE(nullptr, p_second);
+
+    EXPECT_GT(100, take_ms(p_first, 256 << 10));
+    EXPECT_LE(200, take_ms(p_second, 256 << 10));
+
+    shape_flow_destroy(&p_second);
+    shape_flow_destroy(&p_first);
+    shape_destroy(&p_shaper);
+}
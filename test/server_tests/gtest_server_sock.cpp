@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <endian.h>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include <server_sock.h>
+
+static const std::filesystem::path test_dir{"/tmp/SockFrames"};
+static const std::filesystem::path big_file{test_dir/"big.bin"};
+static const uint16_t test_port     = 31451;
+static const size_t big_size        = 8 << 20;
+static const uint64_t conn_rate     = 4 << 20;
+
+/*
+ * Serves a home directory holding a multi-MiB file on a shaped connection so
+ * a GET of the file streams for a couple of seconds
+ */
+class SockFrames : public ::testing::Test
+{
+ protected:
+    db_t *      p_db = nullptr;
+    int         client_fd = -1;
+    std::thread server;
+
+    void SetUp() override
+    {
+        std::filesystem::remove_all(test_dir);
+        std::filesystem::create_directory(test_dir);
+
+        std::ofstream output(big_file, std::ios::binary);
+        for (size_t idx = 0; idx < big_size; idx++)
+        {
+            output.put((char)(idx * 31 + (idx >> 16)));
+        }
+        output.close();
+
+        verified_path_t * p_home_dir = f_set_home_dir(test_dir.c_str(), test_dir.string().size());
+        ASSERT_NE(p_home_dir, nullptr);
+        p_db = db_init(p_home_dir, SYNC_NONE);
+        ASSERT_NE(p_db, nullptr);
+
+        shape_limits_t limits = {};
+        limits.connection = conn_rate;
+        p_db->p_shaper = shape_init(&limits);
+        p_db->p_io = io_pool_init(2, 4, 1, 2);
+        p_db->p_mem = mem_init(256 << 20);
+        p_db->p_spill = mem_init(256 << 20);
+        ASSERT_NE(p_db->p_shaper, nullptr);
+        ASSERT_NE(p_db->p_io, nullptr);
+
+        server = std::thread(start_server, p_db, test_port, 10, 2, 4, 1, false);
+
+        // The acceptor may take a moment to listen
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(test_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (int attempt = 0; attempt < 100; attempt++)
+        {
+            client_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (0 == connect(client_fd, (sockaddr *)&addr, sizeof(addr)))
+            {
+                break;
+            }
+            close(client_fd);
+            client_fd = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        ASSERT_NE(client_fd, -1);
+    }
+
+    void TearDown() override
+    {
+        if (-1 != client_fd)
+        {
+            close(client_fd);
+        }
+        if (server.joinable())
+        {
+            stop_server();
+            server.join();
+        }
+        if (nullptr != p_db)
+        {
+            mem_destroy(&p_db->p_spill);
+            mem_destroy(&p_db->p_mem);
+            io_pool_destroy(&p_db->p_io);
+            shape_destroy(&p_db->p_shaper);
+            db_shutdown(&p_db);
+        }
+        std::filesystem::remove_all(test_dir);
+    }
+
+    // v2 GET of path with the default admin account
+    void send_get(uint32_t request_id, const std::string & path)
+    {
+        const std::string user{"admin"};
+        const std::string passwd{"password"};
+        std::vector<uint8_t> pkt(WIRE_V2_HEADER_LEN);
+        wire_v2_header_t header = {};
+        header.version = WIRE_VERSION_2;
+        header.opt_code = ACT_GET_REMOTE_FILE;
+        header.request_id = htonl(request_id);
+        header.username_len = htons((uint16_t)user.size());
+        header.passwd_len = htons((uint16_t)passwd.size());
+        header.payload_len = htobe64(user.size() + passwd.size() + 2 + path.size());
+        memcpy(pkt.data(), &header, sizeof(header));
+        pkt.insert(pkt.end(), user.begin(), user.end());
+        pkt.insert(pkt.end(), passwd.begin(), passwd.end());
+        uint16_t path_len = htons((uint16_t)path.size());
+        pkt.insert(pkt.end(), (uint8_t *)&path_len, (uint8_t *)&path_len + 2);
+        pkt.insert(pkt.end(), path.begin(), path.end());
+        ASSERT_EQ(write(client_fd, pkt.data(), pkt.size()), (ssize_t)pkt.size());
+    }
+
+    void read_full(void * p_buf, size_t len)
+    {
+        size_t done = 0;
+        while (done < len)
+        {
+            ssize_t got = read(client_fd, (uint8_t *)p_buf + done, len - done);
+            ASSERT_GT(got, 0);
+            done += (size_t)got;
+        }
+    }
+};
+
+// The response of a small request is written between the frames of a GET
+// that is still streaming instead of waiting for all of its data
+TEST_F(SockFrames, TestSmallResponseBetweenFrames)
+{
+    send_get(1, "big.bin");
+
+    std::vector<uint8_t> data;
+    size_t data_len = 0;
+    size_t data_at_small = 0;
+    bool b_big_header = false;
+    bool b_small = false;
+    bool b_sent_small = false;
+    while (!b_big_header || !b_small || (data.size() < data_len))
+    {
+        uint8_t version = 0;
+        read_full(&version, 1);
+        if (WIRE_V2_DATA == version)
+        {
+            wire_v2_frame_t frame = {};
+            frame.version = version;
+            read_full((uint8_t *)&frame + 1, sizeof(frame) - 1);
+            ASSERT_EQ(ntohl(frame.request_id), 1u);
+            uint32_t frame_len = ntohl(frame.frame_len);
+            ASSERT_GT(frame_len, 0u);
+            ASSERT_LE(frame_len, (uint32_t)WIRE_V2_FRAME_SIZE);
+            size_t offset = data.size();
+            data.resize(offset + frame_len);
+            read_full(data.data() + offset, frame_len);
+
+            // The big GET is streaming, the small request is sent now
+            if (!b_sent_small)
+            {
+                b_sent_small = true;
+                send_get(2, "missing.bin");
+            }
+            continue;
+        }
+
+        ASSERT_EQ(version, WIRE_VERSION_2);
+        wire_v2_response_t header = {};
+        header.version = version;
+        read_full((uint8_t *)&header + 1, sizeof(header) - 1);
+        std::vector<uint8_t> msg(header.msg_len);
+        read_full(msg.data(), msg.size());
+        uint64_t payload_len = be64toh(header.payload_len);
+        if (1 == ntohl(header.request_id))
+        {
+            ASSERT_EQ(header.result, OP_SUCCESS);
+            uint8_t hash[SHA256_DIGEST_LENGTH];
+            read_full(hash, sizeof(hash));
+            data_len = payload_len - header.msg_len - sizeof(hash);
+            b_big_header = true;
+        }
+        else
+        {
+            ASSERT_EQ(ntohl(header.request_id), 2u);
+            ASSERT_NE(header.result, OP_SUCCESS);
+            ASSERT_EQ(payload_len, header.msg_len);
+            data_at_small = data.size();
+            b_small = true;
+        }
+    }
+
+    // The small response arrived while most of the file was still to come
+    ASSERT_EQ(data_len, big_size);
+    EXPECT_LT(data_at_small, big_size / 2);
+
+    std::ifstream input(big_file, std::ios::binary);
+    std::vector<uint8_t> expected((std::istreambuf_iterator<char>(input)),
+                                  std::istreambuf_iterator<char>());
+    EXPECT_TRUE(expected == data);
+}
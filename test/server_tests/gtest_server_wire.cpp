@@ -0,0 +1,413 @@
+#include <gtest/gtest.h>
+#include <server_wire.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void put_u16(std::vector<uint8_t> & bytes, uint16_t value)
+{
+    value = htons(value);
+    const uint8_t * p_bytes = (const uint8_t *)&value;
+    bytes.insert(bytes.end(), p_bytes, p_bytes + sizeof(value));
+}
+
+static void put_bytes(std::vector<uint8_t> & bytes, const std::string & value)
+{
+    bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+// Request as the client builds it
+static std::vector<uint8_t> make_request(uint8_t opcode,
+                                         uint32_t session_id,
+                                         const std::string & path,
+                                         const std::string & data)
+{
+    std::vector<uint8_t> bytes{opcode, 0};
+    put_u16(bytes, 0x0102);
+    put_u16(bytes, 5);
+    put_u16(bytes, 8);
+    uint32_t session = htonl(session_id);
+    bytes.insert(bytes.end(), (uint8_t *)&session, (uint8_t *)&session + 4);
+    put_bytes(bytes, "admin");
+    put_bytes(bytes, "password");
+
+    uint64_t payload_len = H_PATH_LEN + path.size();
+    if (!data.empty())
+    {
+        payload_len += H_HASH_LEN + data.size();
+    }
+    payload_len = htonll(payload_len);
+    bytes.insert(bytes.end(), (uint8_t *)&payload_len, (uint8_t *)&payload_len + 8);
+    put_u16(bytes, (uint16_t)path.size());
+    put_bytes(bytes, path);
+    if (!data.empty())
+    {
+        bytes.insert(bytes.end(), H_HASH_LEN, 0xab);
+        put_bytes(bytes, data);
+    }
+    return bytes;
+}
+
+// v2 request with the credentials after the aligned header
+static std::vector<uint8_t> make_v2_request(uint8_t opcode,
+                                            uint32_t request_id,
+                                            const std::string & path,
+                                            const std::string & data)
+{
+    std::vector<uint8_t> payload;
+    put_bytes(payload, "admin");
+    put_bytes(payload, "password");
+    put_u16(payload, (uint16_t)path.size());
+    put_bytes(payload, path);
+    if (!data.empty())
+    {
+        payload.insert(payload.end(), H_HASH_LEN, 0xcd);
+        put_bytes(payload, data);
+    }
+
+    wire_v2_header_t header = {};
+    header.version      = WIRE_VERSION_2;
+    header.opt_code     = opcode;
+    header.flags        = htons(0x0002);
+    header.request_id   = htonl(request_id);
+    header.session_id   = htonl(9);
+    header.username_len = htons(5);
+    header.passwd_len   = htons(8);
+    header.payload_len  = htonll(payload.size());
+
+    std::vector<uint8_t> bytes((uint8_t *)&header, (uint8_t *)&header + sizeof(header));
+    bytes.insert(bytes.end(), payload.begin(), payload.end());
+    return bytes;
+}
+
+class ServerWireTest : public ::testing::Test
+{
+protected:
+    int fds[2] = {-1, -1};
+    wire_reader_t reader;
+    arena_t * p_arena = NULL;
+
+    void SetUp() override
+    {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        wire_reader_init(&reader, fds[0], NULL, NULL);
+        p_arena = arena_init(0, NULL);
+        ASSERT_NE(nullptr, p_arena);
+    }
+
+    void TearDown() override
+    {
+        arena_destroy(&p_arena);
+        close(fds[0]);
+        if (-1 != fds[1])
+        {
+            close(fds[1]);
+        }
+    }
+
+    // Writes from another thread so requests larger than the socket buffer
+    // do not block the test
+    void send_all(const std::vector<uint8_t> & bytes)
+    {
+        std::thread writer([this, bytes]() {
+            size_t sent = 0;
+            while (sent < bytes.size())
+            {
+                ssize_t written = write(fds[1], bytes.data() + sent, bytes.size() - sent);
+                ASSERT_GT(written, 0);
+                sent += (size_t)written;
+            }
+        });
+        writer.detach();
+    }
+
+    bool in_buffer(const void * p_view)
+    {
+        const uint8_t * p_bytes = (const uint8_t *)p_view;
+        return (p_bytes >= reader.buffer) && (p_bytes < reader.buffer + sizeof(reader.buffer));
+    }
+};
+
+TEST_F(ServerWireTest, TestParse)
+{
+    // Two requests sent at once are read one after the other
+    std::vector<uint8_t> bytes = make_request(ACT_PUT_REMOTE_FILE, 7, "dir/file.txt", "data");
+    std::vector<uint8_t> second = make_request(ACT_GET_REMOTE_FILE, 8, "other.txt", "");
+    bytes.insert(bytes.end(), second.begin(), second.end());
+    send_all(bytes);
+
+    wire_payload_t wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    EXPECT_EQ(ACT_PUT_REMOTE_FILE, wire.opt_code);
+    EXPECT_EQ(0x0102, wire.flags);
+    EXPECT_EQ((uint32_t)7, wire.session_id);
+    EXPECT_STREQ("admin", wire.p_username);
+    EXPECT_STREQ("password", wire.p_passwd);
+    ASSERT_EQ(STD_PAYLOAD, wire.type);
+    std_payload_t * p_std = wire.p_std_payload;
+    EXPECT_STREQ("dir/file.txt", p_std->p_path);
+    ASSERT_EQ((uint64_t)4, p_std->byte_stream_len);
+    EXPECT_EQ(0, memcmp("data", p_std->p_byte_stream, 4));
+    EXPECT_EQ(0xab, p_std->p_hash_stream[H_HASH_LEN - 1]);
+
+    // The hash and the data are not copied out of the receive buffer
+    EXPECT_TRUE(in_buffer(p_std->p_hash_stream));
+    EXPECT_TRUE(in_buffer(p_std->p_byte_stream));
+
+    arena_reset(p_arena);
+    wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    EXPECT_EQ(ACT_GET_REMOTE_FILE, wire.opt_code);
+    EXPECT_EQ((uint32_t)8, wire.session_id);
+    EXPECT_STREQ("other.txt", wire.p_std_payload->p_path);
+    EXPECT_EQ(nullptr, wire.p_std_payload->p_hash_stream);
+
+    // The client closing the connection ends the requests
+    close(fds[1]);
+    fds[1] = -1;
+    wire = {};
+    EXPECT_EQ(OP_SOCK_CLOSED, wire_read_request(&reader, p_arena, &wire));
+}
+
+TEST_F(ServerWireTest, TestLarge)
+{
+    // Data larger than the receive buffer is read into the arena
+    std::string data(WIRE_RECV_SIZE * 3 + 5, 'x');
+    data.back() = 'y';
+    send_all(make_request(ACT_PUT_REMOTE_FILE, 1, "big.bin", data));
+
+    wire_payload_t wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    std_payload_t * p_std = wire.p_std_payload;
+    ASSERT_EQ(data.size(), p_std->byte_stream_len);
+    EXPECT_FALSE(in_buffer(p_std->p_byte_stream));
+    EXPECT_EQ(data, std::string((char *)p_std->p_byte_stream, data.size()));
+    EXPECT_STREQ("big.bin", p_std->p_path);
+
+    // A request cut short is reported as a closed connection
+    std::vector<uint8_t> bytes = make_request(ACT_PUT_REMOTE_FILE, 1, "cut.bin", "data");
+    bytes.resize(bytes.size() - 2);
+    send_all(bytes);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    shutdown(fds[1], SHUT_WR);
+    arena_reset(p_arena);
+    wire = {};
+    EXPECT_EQ(OP_SOCK_CLOSED, wire_read_request(&reader, p_arena, &wire));
+}
+
+TEST_F(ServerWireTest, TestVersion2)
+{
+    // Both versions are told apart by the first byte of each request
+    std::vector<uint8_t> bytes = make_v2_request(ACT_PUT_REMOTE_FILE, 0xdeadbeef, "v2.txt", "data");
+    std::vector<uint8_t> second = make_request(ACT_GET_REMOTE_FILE, 3, "v1.txt", "");
+    bytes.insert(bytes.end(), second.begin(), second.end());
+    send_all(bytes);
+
+    wire_payload_t wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    EXPECT_EQ(WIRE_VERSION_2, wire.version);
+    EXPECT_EQ(0xdeadbeef, wire.request_id);
+    EXPECT_EQ(ACT_PUT_REMOTE_FILE, wire.opt_code);
+    EXPECT_EQ(0x0002, wire.flags);
+    EXPECT_EQ((uint32_t)9, wire.session_id);
+    EXPECT_STREQ("admin", wire.p_username);
+    EXPECT_STREQ("password", wire.p_passwd);
+    ASSERT_EQ(STD_PAYLOAD, wire.type);
+    std_payload_t * p_std = wire.p_std_payload;
+    EXPECT_STREQ("v2.txt", p_std->p_path);
+    ASSERT_EQ((uint64_t)4, p_std->byte_stream_len);
+    EXPECT_TRUE(in_buffer(p_std->p_byte_stream));
+
+    // Detached requests no longer point into the receive buffer
+    ASSERT_EQ(OP_SUCCESS, wire_detach(&reader, p_arena, &wire));
+    EXPECT_FALSE(in_buffer(p_std->p_hash_stream));
+    EXPECT_FALSE(in_buffer(p_std->p_byte_stream));
+    EXPECT_EQ(0xcd, p_std->p_hash_stream[H_HASH_LEN - 1]);
+    EXPECT_EQ(0, memcmp("data", p_std->p_byte_stream, 4));
+
+    wire_payload_t next = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &next));
+    EXPECT_EQ(WIRE_VERSION_1, next.version);
+    EXPECT_EQ((uint32_t)0, next.request_id);
+    EXPECT_STREQ("v1.txt", next.p_std_payload->p_path);
+
+    // The first request is unchanged by reading the next one
+    EXPECT_EQ(0, memcmp("data", p_std->p_byte_stream, 4));
+
+    // Unknown versions are refused
+    std::vector<uint8_t> unknown = make_v2_request(ACT_GET_REMOTE_FILE, 1, "x", "");
+    unknown[0] = WIRE_VERSION_FLAG | 7;
+    send_all(unknown);
+    wire_payload_t bad = {};
+    EXPECT_EQ(OP_FAILURE, wire_read_request(&reader, p_arena, &bad));
+}
+
+TEST_F(ServerWireTest, TestAdmission)
+{
+    // A single request may be in flight, the next one is turned away
+    admit_limits_t limits = {};
+    limits.requests = 1;
+    admit_t * p_admit = admit_init(&limits, NULL);
+    ASSERT_NE(nullptr, p_admit);
+    wire_reader_init(&reader, fds[0], NULL, p_admit);
+
+    std::vector<uint8_t> bytes = make_request(ACT_PUT_REMOTE_FILE, 1, "first.txt", "data");
+    std::vector<uint8_t> busy = make_v2_request(ACT_PUT_REMOTE_FILE, 2, "busy.bin",
+                                                std::string(WIRE_RECV_SIZE * 2, 'z'));
+    std::vector<uint8_t> last = make_request(ACT_GET_REMOTE_FILE, 3, "last.txt", "");
+    bytes.insert(bytes.end(), busy.begin(), busy.end());
+    bytes.insert(bytes.end(), last.begin(), last.end());
+    send_all(bytes);
+
+    wire_payload_t first = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &first));
+    EXPECT_STREQ("first.txt", first.p_std_payload->p_path);
+
+    // Only the header of a request turned away is read, its payload is
+    // dropped and the client is told when to retry
+    wire_payload_t shed = {};
+    ASSERT_EQ(OP_SERVER_BUSY, wire_read_request(&reader, p_arena, &shed));
+    EXPECT_EQ((uint32_t)2, shed.request_id);
+    EXPECT_EQ(NO_PAYLOAD, shed.type);
+    EXPECT_EQ((uint32_t)(2 * ADMIT_RETRY_MS), shed.retry_ms);
+
+    // The connection is still in step once the first request is answered
+    admit_leave(p_admit, first.payload_len);
+    wire_payload_t next = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &next));
+    EXPECT_EQ((uint32_t)3, next.session_id);
+    EXPECT_STREQ("last.txt", next.p_std_payload->p_path);
+
+    admit_stats_t stats = {};
+    admit_stats(p_admit, &stats);
+    EXPECT_EQ((size_t)1, stats.requests);
+    EXPECT_EQ((uint64_t)2, stats.admitted);
+    EXPECT_EQ((uint64_t)1, stats.shed);
+    admit_destroy(&p_admit);
+}
+
+TEST_F(ServerWireTest, TestBounds)
+{
+    // Bytes after the last field of a payload are dropped with it
+    std::vector<uint8_t> bytes = make_v2_request(ACT_GET_REMOTE_FILE, 1, "trail.txt", "");
+    bytes.insert(bytes.end(), 5, 0xee);
+    wire_v2_header_t header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    header.payload_len = htonll(ntohll(header.payload_len) + 5);
+    memcpy(bytes.data(), &header, sizeof(header));
+    std::vector<uint8_t> next = make_request(ACT_GET_REMOTE_FILE, 4, "next.txt", "");
+    bytes.insert(bytes.end(), next.begin(), next.end());
+    send_all(bytes);
+
+    wire_payload_t wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    EXPECT_STREQ("trail.txt", wire.p_std_payload->p_path);
+    EXPECT_EQ(nullptr, wire.p_std_payload->p_hash_stream);
+    wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_arena, &wire));
+    EXPECT_EQ((uint32_t)4, wire.session_id);
+    EXPECT_STREQ("next.txt", wire.p_std_payload->p_path);
+
+    // A field running past the payload is refused rather than read from
+    // the next request
+    bytes = make_v2_request(ACT_GET_REMOTE_FILE, 2, "long/path.txt", "");
+    memcpy(&header, bytes.data(), sizeof(header));
+    header.payload_len = htonll(5 + 8 + H_PATH_LEN + 3);
+    memcpy(bytes.data(), &header, sizeof(header));
+    send_all(bytes);
+    arena_reset(p_arena);
+    wire = {};
+    EXPECT_EQ(OP_FAILURE, wire_read_request(&reader, p_arena, &wire));
+}
+
+TEST_F(ServerWireTest, TestSpill)
+{
+    std::filesystem::path spill_dir = std::filesystem::temp_directory_path() / "gtest_wire_spill";
+    std::filesystem::remove_all(spill_dir);
+    std::filesystem::create_directories(spill_dir);
+    verified_path_t * p_spill = f_set_home_dir(spill_dir.c_str(), spill_dir.string().size());
+    ASSERT_NE(nullptr, p_spill);
+    reader.p_spill = p_spill;
+
+    // Data within the budget is read into the arena
+    mem_budget_t * p_mem = mem_init(1 << 20);
+    ASSERT_NE(nullptr, p_mem);
+    arena_t * p_budgeted = arena_init(0, p_mem);
+    ASSERT_NE(nullptr, p_budgeted);
+    std::string small(WIRE_RECV_SIZE * 2, 's');
+    send_all(make_request(ACT_PUT_REMOTE_FILE, 1, "small.bin", small));
+    wire_payload_t wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_budgeted, &wire));
+    EXPECT_EQ(small, std::string((char *)wire.p_std_payload->p_byte_stream, small.size()));
+    mem_stats_t stats = {};
+    mem_stats(p_mem, &stats);
+    EXPECT_LT((uint64_t)small.size(), stats.used);
+    arena_reset(p_budgeted);
+
+    // Data over the budget is spilled to disk and read back the same
+    std::string data((2 << 20) + 7, 'x');
+    data.back() = 'y';
+    send_all(make_request(ACT_PUT_REMOTE_FILE, 2, "big.bin", data));
+    wire = {};
+    ASSERT_EQ(OP_SUCCESS, wire_read_request(&reader, p_budgeted, &wire));
+    std_payload_t * p_std = wire.p_std_payload;
+    ASSERT_EQ(data.size(), p_std->byte_stream_len);
+    EXPECT_EQ(data, std::string((char *)p_std->p_byte_stream, data.size()));
+    EXPECT_STREQ("big.bin", p_std->p_path);
+    mem_stats(p_mem, &stats);
+    EXPECT_EQ((uint64_t)0, stats.used);
+    EXPECT_EQ((uint64_t)1, stats.refused);
+
+    // Data over the spill budget is refused before the temp file is made
+    mem_budget_t * p_spill_mem = mem_init(1 << 20);
+    ASSERT_NE(nullptr, p_spill_mem);
+    reader.p_spill_mem = p_spill_mem;
+    arena_reset(p_budgeted);
+    std::vector<uint8_t> huge = make_request(ACT_PUT_REMOTE_FILE, 3, "huge.bin", data);
+    huge.resize(huge.size() - data.size());
+    send_all(huge);
+    wire = {};
+    EXPECT_EQ(OP_FAILURE, wire_read_request(&reader, p_budgeted, &wire));
+    mem_stats(p_spill_mem, &stats);
+    EXPECT_EQ((uint64_t)0, stats.used);
+    EXPECT_EQ((uint64_t)1, stats.refused);
+
+    // The temp file is unnamed and goes away with the arena
+    EXPECT_TRUE(std::filesystem::is_empty(spill_dir));
+    arena_destroy(&p_budgeted);
+    mem_destroy(&p_mem);
+    mem_destroy(&p_spill_mem);
+    f_destroy_path(&p_spill);
+    std::filesystem::remove_all(spill_dir);
+}
+
+TEST(ServerWireLaneTest, TestLane)
+{
+    // Transfers of file data are bulk, metadata and small writes are not
+    wire_payload_t wire = {};
+    wire.opt_code = ACT_GET_REMOTE_FILE;
+    EXPECT_EQ(IO_LANE_BULK, wire_lane(&wire));
+    wire.opt_code = ACT_GET_SIGNATURE;
+    EXPECT_EQ(IO_LANE_BULK, wire_lane(&wire));
+    wire.opt_code = ACT_LIST_REMOTE_DIRECTORY;
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(&wire));
+    wire.opt_code = ACT_MAKE_REMOTE_DIRECTORY;
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(&wire));
+    wire.opt_code = ACT_USER_OPERATION;
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(&wire));
+
+    wire.opt_code = ACT_PUT_REMOTE_FILE;
+    wire.payload_len = IO_BULK_BYTES - 1;
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(&wire));
+    wire.payload_len = IO_BULK_BYTES;
+    EXPECT_EQ(IO_LANE_BULK, wire_lane(&wire));
+    wire.opt_code = ACT_PUT_DELTA;
+    EXPECT_EQ(IO_LANE_BULK, wire_lane(&wire));
+    wire.opt_code = ACT_PUT_BY_HASH;
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(&wire));
+    EXPECT_EQ(IO_LANE_INTERACTIVE, wire_lane(NULL));
+}